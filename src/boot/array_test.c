@@ -25,6 +25,24 @@
 
 #include "tests.h"
 
+/* Not part of the public API, but linked into the boot executable */
+extern void janet_collect_minor(void);
+
+static int young_collected = 0;
+
+static int young_gc(void *p, size_t len) {
+    (void) p;
+    (void) len;
+    young_collected = 1;
+    return 0;
+}
+
+static const JanetAbstractType young_type = {
+    "test/young",
+    young_gc,
+    JANET_ATEND_GC
+};
+
 int array_test() {
 
     int i;
@@ -62,5 +80,16 @@ int array_test() {
 
     assert(array1->count == 5);
 
+    /* A young value stored directly into an old array survives a minor collection */
+    JanetArray *old = janet_array(1);
+    janet_gcroot(janet_wrap_array(old));
+    janet_collect_minor();
+    janet_gc_write_barrier(old);
+    old->data[0] = janet_wrap_abstract(janet_abstract(&young_type, 1));
+    old->count = 1;
+    janet_collect_minor();
+    assert(!young_collected);
+    janet_gcunroot(janet_wrap_array(old));
+
     return 0;
 }
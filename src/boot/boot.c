@@ -41,6 +41,7 @@ int main(int argc, const char **argv) {
     /* Run tests */
     array_test();
     buffer_test();
+    call_test();
     number_test();
     system_test();
     table_test();
@@ -69,6 +70,9 @@ int main(int argc, const char **argv) {
 #endif
     janet_def(env, "boot/config", janet_wrap_table(opts), "Boot options");
 
+    /* Compile the core library with the bytecode optimizer */
+    janet_setdyn("optimize", janet_wrap_true());
+
     /* Run bootstrap script to generate core image */
     const char *boot_filename;
 #ifdef JANET_NO_SOURCEMAPS
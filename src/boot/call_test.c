@@ -0,0 +1,73 @@
+/*
+* Copyright (c) 2020 Calvin Rose
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#include <janet.h>
+#include <assert.h>
+
+#include "tests.h"
+
+int call_test() {
+
+    JanetTable *env = janet_core_env(NULL);
+    Janet fv, out;
+    janet_dostring(env, "(fn [x &opt y] (if (= x 3) (error \"three\") (if y (+ x y) (+ x 10))))", "call_test", &fv);
+    assert(janet_checktype(fv, JANET_FUNCTION));
+
+    JanetCallContext ctx;
+    janet_call_prepare(&ctx, janet_unwrap_function(fv));
+
+    /* Single calls */
+    Janet args[2] = {janet_wrap_integer(1), janet_wrap_integer(2)};
+    assert(janet_call_invoke(&ctx, 2, args, &out) == JANET_SIGNAL_OK);
+    assert(janet_equals(out, janet_wrap_integer(3)));
+    assert(janet_call_invoke(&ctx, 1, args, &out) == JANET_SIGNAL_OK);
+    assert(janet_equals(out, janet_wrap_integer(11)));
+    assert(janet_call_invoke(&ctx, 0, args, &out) == JANET_SIGNAL_ERROR);
+    assert(janet_call_invoke(&ctx, 1, args, &out) == JANET_SIGNAL_OK);
+
+    /* Batches */
+    JanetArray *batch = janet_array(4);
+    for (int32_t i = 0; i < 3; i++) {
+        Janet item = janet_wrap_integer(i);
+        janet_array_push(batch, janet_wrap_tuple(janet_tuple_n(&item, 1)));
+    }
+    JanetArray *results = janet_array(0);
+    assert(janet_call_batch(&ctx, batch->count, batch->data, results, &out) == JANET_SIGNAL_OK);
+    assert(results->count == 3);
+    assert(janet_equals(results->data[0], janet_wrap_integer(10)));
+    assert(janet_equals(results->data[2], janet_wrap_integer(12)));
+
+    /* A batch stops at the first error */
+    Janet item = janet_wrap_integer(3);
+    janet_array_push(batch, janet_wrap_tuple(janet_tuple_n(&item, 1)));
+    janet_array_push(batch, batch->data[0]);
+    results->count = 0;
+    assert(janet_call_batch(&ctx, batch->count, batch->data, results, &out) == JANET_SIGNAL_ERROR);
+    assert(results->count == 3);
+    assert(janet_equals(out, janet_cstringv("three")));
+    batch->data[0] = janet_wrap_integer(0);
+    assert(janet_call_batch(&ctx, batch->count, batch->data, results, &out) == JANET_SIGNAL_ERROR);
+
+    janet_call_finish(&ctx);
+
+    return 0;
+}
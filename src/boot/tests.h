@@ -4,6 +4,7 @@
 /* Tests */
 extern int array_test();
 extern int buffer_test();
+extern int call_test();
 extern int number_test();
 extern int system_test();
 extern int table_test();
@@ -26,17 +26,25 @@
 /* #define JANET_NO_PROCESSES */
 /* #define JANET_NO_ASSEMBLER */
 /* #define JANET_NO_PEG */
+/* #define JANET_NO_TYPED_ARRAY */
 /* #define JANET_NO_NET */
 /* #define JANET_NO_INT_TYPES */
+/* #define JANET_NO_PERSISTENT */
+/* #define JANET_NO_JSON */
 /* #define JANET_NO_EV */
 /* #define JANET_NO_REALPATH */
 /* #define JANET_NO_SYMLINKS */
 /* #define JANET_NO_UMASK */
+/* #define JANET_INSTRUMENT */
+/* #define JANET_NO_JIT */
+/* #define JANET_TLS */
 
 /* Other settings */
 /* #define JANET_DEBUG */
 /* #define JANET_PRF */
+/* #define JANET_FAST_HASH */
 /* #define JANET_NO_UTC_MKTIME */
+/* #define JANET_NO_SLAB_ALLOCATOR */
 /* #define JANET_OUT_OF_MEMORY do { printf("janet out of memory\n"); exit(1); } while (0) */
 /* #define JANET_EXIT(msg) do { printf("C assert failed executing janet: %s\n", msg); exit(1); } while (0) */
 /* #define JANET_TOP_LEVEL_SIGNAL(msg) call_my_function((msg), stderr) */
@@ -44,9 +52,15 @@
 /* #define JANET_MAX_PROTO_DEPTH 200 */
 /* #define JANET_MAX_MACRO_EXPAND 200 */
 /* #define JANET_STACK_MAX 16384 */
+/* #define JANET_STACK_INITIAL 32 */
+/* #define JANET_FIBER_LOCALS 8 */
 /* #define JANET_OS_NAME my-custom-os */
 /* #define JANET_ARCH_NAME pdp-8 */
 /* #define JANET_EV_EPOLL */
+/* #define JANET_EV_URING */
+/* #define JANET_EV_KQUEUE */
+/* #define JANET_EV_POOL_SIZE 16 */
+/* #define JANET_JIT_THRESHOLD 1000 */
 
 /* Custom vm allocator support */
 /* #include <mimalloc.h> */
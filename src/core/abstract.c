@@ -24,6 +24,7 @@
 #include "features.h"
 #include <janet.h>
 #include "gc.h"
+#include "state.h"
 #endif
 
 /* Create new userdata */
@@ -64,6 +64,8 @@ JanetArray *janet_array_n(const Janet *elements, int32_t n) {
 void janet_array_ensure(JanetArray *array, int32_t capacity, int32_t growth) {
     Janet *newData;
     Janet *old = array->data;
+    /* Callers write new elements after ensuring capacity */
+    janet_gc_barrier(array);
     if (capacity <= array->capacity) return;
     int64_t new_capacity = ((int64_t) capacity) * growth;
     if (new_capacity > INT32_MAX) new_capacity = INT32_MAX;
@@ -145,6 +147,7 @@ static Janet cfun_array_fill(int32_t argc, Janet *argv) {
     janet_arity(argc, 1, 2);
     JanetArray *array = janet_getarray(argv, 0);
     Janet x = (argc == 2) ? argv[1] : janet_wrap_nil();
+    janet_gc_barrier(array);
     for (int32_t i = 0; i < array->count; i++) {
         array->data[i] = x;
     }
@@ -297,6 +300,188 @@ static Janet cfun_array_clear(int32_t argc, Janet *argv) {
     return argv[0];
 }
 
+/* Sorting */
+
+typedef struct {
+    JanetArray *array;
+    Janet *data;
+    int32_t count;
+    JanetFunction *fun;
+    JanetCFunction cfun;
+} JanetSortContext;
+
+/* Sorts up to this length use insertion sort */
+#define JANET_SORT_SMALL 16
+
+static int sort_before(JanetSortContext *ctx, Janet x, Janet y) {
+    if (NULL == ctx->fun && NULL == ctx->cfun) {
+        /* Same as < */
+        if (janet_checktype(x, JANET_NUMBER) && janet_checktype(y, JANET_NUMBER)) {
+            return janet_unwrap_number(x) < janet_unwrap_number(y);
+        }
+        return janet_compare(x, y) < 0;
+    }
+    Janet args[2] = {x, y};
+    Janet result = NULL != ctx->fun
+                   ? janet_call(ctx->fun, 2, args)
+                   : ctx->cfun(2, args);
+    /* The comparator can do anything, including resizing the array. */
+    if (ctx->array->data != ctx->data || ctx->array->count != ctx->count) {
+        janet_panic("array was modified during sort");
+    }
+    return janet_truthy(result);
+}
+
+static void sort_insertion(JanetSortContext *ctx, Janet *a, int32_t n) {
+    for (int32_t i = 1; i < n; i++) {
+        Janet x = a[i];
+        int32_t j = i;
+        while (j > 0 && sort_before(ctx, x, a[j - 1])) {
+            a[j] = a[j - 1];
+            j--;
+        }
+        a[j] = x;
+    }
+}
+
+static void sort_siftdown(JanetSortContext *ctx, Janet *a, int32_t root, int32_t n) {
+    for (;;) {
+        int32_t child = 2 * root + 1;
+        if (child >= n) break;
+        if (child + 1 < n && sort_before(ctx, a[child], a[child + 1])) child++;
+        if (!sort_before(ctx, a[root], a[child])) break;
+        Janet tmp = a[root];
+        a[root] = a[child];
+        a[child] = tmp;
+        root = child;
+    }
+}
+
+static void sort_heap(JanetSortContext *ctx, Janet *a, int32_t n) {
+    for (int32_t i = n / 2 - 1; i >= 0; i--) sort_siftdown(ctx, a, i, n);
+    for (int32_t i = n - 1; i > 0; i--) {
+        Janet tmp = a[0];
+        a[0] = a[i];
+        a[i] = tmp;
+        sort_siftdown(ctx, a, 0, i);
+    }
+}
+
+/* Introsort - quicksort with a median of three pivot that falls back to
+ * heapsort when partitioning goes badly, so the worst case is O(n log n).
+ * The partition loops are bounds checked so a comparator that is not a
+ * strict weak ordering gives a wrong order instead of reading out of range. */
+static void sort_intro(JanetSortContext *ctx, Janet *a, int32_t n, int32_t depth) {
+    while (n > JANET_SORT_SMALL) {
+        if (depth-- == 0) {
+            sort_heap(ctx, a, n);
+            return;
+        }
+        int32_t lo = 0, hi = n - 1, mid = lo + (hi - lo) / 2;
+        if (sort_before(ctx, a[mid], a[lo])) {
+            Janet tmp = a[mid];
+            a[mid] = a[lo];
+            a[lo] = tmp;
+        }
+        if (sort_before(ctx, a[hi], a[mid])) {
+            Janet tmp = a[hi];
+            a[hi] = a[mid];
+            a[mid] = tmp;
+            if (sort_before(ctx, a[mid], a[lo])) {
+                tmp = a[mid];
+                a[mid] = a[lo];
+                a[lo] = tmp;
+            }
+        }
+        Janet pivot = a[mid];
+        int32_t i = lo, j = hi;
+        while (i <= j) {
+            while (i < hi && sort_before(ctx, a[i], pivot)) i++;
+            while (j > lo && sort_before(ctx, pivot, a[j])) j--;
+            if (i <= j) {
+                Janet tmp = a[i];
+                a[i] = a[j];
+                a[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        /* Recurse into the smaller side and loop on the larger one */
+        if (j + 1 < n - i) {
+            sort_intro(ctx, a, j + 1, depth);
+            a += i;
+            n -= i;
+        } else {
+            sort_intro(ctx, a + i, n - i, depth);
+            n = j + 1;
+        }
+    }
+    sort_insertion(ctx, a, n);
+}
+
+/* Top down merge sort. Only the left run is copied out, into tmp, before
+ * merging it back with the right run. */
+static void sort_merge(JanetSortContext *ctx, Janet *a, int32_t n, Janet *tmp) {
+    if (n <= JANET_SORT_SMALL) {
+        sort_insertion(ctx, a, n);
+        return;
+    }
+    int32_t mid = n / 2;
+    sort_merge(ctx, a, mid, tmp);
+    sort_merge(ctx, a + mid, n - mid, tmp);
+    if (!sort_before(ctx, a[mid], a[mid - 1])) return;
+    memcpy(tmp, a, mid * sizeof(Janet));
+    int32_t i = 0, j = mid, k = 0;
+    while (i < mid && j < n) {
+        if (sort_before(ctx, a[j], tmp[i])) {
+            a[k++] = a[j++];
+        } else {
+            a[k++] = tmp[i++];
+        }
+    }
+    while (i < mid) a[k++] = tmp[i++];
+}
+
+static JanetArray *sort_init(JanetSortContext *ctx, int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    JanetArray *array = janet_getarray(argv, 0);
+    ctx->array = array;
+    ctx->data = array->data;
+    ctx->count = array->count;
+    ctx->fun = NULL;
+    ctx->cfun = NULL;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        if (janet_checktype(argv[1], JANET_CFUNCTION)) {
+            ctx->cfun = janet_unwrap_cfunction(argv[1]);
+        } else {
+            ctx->fun = janet_getfunction(argv, 1);
+        }
+    }
+    return array;
+}
+
+static Janet cfun_array_sort(int32_t argc, Janet *argv) {
+    JanetSortContext ctx;
+    JanetArray *array = sort_init(&ctx, argc, argv);
+    int32_t depth = 0;
+    for (int32_t n = array->count; n > 1; n >>= 1) depth += 2;
+    sort_intro(&ctx, array->data, array->count, depth);
+    return janet_wrap_array(array);
+}
+
+static Janet cfun_array_sort_stable(int32_t argc, Janet *argv) {
+    JanetSortContext ctx;
+    JanetArray *array = sort_init(&ctx, argc, argv);
+    if (array->count <= JANET_SORT_SMALL) {
+        sort_insertion(&ctx, array->data, array->count);
+    } else {
+        Janet *tmp = janet_smalloc((size_t)(array->count / 2) * sizeof(Janet));
+        sort_merge(&ctx, array->data, array->count, tmp);
+        janet_sfree(tmp);
+    }
+    return janet_wrap_array(array);
+}
+
 static const JanetReg array_cfuns[] = {
     {
         "array/new", cfun_array_new,
@@ -383,6 +568,20 @@ static const JanetReg array_cfuns[] = {
              "Empties an array, setting it's count to 0 but does not free the backing capacity. "
              "Returns the modified array.")
     },
+    {
+        "array/sort", cfun_array_sort,
+        JDOC("(array/sort arr &opt before?)\n\n"
+             "Sort an array in place with introsort and return it. The sort is not stable. "
+             "If a before? comparator function is provided, sorts elements using that, "
+             "otherwise uses <.")
+    },
+    {
+        "array/sort-stable", cfun_array_sort_stable,
+        JDOC("(array/sort-stable arr &opt before?)\n\n"
+             "Sort an array in place with merge sort and return it. Elements that compare "
+             "equal keep their relative order. If a before? comparator function is provided, "
+             "sorts elements using that, otherwise uses <.")
+    },
     {NULL, NULL, NULL}
 };
 
@@ -66,6 +66,8 @@ struct JanetAssembler {
 static const JanetInstructionDef janet_ops[] = {
     {"add", JOP_ADD},
     {"addim", JOP_ADD_IMMEDIATE},
+    {"addimj", JOP_ADD_IMMEDIATE_JUMP},
+    {"addn", JOP_ADD_NUMBER},
     {"band", JOP_BAND},
     {"bnot", JOP_BNOT},
     {"bor", JOP_BOR},
@@ -76,6 +78,7 @@ static const JanetInstructionDef janet_ops[] = {
     {"cncl", JOP_CANCEL},
     {"div", JOP_DIVIDE},
     {"divim", JOP_DIVIDE_IMMEDIATE},
+    {"divn", JOP_DIVIDE_NUMBER},
     {"eq", JOP_EQUALS},
     {"eqim", JOP_EQUALS_IMMEDIATE},
     {"err", JOP_ERROR},
@@ -83,7 +86,10 @@ static const JanetInstructionDef janet_ops[] = {
     {"geti", JOP_GET_INDEX},
     {"gt", JOP_GREATER_THAN},
     {"gte", JOP_GREATER_THAN_EQUAL},
+    {"gtej", JOP_GREATER_THAN_EQUAL_JUMP},
     {"gtim", JOP_GREATER_THAN_IMMEDIATE},
+    {"gtimj", JOP_GREATER_THAN_IMMEDIATE_JUMP},
+    {"gtj", JOP_GREATER_THAN_JUMP},
     {"in", JOP_IN},
     {"jmp", JOP_JUMP},
     {"jmpif", JOP_JUMP_IF},
@@ -100,7 +106,10 @@ static const JanetInstructionDef janet_ops[] = {
     {"len", JOP_LENGTH},
     {"lt", JOP_LESS_THAN},
     {"lte", JOP_LESS_THAN_EQUAL},
+    {"ltej", JOP_LESS_THAN_EQUAL_JUMP},
     {"ltim", JOP_LESS_THAN_IMMEDIATE},
+    {"ltimj", JOP_LESS_THAN_IMMEDIATE_JUMP},
+    {"ltj", JOP_LESS_THAN_JUMP},
     {"mkarr", JOP_MAKE_ARRAY},
     {"mkbtp", JOP_MAKE_BRACKET_TUPLE},
     {"mkbuf", JOP_MAKE_BUFFER},
@@ -113,6 +122,7 @@ static const JanetInstructionDef janet_ops[] = {
     {"movn", JOP_MOVE_NEAR},
     {"mul", JOP_MULTIPLY},
     {"mulim", JOP_MULTIPLY_IMMEDIATE},
+    {"muln", JOP_MULTIPLY_NUMBER},
     {"neq", JOP_NOT_EQUALS},
     {"neqim", JOP_NOT_EQUALS_IMMEDIATE},
     {"next", JOP_NEXT},
@@ -137,6 +147,7 @@ static const JanetInstructionDef janet_ops[] = {
     {"sru", JOP_SHIFT_RIGHT_UNSIGNED},
     {"sruim", JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE},
     {"sub", JOP_SUBTRACT},
+    {"subn", JOP_SUBTRACT_NUMBER},
     {"tcall", JOP_TAILCALL},
     {"tchck", JOP_TYPECHECK}
 };
@@ -720,6 +731,7 @@ static JanetAssembleResult janet_asm1(JanetAssembler *parent, Janet source, int
     if (janet_verify(def)) {
         janet_asm_error(&a, "invalid assembly");
     }
+    janet_bytecode_specialize(def);
 
     /* Add final flags */
     janet_def_addflags(def);
@@ -926,6 +938,7 @@ static Janet janet_disasm_defs(JanetFuncDef *def) {
 }
 
 Janet janet_disasm(JanetFuncDef *def) {
+    if (def->flags & JANET_FUNCDEF_FLAG_LAZY) janet_def_materialize(def);
     JanetTable *ret = janet_table(10);
     janet_table_put(ret, janet_ckeywordv("arity"), janet_disasm_arity(def));
     janet_table_put(ret, janet_ckeywordv("min-arity"), janet_disasm_min_arity(def));
@@ -956,6 +969,7 @@ static Janet cfun_asm(int32_t argc, Janet *argv) {
 static Janet cfun_disasm(int32_t argc, Janet *argv) {
     janet_arity(argc, 1, 2);
     JanetFunction *f = janet_getfunction(argv, 0);
+    if (f->def->flags & JANET_FUNCDEF_FLAG_LAZY) janet_def_materialize(f->def);
     if (argc == 2) {
         JanetKeyword kw = janet_getkeyword(argv, 1);
         if (!janet_cstrcmp(kw, "arity")) return janet_disasm_arity(f->def);
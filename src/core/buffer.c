@@ -54,6 +54,67 @@ JanetBuffer *janet_buffer(int32_t capacity) {
     return janet_buffer_init(buffer, capacity);
 }
 
+/* Recycled buffers, kept per thread in power of two size classes from
+ * 64 bytes to 64 KiB. janet_vm_buffer_pool holds one array of free
+ * buffers per class, and is rooted the first time a buffer is released. */
+#define JANET_BUFFER_POOL_MINBITS 6
+#define JANET_BUFFER_POOL_CLASSES 11
+#define JANET_BUFFER_POOL_DEPTH 32
+#define JANET_BUFFER_POOL_READ 4096
+#define JANET_BUFFER_FLAG_POOLED 0x10000
+
+JANET_THREAD_LOCAL JanetArray *janet_vm_buffer_pool = NULL;
+
+/* Take an empty buffer with room for at least capacity bytes from the pool */
+JanetBuffer *janet_buffer_pooled(int32_t capacity) {
+    int c = 0;
+    while (c < JANET_BUFFER_POOL_CLASSES && (1 << (c + JANET_BUFFER_POOL_MINBITS)) < capacity) c++;
+    if (c == JANET_BUFFER_POOL_CLASSES) return janet_buffer(capacity);
+    if (NULL != janet_vm_buffer_pool) {
+        JanetArray *free = janet_unwrap_array(janet_vm_buffer_pool->data[c]);
+        if (free->count > 0) {
+            JanetBuffer *buffer = janet_unwrap_buffer(free->data[--free->count]);
+            buffer->gc.flags &= ~JANET_BUFFER_FLAG_POOLED;
+            return buffer;
+        }
+    }
+    return janet_buffer(1 << (c + JANET_BUFFER_POOL_MINBITS));
+}
+
+/* Give a buffer back to the pool. It is emptied, and must not be used
+ * again by the caller. Buffers too small or too big for any size class,
+ * or that do not fit in a full class, are left to the garbage collector. */
+void janet_buffer_release(JanetBuffer *buffer) {
+    buffer->count = 0;
+    if (buffer->gc.flags & JANET_BUFFER_FLAG_POOLED) return;
+    int c = -1;
+    while (c + 1 < JANET_BUFFER_POOL_CLASSES &&
+            (1 << (c + 1 + JANET_BUFFER_POOL_MINBITS)) <= buffer->capacity) c++;
+    if (c < 0 || buffer->capacity >= (2 << (JANET_BUFFER_POOL_CLASSES - 1 + JANET_BUFFER_POOL_MINBITS))) return;
+    if (NULL == janet_vm_buffer_pool) {
+        janet_vm_buffer_pool = janet_array(JANET_BUFFER_POOL_CLASSES);
+        janet_gcroot(janet_wrap_array(janet_vm_buffer_pool));
+        for (int i = 0; i < JANET_BUFFER_POOL_CLASSES; i++) {
+            janet_array_push(janet_vm_buffer_pool, janet_wrap_array(janet_array(0)));
+        }
+    }
+    JanetArray *free = janet_unwrap_array(janet_vm_buffer_pool->data[c]);
+    if (free->count >= JANET_BUFFER_POOL_DEPTH) return;
+    buffer->gc.flags |= JANET_BUFFER_FLAG_POOLED;
+    janet_array_push(free, janet_wrap_buffer(buffer));
+}
+
+/* Like janet_optbuffer, but a missing buffer comes from the pool. Used by the
+ * event loop read functions, where size is the byte count or :all asked for. */
+JanetBuffer *janet_optbuffer_pooled(const Janet *argv, int32_t argc, int32_t n, Janet size) {
+    if (argc <= n || janet_checktype(argv[n], JANET_NIL)) {
+        int32_t len = JANET_BUFFER_POOL_READ;
+        if (janet_checkint(size) && janet_unwrap_integer(size) < len) len = janet_unwrap_integer(size);
+        return janet_buffer_pooled(len);
+    }
+    return janet_getbuffer(argv, n);
+}
+
 /* Ensure that the buffer has enough internal capacity */
 void janet_buffer_ensure(JanetBuffer *buffer, int32_t capacity, int32_t growth) {
     uint8_t *new_data;
@@ -277,6 +338,18 @@ static Janet cfun_buffer_clear(int32_t argc, Janet *argv) {
     return argv[0];
 }
 
+static Janet cfun_buffer_pool(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    int32_t capacity = janet_optnat(argv, argc, 0, 64);
+    return janet_wrap_buffer(janet_buffer_pooled(capacity));
+}
+
+static Janet cfun_buffer_release(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    janet_buffer_release(janet_getbuffer(argv, 0));
+    return janet_wrap_nil();
+}
+
 static Janet cfun_buffer_popn(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 2);
     JanetBuffer *buffer = janet_getbuffer(argv, 0);
@@ -389,8 +462,7 @@ static Janet cfun_buffer_blit(int32_t argc, Janet *argv) {
 static Janet cfun_buffer_format(int32_t argc, Janet *argv) {
     janet_arity(argc, 2, -1);
     JanetBuffer *buffer = janet_getbuffer(argv, 0);
-    const char *strfrmt = (const char *) janet_getstring(argv, 1);
-    janet_buffer_format(buffer, strfrmt, 1, argc, argv);
+    janet_buffer_format_arg(buffer, 1, argc, argv);
     return argv[0];
 }
 
@@ -460,6 +532,21 @@ static const JanetReg buffer_cfuns[] = {
              "Sets the size of a buffer to 0 and empties it. The buffer retains "
              "its memory so it can be efficiently refilled. Returns the modified buffer.")
     },
+    {
+        "buffer/pool", cfun_buffer_pool,
+        JDOC("(buffer/pool &opt capacity)\n\n"
+             "Take an empty buffer with room for at least `capacity` bytes (default 64) from the "
+             "per-thread pool of released buffers, or make a new one if there is none of that size. "
+             "ev/read, net/read and the other stream read functions draw from the same pool when "
+             "they are not given a buffer. Returns the buffer.")
+    },
+    {
+        "buffer/release", cfun_buffer_release,
+        JDOC("(buffer/release buffer)\n\n"
+             "Empty a buffer and give it back to the per-thread buffer pool, so that a later "
+             "buffer/pool or stream read can reuse its memory. The buffer must not be used "
+             "after it is released. Returns nil.")
+    },
     {
         "buffer/slice", cfun_buffer_slice,
         JDOC("(buffer/slice bytes &opt start end)\n\n"
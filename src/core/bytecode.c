@@ -103,7 +103,18 @@ enum JanetInstructionType janet_instructions[JOP_INSTRUCTION_COUNT] = {
     JINT_SSS, /* JOP_NEXT */
     JINT_SSS, /* JOP_NOT_EQUALS, */
     JINT_SSI, /* JOP_NOT_EQUALS_IMMEDIATE, */
-    JINT_SSS /* JOP_CANCEL, */
+    JINT_SSS, /* JOP_CANCEL, */
+    JINT_SSS, /* JOP_LESS_THAN_JUMP, */
+    JINT_SSI, /* JOP_LESS_THAN_IMMEDIATE_JUMP, */
+    JINT_SSS, /* JOP_LESS_THAN_EQUAL_JUMP, */
+    JINT_SSS, /* JOP_GREATER_THAN_JUMP, */
+    JINT_SSI, /* JOP_GREATER_THAN_IMMEDIATE_JUMP, */
+    JINT_SSS, /* JOP_GREATER_THAN_EQUAL_JUMP, */
+    JINT_SSI, /* JOP_ADD_IMMEDIATE_JUMP, */
+    JINT_SSS, /* JOP_ADD_NUMBER, */
+    JINT_SSS, /* JOP_SUBTRACT_NUMBER, */
+    JINT_SSS, /* JOP_MULTIPLY_NUMBER, */
+    JINT_SSS /* JOP_DIVIDE_NUMBER, */
 };
 
 /* Verify some bytecode */
@@ -208,6 +219,580 @@ int janet_verify(JanetFuncDef *def) {
     return 0;
 }
 
+/* Operand fields of an instruction that name slots */
+#define JANET_FIELD_NONE 0
+#define JANET_FIELD_A 1 /* 8 bits at bit 8 */
+#define JANET_FIELD_B 2 /* 8 bits at bit 16 */
+#define JANET_FIELD_C 3 /* 8 bits at bit 24 */
+#define JANET_FIELD_D 4 /* 24 bits at bit 8 */
+#define JANET_FIELD_E 5 /* 16 bits at bit 16 */
+
+/* The slots an instruction reads and the slot it writes, if any. The
+ * analyses below depend on the reads being complete. No instruction
+ * writes more than one slot. */
+typedef struct {
+    uint8_t write;
+    uint8_t reads[3];
+} JanetSlotFields;
+
+static JanetSlotFields janet_slot_fields(uint32_t instr) {
+    JanetSlotFields f = {JANET_FIELD_NONE, {JANET_FIELD_NONE, JANET_FIELD_NONE, JANET_FIELD_NONE}};
+    uint8_t op = instr & 0xFF;
+    if (op >= JOP_INSTRUCTION_COUNT) return f;
+    switch (op) {
+        case JOP_ERROR:
+        case JOP_TYPECHECK:
+        case JOP_SET_UPVALUE:
+            f.reads[0] = JANET_FIELD_A;
+            return f;
+        case JOP_RETURN:
+        case JOP_PUSH:
+        case JOP_PUSH_ARRAY:
+        case JOP_TAILCALL:
+            f.reads[0] = JANET_FIELD_D;
+            return f;
+        case JOP_MOVE_FAR:
+            f.write = JANET_FIELD_E;
+            f.reads[0] = JANET_FIELD_A;
+            return f;
+        case JOP_PUSH_2:
+            f.reads[0] = JANET_FIELD_A;
+            f.reads[1] = JANET_FIELD_E;
+            return f;
+        case JOP_PUSH_3:
+        case JOP_PUT:
+            f.reads[0] = JANET_FIELD_A;
+            f.reads[1] = JANET_FIELD_B;
+            f.reads[2] = JANET_FIELD_C;
+            return f;
+        case JOP_PUT_INDEX:
+            f.reads[0] = JANET_FIELD_A;
+            f.reads[1] = JANET_FIELD_B;
+            return f;
+        default:
+            break;
+    }
+    switch (janet_instructions[op]) {
+        case JINT_0:
+        case JINT_L:
+            break;
+        case JINT_SL:
+        case JINT_ST:
+            f.reads[0] = JANET_FIELD_A;
+            break;
+        case JINT_S:
+            f.write = JANET_FIELD_D;
+            break;
+        case JINT_SI:
+        case JINT_SU:
+        case JINT_SC:
+        case JINT_SD:
+        case JINT_SES:
+            f.write = JANET_FIELD_A;
+            break;
+        case JINT_SS:
+            f.write = JANET_FIELD_A;
+            f.reads[0] = JANET_FIELD_E;
+            break;
+        case JINT_SSI:
+        case JINT_SSU:
+            f.write = JANET_FIELD_A;
+            f.reads[0] = JANET_FIELD_B;
+            break;
+        case JINT_SSS:
+            f.write = JANET_FIELD_A;
+            f.reads[0] = JANET_FIELD_B;
+            f.reads[1] = JANET_FIELD_C;
+            break;
+    }
+    return f;
+}
+
+static int32_t janet_field_get(uint32_t instr, uint8_t field) {
+    switch (field) {
+        default:
+            return -1;
+        case JANET_FIELD_A:
+            return (instr >> 8) & 0xFF;
+        case JANET_FIELD_B:
+            return (instr >> 16) & 0xFF;
+        case JANET_FIELD_C:
+            return instr >> 24;
+        case JANET_FIELD_D:
+            return instr >> 8;
+        case JANET_FIELD_E:
+            return instr >> 16;
+    }
+}
+
+/* Returns 0 if the slot does not fit in the field */
+static int janet_field_set(uint32_t *instr, uint8_t field, int32_t slot) {
+    switch (field) {
+        default:
+            return 0;
+        case JANET_FIELD_A:
+            if (slot > 0xFF) return 0;
+            *instr = (*instr & ~0xFF00u) | ((uint32_t) slot << 8);
+            return 1;
+        case JANET_FIELD_B:
+            if (slot > 0xFF) return 0;
+            *instr = (*instr & ~0xFF0000u) | ((uint32_t) slot << 16);
+            return 1;
+        case JANET_FIELD_C:
+            if (slot > 0xFF) return 0;
+            *instr = (*instr & 0xFFFFFFu) | ((uint32_t) slot << 24);
+            return 1;
+        case JANET_FIELD_D:
+            if (slot > 0xFFFFFF) return 0;
+            *instr = (*instr & 0xFFu) | ((uint32_t) slot << 8);
+            return 1;
+        case JANET_FIELD_E:
+            if (slot > 0xFFFF) return 0;
+            *instr = (*instr & 0xFFFFu) | ((uint32_t) slot << 16);
+            return 1;
+    }
+}
+
+/* Arithmetic instructions and the versions of them that skip type checks */
+static const uint8_t janet_number_ops[][2] = {
+    {JOP_ADD, JOP_ADD_NUMBER},
+    {JOP_SUBTRACT, JOP_SUBTRACT_NUMBER},
+    {JOP_MULTIPLY, JOP_MULTIPLY_NUMBER},
+    {JOP_DIVIDE, JOP_DIVIDE_NUMBER}
+};
+
+/* Give up on functions where the analysis would need too much memory */
+#define JANET_ANALYSIS_MAX_WORDS (1 << 20)
+
+static int number_op_index(uint32_t instr) {
+    for (int k = 0; k < (int)(sizeof(janet_number_ops) / sizeof(janet_number_ops[0])); k++) {
+        if ((instr & 0xFF) == janet_number_ops[k][0] || (instr & 0xFF) == janet_number_ops[k][1])
+            return k;
+    }
+    return -1;
+}
+
+static int number_test(const uint32_t *set, int32_t sc, int32_t slot) {
+    return slot < sc && (set[slot >> 5] & (1u << (slot & 31)));
+}
+
+static void number_set(uint32_t *set, int32_t sc, int32_t slot, int num) {
+    if (slot >= sc) return;
+    if (num) {
+        set[slot >> 5] |= 1u << (slot & 31);
+    } else {
+        set[slot >> 5] &= ~(1u << (slot & 31));
+    }
+}
+
+/* Update the set of slots known to hold numbers after an instruction */
+static void number_transfer(JanetFuncDef *def, uint32_t instr, uint32_t *set) {
+    int32_t sc = def->slotcount;
+    int32_t b = (instr >> 16) & 0xFF;
+    int32_t c = instr >> 24;
+    int32_t e = instr >> 16;
+    int num = 0;
+    switch (instr & 0xFF) {
+        default:
+            break;
+        case JOP_MOVE_FAR:
+            num = number_test(set, sc, (instr >> 8) & 0xFF);
+            break;
+        case JOP_MOVE_NEAR:
+            num = number_test(set, sc, e);
+            break;
+        case JOP_LOAD_INTEGER:
+        case JOP_BNOT:
+            num = 1;
+            break;
+        case JOP_LOAD_CONSTANT:
+            num = e < def->constants_length && janet_checktype(def->constants[e], JANET_NUMBER);
+            break;
+        case JOP_ADD_IMMEDIATE:
+        case JOP_ADD_IMMEDIATE_JUMP:
+        case JOP_MULTIPLY_IMMEDIATE:
+        case JOP_DIVIDE_IMMEDIATE:
+        case JOP_SHIFT_LEFT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE:
+            num = number_test(set, sc, b);
+            break;
+        case JOP_ADD:
+        case JOP_SUBTRACT:
+        case JOP_MULTIPLY:
+        case JOP_DIVIDE:
+        case JOP_ADD_NUMBER:
+        case JOP_SUBTRACT_NUMBER:
+        case JOP_MULTIPLY_NUMBER:
+        case JOP_DIVIDE_NUMBER:
+        case JOP_MODULO:
+        case JOP_REMAINDER:
+        case JOP_BAND:
+        case JOP_BOR:
+        case JOP_BXOR:
+        case JOP_SHIFT_LEFT:
+        case JOP_SHIFT_RIGHT:
+        case JOP_SHIFT_RIGHT_UNSIGNED:
+            num = number_test(set, sc, b) && number_test(set, sc, c);
+            break;
+    }
+    int32_t w = janet_field_get(instr, janet_slot_fields(instr).write);
+    if (w >= 0) number_set(set, sc, w, num);
+}
+
+/* Get the instructions that can run after the instruction at i */
+static int janet_successors(uint32_t instr, int32_t i, int32_t *succ) {
+    switch (instr & 0xFF) {
+        default:
+            succ[0] = i + 1;
+            return 1;
+        case JOP_JUMP:
+            succ[0] = i + (((int32_t) instr) >> 8);
+            return 1;
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+            succ[0] = i + 1;
+            succ[1] = i + (((int32_t) instr) >> 16);
+            return 2;
+        case JOP_RETURN:
+        case JOP_RETURN_NIL:
+        case JOP_ERROR:
+        case JOP_TAILCALL:
+            return 0;
+    }
+}
+
+/* Use the number versions of arithmetic instructions when both operands
+ * hold numbers on every path to the instruction. This is a forward dataflow
+ * analysis over the slots of the function. Instructions that can not be
+ * proven safe get the generic opcode back, so this also acts as the guard
+ * for bytecode from the assembler or from unmarshalling, and leaves
+ * bytecode that is already correct untouched. */
+void janet_bytecode_specialize(JanetFuncDef *def) {
+    int32_t count = def->bytecode_length;
+    int32_t sc = def->slotcount;
+    int32_t words = (sc + 31) >> 5;
+    int32_t i;
+    int candidates = 0;
+    int closures = 0;
+    uint32_t *states = NULL;
+    for (i = 0; i < count; i++) {
+        if (number_op_index(def->bytecode[i]) >= 0) candidates = 1;
+        if ((def->bytecode[i] & 0xFF) == JOP_CLOSURE) closures = 1;
+    }
+    if (!candidates) return;
+
+    /* Closures can change the slots of the function that created them
+     * while it is running, so only look at functions without them. */
+    if (!closures && !(def->flags & JANET_FUNCDEF_FLAG_NEEDSENV) && words > 0 &&
+            (size_t) count * (size_t) words <= JANET_ANALYSIS_MAX_WORDS) {
+        size_t size = sizeof(uint32_t) * (size_t) words;
+        states = janet_malloc(size * (size_t) (count + 1));
+        if (NULL == states) {
+            JANET_OUT_OF_MEMORY;
+        }
+        /* The set at index count is scratch space. Nothing is known at
+         * the entry point, and everything is assumed elsewhere until shown
+         * otherwise. */
+        uint32_t *out = states + (size_t) count * words;
+        memset(states, 0xFF, size * (size_t) count);
+        memset(states, 0, size);
+        int changed = 1;
+        while (changed) {
+            changed = 0;
+            for (i = 0; i < count; i++) {
+                int32_t succ[2];
+                uint32_t instr = def->bytecode[i];
+                memcpy(out, states + (size_t) i * words, size);
+                number_transfer(def, instr, out);
+                int nsucc = janet_successors(instr, i, succ);
+                for (int j = 0; j < nsucc; j++) {
+                    if (succ[j] < 0 || succ[j] >= count) continue;
+                    uint32_t *in = states + (size_t) succ[j] * words;
+                    for (int32_t w = 0; w < words; w++) {
+                        uint32_t meet = in[w] & out[w];
+                        if (meet != in[w]) {
+                            in[w] = meet;
+                            changed = 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        uint32_t instr = def->bytecode[i];
+        int k = number_op_index(instr);
+        if (k < 0) continue;
+        int num = NULL != states &&
+                  number_test(states + (size_t) i * words, sc, (instr >> 16) & 0xFF) &&
+                  number_test(states + (size_t) i * words, sc, instr >> 24);
+        uint32_t specialized = (instr & ~0xFFu) | janet_number_ops[k][num];
+        /* Do not write to bytecode that does not change, it may be mapped */
+        if (specialized != instr) def->bytecode[i] = specialized;
+    }
+    janet_free(states);
+}
+
+/* Bytecode optimizer, used by the compiler when the :optimize dynamic
+ * binding is set. Each round threads jumps, then removes unreachable code,
+ * stores of side effect free instructions that are never read, and moves
+ * that can be folded into the instruction before or after them. Unlike
+ * specialization, this changes what a debugger sees in a stack frame. */
+
+#define JANET_OPT_REACHABLE 1
+#define JANET_OPT_TARGET 2
+#define JANET_OPT_REMOVE 4
+#define JANET_OPT_TOUCHED 8
+
+static int32_t jump_target(uint32_t instr, int32_t i) {
+    switch (instr & 0xFF) {
+        default:
+            return -1;
+        case JOP_JUMP:
+            return i + (((int32_t) instr) >> 8);
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+            return i + (((int32_t) instr) >> 16);
+    }
+}
+
+/* Returns 0 if the offset does not fit in the instruction */
+static int set_jump_target(uint32_t *instr, int32_t i, int32_t target) {
+    int32_t offset = target - i;
+    if ((*instr & 0xFF) == JOP_JUMP) {
+        if (offset < -0x800000 || offset > 0x7FFFFF) return 0;
+        *instr = (*instr & 0xFFu) | ((uint32_t) offset << 8);
+    } else {
+        if (offset < -0x8000 || offset > 0x7FFF) return 0;
+        *instr = (*instr & 0xFFFFu) | ((uint32_t) offset << 16);
+    }
+    return 1;
+}
+
+/* Instructions that can be removed if the slot they write is never read */
+static int is_pure(uint32_t instr) {
+    switch (instr & 0xFF) {
+        default:
+            return 0;
+        case JOP_LOAD_NIL:
+        case JOP_LOAD_TRUE:
+        case JOP_LOAD_FALSE:
+        case JOP_LOAD_INTEGER:
+        case JOP_LOAD_CONSTANT:
+        case JOP_LOAD_SELF:
+        case JOP_LOAD_UPVALUE:
+        case JOP_MOVE_NEAR:
+        case JOP_MOVE_FAR:
+        case JOP_CLOSURE:
+            return 1;
+    }
+}
+
+static int slot_in(const uint32_t *set, int32_t slot) {
+    return set[slot >> 5] & (1u << (slot & 31));
+}
+
+/* Slots live after instruction i, including slots closures can see */
+static void live_out(JanetFuncDef *def, const uint32_t *live, const uint32_t *always,
+                     int32_t words, int32_t i, uint32_t *out) {
+    int32_t succ[2];
+    int nsucc = janet_successors(def->bytecode[i], i, succ);
+    for (int32_t w = 0; w < words; w++) out[w] = always[w];
+    for (int j = 0; j < nsucc; j++) {
+        if (succ[j] < 0 || succ[j] >= def->bytecode_length) continue;
+        const uint32_t *in = live + (size_t) succ[j] * words;
+        for (int32_t w = 0; w < words; w++) out[w] |= in[w];
+    }
+}
+
+static int optimize_round(JanetFuncDef *def) {
+    uint32_t *bc = def->bytecode;
+    int32_t count = def->bytecode_length;
+    int32_t sc = def->slotcount;
+    int32_t words = (sc + 31) >> 5;
+    int changed = 0;
+    int removed = 0;
+    int32_t i, j;
+
+    /* Thread jumps to jumps, and turn jumps to returns into returns */
+    for (i = 0; i < count; i++) {
+        int32_t target = jump_target(bc[i], i);
+        if (target < 0 || target >= count) continue;
+        int32_t final = target;
+        for (int hops = 0; hops < 8 && (bc[final] & 0xFF) == JOP_JUMP; hops++) {
+            int32_t next = final + (((int32_t) bc[final]) >> 8);
+            if (next < 0 || next >= count || next == final) break;
+            final = next;
+        }
+        uint8_t finalop = bc[final] & 0xFF;
+        if ((bc[i] & 0xFF) == JOP_JUMP && (finalop == JOP_RETURN || finalop == JOP_RETURN_NIL)) {
+            bc[i] = bc[final];
+            changed = 1;
+        } else if (final != target && set_jump_target(bc + i, i, final)) {
+            changed = 1;
+        }
+    }
+
+    /* Find reachable instructions and jump targets */
+    uint8_t *info = janet_calloc((size_t) count, 1);
+    int32_t *work = janet_malloc(sizeof(int32_t) * (size_t) count);
+    if (NULL == info || NULL == work) {
+        JANET_OUT_OF_MEMORY;
+    }
+    int32_t nwork = 0;
+    info[0] = JANET_OPT_REACHABLE;
+    work[nwork++] = 0;
+    while (nwork) {
+        int32_t succ[2];
+        i = work[--nwork];
+        int nsucc = janet_successors(bc[i], i, succ);
+        for (j = 0; j < nsucc; j++) {
+            if (succ[j] < 0 || succ[j] >= count) continue;
+            if (succ[j] != i + 1) info[succ[j]] |= JANET_OPT_TARGET;
+            if (!(info[succ[j]] & JANET_OPT_REACHABLE)) {
+                info[succ[j]] |= JANET_OPT_REACHABLE;
+                work[nwork++] = succ[j];
+            }
+        }
+    }
+    janet_free(work);
+    for (i = 0; i < count; i++) {
+        if (!(info[i] & JANET_OPT_REACHABLE) || jump_target(bc[i], i) == i + 1) {
+            info[i] |= JANET_OPT_REMOVE;
+            removed = 1;
+        }
+    }
+
+    /* Liveness of slots. Slots captured by closures are always live. If the
+     * function has an environment but no record of which slots are
+     * captured, skip this part. */
+    int has_env = !!(def->flags & JANET_FUNCDEF_FLAG_NEEDSENV);
+    if (words > 0 && (!has_env || NULL != def->closure_bitset) &&
+            (size_t) count * (size_t) words <= JANET_ANALYSIS_MAX_WORDS) {
+        size_t size = sizeof(uint32_t) * (size_t) words;
+        uint32_t *live = janet_calloc((size_t) count + 2, size);
+        if (NULL == live) {
+            JANET_OUT_OF_MEMORY;
+        }
+        uint32_t *out = live + (size_t) count * words;
+        uint32_t *always = out + words;
+        if (has_env) memcpy(always, def->closure_bitset, size);
+        int again = 1;
+        while (again) {
+            again = 0;
+            for (i = count - 1; i >= 0; i--) {
+                if (!(info[i] & JANET_OPT_REACHABLE)) continue;
+                JanetSlotFields f = janet_slot_fields(bc[i]);
+                live_out(def, live, always, words, i, out);
+                int32_t w = janet_field_get(bc[i], f.write);
+                if (w >= 0 && w < sc) out[w >> 5] &= ~(1u << (w & 31));
+                for (j = 0; j < 3; j++) {
+                    int32_t r = janet_field_get(bc[i], f.reads[j]);
+                    if (r >= 0 && r < sc) out[r >> 5] |= 1u << (r & 31);
+                }
+                uint32_t *in = live + (size_t) i * words;
+                if (memcmp(in, out, size)) {
+                    memcpy(in, out, size);
+                    again = 1;
+                }
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            if (info[i] & (JANET_OPT_REMOVE | JANET_OPT_TOUCHED)) continue;
+            uint32_t instr = bc[i];
+            JanetSlotFields f = janet_slot_fields(instr);
+            int32_t w = janet_field_get(instr, f.write);
+            if (w < 0 || w >= sc) continue;
+            live_out(def, live, always, words, i, out);
+
+            /* Dead store */
+            if (is_pure(instr) && !slot_in(out, w)) {
+                info[i] |= JANET_OPT_REMOVE;
+                removed = 1;
+                continue;
+            }
+
+            if (i + 1 >= count || (info[i + 1] & (JANET_OPT_REMOVE | JANET_OPT_TOUCHED | JANET_OPT_TARGET)))
+                continue;
+            uint32_t next = bc[i + 1];
+            JanetSlotFields nf = janet_slot_fields(next);
+            live_out(def, live, always, words, i + 1, out);
+
+            /* x = op ...; y = x  ->  y = op ... */
+            if ((next & 0xFF) == JOP_MOVE_NEAR && (int32_t)(next >> 16) == w) {
+                int32_t d = (next >> 8) & 0xFF;
+                if (d != w && !slot_in(out, w) && janet_field_set(&instr, f.write, d)) {
+                    bc[i] = instr;
+                    info[i] |= JANET_OPT_TOUCHED;
+                    info[i + 1] |= JANET_OPT_TOUCHED | JANET_OPT_REMOVE;
+                    removed = 1;
+                    continue;
+                }
+            }
+
+            /* y = x; ... = op y  ->  ... = op x */
+            if ((instr & 0xFF) == JOP_MOVE_NEAR && !slot_in(always, w)) {
+                int32_t s = instr >> 16;
+                int32_t nw = janet_field_get(next, nf.write);
+                int uses = 0, ok = s != w && (nw == w || !slot_in(out, w));
+                for (j = 0; ok && j < 3; j++) {
+                    if (janet_field_get(next, nf.reads[j]) == w) {
+                        uses++;
+                        ok = janet_field_set(&next, nf.reads[j], s);
+                    }
+                }
+                if (ok && uses) {
+                    bc[i + 1] = next;
+                    info[i] |= JANET_OPT_TOUCHED | JANET_OPT_REMOVE;
+                    info[i + 1] |= JANET_OPT_TOUCHED;
+                    removed = 1;
+                }
+            }
+        }
+        janet_free(live);
+    }
+
+    /* Compact the bytecode, fixing up jumps and the source map */
+    if (removed) {
+        int32_t *newpos = janet_malloc(sizeof(int32_t) * ((size_t) count + 1));
+        if (NULL == newpos) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (i = 0, j = 0; i < count; i++) {
+            newpos[i] = j;
+            if (!(info[i] & JANET_OPT_REMOVE)) j++;
+        }
+        newpos[count] = j;
+        for (i = 0; i < count; i++) {
+            if (info[i] & JANET_OPT_REMOVE) continue;
+            uint32_t instr = bc[i];
+            int32_t target = jump_target(instr, i);
+            if (target >= 0 && target <= count) set_jump_target(&instr, newpos[i], newpos[target]);
+            bc[newpos[i]] = instr;
+            if (NULL != def->sourcemap) def->sourcemap[newpos[i]] = def->sourcemap[i];
+        }
+        def->bytecode_length = newpos[count];
+        janet_free(newpos);
+        changed = 1;
+    }
+
+    janet_free(info);
+    return changed;
+}
+
+void janet_bytecode_optimize(JanetFuncDef *def) {
+    for (int round = 0; round < 4 && def->bytecode_length > 0; round++) {
+        if (!optimize_round(def)) break;
+    }
+}
+
 /* Allocate an empty funcdef. This function may have added functionality
  * as commonalities between asm and compile arise. */
 JanetFuncDef *janet_funcdef_alloc(void) {
@@ -229,6 +814,8 @@ JanetFuncDef *janet_funcdef_alloc(void) {
     def->constants_length = 0;
     def->bytecode_length = 0;
     def->environments_length = 0;
+    def->jit = NULL;
+    def->hotness = 0;
     return def;
 }
 
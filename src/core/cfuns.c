@@ -110,6 +110,60 @@ static int can_slot_be_imm(JanetSlot s, int8_t *out) {
     return can_be_imm(s.constant, out);
 }
 
+/* Check if all slots are number constants, so the whole form can be folded */
+static int all_numbers(JanetFopts opts, JanetSlot *args) {
+    if (!opts.compiler->optimize) return 0;
+    for (int32_t i = 0; i < janet_v_count(args); i++) {
+        if (!(args[i].flags & JANET_SLOT_CONSTANT)) return 0;
+        if (!janet_checktype(args[i].constant, JANET_NUMBER)) return 0;
+    }
+    return 1;
+}
+
+/* Evaluate the op the same way the vm would with number arguments. Returns 0
+ * for bitwise ops whose results are not defined for the arguments. */
+static int fold_op(int op, double x, double y, double *out) {
+    int32_t ix = (int32_t) x, iy = (int32_t) y;
+    int bits = x == (double) ix && y == (double) iy;
+    switch (op) {
+        default:
+            return 0;
+        case JOP_ADD:
+            *out = x + y;
+            return 1;
+        case JOP_SUBTRACT:
+            *out = x - y;
+            return 1;
+        case JOP_MULTIPLY:
+            *out = x * y;
+            return 1;
+        case JOP_DIVIDE:
+            *out = x / y;
+            return 1;
+        case JOP_BAND:
+            *out = (double)(ix & iy);
+            return bits;
+        case JOP_BOR:
+            *out = (double)(ix | iy);
+            return bits;
+        case JOP_BXOR:
+            *out = (double)(ix ^ iy);
+            return bits;
+        case JOP_SHIFT_LEFT:
+            if (!bits || iy < 0 || iy > 31) return 0;
+            *out = (double)(int32_t)((uint32_t) ix << iy);
+            return 1;
+        case JOP_SHIFT_RIGHT:
+            if (!bits || iy < 0 || iy > 31) return 0;
+            *out = (double)(ix >> iy);
+            return 1;
+        case JOP_SHIFT_RIGHT_UNSIGNED:
+            if (!bits || iy < 0 || iy > 31) return 0;
+            *out = (double)((uint32_t) ix >> iy);
+            return 1;
+    }
+}
+
 /* Emit a series of instructions instead of a function call to a math op */
 static JanetSlot opreduce(
     JanetFopts opts,
@@ -124,6 +178,19 @@ static JanetSlot opreduce(
     if (opim < 0) opim = -opim;
     len = janet_v_count(args);
     JanetSlot t;
+    if (len > 0 && all_numbers(opts, args)) {
+        double acc = janet_unwrap_number(args[0].constant);
+        int ok = 1;
+        if (len == 1) {
+            ok = op == JOP_SUBTRACT
+                 ? fold_op(JOP_MULTIPLY, acc, -1, &acc)
+                 : fold_op(op, janet_unwrap_number(nullary), acc, &acc);
+        }
+        for (i = 1; ok && i < len; i++) {
+            ok = fold_op(op, acc, janet_unwrap_number(args[i].constant), &acc);
+        }
+        if (ok) return janetc_cslot(janet_wrap_number(acc));
+    }
     if (len == 0) {
         return janetc_cslot(nullary);
     } else if (len == 1) {
@@ -313,6 +380,39 @@ static JanetSlot compreduce(
                ? janetc_cslot(janet_wrap_false())
                : janetc_cslot(janet_wrap_true());
     }
+    if (all_numbers(opts, args)) {
+        /* Stop at the first pair that decides the result, like the jumps below */
+        int result = !invert, known = 1;
+        for (i = 1; known && i < len; i++) {
+            double x = janet_unwrap_number(args[i - 1].constant);
+            double y = janet_unwrap_number(args[i].constant);
+            switch (op) {
+                default:
+                    known = 0;
+                    break;
+                case JOP_GREATER_THAN:
+                    result = x > y;
+                    break;
+                case JOP_LESS_THAN:
+                    result = x < y;
+                    break;
+                case JOP_GREATER_THAN_EQUAL:
+                    result = x >= y;
+                    break;
+                case JOP_LESS_THAN_EQUAL:
+                    result = x <= y;
+                    break;
+                case JOP_EQUALS:
+                    result = x == y;
+                    break;
+                case JOP_NOT_EQUALS:
+                    result = x != y;
+                    break;
+            }
+            if (result == invert) break;
+        }
+        if (known) return janetc_cslot(janet_wrap_boolean(result));
+    }
     t = janetc_gettarget(opts);
     for (i = 1; i < len; i++) {
         if (opim && can_slot_be_imm(args[i], &imm)) {
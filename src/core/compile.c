@@ -610,7 +610,7 @@ static int macroexpand1(
     /* Evaluate macro */
     JanetFunction *macro = janet_unwrap_function(macroval);
     int32_t arity = janet_tuple_length(form) - 1;
-    JanetFiber *fiberp = janet_fiber(macro, 64, arity, form + 1);
+    JanetFiber *fiberp = janet_fiber(macro, JANET_STACK_INITIAL, arity, form + 1);
     if (NULL == fiberp) {
         int32_t minar = macro->def->min_arity;
         int32_t maxar = macro->def->max_arity;
@@ -818,6 +818,10 @@ JanetFuncDef *janetc_pop_funcdef(JanetCompiler *c) {
         def->closure_bitset = chunks;
     }
 
+    if (c->optimize) janet_bytecode_optimize(def);
+    janetc_superinstructions(def->bytecode, def->bytecode_length);
+    janet_bytecode_specialize(def);
+
     /* Pop the scope */
     janetc_popscope(c);
 
@@ -830,6 +834,8 @@ static void janetc_init(JanetCompiler *c, JanetTable *env, const uint8_t *where)
     c->buffer = NULL;
     c->mapbuffer = NULL;
     c->recursion_guard = JANET_RECURSION_GUARD;
+    c->optimize = janet_truthy(janet_dyn("optimize"));
+    c->release = janet_truthy(janet_dyn("release"));
     c->env = env;
     c->source = where;
     c->current_mapping.line = -1;
@@ -922,7 +928,12 @@ static const JanetReg compile_cfuns[] = {
              "Compiles an Abstract Syntax Tree (ast) into a function. "
              "Pair the compile function with parsing functionality to implement "
              "eval. Returns a new function and does not modify ast. Returns an error "
-             "struct with keys :line, :column, and :error if compilation fails.")
+             "struct with keys :line, :column, and :error if compilation fails. "
+             "If the dynamic binding :optimize is truthy, constant arithmetic is folded "
+             "and the bytecode is optimized, at the cost of less precise debugging. "
+             "If the dynamic binding :release is truthy, functions get no source maps and "
+             "bindings get no docstrings or :source-map, which saves memory but leaves "
+             "stack traces without line numbers and `debug/break` unable to find lines.")
     },
     {NULL, NULL, NULL}
 };
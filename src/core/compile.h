@@ -164,6 +164,12 @@ struct JanetCompiler {
 
     /* Prevent unbounded recursion */
     int recursion_guard;
+
+    /* Run the bytecode optimizer and fold constants, set from (dyn :optimize) */
+    int optimize;
+
+    /* Leave out source maps and docstrings, set from (dyn :release) */
+    int release;
 };
 
 #define JANET_FOPTS_TAIL 0x10000
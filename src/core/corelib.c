@@ -25,7 +25,9 @@
 #include <janet.h>
 #include <math.h>
 #include "compile.h"
+#include "gc.h"
 #include "state.h"
+#include "symcache.h"
 #include "util.h"
 #endif
 
@@ -358,6 +360,55 @@ static Janet janet_core_scannumber(int32_t argc, Janet *argv) {
     return janet_wrap_number(number);
 }
 
+static Janet janet_core_scannumbers(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 3);
+    JanetByteView view = janet_getbytes(argv, 0);
+    JanetByteView delims;
+    delims.bytes = (const uint8_t *) " \t\r\n,";
+    delims.len = 5;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        delims = janet_getbytes(argv, 1);
+    }
+    uint8_t isdelim[256] = {0};
+    for (int32_t i = 0; i < delims.len; i++) isdelim[delims.bytes[i]] = 1;
+    JanetArray *array = NULL;
+#ifdef JANET_TYPED_ARRAY
+    JanetTArrayView *ta = NULL;
+    size_t count = 0;
+    if (argc > 2 && janet_checkabstract(argv[2], &janet_ta_view_type)) {
+        ta = janet_unwrap_abstract(argv[2]);
+    } else
+#endif
+        array = (argc > 2) ? janet_getarray(argv, 2) : janet_array(0);
+    const uint8_t *p = view.bytes;
+    const uint8_t *end = p + view.len;
+    for (;;) {
+        while (p < end && isdelim[*p]) p++;
+        if (p >= end) break;
+        const uint8_t *field = p;
+        while (p < end && !isdelim[*p]) p++;
+        double number;
+        if (janet_scan_number(field, (int32_t)(p - field), &number)) {
+            janet_panicf("invalid number %S at byte %d",
+                         janet_string(field, (int32_t)(p - field)), (int32_t)(field - view.bytes));
+        }
+        if (NULL != array) {
+            janet_array_push(array, janet_wrap_number(number));
+            continue;
+        }
+#ifdef JANET_TYPED_ARRAY
+        if (count >= ta->size) janet_panicf("typed array of size %d is too small", (int32_t) ta->size);
+        if (ta->type == JANET_TARRAY_TYPE_F64) {
+            ta->as.f64[count * ta->stride] = number;
+        } else {
+            janet_put(argv[2], janet_wrap_number((double) count), janet_wrap_number(number));
+        }
+        count++;
+#endif
+    }
+    return (NULL != array) ? janet_wrap_array(array) : argv[2];
+}
+
 static Janet janet_core_tuple(int32_t argc, Janet *argv) {
     return janet_wrap_tuple(janet_tuple_n(argv, argc));
 }
@@ -413,9 +464,97 @@ static Janet janet_core_gensym(int32_t argc, Janet *argv) {
 }
 
 static Janet janet_core_gccollect(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    if (argc == 0 || janet_keyeq(argv[0], "major")) {
+        janet_collect();
+    } else if (janet_keyeq(argv[0], "minor")) {
+        janet_collect_minor();
+    } else {
+        janet_panicf("expected :minor or :major, got %v", argv[0]);
+    }
+    return janet_wrap_nil();
+}
+
+static Janet janet_core_gccount(int32_t argc, Janet *argv) {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    JanetKV *st = janet_struct_begin(4);
+    janet_struct_put(st, janet_ckeywordv("minor"), janet_wrap_number((double) janet_vm_gc_minor_count));
+    janet_struct_put(st, janet_ckeywordv("major"), janet_wrap_number((double) janet_vm_gc_major_count));
+    janet_struct_put(st, janet_ckeywordv("young"),
+                     janet_wrap_number((double)(janet_vm_block_count - janet_vm_old_block_count)));
+    janet_struct_put(st, janet_ckeywordv("old"), janet_wrap_number((double) janet_vm_old_block_count));
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
+static Janet janet_core_gcstats(int32_t argc, Janet *argv) {
     (void) argv;
-    (void) argc;
-    janet_collect();
+    janet_fixarity(argc, 0);
+    static const char *const type_names[JANET_MEMORY_TYPE_COUNT] = {
+        NULL, "string", "symbol", "array", "tuple", "table", "struct",
+        "fiber", "buffer", "function", "abstract", "funcenv", "funcdef"
+    };
+    JanetKV *types = janet_struct_begin(JANET_MEMORY_TYPE_COUNT - 1);
+    for (int i = 1; i < JANET_MEMORY_TYPE_COUNT; i++) {
+        size_t count = janet_vm_gc_type_counts[i];
+        /* Abstract types are untyped until they are initialized */
+        if (i == JANET_MEMORY_ABSTRACT) count += janet_vm_gc_type_counts[JANET_MEMORY_NONE];
+        janet_struct_put(types, janet_ckeywordv(type_names[i]), janet_wrap_number((double) count));
+    }
+    JanetSymcacheStats cache;
+    janet_symcache_stats(&cache);
+    JanetKV *symcache = janet_struct_begin(4);
+    janet_struct_put(symcache, janet_ckeywordv("count"), janet_wrap_number((double) cache.count));
+    janet_struct_put(symcache, janet_ckeywordv("capacity"), janet_wrap_number((double) cache.capacity));
+    janet_struct_put(symcache, janet_ckeywordv("max-probe"), janet_wrap_number((double) cache.max_probe));
+    janet_struct_put(symcache, janet_ckeywordv("mean-probe"), janet_wrap_number(cache.mean_probe));
+    JanetKV *st = janet_struct_begin(14);
+    janet_struct_put(st, janet_ckeywordv("minor"), janet_wrap_number((double) janet_vm_gc_minor_count));
+    janet_struct_put(st, janet_ckeywordv("major"), janet_wrap_number((double) janet_vm_gc_major_count));
+    janet_struct_put(st, janet_ckeywordv("pause-total"), janet_wrap_number(janet_vm_gc_pause_total));
+    janet_struct_put(st, janet_ckeywordv("pause-max"), janet_wrap_number(janet_vm_gc_pause_max));
+    janet_struct_put(st, janet_ckeywordv("pause-last"), janet_wrap_number(janet_vm_gc_pause_last));
+    janet_struct_put(st, janet_ckeywordv("freed"), janet_wrap_number((double) janet_vm_gc_freed));
+    janet_struct_put(st, janet_ckeywordv("allocated"), janet_wrap_number((double) janet_vm_next_collection));
+    janet_struct_put(st, janet_ckeywordv("interval"), janet_wrap_number((double) janet_vm_gc_interval));
+    janet_struct_put(st, janet_ckeywordv("blocks"), janet_wrap_number((double) janet_vm_block_count));
+    janet_struct_put(st, janet_ckeywordv("young"),
+                     janet_wrap_number((double)(janet_vm_block_count - janet_vm_old_block_count)));
+    janet_struct_put(st, janet_ckeywordv("old"), janet_wrap_number((double) janet_vm_old_block_count));
+    janet_struct_put(st, janet_ckeywordv("mode"),
+                     janet_ckeywordv(janet_vm_gc_incremental ? "incremental" : "atomic"));
+    janet_struct_put(st, janet_ckeywordv("types"), janet_wrap_struct(janet_struct_end(types)));
+    janet_struct_put(st, janet_ckeywordv("symcache"), janet_wrap_struct(janet_struct_end(symcache)));
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
+#ifdef JANET_EV
+static Janet janet_core_gcsethook(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    if (janet_checktype(argv[0], JANET_NIL)) {
+        janet_vm_gc_hook = NULL;
+    } else {
+        janet_vm_gc_hook = janet_getfunction(argv, 0);
+    }
+    return janet_wrap_nil();
+}
+#endif
+
+static Janet janet_core_gcsetmode(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    uint32_t budget = janet_vm_gc_step_budget;
+    if (argc > 1) {
+        int32_t b = janet_getinteger(argv, 1);
+        if (b <= 0) janet_panicf("expected positive step budget, got %v", argv[1]);
+        budget = (uint32_t) b;
+    }
+    if (janet_keyeq(argv[0], "atomic")) {
+        janet_gc_setmode(0, budget);
+    } else if (janet_keyeq(argv[0], "incremental")) {
+        janet_gc_setmode(1, budget);
+    } else {
+        janet_panicf("expected :atomic or :incremental, got %v", argv[0]);
+    }
     return janet_wrap_nil();
 }
 
@@ -604,6 +743,15 @@ static const JanetReg corelib_cfuns[] = {
              "must be in the same format as numbers in janet source code. Will return nil "
              "on an invalid number.")
     },
+    {
+        "scan-numbers", janet_core_scannumbers,
+        JDOC("(scan-numbers str &opt delims into)\n\n"
+             "Parse all of the numbers in a byte sequence, separated by runs of the bytes "
+             "in delims. delims defaults to whitespace and commas. The numbers are pushed to "
+             "the array into, or a new array. into can also be a typed array, in which "
+             "case the numbers are stored from index 0 and must all fit. Returns into. "
+             "Raises an error on a field that is not a valid number.")
+    },
     {
         "tuple", janet_core_tuple,
         JDOC("(tuple & items)\n\n"
@@ -626,8 +774,45 @@ static const JanetReg corelib_cfuns[] = {
     },
     {
         "gccollect", janet_core_gccollect,
-        JDOC("(gccollect)\n\n"
-             "Run garbage collection. You should probably not call this manually.")
+        JDOC("(gccollect &opt kind)\n\n"
+             "Run garbage collection. You should probably not call this manually. `kind` "
+             "is either :major (the default) to collect the whole heap, or :minor to only "
+             "collect memory allocated since the last collection.")
+    },
+    {
+        "gccount", janet_core_gccount,
+        JDOC("(gccount)\n\n"
+             "Get a struct with the number of :minor and :major garbage collections run, "
+             "and the number of :young and :old blocks of memory currently allocated.")
+    },
+    {
+        "gcstats", janet_core_gcstats,
+        JDOC("(gcstats)\n\n"
+             "Get a struct of garbage collector statistics. This includes the number of :minor and "
+             ":major collections run, the :pause-total, :pause-max and :pause-last time spent "
+             "collecting in seconds, the number of blocks :freed so far, the bytes :allocated "
+             "since the last collection, the collection :interval, the :mode, the number of "
+             "live :blocks, :young and :old blocks, a struct of live blocks by :types, and a :symcache "
+             "struct with the :count and :capacity of the table of interned symbols and keywords, "
+             "and the :max-probe and :mean-probe number of slots looked at to find one.")
+    },
+#ifdef JANET_EV
+    {
+        "gcsethook", janet_core_gcsethook,
+        JDOC("(gcsethook f)\n\n"
+             "Set a function to call with no arguments after each garbage collection, or nil "
+             "to remove it. The function is run in a new fiber on the event loop, and is not "
+             "scheduled again if it has not started since the previous collection.")
+    },
+#endif
+    {
+        "gcsetmode", janet_core_gcsetmode,
+        JDOC("(gcsetmode mode &opt budget)\n\n"
+             "Set how major garbage collections are run. With :atomic, the default, the "
+             "program is paused until a major collection is done. With :incremental, "
+             "marking and sweeping the old generation is split into steps of about budget "
+             "microseconds (default 1000), interleaved with the program and run when the "
+             "event loop is idle.")
     },
     {
         "gcsetinterval", janet_core_gcsetinterval,
@@ -1026,9 +1211,18 @@ static void janet_load_libs(JanetTable *env) {
 #ifdef JANET_ASSEMBLER
     janet_lib_asm(env);
 #endif
+#ifdef JANET_TYPED_ARRAY
+    janet_lib_typed_array(env);
+#endif
 #ifdef JANET_INT_TYPES
     janet_lib_inttypes(env);
 #endif
+#ifdef JANET_PERSISTENT
+    janet_lib_persistent(env);
+#endif
+#ifdef JANET_JSON
+    janet_lib_json(env);
+#endif
 #ifdef JANET_THREADS
     janet_lib_thread(env);
 #endif
@@ -1038,6 +1232,9 @@ static void janet_load_libs(JanetTable *env) {
 #ifdef JANET_NET
     janet_lib_net(env);
 #endif
+#ifdef JANET_TLS
+    janet_lib_tls(env);
+#endif
 }
 
 #ifdef JANET_BOOTSTRAP
@@ -1221,11 +1418,12 @@ JanetTable *janet_core_env(JanetTable *replacements) {
 
     JanetTable *dict = janet_core_lookup_table(replacements);
 
-    /* Unmarshal bytecode */
+    /* Unmarshal bytecode, borrowing strings and bytecode from the image. The
+     * image was compiled along with this binary, so skip verifying it. */
     Janet marsh_out = janet_unmarshal(
                           janet_core_image,
                           janet_core_image_size,
-                          0,
+                          JANET_MARSHAL_BORROW | JANET_MARSHAL_TRUSTED,
                           dict,
                           NULL);
 
@@ -29,14 +29,39 @@
 #include "vector.h"
 #endif
 
+#ifndef JANET_WINDOWS
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#endif
+
 /* Implements functionality to build a debugger from within janet.
  * The repl should also be able to serve as pretty featured debugger
  * out of the box. */
 
+/* Bytecode borrowed from a mapped image is shared, so take a private
+ * copy before patching it. */
+static void janet_debug_own_bytecode(JanetFuncDef *def) {
+    if (def->flags & JANET_FUNCDEF_FLAG_LAZY) janet_def_materialize(def);
+    if (!(def->flags & JANET_FUNCDEF_FLAG_MAPPED)) return;
+    uint32_t *bytecode = janet_malloc(sizeof(uint32_t) * (size_t) def->bytecode_length);
+    if (NULL == bytecode) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memcpy(bytecode, def->bytecode, sizeof(uint32_t) * (size_t) def->bytecode_length);
+    def->bytecode = bytecode;
+    def->flags &= ~JANET_FUNCDEF_FLAG_MAPPED;
+}
+
 /* Add a break point to a function */
 void janet_debug_break(JanetFuncDef *def, int32_t pc) {
     if (pc >= def->bytecode_length || pc < 0)
         janet_panic("invalid bytecode offset");
+    janet_debug_own_bytecode(def);
+#ifdef JANET_JIT
+    janet_jit_free(def);
+#endif
     def->bytecode[pc] |= 0x80;
 }
 
@@ -44,6 +69,7 @@ void janet_debug_break(JanetFuncDef *def, int32_t pc) {
 void janet_debug_unbreak(JanetFuncDef *def, int32_t pc) {
     if (pc >= def->bytecode_length || pc < 0)
         janet_panic("invalid bytecode offset");
+    janet_debug_own_bytecode(def);
     def->bytecode[pc] &= ~((uint32_t)0x80);
 }
 
@@ -54,8 +80,11 @@ void janet_debug_unbreak(JanetFuncDef *def, int32_t pc) {
 void janet_debug_find(
     JanetFuncDef **def_out, int32_t *pc_out,
     const uint8_t *source, int32_t sourceLine, int32_t sourceColumn) {
-    /* Scan the heap for right func def */
+    /* Scan the heap for right func def. Finish any incremental collection first,
+     * so that unreachable blocks waiting to be swept are not found. */
+    janet_gc_finish();
     JanetGCObject *current = janet_vm_blocks;
+    int scanned_young = 0;
     /* Keep track of the best source mapping we have seen so far */
     int32_t besti = -1;
     int32_t best_line = -1;
@@ -87,6 +116,11 @@ void janet_debug_find(
             }
         }
         current = current->next;
+        if (NULL == current && !scanned_young) {
+            /* Continue with the old generation */
+            scanned_young = 1;
+            current = janet_vm_old_blocks;
+        }
     }
     if (best_def) {
         *def_out = best_def;
@@ -325,6 +359,478 @@ static Janet cfun_debug_step(int32_t argc, Janet *argv) {
     return out;
 }
 
+/*
+ * Sampling profiler. A SIGPROF timer sets a flag, and the vm records the
+ * stack of the current fiber the next time it enters a function or jumps
+ * backwards. Samples are counted per folded stack, which is the format
+ * flamegraph tools expect.
+ */
+
+volatile sig_atomic_t janet_vm_profile_tick = 0;
+JANET_THREAD_LOCAL JanetTable *janet_vm_profile = NULL;
+
+#ifndef JANET_WINDOWS
+/* The timer is per process, so only one thread can profile at a time */
+static int janet_profile_running = 0;
+static struct sigaction janet_profile_old_action;
+
+static void janet_profile_handler(int sig) {
+    (void) sig;
+    janet_vm_profile_tick = 1;
+}
+
+static void janet_profile_timer(int hz) {
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz ? 1000000 / hz : 0;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+#endif
+
+/* Push a frame name without the characters that separate folded stacks */
+static void janet_profile_push_name(JanetBuffer *buf, const uint8_t *name, int32_t len) {
+    for (int32_t i = 0; i < len; i++) {
+        uint8_t c = name[i];
+        janet_buffer_push_u8(buf, (c == ';' || c == '\n') ? '_' : c);
+    }
+}
+
+static void janet_profile_push_frame(JanetBuffer *buf, JanetStackFrame *frame) {
+    if (frame->func) {
+        JanetFuncDef *def = frame->func->def;
+        if (def->name) {
+            janet_profile_push_name(buf, def->name, janet_string_length(def->name));
+        } else {
+            janet_buffer_push_cstring(buf, "_anon");
+        }
+        if (def->source) {
+            janet_buffer_push_u8(buf, ' ');
+            janet_profile_push_name(buf, def->source, janet_string_length(def->source));
+        }
+        if (def->sourcemap && frame->pc) {
+            int32_t off = (int32_t)(frame->pc - def->bytecode);
+            janet_formatb(buf, ":%d", def->sourcemap[off].line);
+        }
+    } else {
+        JanetCFunction cfun = (JanetCFunction)(frame->pc);
+        Janet name = janet_table_get(janet_vm_registry, janet_wrap_cfunction(cfun));
+        if (janet_checktype(name, JANET_SYMBOL)) {
+            JanetSymbol sym = janet_unwrap_symbol(name);
+            janet_profile_push_name(buf, sym, janet_string_length(sym));
+        } else {
+            janet_buffer_push_cstring(buf, "_cfunction");
+        }
+    }
+}
+
+/* Called by the vm at a safe point after the timer fired */
+void janet_profile_sample(JanetFiber *fiber) {
+    if (NULL == janet_vm_profile) return;
+    janet_vm_profile_tick = 0;
+    int32_t *frames = NULL;
+    int32_t i = fiber->frame;
+    while (i > 0) {
+        janet_v_push(frames, i);
+        i = ((JanetStackFrame *)(fiber->data + i - JANET_FRAME_SIZE))->prevframe;
+    }
+    JanetBuffer buf;
+    janet_buffer_init(&buf, 128);
+    for (int32_t j = janet_v_count(frames) - 1; j >= 0; j--) {
+        janet_profile_push_frame(&buf, (JanetStackFrame *)(fiber->data + frames[j] - JANET_FRAME_SIZE));
+        if (j) janet_buffer_push_u8(&buf, ';');
+    }
+    janet_v_free(frames);
+    Janet key = janet_stringv(buf.data, buf.count);
+    janet_buffer_deinit(&buf);
+    Janet count = janet_table_get(janet_vm_profile, key);
+    int32_t n = janet_checktype(count, JANET_NUMBER) ? janet_unwrap_integer(count) : 0;
+    janet_table_put(janet_vm_profile, key, janet_wrap_integer(n + 1));
+}
+
+void janet_profile_deinit(void) {
+#ifndef JANET_WINDOWS
+    if (NULL != janet_vm_profile) {
+        janet_profile_timer(0);
+        sigaction(SIGPROF, &janet_profile_old_action, NULL);
+        janet_profile_running = 0;
+    }
+#endif
+    janet_vm_profile = NULL;
+}
+
+static Janet cfun_profile_start(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    int32_t hz = janet_optinteger(argv, argc, 0, 100);
+    if (hz < 1 || hz > 10000) janet_panicf("expected sample rate between 1 and 10000, got %d", hz);
+#ifdef JANET_WINDOWS
+    janet_panic("profiler not supported on this platform");
+#else
+    if (janet_profile_running) janet_panic("profiler already running");
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = janet_profile_handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGPROF, &action, &janet_profile_old_action))
+        janet_panicf("could not start profiler: %s", strerror(errno));
+    janet_profile_running = 1;
+    janet_vm_profile = janet_table(0);
+    janet_gcroot(janet_wrap_table(janet_vm_profile));
+    janet_vm_profile_tick = 0;
+    janet_profile_timer(hz);
+    return janet_wrap_nil();
+#endif
+}
+
+static int janet_profile_cmp(const void *a, const void *b) {
+    return janet_compare(((const JanetKV *) a)->key, ((const JanetKV *) b)->key);
+}
+
+static Janet cfun_profile_stop(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    JanetTable *samples = janet_vm_profile;
+    if (NULL == samples) janet_panic("profiler is not running");
+    JanetBuffer *buf = janet_optbuffer(argv, argc, 0, 1024);
+    janet_gcunroot(janet_wrap_table(samples));
+    janet_profile_deinit();
+    JanetKV *kvs = janet_smalloc(sizeof(JanetKV) * (size_t)(samples->count + 1));
+    int32_t n = 0;
+    for (int32_t i = 0; i < samples->capacity; i++) {
+        if (!janet_checktype(samples->data[i].key, JANET_NIL)) kvs[n++] = samples->data[i];
+    }
+    qsort(kvs, (size_t) n, sizeof(JanetKV), janet_profile_cmp);
+    for (int32_t i = 0; i < n; i++) {
+        janet_buffer_push_string(buf, janet_unwrap_string(kvs[i].key));
+        janet_formatb(buf, " %d\n", janet_unwrap_integer(kvs[i].value));
+    }
+    janet_sfree(kvs);
+    return janet_wrap_buffer(buf);
+}
+
+/*
+ * Heap snapshots. Live blocks are grouped by memory type, or by type name for
+ * abstract types, and blocks sampled with debug/heap-sample are also grouped
+ * by the function and source location that allocated them.
+ */
+
+typedef struct {
+    const void *key; /* Abstract type, or funcdef of a site */
+    int32_t pc;
+    double count;
+    double bytes;
+} JanetHeapGroup;
+
+typedef struct {
+    double count[JANET_MEMORY_TYPE_COUNT];
+    double bytes[JANET_MEMORY_TYPE_COUNT];
+    JanetHeapGroup *abstracts;
+    JanetHeapGroup *sites;
+} JanetHeapTally;
+
+/* Only tallies into scratch memory, as allocating blocks during the walk would change the heap */
+static void janet_heap_tally(JanetGCObject *mem, size_t size, JanetFuncDef *def, int32_t pc, void *data) {
+    JanetHeapTally *tally = data;
+    int type = mem->flags & JANET_MEM_TYPEBITS;
+    if (type == JANET_MEMORY_NONE || type == JANET_MEMORY_ABSTRACT) {
+        const JanetAbstractType *at = ((JanetAbstractHead *) mem)->type;
+        int32_t i = 0, n = janet_v_count(tally->abstracts);
+        while (i < n && tally->abstracts[i].key != at) i++;
+        if (i == n) {
+            JanetHeapGroup group = {at, 0, 0, 0};
+            janet_v_push(tally->abstracts, group);
+        }
+        tally->abstracts[i].count++;
+        tally->abstracts[i].bytes += (double) size;
+    } else {
+        tally->count[type]++;
+        tally->bytes[type] += (double) size;
+    }
+    if (NULL != def) {
+        JanetHeapGroup group = {def, pc, 1, (double) size};
+        janet_v_push(tally->sites, group);
+    }
+}
+
+static int janet_heap_group_cmp(const void *a, const void *b) {
+    const JanetHeapGroup *ga = a, *gb = b;
+    if (ga->key != gb->key) return (uintptr_t) ga->key < (uintptr_t) gb->key ? -1 : 1;
+    return ga->pc < gb->pc ? -1 : ga->pc > gb->pc;
+}
+
+/* Add to the {:count :bytes} struct under key in t */
+static void janet_heap_group_add(JanetTable *t, Janet key, double count, double bytes) {
+    Janet old = janet_table_get(t, key);
+    if (janet_checktype(old, JANET_STRUCT)) {
+        count += janet_unwrap_number(janet_struct_get(janet_unwrap_struct(old), janet_ckeywordv("count")));
+        bytes += janet_unwrap_number(janet_struct_get(janet_unwrap_struct(old), janet_ckeywordv("bytes")));
+    }
+    JanetKV *st = janet_struct_begin(2);
+    janet_struct_put(st, janet_ckeywordv("count"), janet_wrap_number(count));
+    janet_struct_put(st, janet_ckeywordv("bytes"), janet_wrap_number(bytes));
+    janet_table_put(t, key, janet_wrap_struct(janet_struct_end(st)));
+}
+
+static Janet cfun_debug_heap_snapshot(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 0);
+    (void) argv;
+    static const char *const type_names[JANET_MEMORY_TYPE_COUNT] = {
+        NULL, "string", "symbol", "array", "tuple", "table", "struct",
+        "fiber", "buffer", "function", "abstract", "funcenv", "funcdef"
+    };
+    JanetHeapTally tally;
+    memset(&tally, 0, sizeof(tally));
+    janet_collect();
+    janet_gc_heap_walk(janet_heap_tally, &tally);
+    double count = 0, bytes = 0;
+    JanetTable *types = janet_table(JANET_MEMORY_TYPE_COUNT + janet_v_count(tally.abstracts));
+    for (int i = 0; i < JANET_MEMORY_TYPE_COUNT; i++) {
+        if (tally.count[i] == 0) continue;
+        janet_heap_group_add(types, janet_ckeywordv(type_names[i]), tally.count[i], tally.bytes[i]);
+        count += tally.count[i];
+        bytes += tally.bytes[i];
+    }
+    for (int32_t i = 0; i < janet_v_count(tally.abstracts); i++) {
+        JanetHeapGroup *group = tally.abstracts + i;
+        const JanetAbstractType *at = group->key;
+        janet_heap_group_add(types, janet_ckeywordv(at->name), group->count, group->bytes);
+        count += group->count;
+        bytes += group->bytes;
+    }
+    int32_t nsites = janet_v_count(tally.sites);
+    if (nsites) qsort(tally.sites, (size_t) nsites, sizeof(JanetHeapGroup), janet_heap_group_cmp);
+    JanetTable *sites = janet_table(0);
+    for (int32_t i = 0; i < nsites;) {
+        JanetHeapGroup group = tally.sites[i];
+        while (++i < nsites && !janet_heap_group_cmp(&group, tally.sites + i)) {
+            group.count++;
+            group.bytes += tally.sites[i].bytes;
+        }
+        const JanetFuncDef *def = group.key;
+        Janet site[4];
+        site[0] = def->name ? janet_wrap_string(def->name) : janet_wrap_nil();
+        site[1] = def->source ? janet_wrap_string(def->source) : janet_wrap_nil();
+        site[2] = site[3] = janet_wrap_nil();
+        if (def->sourcemap && group.pc >= 0 && group.pc < def->bytecode_length) {
+            site[2] = janet_wrap_integer(def->sourcemap[group.pc].line);
+            site[3] = janet_wrap_integer(def->sourcemap[group.pc].column);
+        }
+        janet_heap_group_add(sites, janet_wrap_tuple(janet_tuple_n(site, 4)), group.count, group.bytes);
+    }
+    janet_v_free(tally.abstracts);
+    janet_v_free(tally.sites);
+    JanetKV *st = janet_struct_begin(5);
+    janet_struct_put(st, janet_ckeywordv("count"), janet_wrap_number(count));
+    janet_struct_put(st, janet_ckeywordv("bytes"), janet_wrap_number(bytes));
+    janet_struct_put(st, janet_ckeywordv("types"), janet_wrap_struct(janet_table_to_struct(types)));
+    janet_struct_put(st, janet_ckeywordv("sites"), janet_wrap_struct(janet_table_to_struct(sites)));
+    janet_struct_put(st, janet_ckeywordv("sample-rate"), janet_wrap_number((double) janet_vm_heap_sample_rate));
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
+static Janet cfun_debug_heap_sample(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    int32_t rate = janet_optnat(argv, argc, 0, 0);
+    janet_gc_heap_sample((uint32_t) rate);
+    return janet_wrap_nil();
+}
+
+#ifdef JANET_INSTRUMENT
+
+/*
+ * Call instrumentation. The vm reports function entries and exits, and
+ * each active call keeps an entry on a shadow stack so that inclusive and
+ * exclusive time and allocations can be attributed to funcdefs. Frames
+ * that are unwound by errors are closed when an outer frame returns, and
+ * calls that are active when a fiber stops running are closed then.
+ */
+
+typedef struct {
+    JanetFunction *func; /* Some closure of the funcdef, NULL if slot is empty */
+    uint64_t calls;
+    double total;
+    double self;
+    uint64_t bytes;
+    uint64_t self_bytes;
+} JanetCallStats;
+
+typedef struct {
+    int32_t stats;
+    int32_t frame;
+    JanetFiber *fiber;
+    double start;
+    double child;
+    size_t bytes;
+    size_t child_bytes;
+} JanetCallEntry;
+
+JANET_THREAD_LOCAL int janet_vm_instrument = 0;
+JANET_THREAD_LOCAL size_t janet_vm_instrument_bytes = 0;
+static JANET_THREAD_LOCAL JanetCallStats *janet_vm_call_stats = NULL;
+static JANET_THREAD_LOCAL int32_t janet_vm_call_stats_count = 0;
+static JANET_THREAD_LOCAL int32_t janet_vm_call_stats_capacity = 0;
+static JANET_THREAD_LOCAL JanetCallEntry *janet_vm_call_entries = NULL;
+static JANET_THREAD_LOCAL int32_t janet_vm_call_entries_count = 0;
+static JANET_THREAD_LOCAL int32_t janet_vm_call_entries_capacity = 0;
+
+static double janet_instrument_now(void) {
+    struct timespec now;
+    janet_gettime(&now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+static int32_t janet_instrument_find(JanetFuncDef *def) {
+    uint32_t mask = (uint32_t) janet_vm_call_stats_capacity - 1;
+    uint32_t i = (uint32_t)(((uintptr_t) def >> 4) * 2654435761u) & mask;
+    while (janet_vm_call_stats[i].func && janet_vm_call_stats[i].func->def != def) {
+        i = (i + 1) & mask;
+    }
+    return (int32_t) i;
+}
+
+static int32_t janet_instrument_stats(JanetFunction *func) {
+    if (2 * (janet_vm_call_stats_count + 1) > janet_vm_call_stats_capacity) {
+        JanetCallStats *old = janet_vm_call_stats;
+        int32_t oldcap = janet_vm_call_stats_capacity;
+        int32_t newcap = oldcap ? 2 * oldcap : 64;
+        janet_vm_call_stats = janet_calloc((size_t) newcap, sizeof(JanetCallStats));
+        if (NULL == janet_vm_call_stats) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm_call_stats_capacity = newcap;
+        for (int32_t i = 0; i < oldcap; i++) {
+            if (old[i].func) janet_vm_call_stats[janet_instrument_find(old[i].func->def)] = old[i];
+        }
+        /* Entries refer to stats by index */
+        for (int32_t i = 0; i < janet_vm_call_entries_count; i++) {
+            JanetFuncDef *def = old[janet_vm_call_entries[i].stats].func->def;
+            janet_vm_call_entries[i].stats = janet_instrument_find(def);
+        }
+        janet_free(old);
+    }
+    int32_t index = janet_instrument_find(func->def);
+    if (NULL == janet_vm_call_stats[index].func) {
+        janet_vm_call_stats[index].func = func;
+        janet_vm_call_stats_count++;
+    }
+    return index;
+}
+
+void janet_instrument_enter(JanetFiber *fiber, JanetFunction *func) {
+    JanetCallEntry entry;
+    entry.stats = janet_instrument_stats(func);
+    entry.frame = fiber->frame;
+    entry.fiber = fiber;
+    entry.start = janet_instrument_now();
+    entry.child = 0.0;
+    entry.bytes = janet_vm_instrument_bytes;
+    entry.child_bytes = 0;
+    janet_vm_call_stats[entry.stats].calls++;
+    if (janet_vm_call_entries_count == janet_vm_call_entries_capacity) {
+        int32_t newcap = janet_vm_call_entries_capacity ? 2 * janet_vm_call_entries_capacity : 64;
+        JanetCallEntry *entries = janet_realloc(janet_vm_call_entries, sizeof(JanetCallEntry) * (size_t) newcap);
+        if (NULL == entries) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm_call_entries = entries;
+        janet_vm_call_entries_capacity = newcap;
+    }
+    janet_vm_call_entries[janet_vm_call_entries_count++] = entry;
+}
+
+/* Close the calls from the top of the shadow stack down to index */
+static void janet_instrument_close(int32_t index) {
+    double now = janet_instrument_now();
+    int32_t top = janet_vm_call_entries_count;
+    while (top > index) {
+        JanetCallEntry *entry = janet_vm_call_entries + --top;
+        JanetCallStats *stats = janet_vm_call_stats + entry->stats;
+        double elapsed = now - entry->start;
+        size_t bytes = janet_vm_instrument_bytes - entry->bytes;
+        stats->total += elapsed;
+        stats->self += elapsed - entry->child;
+        stats->bytes += bytes;
+        stats->self_bytes += bytes - entry->child_bytes;
+        if (top > 0) {
+            entry[-1].child += elapsed;
+            entry[-1].child_bytes += bytes;
+        }
+    }
+    janet_vm_call_entries_count = top;
+}
+
+void janet_instrument_exit(JanetFiber *fiber) {
+    for (int32_t i = janet_vm_call_entries_count - 1; i >= 0; i--) {
+        JanetCallEntry *entry = janet_vm_call_entries + i;
+        if (entry->fiber == fiber && entry->frame == fiber->frame) {
+            janet_instrument_close(i);
+            return;
+        }
+    }
+}
+
+/* Close calls of a fiber that stopped running */
+void janet_instrument_suspend(JanetFiber *fiber) {
+    int32_t i = janet_vm_call_entries_count;
+    while (i > 0 && janet_vm_call_entries[i - 1].fiber == fiber) i--;
+    janet_instrument_close(i);
+}
+
+void janet_instrument_mark(void) {
+    for (int32_t i = 0; i < janet_vm_call_stats_capacity; i++) {
+        if (janet_vm_call_stats[i].func) janet_mark(janet_wrap_function(janet_vm_call_stats[i].func));
+    }
+}
+
+void janet_instrument_deinit(void) {
+    janet_free(janet_vm_call_stats);
+    janet_free(janet_vm_call_entries);
+    janet_vm_call_stats = NULL;
+    janet_vm_call_stats_count = 0;
+    janet_vm_call_stats_capacity = 0;
+    janet_vm_call_entries = NULL;
+    janet_vm_call_entries_count = 0;
+    janet_vm_call_entries_capacity = 0;
+    janet_vm_instrument = 0;
+}
+
+static Janet cfun_debug_instrument(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    int enable = janet_truthy(argv[0]);
+    if (enable && !janet_vm_instrument) janet_instrument_deinit();
+    if (!enable) janet_instrument_close(0);
+    janet_vm_instrument = enable;
+    return janet_wrap_nil();
+}
+
+static Janet cfun_debug_profile_report(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 0);
+    (void) argv;
+    JanetTable *report = janet_table(janet_vm_call_stats_count);
+    for (int32_t i = 0; i < janet_vm_call_stats_capacity; i++) {
+        JanetCallStats *stats = janet_vm_call_stats + i;
+        if (NULL == stats->func) continue;
+        JanetFuncDef *def = stats->func->def;
+        JanetKV *st = janet_struct_begin(8);
+        janet_struct_put(st, janet_ckeywordv("name"),
+                         def->name ? janet_wrap_string(def->name) : janet_wrap_nil());
+        janet_struct_put(st, janet_ckeywordv("source"),
+                         def->source ? janet_wrap_string(def->source) : janet_wrap_nil());
+        janet_struct_put(st, janet_ckeywordv("source-line"),
+                         (def->sourcemap && def->bytecode_length) ?
+                         janet_wrap_integer(def->sourcemap[0].line) : janet_wrap_nil());
+        janet_struct_put(st, janet_ckeywordv("calls"), janet_wrap_number((double) stats->calls));
+        janet_struct_put(st, janet_ckeywordv("total-time"), janet_wrap_number(stats->total));
+        janet_struct_put(st, janet_ckeywordv("self-time"), janet_wrap_number(stats->self));
+        janet_struct_put(st, janet_ckeywordv("bytes"), janet_wrap_number((double) stats->bytes));
+        janet_struct_put(st, janet_ckeywordv("self-bytes"), janet_wrap_number((double) stats->self_bytes));
+        janet_table_put(report, janet_wrap_function(stats->func), janet_wrap_struct(janet_struct_end(st)));
+    }
+    return janet_wrap_table(report);
+}
+
+#endif
+
 static const JanetReg debug_cfuns[] = {
     {
         "debug/break", cfun_debug_break,
@@ -400,6 +906,58 @@ static const JanetReg debug_cfuns[] = {
              "pass in a value that will be passed as the resuming value. Returns the signal value, "
              "which will usually be nil, as breakpoints raise nil signals.")
     },
+    {
+        "profile/start", cfun_profile_start,
+        JDOC("(profile/start &opt hz)\n\n"
+             "Start sampling the stack of the running fiber hz times per second of cpu time, "
+             "100 by default. Samples are taken when the vm next enters a function or "
+             "jumps backwards, so time spent in a single C function is attributed to what "
+             "runs after it. Only one thread can profile at a time.")
+    },
+    {
+        "profile/stop", cfun_profile_stop,
+        JDOC("(profile/stop &opt buf)\n\n"
+             "Stop the profiler and return its samples as folded stacks in buf, or a new buffer. "
+             "Each line holds the frames from outermost to innermost separated by semicolons, "
+             "then a space and the number of samples, which most flamegraph tools accept.")
+    },
+    {
+        "debug/heap-snapshot", cfun_debug_heap_snapshot,
+        JDOC("(debug/heap-snapshot)\n\n"
+             "Run a full garbage collection and describe the blocks left on the heap of the current "
+             "thread. Returns a struct with the total :count and :bytes of the blocks, a :types struct "
+             "from memory type, or type name for abstract types, to a struct of the :count and :bytes "
+             "of those blocks, and the :sample-rate set with debug/heap-sample. Blocks sampled "
+             "when they were allocated are also grouped in :sites by a tuple of the name, source, "
+             "line and column of the function that allocated them. Sizes include memory owned by "
+             "the blocks, like the contents of arrays and tables. Compare two snapshots with debug/heap-diff.")
+    },
+    {
+        "debug/heap-sample", cfun_debug_heap_sample,
+        JDOC("(debug/heap-sample &opt rate)\n\n"
+             "Record the function and pc that allocated one of every `rate` blocks on the current "
+             "thread, so that debug/heap-snapshot can report the :sites of live blocks. A rate of 1 "
+             "samples every allocation. Calling with no rate or 0 turns sampling off and forgets "
+             "the sites recorded so far.")
+    },
+#ifdef JANET_INSTRUMENT
+    {
+        "debug/instrument", cfun_debug_instrument,
+        JDOC("(debug/instrument enable)\n\n"
+             "Turn call instrumentation on or off for the current thread. Turning it on clears "
+             "the statistics collected so far. Only available when Janet is built with "
+             "JANET_INSTRUMENT.")
+    },
+    {
+        "debug/profile-report", cfun_debug_profile_report,
+        JDOC("(debug/profile-report)\n\n"
+             "Get the statistics collected with debug/instrument as a table from a function to "
+             "a struct with the :name, :source and :source-line of the function, the number of "
+             ":calls, the :total-time and :self-time in seconds, and the :bytes and :self-bytes "
+             "allocated. Totals include callees, and recursive calls are counted once per call. "
+             "All closures of the same function share one entry.")
+    },
+#endif
     {NULL, NULL, NULL}
 };
 
@@ -45,7 +45,7 @@ int32_t janetc_allocnear(JanetCompiler *c, JanetcRegisterTemp tag) {
 /* Emit a raw instruction with source mapping. */
 void janetc_emit(JanetCompiler *c, uint32_t instr) {
     janet_v_push(c->buffer, instr);
-    janet_v_push(c->mapbuffer, c->current_mapping);
+    if (!c->release) janet_v_push(c->mapbuffer, c->current_mapping);
 }
 
 /* Add a constant to the current scope. Return the index of the constant. */
@@ -335,3 +335,43 @@ int32_t janetc_emit_sss(JanetCompiler *c, uint8_t op, JanetSlot s1, JanetSlot s2
     janetc_free_regnear(c, s1, reg1, JANETC_REGTEMP_0);
     return label;
 }
+
+/* Replace instructions that are almost always followed by a jump with
+ * superinstructions that take the jump themselves. The following jump is
+ * kept, so the bytecode is the same length and all labels stay valid. */
+void janetc_superinstructions(uint32_t *bytecode, int32_t count) {
+    for (int32_t i = 0; i + 1 < count; i++) {
+        uint32_t instr = bytecode[i];
+        uint32_t next = bytecode[i + 1];
+        uint32_t cond = (next & 0xFF) == JOP_JUMP_IF || (next & 0xFF) == JOP_JUMP_IF_NOT;
+        /* The jump must test the slot the comparison writes to */
+        cond = cond && ((next >> 8) & 0xFF) == ((instr >> 8) & 0xFF);
+        uint8_t op = 0;
+        switch (instr & 0xFF) {
+            default:
+                break;
+            case JOP_LESS_THAN:
+                if (cond) op = JOP_LESS_THAN_JUMP;
+                break;
+            case JOP_LESS_THAN_IMMEDIATE:
+                if (cond) op = JOP_LESS_THAN_IMMEDIATE_JUMP;
+                break;
+            case JOP_LESS_THAN_EQUAL:
+                if (cond) op = JOP_LESS_THAN_EQUAL_JUMP;
+                break;
+            case JOP_GREATER_THAN:
+                if (cond) op = JOP_GREATER_THAN_JUMP;
+                break;
+            case JOP_GREATER_THAN_IMMEDIATE:
+                if (cond) op = JOP_GREATER_THAN_IMMEDIATE_JUMP;
+                break;
+            case JOP_GREATER_THAN_EQUAL:
+                if (cond) op = JOP_GREATER_THAN_EQUAL_JUMP;
+                break;
+            case JOP_ADD_IMMEDIATE:
+                if ((next & 0xFF) == JOP_JUMP) op = JOP_ADD_IMMEDIATE_JUMP;
+                break;
+        }
+        if (op) bytecode[i] = (instr & ~0xFFu) | op;
+    }
+}
@@ -48,4 +48,7 @@ int janetc_sequal(JanetSlot x, JanetSlot y);
 /* Move value from one slot to another. Cannot copy to constant slots. */
 void janetc_copy(JanetCompiler *c, JanetSlot dest, JanetSlot src);
 
+/* Fuse common instruction pairs in finished bytecode */
+void janetc_superinstructions(uint32_t *bytecode, int32_t count);
+
 #endif
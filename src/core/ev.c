@@ -48,11 +48,25 @@
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #ifdef JANET_EV_EPOLL
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
 #endif
+#ifdef JANET_EV_URING
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <linux/io_uring.h>
+/* Not declared with the strict feature test macros we use */
+extern long syscall(long number, ...);
+#endif
+#ifdef JANET_EV_KQUEUE
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
 #endif
 
 /* Ring buffer for storing a list of fibers */
@@ -78,6 +92,9 @@ typedef struct {
     JanetQueue read_pending;
     JanetQueue write_pending;
     int32_t limit;
+    /* Called when a fiber starts waiting to read, for channels fed from outside
+     * of the event loop */
+    void (*on_wait)(void);
 } JanetChannel;
 
 #define JANET_MAX_Q_CAPACITY 0x7FFFFFF
@@ -143,7 +160,7 @@ struct JanetTask {
     JanetSignal sig;
 };
 
-/* Min priority queue of timestamps for timeouts. */
+/* Timeouts are kept in a hierarchical timer wheel. */
 typedef int64_t JanetTimestamp;
 typedef struct JanetTimeout JanetTimeout;
 struct JanetTimeout {
@@ -152,21 +169,58 @@ struct JanetTimeout {
     JanetFiber *curr_fiber;
     uint32_t sched_id;
     int is_error;
+    /* internal */
+    int level;
+    int slot;
+    JanetTimeout *prev;
+    JanetTimeout *next;
 };
 
 /* Forward declaration */
+typedef struct JanetStealWorker JanetStealWorker;
 static void janet_unlisten(JanetListenerState *state);
+#ifdef JANET_EV_URING
+static void janet_uring_enter(int wait);
+#endif
+#ifdef JANET_EV_EPOLL
+static void janet_epoll_close(JanetStream *stream);
+#endif
+static void janet_flush_pump(void);
 
 /* Global data */
-JANET_THREAD_LOCAL size_t janet_vm_tq_count = 0;
-JANET_THREAD_LOCAL size_t janet_vm_tq_capacity = 0;
 JANET_THREAD_LOCAL JanetQueue janet_vm_spawn;
-JANET_THREAD_LOCAL JanetTimeout *janet_vm_tq = NULL;
 JANET_THREAD_LOCAL JanetRNG janet_vm_ev_rng;
 JANET_THREAD_LOCAL JanetListenerState **janet_vm_listeners = NULL;
 JANET_THREAD_LOCAL size_t janet_vm_listener_count = 0;
 JANET_THREAD_LOCAL size_t janet_vm_listener_cap = 0;
 JANET_THREAD_LOCAL size_t janet_vm_extra_listeners = 0;
+JANET_THREAD_LOCAL JanetChannel *janet_vm_external_channel = NULL;
+JANET_THREAD_LOCAL JanetStealWorker *janet_vm_steal_worker = NULL;
+JANET_THREAD_LOCAL JanetStream **janet_vm_flush_queue = NULL;
+JANET_THREAD_LOCAL size_t janet_vm_flush_count = 0;
+JANET_THREAD_LOCAL size_t janet_vm_flush_cap = 0;
+
+/* Scheduler statistics, see ev/stats. Loop totals are always counted, and
+ * per fiber run times are only measured when turned on with ev/instrument. */
+
+#define JANET_EV_HISTOGRAM_BUCKETS 28
+#define JANET_EV_OUTLIER_LIMIT 64
+
+typedef struct {
+    uint64_t iterations;
+    uint64_t runs;
+    double run_time;
+    double poll_time;
+    JanetTimestamp max_lag;
+    int detailed;
+    double outlier;
+    double max_run;
+    uint64_t lag_histogram[JANET_EV_HISTOGRAM_BUCKETS];
+    uint64_t run_histogram[JANET_EV_HISTOGRAM_BUCKETS];
+    JanetArray *outliers;
+} JanetEVStats;
+
+static JANET_THREAD_LOCAL JanetEVStats janet_vm_ev_stats;
 
 /* Get current timestamp (millisecond precision) */
 static JanetTimestamp ts_now(void);
@@ -177,63 +231,221 @@ static JanetTimestamp ts_delta(JanetTimestamp ts, double delta) {
     return ts;
 }
 
-/* Look at the next timeout value without
- * removing it. */
-static int peek_timeout(JanetTimeout *out) {
-    if (janet_vm_tq_count == 0) return 0;
-    *out = janet_vm_tq[0];
+/*
+ * Timer wheel. Each level has 64 slots, and a slot on level k holds the timeouts
+ * whose expiry agrees with the wheel time on every digit above k (in base 64), and
+ * whose k-th digit is the slot index. When the wheel time reaches a slot on a higher
+ * level, that slot is cascaded down into the lower levels. Timeouts too far in the
+ * future to fit in the wheel go on an overflow list, and expired timeouts
+ * wait on a list of their own to be handled. Adding and removing a timeout is O(1).
+ */
+
+#define JANET_TW_BITS 6
+#define JANET_TW_SLOTS (1 << JANET_TW_BITS)
+#define JANET_TW_LEVELS 6
+#define JANET_TW_EXPIRED (-1)
+#define JANET_TW_OVERFLOW JANET_TW_LEVELS
+
+JANET_THREAD_LOCAL JanetTimeout *janet_vm_tw[JANET_TW_LEVELS][JANET_TW_SLOTS];
+JANET_THREAD_LOCAL uint64_t janet_vm_tw_occupied[JANET_TW_LEVELS];
+JANET_THREAD_LOCAL JanetTimeout *janet_vm_tw_overflow = NULL;
+JANET_THREAD_LOCAL JanetTimeout *janet_vm_tw_expired = NULL;
+JANET_THREAD_LOCAL JanetTimeout *janet_vm_tw_expired_tail = NULL;
+JANET_THREAD_LOCAL JanetTimeout *janet_vm_tw_free = NULL;
+JANET_THREAD_LOCAL JanetTimestamp janet_vm_tw_now = 0;
+JANET_THREAD_LOCAL size_t janet_vm_tq_count = 0;
+
+static int janet_tw_ctz(uint64_t x) {
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    int ret = 0;
+    while (!(x & 1)) {
+        ret++;
+        x >>= 1;
+    }
+    return ret;
+#endif
+}
+
+static JanetTimeout **janet_tw_head(JanetTimeout *to) {
+    if (to->level == JANET_TW_EXPIRED) return &janet_vm_tw_expired;
+    if (to->level == JANET_TW_OVERFLOW) return &janet_vm_tw_overflow;
+    return &janet_vm_tw[to->level][to->slot];
+}
+
+/* Put a timeout in the slot for its expiry, relative to the current wheel time */
+static void janet_tw_link(JanetTimeout *to) {
+    uint64_t when = (uint64_t) to->when;
+    uint64_t now = (uint64_t) janet_vm_tw_now;
+    to->prev = NULL;
+    if (to->when <= janet_vm_tw_now) {
+        /* Append so timeouts are handled in the order they expire */
+        to->level = JANET_TW_EXPIRED;
+        to->next = NULL;
+        to->prev = janet_vm_tw_expired_tail;
+        if (NULL == janet_vm_tw_expired_tail) {
+            janet_vm_tw_expired = to;
+        } else {
+            janet_vm_tw_expired_tail->next = to;
+        }
+        janet_vm_tw_expired_tail = to;
+        return;
+    }
+    to->level = JANET_TW_OVERFLOW;
+    for (int level = 0; level < JANET_TW_LEVELS; level++) {
+        int shift = JANET_TW_BITS * (level + 1);
+        if ((when >> shift) == (now >> shift)) {
+            to->level = level;
+            to->slot = (int)((when >> (JANET_TW_BITS * level)) & (JANET_TW_SLOTS - 1));
+            janet_vm_tw_occupied[level] |= (uint64_t) 1 << to->slot;
+            break;
+        }
+    }
+    JanetTimeout **head = janet_tw_head(to);
+    to->next = *head;
+    if (NULL != *head) (*head)->prev = to;
+    *head = to;
+}
+
+static void janet_tw_unlink(JanetTimeout *to) {
+    JanetTimeout **head = janet_tw_head(to);
+    if (NULL != to->prev) {
+        to->prev->next = to->next;
+    } else {
+        *head = to->next;
+    }
+    if (NULL != to->next) {
+        to->next->prev = to->prev;
+    } else if (to->level == JANET_TW_EXPIRED) {
+        janet_vm_tw_expired_tail = to->prev;
+    }
+    if (to->level >= 0 && to->level < JANET_TW_LEVELS && NULL == *head) {
+        janet_vm_tw_occupied[to->level] &= ~((uint64_t) 1 << to->slot);
+    }
+}
+
+/* Find the next time at which the wheel needs to move timeouts. Returns 0 if
+ * there are no pending timeouts outside of the expired list. */
+static int janet_tw_next_event(JanetTimestamp *when, int *level_out) {
+    uint64_t now = (uint64_t) janet_vm_tw_now;
+    for (int level = 0; level < JANET_TW_LEVELS; level++) {
+        int digit = (int)((now >> (JANET_TW_BITS * level)) & (JANET_TW_SLOTS - 1));
+        uint64_t later = (digit == JANET_TW_SLOTS - 1) ? 0 : (~(uint64_t) 0 << (digit + 1));
+        uint64_t mask = janet_vm_tw_occupied[level] & later;
+        if (mask) {
+            int shift = JANET_TW_BITS * (level + 1);
+            uint64_t t = ((now >> shift) << shift) | ((uint64_t) janet_tw_ctz(mask) << (JANET_TW_BITS * level));
+            *when = (JanetTimestamp) t;
+            *level_out = level;
+            return 1;
+        }
+    }
+    if (NULL != janet_vm_tw_overflow) {
+        int shift = JANET_TW_BITS * JANET_TW_LEVELS;
+        *when = (JanetTimestamp)(((now >> shift) + 1) << shift);
+        *level_out = JANET_TW_OVERFLOW;
+        return 1;
+    }
+    return 0;
+}
+
+/* Move the wheel time forward, moving timeouts that expire onto the expired list */
+static void janet_tw_advance(JanetTimestamp target) {
+    JanetTimestamp when;
+    int level;
+    while (janet_tw_next_event(&when, &level) && when <= target) {
+        janet_vm_tw_now = when;
+        JanetTimeout **head;
+        if (level == JANET_TW_OVERFLOW) {
+            head = &janet_vm_tw_overflow;
+        } else {
+            int slot = (int)(((uint64_t) when >> (JANET_TW_BITS * level)) & (JANET_TW_SLOTS - 1));
+            head = &janet_vm_tw[level][slot];
+        }
+        while (NULL != *head) {
+            JanetTimeout *to = *head;
+            janet_tw_unlink(to);
+            janet_tw_link(to);
+        }
+    }
+    if (target > janet_vm_tw_now) janet_vm_tw_now = target;
+}
+
+/* Get the time of the next pending timeout, or a time at which the wheel needs to cascade */
+static int peek_timeout(JanetTimestamp *out) {
+    int level;
+    if (NULL != janet_vm_tw_expired) {
+        *out = janet_vm_tw_now;
+        return 1;
+    }
+    return janet_tw_next_event(out, &level);
+}
+
+/* Remove an expired timeout, copying it into out. */
+static int pop_timeout(JanetTimeout *out) {
+    JanetTimeout *to = janet_vm_tw_expired;
+    if (NULL == to) return 0;
+    janet_tw_unlink(to);
+    if (NULL != to->curr_fiber) {
+        if (to->curr_fiber->deadline == to) to->curr_fiber->deadline = NULL;
+    } else if (to->fiber->timeout == to) {
+        to->fiber->timeout = NULL;
+    }
+    *out = *to;
+    to->next = janet_vm_tw_free;
+    janet_vm_tw_free = to;
+    janet_vm_tq_count--;
     return 1;
 }
 
-/* Remove the next timeout from the priority queue */
-static void pop_timeout(size_t index) {
-    if (janet_vm_tq_count <= index) return;
-    janet_vm_tq[index] = janet_vm_tq[--janet_vm_tq_count];
-    for (;;) {
-        size_t left = (index << 1) + 1;
-        size_t right = left + 1;
-        size_t smallest = index;
-        if (left < janet_vm_tq_count &&
-                (janet_vm_tq[left].when < janet_vm_tq[smallest].when))
-            smallest = left;
-        if (right < janet_vm_tq_count &&
-                (janet_vm_tq[right].when < janet_vm_tq[smallest].when))
-            smallest = right;
-        if (smallest == index) return;
-        JanetTimeout temp = janet_vm_tq[index];
-        janet_vm_tq[index] = janet_vm_tq[smallest];
-        janet_vm_tq[smallest] = temp;
-        index = smallest;
-    }
-}
-
-/* Add a timeout to the timeout min heap */
-static void add_timeout(JanetTimeout to) {
-    size_t oldcount = janet_vm_tq_count;
-    size_t newcount = oldcount + 1;
-    if (newcount > janet_vm_tq_capacity) {
-        size_t newcap = 2 * newcount;
-        JanetTimeout *tq = janet_realloc(janet_vm_tq, newcap * sizeof(JanetTimeout));
-        if (NULL == tq) {
+/* Add a timeout to the timer wheel */
+static JanetTimeout *add_timeout(JanetTimeout to) {
+    JanetTimeout *node = janet_vm_tw_free;
+    if (NULL != node) {
+        janet_vm_tw_free = node->next;
+    } else {
+        node = janet_malloc(sizeof(JanetTimeout));
+        if (NULL == node) {
             JANET_OUT_OF_MEMORY;
         }
-        janet_vm_tq = tq;
-        janet_vm_tq_capacity = newcap;
     }
-    /* Append */
-    janet_vm_tq_count = (int32_t) newcount;
-    janet_vm_tq[oldcount] = to;
-    /* Heapify */
-    size_t index = oldcount;
-    while (index > 0) {
-        size_t parent = (index - 1) >> 1;
-        if (janet_vm_tq[parent].when <= janet_vm_tq[index].when) break;
-        /* Swap */
-        JanetTimeout tmp = janet_vm_tq[index];
-        janet_vm_tq[index] = janet_vm_tq[parent];
-        janet_vm_tq[parent] = tmp;
-        /* Next */
-        index = parent;
+    *node = to;
+    janet_tw_link(node);
+    janet_vm_tq_count++;
+    return node;
+}
+
+/* Remove a pending timeout without handling it */
+static void cancel_timeout(JanetTimeout *to) {
+    janet_tw_unlink(to);
+    to->next = janet_vm_tw_free;
+    janet_vm_tw_free = to;
+    janet_vm_tq_count--;
+}
+
+/* Change the expiry of a pending timeout in place */
+static void reset_timeout(JanetTimeout *to, JanetTimestamp when) {
+    janet_tw_unlink(to);
+    to->when = when;
+    janet_tw_link(to);
+}
+
+static void mark_timeout_list(JanetTimeout *to) {
+    while (NULL != to) {
+        janet_mark(janet_wrap_fiber(to->fiber));
+        if (to->curr_fiber != NULL) {
+            janet_mark(janet_wrap_fiber(to->curr_fiber));
+        }
+        to = to->next;
+    }
+}
+
+static void free_timeout_list(JanetTimeout *to) {
+    while (NULL != to) {
+        JanetTimeout *next = to->next;
+        janet_free(to);
+        to = next;
     }
 }
 
@@ -242,7 +454,9 @@ static JanetListenerState *janet_listen_impl(JanetStream *stream, JanetListener
     if (stream->_mask & mask) {
         janet_panic("cannot listen for duplicate event on stream");
     }
-    if (janet_vm_root_fiber->waiting != NULL) {
+    /* Outside of a fiber, listen in the background - used to flush coalesced writes */
+    JanetFiber *fiber = janet_vm_root_fiber;
+    if (NULL != fiber && fiber->waiting != NULL) {
         janet_panic("current fiber is already waiting for event");
     }
     if (size < sizeof(JanetListenerState))
@@ -252,8 +466,8 @@ static JanetListenerState *janet_listen_impl(JanetStream *stream, JanetListener
         JANET_OUT_OF_MEMORY;
     }
     state->machine = behavior;
-    state->fiber = janet_vm_root_fiber;
-    janet_vm_root_fiber->waiting = state;
+    state->fiber = fiber;
+    if (NULL != fiber) fiber->waiting = state;
     state->stream = stream;
     state->_mask = mask;
     stream->_mask |= mask;
@@ -319,6 +533,8 @@ JanetStream *janet_stream(JanetHandle handle, uint32_t flags, const JanetMethod
     stream->flags = flags;
     stream->state = NULL;
     stream->_mask = 0;
+    stream->_wbuf = NULL;
+    stream->_wlimit = 0;
     if (methods == NULL) methods = ev_default_stream_methods;
     stream->methods = methods;
     return stream;
@@ -336,6 +552,9 @@ static int janet_stream_gc(void *p, size_t s) {
 void janet_stream_close(JanetStream *stream) {
     if (stream->flags & JANET_STREAM_CLOSED) return;
     JanetListenerState *state = stream->state;
+#ifdef JANET_EV_URING
+    int had_listeners = NULL != state;
+#endif
     while (NULL != state) {
         state->machine(state, JANET_ASYNC_EVENT_CLOSE);
         JanetListenerState *next_state = state->_next;
@@ -344,6 +563,13 @@ void janet_stream_close(JanetStream *stream) {
     }
     stream->state = NULL;
     stream->flags |= JANET_STREAM_CLOSED;
+#ifdef JANET_EV_URING
+    /* Pending polls keep the file open, so cancel them before closing the handle */
+    if (had_listeners) janet_uring_enter(0);
+#endif
+#ifdef JANET_EV_EPOLL
+    janet_epoll_close(stream);
+#endif
 #ifdef JANET_WINDOWS
 #ifdef JANET_NET
     if (stream->flags & JANET_STREAM_SOCKET) {
@@ -354,7 +580,7 @@ void janet_stream_close(JanetStream *stream) {
         CloseHandle(stream->handle);
     }
 #else
-    close(stream->handle);
+    if (!(stream->flags & JANET_STREAM_PROCESS)) close(stream->handle);
 #endif
 }
 
@@ -370,6 +596,9 @@ static int janet_stream_mark(void *p, size_t s) {
         (state->machine)(state, JANET_ASYNC_EVENT_MARK);
         state = state->_next;
     }
+    if (NULL != stream->_wbuf) {
+        janet_mark(janet_wrap_buffer(stream->_wbuf));
+    }
     return 0;
 }
 
@@ -423,7 +652,11 @@ static void *janet_stream_unmarshal(JanetMarshalContext *ctx) {
     /* Can't share listening state and such across threads */
     p->_mask = 0;
     p->state = NULL;
+    p->_wbuf = NULL;
+    p->_wlimit = 0;
     p->flags = (uint32_t) janet_unmarshal_int(ctx);
+    /* Coalesced output stays with the original stream */
+    p->flags &= ~(JANET_STREAM_FLUSH_QUEUED | JANET_STREAM_CLOSE_PENDING);
     p->methods = (void *) janet_unmarshal_int64(ctx);
 #ifdef JANET_WINDOWS
     p->handle = (JanetHandle) janet_unmarshal_int64(ctx);
@@ -458,6 +691,11 @@ void janet_schedule_signal(JanetFiber *fiber, Janet value, JanetSignal sig) {
     if (fiber->flags & JANET_FIBER_FLAG_SCHEDULED) return;
     fiber->flags |= JANET_FIBER_FLAG_SCHEDULED;
     fiber->sched_id++;
+    /* Any timeout on the current wait can no longer fire */
+    if (NULL != fiber->timeout) {
+        cancel_timeout(fiber->timeout);
+        fiber->timeout = NULL;
+    }
     JanetTask t = { fiber, value, sig };
     janet_q_push(&janet_vm_spawn, &t, sizeof(t));
 }
@@ -478,9 +716,22 @@ void janet_fiber_did_resume(JanetFiber *fiber) {
     }
 }
 
+static void janet_tchan_mark(void);
+static void janet_tchan_deinit(void);
+static void janet_steal_mark(void);
+static void janet_steal_deinit(void);
+static int janet_steal_finish(JanetFiber *fiber, JanetSignal sig, Janet value);
+static int janet_steal_pump(void);
+
 /* Mark all pending tasks */
 void janet_ev_mark(void) {
 
+    /* Fibers waiting on thread channels */
+    janet_tchan_mark();
+
+    /* Fibers migrated to this thread */
+    janet_steal_mark();
+
     /* Pending tasks */
     JanetTask *tasks = janet_vm_spawn.data;
     if (janet_vm_spawn.head <= janet_vm_spawn.tail) {
@@ -500,10 +751,14 @@ void janet_ev_mark(void) {
     }
 
     /* Pending timeouts */
-    for (size_t i = 0; i < janet_vm_tq_count; i++) {
-        janet_mark(janet_wrap_fiber(janet_vm_tq[i].fiber));
-        if (janet_vm_tq[i].curr_fiber != NULL) {
-            janet_mark(janet_wrap_fiber(janet_vm_tq[i].curr_fiber));
+    mark_timeout_list(janet_vm_tw_expired);
+    mark_timeout_list(janet_vm_tw_overflow);
+    for (int level = 0; level < JANET_TW_LEVELS; level++) {
+        uint64_t occupied = janet_vm_tw_occupied[level];
+        while (occupied) {
+            int slot = janet_tw_ctz(occupied);
+            occupied &= occupied - 1;
+            mark_timeout_list(janet_vm_tw[level][slot]);
         }
     }
 
@@ -516,6 +771,15 @@ void janet_ev_mark(void) {
         janet_stream_mark(state->stream, sizeof(JanetStream));
         (state->machine)(state, JANET_ASYNC_EVENT_MARK);
     }
+
+    /* Streams with coalesced output to write */
+    for (size_t i = 0; i < janet_vm_flush_count; i++) {
+        janet_mark(janet_wrap_abstract(janet_vm_flush_queue[i]));
+    }
+    /* Slow fibers noted for ev/stats */
+    if (NULL != janet_vm_ev_stats.outliers) {
+        janet_mark(janet_wrap_array(janet_vm_ev_stats.outliers));
+    }
 }
 
 static int janet_channel_push(JanetChannel *channel, Janet x, int mode);
@@ -527,13 +791,87 @@ static Janet make_supervisor_event(const char *name, JanetFiber *fiber) {
     return janet_wrap_tuple(janet_tuple_n(tup, 2));
 }
 
+static double ev_clock(void) {
+    struct timespec now;
+    janet_gettime(&now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+/* Bucket i counts durations under 2^i microseconds */
+static void ev_histogram_add(uint64_t *histogram, double seconds) {
+    uint64_t us = (uint64_t)(seconds * 1e6);
+    int i = 0;
+    while (us && i < JANET_EV_HISTOGRAM_BUCKETS - 1) {
+        us >>= 1;
+        i++;
+    }
+    histogram[i]++;
+}
+
+/* Record how late a timeout fired */
+static void ev_stats_lag(JanetTimestamp now, JanetTimestamp when) {
+    JanetTimestamp lag = now > when ? now - when : 0;
+    if (lag > janet_vm_ev_stats.max_lag) janet_vm_ev_stats.max_lag = lag;
+    if (janet_vm_ev_stats.detailed) ev_histogram_add(janet_vm_ev_stats.lag_histogram, (double) lag * 1e-3);
+}
+
+/* Remember a fiber that kept the loop busy for too long */
+static void ev_stats_outlier(JanetFunction *func, double elapsed) {
+    JanetArray *outliers = janet_vm_ev_stats.outliers;
+    if (outliers->count >= JANET_EV_OUTLIER_LIMIT) {
+        memmove(outliers->data, outliers->data + 1, (outliers->count - 1) * sizeof(Janet));
+        outliers->count--;
+    }
+    JanetFuncDef *def = func ? func->def : NULL;
+    JanetKV *st = janet_struct_begin(4);
+    janet_struct_put(st, janet_ckeywordv("name"),
+                     (def && def->name) ? janet_wrap_string(def->name) : janet_wrap_nil());
+    janet_struct_put(st, janet_ckeywordv("source"),
+                     (def && def->source) ? janet_wrap_string(def->source) : janet_wrap_nil());
+    janet_struct_put(st, janet_ckeywordv("source-line"),
+                     (def && def->sourcemap && def->bytecode_length) ?
+                     janet_wrap_integer(def->sourcemap[0].line) : janet_wrap_nil());
+    janet_struct_put(st, janet_ckeywordv("time"), janet_wrap_number(elapsed));
+    janet_array_push(outliers, janet_wrap_struct(janet_struct_end(st)));
+}
+
+/* The function a fiber was started with */
+static JanetFunction *ev_fiber_function(JanetFiber *fiber) {
+    JanetFunction *func = NULL;
+    int32_t i = fiber->frame;
+    while (i > 0) {
+        JanetStackFrame *frame = (JanetStackFrame *)(fiber->data + i - JANET_FRAME_SIZE);
+        if (frame->func) func = frame->func;
+        i = frame->prevframe;
+    }
+    return func;
+}
+
 /* Run a top level task */
 static void run_one(JanetFiber *fiber, Janet value, JanetSignal sigin) {
     fiber->flags &= ~JANET_FIBER_FLAG_SCHEDULED;
     Janet res;
-    JanetSignal sig = janet_continue_signal(fiber, value, &res, sigin);
+    janet_vm_ev_stats.runs++;
+    JanetSignal sig;
+    if (janet_vm_ev_stats.detailed) {
+        JanetFunction *func = ev_fiber_function(fiber);
+        double start = ev_clock();
+        sig = janet_continue_signal(fiber, value, &res, sigin);
+        double elapsed = ev_clock() - start;
+        /* The fiber may have turned instrumentation off */
+        if (janet_vm_ev_stats.detailed) {
+            ev_histogram_add(janet_vm_ev_stats.run_histogram, elapsed);
+            if (elapsed > janet_vm_ev_stats.max_run) janet_vm_ev_stats.max_run = elapsed;
+            if (elapsed >= janet_vm_ev_stats.outlier) ev_stats_outlier(func, elapsed);
+        }
+    } else {
+        sig = janet_continue_signal(fiber, value, &res, sigin);
+    }
     JanetChannel *chan = (JanetChannel *)(fiber->supervisor_channel);
-    if (NULL == chan) {
+    if (NULL != janet_vm_steal_worker && sig != JANET_SIGNAL_EVENT &&
+            janet_steal_finish(fiber, sig, res)) {
+        /* A migrated fiber is done, and its result went back to its origin */
+    } else if (NULL == chan) {
         if (sig != JANET_SIGNAL_EVENT && sig != JANET_SIGNAL_YIELD) {
             janet_stacktrace(fiber, res);
         }
@@ -548,18 +886,42 @@ void janet_ev_init_common(void) {
     janet_vm_listener_count = 0;
     janet_vm_listener_cap = 0;
     janet_vm_listeners = NULL;
-    janet_vm_tq = NULL;
+    memset(janet_vm_tw, 0, sizeof(janet_vm_tw));
+    memset(janet_vm_tw_occupied, 0, sizeof(janet_vm_tw_occupied));
+    janet_vm_tw_overflow = NULL;
+    janet_vm_tw_expired = NULL;
+    janet_vm_tw_expired_tail = NULL;
+    janet_vm_tw_free = NULL;
+    janet_vm_tw_now = ts_now();
     janet_vm_tq_count = 0;
-    janet_vm_tq_capacity = 0;
+    janet_vm_external_channel = NULL;
+    janet_vm_flush_queue = NULL;
+    janet_vm_flush_count = 0;
+    janet_vm_flush_cap = 0;
+    memset(&janet_vm_ev_stats, 0, sizeof(janet_vm_ev_stats));
     janet_rng_seed(&janet_vm_ev_rng, 0);
 }
 
 /* Common deinit code */
 void janet_ev_deinit_common(void) {
+    janet_tchan_deinit();
+    janet_steal_deinit();
     janet_q_deinit(&janet_vm_spawn);
-    janet_free(janet_vm_tq);
+    free_timeout_list(janet_vm_tw_expired);
+    free_timeout_list(janet_vm_tw_overflow);
+    for (int level = 0; level < JANET_TW_LEVELS; level++) {
+        for (int slot = 0; slot < JANET_TW_SLOTS; slot++) {
+            free_timeout_list(janet_vm_tw[level][slot]);
+        }
+    }
+    free_timeout_list(janet_vm_tw_free);
+    janet_vm_tq_count = 0;
     janet_free(janet_vm_listeners);
     janet_vm_listeners = NULL;
+    janet_free(janet_vm_flush_queue);
+    janet_vm_flush_queue = NULL;
+    janet_vm_flush_count = 0;
+    janet_vm_flush_cap = 0;
 }
 
 /* Short hand to yield to event loop */
@@ -576,7 +938,8 @@ void janet_addtimeout(double sec) {
     to.curr_fiber = NULL;
     to.sched_id = fiber->sched_id;
     to.is_error = 1;
-    add_timeout(to);
+    JanetTimeout *node = add_timeout(to);
+    if (NULL == fiber->timeout) fiber->timeout = node;
 }
 
 void janet_ev_inc_refcount(void) {
@@ -593,6 +956,7 @@ void janet_ev_dec_refcount(void) {
 
 static void janet_chan_init(JanetChannel *chan, int32_t limit) {
     chan->limit = limit;
+    chan->on_wait = NULL;
     janet_q_init(&chan->items);
     janet_q_init(&chan->read_pending);
     janet_q_init(&chan->write_pending);
@@ -667,14 +1031,14 @@ static int janet_chanat_mark(void *p, size_t s) {
     return 0;
 }
 
-static Janet make_write_result(JanetChannel *channel) {
+static Janet make_write_result(void *channel) {
     Janet *tup = janet_tuple_begin(2);
     tup[0] = janet_ckeywordv("give");
     tup[1] = janet_wrap_abstract(channel);
     return janet_wrap_tuple(janet_tuple_end(tup));
 }
 
-static Janet make_read_result(JanetChannel *channel, Janet x) {
+static Janet make_read_result(void *channel, Janet x) {
     Janet *tup = janet_tuple_begin(3);
     tup[0] = janet_ckeywordv("take");
     tup[1] = janet_wrap_abstract(channel);
@@ -728,6 +1092,7 @@ static int janet_channel_pop(JanetChannel *channel, Janet *item, int is_choice)
         pending.sched_id = janet_vm_root_fiber->sched_id;
         pending.mode = is_choice ? JANET_CP_MODE_CHOICE_READ : JANET_CP_MODE_ITEM;
         janet_q_push(&channel->read_pending, &pending, sizeof(pending));
+        if (channel->on_wait) channel->on_wait();
         return 0;
     }
     if (!janet_q_pop(&channel->write_pending, &writer, sizeof(writer))) {
@@ -741,10 +1106,429 @@ static int janet_channel_pop(JanetChannel *channel, Janet *item, int is_choice)
     return 1;
 }
 
+/*
+ * Thread channels. A thread channel is shared by all threads that have a
+ * handle to it, and holds marshalled values. A fiber waiting on a thread
+ * channel is recorded in the channel along with the event loop of its
+ * thread, which is woken with janet_ev_post when the fiber can continue.
+ */
+
+typedef struct {
+    JanetHandle loop;
+    JanetFiber *fiber; /* Only used by the thread that owns loop */
+    uint32_t sched_id;
+    int mode;
+} JanetThreadChanWaiter;
+
+typedef struct {
+#ifdef JANET_WINDOWS
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+    int refCount;
+    int32_t limit;
+    JanetQueue items; /* JanetBuffer */
+    JanetQueue read_pending; /* JanetThreadChanWaiter */
+    JanetQueue write_pending; /* JanetThreadChanWaiter */
+} JanetThreadChannel;
+
+/* The abstract value each thread uses to refer to a thread channel */
+typedef struct {
+    JanetThreadChannel *chan;
+} JanetThreadChanHandle;
+
+/* Fibers of this thread that are waiting on thread channels. These are gc
+ * roots and keep the event loop running while a fiber is still waiting. */
+typedef struct {
+    JanetThreadChannel *chan;
+    JanetThreadChanHandle *handle;
+    JanetFiber *fiber;
+    uint32_t sched_id;
+} JanetThreadChanWait;
+
+JANET_THREAD_LOCAL JanetThreadChanWait *janet_vm_tchan_waits = NULL;
+JANET_THREAD_LOCAL size_t janet_vm_tchan_wait_count = 0;
+JANET_THREAD_LOCAL size_t janet_vm_tchan_wait_cap = 0;
+
+static void janet_tchan_lock(JanetThreadChannel *chan) {
+#ifdef JANET_WINDOWS
+    EnterCriticalSection(&chan->lock);
+#else
+    pthread_mutex_lock(&chan->lock);
+#endif
+}
+
+static void janet_tchan_unlock(JanetThreadChannel *chan) {
+#ifdef JANET_WINDOWS
+    LeaveCriticalSection(&chan->lock);
+#else
+    pthread_mutex_unlock(&chan->lock);
+#endif
+}
+
+static JanetThreadChannel *janet_tchan_create(int32_t limit) {
+    JanetThreadChannel *chan = janet_malloc(sizeof(JanetThreadChannel));
+    if (NULL == chan) {
+        JANET_OUT_OF_MEMORY;
+    }
+#ifdef JANET_WINDOWS
+    InitializeCriticalSection(&chan->lock);
+#else
+    pthread_mutex_init(&chan->lock, NULL);
+#endif
+    chan->refCount = 1;
+    chan->limit = limit;
+    janet_q_init(&chan->items);
+    janet_q_init(&chan->read_pending);
+    janet_q_init(&chan->write_pending);
+    return chan;
+}
+
+static void janet_tchan_ref(JanetThreadChannel *chan, int delta) {
+    janet_tchan_lock(chan);
+    int refCount = (chan->refCount += delta);
+    janet_tchan_unlock(chan);
+    if (refCount) return;
+    JanetBuffer item;
+    while (!janet_q_pop(&chan->items, &item, sizeof(item))) {
+        janet_buffer_deinit(&item);
+    }
+    janet_q_deinit(&chan->items);
+    janet_q_deinit(&chan->read_pending);
+    janet_q_deinit(&chan->write_pending);
+#ifdef JANET_WINDOWS
+    DeleteCriticalSection(&chan->lock);
+#else
+    pthread_mutex_destroy(&chan->lock);
+#endif
+    janet_free(chan);
+}
+
+static int janet_tchanat_gc(void *p, size_t s) {
+    (void) s;
+    JanetThreadChanHandle *handle = p;
+    janet_tchan_ref(handle->chan, -1);
+    return 0;
+}
+
+/* Like shared values, only the pointer crosses threads, so the unsafe
+ * flag is needed. The marshalled copy holds a reference that is adopted
+ * by whoever unmarshals it. */
+static void janet_tchanat_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetThreadChanHandle *handle = p;
+    if (!(ctx->flags & JANET_MARSHAL_UNSAFE)) {
+        janet_panic("cannot marshal thread channel without unsafe flag");
+    }
+    janet_marshal_abstract(ctx, p);
+    janet_tchan_ref(handle->chan, 1);
+    janet_marshal_bytes(ctx, (const uint8_t *) &handle->chan, sizeof(JanetThreadChannel *));
+}
+
+static void *janet_tchanat_unmarshal(JanetMarshalContext *ctx) {
+    if (!(ctx->flags & JANET_MARSHAL_UNSAFE)) {
+        janet_panic("cannot unmarshal thread channel without unsafe flag");
+    }
+    JanetThreadChannel *chan;
+    janet_unmarshal_bytes(ctx, (uint8_t *) &chan, sizeof(JanetThreadChannel *));
+    JanetThreadChanHandle *handle = janet_unmarshal_abstract(ctx, sizeof(JanetThreadChanHandle));
+    handle->chan = chan;
+    return handle;
+}
+
+static int janet_tchanat_get(void *p, Janet key, Janet *out);
+static Janet janet_tchanat_next(void *p, Janet key);
+
+const JanetAbstractType janet_thread_channel_type = {
+    "core/threaded-channel",
+    janet_tchanat_gc,
+    NULL, /* mark */
+    janet_tchanat_get,
+    NULL, /* put */
+    janet_tchanat_marshal,
+    janet_tchanat_unmarshal,
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    janet_tchanat_next,
+    JANET_ATEND_NEXT
+};
+
+static void janet_tchan_event(JanetEVGenericMessage msg);
+
+/* Wake up the first waiter in a queue. Assumes the channel lock is held,
+ * which also keeps the waiting thread from closing its event loop. */
+static void janet_tchan_notify(JanetThreadChannel *chan, JanetQueue *q) {
+    JanetThreadChanWaiter waiter;
+    if (janet_q_pop(q, &waiter, sizeof(waiter))) return;
+    JanetEVGenericMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.tag = (q == &chan->write_pending) | (waiter.mode << 1);
+    msg.argi = (int32_t) waiter.sched_id;
+    msg.argp = chan;
+    msg.fiber = waiter.fiber;
+    /* The event holds a reference until it is handled */
+    chan->refCount++;
+    janet_ev_post(waiter.loop, janet_tchan_event, msg);
+}
+
+/* Drop the waiters of one fiber (or all fibers of this thread if fiber
+ * is NULL) from a queue. Assumes the channel lock is held. */
+static void janet_tchan_unwait(JanetQueue *q, JanetFiber *fiber, uint32_t sched_id) {
+    JanetHandle loop = janet_ev_loop_handle();
+    int32_t count = janet_q_count(q);
+    for (int32_t i = 0; i < count; i++) {
+        JanetThreadChanWaiter waiter;
+        janet_q_pop(q, &waiter, sizeof(waiter));
+        if (waiter.loop == loop && (NULL == fiber ||
+                                    (waiter.fiber == fiber && waiter.sched_id == sched_id))) {
+            continue;
+        }
+        janet_q_push(q, &waiter, sizeof(waiter));
+    }
+}
+
+/* Park a fiber on a thread channel. Assumes the channel lock is held. */
+static void janet_tchan_wait(JanetThreadChanHandle *handle, JanetQueue *q, int mode, JanetFiber *fiber) {
+    JanetThreadChanWaiter waiter;
+    waiter.loop = janet_ev_loop_handle();
+    waiter.fiber = fiber;
+    waiter.sched_id = fiber->sched_id;
+    waiter.mode = mode;
+    janet_q_push(q, &waiter, sizeof(waiter));
+    if (janet_vm_tchan_wait_count == janet_vm_tchan_wait_cap) {
+        size_t newcap = janet_vm_tchan_wait_cap ? janet_vm_tchan_wait_cap * 2 : 16;
+        janet_vm_tchan_waits = janet_realloc(janet_vm_tchan_waits, newcap * sizeof(JanetThreadChanWait));
+        if (NULL == janet_vm_tchan_waits) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm_tchan_wait_cap = newcap;
+    }
+    JanetThreadChanWait *wait = janet_vm_tchan_waits + janet_vm_tchan_wait_count++;
+    wait->chan = handle->chan;
+    wait->handle = handle;
+    wait->fiber = waiter.fiber;
+    wait->sched_id = waiter.sched_id;
+    handle->chan->refCount++;
+}
+
+static void janet_tchan_wait_remove(size_t index) {
+    janet_vm_tchan_waits[index] = janet_vm_tchan_waits[--janet_vm_tchan_wait_count];
+}
+
+/* Check if any fiber is still waiting on a thread channel. Waits that
+ * ended some other way (a timeout, another channel in ev/select) are dropped. */
+static int janet_tchan_waiting(void) {
+    int live = 0;
+    size_t i = 0;
+    while (i < janet_vm_tchan_wait_count) {
+        JanetThreadChanWait wait = janet_vm_tchan_waits[i];
+        if (wait.fiber->sched_id == wait.sched_id) {
+            live = 1;
+            i++;
+            continue;
+        }
+        JanetThreadChannel *chan = wait.chan;
+        janet_tchan_lock(chan);
+        janet_tchan_unwait(&chan->read_pending, wait.fiber, wait.sched_id);
+        janet_tchan_unwait(&chan->write_pending, wait.fiber, wait.sched_id);
+        janet_tchan_unlock(chan);
+        janet_tchan_wait_remove(i);
+        janet_tchan_ref(chan, -1);
+    }
+    return live;
+}
+
+static void janet_tchan_mark(void) {
+    for (size_t i = 0; i < janet_vm_tchan_wait_count; i++) {
+        janet_mark(janet_wrap_abstract(janet_vm_tchan_waits[i].handle));
+        janet_mark(janet_wrap_fiber(janet_vm_tchan_waits[i].fiber));
+    }
+}
+
+/* Called before the event loop of this thread goes away */
+static void janet_tchan_deinit(void) {
+    for (size_t i = 0; i < janet_vm_tchan_wait_count; i++) {
+        /* The handles may already be freed */
+        JanetThreadChannel *chan = janet_vm_tchan_waits[i].chan;
+        janet_tchan_lock(chan);
+        janet_tchan_unwait(&chan->read_pending, NULL, 0);
+        janet_tchan_unwait(&chan->write_pending, NULL, 0);
+        janet_tchan_unlock(chan);
+        janet_tchan_ref(chan, -1);
+    }
+    janet_free(janet_vm_tchan_waits);
+    janet_vm_tchan_waits = NULL;
+    janet_vm_tchan_wait_count = 0;
+    janet_vm_tchan_wait_cap = 0;
+}
+
+/* Marshal a value for a thread channel */
+static JanetBuffer janet_tchan_encode(Janet x) {
+    JanetBuffer *buffer = janet_buffer(0);
+    janet_marshal(buffer, x, NULL, JANET_MARSHAL_UNSAFE);
+    /* Take the memory from the gc managed buffer */
+    JanetBuffer item = *buffer;
+    buffer->data = NULL;
+    buffer->count = 0;
+    buffer->capacity = 0;
+    return item;
+}
+
+/* Unmarshal a value taken from a thread channel and free its buffer.
+ * Returns 1 and sets out to the error if the value can't be unmarshalled. */
+static int janet_tchan_decode(JanetBuffer *item, Janet *out) {
+    jmp_buf buf;
+    jmp_buf *old_buf = janet_vm_jmp_buf;
+    janet_vm_jmp_buf = &buf;
+    if (setjmp(buf)) {
+        janet_vm_jmp_buf = old_buf;
+        janet_buffer_deinit(item);
+        *out = *janet_vm_return_reg;
+        return 1;
+    }
+    *out = janet_unmarshal(item->data, item->count, JANET_MARSHAL_UNSAFE, NULL, NULL);
+    janet_vm_jmp_buf = old_buf;
+    janet_buffer_deinit(item);
+    return 0;
+}
+
+/* Push a value to a thread channel. Returns 1 if the writer should wait. */
+static int janet_tchan_push(JanetThreadChanHandle *handle, Janet x, int mode) {
+    JanetThreadChannel *chan = handle->chan;
+    JanetBuffer item = janet_tchan_encode(x);
+    janet_tchan_lock(chan);
+    if (janet_q_push(&chan->items, &item, sizeof(item))) {
+        janet_tchan_unlock(chan);
+        janet_buffer_deinit(&item);
+        janet_panicf("channel overflow: %v", x);
+    }
+    janet_tchan_notify(chan, &chan->read_pending);
+    int should_wait = janet_q_count(&chan->items) > chan->limit;
+    if (should_wait) {
+        janet_tchan_wait(handle, &chan->write_pending,
+                         mode ? JANET_CP_MODE_CHOICE_WRITE : JANET_CP_MODE_ITEM,
+                         janet_vm_root_fiber);
+    }
+    janet_tchan_unlock(chan);
+    return should_wait;
+}
+
+/* Push a value to a thread channel only if it has room. Returns 1 if pushed. */
+static int janet_tchan_try_push(JanetThreadChanHandle *handle, Janet x) {
+    JanetThreadChannel *chan = handle->chan;
+    JanetBuffer item = janet_tchan_encode(x);
+    janet_tchan_lock(chan);
+    int pushed = janet_q_count(&chan->items) < chan->limit &&
+                 !janet_q_push(&chan->items, &item, sizeof(item));
+    if (pushed) janet_tchan_notify(chan, &chan->read_pending);
+    janet_tchan_unlock(chan);
+    if (!pushed) janet_buffer_deinit(&item);
+    return pushed;
+}
+
+static int32_t janet_tchan_count(JanetThreadChanHandle *handle) {
+    janet_tchan_lock(handle->chan);
+    int32_t count = janet_q_count(&handle->chan->items);
+    janet_tchan_unlock(handle->chan);
+    return count;
+}
+
+/* Pop a value from a thread channel. Returns 1 if an item was obtained, and 0
+ * if the reader should wait (if wait is set). */
+static int janet_tchan_pop(JanetThreadChanHandle *handle, Janet *out, int wait, int mode) {
+    JanetThreadChannel *chan = handle->chan;
+    JanetBuffer item;
+    janet_tchan_lock(chan);
+    if (janet_q_pop(&chan->items, &item, sizeof(item))) {
+        if (wait) janet_tchan_wait(handle, &chan->read_pending, mode, janet_vm_root_fiber);
+        janet_tchan_unlock(chan);
+        return 0;
+    }
+    if (janet_q_count(&chan->items) <= chan->limit) {
+        janet_tchan_notify(chan, &chan->write_pending);
+    }
+    janet_tchan_unlock(chan);
+    if (janet_tchan_decode(&item, out)) {
+        janet_panicv(*out);
+    }
+    return 1;
+}
+
+/* Runs in the event loop of a waiting fiber */
+static void janet_tchan_event(JanetEVGenericMessage msg) {
+    /* Not counted by the event loop, so undo the decrement that follows */
+    janet_ev_inc_refcount();
+    JanetThreadChannel *chan = msg.argp;
+    int is_write = msg.tag & 1;
+    int mode = msg.tag >> 1;
+    uint32_t sched_id = (uint32_t) msg.argi;
+    int refs = 1;
+
+    /* Find the wait. If it is gone, the fiber must not be touched */
+    JanetThreadChanHandle *handle = NULL;
+    for (size_t i = 0; i < janet_vm_tchan_wait_count; i++) {
+        JanetThreadChanWait *wait = janet_vm_tchan_waits + i;
+        if (wait->chan == chan && wait->fiber == msg.fiber && wait->sched_id == sched_id) {
+            handle = wait->handle;
+            janet_tchan_wait_remove(i);
+            refs++;
+            break;
+        }
+    }
+    JanetFiber *fiber = (NULL != handle && msg.fiber->sched_id == sched_id) ? msg.fiber : NULL;
+
+    janet_tchan_lock(chan);
+    if (NULL == fiber) {
+        /* Pass the wakeup on to the next waiter */
+        if (is_write) {
+            if (janet_q_count(&chan->items) <= chan->limit) {
+                janet_tchan_notify(chan, &chan->write_pending);
+            }
+        } else if (chan->items.head != chan->items.tail) {
+            janet_tchan_notify(chan, &chan->read_pending);
+        }
+        janet_tchan_unlock(chan);
+    } else if (is_write) {
+        janet_tchan_unlock(chan);
+        janet_schedule(fiber, mode == JANET_CP_MODE_CHOICE_WRITE
+                       ? make_write_result(handle)
+                       : janet_wrap_abstract(handle));
+    } else {
+        JanetBuffer item;
+        if (janet_q_pop(&chan->items, &item, sizeof(item))) {
+            /* Another reader got there first, keep waiting */
+            janet_tchan_wait(handle, &chan->read_pending, mode, fiber);
+            janet_tchan_unlock(chan);
+        } else {
+            if (janet_q_count(&chan->items) <= chan->limit) {
+                janet_tchan_notify(chan, &chan->write_pending);
+            }
+            janet_tchan_unlock(chan);
+            Janet x;
+            if (janet_tchan_decode(&item, &x)) {
+                janet_cancel(fiber, x);
+            } else {
+                janet_schedule(fiber, mode == JANET_CP_MODE_CHOICE_READ
+                               ? make_read_result(handle, x)
+                               : x);
+            }
+        }
+    }
+    janet_tchan_ref(chan, -refs);
+}
+
 /* Channel Methods */
 
 static Janet cfun_channel_push(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 2);
+    JanetThreadChanHandle *handle = janet_checkabstract(argv[0], &janet_thread_channel_type);
+    if (NULL != handle) {
+        if (janet_tchan_push(handle, argv[1], 0)) {
+            janet_await();
+        }
+        return argv[0];
+    }
     JanetChannel *channel = janet_getabstract(argv, 0, &ChannelAT);
     if (janet_channel_push(channel, argv[1], 0)) {
         janet_await();
@@ -754,8 +1538,15 @@ static Janet cfun_channel_push(int32_t argc, Janet *argv) {
 
 static Janet cfun_channel_pop(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
-    JanetChannel *channel = janet_getabstract(argv, 0, &ChannelAT);
     Janet item;
+    JanetThreadChanHandle *handle = janet_checkabstract(argv[0], &janet_thread_channel_type);
+    if (NULL != handle) {
+        if (janet_tchan_pop(handle, &item, 1, JANET_CP_MODE_ITEM)) {
+            janet_schedule(janet_vm_root_fiber, item);
+        }
+        janet_await();
+    }
+    JanetChannel *channel = janet_getabstract(argv, 0, &ChannelAT);
     if (janet_channel_pop(channel, &item, 0)) {
         janet_schedule(janet_vm_root_fiber, item);
     }
@@ -771,6 +1562,13 @@ static Janet cfun_channel_choice(int32_t argc, Janet *argv) {
     for (int32_t i = 0; i < argc; i++) {
         if (janet_indexed_view(argv[i], &data, &len) && len == 2) {
             /* Write */
+            JanetThreadChanHandle *handle = janet_checkabstract(data[0], &janet_thread_channel_type);
+            if (NULL != handle) {
+                if (janet_tchan_try_push(handle, data[1])) {
+                    return make_write_result(handle);
+                }
+                continue;
+            }
             JanetChannel *chan = janet_getabstract(data, 0, &ChannelAT);
             if (janet_q_count(&chan->items) < chan->limit) {
                 janet_channel_push(chan, data[1], 1);
@@ -778,6 +1576,14 @@ static Janet cfun_channel_choice(int32_t argc, Janet *argv) {
             }
         } else {
             /* Read */
+            JanetThreadChanHandle *handle = janet_checkabstract(argv[i], &janet_thread_channel_type);
+            if (NULL != handle) {
+                Janet item;
+                if (janet_tchan_pop(handle, &item, 0, JANET_CP_MODE_CHOICE_READ)) {
+                    return make_read_result(handle, item);
+                }
+                continue;
+            }
             JanetChannel *chan = janet_getabstract(argv, i, &ChannelAT);
             if (chan->items.head != chan->items.tail) {
                 Janet item;
@@ -787,15 +1593,32 @@ static Janet cfun_channel_choice(int32_t argc, Janet *argv) {
         }
     }
 
-    /* Wait for all readers or writers */
+    /* Wait for all readers or writers. Another thread can make a thread
+     * channel ready in the meantime, in which case we stop and resume with it. */
     for (int32_t i = 0; i < argc; i++) {
         if (janet_indexed_view(argv[i], &data, &len) && len == 2) {
             /* Write */
+            JanetThreadChanHandle *handle = janet_checkabstract(data[0], &janet_thread_channel_type);
+            if (NULL != handle) {
+                if (!janet_tchan_push(handle, data[1], 1)) {
+                    janet_schedule(janet_vm_root_fiber, make_write_result(handle));
+                    break;
+                }
+                continue;
+            }
             JanetChannel *chan = janet_getabstract(data, 0, &ChannelAT);
             janet_channel_push(chan, data[1], 1);
         } else {
             /* Read */
             Janet item;
+            JanetThreadChanHandle *handle = janet_checkabstract(argv[i], &janet_thread_channel_type);
+            if (NULL != handle) {
+                if (janet_tchan_pop(handle, &item, 1, JANET_CP_MODE_CHOICE_READ)) {
+                    janet_schedule(janet_vm_root_fiber, make_read_result(handle, item));
+                    break;
+                }
+                continue;
+            }
             JanetChannel *chan = janet_getabstract(argv, i, &ChannelAT);
             janet_channel_pop(chan, &item, 1);
         }
@@ -806,18 +1629,30 @@ static Janet cfun_channel_choice(int32_t argc, Janet *argv) {
 
 static Janet cfun_channel_full(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
+    JanetThreadChanHandle *handle = janet_checkabstract(argv[0], &janet_thread_channel_type);
+    if (NULL != handle) {
+        return janet_wrap_boolean(janet_tchan_count(handle) >= handle->chan->limit);
+    }
     JanetChannel *channel = janet_getabstract(argv, 0, &ChannelAT);
     return janet_wrap_boolean(janet_q_count(&channel->items) >= channel->limit);
 }
 
 static Janet cfun_channel_capacity(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
+    JanetThreadChanHandle *handle = janet_checkabstract(argv[0], &janet_thread_channel_type);
+    if (NULL != handle) {
+        return janet_wrap_integer(handle->chan->limit);
+    }
     JanetChannel *channel = janet_getabstract(argv, 0, &ChannelAT);
     return janet_wrap_integer(channel->limit);
 }
 
 static Janet cfun_channel_count(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
+    JanetThreadChanHandle *handle = janet_checkabstract(argv[0], &janet_thread_channel_type);
+    if (NULL != handle) {
+        return janet_wrap_integer(janet_tchan_count(handle));
+    }
     JanetChannel *channel = janet_getabstract(argv, 0, &ChannelAT);
     return janet_wrap_integer(janet_q_count(&channel->items));
 }
@@ -845,6 +1680,14 @@ static Janet cfun_channel_new(int32_t argc, Janet *argv) {
     return janet_wrap_abstract(channel);
 }
 
+static Janet cfun_channel_thread_new(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    int32_t limit = janet_optnat(argv, argc, 0, 0);
+    JanetThreadChanHandle *handle = janet_abstract(&janet_thread_channel_type, sizeof(JanetThreadChanHandle));
+    handle->chan = janet_tchan_create(limit);
+    return janet_wrap_abstract(handle);
+}
+
 static const JanetMethod ev_chanat_methods[] = {
     {"select", cfun_channel_choice},
     {"rselect", cfun_channel_rchoice},
@@ -867,6 +1710,76 @@ static Janet janet_chanat_next(void *p, Janet key) {
     return janet_nextmethod(ev_chanat_methods, key);
 }
 
+static int janet_tchanat_get(void *p, Janet key, Janet *out) {
+    return janet_chanat_get(p, key, out);
+}
+
+static Janet janet_tchanat_next(void *p, Janet key) {
+    return janet_chanat_next(p, key);
+}
+
+/* Count the fibers still waiting to read from a channel. Readers that were
+ * resumed by something else (a timeout, another channel in ev/select) are
+ * left in the queue until a push skips them, so check the schedule ids. */
+static int32_t janet_channel_readers(JanetChannel *channel) {
+    JanetQueue *q = &channel->read_pending;
+    JanetChannelPending *pending = q->data;
+    int32_t count = 0;
+    for (int32_t i = q->head; i != q->tail; i = (i + 1 == q->capacity) ? 0 : i + 1) {
+        if (pending[i].sched_id == pending[i].fiber->sched_id) count++;
+    }
+    return count;
+}
+
+/* Interface for channels fed from outside of the event loop, such as the
+ * mailbox of the current thread. A thread has at most one such channel, and the
+ * event loop keeps running while a fiber waits on it. */
+
+JanetAbstract janet_ev_external_channel(void (*on_wait)(void)) {
+    if (NULL == janet_vm_external_channel) {
+        JanetChannel *channel = janet_abstract(&ChannelAT, sizeof(JanetChannel));
+        janet_chan_init(channel, 0);
+        channel->on_wait = on_wait;
+        janet_gcroot(janet_wrap_abstract(channel));
+        janet_vm_external_channel = channel;
+    }
+    return janet_vm_external_channel;
+}
+
+void janet_ev_channel_feed(JanetAbstract channel, Janet x) {
+    janet_channel_push((JanetChannel *) channel, x, 2);
+}
+
+int janet_ev_channel_take(JanetAbstract channel, Janet *out) {
+    JanetChannel *chan = (JanetChannel *) channel;
+    if (chan->items.head == chan->items.tail) return 0;
+    janet_channel_pop(chan, out, 0);
+    return 1;
+}
+
+void janet_ev_channel_wait(JanetAbstract channel) {
+    Janet item;
+    if (janet_channel_pop((JanetChannel *) channel, &item, 0)) {
+        janet_schedule(janet_vm_root_fiber, item);
+    }
+}
+
+int32_t janet_ev_channel_readers(JanetAbstract channel) {
+    return janet_channel_readers((JanetChannel *) channel);
+}
+
+static int janet_ev_external_waiting(void) {
+    /* Workers of the work stealing scheduler wait for work forever */
+    if (NULL != janet_vm_steal_worker) return 1;
+    JanetChannel *channel = janet_vm_external_channel;
+    if (NULL != channel &&
+            channel->read_pending.head != channel->read_pending.tail &&
+            janet_channel_readers(channel) > 0) {
+        return 1;
+    }
+    return janet_vm_tchan_wait_count && janet_tchan_waiting();
+}
+
 /* Main event loop */
 
 void janet_loop1_impl(int has_timeout, JanetTimestamp timeout);
@@ -875,18 +1788,20 @@ void janet_loop1(void) {
     /* Schedule expired timers */
     JanetTimeout to;
     JanetTimestamp now = ts_now();
-    while (peek_timeout(&to) && to.when <= now) {
-        pop_timeout(0);
+    janet_vm_ev_stats.iterations++;
+    janet_tw_advance(now);
+    while (pop_timeout(&to)) {
+        ev_stats_lag(now, to.when);
         if (to.curr_fiber != NULL) {
             /* This is a deadline (for a fiber, not a function call) */
             JanetFiberStatus s = janet_fiber_status(to.curr_fiber);
-            int isFinished = s == (JANET_STATUS_DEAD ||
-                                   s == JANET_STATUS_ERROR ||
-                                   s == JANET_STATUS_USER0 ||
-                                   s == JANET_STATUS_USER1 ||
-                                   s == JANET_STATUS_USER2 ||
-                                   s == JANET_STATUS_USER3 ||
-                                   s == JANET_STATUS_USER4);
+            int isFinished = (s == JANET_STATUS_DEAD ||
+                              s == JANET_STATUS_ERROR ||
+                              s == JANET_STATUS_USER0 ||
+                              s == JANET_STATUS_USER1 ||
+                              s == JANET_STATUS_USER2 ||
+                              s == JANET_STATUS_USER3 ||
+                              s == JANET_STATUS_USER4);
             if (!isFinished) {
                 janet_cancel(to.fiber, janet_cstringv("deadline expired"));
             }
@@ -903,30 +1818,43 @@ void janet_loop1(void) {
     }
 
     /* Run scheduled fibers */
-    while (janet_vm_spawn.head != janet_vm_spawn.tail) {
-        JanetTask task = {NULL, janet_wrap_nil(), JANET_SIGNAL_OK};
-        janet_q_pop(&janet_vm_spawn, &task, sizeof(task));
-        run_one(task.fiber, task.value, task.sig);
+    if (janet_vm_spawn.head != janet_vm_spawn.tail) {
+        double start = ev_clock();
+        while (janet_vm_spawn.head != janet_vm_spawn.tail) {
+            JanetTask task = {NULL, janet_wrap_nil(), JANET_SIGNAL_OK};
+            janet_q_pop(&janet_vm_spawn, &task, sizeof(task));
+            run_one(task.fiber, task.value, task.sig);
+        }
+        janet_vm_ev_stats.run_time += ev_clock() - start;
     }
 
+    /* Write out what the fibers left in coalescing streams */
+    janet_flush_pump();
+
+    /* Take more work from the work stealing scheduler */
+    int stole = NULL != janet_vm_steal_worker && janet_steal_pump();
+
     /* Poll for events */
-    if (janet_vm_listener_count || janet_vm_tq_count || janet_vm_extra_listeners) {
-        JanetTimeout to;
-        memset(&to, 0, sizeof(to));
-        int has_timeout;
-        /* Drop timeouts that are no longer needed */
-        while ((has_timeout = peek_timeout(&to)) && (to.curr_fiber == NULL) && to.fiber->sched_id != to.sched_id) {
-            pop_timeout(0);
-        }
-        /* Run polling implementation only if pending timeouts or pending events */
-        if (janet_vm_tq_count || janet_vm_listener_count || janet_vm_extra_listeners) {
-            janet_loop1_impl(has_timeout, to.when);
+    if (janet_vm_listener_count || janet_vm_tq_count || janet_vm_extra_listeners || janet_ev_external_waiting()) {
+        JanetTimestamp when = 0;
+        int has_timeout = peek_timeout(&when);
+        /* Use idle time to work on an incremental garbage collection, and
+         * only poll for events if there is more work to do. */
+        if (stole || janet_gc_idle_step()) {
+            has_timeout = 1;
+            when = ts_now();
         }
+        double start = ev_clock();
+        janet_loop1_impl(has_timeout, when);
+        janet_vm_ev_stats.poll_time += ev_clock() - start;
+        /* Close streams whose coalesced output was just written */
+        janet_flush_pump();
     }
 }
 
 void janet_loop(void) {
-    while (janet_vm_listener_count || (janet_vm_spawn.head != janet_vm_spawn.tail) || janet_vm_tq_count || janet_vm_extra_listeners) {
+    while (janet_vm_listener_count || (janet_vm_spawn.head != janet_vm_spawn.tail) || janet_vm_tq_count ||
+            janet_vm_extra_listeners || janet_vm_flush_count || janet_ev_external_waiting()) {
         janet_loop1();
     }
 }
@@ -944,12 +1872,14 @@ typedef struct {
 
 /* Structure used to initialize threads in the thread pool
  * (same head structure as self pipe event)*/
-typedef struct {
+typedef struct JanetEVThreadInit JanetEVThreadInit;
+struct JanetEVThreadInit {
     JanetEVGenericMessage msg;
     JanetThreadedCallback cb;
     JanetThreadedSubroutine subr;
     JanetHandle write_pipe;
-} JanetEVThreadInit;
+    JanetEVThreadInit *next;
+};
 
 #ifdef JANET_WINDOWS
 
@@ -1088,11 +2018,69 @@ static int make_epoll_events(int mask) {
     return events;
 }
 
+/* Edge triggered streams are registered once for both reading and writing, and
+ * remember which directions are ready. A listener added while its direction is
+ * ready is run at the start of the next loop iteration, since no new edge will come. */
+JANET_THREAD_LOCAL JanetListenerState **janet_vm_edge_pending = NULL;
+JANET_THREAD_LOCAL size_t janet_vm_edge_pending_count = 0;
+JANET_THREAD_LOCAL size_t janet_vm_edge_pending_cap = 0;
+
+static void janet_edge_pending_push(JanetListenerState *state) {
+    if (janet_vm_edge_pending_count == janet_vm_edge_pending_cap) {
+        size_t newcap = janet_vm_edge_pending_cap ? janet_vm_edge_pending_cap * 2 : 16;
+        janet_vm_edge_pending = janet_realloc(janet_vm_edge_pending, newcap * sizeof(JanetListenerState *));
+        if (NULL == janet_vm_edge_pending) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm_edge_pending_cap = newcap;
+    }
+    janet_vm_edge_pending[janet_vm_edge_pending_count++] = state;
+}
+
+static int janet_edge_ready_mask(JanetStream *stream) {
+    int mask = 0;
+    if (stream->flags & JANET_STREAM_EDGE_READABLE) mask |= JANET_ASYNC_LISTEN_READ;
+    if (stream->flags & JANET_STREAM_EDGE_WRITABLE) mask |= JANET_ASYNC_LISTEN_WRITE;
+    return mask;
+}
+
+static void janet_epoll_ctl(JanetStream *stream, int op, int events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = stream;
+    int status;
+    do {
+        status = epoll_ctl(janet_vm_epoll, op, stream->handle, &ev);
+    } while (status == -1 && errno == EINTR);
+    if (status == -1) {
+        janet_panicv(janet_ev_lasterr());
+    }
+}
+
 /* Wait for the next event */
 JanetListenerState *janet_listen(JanetStream *stream, JanetListener behavior, int mask, size_t size, void *user) {
     int is_first = !(stream->state);
     int op = is_first ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
     JanetListenerState *state = janet_listen_impl(stream, behavior, mask, size, user);
+    if (stream->flags & JANET_STREAM_EDGE) {
+        if (!(stream->flags & JANET_STREAM_EDGE_REGISTERED)) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            ev.data.ptr = stream;
+            int status;
+            do {
+                status = epoll_ctl(janet_vm_epoll, EPOLL_CTL_ADD, stream->handle, &ev);
+            } while (status == -1 && errno == EINTR);
+            if (status == -1) {
+                janet_unlisten_impl(state);
+                janet_panicv(janet_ev_lasterr());
+            }
+            stream->flags |= JANET_STREAM_EDGE_REGISTERED;
+        } else if (janet_edge_ready_mask(stream) & mask) {
+            janet_edge_pending_push(state);
+        }
+        return state;
+    }
     struct epoll_event ev;
     ev.events = make_epoll_events(state->stream->_mask);
     ev.data.ptr = stream;
@@ -1110,24 +2098,49 @@ JanetListenerState *janet_listen(JanetStream *stream, JanetListener behavior, in
 /* Tell system we are done listening for a certain event */
 static void janet_unlisten(JanetListenerState *state) {
     JanetStream *stream = state->stream;
-    if (!(stream->flags & JANET_STREAM_CLOSED)) {
+    if (stream->flags & JANET_STREAM_EDGE_REGISTERED) {
+        /* Stays registered - just make sure we don't run a freed listener */
+        for (size_t i = 0; i < janet_vm_edge_pending_count; i++) {
+            if (janet_vm_edge_pending[i] == state) janet_vm_edge_pending[i] = NULL;
+        }
+    } else if (!(stream->flags & JANET_STREAM_CLOSED)) {
         int is_last = (state->_next == NULL && stream->state == state);
         int op = is_last ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
-        struct epoll_event ev;
-        ev.events = make_epoll_events(stream->_mask & ~state->_mask);
-        ev.data.ptr = stream;
-        int status;
-        do {
-            status = epoll_ctl(janet_vm_epoll, op, stream->handle, &ev);
-        } while (status == -1 && errno == EINTR);
-        if (status == -1) {
-            janet_panicv(janet_ev_lasterr());
-        }
+        janet_epoll_ctl(stream, op, make_epoll_events(stream->_mask & ~state->_mask));
     }
     /* Destroy state machine and free memory */
     janet_unlisten_impl(state);
 }
 
+/* Called before closing a stream */
+static void janet_epoll_close(JanetStream *stream) {
+    /* The file description may outlive the handle (see janet_stream_marshal),
+     * so remove edge triggered streams explicitly. */
+    if (stream->flags & JANET_STREAM_EDGE_REGISTERED) {
+        struct epoll_event ev;
+        epoll_ctl(janet_vm_epoll, EPOLL_CTL_DEL, stream->handle, &ev);
+        stream->flags &= ~JANET_STREAM_EDGE_REGISTERED;
+    }
+}
+
+/* Run a listener on an edge triggered stream for each ready direction it wants.
+ * State machines must read or write until they would block before returning
+ * JANET_ASYNC_STATUS_NOT_DONE, at which point the direction is no longer ready. */
+static JanetAsyncStatus janet_edge_step(JanetListenerState *state) {
+    JanetStream *stream = state->stream;
+    JanetAsyncStatus status = JANET_ASYNC_STATUS_NOT_DONE;
+    if ((state->_mask & JANET_ASYNC_LISTEN_WRITE) && (stream->flags & JANET_STREAM_EDGE_WRITABLE)) {
+        status = state->machine(state, JANET_ASYNC_EVENT_WRITE);
+        if (status == JANET_ASYNC_STATUS_NOT_DONE) stream->flags &= ~JANET_STREAM_EDGE_WRITABLE;
+    }
+    if (status == JANET_ASYNC_STATUS_NOT_DONE &&
+            (state->_mask & JANET_ASYNC_LISTEN_READ) && (stream->flags & JANET_STREAM_EDGE_READABLE)) {
+        status = state->machine(state, JANET_ASYNC_EVENT_READ);
+        if (status == JANET_ASYNC_STATUS_NOT_DONE) stream->flags &= ~JANET_STREAM_EDGE_READABLE;
+    }
+    return status;
+}
+
 #define JANET_EPOLL_MAX_EVENTS 64
 void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
     struct itimerspec its;
@@ -1141,11 +2154,23 @@ void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
     }
     janet_vm_timer_enabled = has_timeout;
 
+    /* Run listeners on edge triggered streams that were already ready */
+    int ran_pending = janet_vm_edge_pending_count > 0;
+    for (size_t i = 0; i < janet_vm_edge_pending_count; i++) {
+        JanetListenerState *state = janet_vm_edge_pending[i];
+        if (NULL == state) continue;
+        janet_vm_edge_pending[i] = NULL;
+        if (janet_edge_step(state) == JANET_ASYNC_STATUS_DONE) {
+            janet_unlisten(state);
+        }
+    }
+    janet_vm_edge_pending_count = 0;
+
     /* Poll for events */
     struct epoll_event events[JANET_EPOLL_MAX_EVENTS];
     int ready;
     do {
-        ready = epoll_wait(janet_vm_epoll, events, JANET_EPOLL_MAX_EVENTS, -1);
+        ready = epoll_wait(janet_vm_epoll, events, JANET_EPOLL_MAX_EVENTS, ran_pending ? 0 : -1);
     } while (ready == -1 && errno == EINTR);
     if (ready == -1) {
         JANET_EXIT("failed to poll events");
@@ -1163,21 +2188,32 @@ void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
             JanetStream *stream = p;
             int mask = events[i].events;
             JanetListenerState *state = stream->state;
-            state->event = events + i;
+            int is_edge = stream->flags & JANET_STREAM_EDGE_REGISTERED;
+            if (is_edge) {
+                if (mask & (EPOLLIN | EPOLLHUP | EPOLLERR)) stream->flags |= JANET_STREAM_EDGE_READABLE;
+                if (mask & (EPOLLOUT | EPOLLERR)) stream->flags |= JANET_STREAM_EDGE_WRITABLE;
+            }
+            if (NULL != state) state->event = events + i;
             while (NULL != state) {
                 JanetListenerState *next_state = state->_next;
                 JanetAsyncStatus status1 = JANET_ASYNC_STATUS_NOT_DONE;
                 JanetAsyncStatus status2 = JANET_ASYNC_STATUS_NOT_DONE;
                 JanetAsyncStatus status3 = JANET_ASYNC_STATUS_NOT_DONE;
                 JanetAsyncStatus status4 = JANET_ASYNC_STATUS_NOT_DONE;
-                if (mask & EPOLLOUT)
-                    status1 = state->machine(state, JANET_ASYNC_EVENT_WRITE);
-                if (mask & EPOLLIN)
-                    status2 = state->machine(state, JANET_ASYNC_EVENT_READ);
-                if (mask & EPOLLERR)
-                    status3 = state->machine(state, JANET_ASYNC_EVENT_ERR);
-                if ((mask & EPOLLHUP) && !(mask & (EPOLLOUT | EPOLLIN)))
-                    status4 = state->machine(state, JANET_ASYNC_EVENT_HUP);
+                if (is_edge) {
+                    status1 = janet_edge_step(state);
+                } else {
+                    if (mask & EPOLLOUT)
+                        status1 = state->machine(state, JANET_ASYNC_EVENT_WRITE);
+                    if (mask & EPOLLIN)
+                        status2 = state->machine(state, JANET_ASYNC_EVENT_READ);
+                }
+                if (status1 != JANET_ASYNC_STATUS_DONE) {
+                    if (mask & EPOLLERR)
+                        status3 = state->machine(state, JANET_ASYNC_EVENT_ERR);
+                    if ((mask & EPOLLHUP) && !(mask & (EPOLLOUT | EPOLLIN)))
+                        status4 = state->machine(state, JANET_ASYNC_EVENT_HUP);
+                }
                 if (status1 == JANET_ASYNC_STATUS_DONE ||
                         status2 == JANET_ASYNC_STATUS_DONE ||
                         status3 == JANET_ASYNC_STATUS_DONE ||
@@ -1210,6 +2246,10 @@ error:
 
 void janet_ev_deinit(void) {
     janet_ev_deinit_common();
+    janet_free(janet_vm_edge_pending);
+    janet_vm_edge_pending = NULL;
+    janet_vm_edge_pending_count = 0;
+    janet_vm_edge_pending_cap = 0;
     close(janet_vm_epoll);
     close(janet_vm_timerfd);
     janet_ev_cleanup_selfpipe();
@@ -1220,21 +2260,113 @@ void janet_ev_deinit(void) {
  * End epoll implementation
  */
 
-#else
+#elif defined(JANET_EV_URING)
 
-#include <poll.h>
+/*
+ * io_uring implementation. Stream reads, writes and accepts are completion based, like
+ * IOCP on windows: the state machine submits the read, recv, write, send or accept
+ * itself with janet_uring_submit, and gets the result back as a
+ * JANET_ASYNC_EVENT_COMPLETE event. Every other listener gets a one shot poll request
+ * on the ring. Requests and cancellations are queued up and submitted in the same
+ * io_uring_enter call that waits for completions. The ring is driven with raw system
+ * calls so we don't need liburing.
+ */
 
-JANET_THREAD_LOCAL struct pollfd *janet_vm_fds = NULL;
+/* A request in flight - a poll, or a completion based read, write or accept. Owned by
+ * the ring until its completion is reaped, so a listener can be freed while its
+ * request is still pending. For the same reason, data is read into and written
+ * from a copy in the request rather than the listener's buffer. */
+typedef struct {
+    JanetListenerState *state;
+    int opcode;
+    uint8_t data[];
+} JanetURingRequest;
+
+typedef struct {
+    int fd;
+    /* Submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_entries;
+    unsigned *sq_array;
+    unsigned sq_local_tail;
+    unsigned sq_submitted;
+    struct io_uring_sqe *sqes;
+    /* Completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Mappings */
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} JanetURing;
+
+#define JANET_URING_ENTRIES 256
+
+JANET_THREAD_LOCAL JanetURing janet_vm_uring;
+JANET_THREAD_LOCAL int janet_vm_uring_complete = 0;
+JANET_THREAD_LOCAL int janet_vm_timerfd = 0;
+JANET_THREAD_LOCAL int janet_vm_timer_enabled = 0;
 
 static JanetTimestamp ts_now(void) {
     struct timespec now;
-    janet_assert(-1 != clock_gettime(CLOCK_REALTIME, &now), "failed to get time");
+    janet_assert(-1 != clock_gettime(CLOCK_MONOTONIC, &now), "failed to get time");
     uint64_t res = 1000 * now.tv_sec;
     res += now.tv_nsec / 1000000;
     return res;
 }
 
-static int make_poll_events(int mask) {
+/* Submit queued requests, and optionally wait for at least one completion */
+static void janet_uring_enter(int wait) {
+    JanetURing *ring = &janet_vm_uring;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sq_local_tail - ring->sq_submitted;
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    long status;
+    do {
+        status = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait ? 1 : 0, flags, NULL, 0);
+    } while (status == -1 && errno == EINTR);
+    if (status == -1) {
+        /* Completion queue is backed up - reap completions and try again later */
+        if (errno == EBUSY || errno == EAGAIN) return;
+        JANET_EXIT("failed to submit events");
+    }
+    ring->sq_submitted += (unsigned) status;
+}
+
+/* Get a fresh submission queue entry, flushing the queue if it is full */
+static struct io_uring_sqe *janet_uring_sqe(void) {
+    JanetURing *ring = &janet_vm_uring;
+    while (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= *ring->sq_entries) {
+        janet_uring_enter(0);
+    }
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = ring->sqes + index;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+static void janet_uring_poll_add(int fd, int events, void *user) {
+    struct io_uring_sqe *sqe = janet_uring_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+#ifdef JANET_BIG_ENDIAN
+    /* poll32_events is word-reversed on big endian */
+    sqe->poll32_events = (((uint32_t) events) << 16) | (((uint32_t) events) >> 16);
+#else
+    sqe->poll32_events = (uint32_t) events;
+#endif
+    sqe->user_data = (uint64_t)(uintptr_t) user;
+}
+
+static int make_uring_events(int mask) {
     int events = 0;
     if (mask & JANET_ASYNC_LISTEN_READ)
         events |= POLLIN;
@@ -1243,154 +2375,803 @@ static int make_poll_events(int mask) {
     return events;
 }
 
+static JanetURingRequest *janet_uring_request(JanetListenerState *state, int opcode, int32_t size) {
+    JanetURingRequest *req = janet_malloc(sizeof(JanetURingRequest) + (size_t) size);
+    if (NULL == req) {
+        JANET_OUT_OF_MEMORY;
+    }
+    req->state = state;
+    req->opcode = opcode;
+    state->tag = req;
+    return req;
+}
+
+/* Arm a one shot poll for a listener */
+static void janet_uring_arm(JanetListenerState *state) {
+    JanetURingRequest *req = janet_uring_request(state, IORING_OP_POLL_ADD, 0);
+    janet_uring_poll_add(state->stream->handle, make_uring_events(state->_mask), req);
+}
+
 /* Wait for the next event */
 JanetListenerState *janet_listen(JanetStream *stream, JanetListener behavior, int mask, size_t size, void *user) {
-    size_t oldsize = janet_vm_listener_cap;
     JanetListenerState *state = janet_listen_impl(stream, behavior, mask, size, user);
-    size_t newsize = janet_vm_listener_cap;
-    if (newsize > oldsize) {
-        janet_vm_fds = janet_realloc(janet_vm_fds, (newsize + 1) * sizeof(struct pollfd));
-        if (NULL == janet_vm_fds) {
-            JANET_OUT_OF_MEMORY;
+    janet_uring_arm(state);
+    return state;
+}
+
+/* Wait for requests that the state machine submits with janet_uring_submit */
+JanetListenerState *janet_uring_listen(JanetStream *stream, JanetListener behavior, int mask, size_t size, void *user) {
+    JanetListenerState *state = janet_listen_impl(stream, behavior, mask, size, user);
+    state->tag = NULL;
+    return state;
+}
+
+/* Start a read, recv, write, send or accept for a listener. Writes send up to size bytes
+ * gathered from iov, reads get up to size bytes. The result - a byte count, the accepted
+ * socket, or a negative error code - is passed to the state machine in state->bytes with a
+ * JANET_ASYNC_EVENT_COMPLETE event, and the data read in state->event. On kernels that
+ * cannot do this, the state machine gets readiness events instead. */
+void janet_uring_submit(JanetListenerState *state, int opcode, int32_t size, const struct iovec *iov, int niov, int flags) {
+    if (!janet_vm_uring_complete) {
+        janet_uring_arm(state);
+        return;
+    }
+    JanetURingRequest *req = janet_uring_request(state, opcode, size);
+    if (NULL != iov) {
+        int32_t len = 0;
+        for (int i = 0; i < niov && len < size; i++) {
+            size_t n = iov[i].iov_len < (size_t)(size - len) ? iov[i].iov_len : (size_t)(size - len);
+            memcpy(req->data + len, iov[i].iov_base, n);
+            len += (int32_t) n;
         }
+        size = len;
+    }
+    struct io_uring_sqe *sqe = janet_uring_sqe();
+    sqe->opcode = opcode;
+    sqe->fd = state->stream->handle;
+    sqe->user_data = (uint64_t)(uintptr_t) req;
+    if (opcode == IORING_OP_ACCEPT) {
+        sqe->accept_flags = SOCK_CLOEXEC;
+        return;
+    }
+    sqe->addr = (uint64_t)(uintptr_t) req->data;
+    sqe->len = (uint32_t) size;
+    if (opcode == IORING_OP_RECV || opcode == IORING_OP_SEND) {
+        sqe->msg_flags = (uint32_t) flags;
+    } else {
+        /* Read and write at the current file position */
+        sqe->off = (uint64_t) -1;
     }
-    struct pollfd ev;
-    ev.fd = stream->handle;
-    ev.events = make_poll_events(state->stream->_mask);
-    ev.revents = 0;
-    janet_vm_fds[state->_index + 1] = ev;
-    return state;
 }
 
+/* Tell system we are done listening for a certain event */
 static void janet_unlisten(JanetListenerState *state) {
-    janet_vm_fds[state->_index + 1] = janet_vm_fds[janet_vm_listener_count];
+    JanetURingRequest *req = state->tag;
+    if (NULL != req) {
+        /* The request is freed when its (canceled) completion is reaped */
+        req->state = NULL;
+        struct io_uring_sqe *sqe = janet_uring_sqe();
+        sqe->opcode = req->opcode == IORING_OP_POLL_ADD ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+        sqe->addr = (uint64_t)(uintptr_t) req;
+        sqe->user_data = 0;
+    }
     janet_unlisten_impl(state);
 }
 
+static void janet_uring_complete(JanetListenerState *state, JanetURingRequest *req, int res) {
+    if (res == -EAGAIN || res == -EINTR) {
+        /* Nonblocking files that aren't ready fail right away, so wait for readiness instead */
+        janet_free(req);
+        janet_uring_arm(state);
+        return;
+    }
+    state->bytes = res;
+    state->event = req->data;
+    JanetAsyncStatus status = state->machine(state, JANET_ASYNC_EVENT_COMPLETE);
+    janet_free(req);
+    if (status == JANET_ASYNC_STATUS_DONE) {
+        janet_unlisten(state);
+    } else if (NULL == state->tag) {
+        janet_uring_arm(state);
+    }
+}
+
+static void janet_uring_handle(JanetURingRequest *req, int res) {
+    JanetListenerState *state = req->state;
+    if (NULL == state) {
+        /* Don't leak a connection accepted after its listener went away */
+        if (req->opcode == IORING_OP_ACCEPT && res >= 0) close(res);
+        janet_free(req);
+        return;
+    }
+    state->tag = NULL;
+    if (req->opcode != IORING_OP_POLL_ADD) {
+        janet_uring_complete(state, req, res);
+        return;
+    }
+    janet_free(req);
+    int mask = res < 0 ? POLLERR : res;
+    state->event = &mask;
+    JanetAsyncStatus status1 = JANET_ASYNC_STATUS_NOT_DONE;
+    JanetAsyncStatus status2 = JANET_ASYNC_STATUS_NOT_DONE;
+    JanetAsyncStatus status3 = JANET_ASYNC_STATUS_NOT_DONE;
+    JanetAsyncStatus status4 = JANET_ASYNC_STATUS_NOT_DONE;
+    if (mask & POLLOUT)
+        status1 = state->machine(state, JANET_ASYNC_EVENT_WRITE);
+    if (mask & POLLIN)
+        status2 = state->machine(state, JANET_ASYNC_EVENT_READ);
+    if (mask & POLLERR)
+        status3 = state->machine(state, JANET_ASYNC_EVENT_ERR);
+    if ((mask & POLLHUP) && !(mask & (POLLOUT | POLLIN)))
+        status4 = state->machine(state, JANET_ASYNC_EVENT_HUP);
+    if (status1 == JANET_ASYNC_STATUS_DONE ||
+            status2 == JANET_ASYNC_STATUS_DONE ||
+            status3 == JANET_ASYNC_STATUS_DONE ||
+            status4 == JANET_ASYNC_STATUS_DONE) {
+        janet_unlisten(state);
+    } else {
+        janet_uring_arm(state);
+    }
+}
+
 void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
-    /* Poll for events */
-    int ready;
-    do {
-        int to = -1;
+    JanetURing *ring = &janet_vm_uring;
+    struct itimerspec its;
+    if (janet_vm_timer_enabled || has_timeout) {
+        memset(&its, 0, sizeof(its));
         if (has_timeout) {
-            JanetTimestamp now = ts_now();
-            to = now > timeout ? 0 : (int)(timeout - now);
+            its.it_value.tv_sec = timeout / 1000;
+            its.it_value.tv_nsec = (timeout % 1000) * 1000000;
         }
-        ready = poll(janet_vm_fds, janet_vm_listener_count + 1, to);
-    } while (ready == -1 && errno == EINTR);
-    if (ready == -1) {
-        JANET_EXIT("failed to poll events");
-    }
-
-    /* Check selfpipe */
-    if (janet_vm_fds[0].revents & POLLIN) {
-        janet_vm_fds[0].revents = 0;
-        janet_ev_handle_selfpipe();
+        timerfd_settime(janet_vm_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
     }
+    janet_vm_timer_enabled = has_timeout;
 
-    /* Step state machines */
-    for (size_t i = 0; i < janet_vm_listener_count; i++) {
-        struct pollfd *pfd = janet_vm_fds + i + 1;
-        /* Skip fds where nothing interesting happened */
-        JanetListenerState *state = janet_vm_listeners[i];
-        /* Normal event */
-        int mask = pfd->revents;
-        JanetAsyncStatus status1 = JANET_ASYNC_STATUS_NOT_DONE;
-        JanetAsyncStatus status2 = JANET_ASYNC_STATUS_NOT_DONE;
-        JanetAsyncStatus status3 = JANET_ASYNC_STATUS_NOT_DONE;
-        JanetAsyncStatus status4 = JANET_ASYNC_STATUS_NOT_DONE;
-        state->event = pfd;
-        if (mask & POLLOUT)
-            status1 = state->machine(state, JANET_ASYNC_EVENT_WRITE);
-        if (mask & POLLIN)
-            status2 = state->machine(state, JANET_ASYNC_EVENT_READ);
-        if (mask & POLLERR)
-            status3 = state->machine(state, JANET_ASYNC_EVENT_ERR);
-        if ((mask & POLLHUP) && !(mask & (POLLIN | POLLOUT)))
-            status4 = state->machine(state, JANET_ASYNC_EVENT_HUP);
-        if (status1 == JANET_ASYNC_STATUS_DONE ||
-                status2 == JANET_ASYNC_STATUS_DONE ||
-                status3 == JANET_ASYNC_STATUS_DONE ||
-                status4 == JANET_ASYNC_STATUS_DONE)
-            janet_unlisten(state);
+    /* Submit pending requests and wait for completions in one call */
+    janet_uring_enter(1);
+
+    /* Reap completions */
+    unsigned head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe cqe = ring->cqes[head & *ring->cq_mask];
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        void *p = (void *)(uintptr_t) cqe.user_data;
+        if (NULL == p) {
+            /* Result of a cancellation, ignore */;
+        } else if (&janet_vm_timerfd == p) {
+            /* Timer expired, clear and rearm */
+            uint64_t expirations;
+            while (read(janet_vm_timerfd, &expirations, sizeof(expirations)) > 0);
+            janet_uring_poll_add(janet_vm_timerfd, POLLIN, &janet_vm_timerfd);
+        } else if (janet_vm_selfpipe == p) {
+            /* Self-pipe handling */
+            janet_ev_handle_selfpipe();
+            janet_uring_poll_add(janet_vm_selfpipe[0], POLLIN, janet_vm_selfpipe);
+        } else {
+            janet_uring_handle((JanetURingRequest *) p, cqe.res);
+        }
     }
 }
 
 void janet_ev_init(void) {
     janet_ev_init_common();
-    janet_vm_fds = NULL;
     janet_ev_setup_selfpipe();
-    janet_vm_fds = janet_malloc(sizeof(struct pollfd));
-    if (NULL == janet_vm_fds) {
-        JANET_OUT_OF_MEMORY;
+    JanetURing *ring = &janet_vm_uring;
+    memset(ring, 0, sizeof(JanetURing));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int) syscall(__NR_io_uring_setup, JANET_URING_ENTRIES, &params);
+    if (ring->fd < 0) goto error;
+    fcntl(ring->fd, F_SETFD, FD_CLOEXEC);
+    /* Completion based requests need the kernel to poll sockets that are not ready,
+     * and to read and write at the current file position */
+    janet_vm_uring_complete = (params.features & IORING_FEAT_FAST_POLL) &&
+                              (params.features & IORING_FEAT_RW_CUR_POS);
+
+    /* Map rings */
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
     }
-    janet_vm_fds[0].fd = janet_vm_selfpipe[0];
-    janet_vm_fds[0].events = POLLIN;
-    janet_vm_fds[0].revents = 0;
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) goto error;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) goto error;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto error;
+    char *sq = ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = (unsigned *)(sq + params.sq_off.ring_entries);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->sq_submitted = ring->sq_local_tail;
+    char *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    /* Timer and self pipe */
+    janet_vm_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    janet_vm_timer_enabled = 0;
+    if (janet_vm_timerfd == -1) goto error;
+    janet_uring_poll_add(janet_vm_timerfd, POLLIN, &janet_vm_timerfd);
+    janet_uring_poll_add(janet_vm_selfpipe[0], POLLIN, janet_vm_selfpipe);
     return;
+error:
+    JANET_EXIT("failed to initialize event loop");
 }
 
 void janet_ev_deinit(void) {
+    JanetURing *ring = &janet_vm_uring;
     janet_ev_deinit_common();
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    close(janet_vm_timerfd);
     janet_ev_cleanup_selfpipe();
-    janet_free(janet_vm_fds);
-    janet_vm_fds = NULL;
 }
 
-#endif
-
 /*
- * End poll implementation
+ * End io_uring implementation
  */
 
+#elif defined(JANET_EV_KQUEUE)
+
 /*
- * Threaded calls
+ * kqueue implementation for BSDs and macOS. Each stream is registered with one
+ * filter per direction it is listening on, and timeouts use a one shot EVFILT_TIMER
+ * instead of a timer file descriptor.
  */
 
-#ifdef JANET_WINDOWS
-static DWORD WINAPI janet_thread_body(LPVOID ptr) {
-    JanetEVThreadInit *init = (JanetEVThreadInit *)ptr;
-    JanetEVGenericMessage msg = init->msg;
-    JanetThreadedSubroutine subr = init->subr;
-    JanetThreadedCallback cb = init->cb;
-    JanetHandle iocp = init->write_pipe;
-    /* Reuse memory from thread init for returning data */
-    init->msg = subr(msg);
-    init->cb = cb;
-    janet_assert(PostQueuedCompletionStatus(iocp,
-                                            sizeof(JanetSelfPipeEvent),
-                                            0,
-                                            (LPOVERLAPPED) init),
-                 "failed to post completion event");
-    return 0;
+JANET_THREAD_LOCAL int janet_vm_kq = 0;
+JANET_THREAD_LOCAL int janet_vm_timer_enabled = 0;
+
+/* Identifier of the timeout timer in the EVFILT_TIMER namespace */
+#define JANET_KQUEUE_TIMER_IDENT 1
+
+static JanetTimestamp ts_now(void) {
+    struct timespec now;
+    janet_assert(-1 != clock_gettime(CLOCK_MONOTONIC, &now), "failed to get time");
+    uint64_t res = 1000 * now.tv_sec;
+    res += now.tv_nsec / 1000000;
+    return res;
 }
-#else
-static void *janet_thread_body(void *ptr) {
-    JanetEVThreadInit *init = (JanetEVThreadInit *)ptr;
-    JanetEVGenericMessage msg = init->msg;
-    JanetThreadedSubroutine subr = init->subr;
-    JanetThreadedCallback cb = init->cb;
-    int fd = init->write_pipe;
-    janet_free(init);
+
+/* Add or remove the filters for each direction in mask */
+static int janet_kqueue_update(JanetStream *stream, int mask, int flags) {
+    struct kevent changes[2];
+    int count = 0;
+    if (stream->flags & JANET_STREAM_PROCESS) {
+        /* The handle is a process id, and reading means waiting for it to exit.
+         * The filter goes away on its own once the exit is reported. */
+        if (!(mask & JANET_ASYNC_LISTEN_READ)) return 0;
+        EV_SET(changes, stream->handle, EVFILT_PROC, flags, NOTE_EXIT, 0, stream);
+        int status;
+        do {
+            status = kevent(janet_vm_kq, changes, 1, NULL, 0, NULL);
+        } while (status == -1 && errno == EINTR);
+        return (flags & EV_DELETE) ? 0 : status;
+    }
+    if (mask & JANET_ASYNC_LISTEN_READ) {
+        EV_SET(changes + count, stream->handle, EVFILT_READ, flags, 0, 0, stream);
+        count++;
+    }
+    if (mask & JANET_ASYNC_LISTEN_WRITE) {
+        EV_SET(changes + count, stream->handle, EVFILT_WRITE, flags, 0, 0, stream);
+        count++;
+    }
+    if (count == 0) return 0;
+    int status;
+    do {
+        status = kevent(janet_vm_kq, changes, count, NULL, 0, NULL);
+    } while (status == -1 && errno == EINTR);
+    return status;
+}
+
+/* Wait for the next event */
+JanetListenerState *janet_listen(JanetStream *stream, JanetListener behavior, int mask, size_t size, void *user) {
+    JanetListenerState *state = janet_listen_impl(stream, behavior, mask, size, user);
+    if (-1 == janet_kqueue_update(stream, state->_mask, EV_ADD)) {
+        janet_unlisten_impl(state);
+        janet_panicv(janet_ev_lasterr());
+    }
+    return state;
+}
+
+/* Tell system we are done listening for a certain event */
+static void janet_unlisten(JanetListenerState *state) {
+    JanetStream *stream = state->stream;
+    /* Closing a descriptor removes its filters */
+    if (!(stream->flags & JANET_STREAM_CLOSED)) {
+        if (-1 == janet_kqueue_update(stream, state->_mask, EV_DELETE)) {
+            janet_panicv(janet_ev_lasterr());
+        }
+    }
+    /* Destroy state machine and free memory */
+    janet_unlisten_impl(state);
+}
+
+#define JANET_KQUEUE_MAX_EVENTS 64
+void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
+    /* Set or clear the timeout timer along with waiting for events. Any error for
+     * the change (such as deleting a timer that already fired) comes back as an event. */
+    struct kevent change;
+    int nchanges = 0;
+    if (has_timeout) {
+        JanetTimestamp now = ts_now();
+        int64_t delay = timeout > now ? (int64_t)(timeout - now) : 0;
+        EV_SET(&change, JANET_KQUEUE_TIMER_IDENT, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, delay, &janet_vm_timer_enabled);
+        nchanges = 1;
+    } else if (janet_vm_timer_enabled) {
+        EV_SET(&change, JANET_KQUEUE_TIMER_IDENT, EVFILT_TIMER, EV_DELETE, 0, 0, &janet_vm_timer_enabled);
+        nchanges = 1;
+    }
+    janet_vm_timer_enabled = has_timeout;
+
+    /* Poll for events */
+    struct kevent events[JANET_KQUEUE_MAX_EVENTS];
+    int ready;
+    do {
+        ready = kevent(janet_vm_kq, &change, nchanges, events, JANET_KQUEUE_MAX_EVENTS, NULL);
+    } while (ready == -1 && errno == EINTR);
+    if (ready == -1) {
+        JANET_EXIT("failed to poll events");
+    }
+
+    /* Step state machines */
+    for (int i = 0; i < ready; i++) {
+        struct kevent *event = events + i;
+        void *p = (void *) event->udata;
+        if (event->filter == EVFILT_TIMER) {
+            /* Timer expired, and was removed since it is one shot */
+            if (!(event->flags & EV_ERROR)) janet_vm_timer_enabled = 0;
+        } else if (janet_vm_selfpipe == p) {
+            /* Self-pipe handling */
+            janet_ev_handle_selfpipe();
+        } else {
+            JanetStream *stream = p;
+            JanetListenerState *state = stream->state;
+            if (NULL != state) state->event = event;
+            while (NULL != state) {
+                JanetListenerState *next_state = state->_next;
+                JanetAsyncStatus status = JANET_ASYNC_STATUS_NOT_DONE;
+                if (event->flags & EV_ERROR) {
+                    status = state->machine(state, JANET_ASYNC_EVENT_ERR);
+                } else if (event->filter == EVFILT_WRITE) {
+                    status = state->machine(state, JANET_ASYNC_EVENT_WRITE);
+                } else if (event->filter == EVFILT_READ || event->filter == EVFILT_PROC) {
+                    status = state->machine(state, JANET_ASYNC_EVENT_READ);
+                }
+                if (status == JANET_ASYNC_STATUS_DONE)
+                    janet_unlisten(state);
+                state = next_state;
+            }
+        }
+    }
+}
+
+void janet_ev_init(void) {
+    janet_ev_init_common();
+    janet_ev_setup_selfpipe();
+    janet_vm_kq = kqueue();
+    janet_vm_timer_enabled = 0;
+    if (janet_vm_kq == -1) goto error;
+    fcntl(janet_vm_kq, F_SETFD, FD_CLOEXEC);
+    struct kevent change;
+    EV_SET(&change, janet_vm_selfpipe[0], EVFILT_READ, EV_ADD, 0, 0, janet_vm_selfpipe);
+    if (-1 == kevent(janet_vm_kq, &change, 1, NULL, 0, NULL)) goto error;
+    return;
+error:
+    JANET_EXIT("failed to initialize event loop");
+}
+
+void janet_ev_deinit(void) {
+    janet_ev_deinit_common();
+    close(janet_vm_kq);
+    janet_ev_cleanup_selfpipe();
+    janet_vm_kq = 0;
+}
+
+/*
+ * End kqueue implementation
+ */
+
+#else
+
+#include <poll.h>
+
+JANET_THREAD_LOCAL struct pollfd *janet_vm_fds = NULL;
+
+static JanetTimestamp ts_now(void) {
+    struct timespec now;
+    janet_assert(-1 != clock_gettime(CLOCK_REALTIME, &now), "failed to get time");
+    uint64_t res = 1000 * now.tv_sec;
+    res += now.tv_nsec / 1000000;
+    return res;
+}
+
+static int make_poll_events(int mask) {
+    int events = 0;
+    if (mask & JANET_ASYNC_LISTEN_READ)
+        events |= POLLIN;
+    if (mask & JANET_ASYNC_LISTEN_WRITE)
+        events |= POLLOUT;
+    return events;
+}
+
+/* Wait for the next event */
+JanetListenerState *janet_listen(JanetStream *stream, JanetListener behavior, int mask, size_t size, void *user) {
+    size_t oldsize = janet_vm_listener_cap;
+    JanetListenerState *state = janet_listen_impl(stream, behavior, mask, size, user);
+    size_t newsize = janet_vm_listener_cap;
+    if (newsize > oldsize) {
+        janet_vm_fds = janet_realloc(janet_vm_fds, (newsize + 1) * sizeof(struct pollfd));
+        if (NULL == janet_vm_fds) {
+            JANET_OUT_OF_MEMORY;
+        }
+    }
+    struct pollfd ev;
+    ev.fd = stream->handle;
+    ev.events = make_poll_events(state->stream->_mask);
+    ev.revents = 0;
+    janet_vm_fds[state->_index + 1] = ev;
+    return state;
+}
+
+static void janet_unlisten(JanetListenerState *state) {
+    janet_vm_fds[state->_index + 1] = janet_vm_fds[janet_vm_listener_count];
+    janet_unlisten_impl(state);
+}
+
+void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
+    /* Poll for events */
+    int ready;
+    do {
+        int to = -1;
+        if (has_timeout) {
+            JanetTimestamp now = ts_now();
+            to = now > timeout ? 0 : (int)(timeout - now);
+        }
+        ready = poll(janet_vm_fds, janet_vm_listener_count + 1, to);
+    } while (ready == -1 && errno == EINTR);
+    if (ready == -1) {
+        JANET_EXIT("failed to poll events");
+    }
+
+    /* Check selfpipe */
+    if (janet_vm_fds[0].revents & POLLIN) {
+        janet_vm_fds[0].revents = 0;
+        janet_ev_handle_selfpipe();
+    }
+
+    /* Step state machines */
+    for (size_t i = 0; i < janet_vm_listener_count; i++) {
+        struct pollfd *pfd = janet_vm_fds + i + 1;
+        /* Skip fds where nothing interesting happened */
+        JanetListenerState *state = janet_vm_listeners[i];
+        /* Normal event */
+        int mask = pfd->revents;
+        JanetAsyncStatus status1 = JANET_ASYNC_STATUS_NOT_DONE;
+        JanetAsyncStatus status2 = JANET_ASYNC_STATUS_NOT_DONE;
+        JanetAsyncStatus status3 = JANET_ASYNC_STATUS_NOT_DONE;
+        JanetAsyncStatus status4 = JANET_ASYNC_STATUS_NOT_DONE;
+        state->event = pfd;
+        if (mask & POLLOUT)
+            status1 = state->machine(state, JANET_ASYNC_EVENT_WRITE);
+        if (mask & POLLIN)
+            status2 = state->machine(state, JANET_ASYNC_EVENT_READ);
+        if (mask & POLLERR)
+            status3 = state->machine(state, JANET_ASYNC_EVENT_ERR);
+        if ((mask & POLLHUP) && !(mask & (POLLIN | POLLOUT)))
+            status4 = state->machine(state, JANET_ASYNC_EVENT_HUP);
+        if (status1 == JANET_ASYNC_STATUS_DONE ||
+                status2 == JANET_ASYNC_STATUS_DONE ||
+                status3 == JANET_ASYNC_STATUS_DONE ||
+                status4 == JANET_ASYNC_STATUS_DONE)
+            janet_unlisten(state);
+    }
+}
+
+void janet_ev_init(void) {
+    janet_ev_init_common();
+    janet_vm_fds = NULL;
+    janet_ev_setup_selfpipe();
+    janet_vm_fds = janet_malloc(sizeof(struct pollfd));
+    if (NULL == janet_vm_fds) {
+        JANET_OUT_OF_MEMORY;
+    }
+    janet_vm_fds[0].fd = janet_vm_selfpipe[0];
+    janet_vm_fds[0].events = POLLIN;
+    janet_vm_fds[0].revents = 0;
+    return;
+}
+
+void janet_ev_deinit(void) {
+    janet_ev_deinit_common();
+    janet_ev_cleanup_selfpipe();
+    janet_free(janet_vm_fds);
+    janet_vm_fds = NULL;
+}
+
+#endif
+
+/*
+ * End poll implementation
+ */
+
+/*
+ * Threaded calls
+ */
+
+/* Get a handle that other threads can use to post events to the event loop
+ * of the current thread. */
+JanetHandle janet_ev_loop_handle(void) {
+#ifdef JANET_WINDOWS
+    return janet_vm_iocp;
+#else
+    return janet_vm_selfpipe[1];
+#endif
+}
+
+/* Post an event to the event loop with the given handle. Safe to call
+ * from any thread. The callback runs inside of the receiving event loop,
+ * which then decrements its refcount. */
+void janet_ev_post(JanetHandle loop, JanetThreadedCallback cb, JanetEVGenericMessage msg) {
+#ifdef JANET_WINDOWS
+    JanetSelfPipeEvent *event = janet_malloc(sizeof(JanetSelfPipeEvent));
+    if (NULL == event) {
+        JANET_OUT_OF_MEMORY;
+    }
+    event->msg = msg;
+    event->cb = cb;
+    janet_assert(PostQueuedCompletionStatus(loop,
+                                            sizeof(JanetSelfPipeEvent),
+                                            0,
+                                            (LPOVERLAPPED) event),
+                 "failed to post completion event");
+#else
     JanetSelfPipeEvent response;
-    response.msg = subr(msg);
+    response.msg = msg;
     response.cb = cb;
     /* handle a bit of back pressure before giving up. */
     int tries = 4;
     while (tries > 0) {
         int status;
         do {
-            status = write(fd, &response, sizeof(response));
+            status = write(loop, &response, sizeof(response));
         } while (status == -1 && errno == EINTR);
         if (status > 0) break;
         sleep(1);
         tries--;
     }
-    return NULL;
+#endif
+}
+
+/* Run a threaded subroutine and post the result back to the event loop
+ * of the submitting thread. Takes ownership of init. */
+static void janet_ev_run_threaded(JanetEVThreadInit *init) {
+#ifdef JANET_WINDOWS
+    JanetEVGenericMessage msg = init->msg;
+    JanetThreadedSubroutine subr = init->subr;
+    JanetThreadedCallback cb = init->cb;
+    JanetHandle iocp = init->write_pipe;
+    /* Reuse memory from thread init for returning data */
+    init->msg = subr(msg);
+    init->cb = cb;
+    janet_assert(PostQueuedCompletionStatus(iocp,
+                                            sizeof(JanetSelfPipeEvent),
+                                            0,
+                                            (LPOVERLAPPED) init),
+                 "failed to post completion event");
+#else
+    JanetEVGenericMessage msg = init->msg;
+    JanetThreadedSubroutine subr = init->subr;
+    JanetThreadedCallback cb = init->cb;
+    int fd = init->write_pipe;
+    janet_free(init);
+    janet_ev_post(fd, cb, subr(msg));
+#endif
+}
+
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_thread_body(LPVOID ptr) {
+    janet_ev_run_threaded((JanetEVThreadInit *) ptr);
+    return 0;
+}
+#else
+static void *janet_thread_body(void *ptr) {
+    janet_ev_run_threaded((JanetEVThreadInit *) ptr);
+    return NULL;
+}
+#endif
+
+/* Start a detached thread that runs a single threaded call. Returns
+ * non-zero on failure. */
+static int janet_ev_thread_start(JanetEVThreadInit *init) {
+#ifdef JANET_WINDOWS
+    HANDLE thread_handle = CreateThread(NULL, 0, janet_thread_body, init, 0, NULL);
+    if (NULL == thread_handle) return 1;
+    CloseHandle(thread_handle); /* detach from thread */
+    return 0;
+#else
+    pthread_t waiter_thread;
+    int err = pthread_create(&waiter_thread, NULL, janet_thread_body, init);
+    if (err) return err;
+    pthread_detach(waiter_thread);
+    return 0;
+#endif
+}
+
+/*
+ * Worker pool for threaded calls. The pool is shared by all janet threads
+ * in the process. Workers are started lazily up to the pool size and then
+ * stay around waiting for more work. When every worker is busy, calls wait
+ * in a queue instead of starting more threads. Only ev/thread, which runs a
+ * whole event loop for as long as the thread lives, gets a dedicated thread,
+ * so that it cannot hold up other calls.
+ */
+
+#ifndef JANET_EV_POOL_SIZE
+#define JANET_EV_POOL_SIZE 16
+#endif
+
+#ifdef JANET_WINDOWS
+static SRWLOCK janet_ev_pool_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE janet_ev_pool_cond = CONDITION_VARIABLE_INIT;
+#else
+static pthread_mutex_t janet_ev_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t janet_ev_pool_cond = PTHREAD_COND_INITIALIZER;
+#endif
+static int32_t janet_ev_pool_max = JANET_EV_POOL_SIZE;
+static int32_t janet_ev_pool_workers = 0;
+static int32_t janet_ev_pool_idle = 0;
+static int32_t janet_ev_pool_queued = 0;
+static JanetEVThreadInit *janet_ev_pool_head = NULL;
+static JanetEVThreadInit *janet_ev_pool_tail = NULL;
+
+static void janet_ev_pool_acquire(void) {
+#ifdef JANET_WINDOWS
+    AcquireSRWLockExclusive(&janet_ev_pool_lock);
+#else
+    pthread_mutex_lock(&janet_ev_pool_lock);
+#endif
+}
+
+static void janet_ev_pool_release(void) {
+#ifdef JANET_WINDOWS
+    ReleaseSRWLockExclusive(&janet_ev_pool_lock);
+#else
+    pthread_mutex_unlock(&janet_ev_pool_lock);
+#endif
+}
+
+/* Assumes the pool lock is held */
+static void janet_ev_pool_wait(void) {
+#ifdef JANET_WINDOWS
+    SleepConditionVariableSRW(&janet_ev_pool_cond, &janet_ev_pool_lock, INFINITE, 0);
+#else
+    pthread_cond_wait(&janet_ev_pool_cond, &janet_ev_pool_lock);
+#endif
+}
+
+static void janet_ev_pool_wakeup(int all) {
+#ifdef JANET_WINDOWS
+    if (all) {
+        WakeAllConditionVariable(&janet_ev_pool_cond);
+    } else {
+        WakeConditionVariable(&janet_ev_pool_cond);
+    }
+#else
+    if (all) {
+        pthread_cond_broadcast(&janet_ev_pool_cond);
+    } else {
+        pthread_cond_signal(&janet_ev_pool_cond);
+    }
+#endif
+}
+
+/* Assumes the pool lock is held */
+static void janet_ev_pool_push(JanetEVThreadInit *init) {
+    init->next = NULL;
+    if (janet_ev_pool_tail) {
+        janet_ev_pool_tail->next = init;
+    } else {
+        janet_ev_pool_head = init;
+    }
+    janet_ev_pool_tail = init;
+    janet_ev_pool_queued++;
+}
+
+static void janet_ev_pool_worker(void) {
+    janet_ev_pool_acquire();
+    for (;;) {
+        while (NULL == janet_ev_pool_head && janet_ev_pool_workers <= janet_ev_pool_max) {
+            janet_ev_pool_idle++;
+            janet_ev_pool_wait();
+            janet_ev_pool_idle--;
+        }
+        if (NULL == janet_ev_pool_head) {
+            /* Pool was shrunk */
+            break;
+        }
+        JanetEVThreadInit *init = janet_ev_pool_head;
+        janet_ev_pool_head = init->next;
+        if (NULL == janet_ev_pool_head) janet_ev_pool_tail = NULL;
+        janet_ev_pool_queued--;
+        janet_ev_pool_release();
+        janet_ev_run_threaded(init);
+        janet_ev_pool_acquire();
+    }
+    janet_ev_pool_workers--;
+    janet_ev_pool_release();
+}
+
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_ev_pool_body(LPVOID ptr) {
+    (void) ptr;
+    janet_ev_pool_worker();
+    return 0;
+}
+#else
+static void *janet_ev_pool_body(void *ptr) {
+    (void) ptr;
+    janet_ev_pool_worker();
+    return NULL;
+}
+#endif
+
+/* Assumes the pool lock is held. Returns non-zero if a worker could not be started. */
+static int janet_ev_pool_spawn(void) {
+#ifdef JANET_WINDOWS
+    HANDLE thread_handle = CreateThread(NULL, 0, janet_ev_pool_body, NULL, 0, NULL);
+    if (NULL == thread_handle) return 1;
+    CloseHandle(thread_handle);
+#else
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, janet_ev_pool_body, NULL)) return 1;
+    pthread_detach(worker);
+#endif
+    janet_ev_pool_workers++;
+    return 0;
+}
+
+/* Hand a threaded call to the pool. Returns 1 if the pool took ownership
+ * of init, 0 if there is no worker and none could be started. */
+static int janet_ev_pool_submit(JanetEVThreadInit *init) {
+    int accepted = 1;
+    janet_ev_pool_acquire();
+    if (janet_ev_pool_idle > janet_ev_pool_queued) {
+        janet_ev_pool_push(init);
+        janet_ev_pool_wakeup(0);
+    } else if (janet_ev_pool_workers < janet_ev_pool_max && !janet_ev_pool_spawn()) {
+        janet_ev_pool_push(init);
+    } else if (janet_ev_pool_workers > 0) {
+        /* Wait for a busy worker */
+        janet_ev_pool_push(init);
+    } else {
+        accepted = 0;
+    }
+    janet_ev_pool_release();
+    return accepted;
 }
-#endif
 
-void janet_ev_threaded_call(JanetThreadedSubroutine fp, JanetEVGenericMessage arguments, JanetThreadedCallback cb) {
+static void janet_ev_threaded_call_impl(JanetThreadedSubroutine fp, JanetEVGenericMessage arguments,
+                                        JanetThreadedCallback cb, int dedicated) {
     JanetEVThreadInit *init = janet_malloc(sizeof(JanetEVThreadInit));
     if (NULL == init) {
         JANET_OUT_OF_MEMORY;
@@ -1398,30 +3179,36 @@ void janet_ev_threaded_call(JanetThreadedSubroutine fp, JanetEVGenericMessage ar
     init->msg = arguments;
     init->subr = fp;
     init->cb = cb;
+    init->next = NULL;
 
 #ifdef JANET_WINDOWS
     init->write_pipe = janet_vm_iocp;
-    HANDLE thread_handle = CreateThread(NULL, 0, janet_thread_body, init, 0, NULL);
-    if (NULL == thread_handle) {
-        janet_free(init);
-        janet_panic("failed to create thread");
-    }
-    CloseHandle(thread_handle); /* detach from thread */
 #else
     init->write_pipe = janet_vm_selfpipe[1];
-    pthread_t waiter_thread;
-    int err = pthread_create(&waiter_thread, NULL, janet_thread_body, init);
-    if (err) {
+#endif
+    if (dedicated) {
+        int err = janet_ev_thread_start(init);
+        if (err) {
+            janet_free(init);
+#ifdef JANET_WINDOWS
+            janet_panic("failed to create thread");
+#else
+            janet_panicf("%s", strerror(err));
+#endif
+        }
+    } else if (!janet_ev_pool_submit(init)) {
         janet_free(init);
-        janet_panicf("%s", strerror(err));
+        janet_panic("failed to start worker thread");
     }
-    pthread_detach(waiter_thread);
-#endif
 
     /* Increment ev refcount so we don't quit while waiting for a subprocess */
     janet_ev_inc_refcount();
 }
 
+void janet_ev_threaded_call(JanetThreadedSubroutine fp, JanetEVGenericMessage arguments, JanetThreadedCallback cb) {
+    janet_ev_threaded_call_impl(fp, arguments, cb, 0);
+}
+
 /* Default callback for janet_ev_threaded_await. */
 void janet_ev_default_threaded_callback(JanetEVGenericMessage return_value) {
     switch (return_value.tag) {
@@ -1456,19 +3243,430 @@ void janet_ev_default_threaded_callback(JanetEVGenericMessage return_value) {
 }
 
 
-/* Convenience method for common case */
 JANET_NO_RETURN
-void janet_ev_threaded_await(JanetThreadedSubroutine fp, int tag, int argi, void *argp) {
+static void janet_ev_threaded_await_impl(JanetThreadedSubroutine fp, int tag, int argi, void *argp, int dedicated) {
     JanetEVGenericMessage arguments;
     arguments.tag = tag;
     arguments.argi = argi;
     arguments.argp = argp;
     arguments.fiber = janet_root_fiber();
+    /* The callback runs on this thread, so rooting after a successful submit is safe */
+    janet_ev_threaded_call_impl(fp, arguments, janet_ev_default_threaded_callback, dedicated);
     janet_gcroot(janet_wrap_fiber(arguments.fiber));
-    janet_ev_threaded_call(fp, arguments, janet_ev_default_threaded_callback);
     janet_await();
 }
 
+/* Convenience method for common case */
+JANET_NO_RETURN
+void janet_ev_threaded_await(JanetThreadedSubroutine fp, int tag, int argi, void *argp) {
+    janet_ev_threaded_await_impl(fp, tag, argi, argp, 0);
+}
+
+/*
+ * Work stealing scheduler for ev/migrate. Migrated fibers are marshalled and
+ * run on a pool of worker threads, each with its own janet VM and event loop.
+ * Every worker has a deque of jobs - fibers migrated from inside a worker go to
+ * the back of its own deque, and are taken back from there first. Other fibers
+ * go to a shared queue. A worker with nothing to do steals from the front of
+ * the other deques, and otherwise sleeps in its event loop until it is woken
+ * with janet_ev_post. Jobs are coarse (a marshalled fiber), so a single lock
+ * guards all of the queues.
+ */
+
+/* Shared by all jobs migrated from one thread. The thread may exit before
+ * its jobs are done, after which the results are dropped. */
+typedef struct {
+    JanetHandle loop;
+    int refCount;
+    int dead;
+} JanetStealOrigin;
+
+typedef struct JanetStealJob JanetStealJob;
+struct JanetStealJob {
+    JanetBuffer payload; /* The marshalled fiber and value, and later the result */
+    JanetStealOrigin *origin;
+    JanetFiber *fiber; /* Only used by the origin thread */
+    uint32_t sched_id;
+    JanetSignal sig;
+    JanetStealJob *prev;
+    JanetStealJob *next;
+};
+
+typedef struct {
+    JanetStealJob *head;
+    JanetStealJob *tail;
+} JanetStealDeque;
+
+struct JanetStealWorker {
+    JanetHandle loop;
+    int idle;
+    JanetStealDeque jobs;
+};
+
+/* Jobs running on this worker thread */
+typedef struct {
+    JanetFiber *fiber;
+    JanetStealJob *job;
+} JanetStealRunning;
+
+#ifdef JANET_WINDOWS
+static SRWLOCK janet_steal_lock = SRWLOCK_INIT;
+#else
+static pthread_mutex_t janet_steal_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static int32_t janet_steal_max = 0;
+static int32_t janet_steal_started = 0;
+static int32_t janet_steal_worker_count = 0;
+static int32_t janet_steal_worker_cap = 0;
+static JanetStealWorker **janet_steal_workers = NULL;
+static JanetStealDeque janet_steal_injected = {NULL, NULL};
+
+JANET_THREAD_LOCAL JanetStealOrigin *janet_vm_steal_origin = NULL;
+JANET_THREAD_LOCAL JanetStealRunning *janet_vm_steal_running = NULL;
+JANET_THREAD_LOCAL size_t janet_vm_steal_running_count = 0;
+JANET_THREAD_LOCAL size_t janet_vm_steal_running_cap = 0;
+
+static void janet_steal_acquire(void) {
+#ifdef JANET_WINDOWS
+    AcquireSRWLockExclusive(&janet_steal_lock);
+#else
+    pthread_mutex_lock(&janet_steal_lock);
+#endif
+}
+
+static void janet_steal_release(void) {
+#ifdef JANET_WINDOWS
+    ReleaseSRWLockExclusive(&janet_steal_lock);
+#else
+    pthread_mutex_unlock(&janet_steal_lock);
+#endif
+}
+
+/* Default number of workers is the number of processors */
+static int32_t janet_steal_default_max(void) {
+#ifdef JANET_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int32_t n = (int32_t) info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    int32_t n = 4;
+#endif
+    return n < 1 ? 1 : (int32_t) n;
+}
+
+/* Assumes the steal lock is held */
+static void janet_steal_push(JanetStealDeque *q, JanetStealJob *job) {
+    job->next = NULL;
+    job->prev = q->tail;
+    if (q->tail) {
+        q->tail->next = job;
+    } else {
+        q->head = job;
+    }
+    q->tail = job;
+}
+
+/* Assumes the steal lock is held */
+static JanetStealJob *janet_steal_pop_front(JanetStealDeque *q) {
+    JanetStealJob *job = q->head;
+    if (NULL == job) return NULL;
+    q->head = job->next;
+    if (q->head) {
+        q->head->prev = NULL;
+    } else {
+        q->tail = NULL;
+    }
+    return job;
+}
+
+/* Assumes the steal lock is held */
+static JanetStealJob *janet_steal_pop_back(JanetStealDeque *q) {
+    JanetStealJob *job = q->tail;
+    if (NULL == job) return NULL;
+    q->tail = job->prev;
+    if (q->tail) {
+        q->tail->next = NULL;
+    } else {
+        q->head = NULL;
+    }
+    return job;
+}
+
+static void janet_steal_wakeup_event(JanetEVGenericMessage msg) {
+    (void) msg;
+    /* Not counted by the event loop, so undo the decrement that follows */
+    janet_ev_inc_refcount();
+}
+
+/* Assumes the steal lock is held. Returns 1 if an idle worker was woken. */
+static int janet_steal_wakeup(void) {
+    for (int32_t i = 0; i < janet_steal_worker_count; i++) {
+        JanetStealWorker *worker = janet_steal_workers[i];
+        if (worker->idle) {
+            JanetEVGenericMessage msg;
+            memset(&msg, 0, sizeof(msg));
+            worker->idle = 0;
+            janet_ev_post(worker->loop, janet_steal_wakeup_event, msg);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void janet_steal_worker_main(JanetBuffer *registries) {
+    janet_init();
+    JanetTryState tstate;
+    if (!janet_try(&tstate)) {
+        const uint8_t *nextbytes = registries->data;
+        const uint8_t *endbytes = nextbytes + registries->count;
+        Janet aregv = janet_unmarshal(nextbytes, endbytes - nextbytes,
+                                      JANET_MARSHAL_UNSAFE, NULL, &nextbytes);
+        Janet regv = janet_unmarshal(nextbytes, endbytes - nextbytes,
+                                     JANET_MARSHAL_UNSAFE, NULL, &nextbytes);
+        if (janet_checktype(aregv, JANET_TABLE)) janet_vm_abstract_registry = janet_unwrap_table(aregv);
+        if (janet_checktype(regv, JANET_TABLE)) janet_vm_registry = janet_unwrap_table(regv);
+    }
+    janet_restore(&tstate);
+    janet_buffer_deinit(registries);
+    janet_free(registries);
+
+    JanetStealWorker *self = janet_malloc(sizeof(JanetStealWorker));
+    if (NULL == self) {
+        JANET_OUT_OF_MEMORY;
+    }
+    self->loop = janet_ev_loop_handle();
+    self->idle = 0;
+    self->jobs.head = NULL;
+    self->jobs.tail = NULL;
+    janet_steal_acquire();
+    if (janet_steal_worker_count == janet_steal_worker_cap) {
+        int32_t newcap = janet_steal_worker_cap ? janet_steal_worker_cap * 2 : 8;
+        JanetStealWorker **newworkers = janet_realloc(janet_steal_workers, newcap * sizeof(JanetStealWorker *));
+        if (NULL == newworkers) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_steal_workers = newworkers;
+        janet_steal_worker_cap = newcap;
+    }
+    janet_steal_workers[janet_steal_worker_count++] = self;
+    janet_steal_release();
+
+    /* Workers are never stopped */
+    janet_vm_steal_worker = self;
+    janet_loop();
+    janet_deinit();
+}
+
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_steal_worker_body(LPVOID ptr) {
+    janet_steal_worker_main((JanetBuffer *) ptr);
+    return 0;
+}
+#else
+static void *janet_steal_worker_body(void *ptr) {
+    janet_steal_worker_main((JanetBuffer *) ptr);
+    return NULL;
+}
+#endif
+
+/* Start a new worker with the registries of this thread. Returns non-zero
+ * if the thread could not be started. */
+static int janet_steal_spawn(void) {
+    JanetBuffer *registries = janet_malloc(sizeof(JanetBuffer));
+    if (NULL == registries) {
+        JANET_OUT_OF_MEMORY;
+    }
+    janet_buffer_init(registries, 0);
+    janet_marshal(registries, janet_wrap_table(janet_vm_abstract_registry), NULL, JANET_MARSHAL_UNSAFE);
+    janet_marshal(registries, janet_wrap_table(janet_vm_registry), NULL, JANET_MARSHAL_UNSAFE);
+#ifdef JANET_WINDOWS
+    HANDLE thread_handle = CreateThread(NULL, 0, janet_steal_worker_body, registries, 0, NULL);
+    int failed = NULL == thread_handle;
+    if (!failed) CloseHandle(thread_handle);
+#else
+    pthread_t worker;
+    int failed = pthread_create(&worker, NULL, janet_steal_worker_body, registries);
+    if (!failed) pthread_detach(worker);
+#endif
+    if (failed) {
+        janet_buffer_deinit(registries);
+        janet_free(registries);
+    }
+    return failed;
+}
+
+/* Queue a job, starting another worker if none are idle. Returns non-zero
+ * if there are no workers to run the job. */
+static int janet_steal_submit(JanetStealJob *job) {
+    janet_steal_acquire();
+    if (!janet_steal_max) janet_steal_max = janet_steal_default_max();
+    int idle = 0;
+    for (int32_t i = 0; i < janet_steal_worker_count; i++) {
+        idle += janet_steal_workers[i]->idle;
+    }
+    int spawn = !idle && janet_steal_started < janet_steal_max;
+    if (spawn) janet_steal_started++;
+    janet_steal_release();
+    if (spawn && janet_steal_spawn()) {
+        janet_steal_acquire();
+        int none = --janet_steal_started == 0;
+        janet_steal_release();
+        if (none) return 1;
+    }
+    janet_steal_acquire();
+    if (NULL != janet_vm_steal_worker) {
+        janet_steal_push(&janet_vm_steal_worker->jobs, job);
+    } else {
+        janet_steal_push(&janet_steal_injected, job);
+    }
+    janet_steal_wakeup();
+    janet_steal_release();
+    return 0;
+}
+
+/* Runs in the event loop of the origin thread */
+static void janet_steal_done(JanetEVGenericMessage msg) {
+    JanetStealJob *job = (JanetStealJob *) msg.argp;
+    JanetFiber *fiber = job->fiber;
+    Janet value;
+    int failed = janet_tchan_decode(&job->payload, &value);
+    if (fiber->sched_id == job->sched_id) {
+        if (failed || job->sig == JANET_SIGNAL_ERROR) {
+            janet_cancel(fiber, value);
+        } else {
+            janet_schedule(fiber, value);
+        }
+    }
+    janet_gcunroot(janet_wrap_fiber(fiber));
+    janet_free(job);
+}
+
+/* Send the result of a job back to the thread it came from */
+static void janet_steal_report(JanetStealJob *job, JanetSignal sig, Janet value) {
+    job->payload.count = 0;
+    job->sig = sig;
+    JanetTryState tstate;
+    if (!janet_try(&tstate)) {
+        janet_marshal(&job->payload, value, NULL, JANET_MARSHAL_UNSAFE);
+    } else {
+        job->payload.count = 0;
+        job->sig = JANET_SIGNAL_ERROR;
+        janet_marshal(&job->payload, janet_cstringv("could not marshal result of migrated fiber"),
+                      NULL, JANET_MARSHAL_UNSAFE);
+    }
+    janet_restore(&tstate);
+    int posted = 0;
+    janet_steal_acquire();
+    JanetStealOrigin *origin = job->origin;
+    if (!origin->dead) {
+        JanetEVGenericMessage msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.argp = job;
+        janet_ev_post(origin->loop, janet_steal_done, msg);
+        posted = 1;
+    }
+    int refCount = --origin->refCount;
+    janet_steal_release();
+    if (!refCount) janet_free(origin);
+    if (!posted) {
+        janet_buffer_deinit(&job->payload);
+        janet_free(job);
+    }
+}
+
+/* Unmarshal a job and schedule its fiber on this worker */
+static void janet_steal_start(JanetStealJob *job) {
+    JanetTryState tstate;
+    if (!janet_try(&tstate)) {
+        const uint8_t *nextbytes = job->payload.data;
+        const uint8_t *endbytes = nextbytes + job->payload.count;
+        Janet fiberv = janet_unmarshal(nextbytes, endbytes - nextbytes,
+                                       JANET_MARSHAL_UNSAFE, NULL, &nextbytes);
+        Janet value = janet_unmarshal(nextbytes, endbytes - nextbytes,
+                                      JANET_MARSHAL_UNSAFE, NULL, &nextbytes);
+        if (!janet_checktype(fiberv, JANET_FIBER)) janet_panic("expected fiber");
+        JanetFiber *fiber = janet_unwrap_fiber(fiberv);
+        if (janet_vm_steal_running_count == janet_vm_steal_running_cap) {
+            size_t newcap = janet_vm_steal_running_cap ? janet_vm_steal_running_cap * 2 : 16;
+            JanetStealRunning *newrunning = janet_realloc(janet_vm_steal_running, newcap * sizeof(JanetStealRunning));
+            if (NULL == newrunning) {
+                JANET_OUT_OF_MEMORY;
+            }
+            janet_vm_steal_running = newrunning;
+            janet_vm_steal_running_cap = newcap;
+        }
+        janet_vm_steal_running[janet_vm_steal_running_count].fiber = fiber;
+        janet_vm_steal_running[janet_vm_steal_running_count].job = job;
+        janet_vm_steal_running_count++;
+        janet_schedule(fiber, value);
+        janet_restore(&tstate);
+    } else {
+        Janet err = tstate.payload;
+        janet_restore(&tstate);
+        janet_steal_report(job, JANET_SIGNAL_ERROR, err);
+    }
+}
+
+/* Take a job for this worker - from its own deque, then the shared queue,
+ * and then from the other workers. Returns 1 if a job was started. */
+static int janet_steal_pump(void) {
+    JanetStealWorker *self = janet_vm_steal_worker;
+    janet_steal_acquire();
+    JanetStealJob *job = janet_steal_pop_back(&self->jobs);
+    if (NULL == job) job = janet_steal_pop_front(&janet_steal_injected);
+    if (NULL == job && janet_steal_worker_count > 1) {
+        int32_t start = (int32_t)(janet_rng_u32(&janet_vm_ev_rng) % (uint32_t) janet_steal_worker_count);
+        for (int32_t i = 0; i < janet_steal_worker_count && NULL == job; i++) {
+            JanetStealWorker *victim = janet_steal_workers[(start + i) % janet_steal_worker_count];
+            if (victim != self) job = janet_steal_pop_front(&victim->jobs);
+        }
+    }
+    self->idle = NULL == job;
+    janet_steal_release();
+    if (NULL == job) return 0;
+    janet_steal_start(job);
+    return 1;
+}
+
+/* Called from run_one when a fiber on a worker stops with anything but an
+ * event. Returns 1 if the fiber was migrated. */
+static int janet_steal_finish(JanetFiber *fiber, JanetSignal sig, Janet value) {
+    for (size_t i = 0; i < janet_vm_steal_running_count; i++) {
+        if (janet_vm_steal_running[i].fiber == fiber) {
+            JanetStealJob *job = janet_vm_steal_running[i].job;
+            janet_vm_steal_running[i] = janet_vm_steal_running[--janet_vm_steal_running_count];
+            janet_steal_report(job, sig, value);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void janet_steal_mark(void) {
+    for (size_t i = 0; i < janet_vm_steal_running_count; i++) {
+        janet_mark(janet_wrap_fiber(janet_vm_steal_running[i].fiber));
+    }
+}
+
+/* Called before the event loop of this thread goes away */
+static void janet_steal_deinit(void) {
+    JanetStealOrigin *origin = janet_vm_steal_origin;
+    if (NULL != origin) {
+        janet_steal_acquire();
+        origin->dead = 1;
+        int refCount = --origin->refCount;
+        janet_steal_release();
+        if (!refCount) janet_free(origin);
+        janet_vm_steal_origin = NULL;
+    }
+    janet_free(janet_vm_steal_running);
+    janet_vm_steal_running = NULL;
+    janet_vm_steal_running_count = 0;
+    janet_vm_steal_running_cap = 0;
+}
+
 /*
  * C API helpers for reading and writing from streams.
  * There is some networking code in here as well as generic
@@ -1476,7 +3674,7 @@ void janet_ev_threaded_await(JanetThreadedSubroutine fp, int tag, int argi, void
  */
 
 void janet_stream_flags(JanetStream *stream, uint32_t flags) {
-    if (stream->flags & JANET_STREAM_CLOSED) {
+    if (stream->flags & (JANET_STREAM_CLOSED | JANET_STREAM_CLOSE_PENDING)) {
         janet_panic("stream is closed");
     }
     if ((stream->flags & flags) != flags) {
@@ -1492,8 +3690,9 @@ void janet_stream_flags(JanetStream *stream, uint32_t flags) {
 
 /* When there is an IO error, we need to be able to convert it to a Janet
  * string to raise a Janet error. */
-#ifdef JANET_WINDOWS
 #define JANET_EV_CHUNKSIZE 4096
+
+#ifdef JANET_WINDOWS
 Janet janet_ev_lasterr(void) {
     int code = GetLastError();
     char msgbuf[256];
@@ -1627,6 +3826,41 @@ JanetAsyncStatus ev_machine_read(JanetListenerState *s, JanetAsyncEvent event) {
         }
         break;
 #else
+#ifdef JANET_EV_URING
+        case JANET_ASYNC_EVENT_COMPLETE: {
+            /* Called when read finished */
+            int32_t nread = s->bytes;
+            if (nread < 0) {
+                /* In stream protocols, a pipe error is end of stream */
+                if (nread != -EPIPE) {
+                    errno = -nread;
+                    janet_cancel(s->fiber, janet_ev_lasterr());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                nread = 0;
+            }
+            state->bytes_read += nread;
+            if (state->bytes_read == 0) {
+                janet_schedule(s->fiber, janet_wrap_nil());
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            janet_buffer_push_bytes(state->buf, s->event, nread);
+            state->bytes_left -= nread;
+            if (!state->is_chunk || state->bytes_left == 0 || nread == 0) {
+                janet_schedule(s->fiber, janet_wrap_buffer(state->buf));
+                return JANET_ASYNC_STATUS_DONE;
+            }
+        }
+
+        /* fallthrough */
+        case JANET_ASYNC_EVENT_USER: {
+            /* Begin read. recv-from waits for readiness instead. */
+            int32_t chunk_size = state->bytes_left > JANET_EV_CHUNKSIZE ? JANET_EV_CHUNKSIZE : state->bytes_left;
+            int opcode = state->mode == JANET_ASYNC_READMODE_RECV ? IORING_OP_RECV : IORING_OP_READ;
+            janet_uring_submit(s, opcode, chunk_size, NULL, 0, state->flags);
+        }
+        break;
+#endif
         case JANET_ASYNC_EVENT_ERR: {
             if (state->bytes_read) {
                 janet_schedule(s->fiber, janet_wrap_buffer(state->buf));
@@ -1637,70 +3871,74 @@ JanetAsyncStatus ev_machine_read(JanetListenerState *s, JanetAsyncEvent event) {
         }
         case JANET_ASYNC_EVENT_HUP:
         case JANET_ASYNC_EVENT_READ: {
-            JanetBuffer *buffer = state->buf;
-            int32_t bytes_left = state->bytes_left;
-            int32_t read_limit = bytes_left > 4096 ? 4096 : bytes_left;
-            janet_buffer_extra(buffer, read_limit);
-            ssize_t nread;
+            /* Keep reading until the request is satisfied or the stream would block,
+             * so that edge triggered streams never miss data. */
+            for (;;) {
+                JanetBuffer *buffer = state->buf;
+                int32_t bytes_left = state->bytes_left;
+                int32_t read_limit = bytes_left > 4096 ? 4096 : bytes_left;
+                janet_buffer_extra(buffer, read_limit);
+                ssize_t nread;
 #ifdef JANET_NET
-            char saddr[256];
-            socklen_t socklen = sizeof(saddr);
+                char saddr[256];
+                socklen_t socklen = sizeof(saddr);
 #endif
-            do {
+                do {
 #ifdef JANET_NET
-                if (state->mode == JANET_ASYNC_READMODE_RECVFROM) {
-                    nread = recvfrom(s->stream->handle, buffer->data + buffer->count, read_limit, state->flags,
-                                     (struct sockaddr *)&saddr, &socklen);
-                } else if (state->mode == JANET_ASYNC_READMODE_RECV) {
-                    nread = recv(s->stream->handle, buffer->data + buffer->count, read_limit, state->flags);
-                } else
+                    if (state->mode == JANET_ASYNC_READMODE_RECVFROM) {
+                        nread = recvfrom(s->stream->handle, buffer->data + buffer->count, read_limit, state->flags,
+                                         (struct sockaddr *)&saddr, &socklen);
+                    } else if (state->mode == JANET_ASYNC_READMODE_RECV) {
+                        nread = recv(s->stream->handle, buffer->data + buffer->count, read_limit, state->flags);
+                    } else
 #endif
-                {
-                    nread = read(s->stream->handle, buffer->data + buffer->count, read_limit);
-                }
-            } while (nread == -1 && errno == EINTR);
+                    {
+                        nread = read(s->stream->handle, buffer->data + buffer->count, read_limit);
+                    }
+                } while (nread == -1 && errno == EINTR);
 
-            /* Check for errors - special case errors that can just be waited on to fix */
-            if (nread == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    return JANET_ASYNC_STATUS_NOT_DONE;
+                /* Check for errors - special case errors that can just be waited on to fix */
+                if (nread == -1) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        return JANET_ASYNC_STATUS_NOT_DONE;
+                    }
+                    /* In stream protocols, a pipe error is end of stream */
+                    if (errno == EPIPE && (state->mode != JANET_ASYNC_READMODE_RECVFROM)) {
+                        nread = 0;
+                    } else {
+                        janet_cancel(s->fiber, janet_ev_lasterr());
+                        return JANET_ASYNC_STATUS_DONE;
+                    }
                 }
-                /* In stream protocols, a pipe error is end of stream */
-                if (errno == EPIPE && (state->mode != JANET_ASYNC_READMODE_RECVFROM)) {
-                    nread = 0;
-                } else {
-                    janet_cancel(s->fiber, janet_ev_lasterr());
+
+                /* Only allow 0-length packets in recv-from. In stream protocols, a zero length packet is EOS. */
+                state->bytes_read += nread;
+                if (state->bytes_read == 0 && (state->mode != JANET_ASYNC_READMODE_RECVFROM)) {
+                    janet_schedule(s->fiber, janet_wrap_nil());
                     return JANET_ASYNC_STATUS_DONE;
                 }
-            }
-
-            /* Only allow 0-length packets in recv-from. In stream protocols, a zero length packet is EOS. */
-            state->bytes_read += nread;
-            if (state->bytes_read == 0 && (state->mode != JANET_ASYNC_READMODE_RECVFROM)) {
-                janet_schedule(s->fiber, janet_wrap_nil());
-                return JANET_ASYNC_STATUS_DONE;
-            }
 
-            /* Increment buffer counts */
-            buffer->count += nread;
-            bytes_left -= nread;
-            state->bytes_left = bytes_left;
+                /* Increment buffer counts */
+                buffer->count += nread;
+                bytes_left -= nread;
+                state->bytes_left = bytes_left;
 
-            /* Resume if done */
-            if (!state->is_chunk || bytes_left == 0 || nread == 0) {
-                Janet resume_val;
+                /* Resume if done */
+                if (!state->is_chunk || bytes_left == 0 || nread == 0) {
+                    Janet resume_val;
 #ifdef JANET_NET
-                if (state->mode == JANET_ASYNC_READMODE_RECVFROM) {
-                    void *abst = janet_abstract(&janet_address_type, socklen);
-                    memcpy(abst, &saddr, socklen);
-                    resume_val = janet_wrap_abstract(abst);
-                } else
+                    if (state->mode == JANET_ASYNC_READMODE_RECVFROM) {
+                        void *abst = janet_abstract(&janet_address_type, socklen);
+                        memcpy(abst, &saddr, socklen);
+                        resume_val = janet_wrap_abstract(abst);
+                    } else
 #endif
-                {
-                    resume_val = janet_wrap_buffer(buffer);
+                    {
+                        resume_val = janet_wrap_buffer(buffer);
+                    }
+                    janet_schedule(s->fiber, resume_val);
+                    return JANET_ASYNC_STATUS_DONE;
                 }
-                janet_schedule(s->fiber, resume_val);
-                return JANET_ASYNC_STATUS_DONE;
             }
         }
         break;
@@ -1710,8 +3948,14 @@ JanetAsyncStatus ev_machine_read(JanetListenerState *s, JanetAsyncEvent event) {
 }
 
 static void janet_ev_read_generic(JanetStream *stream, JanetBuffer *buf, int32_t nbytes, int is_chunked, JanetReadMode mode, int flags) {
+#ifdef JANET_EV_URING
+    int complete = mode != JANET_ASYNC_READMODE_RECVFROM;
+    StateRead *state = (StateRead *)(complete ? janet_uring_listen : janet_listen)(stream, ev_machine_read,
+                       JANET_ASYNC_LISTEN_READ, sizeof(StateRead), NULL);
+#else
     StateRead *state = (StateRead *) janet_listen(stream, ev_machine_read,
                        JANET_ASYNC_LISTEN_READ, sizeof(StateRead), NULL);
+#endif
     state->is_chunk = is_chunked;
     state->buf = buf;
     state->bytes_left = nbytes;
@@ -1722,6 +3966,9 @@ static void janet_ev_read_generic(JanetStream *stream, JanetBuffer *buf, int32_t
     state->flags = (DWORD) flags;
 #else
     state->flags = flags;
+#ifdef JANET_EV_URING
+    if (complete) ev_machine_read((JanetListenerState *) state, JANET_ASYNC_EVENT_USER);
+#endif
 #endif
 }
 
@@ -1753,26 +4000,131 @@ typedef enum {
     JANET_ASYNC_WRITEMODE_SENDTO
 } JanetWriteMode;
 
+typedef enum {
+    JANET_WRITESRC_STRING,
+    JANET_WRITESRC_BUFFER,
+    JANET_WRITESRC_PARTS,
+    JANET_WRITESRC_COALESCED
+} JanetWriteSource;
+
+/* Most pieces gathered into one vectored write */
+#define JANET_EV_IOV_MAX 64
+
+/* Most bytes copied into one io_uring write request */
+#define JANET_EV_WRITE_CHUNKSIZE 65536
+
 typedef struct {
     JanetListenerState head;
     union {
         JanetBuffer *buf;
         const uint8_t *str;
+        const Janet *parts;
     } src;
-    int is_buffer;
+    JanetWriteSource source;
     JanetWriteMode mode;
     void *dest_abst;
+    int32_t start;
+#ifdef JANET_WINDOWS
+    JanetString copy;
+    OVERLAPPED overlapped;
+#ifdef JANET_NET
+    WSABUF wbuf;
+    DWORD flags;
+#endif
+#else
+    int flags;
+#endif
+} StateWrite;
+
+static void janet_stream_flush_later(JanetStream *stream);
+
+/* Finish a write. A background flush of coalesced output has no fiber to resume. */
+static JanetAsyncStatus ev_write_finish(JanetListenerState *s, int is_error, Janet value) {
+    StateWrite *state = (StateWrite *) s;
+    if (state->source == JANET_WRITESRC_COALESCED) {
+        JanetBuffer *buffer = state->src.buf;
+        if (is_error) {
+            /* Output that cannot be written is dropped, and the stream closed */
+            buffer->count = 0;
+            s->stream->flags |= JANET_STREAM_CLOSE_PENDING;
+        } else {
+            int32_t written = state->start;
+            memmove(buffer->data, buffer->data + written, buffer->count - written);
+            buffer->count -= written;
+        }
+    }
+    if (NULL != s->fiber) {
+        if (is_error) {
+            janet_cancel(s->fiber, value);
+        } else {
+            janet_schedule(s->fiber, value);
+        }
+    }
+    return JANET_ASYNC_STATUS_DONE;
+}
+
 #ifdef JANET_WINDOWS
-    OVERLAPPED overlapped;
-#ifdef JANET_NET
-    WSABUF wbuf;
-    DWORD flags;
-#endif
+/* Join the pieces of a vectored write into one string */
+static JanetString ev_write_flatten(const Janet *parts) {
+    int32_t total = 0;
+    for (int32_t i = 0; i < janet_tuple_length(parts); i++) {
+        const uint8_t *bytes;
+        int32_t len;
+        janet_bytes_view(parts[i], &bytes, &len);
+        total += len;
+    }
+    uint8_t *str = janet_string_begin(total);
+    total = 0;
+    for (int32_t i = 0; i < janet_tuple_length(parts); i++) {
+        const uint8_t *bytes;
+        int32_t len;
+        janet_bytes_view(parts[i], &bytes, &len);
+        memcpy(str + total, bytes, len);
+        total += len;
+    }
+    return janet_string_end(str);
+}
 #else
-    int flags;
-    int32_t start;
+/* Collect the bytes of a write that come after start. Returns how many there are. */
+static int32_t ev_write_gather(StateWrite *state, int32_t start, struct iovec *iov, int *niov) {
+    *niov = 0;
+    if (state->source == JANET_WRITESRC_PARTS) {
+        const Janet *parts = state->src.parts;
+        int32_t left = 0;
+        for (int32_t i = 0; i < janet_tuple_length(parts); i++) {
+            const uint8_t *bytes;
+            int32_t len;
+            janet_bytes_view(parts[i], &bytes, &len);
+            if (start >= len) {
+                start -= len;
+                continue;
+            }
+            if (*niov < JANET_EV_IOV_MAX) {
+                iov[*niov].iov_base = (void *)(bytes + start);
+                iov[*niov].iov_len = (size_t)(len - start);
+                (*niov)++;
+            }
+            left += len - start;
+            start = 0;
+        }
+        return left;
+    }
+    const uint8_t *bytes;
+    int32_t len;
+    if (state->source == JANET_WRITESRC_STRING) {
+        bytes = state->src.str;
+        len = janet_string_length(bytes);
+    } else {
+        bytes = state->src.buf->data;
+        len = state->src.buf->count;
+    }
+    if (start >= len) return 0;
+    iov[0].iov_base = (void *)(bytes + start);
+    iov[0].iov_len = (size_t)(len - start);
+    *niov = 1;
+    return len - start;
+}
 #endif
-} StateWrite;
 
 JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event) {
     StateWrite *state = (StateWrite *) s;
@@ -1780,44 +4132,57 @@ JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event)
         default:
             break;
         case JANET_ASYNC_EVENT_MARK:
-            janet_mark(state->is_buffer
-                       ? janet_wrap_buffer(state->src.buf)
-                       : janet_wrap_string(state->src.str));
+            if (state->source == JANET_WRITESRC_STRING) {
+                janet_mark(janet_wrap_string(state->src.str));
+            } else if (state->source == JANET_WRITESRC_PARTS) {
+                janet_mark(janet_wrap_tuple(state->src.parts));
+            } else {
+                janet_mark(janet_wrap_buffer(state->src.buf));
+            }
+#ifdef JANET_WINDOWS
+            if (NULL != state->copy) {
+                janet_mark(janet_wrap_string(state->copy));
+            }
+#endif
             if (state->mode == JANET_ASYNC_WRITEMODE_SENDTO) {
                 janet_mark(janet_wrap_abstract(state->dest_abst));
             }
             break;
+        case JANET_ASYNC_EVENT_DEINIT:
+            /* Output added during the flush, or left by a canceled one, goes out later */
+            if (state->source == JANET_WRITESRC_COALESCED) {
+                janet_stream_flush_later(s->stream);
+            }
+            break;
         case JANET_ASYNC_EVENT_CLOSE:
-            janet_cancel(s->fiber, janet_cstringv("stream closed"));
-            return JANET_ASYNC_STATUS_DONE;
+            return ev_write_finish(s, 1, janet_cstringv("stream closed"));
 #ifdef JANET_WINDOWS
         case JANET_ASYNC_EVENT_COMPLETE: {
             /* Called when write finished */
             if (s->bytes == 0 && (state->mode != JANET_ASYNC_WRITEMODE_SENDTO)) {
-                janet_cancel(s->fiber, janet_cstringv("disconnect"));
-                return JANET_ASYNC_STATUS_DONE;
+                return ev_write_finish(s, 1, janet_cstringv("disconnect"));
             }
-
-            janet_schedule(s->fiber, janet_wrap_nil());
-            return JANET_ASYNC_STATUS_DONE;
+            return ev_write_finish(s, 0, janet_wrap_nil());
         }
         break;
         case JANET_ASYNC_EVENT_USER: {
             /* Begin write */
             int32_t len;
             const uint8_t *bytes;
-            if (state->is_buffer) {
-                /* If buffer, convert to string. */
-                /* TODO - be more efficient about this */
-                JanetBuffer *buffer = state->src.buf;
-                JanetString str = janet_string(buffer->data, buffer->count);
-                bytes = str;
-                len = buffer->count;
-                state->is_buffer = 0;
-                state->src.str = str;
-            } else {
+            if (state->source == JANET_WRITESRC_STRING) {
                 bytes = state->src.str;
                 len = janet_string_length(bytes);
+            } else {
+                /* Copy into a string that cannot change while the write is in flight. */
+                /* TODO - be more efficient about this */
+                if (state->source == JANET_WRITESRC_PARTS) {
+                    state->copy = ev_write_flatten(state->src.parts);
+                } else {
+                    state->copy = janet_string(state->src.buf->data, state->src.buf->count);
+                }
+                bytes = state->copy;
+                len = janet_string_length(bytes);
+                state->start = len;
             }
             s->tag = &state->overlapped;
             memset(&(state->overlapped), 0, sizeof(WSAOVERLAPPED));
@@ -1832,82 +4197,101 @@ JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event)
                 int tolen = (int) janet_abstract_size((void *) to);
                 status = WSASendTo(sock, &state->wbuf, 1, NULL, state->flags, to, tolen, &state->overlapped, NULL);
                 if (status && (WSA_IO_PENDING != WSAGetLastError())) {
-                    janet_cancel(s->fiber, janet_ev_lasterr());
-                    return JANET_ASYNC_STATUS_DONE;
+                    return ev_write_finish(s, 1, janet_ev_lasterr());
                 }
             } else
 #endif
             {
                 status = WriteFile(s->stream->handle, bytes, len, NULL, &state->overlapped);
                 if (!status && (ERROR_IO_PENDING != WSAGetLastError())) {
-                    janet_cancel(s->fiber, janet_ev_lasterr());
-                    return JANET_ASYNC_STATUS_DONE;
+                    return ev_write_finish(s, 1, janet_ev_lasterr());
                 }
             }
         }
         break;
 #else
+#ifdef JANET_EV_URING
+        case JANET_ASYNC_EVENT_COMPLETE: {
+            /* Called when write finished */
+            int32_t nwrote = s->bytes;
+            if (nwrote < 0) {
+                errno = -nwrote;
+                return ev_write_finish(s, 1, janet_ev_lasterr());
+            }
+            if (nwrote == 0) {
+                return ev_write_finish(s, 1, janet_cstringv("disconnect"));
+            }
+            state->start += nwrote;
+        }
+
+        /* fallthrough */
+        case JANET_ASYNC_EVENT_USER: {
+            /* Begin writing what is left. send-to waits for readiness instead. */
+            struct iovec iov[JANET_EV_IOV_MAX];
+            int niov;
+            int32_t left = ev_write_gather(state, state->start, iov, &niov);
+            if (left <= 0) {
+                return ev_write_finish(s, 0, janet_wrap_nil());
+            }
+            int32_t size = left > JANET_EV_WRITE_CHUNKSIZE ? JANET_EV_WRITE_CHUNKSIZE : left;
+            int opcode = state->mode == JANET_ASYNC_WRITEMODE_SEND ? IORING_OP_SEND : IORING_OP_WRITE;
+            janet_uring_submit(s, opcode, size, iov, niov, state->flags);
+        }
+        break;
+#endif
         case JANET_ASYNC_EVENT_ERR:
-            janet_cancel(s->fiber, janet_cstringv("stream err"));
-            return JANET_ASYNC_STATUS_DONE;
+            return ev_write_finish(s, 1, janet_cstringv("stream err"));
         case JANET_ASYNC_EVENT_HUP:
-            janet_cancel(s->fiber, janet_cstringv("stream hup"));
-            return JANET_ASYNC_STATUS_DONE;
+            return ev_write_finish(s, 1, janet_cstringv("stream hup"));
         case JANET_ASYNC_EVENT_WRITE: {
-            int32_t start, len;
-            const uint8_t *bytes;
-            start = state->start;
-            if (state->is_buffer) {
-                JanetBuffer *buffer = state->src.buf;
-                bytes = buffer->data;
-                len = buffer->count;
-            } else {
-                bytes = state->src.str;
-                len = janet_string_length(bytes);
-            }
-            ssize_t nwrote = 0;
-            if (start < len) {
-                int32_t nbytes = len - start;
-                void *dest_abst = state->dest_abst;
+            int32_t start = state->start;
+            void *dest_abst = state->dest_abst;
+            /* Keep writing until done or the stream would block */
+            for (;;) {
+                struct iovec iov[JANET_EV_IOV_MAX];
+                int niov;
+                int32_t left = ev_write_gather(state, start, iov, &niov);
+                if (left <= 0) {
+                    state->start = start;
+                    return ev_write_finish(s, 0, janet_wrap_nil());
+                }
+                ssize_t nwrote = 0;
                 do {
 #ifdef JANET_NET
                     if (state->mode == JANET_ASYNC_WRITEMODE_SENDTO) {
-                        nwrote = sendto(s->stream->handle, bytes + start, nbytes, state->flags,
+                        nwrote = sendto(s->stream->handle, iov[0].iov_base, iov[0].iov_len, state->flags,
                                         (struct sockaddr *) dest_abst, janet_abstract_size(dest_abst));
+                    } else if (state->mode == JANET_ASYNC_WRITEMODE_SEND && niov > 1) {
+                        struct msghdr msg;
+                        memset(&msg, 0, sizeof(msg));
+                        msg.msg_iov = iov;
+                        msg.msg_iovlen = niov;
+                        nwrote = sendmsg(s->stream->handle, &msg, state->flags);
                     } else if (state->mode == JANET_ASYNC_WRITEMODE_SEND) {
-                        nwrote = send(s->stream->handle, bytes + start, nbytes, state->flags);
+                        nwrote = send(s->stream->handle, iov[0].iov_base, iov[0].iov_len, state->flags);
                     } else
 #endif
-                    {
-                        nwrote = write(s->stream->handle, bytes + start, nbytes);
-                    }
+                        if (niov > 1) {
+                            nwrote = writev(s->stream->handle, iov, niov);
+                        } else {
+                            nwrote = write(s->stream->handle, iov[0].iov_base, iov[0].iov_len);
+                        }
                 } while (nwrote == -1 && errno == EINTR);
 
                 /* Handle write errors */
                 if (nwrote == -1) {
                     if (errno == EAGAIN || errno  == EWOULDBLOCK) break;
-                    janet_cancel(s->fiber, janet_ev_lasterr());
-                    return JANET_ASYNC_STATUS_DONE;
+                    return ev_write_finish(s, 1, janet_ev_lasterr());
                 }
 
                 /* Unless using datagrams, empty message is a disconnect */
                 if (nwrote == 0 && !dest_abst) {
-                    janet_cancel(s->fiber, janet_cstringv("disconnect"));
-                    return JANET_ASYNC_STATUS_DONE;
+                    return ev_write_finish(s, 1, janet_cstringv("disconnect"));
                 }
 
-                if (nwrote > 0) {
-                    start += nwrote;
-                } else {
-                    start = len;
-                }
+                start += nwrote > 0 ? (int32_t) nwrote : left;
             }
             state->start = start;
-            if (start >= len) {
-                janet_schedule(s->fiber, janet_wrap_nil());
-                return JANET_ASYNC_STATUS_DONE;
-            }
-            break;
         }
         break;
 #endif
@@ -1915,48 +4299,211 @@ JanetAsyncStatus ev_machine_write(JanetListenerState *s, JanetAsyncEvent event)
     return JANET_ASYNC_STATUS_NOT_DONE;
 }
 
-static void janet_ev_write_generic(JanetStream *stream, void *buf, void *dest_abst, JanetWriteMode mode, int is_buffer, int flags) {
+static void janet_ev_write_generic(JanetStream *stream, void *buf, void *dest_abst, JanetWriteMode mode,
+                                   JanetWriteSource source, int flags) {
+#ifdef JANET_EV_URING
+    int complete = mode != JANET_ASYNC_WRITEMODE_SENDTO;
+    StateWrite *state = (StateWrite *)(complete ? janet_uring_listen : janet_listen)(stream, ev_machine_write,
+                        JANET_ASYNC_LISTEN_WRITE, sizeof(StateWrite), NULL);
+#else
     StateWrite *state = (StateWrite *) janet_listen(stream, ev_machine_write,
                         JANET_ASYNC_LISTEN_WRITE, sizeof(StateWrite), NULL);
-    state->is_buffer = is_buffer;
+#endif
+    state->source = source;
     state->src.buf = buf;
     state->dest_abst = dest_abst;
     state->mode = mode;
+    state->start = 0;
 #ifdef JANET_WINDOWS
+    state->copy = NULL;
     state->flags = (DWORD) flags;
     ev_machine_write((JanetListenerState *) state, JANET_ASYNC_EVENT_USER);
 #else
-    state->start = 0;
     state->flags = flags;
+#ifdef JANET_EV_URING
+    /* Nothing to write finishes right away */
+    if (complete && ev_machine_write((JanetListenerState *) state, JANET_ASYNC_EVENT_USER) == JANET_ASYNC_STATUS_DONE) {
+        janet_unlisten((JanetListenerState *) state);
+    }
+#endif
 #endif
 }
 
 
 void janet_ev_write_buffer(JanetStream *stream, JanetBuffer *buf) {
-    janet_ev_write_generic(stream, buf, NULL, JANET_ASYNC_WRITEMODE_WRITE, 1, 0);
+    janet_ev_write_generic(stream, buf, NULL, JANET_ASYNC_WRITEMODE_WRITE, JANET_WRITESRC_BUFFER, 0);
 }
 
 void janet_ev_write_string(JanetStream *stream, JanetString str) {
-    janet_ev_write_generic(stream, (void *) str, NULL, JANET_ASYNC_WRITEMODE_WRITE, 0, 0);
+    janet_ev_write_generic(stream, (void *) str, NULL, JANET_ASYNC_WRITEMODE_WRITE, JANET_WRITESRC_STRING, 0);
+}
+
+void janet_ev_write_parts(JanetStream *stream, JanetTuple parts) {
+    janet_ev_write_generic(stream, (void *) parts, NULL, JANET_ASYNC_WRITEMODE_WRITE, JANET_WRITESRC_PARTS, 0);
 }
 
 #ifdef JANET_NET
 void janet_ev_send_buffer(JanetStream *stream, JanetBuffer *buf, int flags) {
-    janet_ev_write_generic(stream, buf, NULL, JANET_ASYNC_WRITEMODE_SEND, 1, flags);
+    janet_ev_write_generic(stream, buf, NULL, JANET_ASYNC_WRITEMODE_SEND, JANET_WRITESRC_BUFFER, flags);
 }
 
 void janet_ev_send_string(JanetStream *stream, JanetString str, int flags) {
-    janet_ev_write_generic(stream, (void *) str, NULL, JANET_ASYNC_WRITEMODE_SEND, 0, flags);
+    janet_ev_write_generic(stream, (void *) str, NULL, JANET_ASYNC_WRITEMODE_SEND, JANET_WRITESRC_STRING, flags);
+}
+
+void janet_ev_send_parts(JanetStream *stream, JanetTuple parts, int flags) {
+    janet_ev_write_generic(stream, (void *) parts, NULL, JANET_ASYNC_WRITEMODE_SEND, JANET_WRITESRC_PARTS, flags);
 }
 
 void janet_ev_sendto_buffer(JanetStream *stream, JanetBuffer *buf, void *dest, int flags) {
-    janet_ev_write_generic(stream, buf, dest, JANET_ASYNC_WRITEMODE_SENDTO, 1, flags);
+    janet_ev_write_generic(stream, buf, dest, JANET_ASYNC_WRITEMODE_SENDTO, JANET_WRITESRC_BUFFER, flags);
 }
 
 void janet_ev_sendto_string(JanetStream *stream, JanetString str, void *dest, int flags) {
-    janet_ev_write_generic(stream, (void *) str, dest, JANET_ASYNC_WRITEMODE_SENDTO, 0, flags);
+    janet_ev_write_generic(stream, (void *) str, dest, JANET_ASYNC_WRITEMODE_SENDTO, JANET_WRITESRC_STRING, flags);
+}
+#endif
+
+/* Get the pieces of a vectored write, or NULL if the argument is a single byte sequence */
+JanetTuple janet_ev_getparts(const Janet *argv, int32_t n) {
+    const Janet *items;
+    int32_t len;
+    if (!janet_indexed_view(argv[n], &items, &len)) return NULL;
+    int64_t total = 0;
+    for (int32_t i = 0; i < len; i++) {
+        const uint8_t *bytes;
+        int32_t blen;
+        if (!janet_bytes_view(items[i], &bytes, &blen)) {
+            janet_panicf("bad slot #%d, expected bytes, got %v", n, items[i]);
+        }
+        total += blen;
+    }
+    if (total > INT32_MAX) janet_panic("write too large");
+    if (janet_checktype(argv[n], JANET_TUPLE)) return janet_unwrap_tuple(argv[n]);
+    return janet_tuple_n(items, len);
+}
+
+/*
+ * Write coalescing. Writes to a stream in coalescing mode are added to the stream's
+ * output buffer and return right away. The buffer is written in the background at the
+ * end of each event loop iteration, so small writes made together go out in a single
+ * system call. A writer that grows the buffer past the stream's limit waits for it to
+ * be written, which keeps a fast producer from running ahead of the connection.
+ */
+
+static void janet_stream_flush_later(JanetStream *stream) {
+    if (stream->flags & (JANET_STREAM_CLOSED | JANET_STREAM_FLUSH_QUEUED)) return;
+    int has_output = NULL != stream->_wbuf && stream->_wbuf->count > 0;
+    if (!has_output && !(stream->flags & JANET_STREAM_CLOSE_PENDING)) return;
+    if (janet_vm_flush_count == janet_vm_flush_cap) {
+        size_t newcap = janet_vm_flush_cap ? janet_vm_flush_cap * 2 : 16;
+        JanetStream **newqueue = janet_realloc(janet_vm_flush_queue, newcap * sizeof(JanetStream *));
+        if (NULL == newqueue) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm_flush_queue = newqueue;
+        janet_vm_flush_cap = newcap;
+    }
+    janet_vm_flush_queue[janet_vm_flush_count++] = stream;
+    stream->flags |= JANET_STREAM_FLUSH_QUEUED;
 }
+
+/* Start writing the coalesced output of a stream. Outside of a fiber, this
+ * listens in the background. */
+static void janet_stream_flush_start(JanetStream *stream) {
+    JanetWriteMode mode = JANET_ASYNC_WRITEMODE_WRITE;
+    int flags = 0;
+#if defined(JANET_NET) && defined(MSG_NOSIGNAL)
+    if (stream->flags & JANET_STREAM_SOCKET) {
+        mode = JANET_ASYNC_WRITEMODE_SEND;
+        flags = MSG_NOSIGNAL;
+    }
 #endif
+    janet_ev_write_generic(stream, stream->_wbuf, NULL, mode, JANET_WRITESRC_COALESCED, flags);
+}
+
+/* Suspend the current fiber until the coalesced output of a stream is written.
+ * Returns if some other fiber is already waiting for it. */
+static void janet_stream_flush_wait(JanetStream *stream, double to) {
+    JanetListenerState *state = stream->state;
+    while (NULL != state && !(state->machine == ev_machine_write &&
+                              ((StateWrite *) state)->source == JANET_WRITESRC_COALESCED)) {
+        state = state->_next;
+    }
+    if (NULL != state) {
+        /* Join the flush already in flight */
+        if (NULL != state->fiber) return;
+        state->fiber = janet_vm_root_fiber;
+        janet_vm_root_fiber->waiting = state;
+    } else if (stream->_mask & JANET_ASYNC_LISTEN_WRITE) {
+        return;
+    } else {
+        janet_stream_flush_start(stream);
+    }
+    if (to != INFINITY) janet_addtimeout(to);
+    janet_await();
+}
+
+/* Add data - bytes, or a tuple from janet_ev_getparts - to the output of a stream in
+ * coalescing mode. Returns 0 if the stream does not coalesce writes. */
+int janet_stream_coalesce(JanetStream *stream, Janet data, double to) {
+    if (stream->_wlimit <= 0) return 0;
+    JanetBuffer *wbuf = stream->_wbuf;
+    const uint8_t *bytes;
+    int32_t len;
+    if (janet_bytes_view(data, &bytes, &len)) {
+        janet_buffer_push_bytes(wbuf, bytes, len);
+    } else {
+        const Janet *parts = janet_unwrap_tuple(data);
+        for (int32_t i = 0; i < janet_tuple_length(parts); i++) {
+            janet_bytes_view(parts[i], &bytes, &len);
+            janet_buffer_push_bytes(wbuf, bytes, len);
+        }
+    }
+    if (wbuf->count >= stream->_wlimit) {
+        janet_stream_flush_wait(stream, to);
+    }
+    janet_stream_flush_later(stream);
+    return 1;
+}
+
+static void janet_stream_flush_background(JanetStream *stream) {
+    JanetTryState tstate;
+    if (!janet_try(&tstate)) {
+        janet_stream_flush_start(stream);
+    } else {
+        /* Nowhere for the output to go */
+        stream->_wbuf->count = 0;
+        janet_stream_close(stream);
+    }
+    janet_restore(&tstate);
+}
+
+/* Write out coalesced output and finish closes that waited for it. Runs between
+ * fibers, so new writes are started in the background. */
+static void janet_flush_pump(void) {
+    size_t count = janet_vm_flush_count;
+    size_t keep = 0;
+    for (size_t i = 0; i < count; i++) {
+        JanetStream *stream = janet_vm_flush_queue[i];
+        if (stream->flags & JANET_STREAM_CLOSED) {
+            stream->flags &= ~JANET_STREAM_FLUSH_QUEUED;
+            continue;
+        }
+        if (stream->_mask & JANET_ASYNC_LISTEN_WRITE) {
+            /* Wait for the write in flight */
+            janet_vm_flush_queue[keep++] = stream;
+            continue;
+        }
+        stream->flags &= ~JANET_STREAM_FLUSH_QUEUED;
+        if (NULL != stream->_wbuf && stream->_wbuf->count > 0) {
+            janet_stream_flush_background(stream);
+        } else if (stream->flags & JANET_STREAM_CLOSE_PENDING) {
+            janet_stream_close(stream);
+        }
+    }
+    janet_vm_flush_count = keep;
+}
 
 /* For a pipe ID */
 #ifdef JANET_WINDOWS
@@ -2021,10 +4568,11 @@ int janet_make_pipe(JanetHandle handles[2], int mode) {
     }
     return 0;
 #else
-    (void) mode;
+    /* The side sent to a subprocess must stay blocking, as the subprocess
+     * shares its file description. */
     if (pipe(handles)) return -1;
-    if (fcntl(handles[0], F_SETFL, O_NONBLOCK)) goto error;
-    if (fcntl(handles[1], F_SETFL, O_NONBLOCK)) goto error;
+    if (mode != 2 && fcntl(handles[0], F_SETFL, O_NONBLOCK)) goto error;
+    if (mode != 1 && fcntl(handles[1], F_SETFL, O_NONBLOCK)) goto error;
     return 0;
 error:
     close(handles[0]);
@@ -2041,7 +4589,16 @@ static Janet cfun_ev_go(int32_t argc, Janet *argv) {
     Janet value = argc == 2 ? argv[1] : janet_wrap_nil();
     JanetChannel *supervisor_channel = janet_optabstract(argv, argc, 2, &ChannelAT,
                                        janet_vm_root_fiber->supervisor_channel);
+    janet_gc_barrier(fiber);
     fiber->supervisor_channel = supervisor_channel;
+    if (janet_fiber_status(fiber) == JANET_STATUS_NEW && fiber != janet_vm_fiber) {
+        /* Inherit fiber-locals that the new fiber has not set itself */
+        for (int i = 0; i < JANET_FIBER_LOCALS; i++) {
+            if (janet_checktype(fiber->locals[i], JANET_NIL)) {
+                fiber->locals[i] = janet_vm_fiber->locals[i];
+            }
+        }
+    }
     janet_schedule(fiber, value);
     return argv[0];
 }
@@ -2101,7 +4658,66 @@ static Janet cfun_ev_thread(int32_t argc, Janet *argv) {
     janet_marshal(buffer, janet_wrap_table(janet_vm_registry), NULL, JANET_MARSHAL_UNSAFE);
     janet_marshal(buffer, argv[0], NULL, JANET_MARSHAL_UNSAFE);
     janet_marshal(buffer, value, NULL, JANET_MARSHAL_UNSAFE);
-    janet_ev_threaded_await(janet_go_thread_subr, 0, argc, buffer);
+    /* The thread runs for as long as its event loop does, so don't tie up a pooled worker */
+    janet_ev_threaded_await_impl(janet_go_thread_subr, 0, argc, buffer, 1);
+}
+
+static Janet cfun_ev_migrate(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    janet_getfiber(argv, 0);
+    Janet value = argc == 2 ? argv[1] : janet_wrap_nil();
+    JanetBuffer *buffer = janet_buffer(0);
+    janet_marshal(buffer, argv[0], NULL, JANET_MARSHAL_UNSAFE);
+    janet_marshal(buffer, value, NULL, JANET_MARSHAL_UNSAFE);
+    JanetStealJob *job = janet_malloc(sizeof(JanetStealJob));
+    if (NULL == job) {
+        JANET_OUT_OF_MEMORY;
+    }
+    /* Take the memory from the gc managed buffer */
+    job->payload = *buffer;
+    buffer->data = NULL;
+    buffer->count = 0;
+    buffer->capacity = 0;
+    if (NULL == janet_vm_steal_origin) {
+        JanetStealOrigin *origin = janet_malloc(sizeof(JanetStealOrigin));
+        if (NULL == origin) {
+            JANET_OUT_OF_MEMORY;
+        }
+        origin->loop = janet_ev_loop_handle();
+        origin->refCount = 1;
+        origin->dead = 0;
+        janet_vm_steal_origin = origin;
+    }
+    job->origin = janet_vm_steal_origin;
+    job->fiber = janet_vm_root_fiber;
+    job->sched_id = janet_vm_root_fiber->sched_id;
+    job->sig = JANET_SIGNAL_OK;
+    janet_steal_acquire();
+    job->origin->refCount++;
+    janet_steal_release();
+    if (janet_steal_submit(job)) {
+        janet_steal_acquire();
+        job->origin->refCount--;
+        janet_steal_release();
+        janet_buffer_deinit(&job->payload);
+        janet_free(job);
+        janet_panic("failed to start worker thread");
+    }
+    janet_gcroot(janet_wrap_fiber(job->fiber));
+    /* Keep the event loop running until the result comes back */
+    janet_ev_inc_refcount();
+    janet_await();
+}
+
+static Janet cfun_ev_set_migrate_workers(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    int32_t size = janet_getnat(argv, 0);
+    if (size < 1) janet_panic("expected at least 1 worker");
+    janet_steal_acquire();
+    int32_t old_size = janet_steal_max ? janet_steal_max : janet_steal_default_max();
+    janet_steal_max = size;
+    janet_steal_release();
+    return janet_wrap_integer(old_size);
 }
 
 static Janet cfun_ev_give_supervisor(int32_t argc, Janet *argv) {
@@ -2122,7 +4738,8 @@ JANET_NO_RETURN void janet_sleep_await(double sec) {
     to.is_error = 0;
     to.sched_id = to.fiber->sched_id;
     to.curr_fiber = NULL;
-    add_timeout(to);
+    JanetTimeout *node = add_timeout(to);
+    if (NULL == to.fiber->timeout) to.fiber->timeout = node;
     janet_await();
 }
 
@@ -2137,16 +4754,35 @@ static Janet cfun_ev_deadline(int32_t argc, Janet *argv) {
     double sec = janet_getnumber(argv, 0);
     JanetFiber *tocancel = janet_optfiber(argv, argc, 1, janet_vm_root_fiber);
     JanetFiber *tocheck = janet_optfiber(argv, argc, 2, janet_vm_fiber);
-    JanetTimeout to;
-    to.when = ts_delta(ts_now(), sec);
-    to.fiber = tocancel;
-    to.curr_fiber = tocheck;
-    to.is_error = 0;
-    to.sched_id = to.fiber->sched_id;
-    add_timeout(to);
+    JanetTimestamp when = ts_delta(ts_now(), sec);
+    JanetTimeout *existing = tocheck->deadline;
+    if (NULL != existing) {
+        /* Reuse the pending deadline instead of adding another one */
+        existing->fiber = tocancel;
+        existing->sched_id = tocancel->sched_id;
+        reset_timeout(existing, when);
+    } else {
+        JanetTimeout to;
+        to.when = when;
+        to.fiber = tocancel;
+        to.curr_fiber = tocheck;
+        to.is_error = 0;
+        to.sched_id = to.fiber->sched_id;
+        tocheck->deadline = add_timeout(to);
+    }
     return janet_wrap_fiber(tocancel);
 }
 
+static Janet cfun_ev_cancel_deadline(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    JanetFiber *tocheck = janet_optfiber(argv, argc, 0, janet_vm_fiber);
+    JanetTimeout *existing = tocheck->deadline;
+    if (NULL == existing) return janet_wrap_false();
+    cancel_timeout(existing);
+    tocheck->deadline = NULL;
+    return janet_wrap_true();
+}
+
 static Janet cfun_ev_cancel(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 2);
     JanetFiber *fiber = janet_getfiber(argv, 0);
@@ -2155,18 +4791,241 @@ static Janet cfun_ev_cancel(int32_t argc, Janet *argv) {
     return argv[0];
 }
 
+static Janet cfun_ev_edge_triggered(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, 0);
+    int enable = argc < 2 || janet_truthy(argv[1]);
+    if (NULL != stream->state) {
+        janet_panic("cannot change triggering of a stream with pending operations");
+    }
+    if (enable) {
+        stream->flags |= JANET_STREAM_EDGE;
+    } else {
+#ifdef JANET_EV_EPOLL
+        janet_epoll_close(stream);
+#endif
+        stream->flags &= ~(JANET_STREAM_EDGE | JANET_STREAM_EDGE_READABLE | JANET_STREAM_EDGE_WRITABLE);
+    }
+    return argv[0];
+}
+
+static Janet cfun_ev_set_pool_size(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    int32_t size = janet_getnat(argv, 0);
+    if (size < 1) janet_panic("expected pool size of at least 1");
+    janet_ev_pool_acquire();
+    int32_t old_size = janet_ev_pool_max;
+    janet_ev_pool_max = size;
+    /* Let excess idle workers exit */
+    if (janet_ev_pool_workers > size) janet_ev_pool_wakeup(1);
+    janet_ev_pool_release();
+    return janet_wrap_integer(old_size);
+}
+
+static Janet ev_histogram(const uint64_t *histogram) {
+    int32_t n = JANET_EV_HISTOGRAM_BUCKETS;
+    while (n > 0 && !histogram[n - 1]) n--;
+    Janet *counts = janet_tuple_begin(n);
+    for (int32_t i = 0; i < n; i++) counts[i] = janet_wrap_number((double) histogram[i]);
+    return janet_wrap_tuple(janet_tuple_end(counts));
+}
+
+static Janet cfun_ev_stats(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 0);
+    (void) argv;
+    JanetEVStats *stats = &janet_vm_ev_stats;
+    JanetKV *st = janet_struct_begin(15);
+    janet_struct_put(st, janet_ckeywordv("spawn-queue"), janet_wrap_integer(janet_q_count(&janet_vm_spawn)));
+    janet_struct_put(st, janet_ckeywordv("listeners"), janet_wrap_number((double) janet_vm_listener_count));
+    janet_struct_put(st, janet_ckeywordv("timeouts"), janet_wrap_number((double) janet_vm_tq_count));
+    janet_struct_put(st, janet_ckeywordv("iterations"), janet_wrap_number((double) stats->iterations));
+    janet_struct_put(st, janet_ckeywordv("runs"), janet_wrap_number((double) stats->runs));
+    janet_struct_put(st, janet_ckeywordv("run-time"), janet_wrap_number(stats->run_time));
+    janet_struct_put(st, janet_ckeywordv("poll-time"), janet_wrap_number(stats->poll_time));
+    janet_struct_put(st, janet_ckeywordv("max-lag"), janet_wrap_number((double) stats->max_lag * 1e-3));
+    if (stats->detailed) {
+        janet_struct_put(st, janet_ckeywordv("max-run"), janet_wrap_number(stats->max_run));
+        janet_struct_put(st, janet_ckeywordv("lag-histogram"), ev_histogram(stats->lag_histogram));
+        janet_struct_put(st, janet_ckeywordv("run-histogram"), ev_histogram(stats->run_histogram));
+        janet_struct_put(st, janet_ckeywordv("outliers"),
+                         janet_wrap_tuple(janet_tuple_n(stats->outliers->data, stats->outliers->count)));
+    }
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
+static Janet cfun_ev_instrument(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    JanetEVStats *stats = &janet_vm_ev_stats;
+    stats->detailed = janet_truthy(argv[0]);
+    stats->outlier = janet_optnumber(argv, argc, 1, 0.01);
+    stats->max_run = 0;
+    memset(stats->lag_histogram, 0, sizeof(stats->lag_histogram));
+    memset(stats->run_histogram, 0, sizeof(stats->run_histogram));
+    stats->outliers = stats->detailed ? janet_array(0) : NULL;
+    return janet_wrap_nil();
+}
+
+/* Files
+ *
+ * Regular files are always "ready" to a poller, so reads and writes on them
+ * would block the whole loop on a slow disk. Instead they run on the thread
+ * pool, using memory owned by the operation, and the results are copied into
+ * janet values back on the loop thread. The file is marked busy while an
+ * operation is in flight so it cannot be used or closed from another fiber. */
+
+typedef enum {
+    JANET_FILEOP_READ,
+    JANET_FILEOP_CHUNK,
+    JANET_FILEOP_ALL,
+    JANET_FILEOP_WRITE
+} JanetFileOpMode;
+
+typedef struct {
+    JanetFile *file;
+    JanetBuffer *buffer;
+    JanetFileOpMode mode;
+    uint8_t *data;
+    size_t len;
+    size_t count;
+    int err;
+    uint32_t sched_id;
+} JanetFileOp;
+
+static JanetEVGenericMessage janet_fileop_subr(JanetEVGenericMessage msg) {
+    JanetFileOp *op = (JanetFileOp *) msg.argp;
+    FILE *f = op->file->file;
+    if (op->mode == JANET_FILEOP_WRITE) {
+        if (fwrite(op->data, 1, op->len, f) != op->len || fflush(f)) op->err = errno ? errno : EIO;
+        return msg;
+    }
+    size_t cap = op->mode == JANET_FILEOP_ALL ? 4096 : op->len;
+    op->data = cap ? janet_malloc(cap) : NULL;
+    if (cap && NULL == op->data) {
+        op->err = ENOMEM;
+        return msg;
+    }
+    for (;;) {
+        size_t nread = fread(op->data + op->count, 1, cap - op->count, f);
+        op->count += nread;
+        if (ferror(f)) {
+            op->err = errno ? errno : EIO;
+            break;
+        }
+        if (op->count < cap || op->mode != JANET_FILEOP_ALL) break;
+        if (cap >= op->len) break;
+        size_t newcap = cap > op->len / 2 ? op->len : 2 * cap;
+        uint8_t *newdata = janet_realloc(op->data, newcap);
+        if (NULL == newdata) {
+            op->err = ENOMEM;
+            break;
+        }
+        op->data = newdata;
+        cap = newcap;
+    }
+    return msg;
+}
+
+static void janet_fileop_callback(JanetEVGenericMessage msg) {
+    JanetFileOp *op = (JanetFileOp *) msg.argp;
+    JanetFiber *fiber = msg.fiber;
+    op->file->flags &= ~JANET_FILE_BUSY;
+    /* Do not resume a fiber that was canceled or timed out in the meantime */
+    if (fiber->sched_id == op->sched_id) {
+        if (op->err) {
+            janet_cancel(fiber, janet_cstringv(strerror(op->err)));
+        } else if (op->mode == JANET_FILEOP_WRITE) {
+            janet_schedule(fiber, janet_wrap_nil());
+        } else if (op->count == 0) {
+            janet_schedule(fiber, janet_wrap_nil());
+        } else if (op->count > (size_t)(INT32_MAX - op->buffer->count)) {
+            janet_cancel(fiber, janet_cstringv("buffer overflow"));
+        } else {
+            janet_buffer_push_bytes(op->buffer, op->data, (int32_t) op->count);
+            janet_schedule(fiber, janet_wrap_buffer(op->buffer));
+        }
+    }
+    janet_gcunroot(janet_wrap_abstract(op->file));
+    if (NULL != op->buffer) janet_gcunroot(janet_wrap_buffer(op->buffer));
+    janet_gcunroot(janet_wrap_fiber(fiber));
+    janet_free(op->data);
+    janet_free(op);
+}
+
+JANET_NO_RETURN static void janet_ev_fileop(JanetFile *file, JanetFileOpMode mode, JanetBuffer *buffer,
+        const uint8_t *bytes, size_t len, double to) {
+    if (file->flags & JANET_FILE_CLOSED) janet_panic("file is closed");
+    if (file->flags & JANET_FILE_BUSY) janet_panic("file is busy");
+    if (mode == JANET_FILEOP_WRITE) {
+        if (!(file->flags & (JANET_FILE_WRITE | JANET_FILE_APPEND | JANET_FILE_UPDATE)))
+            janet_panic("file is not writeable");
+    } else if (!(file->flags & (JANET_FILE_READ | JANET_FILE_UPDATE))) {
+        janet_panic("file is not readable");
+    }
+    JanetFileOp *op = janet_malloc(sizeof(JanetFileOp));
+    if (NULL == op) {
+        JANET_OUT_OF_MEMORY;
+    }
+    op->file = file;
+    op->buffer = buffer;
+    op->mode = mode;
+    op->data = NULL;
+    op->len = len;
+    op->count = 0;
+    op->err = 0;
+    if (mode == JANET_FILEOP_WRITE && len > 0) {
+        /* The bytes may move or be collected while the write runs */
+        op->data = janet_malloc(len);
+        if (NULL == op->data) {
+            janet_free(op);
+            JANET_OUT_OF_MEMORY;
+        }
+        memcpy(op->data, bytes, len);
+    }
+    JanetEVGenericMessage msg;
+    msg.tag = 0;
+    msg.argi = 0;
+    msg.argp = op;
+    msg.fiber = janet_root_fiber();
+    op->sched_id = msg.fiber->sched_id;
+    if (to != INFINITY) janet_addtimeout(to);
+    janet_ev_threaded_call(janet_fileop_subr, msg, janet_fileop_callback);
+    file->flags |= JANET_FILE_BUSY;
+    janet_gcroot(janet_wrap_abstract(file));
+    if (NULL != buffer) janet_gcroot(janet_wrap_buffer(buffer));
+    janet_gcroot(janet_wrap_fiber(msg.fiber));
+    janet_await();
+}
+
 Janet janet_cfun_stream_close(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
+    if (janet_checkfile(argv[0])) return janet_mcall("close", 1, argv);
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    if (!(stream->flags & JANET_STREAM_CLOSED) && NULL != stream->_wbuf && stream->_wbuf->count > 0) {
+        /* Write out coalesced output first - the stream is closed after that */
+        stream->flags |= JANET_STREAM_CLOSE_PENDING;
+        janet_stream_flush_wait(stream, INFINITY);
+        janet_stream_flush_later(stream);
+        return argv[0];
+    }
     janet_stream_close(stream);
     return argv[0];
 }
 
 Janet janet_cfun_stream_read(int32_t argc, Janet *argv) {
     janet_arity(argc, 2, 4);
+    if (janet_checkfile(argv[0])) {
+        JanetBuffer *buffer = janet_optbuffer_pooled(argv, argc, 2, argv[1]);
+        double to = janet_optnumber(argv, argc, 3, INFINITY);
+        if (janet_keyeq(argv[1], "all")) {
+            janet_ev_fileop(janet_unwrap_abstract(argv[0]), JANET_FILEOP_ALL, buffer, NULL, INT32_MAX, to);
+        }
+        int32_t n = janet_getnat(argv, 1);
+        janet_ev_fileop(janet_unwrap_abstract(argv[0]), JANET_FILEOP_READ, buffer, NULL, (size_t) n, to);
+    }
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
     janet_stream_flags(stream, JANET_STREAM_READABLE);
-    JanetBuffer *buffer = janet_optbuffer(argv, argc, 2, 10);
+    JanetBuffer *buffer = janet_optbuffer_pooled(argv, argc, 2, argv[1]);
     double to = janet_optnumber(argv, argc, 3, INFINITY);
     if (janet_keyeq(argv[1], "all")) {
         if (to != INFINITY) janet_addtimeout(to);
@@ -2181,10 +5040,16 @@ Janet janet_cfun_stream_read(int32_t argc, Janet *argv) {
 
 Janet janet_cfun_stream_chunk(int32_t argc, Janet *argv) {
     janet_arity(argc, 2, 4);
+    if (janet_checkfile(argv[0])) {
+        int32_t n = janet_getnat(argv, 1);
+        JanetBuffer *buffer = janet_optbuffer_pooled(argv, argc, 2, argv[1]);
+        double to = janet_optnumber(argv, argc, 3, INFINITY);
+        janet_ev_fileop(janet_unwrap_abstract(argv[0]), JANET_FILEOP_CHUNK, buffer, NULL, (size_t) n, to);
+    }
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
     janet_stream_flags(stream, JANET_STREAM_READABLE);
     int32_t n = janet_getnat(argv, 1);
-    JanetBuffer *buffer = janet_optbuffer(argv, argc, 2, 10);
+    JanetBuffer *buffer = janet_optbuffer_pooled(argv, argc, 2, argv[1]);
     double to = janet_optnumber(argv, argc, 3, INFINITY);
     if (to != INFINITY) janet_addtimeout(to);
     janet_ev_readchunk(stream, buffer, n);
@@ -2193,10 +5058,34 @@ Janet janet_cfun_stream_chunk(int32_t argc, Janet *argv) {
 
 Janet janet_cfun_stream_write(int32_t argc, Janet *argv) {
     janet_arity(argc, 2, 3);
+    JanetTuple parts = janet_ev_getparts(argv, 1);
+    if (janet_checkfile(argv[0])) {
+        double to = janet_optnumber(argv, argc, 2, INFINITY);
+        if (NULL != parts) {
+            /* The bytes are copied before the write starts, so join them in a scratch buffer */
+            JanetBuffer *joined = janet_buffer(0);
+            for (int32_t i = 0; i < janet_tuple_length(parts); i++) {
+                JanetByteView part = janet_getbytes(parts, i);
+                janet_buffer_push_bytes(joined, part.bytes, part.len);
+            }
+            janet_ev_fileop(janet_unwrap_abstract(argv[0]), JANET_FILEOP_WRITE, NULL,
+                            joined->data, (size_t) joined->count, to);
+        }
+        JanetByteView bytes = janet_getbytes(argv, 1);
+        janet_ev_fileop(janet_unwrap_abstract(argv[0]), JANET_FILEOP_WRITE, NULL,
+                        bytes.bytes, (size_t) bytes.len, to);
+    }
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
     janet_stream_flags(stream, JANET_STREAM_WRITABLE);
     double to = janet_optnumber(argv, argc, 2, INFINITY);
-    if (janet_checktype(argv[1], JANET_BUFFER)) {
+    if (NULL == parts) janet_getbytes(argv, 1);
+    if (janet_stream_coalesce(stream, parts ? janet_wrap_tuple(parts) : argv[1], to)) {
+        return janet_wrap_nil();
+    }
+    if (NULL != parts) {
+        if (to != INFINITY) janet_addtimeout(to);
+        janet_ev_write_parts(stream, parts);
+    } else if (janet_checktype(argv[1], JANET_BUFFER)) {
         if (to != INFINITY) janet_addtimeout(to);
         janet_ev_write_buffer(stream, janet_getbuffer(argv, 1));
     } else {
@@ -2207,6 +5096,22 @@ Janet janet_cfun_stream_write(int32_t argc, Janet *argv) {
     janet_await();
 }
 
+static Janet cfun_ev_coalesce(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_WRITABLE);
+    int32_t limit = janet_optnat(argv, argc, 1, 0x10000);
+    if (limit > 0 && NULL == stream->_wbuf) {
+        stream->_wbuf = janet_buffer(limit < 4096 ? limit : 4096);
+    }
+    stream->_wlimit = limit;
+    if (limit == 0 && NULL != stream->_wbuf && stream->_wbuf->count > 0) {
+        /* Later writes go straight out, so they must not overtake this output */
+        janet_stream_flush_wait(stream, INFINITY);
+    }
+    return janet_wrap_nil();
+}
+
 static const JanetReg ev_cfuns[] = {
     {
         "ev/go", cfun_ev_go,
@@ -2225,6 +5130,23 @@ static const JanetReg ev_cfuns[] = {
              "Unlike `ev/go`, this function will suspend the current fiber until the thread is complete. "
              "The the final result.")
     },
+    {
+        "ev/migrate", cfun_ev_migrate,
+        JDOC("(ev/migrate fiber &opt value)\n\n"
+             "Resume a (copy of a) `fiber` on the shared pool of worker threads, optionally passing "
+             "`value` to resume with, and suspend the current fiber until it is done. Returns the "
+             "final value of the migrated fiber, or raises its error. Both must be marshallable. "
+             "Each worker runs many migrated fibers on its own event loop, and idle workers steal "
+             "fibers from busy ones, so fibers migrated from inside of a migrated fiber are spread "
+             "over the pool too.")
+    },
+    {
+        "ev/set-migrate-workers", cfun_ev_set_migrate_workers,
+        JDOC("(ev/set-migrate-workers n)\n\n"
+             "Set the maximum number of worker threads used by `ev/migrate`. Workers are started "
+             "as needed and are never stopped. Defaults to the number of processors. Returns the "
+             "previous maximum.")
+    },
     {
         "ev/give-supervisor", cfun_ev_give_supervisor,
         JDOC("(ev/give-supervsior tag & payload)\n\n"
@@ -2243,7 +5165,14 @@ static const JanetReg ev_cfuns[] = {
              "Set a deadline for a fiber `tocheck`. If `tocheck` is not finished after `sec` seconds, "
              "`tocancel` will be canceled as with `ev/cancel`. "
              "If `tocancel` and `tocheck` are not given, they default to `(fiber/root)` and "
-             "`(fiber/current)` respectively. Returns `tocancel`.")
+             "`(fiber/current)` respectively. A fiber has at most one pending deadline, so setting "
+             "a deadline for a fiber that already has one moves the existing deadline. Returns `tocancel`.")
+    },
+    {
+        "ev/cancel-deadline", cfun_ev_cancel_deadline,
+        JDOC("(ev/cancel-deadline &opt tocheck)\n\n"
+             "Remove the pending deadline set with `ev/deadline` for the fiber `tocheck`, which "
+             "defaults to `(fiber/current)`. Returns true if there was a pending deadline, false otherwise.")
     },
     {
         "ev/chan", cfun_channel_new,
@@ -2251,6 +5180,15 @@ static const JanetReg ev_cfuns[] = {
              "Create a new channel. capacity is the number of values to queue before "
              "blocking writers, defaults to 0 if not provided. Returns a new channel.")
     },
+    {
+        "ev/thread-chan", cfun_channel_thread_new,
+        JDOC("(ev/thread-chan &opt capacity)\n\n"
+             "Create a new channel that can be shared between threads, for example by sending it "
+             "with `thread/send` or passing it to `thread/new` in a closure. Works with the same "
+             "functions as `ev/chan`, and values are marshalled when given to the channel. "
+             "capacity is the number of values to queue before blocking writers, defaults to 0 "
+             "if not provided. Returns a new channel.")
+    },
     {
         "ev/give", cfun_channel_push,
         JDOC("(ev/give channel value)\n\n"
@@ -2281,6 +5219,43 @@ static const JanetReg ev_cfuns[] = {
         JDOC("(ev/cancel fiber err)\n\n"
              "Cancel a suspended fiber in the event loop. Differs from cancel in that it returns the canceled fiber immediately")
     },
+    {
+        "ev/edge-triggered", cfun_ev_edge_triggered,
+        JDOC("(ev/edge-triggered stream &opt enable)\n\n"
+             "Enable or disable edge triggered event notification for a stream. An edge triggered stream "
+             "is registered with the event loop once for its whole lifetime, rather than once per read or write, "
+             "and connections accepted from an edge triggered server are also edge triggered. Only has an effect "
+             "with the epoll backend. Cannot be changed while the stream has pending operations. Returns the stream.")
+    },
+    {
+        "ev/set-pool-size", cfun_ev_set_pool_size,
+        JDOC("(ev/set-pool-size size)\n\n"
+             "Set the maximum number of worker threads kept around to run threaded calls, such as "
+             "waiting on subprocesses. The pool is shared by all threads in the process. When every "
+             "worker is busy, new calls wait for one, so calls that block for a long time, such as "
+             "waiting on a subprocess that does not exit, hold up the calls behind them. Threads "
+             "started with ev/thread do not use the pool. Returns the previous pool size.")
+    },
+    {
+        "ev/stats", cfun_ev_stats,
+        JDOC("(ev/stats)\n\n"
+             "Get a struct of event loop statistics for the current thread. This includes the number of "
+             "fibers in the :spawn-queue, the number of :listeners and pending :timeouts, the number of "
+             "loop :iterations and fiber :runs so far, the :run-time spent running fibers and the "
+             ":poll-time spent waiting for events in seconds, and the :max-lag in seconds between when a "
+             "timeout should have fired and when it did. With ev/instrument on, it also has the "
+             ":max-run time of one fiber run, a :lag-histogram and :run-histogram where the count at index "
+             "i is for times under 2^i microseconds, and the most recent :outliers, a struct with the "
+             ":name, :source, :source-line and :time of each fiber run that took too long.")
+    },
+    {
+        "ev/instrument", cfun_ev_instrument,
+        JDOC("(ev/instrument enable &opt outlier)\n\n"
+             "Turn timing of each fiber run on the event loop of the current thread on or off, which adds "
+             "histograms and outliers to ev/stats. Runs that take at least `outlier` seconds, 0.01 by "
+             "default, are noted with the function the fiber was started with. Clears the histograms "
+             "and outliers collected so far. Returns nil.")
+    },
     {
         "ev/select", cfun_channel_choice,
         JDOC("(ev/select & clauses)\n\n"
@@ -2297,7 +5272,9 @@ static const JanetReg ev_cfuns[] = {
     {
         "ev/close", janet_cfun_stream_close,
         JDOC("(ev/close stream)\n\n"
-             "Close a stream. This should be the same as calling (:close stream) for all streams.")
+             "Close a stream or file. This should be the same as calling (:close stream) for all streams. "
+             "If the stream has coalesced output that is not written yet, suspends the current fiber until "
+             "it is written.")
     },
     {
         "ev/read", janet_cfun_stream_read,
@@ -2307,7 +5284,8 @@ static const JanetReg ev_cfuns[] = {
              "Optionally provide a buffer to write into "
              "as well as a timeout in seconds after which to cancel the operation and raise an error. "
              "Returns the buffer if the read was successful or nil if end-of-stream reached. Will raise an "
-             "error if there are problems with the IO operation.")
+             "error if there are problems with the IO operation. `stream` can also be a core/file, which is "
+             "read on the thread pool so a slow disk does not block other fibers.")
     },
     {
         "ev/chunk", janet_cfun_stream_chunk,
@@ -2320,7 +5298,20 @@ static const JanetReg ev_cfuns[] = {
         JDOC("(ev/write stream data &opt timeout)\n\n"
              "Write data to a stream, suspending the current fiber until the write "
              "completes. Takes an optional timeout in seconds, after which will return nil. "
-             "Returns nil, or raises an error if the write failed.")
+             "Returns nil, or raises an error if the write failed. `data` can also be an array or tuple of "
+             "byte sequences, which are written together with a single vectored write where possible. "
+             "`stream` can also be a core/file, which is "
+             "written and flushed on the thread pool so a slow disk does not block other fibers.")
+    },
+    {
+        "ev/coalesce", cfun_ev_coalesce,
+        JDOC("(ev/coalesce stream &opt limit)\n\n"
+             "Turn on write coalescing for a stream. Writes to the stream then add to an output buffer "
+             "and return right away, and the buffer is written at the end of the current event loop "
+             "iteration, so many small writes go out in one system call. A write that brings the buffer "
+             "to `limit` bytes (default 65536) instead waits for the buffer to be written. Closing the "
+             "stream waits for the buffer to be written first. If writing the buffer fails, the stream is "
+             "closed. A `limit` of 0 turns coalescing off again. Returns nil.")
     },
     {NULL, NULL, NULL}
 };
@@ -2328,6 +5319,7 @@ static const JanetReg ev_cfuns[] = {
 void janet_lib_ev(JanetTable *env) {
     janet_core_cfuns(env, NULL, ev_cfuns);
     janet_register_abstract_type(&janet_stream_type);
+    janet_register_abstract_type(&janet_thread_channel_type);
 }
 
 #endif
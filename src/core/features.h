@@ -45,6 +45,11 @@
 #define _XOPEN_SOURCE 500
 #endif
 
+/* Needed for MAP_ANONYMOUS with -std=c99 */
+#if !defined(_DEFAULT_SOURCE) && defined(__linux__)
+#define _DEFAULT_SOURCE
+#endif
+
 /* Needed for timegm and other extensions when building with -std=c99.
  * It also defines realpath, etc, which would normally require
  * _XOPEN_SOURCE >= 500. */
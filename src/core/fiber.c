@@ -38,38 +38,113 @@ static void fiber_reset(JanetFiber *fiber) {
     fiber->flags = JANET_FIBER_MASK_YIELD | JANET_FIBER_RESUME_NO_USEVAL | JANET_FIBER_RESUME_NO_SKIP;
     fiber->env = NULL;
     fiber->last_value = janet_wrap_nil();
+    for (int i = 0; i < JANET_FIBER_LOCALS; i++) {
+        fiber->locals[i] = janet_wrap_nil();
+    }
 #ifdef JANET_EV
     fiber->waiting = NULL;
     fiber->sched_id = 0;
     fiber->supervisor_channel = NULL;
+    fiber->timeout = NULL;
+    fiber->deadline = NULL;
 #endif
     janet_fiber_set_status(fiber, JANET_STATUS_NEW);
 }
 
-static JanetFiber *fiber_alloc(int32_t capacity) {
-    Janet *data;
-    JanetFiber *fiber = janet_gcalloc(JANET_MEMORY_FIBER, sizeof(JanetFiber));
-    if (capacity < 32) {
-        capacity = 32;
+/* Fiber stacks are sized in powers of two, so that the stacks of collected
+ * fibers can be kept per thread in one free list per size and handed to new
+ * fibers instead of going back to malloc. Free stacks are linked through
+ * their first slot. */
+
+JANET_THREAD_LOCAL Janet *janet_vm_stack_pool[JANET_STACK_POOL_CLASSES];
+JANET_THREAD_LOCAL int32_t janet_vm_stack_pool_count[JANET_STACK_POOL_CLASSES];
+
+static int32_t janet_stack_size(int32_t n) {
+    int32_t size = JANET_STACK_POOL_MIN;
+    while (size < n) {
+        if (size > INT32_MAX / 2) return INT32_MAX;
+        size *= 2;
     }
-    fiber->capacity = capacity;
-    data = janet_malloc(sizeof(Janet) * (size_t) capacity);
+    return size;
+}
+
+static int janet_stack_class(int32_t capacity) {
+    int c = 0;
+    int32_t size = JANET_STACK_POOL_MIN;
+    while (c < JANET_STACK_POOL_CLASSES && size < capacity) {
+        size *= 2;
+        c++;
+    }
+    return (c < JANET_STACK_POOL_CLASSES && size == capacity) ? c : -1;
+}
+
+static Janet *janet_stack_alloc(int32_t capacity) {
+    int c = janet_stack_class(capacity);
+    if (c >= 0 && NULL != janet_vm_stack_pool[c]) {
+        Janet *data = janet_vm_stack_pool[c];
+        janet_vm_stack_pool[c] = *((Janet **) data);
+        janet_vm_stack_pool_count[c]--;
+        return data;
+    }
+    Janet *data = janet_malloc(sizeof(Janet) * (size_t) capacity);
     if (NULL == data) {
         JANET_OUT_OF_MEMORY;
     }
+    return data;
+}
+
+/* Called when a fiber is collected */
+void janet_stack_free(Janet *data, int32_t capacity) {
+    int c = janet_stack_class(capacity);
+    if (NULL != data && c >= 0 &&
+            (size_t) janet_vm_stack_pool_count[c] * (size_t) capacity * sizeof(Janet) < JANET_STACK_POOL_BYTES) {
+        *((Janet **) data) = janet_vm_stack_pool[c];
+        janet_vm_stack_pool[c] = data;
+        janet_vm_stack_pool_count[c]++;
+        return;
+    }
+    janet_free(data);
+}
+
+void janet_stack_pool_init(void) {
+    for (int i = 0; i < JANET_STACK_POOL_CLASSES; i++) {
+        janet_vm_stack_pool[i] = NULL;
+        janet_vm_stack_pool_count[i] = 0;
+    }
+}
+
+void janet_stack_pool_deinit(void) {
+    for (int i = 0; i < JANET_STACK_POOL_CLASSES; i++) {
+        Janet *data = janet_vm_stack_pool[i];
+        while (NULL != data) {
+            Janet *next = *((Janet **) data);
+            janet_free(data);
+            data = next;
+        }
+    }
+    janet_stack_pool_init();
+}
+
+static JanetFiber *fiber_alloc(int32_t capacity) {
+    JanetFiber *fiber = janet_gcalloc(JANET_MEMORY_FIBER, sizeof(JanetFiber));
+    capacity = janet_stack_size(capacity);
+    fiber->capacity = capacity;
+    fiber->data = janet_stack_alloc(capacity);
     janet_vm_next_collection += sizeof(Janet) * capacity;
-    fiber->data = data;
     return fiber;
 }
 
+static void janet_fiber_grow(JanetFiber *fiber, int32_t needed);
+
 /* Create a new fiber with argn values on the stack by reusing a fiber. */
 JanetFiber *janet_fiber_reset(JanetFiber *fiber, JanetFunction *callee, int32_t argc, const Janet *argv) {
     int32_t newstacktop;
+    janet_gc_barrier(fiber);
     fiber_reset(fiber);
     if (argc) {
         newstacktop = fiber->stacktop + argc;
         if (newstacktop >= fiber->capacity) {
-            janet_fiber_setcapacity(fiber, 2 * newstacktop);
+            janet_fiber_grow(fiber, newstacktop);
         }
         if (argv) {
             memcpy(fiber->data + fiber->stacktop, argv, argc * sizeof(Janet));
@@ -114,6 +189,7 @@ static void janet_fiber_refresh_memory(JanetFiber *fiber) {
 /* Ensure that the fiber has enough extra capacity */
 void janet_fiber_setcapacity(JanetFiber *fiber, int32_t n) {
     int32_t old_size = fiber->capacity;
+    n = janet_stack_size(n);
     int32_t diff = n - old_size;
     Janet *newData = janet_realloc(fiber->data, sizeof(Janet) * n);
     if (NULL == newData) {
@@ -126,13 +202,13 @@ void janet_fiber_setcapacity(JanetFiber *fiber, int32_t n) {
 
 /* Grow fiber if needed */
 static void janet_fiber_grow(JanetFiber *fiber, int32_t needed) {
-    int32_t cap = needed > (INT32_MAX / 2) ? INT32_MAX : 2 * needed;
-    janet_fiber_setcapacity(fiber, cap);
+    janet_fiber_setcapacity(fiber, needed > INT32_MAX / 2 ? INT32_MAX : 2 * needed);
 }
 
 /* Push a value on the next stack frame */
 void janet_fiber_push(JanetFiber *fiber, Janet x) {
     if (fiber->stacktop == INT32_MAX) janet_panic("stack overflow");
+    janet_gc_barrier(fiber);
     if (fiber->stacktop >= fiber->capacity) {
         janet_fiber_grow(fiber, fiber->stacktop);
     }
@@ -142,6 +218,7 @@ void janet_fiber_push(JanetFiber *fiber, Janet x) {
 /* Push 2 values on the next stack frame */
 void janet_fiber_push2(JanetFiber *fiber, Janet x, Janet y) {
     if (fiber->stacktop >= INT32_MAX - 1) janet_panic("stack overflow");
+    janet_gc_barrier(fiber);
     int32_t newtop = fiber->stacktop + 2;
     if (newtop > fiber->capacity) {
         janet_fiber_grow(fiber, newtop);
@@ -154,6 +231,7 @@ void janet_fiber_push2(JanetFiber *fiber, Janet x, Janet y) {
 /* Push 3 values on the next stack frame */
 void janet_fiber_push3(JanetFiber *fiber, Janet x, Janet y, Janet z) {
     if (fiber->stacktop >= INT32_MAX - 2) janet_panic("stack overflow");
+    janet_gc_barrier(fiber);
     int32_t newtop = fiber->stacktop + 3;
     if (newtop > fiber->capacity) {
         janet_fiber_grow(fiber, newtop);
@@ -167,6 +245,7 @@ void janet_fiber_push3(JanetFiber *fiber, Janet x, Janet y, Janet z) {
 /* Push an array on the next stack frame */
 void janet_fiber_pushn(JanetFiber *fiber, const Janet *arr, int32_t n) {
     if (fiber->stacktop > INT32_MAX - n) janet_panic("stack overflow");
+    janet_gc_barrier(fiber);
     int32_t newtop = fiber->stacktop + n;
     if (newtop > fiber->capacity) {
         janet_fiber_grow(fiber, newtop);
@@ -187,6 +266,8 @@ static Janet make_struct_n(const Janet *args, int32_t n) {
 
 /* Push a stack frame to a fiber */
 int janet_fiber_funcframe(JanetFiber *fiber, JanetFunction *func) {
+    if (func->def->flags & JANET_FUNCDEF_FLAG_LAZY)
+        janet_def_materialize(func->def);
     JanetStackFrame *newframe;
 
     int32_t i;
@@ -199,9 +280,10 @@ int janet_fiber_funcframe(JanetFiber *fiber, JanetFunction *func) {
     /* Check strict arity before messing with state */
     if (next_arity < func->def->min_arity) return 1;
     if (next_arity > func->def->max_arity) return 1;
+    janet_gc_barrier(fiber);
 
     if (fiber->capacity < nextstacktop) {
-        janet_fiber_setcapacity(fiber, 2 * nextstacktop);
+        janet_fiber_grow(fiber, nextstacktop);
 #ifdef JANET_DEBUG
     } else {
         janet_fiber_refresh_memory(fiber);
@@ -261,6 +343,7 @@ static void janet_env_detach(JanetFuncEnv *env) {
         }
         Janet *values = env->as.fiber->data + env->offset;
         safe_memcpy(vmem, values, s);
+        janet_gc_barrier(env);
         uint32_t *bitset = janet_stack_frame(values)->func->def->closure_bitset;
         if (bitset) {
             /* Clear unneeded references in closure environment */
@@ -326,6 +409,8 @@ void janet_env_maybe_detach(JanetFuncEnv *env) {
 
 /* Create a tail frame for a function */
 int janet_fiber_funcframe_tail(JanetFiber *fiber, JanetFunction *func) {
+    if (func->def->flags & JANET_FUNCDEF_FLAG_LAZY)
+        janet_def_materialize(func->def);
     int32_t i;
     int32_t nextframetop = fiber->frame + func->def->slotcount;
     int32_t nextstacktop = nextframetop + JANET_FRAME_SIZE;
@@ -335,9 +420,10 @@ int janet_fiber_funcframe_tail(JanetFiber *fiber, JanetFunction *func) {
     /* Check strict arity before messing with state */
     if (next_arity < func->def->min_arity) return 1;
     if (next_arity > func->def->max_arity) return 1;
+    janet_gc_barrier(fiber);
 
     if (fiber->capacity < nextstacktop) {
-        janet_fiber_setcapacity(fiber, 2 * nextstacktop);
+        janet_fiber_grow(fiber, nextstacktop);
 #ifdef JANET_DEBUG
     } else {
         janet_fiber_refresh_memory(fiber);
@@ -357,7 +443,7 @@ int janet_fiber_funcframe_tail(JanetFiber *fiber, JanetFunction *func) {
         int32_t tuplehead = fiber->stackstart + func->def->arity;
         int st = func->def->flags & JANET_FUNCDEF_FLAG_STRUCTARG;
         if (tuplehead >= fiber->stacktop) {
-            if (tuplehead >= fiber->capacity) janet_fiber_setcapacity(fiber, 2 * (tuplehead + 1));
+            if (tuplehead >= fiber->capacity) janet_fiber_grow(fiber, tuplehead + 1);
             for (i = fiber->stacktop; i < tuplehead; ++i) fiber->data[i] = janet_wrap_nil();
             fiber->data[tuplehead] = st
                                      ? make_struct_n(NULL, 0)
@@ -403,7 +489,7 @@ void janet_fiber_cframe(JanetFiber *fiber, JanetCFunction cfun) {
     int32_t nextstacktop = fiber->stacktop + JANET_FRAME_SIZE;
 
     if (fiber->capacity < nextstacktop) {
-        janet_fiber_setcapacity(fiber, 2 * nextstacktop);
+        janet_fiber_grow(fiber, nextstacktop);
 #ifdef JANET_DEBUG
     } else {
         janet_fiber_refresh_memory(fiber);
@@ -449,6 +535,43 @@ JanetFiber *janet_root_fiber(void) {
     return janet_vm_root_fiber;
 }
 
+/* Fiber-local storage. Keys are registered once per thread and get a fixed
+ * slot in every fiber, so reads and writes don't go through the env table. */
+
+JANET_THREAD_LOCAL JanetTable *janet_vm_fiber_locals = NULL;
+
+int32_t janet_fiber_local_key(Janet key) {
+    if (NULL == janet_vm_fiber_locals) {
+        janet_vm_fiber_locals = janet_table(JANET_FIBER_LOCALS);
+        janet_gcroot(janet_wrap_table(janet_vm_fiber_locals));
+    }
+    Janet index = janet_table_get(janet_vm_fiber_locals, key);
+    if (janet_checktype(index, JANET_NUMBER)) {
+        return (int32_t) janet_unwrap_number(index);
+    }
+    int32_t next = janet_vm_fiber_locals->count;
+    if (next >= JANET_FIBER_LOCALS) {
+        janet_panicf("too many fiber-local keys, at most %d can be registered", JANET_FIBER_LOCALS);
+    }
+    janet_table_put(janet_vm_fiber_locals, key, janet_wrap_integer(next));
+    return next;
+}
+
+Janet janet_fiber_local(JanetFiber *fiber, int32_t index) {
+    if (index < 0 || index >= JANET_FIBER_LOCALS) {
+        janet_panicf("fiber-local index %d out of range", index);
+    }
+    return fiber->locals[index];
+}
+
+void janet_fiber_setlocal(JanetFiber *fiber, int32_t index, Janet value) {
+    if (index < 0 || index >= JANET_FIBER_LOCALS) {
+        janet_panicf("fiber-local index %d out of range", index);
+    }
+    janet_gc_barrier(fiber);
+    fiber->locals[index] = value;
+}
+
 /* CFuns */
 
 static Janet cfun_fiber_getenv(int32_t argc, Janet *argv) {
@@ -462,6 +585,7 @@ static Janet cfun_fiber_getenv(int32_t argc, Janet *argv) {
 static Janet cfun_fiber_setenv(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 2);
     JanetFiber *fiber = janet_getfiber(argv, 0);
+    janet_gc_barrier(fiber);
     if (janet_checktype(argv[1], JANET_NIL)) {
         fiber->env = NULL;
     } else {
@@ -477,7 +601,7 @@ static Janet cfun_fiber_new(int32_t argc, Janet *argv) {
     if (func->def->min_arity > 1) {
         janet_panicf("fiber function must accept 0 or 1 arguments");
     }
-    fiber = janet_fiber(func, 64, func->def->min_arity, NULL);
+    fiber = janet_fiber(func, JANET_STACK_INITIAL, func->def->min_arity, NULL);
     if (argc == 2) {
         int32_t i;
         JanetByteView view = janet_getbytes(argv, 1);
@@ -595,6 +719,26 @@ static Janet cfun_fiber_last_value(int32_t argc, Janet *argv) {
     return fiber->last_value;
 }
 
+static Janet cfun_fiber_local_key(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    return janet_wrap_integer(janet_fiber_local_key(argv[0]));
+}
+
+static Janet cfun_fiber_local(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    int32_t index = janet_getinteger(argv, 0);
+    JanetFiber *fiber = argc > 1 ? janet_getfiber(argv, 1) : janet_vm_fiber;
+    return janet_fiber_local(fiber, index);
+}
+
+static Janet cfun_fiber_setlocal(int32_t argc, Janet *argv) {
+    janet_arity(argc, 2, 3);
+    int32_t index = janet_getinteger(argv, 0);
+    JanetFiber *fiber = argc > 2 ? janet_getfiber(argv, 2) : janet_vm_fiber;
+    janet_fiber_setlocal(fiber, index, argv[1]);
+    return argv[1];
+}
+
 static const JanetReg fiber_cfuns[] = {
     {
         "fiber/new", cfun_fiber_new,
@@ -680,6 +824,26 @@ static const JanetReg fiber_cfuns[] = {
         JDOC("(fiber/last-value\n\n"
              "Get the last value returned or signaled from the fiber.")
     },
+    {
+        "fiber/local-key", cfun_fiber_local_key,
+        JDOC("(fiber/local-key key)\n\n"
+             "Register key as a fiber-local and return its slot index. Registering the same "
+             "key again returns the same index. Each fiber stores its fiber-locals inline, so "
+             "fiber/local and fiber/set-local take constant time, unlike dyn and setdyn. A new fiber "
+             "scheduled with ev/go inherits the current fiber's values for any slots it has not set. "
+             "At most JANET_FIBER_LOCALS keys can be registered per thread.")
+    },
+    {
+        "fiber/local", cfun_fiber_local,
+        JDOC("(fiber/local index &opt fiber)\n\n"
+             "Get the value of a fiber-local slot, as returned by fiber/local-key, in the current "
+             "fiber or in fiber. Unset slots are nil.")
+    },
+    {
+        "fiber/set-local", cfun_fiber_setlocal,
+        JDOC("(fiber/set-local index value &opt fiber)\n\n"
+             "Set the value of a fiber-local slot in the current fiber or in fiber. Returns value.")
+    },
     {NULL, NULL, NULL}
 };
 
@@ -66,6 +66,15 @@ extern JANET_THREAD_LOCAL JanetFiber *janet_vm_fiber;
 
 #define janet_stack_frame(s) ((JanetStackFrame *)((s) - JANET_FRAME_SIZE))
 #define janet_fiber_frame(f) janet_stack_frame((f)->data + (f)->frame)
+/* Pool of free fiber stacks, in power of two sizes from JANET_STACK_POOL_MIN
+ * slots, keeping at most JANET_STACK_POOL_BYTES of free stacks per size. */
+#define JANET_STACK_POOL_MIN 16
+#define JANET_STACK_POOL_CLASSES 10
+#define JANET_STACK_POOL_BYTES (512 * 1024)
+
+void janet_stack_free(Janet *data, int32_t capacity);
+void janet_stack_pool_init(void);
+void janet_stack_pool_deinit(void);
 void janet_fiber_setcapacity(JanetFiber *fiber, int32_t n);
 void janet_fiber_push(JanetFiber *fiber, Janet x);
 void janet_fiber_push2(JanetFiber *fiber, Janet x, Janet y);
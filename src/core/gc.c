@@ -43,6 +43,61 @@ JANET_THREAD_LOCAL size_t janet_vm_next_collection;
 JANET_THREAD_LOCAL size_t janet_vm_block_count;
 JANET_THREAD_LOCAL int janet_vm_gc_suspend = 0;
 
+/* Generations. New blocks go on janet_vm_blocks, and blocks that survive a
+ * collection are moved to janet_vm_old_blocks. */
+JANET_THREAD_LOCAL void *janet_vm_old_blocks;
+JANET_THREAD_LOCAL size_t janet_vm_old_block_count;
+JANET_THREAD_LOCAL size_t janet_vm_gc_old_limit;
+JANET_THREAD_LOCAL size_t janet_vm_gc_minor_count;
+JANET_THREAD_LOCAL size_t janet_vm_gc_major_count;
+
+/* Old blocks that may reference young blocks */
+JANET_THREAD_LOCAL JanetGCObject **janet_vm_gc_remembered;
+JANET_THREAD_LOCAL size_t janet_vm_gc_remembered_count;
+JANET_THREAD_LOCAL size_t janet_vm_gc_remembered_capacity;
+
+/* Old abstract types with a gcmark function, which we can't track writes to */
+JANET_THREAD_LOCAL JanetGCObject **janet_vm_gc_watched;
+JANET_THREAD_LOCAL size_t janet_vm_gc_watched_count;
+JANET_THREAD_LOCAL size_t janet_vm_gc_watched_capacity;
+
+#ifndef JANET_NO_SLAB_ALLOCATOR
+/* Small blocks are carved out of large chunks, one free list per size class */
+JANET_THREAD_LOCAL void *janet_vm_slab_chunks;
+JANET_THREAD_LOCAL void *janet_vm_slab_free[JANET_SLAB_CLASS_COUNT];
+#endif
+
+/* Statistics */
+JANET_THREAD_LOCAL size_t janet_vm_gc_type_counts[JANET_MEMORY_TYPE_COUNT];
+JANET_THREAD_LOCAL size_t janet_vm_gc_freed;
+JANET_THREAD_LOCAL double janet_vm_gc_pause_total;
+JANET_THREAD_LOCAL double janet_vm_gc_pause_max;
+JANET_THREAD_LOCAL double janet_vm_gc_pause_last;
+
+#ifdef JANET_EV
+/* Function to call in a new fiber after each collection */
+JANET_THREAD_LOCAL JanetFunction *janet_vm_gc_hook;
+JANET_THREAD_LOCAL JanetFiber *janet_vm_gc_hook_fiber;
+#endif
+
+/* Incremental collection. Old blocks that are left to sweep after an incremental mark */
+JANET_THREAD_LOCAL int janet_vm_gc_incremental;
+JANET_THREAD_LOCAL uint32_t janet_vm_gc_step_budget;
+JANET_THREAD_LOCAL size_t janet_vm_gc_next_step;
+JANET_THREAD_LOCAL void *janet_vm_gc_sweep_blocks;
+
+/* Allocation sites of sampled blocks, see debug/heap-sample */
+typedef struct {
+    JanetGCObject *block; /* NULL if slot is empty */
+    JanetFuncDef *def;
+    int32_t pc;
+} JanetHeapSite;
+JANET_THREAD_LOCAL uint32_t janet_vm_heap_sample_rate;
+static JANET_THREAD_LOCAL uint32_t janet_vm_heap_sample_countdown;
+static JANET_THREAD_LOCAL JanetHeapSite *janet_vm_heap_sites;
+static JANET_THREAD_LOCAL uint32_t janet_vm_heap_site_count;
+static JANET_THREAD_LOCAL uint32_t janet_vm_heap_site_capacity;
+
 /* Roots */
 JANET_THREAD_LOCAL Janet *janet_vm_roots;
 JANET_THREAD_LOCAL size_t janet_vm_root_count;
@@ -66,13 +121,102 @@ static void janet_mark_string(const uint8_t *str);
 static void janet_mark_fiber(JanetFiber *fiber);
 static void janet_mark_abstract(void *adata);
 
+/* Don't run a major collection before the old generation has this many blocks */
+#define JANET_GC_MIN_OLD_LIMIT 0x10000
+
 /* Local state that is only temporary for gc */
 static JANET_THREAD_LOCAL uint32_t depth = JANET_RECURSION_GUARD;
 static JANET_THREAD_LOCAL size_t orig_rootcount;
 
+/* Flags of blocks that marking does not need to visit. In a minor collection,
+ * old blocks are skipped as well as blocks that are already marked. */
+static JANET_THREAD_LOCAL int32_t janet_vm_gc_skipmask = JANET_MEM_REACHABLE;
+#define janet_gc_skip(m) (janet_gc_header(m)->flags & janet_vm_gc_skipmask)
+
+/* Phases of an incremental major collection */
+#define JANET_GC_IDLE 0
+#define JANET_GC_MARK 1
+#define JANET_GC_SWEEP 2
+
+/* Work between checks of the clock in an incremental step */
+#define JANET_GC_STEP_CHUNK 256
+
+/* Bytes to allocate between incremental steps */
+#define JANET_GC_STEP_INTERVAL 0x40000
+
+static JANET_THREAD_LOCAL int janet_vm_gc_phase = JANET_GC_IDLE;
+
+/* Blocks allocated in total, and when the last incremental step ran. Each step does at
+ * least JANET_GC_STEP_WORK units of work per block allocated since the last one, so
+ * a cycle finishes even when the mutator allocates faster than the time budget allows. */
+#define JANET_GC_STEP_WORK 2
+static JANET_THREAD_LOCAL size_t janet_vm_gc_alloc_count = 0;
+static JANET_THREAD_LOCAL size_t janet_vm_gc_step_alloc_count = 0;
+
+/* When set, old blocks are shaded gray instead of having their children marked. With
+ * grayonly, young blocks are also skipped. A minor collection during an incremental
+ * mark shades the old blocks it finds, so blocks it promotes are already scanned. */
+static JANET_THREAD_LOCAL int janet_vm_gc_shading = 0;
+static JANET_THREAD_LOCAL int janet_vm_gc_grayonly = 0;
+
+/* Block whose children are being marked, even though it may be marked or old */
+static JANET_THREAD_LOCAL JanetGCObject *janet_vm_gc_scanning = NULL;
+
+/* Old blocks that are marked but whose children are not yet marked */
+static JANET_THREAD_LOCAL JanetGCObject **janet_vm_gc_gray = NULL;
+static JANET_THREAD_LOCAL size_t janet_vm_gc_gray_count = 0;
+static JANET_THREAD_LOCAL size_t janet_vm_gc_gray_capacity = 0;
+
 /* Hint to the GC that we may need to collect */
 void janet_gcpressure(size_t s) {
     janet_vm_next_collection += s;
+#ifdef JANET_INSTRUMENT
+    janet_vm_instrument_bytes += s;
+#endif
+}
+
+/* Write barrier for native code that stores into an existing array, table, fiber or
+ * funcenv without going through the C API. Old blocks that now reference young ones
+ * would otherwise not be scanned by minor collections. */
+void janet_gc_write_barrier(void *mem) {
+    janet_gc_barrier(mem);
+}
+
+static void janet_gc_push(JanetGCObject ***list, size_t *count, size_t *capacity, JanetGCObject *mem);
+
+/* Check if the children of a block should be marked now, and mark the block. During
+ * an incremental step, old blocks are only shaded gray to be scanned later,
+ * and young blocks are left for the final mark. */
+static int janet_gc_visit(void *m) {
+    JanetGCObject *mem = janet_gc_header(m);
+    if (mem == janet_vm_gc_scanning) {
+        janet_vm_gc_scanning = NULL;
+        return 1;
+    }
+    if (janet_vm_gc_shading && (mem->flags & JANET_MEM_OLD)) {
+        if (!(mem->flags & JANET_MEM_REACHABLE)) {
+            janet_gc_mark(mem);
+            janet_gc_push(&janet_vm_gc_gray, &janet_vm_gc_gray_count,
+                          &janet_vm_gc_gray_capacity, mem);
+        }
+        return 0;
+    }
+    if (janet_gc_skip(mem) || janet_vm_gc_grayonly)
+        return 0;
+    janet_gc_mark(mem);
+    return 1;
+}
+
+/* Same as janet_gc_visit, for blocks without children */
+static void janet_gc_visit_leaf(void *m) {
+    JanetGCObject *mem = janet_gc_header(m);
+    if (janet_vm_gc_shading && (mem->flags & JANET_MEM_OLD)) {
+        janet_gc_mark(mem);
+        return;
+    }
+    if (janet_gc_skip(mem) || janet_vm_gc_grayonly)
+        return;
+    janet_gc_mark(mem);
 }
 
 /* Mark a value */
@@ -119,19 +263,20 @@ void janet_mark(Janet x) {
 }
 
 static void janet_mark_string(const uint8_t *str) {
-    janet_gc_mark(janet_string_head(str));
+    janet_gc_visit_leaf(janet_string_head(str));
 }
 
 static void janet_mark_buffer(JanetBuffer *buffer) {
-    janet_gc_mark(buffer);
+    janet_gc_visit_leaf(buffer);
 }
 
 static void janet_mark_abstract(void *adata) {
-    if (janet_gc_reachable(janet_abstract_head(adata)))
-        return;
-    janet_gc_mark(janet_abstract_head(adata));
     if (janet_abstract_head(adata)->type->gcmark) {
+        if (!janet_gc_visit(janet_abstract_head(adata)))
+            return;
         janet_abstract_head(adata)->type->gcmark(adata, janet_abstract_size(adata));
+    } else {
+        janet_gc_visit_leaf(janet_abstract_head(adata));
     }
 }
 
@@ -155,17 +300,15 @@ static void janet_mark_kvs(const JanetKV *kvs, int32_t n) {
 }
 
 static void janet_mark_array(JanetArray *array) {
-    if (janet_gc_reachable(array))
+    if (!janet_gc_visit(array))
         return;
-    janet_gc_mark(array);
     janet_mark_many(array->data, array->count);
 }
 
 static void janet_mark_table(JanetTable *table) {
 recur: /* Manual tail recursion */
-    if (janet_gc_reachable(table))
+    if (!janet_gc_visit(table))
         return;
-    janet_gc_mark(table);
     janet_mark_kvs(table->data, table->capacity);
     if (table->proto) {
         table = table->proto;
@@ -174,24 +317,21 @@ recur: /* Manual tail recursion */
 }
 
 static void janet_mark_struct(const JanetKV *st) {
-    if (janet_gc_reachable(janet_struct_head(st)))
+    if (!janet_gc_visit(janet_struct_head(st)))
         return;
-    janet_gc_mark(janet_struct_head(st));
     janet_mark_kvs(st, janet_struct_capacity(st));
 }
 
 static void janet_mark_tuple(const Janet *tuple) {
-    if (janet_gc_reachable(janet_tuple_head(tuple)))
+    if (!janet_gc_visit(janet_tuple_head(tuple)))
         return;
-    janet_gc_mark(janet_tuple_head(tuple));
     janet_mark_many(tuple, janet_tuple_length(tuple));
 }
 
 /* Helper to mark function environments */
 static void janet_mark_funcenv(JanetFuncEnv *env) {
-    if (janet_gc_reachable(env))
+    if (!janet_gc_visit(env))
         return;
-    janet_gc_mark(env);
     /* If closure env references a dead fiber, we can just copy out the stack frame we need so
      * we don't need to keep around the whole dead fiber. */
     janet_env_maybe_detach(env);
@@ -207,9 +347,8 @@ static void janet_mark_funcenv(JanetFuncEnv *env) {
 /* GC helper to mark a FuncDef */
 static void janet_mark_funcdef(JanetFuncDef *def) {
     int32_t i;
-    if (janet_gc_reachable(def))
+    if (!janet_gc_visit(def))
         return;
-    janet_gc_mark(def);
     janet_mark_many(def->constants, def->constants_length);
     for (i = 0; i < def->defs_length; ++i) {
         janet_mark_funcdef(def->defs[i]);
@@ -218,14 +357,15 @@ static void janet_mark_funcdef(JanetFuncDef *def) {
         janet_mark_string(def->source);
     if (def->name)
         janet_mark_string(def->name);
+    if (def->flags & JANET_FUNCDEF_FLAG_LAZY)
+        janet_def_lazy_mark(def);
 }
 
 static void janet_mark_function(JanetFunction *func) {
     int32_t i;
     int32_t numenvs;
-    if (janet_gc_reachable(func))
+    if (!janet_gc_visit(func))
         return;
-    janet_gc_mark(func);
     if (NULL != func->def) {
         /* this should always be true, except if function is only partially constructed */
         numenvs = func->def->environments_length;
@@ -240,11 +380,11 @@ static void janet_mark_fiber(JanetFiber *fiber) {
     int32_t i, j;
     JanetStackFrame *frame;
 recur:
-    if (janet_gc_reachable(fiber))
+    if (!janet_gc_visit(fiber))
         return;
-    janet_gc_mark(fiber);
 
     janet_mark(fiber->last_value);
+    janet_mark_many(fiber->locals, JANET_FIBER_LOCALS);
 
     /* Mark values on the argument stack */
     janet_mark_many(fiber->data + fiber->stackstart,
@@ -287,16 +427,20 @@ static void janet_deinit_block(JanetGCObject *mem) {
         case JANET_MEMORY_FUNCTION:
             break; /* Do nothing for non gc types */
         case JANET_MEMORY_SYMBOL:
+            /* Inline caches compare symbols and keywords by address */
+            janet_vm_table_epoch++;
             janet_symbol_deinit(((JanetStringHead *) mem)->data);
             break;
         case JANET_MEMORY_ARRAY:
             janet_free(((JanetArray *) mem)->data);
             break;
         case JANET_MEMORY_TABLE:
+            /* The address may be reused by a new table */
+            janet_table_touch((JanetTable *) mem);
             janet_free(((JanetTable *) mem)->data);
             break;
         case JANET_MEMORY_FIBER:
-            janet_free(((JanetFiber *)mem)->data);
+            janet_stack_free(((JanetFiber *)mem)->data, ((JanetFiber *)mem)->capacity);
             break;
         case JANET_MEMORY_BUFFER:
             janet_buffer_deinit((JanetBuffer *) mem);
@@ -320,64 +464,437 @@ static void janet_deinit_block(JanetGCObject *mem) {
             janet_free(def->defs);
             janet_free(def->environments);
             janet_free(def->constants);
-            janet_free(def->bytecode);
+            if (!(def->flags & JANET_FUNCDEF_FLAG_MAPPED))
+                janet_free(def->bytecode);
             janet_free(def->sourcemap);
             janet_free(def->closure_bitset);
+            if (def->flags & JANET_FUNCDEF_FLAG_LAZY)
+                janet_free(def->lazy);
+#ifdef JANET_JIT
+            janet_jit_free(def);
+#endif
         }
         break;
     }
 }
 
-/* Iterate over all allocated memory, and free memory that is not
- * marked as reachable. Flip the gc color flag for next sweep. */
-void janet_sweep() {
+static void janet_gc_push(JanetGCObject ***list, size_t *count, size_t *capacity, JanetGCObject *mem) {
+    if (*count == *capacity) {
+        size_t newcap = *capacity ? 2 * *capacity : 64;
+        JanetGCObject **newlist = janet_realloc(*list, newcap * sizeof(JanetGCObject *));
+        if (NULL == newlist) {
+            JANET_OUT_OF_MEMORY;
+        }
+        *list = newlist;
+        *capacity = newcap;
+    }
+    (*list)[(*count)++] = mem;
+}
+
+/* Called by the write barrier the first time an old block is mutated after a collection */
+void janet_gc_remember(JanetGCObject *mem) {
+    mem->flags |= JANET_MEM_REMEMBERED;
+    janet_gc_push(&janet_vm_gc_remembered, &janet_vm_gc_remembered_count,
+                  &janet_vm_gc_remembered_capacity, mem);
+}
+
+/* Everything that survives a collection will be old, so only running fibers need
+ * to stay remembered - their stacks are written to without a write barrier. Called
+ * after marking and before sweeping. While an incremental mark is running, marked
+ * blocks that are forgotten are shaded gray again, as they may have been written
+ * to after they were scanned. */
+static void janet_gc_prune_remembered(int major) {
+    size_t kept = 0;
+    for (size_t i = 0; i < janet_vm_gc_remembered_count; i++) {
+        JanetGCObject *mem = janet_vm_gc_remembered[i];
+        if ((mem->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_FIBER &&
+                janet_fiber_status((JanetFiber *) mem) == JANET_STATUS_ALIVE &&
+                (!major || (mem->flags & JANET_MEM_REACHABLE))) {
+            janet_vm_gc_remembered[kept++] = mem;
+        } else {
+            mem->flags &= ~JANET_MEM_REMEMBERED;
+            if (!major && janet_vm_gc_phase == JANET_GC_MARK && (mem->flags & JANET_MEM_REACHABLE)) {
+                janet_gc_push(&janet_vm_gc_gray, &janet_vm_gc_gray_count,
+                              &janet_vm_gc_gray_capacity, mem);
+            }
+        }
+    }
+    janet_vm_gc_remembered_count = kept;
+}
+
+static int janet_gc_is_watched(JanetGCObject *mem) {
+    return (mem->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_ABSTRACT &&
+           NULL != ((JanetAbstractHead *) mem)->type->gcmark;
+}
+
+#ifndef JANET_NO_SLAB_ALLOCATOR
+
+/* Slab chunks are linked together so they can be freed on deinit */
+typedef struct JanetSlabChunk JanetSlabChunk;
+struct JanetSlabChunk {
+    JanetSlabChunk *next;
+    long long mem[]; /* for proper alignment */
+};
+
+#define JANET_SLAB_MAX 512
+#define JANET_SLAB_CHUNK_SIZE 0x10000
+#define janet_slab_class(m) (((m)->flags & JANET_MEM_SLABBITS) >> 12)
+
+/* Size of each class in bytes. Class 0 is for blocks from janet_malloc. */
+static const uint16_t janet_slab_sizes[JANET_SLAB_CLASS_COUNT] = {
+    0, 16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 512
+};
+
+/* Map (size + 15) / 16 to the smallest class that fits */
+static const uint8_t janet_slab_lookup[JANET_SLAB_MAX / 16 + 1] = {
+    1, 1, 2, 3, 4, 5, 6, 7, 8, 9, 9, 10, 10, 11, 11, 12, 12,
+    13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15, 15, 15, 15, 15
+};
+
+/* Get a new chunk and split it into blocks on the free list for a class */
+static void janet_slab_refill(int cls) {
+    size_t bsize = janet_slab_sizes[cls];
+    size_t count = (JANET_SLAB_CHUNK_SIZE - sizeof(JanetSlabChunk)) / bsize;
+    JanetSlabChunk *chunk = janet_malloc(JANET_SLAB_CHUNK_SIZE);
+    if (NULL == chunk) {
+        JANET_OUT_OF_MEMORY;
+    }
+    chunk->next = janet_vm_slab_chunks;
+    janet_vm_slab_chunks = chunk;
+    /* Push in reverse so blocks are handed out in address order */
+    char *base = (char *) chunk->mem;
+    JanetGCObject *head = janet_vm_slab_free[cls];
+    for (size_t i = count; i > 0; i--) {
+        JanetGCObject *block = (JanetGCObject *)(base + (i - 1) * bsize);
+        block->next = head;
+        head = block;
+    }
+    janet_vm_slab_free[cls] = head;
+}
+
+static void *janet_slab_alloc(size_t size, int32_t *flags) {
+    if (size > JANET_SLAB_MAX) {
+        *flags = 0;
+        return janet_malloc(size);
+    }
+    int cls = janet_slab_lookup[(size + 15) >> 4];
+    if (NULL == janet_vm_slab_free[cls]) janet_slab_refill(cls);
+    JanetGCObject *block = janet_vm_slab_free[cls];
+    janet_vm_slab_free[cls] = block->next;
+    *flags = cls << 12;
+    return block;
+}
+
+static void janet_slab_free(JanetGCObject *mem) {
+    int cls = janet_slab_class(mem);
+    if (cls) {
+        mem->next = janet_vm_slab_free[cls];
+        janet_vm_slab_free[cls] = mem;
+    } else {
+        janet_free(mem);
+    }
+}
+
+static void janet_slab_clear(void) {
+    JanetSlabChunk *chunk = janet_vm_slab_chunks;
+    while (NULL != chunk) {
+        JanetSlabChunk *next = chunk->next;
+        janet_free(chunk);
+        chunk = next;
+    }
+    janet_vm_slab_chunks = NULL;
+    for (int i = 0; i < JANET_SLAB_CLASS_COUNT; i++) {
+        janet_vm_slab_free[i] = NULL;
+    }
+}
+
+#else
+
+#define janet_slab_free(m) janet_free(m)
+
+#endif
+
+/* The sampled blocks are kept in an open addressing table with linear probing,
+ * so that they can be found and removed when they are freed. */
+static uint32_t janet_heap_site_slot(JanetGCObject *mem) {
+    uint32_t mask = janet_vm_heap_site_capacity - 1;
+    uint32_t i = (uint32_t)(((uintptr_t) mem >> 4) * 2654435761u) & mask;
+    while (janet_vm_heap_sites[i].block && janet_vm_heap_sites[i].block != mem) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void janet_heap_site_put(JanetGCObject *mem, JanetFuncDef *def, int32_t pc) {
+    if (2 * (janet_vm_heap_site_count + 1) > janet_vm_heap_site_capacity) {
+        JanetHeapSite *old = janet_vm_heap_sites;
+        uint32_t oldcap = janet_vm_heap_site_capacity;
+        uint32_t newcap = oldcap ? 2 * oldcap : 256;
+        janet_vm_heap_sites = janet_calloc(newcap, sizeof(JanetHeapSite));
+        if (NULL == janet_vm_heap_sites) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm_heap_site_capacity = newcap;
+        for (uint32_t i = 0; i < oldcap; i++) {
+            if (old[i].block) janet_vm_heap_sites[janet_heap_site_slot(old[i].block)] = old[i];
+        }
+        janet_free(old);
+    }
+    JanetHeapSite *site = janet_vm_heap_sites + janet_heap_site_slot(mem);
+    site->block = mem;
+    site->def = def;
+    site->pc = pc;
+    janet_vm_heap_site_count++;
+}
+
+static void janet_heap_site_remove(JanetGCObject *mem) {
+    uint32_t mask = janet_vm_heap_site_capacity - 1;
+    uint32_t i = janet_heap_site_slot(mem);
+    if (NULL == janet_vm_heap_sites[i].block) return;
+    janet_vm_heap_site_count--;
+    /* Shift later entries of the probe sequence back into the hole */
+    uint32_t j = i;
+    for (;;) {
+        janet_vm_heap_sites[i].block = NULL;
+        uint32_t home;
+        do {
+            j = (j + 1) & mask;
+            if (NULL == janet_vm_heap_sites[j].block) return;
+            home = (uint32_t)(((uintptr_t) janet_vm_heap_sites[j].block >> 4) * 2654435761u) & mask;
+        } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+        janet_vm_heap_sites[i] = janet_vm_heap_sites[j];
+        i = j;
+    }
+}
+
+/* Record the innermost Janet function of the running fiber as the site of mem */
+static void janet_heap_sample(JanetGCObject *mem) {
+    JanetFiber *fiber = janet_vm_fiber;
+    if (NULL == fiber) return;
+    int32_t i = fiber->frame;
+    while (i > 0) {
+        JanetStackFrame *frame = (JanetStackFrame *)(fiber->data + i - JANET_FRAME_SIZE);
+        if (frame->func && frame->pc) {
+            JanetFuncDef *def = frame->func->def;
+            janet_heap_site_put(mem, def, (int32_t)(frame->pc - def->bytecode));
+            return;
+        }
+        i = frame->prevframe;
+    }
+}
+
+static void janet_heap_sites_mark(void) {
+    for (uint32_t i = 0; i < janet_vm_heap_site_capacity; i++) {
+        if (janet_vm_heap_sites[i].block) janet_mark_funcdef(janet_vm_heap_sites[i].def);
+    }
+}
+
+void janet_gc_heap_sample(uint32_t rate) {
+    if (0 == rate) {
+        janet_free(janet_vm_heap_sites);
+        janet_vm_heap_sites = NULL;
+        janet_vm_heap_site_count = 0;
+        janet_vm_heap_site_capacity = 0;
+    }
+    janet_vm_heap_sample_rate = rate;
+    janet_vm_heap_sample_countdown = rate;
+}
+
+static void janet_free_block(JanetGCObject *mem) {
+    if (janet_vm_heap_site_count) janet_heap_site_remove(mem);
+    janet_vm_block_count--;
+    janet_vm_gc_type_counts[mem->flags & JANET_MEM_TYPEBITS]--;
+    janet_vm_gc_freed++;
+    janet_deinit_block(mem);
+    janet_slab_free(mem);
+}
+
+/* Free unreachable old blocks. */
+static void janet_sweep_old(void) {
     JanetGCObject *previous = NULL;
-    JanetGCObject *current = janet_vm_blocks;
+    JanetGCObject *current = janet_vm_old_blocks;
     JanetGCObject *next;
+    janet_vm_gc_watched_count = 0;
     while (NULL != current) {
         next = current->next;
         if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
             previous = current;
             current->flags &= ~JANET_MEM_REACHABLE;
+            if (janet_gc_is_watched(current)) {
+                janet_gc_push(&janet_vm_gc_watched, &janet_vm_gc_watched_count,
+                              &janet_vm_gc_watched_capacity, current);
+            }
         } else {
-            janet_vm_block_count--;
-            janet_deinit_block(current);
+            janet_vm_old_block_count--;
             if (NULL != previous) {
                 previous->next = next;
             } else {
-                janet_vm_blocks = next;
+                janet_vm_old_blocks = next;
             }
-            janet_free(current);
+            janet_free_block(current);
         }
         current = next;
     }
 }
 
+/* Free unreachable young blocks, and move the rest to the old generation. */
+static void janet_sweep_young(void) {
+    JanetGCObject *previous = NULL;
+    JanetGCObject *current = janet_vm_blocks;
+    JanetGCObject *next;
+    while (NULL != current) {
+        next = current->next;
+        if (current->flags & JANET_MEM_DISABLED) {
+            /* Not initialized, so keep it young */
+            previous = current;
+            current->flags &= ~JANET_MEM_REACHABLE;
+            current = next;
+            continue;
+        }
+        if (NULL != previous) {
+            previous->next = next;
+        } else {
+            janet_vm_blocks = next;
+        }
+        if (current->flags & JANET_MEM_REACHABLE) {
+            /* Blocks promoted during an incremental mark stay marked */
+            if (janet_vm_gc_phase != JANET_GC_MARK)
+                current->flags &= ~JANET_MEM_REACHABLE;
+            current->flags |= JANET_MEM_OLD;
+            current->next = janet_vm_old_blocks;
+            janet_vm_old_blocks = current;
+            janet_vm_old_block_count++;
+            if (janet_gc_is_watched(current)) {
+                janet_gc_push(&janet_vm_gc_watched, &janet_vm_gc_watched_count,
+                              &janet_vm_gc_watched_capacity, current);
+            }
+        } else {
+            janet_free_block(current);
+        }
+        current = next;
+    }
+}
+
+/* Iterate over all allocated memory, and free memory that is not
+ * marked as reachable. */
+void janet_sweep() {
+    janet_gc_prune_remembered(1);
+    janet_sweep_old();
+    janet_sweep_young();
+}
+
 /* Allocate some memory that is tracked for garbage collection */
 void *janet_gcalloc(enum JanetMemoryType type, size_t size) {
     JanetGCObject *mem;
 
     /* Make sure everything is inited */
     janet_assert(NULL != janet_vm_cache, "please initialize janet before use");
+#ifdef JANET_NO_SLAB_ALLOCATOR
     mem = janet_malloc(size);
+    int32_t slabflags = 0;
+#else
+    int32_t slabflags;
+    mem = janet_slab_alloc(size, &slabflags);
+#endif
 
     /* Check for bad malloc */
     if (NULL == mem) {
         JANET_OUT_OF_MEMORY;
     }
 
-    /* Configure block */
-    mem->flags = type;
+    /* Configure block. New blocks are always young. */
+    mem->flags = type | slabflags;
 
     /* Prepend block to heap list */
+    janet_vm_gc_type_counts[type]++;
     janet_vm_next_collection += size;
+#ifdef JANET_INSTRUMENT
+    janet_vm_instrument_bytes += size;
+#endif
     mem->next = janet_vm_blocks;
     janet_vm_blocks = mem;
     janet_vm_block_count++;
+    janet_vm_gc_alloc_count++;
+    if (janet_vm_heap_sample_rate && 0 == --janet_vm_heap_sample_countdown) {
+        janet_vm_heap_sample_countdown = janet_vm_heap_sample_rate;
+        janet_heap_sample(mem);
+    }
 
     return (void *)mem;
 }
 
+/* Estimate the bytes used by a block, including memory that it owns */
+static size_t janet_block_size(JanetGCObject *mem) {
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            return sizeof(JanetGCObject);
+        case JANET_MEMORY_STRING:
+        case JANET_MEMORY_SYMBOL:
+            return sizeof(JanetStringHead) + (size_t)((JanetStringHead *) mem)->length + 1;
+        case JANET_MEMORY_ARRAY:
+            return sizeof(JanetArray) + (size_t)((JanetArray *) mem)->capacity * sizeof(Janet);
+        case JANET_MEMORY_TUPLE:
+            return sizeof(JanetTupleHead) + (size_t)((JanetTupleHead *) mem)->length * sizeof(Janet);
+        case JANET_MEMORY_TABLE:
+            return sizeof(JanetTable) + (size_t)((JanetTable *) mem)->capacity * sizeof(JanetKV);
+        case JANET_MEMORY_STRUCT:
+            return sizeof(JanetStructHead) + (size_t)((JanetStructHead *) mem)->capacity * sizeof(JanetKV);
+        case JANET_MEMORY_FIBER:
+            return sizeof(JanetFiber) + (size_t)((JanetFiber *) mem)->capacity * sizeof(Janet);
+        case JANET_MEMORY_BUFFER:
+            return sizeof(JanetBuffer) + (size_t)((JanetBuffer *) mem)->capacity;
+        case JANET_MEMORY_FUNCTION: {
+            int32_t elen = ((JanetFunction *) mem)->def->environments_length;
+            return sizeof(JanetFunction) + (size_t) elen * sizeof(JanetFuncEnv *);
+        }
+        case JANET_MEMORY_NONE:
+        case JANET_MEMORY_ABSTRACT:
+            return sizeof(JanetAbstractHead) + ((JanetAbstractHead *) mem)->size;
+        case JANET_MEMORY_FUNCENV: {
+            JanetFuncEnv *env = (JanetFuncEnv *) mem;
+            size_t size = sizeof(JanetFuncEnv);
+            if (0 == env->offset) size += (size_t) env->length * sizeof(Janet);
+            return size;
+        }
+        case JANET_MEMORY_FUNCDEF: {
+            JanetFuncDef *def = (JanetFuncDef *) mem;
+            size_t size = sizeof(JanetFuncDef);
+            size += (size_t) def->constants_length * sizeof(Janet);
+            size += (size_t) def->defs_length * sizeof(JanetFuncDef *);
+            size += (size_t) def->environments_length * sizeof(int32_t);
+            if (!(def->flags & JANET_FUNCDEF_FLAG_MAPPED))
+                size += (size_t) def->bytecode_length * sizeof(uint32_t);
+            if (def->sourcemap)
+                size += (size_t) def->bytecode_length * sizeof(JanetSourceMapping);
+            if (def->closure_bitset)
+                size += (size_t)((def->slotcount + 31) >> 5) * sizeof(uint32_t);
+            return size;
+        }
+    }
+}
+
+static void janet_heap_walk_list(JanetGCObject *current, JanetHeapVisitor visit, void *data) {
+    for (; NULL != current; current = current->next) {
+        JanetFuncDef *def = NULL;
+        int32_t pc = 0;
+        if (janet_vm_heap_site_count) {
+            JanetHeapSite *site = janet_vm_heap_sites + janet_heap_site_slot(current);
+            if (site->block) {
+                def = site->def;
+                pc = site->pc;
+            }
+        }
+        visit(current, janet_block_size(current), def, pc, data);
+    }
+}
+
+/* Visit every allocated block with its size and sampled allocation site */
+void janet_gc_heap_walk(JanetHeapVisitor visit, void *data) {
+    janet_heap_walk_list(janet_vm_blocks, visit, data);
+    janet_heap_walk_list(janet_vm_old_blocks, visit, data);
+    janet_heap_walk_list(janet_vm_gc_sweep_blocks, visit, data);
+}
+
 static void free_one_scratch(JanetScratch *s) {
     if (NULL != s->finalize) {
         s->finalize((char *) s->mem);
@@ -398,33 +915,327 @@ static JanetScratch *janet_mem2scratch(void *mem) {
     return s - 1;
 }
 
-/* Run garbage collection */
-void janet_collect(void) {
-    uint32_t i;
+/* Mark the children of a block, without changing the flags of the block itself */
+static void janet_scan_block(JanetGCObject *mem) {
+    janet_vm_gc_scanning = mem;
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            break;
+        case JANET_MEMORY_ARRAY:
+            janet_mark_array((JanetArray *) mem);
+            break;
+        case JANET_MEMORY_TUPLE:
+            janet_mark_tuple(((JanetTupleHead *) mem)->data);
+            break;
+        case JANET_MEMORY_TABLE:
+            janet_mark_table((JanetTable *) mem);
+            break;
+        case JANET_MEMORY_STRUCT:
+            janet_mark_struct(((JanetStructHead *) mem)->data);
+            break;
+        case JANET_MEMORY_FIBER:
+            janet_mark_fiber((JanetFiber *) mem);
+            break;
+        case JANET_MEMORY_FUNCTION:
+            janet_mark_function((JanetFunction *) mem);
+            break;
+        case JANET_MEMORY_FUNCENV:
+            janet_mark_funcenv((JanetFuncEnv *) mem);
+            break;
+        case JANET_MEMORY_FUNCDEF:
+            janet_mark_funcdef((JanetFuncDef *) mem);
+            break;
+        case JANET_MEMORY_ABSTRACT:
+            janet_mark_abstract(((JanetAbstractHead *) mem)->data);
+            break;
+    }
+    janet_vm_gc_scanning = NULL;
+}
+
+/* Mark everything reachable from the roots */
+static void janet_mark_roots(void) {
+#ifdef JANET_EV
+    janet_ev_mark();
+#endif
+#ifdef JANET_INSTRUMENT
+    janet_instrument_mark();
+#endif
+    if (janet_vm_heap_site_count)
+        janet_heap_sites_mark();
+    if (NULL != janet_vm_root_fiber)
+        janet_mark_fiber(janet_vm_root_fiber);
+#ifdef JANET_EV
+    if (NULL != janet_vm_gc_hook)
+        janet_mark_function(janet_vm_gc_hook);
+    if (NULL != janet_vm_gc_hook_fiber)
+        janet_mark_fiber(janet_vm_gc_hook_fiber);
+#endif
+    for (uint32_t i = 0; i < orig_rootcount; i++)
+        janet_mark(janet_vm_roots[i]);
+}
+
+/* Measure the time spent in a collection */
+static void janet_gc_pause_begin(struct timespec *start) {
+    janet_gettime(start);
+}
+
+static void janet_gc_pause_end(struct timespec *start) {
+    struct timespec now;
+    janet_gettime(&now);
+    double pause = (double)(now.tv_sec - start->tv_sec) +
+                   (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+    janet_vm_gc_pause_last = pause;
+    janet_vm_gc_pause_total += pause;
+    if (pause > janet_vm_gc_pause_max)
+        janet_vm_gc_pause_max = pause;
+}
+
+/* Schedule the gc hook to run after a collection, unless it is already waiting to run */
+static void janet_gc_run_hook(void) {
+#ifdef JANET_EV
+    if (NULL == janet_vm_gc_hook) return;
+    if (NULL != janet_vm_gc_hook_fiber &&
+            janet_fiber_status(janet_vm_gc_hook_fiber) == JANET_STATUS_NEW) return;
+    janet_vm_gc_hook_fiber = janet_fiber(janet_vm_gc_hook, JANET_STACK_INITIAL, 0, NULL);
+    janet_schedule(janet_vm_gc_hook_fiber, janet_wrap_nil());
+#endif
+}
+
+/* Mark values that were deferred to the roots, as well as gray blocks */
+static void janet_mark_deferred(void) {
+    while (orig_rootcount < janet_vm_root_count || janet_vm_gc_gray_count) {
+        while (orig_rootcount < janet_vm_root_count) {
+            Janet x = janet_vm_roots[--janet_vm_root_count];
+            janet_mark(x);
+        }
+        if (janet_vm_gc_gray_count) {
+            janet_scan_block(janet_vm_gc_gray[--janet_vm_gc_gray_count]);
+        }
+    }
+}
+
+/* Run garbage collection. A minor collection only marks and sweeps young blocks,
+ * using old blocks that were written to since the last collection as extra roots. */
+static void janet_collect_impl(int major) {
+    struct timespec start;
     if (janet_vm_gc_suspend) return;
+    janet_gc_pause_begin(&start);
     depth = JANET_RECURSION_GUARD;
+    janet_vm_gc_skipmask = major ? JANET_MEM_REACHABLE : (JANET_MEM_REACHABLE | JANET_MEM_OLD);
+    janet_vm_gc_shading = !major && janet_vm_gc_phase == JANET_GC_MARK;
     /* Try and prevent many major collections back to back.
      * A full collection will take O(janet_vm_block_count) time.
      * If we have a large heap, make sure our interval is not too
      * small so we won't make many collections over it. This is just a
-     * heuristic for automatically changing the gc interval */
-    if (janet_vm_block_count * 8 > janet_vm_gc_interval) {
+     * heuristic for automatically changing the gc interval. It is not
+     * used in incremental mode, where short pauses matter more. */
+    if (!janet_vm_gc_incremental && janet_vm_block_count * 8 > janet_vm_gc_interval) {
         janet_vm_gc_interval = janet_vm_block_count * sizeof(JanetGCObject);
     }
     orig_rootcount = janet_vm_root_count;
-#ifdef JANET_EV
-    janet_ev_mark();
-#endif
-    janet_mark_fiber(janet_vm_root_fiber);
-    for (i = 0; i < orig_rootcount; i++)
-        janet_mark(janet_vm_roots[i]);
+    janet_mark_roots();
+    if (!major) {
+        /* Marking can add to the remembered set, so don't cache the count */
+        for (size_t j = 0; j < janet_vm_gc_remembered_count; j++)
+            janet_scan_block(janet_vm_gc_remembered[j]);
+        for (size_t j = 0; j < janet_vm_gc_watched_count; j++)
+            janet_scan_block(janet_vm_gc_watched[j]);
+    }
     while (orig_rootcount < janet_vm_root_count) {
         Janet x = janet_vm_roots[--janet_vm_root_count];
         janet_mark(x);
     }
-    janet_sweep();
+    janet_gc_prune_remembered(major);
+    if (major) {
+        janet_sweep_old();
+        janet_vm_gc_major_count++;
+    } else {
+        janet_vm_gc_minor_count++;
+    }
+    janet_sweep_young();
+    if (major) {
+        /* Wait until the old generation doubles before the next major collection */
+        janet_vm_gc_old_limit = 2 * janet_vm_old_block_count;
+        if (janet_vm_gc_old_limit < JANET_GC_MIN_OLD_LIMIT)
+            janet_vm_gc_old_limit = JANET_GC_MIN_OLD_LIMIT;
+    }
+    janet_vm_gc_skipmask = JANET_MEM_REACHABLE;
+    janet_vm_gc_shading = 0;
     janet_vm_next_collection = 0;
     janet_free_all_scratch();
+    janet_gc_pause_end(&start);
+    janet_gc_run_hook();
+}
+
+/* Start an incremental major collection by shading the old blocks referenced
+ * from the roots. Young blocks are marked when the cycle's mark phase ends. */
+static void janet_gc_begin(void) {
+    struct timespec start;
+    janet_gc_pause_begin(&start);
+    janet_vm_gc_phase = JANET_GC_MARK;
+    janet_vm_gc_step_alloc_count = janet_vm_gc_alloc_count;
+    janet_vm_gc_shading = 1;
+    janet_vm_gc_grayonly = 1;
+    depth = JANET_RECURSION_GUARD;
+    orig_rootcount = janet_vm_root_count;
+    janet_mark_roots();
+    janet_vm_gc_shading = 0;
+    janet_vm_gc_grayonly = 0;
+    janet_gc_pause_end(&start);
+}
+
+/* Finish the mark phase of an incremental collection. This marks everything
+ * that could have changed since it was scanned - the roots, the young generation,
+ * and old blocks that were written to - and then sweeps the young generation. */
+static void janet_gc_remark(void) {
+    depth = JANET_RECURSION_GUARD;
+    orig_rootcount = janet_vm_root_count;
+    janet_mark_roots();
+    for (size_t j = 0; j < janet_vm_gc_remembered_count; j++) {
+        if (janet_vm_gc_remembered[j]->flags & JANET_MEM_REACHABLE)
+            janet_scan_block(janet_vm_gc_remembered[j]);
+    }
+    for (size_t j = 0; j < janet_vm_gc_watched_count; j++) {
+        if (janet_vm_gc_watched[j]->flags & JANET_MEM_REACHABLE)
+            janet_scan_block(janet_vm_gc_watched[j]);
+    }
+    janet_mark_deferred();
+    janet_gc_prune_remembered(1);
+    size_t kept = 0;
+    for (size_t j = 0; j < janet_vm_gc_watched_count; j++) {
+        if (janet_vm_gc_watched[j]->flags & JANET_MEM_REACHABLE)
+            janet_vm_gc_watched[kept++] = janet_vm_gc_watched[j];
+    }
+    janet_vm_gc_watched_count = kept;
+    /* Dead symbols must not be found in the cache while they wait to be swept */
+    janet_symcache_prune();
+    janet_vm_gc_sweep_blocks = janet_vm_old_blocks;
+    janet_vm_old_blocks = NULL;
+    janet_vm_gc_phase = JANET_GC_SWEEP;
+    janet_sweep_young();
+    janet_vm_next_collection = 0;
+    janet_free_all_scratch();
+}
+
+/* Sweep one old block from an incremental collection. */
+static void janet_gc_sweep_one(void) {
+    JanetGCObject *current = janet_vm_gc_sweep_blocks;
+    janet_vm_gc_sweep_blocks = current->next;
+    if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+        current->flags &= ~JANET_MEM_REACHABLE;
+        current->next = janet_vm_old_blocks;
+        janet_vm_old_blocks = current;
+    } else {
+        janet_vm_old_block_count--;
+        janet_free_block(current);
+    }
+    if (NULL == janet_vm_gc_sweep_blocks) {
+        janet_vm_gc_phase = JANET_GC_IDLE;
+        janet_vm_gc_major_count++;
+        janet_vm_gc_old_limit = 2 * janet_vm_old_block_count;
+        if (janet_vm_gc_old_limit < JANET_GC_MIN_OLD_LIMIT)
+            janet_vm_gc_old_limit = JANET_GC_MIN_OLD_LIMIT;
+        janet_gc_run_hook();
+    }
+}
+
+/* Check if an incremental step has used up its budget */
+static int janet_gc_budget_spent(struct timespec *start) {
+    struct timespec now;
+    janet_gettime(&now);
+    int64_t elapsed = (int64_t)(now.tv_sec - start->tv_sec) * 1000000 +
+                      (now.tv_nsec - start->tv_nsec) / 1000;
+    return elapsed >= (int64_t) janet_vm_gc_step_budget;
+}
+
+/* Do about janet_vm_gc_step_budget microseconds of work on an incremental collection,
+ * and at least enough to keep up with allocation. Each unit of work marks or sweeps
+ * one old block, and each allocation adds at most one old block. */
+static void janet_gc_step(void) {
+    struct timespec start;
+    size_t work = 0;
+    size_t min_work = JANET_GC_STEP_WORK * (janet_vm_gc_alloc_count - janet_vm_gc_step_alloc_count);
+    janet_vm_gc_step_alloc_count = janet_vm_gc_alloc_count;
+    janet_gc_pause_begin(&start);
+    if (janet_vm_gc_phase == JANET_GC_MARK) {
+        janet_vm_gc_shading = 1;
+        janet_vm_gc_grayonly = 1;
+        depth = JANET_RECURSION_GUARD;
+        while (janet_vm_gc_gray_count) {
+            janet_scan_block(janet_vm_gc_gray[--janet_vm_gc_gray_count]);
+            if (++work % JANET_GC_STEP_CHUNK == 0 && work >= min_work && janet_gc_budget_spent(&start))
+                break;
+        }
+        janet_vm_gc_shading = 0;
+        janet_vm_gc_grayonly = 0;
+        if (!janet_vm_gc_gray_count)
+            janet_gc_remark();
+    }
+    while (janet_vm_gc_phase == JANET_GC_SWEEP) {
+        janet_gc_sweep_one();
+        if (++work % JANET_GC_STEP_CHUNK == 0 && work >= min_work && janet_gc_budget_spent(&start))
+            break;
+    }
+    janet_gc_pause_end(&start);
+}
+
+/* Finish an incremental collection if one is running */
+void janet_gc_finish(void) {
+    struct timespec start;
+    if (janet_vm_gc_suspend || janet_vm_gc_phase == JANET_GC_IDLE) return;
+    janet_gc_pause_begin(&start);
+    if (janet_vm_gc_phase == JANET_GC_MARK)
+        janet_gc_remark();
+    while (janet_vm_gc_phase == JANET_GC_SWEEP)
+        janet_gc_sweep_one();
+    janet_vm_gc_next_step = SIZE_MAX;
+    janet_gc_pause_end(&start);
+}
+
+/* Make progress on an incremental collection when there is nothing else to do.
+ * Returns 1 if there is still more work left. */
+int janet_gc_idle_step(void) {
+    if (janet_vm_gc_suspend || janet_vm_gc_phase == JANET_GC_IDLE) return 0;
+    janet_gc_step();
+    janet_vm_gc_next_step = janet_vm_gc_phase == JANET_GC_IDLE ? SIZE_MAX
+                            : janet_vm_next_collection + JANET_GC_STEP_INTERVAL;
+    return janet_vm_gc_phase != JANET_GC_IDLE;
+}
+
+/* Run a full garbage collection */
+void janet_collect(void) {
+    janet_gc_finish();
+    janet_collect_impl(1);
+}
+
+/* Run a minor garbage collection */
+void janet_collect_minor(void) {
+    janet_collect_impl(0);
+}
+
+/* Run a minor garbage collection, or a major one if the old generation has grown enough.
+ * In incremental mode, major collections are instead run in steps between allocations. */
+void janet_collect_auto(void) {
+    if (janet_vm_gc_suspend) return;
+    if (!janet_vm_gc_incremental) {
+        janet_collect_impl(janet_vm_old_block_count >= janet_vm_gc_old_limit);
+        return;
+    }
+    if (janet_vm_next_collection >= janet_vm_gc_interval)
+        janet_collect_impl(0);
+    if (janet_vm_gc_phase == JANET_GC_IDLE && janet_vm_old_block_count >= janet_vm_gc_old_limit)
+        janet_gc_begin();
+    if (janet_vm_gc_phase != JANET_GC_IDLE)
+        janet_gc_step();
+    janet_vm_gc_next_step = janet_vm_gc_phase == JANET_GC_IDLE ? SIZE_MAX
+                            : janet_vm_next_collection + JANET_GC_STEP_INTERVAL;
+}
+
+/* Switch between atomic and incremental major collections */
+void janet_gc_setmode(int incremental, uint32_t budget) {
+    if (!incremental) janet_gc_finish();
+    janet_vm_gc_incremental = incremental;
+    janet_vm_gc_step_budget = budget;
 }
 
 /* Add a root value to the GC. This prevents the GC from removing a value
@@ -494,12 +1305,41 @@ void janet_clear_memory(void) {
     while (NULL != current) {
         janet_deinit_block(current);
         JanetGCObject *next = current->next;
-        janet_free(current);
+        janet_slab_free(current);
         current = next;
     }
     janet_vm_blocks = NULL;
+    current = janet_vm_old_blocks;
+    while (NULL != current) {
+        janet_deinit_block(current);
+        JanetGCObject *next = current->next;
+        janet_slab_free(current);
+        current = next;
+    }
+    janet_vm_old_blocks = NULL;
+    current = janet_vm_gc_sweep_blocks;
+    while (NULL != current) {
+        janet_deinit_block(current);
+        JanetGCObject *next = current->next;
+        janet_slab_free(current);
+        current = next;
+    }
+    janet_vm_gc_sweep_blocks = NULL;
+    janet_free(janet_vm_gc_gray);
+    janet_vm_gc_gray = NULL;
+    janet_vm_gc_gray_count = 0;
+    janet_vm_gc_gray_capacity = 0;
+    janet_vm_gc_phase = JANET_GC_IDLE;
+#ifndef JANET_NO_SLAB_ALLOCATOR
+    janet_slab_clear();
+#endif
+    janet_free(janet_vm_gc_remembered);
+    janet_free(janet_vm_gc_watched);
+    janet_vm_gc_remembered = NULL;
+    janet_vm_gc_watched = NULL;
     janet_free_all_scratch();
     janet_free(janet_scratch_mem);
+    janet_gc_heap_sample(0);
 }
 
 /* Primitives for suspending GC. */
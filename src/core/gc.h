@@ -34,13 +34,32 @@
 #define JANET_MEM_TYPEBITS 0xFF
 #define JANET_MEM_REACHABLE 0x100
 #define JANET_MEM_DISABLED 0x200
+#define JANET_MEM_OLD 0x400
+#define JANET_MEM_REMEMBERED 0x800
+#define JANET_MEM_SLABBITS 0xF000
+#define JANET_SLAB_CLASS_COUNT 16
 
-#define janet_gc_settype(m, t) ((janet_gc_header(m)->flags |= (0xFF & (t))))
+#define janet_gc_settype(m, t) do { \
+    janet_vm_gc_type_counts[janet_gc_type(m)]--; \
+    janet_gc_header(m)->flags |= (0xFF & (t)); \
+    janet_vm_gc_type_counts[janet_gc_type(m)]++; \
+} while (0)
 #define janet_gc_type(m) (janet_gc_header(m)->flags & 0xFF)
 
 #define janet_gc_mark(m) (janet_gc_header(m)->flags |= JANET_MEM_REACHABLE)
 #define janet_gc_reachable(m) (janet_gc_header(m)->flags & JANET_MEM_REACHABLE)
 
+/* Write barrier for the generational collector. Must be used before storing a
+ * reference into an existing array, table, fiber, or funcenv, so that old blocks
+ * referencing young blocks are seen by minor collections. Other blocks are
+ * immutable and so can only reference blocks older than themselves, and abstract
+ * types with a gcmark function are always scanned. */
+#define janet_gc_barrier(m) do { \
+    JanetGCObject *janet_gc_barrier_head = janet_gc_header(m); \
+    if ((janet_gc_barrier_head->flags & (JANET_MEM_OLD | JANET_MEM_REMEMBERED)) == JANET_MEM_OLD) \
+        janet_gc_remember(janet_gc_barrier_head); \
+} while (0)
+
 /* Memory types for the GC. Different from JanetType to include funcenv and funcdef. */
 enum JanetMemoryType {
     JANET_MEMORY_NONE,
@@ -58,8 +77,23 @@ enum JanetMemoryType {
     JANET_MEMORY_FUNCDEF
 };
 
+#define JANET_MEMORY_TYPE_COUNT (JANET_MEMORY_FUNCDEF + 1)
+
 /* To allocate collectable memory, one must calk janet_alloc, initialize the memory,
  * and then call when janet_enablegc when it is initailize and reachable by the gc (on the JANET stack) */
 void *janet_gcalloc(enum JanetMemoryType type, size_t size);
 
+void janet_gc_remember(JanetGCObject *mem);
+void janet_collect_minor(void);
+void janet_collect_auto(void);
+void janet_gc_finish(void);
+int janet_gc_idle_step(void);
+void janet_gc_setmode(int incremental, uint32_t budget);
+
+/* Heap snapshots, see debug/heap-snapshot. Sampled blocks have the funcdef and
+ * pc that allocated them, other blocks have a NULL def. */
+typedef void (*JanetHeapVisitor)(JanetGCObject *mem, size_t size, JanetFuncDef *def, int32_t pc, void *data);
+void janet_gc_heap_walk(JanetHeapVisitor visit, void *data);
+void janet_gc_heap_sample(uint32_t rate);
+
 #endif
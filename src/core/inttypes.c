@@ -24,6 +24,8 @@
 #include "features.h"
 #include <janet.h>
 #include "util.h"
+#include "gc.h"
+#include "state.h"
 #endif
 
 #include <errno.h>
@@ -41,6 +43,8 @@ static int it_s64_get(void *p, Janet key, Janet *out);
 static int it_u64_get(void *p, Janet key, Janet *out);
 static Janet janet_int64_next(void *p, Janet key);
 static Janet janet_uint64_next(void *p, Janet key);
+static int it_acc_get(void *p, Janet key, Janet *out);
+static Janet it_acc_next(void *p, Janet key);
 
 static int32_t janet_int64_hash(void *p1, size_t size) {
     (void) size;
@@ -113,6 +117,53 @@ const JanetAbstractType janet_u64_type = {
     JANET_ATEND_NEXT
 };
 
+/* Mutable accumulators made by int/s64-acc and int/u64-acc. Operations
+ * update the accumulator in place rather than allocating a new box for
+ * every result. The value is kept as the bits of a uint64_t so that
+ * wrapping add, sub and mul are well defined for both signednesses. */
+typedef struct {
+    uint64_t value;
+    int is_signed;
+} JanetIntAcc;
+
+static void it_acc_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetIntAcc *acc = p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_int64(ctx, (int64_t) acc->value);
+    janet_marshal_int(ctx, acc->is_signed);
+}
+
+static void *it_acc_unmarshal(JanetMarshalContext *ctx) {
+    JanetIntAcc *acc = janet_unmarshal_abstract(ctx, sizeof(JanetIntAcc));
+    acc->value = (uint64_t) janet_unmarshal_int64(ctx);
+    acc->is_signed = janet_unmarshal_int(ctx);
+    return acc;
+}
+
+static void it_acc_tostring(void *p, JanetBuffer *buffer) {
+    JanetIntAcc *acc = p;
+    if (acc->is_signed) {
+        it_s64_tostring(&acc->value, buffer);
+    } else {
+        it_u64_tostring(&acc->value, buffer);
+    }
+}
+
+static const JanetAbstractType it_acc_type = {
+    "core/int-accumulator",
+    NULL,
+    NULL,
+    it_acc_get,
+    NULL,
+    it_acc_marshal,
+    it_acc_unmarshal,
+    it_acc_tostring,
+    NULL,
+    NULL,
+    it_acc_next,
+    JANET_ATEND_NEXT
+};
+
 int64_t janet_unwrap_s64(Janet x) {
     switch (janet_type(x)) {
         default:
@@ -135,6 +186,8 @@ int64_t janet_unwrap_s64(Janet x) {
             if (janet_abstract_type(abst) == &janet_s64_type ||
                     (janet_abstract_type(abst) == &janet_u64_type))
                 return *(int64_t *)abst;
+            if (janet_abstract_type(abst) == &it_acc_type)
+                return (int64_t)((JanetIntAcc *)abst)->value;
             break;
         }
     }
@@ -166,6 +219,8 @@ uint64_t janet_unwrap_u64(Janet x) {
             if (janet_abstract_type(abst) == &janet_s64_type ||
                     (janet_abstract_type(abst) == &janet_u64_type))
                 return *(uint64_t *)abst;
+            if (janet_abstract_type(abst) == &it_acc_type)
+                return ((JanetIntAcc *)abst)->value;
             break;
         }
     }
@@ -181,18 +236,65 @@ JanetIntType janet_is_int(Janet x) {
             JANET_INT_NONE);
 }
 
+/* Boxes are never modified after creation, so boxes for small values are
+ * shared instead of allocated each time. The cache holds s64 boxes for
+ * INT_CACHE_MIN up to INT_CACHE_MAX, followed by u64 boxes for 0 up to
+ * INT_CACHE_MAX, and is filled in on first use. */
+#define INT_CACHE_MIN (-128)
+#define INT_CACHE_MAX 1024
+#define INT_CACHE_U64 (INT_CACHE_MAX - INT_CACHE_MIN)
+#define INT_CACHE_SIZE (INT_CACHE_U64 + INT_CACHE_MAX)
+
+JANET_THREAD_LOCAL JanetArray *janet_vm_int_cache = NULL;
+
+static Janet *int_cache_slot(int32_t index) {
+    if (NULL == janet_vm_int_cache) {
+        janet_vm_int_cache = janet_array(INT_CACHE_SIZE);
+        for (int32_t i = 0; i < INT_CACHE_SIZE; i++)
+            janet_vm_int_cache->data[i] = janet_wrap_nil();
+        janet_vm_int_cache->count = INT_CACHE_SIZE;
+        janet_gcroot(janet_wrap_array(janet_vm_int_cache));
+    }
+    return janet_vm_int_cache->data + index;
+}
+
 Janet janet_wrap_s64(int64_t x) {
+    Janet *slot = NULL;
+    if (x >= INT_CACHE_MIN && x < INT_CACHE_MAX) {
+        slot = int_cache_slot((int32_t)(x - INT_CACHE_MIN));
+        if (!janet_checktype(*slot, JANET_NIL)) return *slot;
+    }
     int64_t *box = janet_abstract(&janet_s64_type, sizeof(int64_t));
     *box = (int64_t)x;
-    return janet_wrap_abstract(box);
+    Janet ret = janet_wrap_abstract(box);
+    if (NULL != slot) {
+        janet_gc_barrier(janet_vm_int_cache);
+        *slot = ret;
+    }
+    return ret;
 }
 
 Janet janet_wrap_u64(uint64_t x) {
+    Janet *slot = NULL;
+    if (x < INT_CACHE_MAX) {
+        slot = int_cache_slot(INT_CACHE_U64 + (int32_t) x);
+        if (!janet_checktype(*slot, JANET_NIL)) return *slot;
+    }
     uint64_t *box = janet_abstract(&janet_u64_type, sizeof(uint64_t));
     *box = (uint64_t)x;
-    return janet_wrap_abstract(box);
+    Janet ret = janet_wrap_abstract(box);
+    if (NULL != slot) {
+        janet_gc_barrier(janet_vm_int_cache);
+        *slot = ret;
+    }
+    return ret;
 }
 
+#undef INT_CACHE_MIN
+#undef INT_CACHE_MAX
+#undef INT_CACHE_U64
+#undef INT_CACHE_SIZE
+
 static Janet cfun_it_s64_new(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
     return janet_wrap_s64(janet_unwrap_s64(argv[0]));
@@ -320,82 +422,74 @@ static Janet cfun_it_u64_compare(int32_t argc, Janet *argv) {
 #define OPMETHOD(T, type, name, oper) \
 static Janet cfun_it_##type##_##name(int32_t argc, Janet *argv) { \
     janet_arity(argc, 2, -1); \
-    T *box = janet_abstract(&janet_##type##_type, sizeof(T)); \
-    *box = janet_unwrap_##type(argv[0]); \
+    T x = janet_unwrap_##type(argv[0]); \
     for (int32_t i = 1; i < argc; i++) \
-        *box oper##= janet_unwrap_##type(argv[i]); \
-    return janet_wrap_abstract(box); \
+        x oper##= janet_unwrap_##type(argv[i]); \
+    return janet_wrap_##type(x); \
 } \
 
 #define OPMETHODINVERT(T, type, name, oper) \
 static Janet cfun_it_##type##_##name(int32_t argc, Janet *argv) { \
     janet_fixarity(argc, 2); \
-    T *box = janet_abstract(&janet_##type##_type, sizeof(T)); \
-    *box = janet_unwrap_##type(argv[1]); \
-    *box oper##= janet_unwrap_##type(argv[0]); \
-    return janet_wrap_abstract(box); \
+    T x = janet_unwrap_##type(argv[1]); \
+    x oper##= janet_unwrap_##type(argv[0]); \
+    return janet_wrap_##type(x); \
 } \
 
 #define DIVMETHOD(T, type, name, oper) \
 static Janet cfun_it_##type##_##name(int32_t argc, Janet *argv) { \
     janet_arity(argc, 2, -1);                       \
-    T *box = janet_abstract(&janet_##type##_type, sizeof(T)); \
-    *box = janet_unwrap_##type(argv[0]); \
+    T x = janet_unwrap_##type(argv[0]); \
     for (int32_t i = 1; i < argc; i++) { \
       T value = janet_unwrap_##type(argv[i]); \
       if (value == 0) janet_panic("division by zero"); \
-      *box oper##= value; \
+      x oper##= value; \
     } \
-    return janet_wrap_abstract(box); \
+    return janet_wrap_##type(x); \
 } \
 
 #define DIVMETHODINVERT(T, type, name, oper) \
 static Janet cfun_it_##type##_##name(int32_t argc, Janet *argv) { \
     janet_fixarity(argc, 2);                       \
-    T *box = janet_abstract(&janet_##type##_type, sizeof(T)); \
-    *box = janet_unwrap_##type(argv[1]); \
+    T x = janet_unwrap_##type(argv[1]); \
     T value = janet_unwrap_##type(argv[0]); \
     if (value == 0) janet_panic("division by zero"); \
-    *box oper##= value; \
-    return janet_wrap_abstract(box); \
+    x oper##= value; \
+    return janet_wrap_##type(x); \
 } \
 
 #define DIVMETHOD_SIGNED(T, type, name, oper) \
 static Janet cfun_it_##type##_##name(int32_t argc, Janet *argv) { \
     janet_arity(argc, 2, -1);                       \
-    T *box = janet_abstract(&janet_##type##_type, sizeof(T)); \
-    *box = janet_unwrap_##type(argv[0]); \
+    T x = janet_unwrap_##type(argv[0]); \
     for (int32_t i = 1; i < argc; i++) { \
       T value = janet_unwrap_##type(argv[i]); \
       if (value == 0) janet_panic("division by zero"); \
-      if ((value == -1) && (*box == INT64_MIN)) janet_panic("INT64_MIN divided by -1"); \
-      *box oper##= value; \
+      if ((value == -1) && (x == INT64_MIN)) janet_panic("INT64_MIN divided by -1"); \
+      x oper##= value; \
     } \
-    return janet_wrap_abstract(box); \
+    return janet_wrap_##type(x); \
 } \
 
 #define DIVMETHODINVERT_SIGNED(T, type, name, oper) \
 static Janet cfun_it_##type##_##name(int32_t argc, Janet *argv) { \
     janet_fixarity(argc, 2);                       \
-    T *box = janet_abstract(&janet_##type##_type, sizeof(T)); \
-    *box = janet_unwrap_##type(argv[1]); \
+    T x = janet_unwrap_##type(argv[1]); \
     T value = janet_unwrap_##type(argv[0]); \
     if (value == 0) janet_panic("division by zero"); \
-    if ((value == -1) && (*box == INT64_MIN)) janet_panic("INT64_MIN divided by -1"); \
-    *box oper##= value; \
-    return janet_wrap_abstract(box); \
+    if ((value == -1) && (x == INT64_MIN)) janet_panic("INT64_MIN divided by -1"); \
+    x oper##= value; \
+    return janet_wrap_##type(x); \
 } \
 
 static Janet cfun_it_s64_mod(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 2);
-    int64_t *box = janet_abstract(&janet_s64_type, sizeof(int64_t));
     int64_t op1 = janet_unwrap_s64(argv[0]);
     int64_t op2 = janet_unwrap_s64(argv[1]);
     int64_t x = op1 % op2;
-    *box = (op1 > 0)
-           ? ((op2 > 0) ? x : (0 == x ? x : x + op2))
-           : ((op2 > 0) ? (0 == x ? x : x + op2) : x);
-    return janet_wrap_abstract(box);
+    return janet_wrap_s64((op1 > 0)
+                          ? ((op2 > 0) ? x : (0 == x ? x : x + op2))
+                          : ((op2 > 0) ? (0 == x ? x : x + op2) : x));
 }
 
 OPMETHOD(int64_t, s64, add, +)
@@ -505,6 +599,192 @@ static int it_u64_get(void *p, Janet key, Janet *out) {
     return janet_getmethod(janet_unwrap_keyword(key), it_u64_methods, out);
 }
 
+/* Accumulators */
+
+typedef enum {
+    ACC_ADD,
+    ACC_SUB,
+    ACC_MUL,
+    ACC_DIV,
+    ACC_AND,
+    ACC_OR,
+    ACC_XOR
+} JanetIntAccOp;
+
+static uint64_t acc_unwrap(JanetIntAcc *acc, Janet x) {
+    return acc->is_signed ? (uint64_t) janet_unwrap_s64(x) : janet_unwrap_u64(x);
+}
+
+static void acc_apply(JanetIntAcc *acc, JanetIntAccOp op, uint64_t x) {
+    switch (op) {
+        case ACC_ADD:
+            acc->value += x;
+            break;
+        case ACC_SUB:
+            acc->value -= x;
+            break;
+        case ACC_MUL:
+            acc->value *= x;
+            break;
+        case ACC_DIV:
+            if (x == 0) janet_panic("division by zero");
+            if (acc->is_signed) {
+                int64_t a = (int64_t) acc->value;
+                int64_t b = (int64_t) x;
+                if ((b == -1) && (a == INT64_MIN)) janet_panic("INT64_MIN divided by -1");
+                acc->value = (uint64_t)(a / b);
+            } else {
+                acc->value /= x;
+            }
+            break;
+        case ACC_AND:
+            acc->value &= x;
+            break;
+        case ACC_OR:
+            acc->value |= x;
+            break;
+        case ACC_XOR:
+            acc->value ^= x;
+            break;
+    }
+}
+
+/* Apply op with x, or with each element in turn if x is an array, tuple,
+ * or typed array. Elements of s64 and u64 typed arrays are read directly. */
+static void acc_fold(JanetIntAcc *acc, JanetIntAccOp op, Janet x) {
+    const Janet *items;
+    int32_t len;
+    if (janet_indexed_view(x, &items, &len)) {
+        for (int32_t i = 0; i < len; i++)
+            acc_apply(acc, op, acc_unwrap(acc, items[i]));
+        return;
+    }
+#ifdef JANET_TYPED_ARRAY
+    JanetTArrayView *view = janet_checkabstract(x, &janet_ta_view_type);
+    if (NULL != view) {
+        size_t size = view->size, stride = view->stride;
+        if (view->type == JANET_TARRAY_TYPE_S64 || view->type == JANET_TARRAY_TYPE_U64) {
+            const uint64_t *data = view->as.u64;
+            if (op == ACC_ADD && stride == 1) {
+                /* Simple enough for the compiler to vectorize */
+                uint64_t sum = acc->value;
+                for (size_t i = 0; i < size; i++) sum += data[i];
+                acc->value = sum;
+            } else {
+                for (size_t i = 0; i < size; i++)
+                    acc_apply(acc, op, data[i * stride]);
+            }
+        } else {
+            for (size_t i = 0; i < size; i++)
+                acc_apply(acc, op, acc_unwrap(acc, janet_get(x, janet_wrap_number((double) i))));
+        }
+        return;
+    }
+#endif
+    acc_apply(acc, op, acc_unwrap(acc, x));
+}
+
+static Janet acc_wrap(JanetIntAcc *acc) {
+    return acc->is_signed
+           ? janet_wrap_s64((int64_t) acc->value)
+           : janet_wrap_u64(acc->value);
+}
+
+#define ACCMETHOD(name, op) \
+static Janet cfun_it_acc_##name(int32_t argc, Janet *argv) { \
+    janet_arity(argc, 1, -1); \
+    JanetIntAcc *acc = janet_getabstract(argv, 0, &it_acc_type); \
+    for (int32_t i = 1; i < argc; i++) \
+        acc_fold(acc, op, argv[i]); \
+    return argv[0]; \
+}
+
+ACCMETHOD(add, ACC_ADD)
+ACCMETHOD(sub, ACC_SUB)
+ACCMETHOD(mul, ACC_MUL)
+ACCMETHOD(div, ACC_DIV)
+ACCMETHOD(and, ACC_AND)
+ACCMETHOD(or, ACC_OR)
+ACCMETHOD(xor, ACC_XOR)
+
+#undef ACCMETHOD
+
+static Janet cfun_it_acc_set(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 2);
+    JanetIntAcc *acc = janet_getabstract(argv, 0, &it_acc_type);
+    acc->value = acc_unwrap(acc, argv[1]);
+    return argv[0];
+}
+
+static Janet cfun_it_acc_value(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    return acc_wrap(janet_getabstract(argv, 0, &it_acc_type));
+}
+
+static JanetMethod it_acc_methods[] = {
+    {"add", cfun_it_acc_add},
+    {"sub", cfun_it_acc_sub},
+    {"mul", cfun_it_acc_mul},
+    {"div", cfun_it_acc_div},
+    {"and", cfun_it_acc_and},
+    {"or", cfun_it_acc_or},
+    {"xor", cfun_it_acc_xor},
+    {"set", cfun_it_acc_set},
+    {"value", cfun_it_acc_value},
+    {NULL, NULL}
+};
+
+static Janet it_acc_next(void *p, Janet key) {
+    (void) p;
+    return janet_nextmethod(it_acc_methods, key);
+}
+
+static int it_acc_get(void *p, Janet key, Janet *out) {
+    (void) p;
+    if (!janet_checktype(key, JANET_KEYWORD))
+        return 0;
+    return janet_getmethod(janet_unwrap_keyword(key), it_acc_methods, out);
+}
+
+static Janet it_acc_new(int32_t argc, Janet *argv, int is_signed) {
+    janet_arity(argc, 0, 1);
+    JanetIntAcc *acc = janet_abstract(&it_acc_type, sizeof(JanetIntAcc));
+    acc->is_signed = is_signed;
+    acc->value = argc > 0 ? acc_unwrap(acc, argv[0]) : 0;
+    return janet_wrap_abstract(acc);
+}
+
+static Janet cfun_it_s64_acc_new(int32_t argc, Janet *argv) {
+    return it_acc_new(argc, argv, 1);
+}
+
+static Janet cfun_it_u64_acc_new(int32_t argc, Janet *argv) {
+    return it_acc_new(argc, argv, 0);
+}
+
+static Janet cfun_it_sum(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    JanetIntAcc acc;
+    acc.value = 0;
+    acc.is_signed = 1;
+    if (argc > 1) {
+        const uint8_t *kind = janet_getkeyword(argv, 1);
+        if (!janet_cstrcmp(kind, "u64")) {
+            acc.is_signed = 0;
+        } else if (janet_cstrcmp(kind, "s64")) {
+            janet_panicf("expected :s64 or :u64, got %v", argv[1]);
+        }
+    }
+#ifdef JANET_TYPED_ARRAY
+    else {
+        JanetTArrayView *view = janet_checkabstract(argv[0], &janet_ta_view_type);
+        if (NULL != view && view->type == JANET_TARRAY_TYPE_U64) acc.is_signed = 0;
+    }
+#endif
+    acc_fold(&acc, ACC_ADD, argv[0]);
+    return acc_wrap(&acc);
+}
+
 static const JanetReg it_cfuns[] = {
     {
         "int/s64", cfun_it_s64_new,
@@ -516,6 +796,30 @@ static const JanetReg it_cfuns[] = {
         JDOC("(int/u64 value)\n\n"
              "Create a boxed unsigned 64 bit integer from a string value.")
     },
+    {
+        "int/s64-acc", cfun_it_s64_acc_new,
+        JDOC("(int/s64-acc &opt value)\n\n"
+             "Create a mutable signed 64 bit accumulator, starting at value or 0. "
+             "The methods :add, :sub, :mul, :div, :and, :or and :xor update the "
+             "accumulator in place with each argument and return it, without "
+             "allocating. An argument that is an array, tuple, or typed array "
+             "applies the operation with each of its elements. :set replaces the "
+             "value, and :value returns it as an int/s64.")
+    },
+    {
+        "int/u64-acc", cfun_it_u64_acc_new,
+        JDOC("(int/u64-acc &opt value)\n\n"
+             "Create a mutable unsigned 64 bit accumulator, starting at value or 0. "
+             "See int/s64-acc.")
+    },
+    {
+        "int/sum", cfun_it_sum,
+        JDOC("(int/sum xs &opt kind)\n\n"
+             "Sum the elements of an array, tuple, or typed array as 64 bit integers "
+             "with wrap around, and return the result as an int/s64, or an int/u64 "
+             "if kind is :u64. Kind defaults to :u64 for u64 typed arrays and :s64 "
+             "otherwise. s64 and u64 typed arrays are summed without boxing.")
+    },
     {NULL, NULL, NULL}
 };
 
@@ -524,6 +828,7 @@ void janet_lib_inttypes(JanetTable *env) {
     janet_core_cfuns(env, NULL, it_cfuns);
     janet_register_abstract_type(&janet_s64_type);
     janet_register_abstract_type(&janet_u64_type);
+    janet_register_abstract_type(&it_acc_type);
 }
 
 #endif
@@ -31,6 +31,8 @@
 
 #ifndef JANET_WINDOWS
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #endif
@@ -188,6 +190,7 @@ static Janet cfun_io_fread(int32_t argc, Janet *argv) {
     janet_arity(argc, 2, 3);
     JanetFile *iof = janet_getabstract(argv, 0, &janet_file_type);
     if (iof->flags & JANET_FILE_CLOSED) janet_panic("file is closed");
+    if (iof->flags & JANET_FILE_BUSY) janet_panic("file is busy");
     JanetBuffer *buffer;
     if (argc == 2) {
         buffer = janet_buffer(0);
@@ -229,6 +232,8 @@ static Janet cfun_io_fwrite(int32_t argc, Janet *argv) {
     JanetFile *iof = janet_getabstract(argv, 0, &janet_file_type);
     if (iof->flags & JANET_FILE_CLOSED)
         janet_panic("file is closed");
+    if (iof->flags & JANET_FILE_BUSY)
+        janet_panic("file is busy");
     if (!(iof->flags & (JANET_FILE_WRITE | JANET_FILE_APPEND | JANET_FILE_UPDATE)))
         janet_panic("file is not writeable");
     int32_t i;
@@ -252,6 +257,8 @@ static Janet cfun_io_fflush(int32_t argc, Janet *argv) {
     JanetFile *iof = janet_getabstract(argv, 0, &janet_file_type);
     if (iof->flags & JANET_FILE_CLOSED)
         janet_panic("file is closed");
+    if (iof->flags & JANET_FILE_BUSY)
+        janet_panic("file is busy");
     if (!(iof->flags & (JANET_FILE_WRITE | JANET_FILE_APPEND | JANET_FILE_UPDATE)))
         janet_panic("file is not writeable");
     if (fflush(iof->file))
@@ -296,6 +303,8 @@ static Janet cfun_io_fclose(int32_t argc, Janet *argv) {
     JanetFile *iof = janet_getabstract(argv, 0, &janet_file_type);
     if (iof->flags & JANET_FILE_CLOSED)
         return janet_wrap_nil();
+    if (iof->flags & JANET_FILE_BUSY)
+        janet_panic("file is busy");
     if (iof->flags & (JANET_FILE_NOT_CLOSEABLE))
         janet_panic("file not closable");
     if (iof->flags & JANET_FILE_PIPED) {
@@ -323,6 +332,8 @@ static Janet cfun_io_fseek(int32_t argc, Janet *argv) {
     JanetFile *iof = janet_getabstract(argv, 0, &janet_file_type);
     if (iof->flags & JANET_FILE_CLOSED)
         janet_panic("file is closed");
+    if (iof->flags & JANET_FILE_BUSY)
+        janet_panic("file is busy");
     long int offset = 0;
     int whence = SEEK_CUR;
     if (argc >= 2) {
@@ -509,14 +520,13 @@ static Janet cfun_io_xprin(int32_t argc, Janet *argv) {
 static Janet cfun_io_printf_impl_x(int32_t argc, Janet *argv, int newline,
                                    FILE *dflt_file, int32_t offset, Janet x) {
     FILE *f;
-    const char *fmt = janet_getcstring(argv, offset);
     switch (janet_type(x)) {
         default:
             janet_panicf("cannot print to %v", x);
         case JANET_BUFFER: {
             /* Special case buffer */
             JanetBuffer *buf = janet_unwrap_buffer(x);
-            janet_buffer_format(buf, fmt, offset, argc, argv);
+            janet_buffer_format_arg(buf, offset, argc, argv);
             if (newline) janet_buffer_push_u8(buf, '\n');
             return janet_wrap_nil();
         }
@@ -534,7 +544,7 @@ static Janet cfun_io_printf_impl_x(int32_t argc, Janet *argv, int newline,
         }
     }
     JanetBuffer *buf = janet_buffer(10);
-    janet_buffer_format(buf, fmt, offset, argc, argv);
+    janet_buffer_format_arg(buf, offset, argc, argv);
     if (newline) janet_buffer_push_u8(buf, '\n');
     if (buf->count) {
         if (1 != fwrite(buf->data, buf->count, 1, f)) {
@@ -651,6 +661,229 @@ void janet_dynprintf(const char *name, FILE *dflt_file, const char *format, ...)
     return;
 }
 
+/* Memory mapped files */
+
+/* Read only views of a file that string and buffer functions can use in
+ * place. On Windows the file is read into memory instead. */
+typedef struct {
+    const uint8_t *data;
+    int32_t len;
+    void *base;
+    size_t maplen;
+} JanetMmap;
+
+static void io_mmap_release(JanetMmap *m) {
+    if (NULL != m->base) {
+#ifdef JANET_WINDOWS
+        janet_free(m->base);
+#else
+        munmap(m->base, m->maplen);
+#endif
+    }
+    m->base = NULL;
+    m->maplen = 0;
+    m->data = NULL;
+    m->len = 0;
+}
+
+static int io_mmap_gc(void *p, size_t len) {
+    (void) len;
+    io_mmap_release((JanetMmap *) p);
+    return 0;
+}
+
+static Janet cfun_io_mmap_close(int32_t argc, Janet *argv);
+static Janet cfun_io_mmap_advise(int32_t argc, Janet *argv);
+static Janet cfun_io_mmap_length(int32_t argc, Janet *argv);
+
+static JanetMethod io_mmap_methods[] = {
+    {"advise", cfun_io_mmap_advise},
+    {"close", cfun_io_mmap_close},
+    {"length", cfun_io_mmap_length},
+    {NULL, NULL}
+};
+
+static int io_mmap_get(void *p, Janet key, Janet *out) {
+    JanetMmap *m = (JanetMmap *) p;
+    if (janet_checktype(key, JANET_KEYWORD)) {
+        return janet_getmethod(janet_unwrap_keyword(key), io_mmap_methods, out);
+    }
+    if (!janet_checkint(key)) return 0;
+    int32_t i = janet_unwrap_integer(key);
+    if (i < 0 || i >= m->len) return 0;
+    *out = janet_wrap_integer(m->data[i]);
+    return 1;
+}
+
+static Janet io_mmap_next(void *p, Janet key) {
+    JanetMmap *m = (JanetMmap *) p;
+    if (janet_checktype(key, JANET_NIL)) {
+        return m->len > 0 ? janet_wrap_integer(0) : janet_wrap_nil();
+    }
+    if (!janet_checkint(key)) return janet_wrap_nil();
+    int32_t i = janet_unwrap_integer(key);
+    if (i < 0 || i + 1 >= m->len) return janet_wrap_nil();
+    return janet_wrap_integer(i + 1);
+}
+
+const JanetAbstractType janet_mmap_type = {
+    "core/mmap",
+    io_mmap_gc,
+    NULL,
+    io_mmap_get,
+    NULL, /* put */
+    NULL, /* marshal */
+    NULL, /* unmarshal */
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    io_mmap_next,
+    JANET_ATEND_NEXT
+};
+
+int janet_mmap_bytes(void *abstract, const uint8_t **data, int32_t *len) {
+    JanetMmap *m = (JanetMmap *) abstract;
+    if (NULL == m->data) return 0;
+    *data = m->data;
+    *len = m->len;
+    return 1;
+}
+
+static void io_mmap_advise(JanetMmap *m, const uint8_t *advice) {
+#ifdef JANET_WINDOWS
+    (void) m;
+    if (!janet_cstrcmp(advice, "normal") || !janet_cstrcmp(advice, "sequential") ||
+            !janet_cstrcmp(advice, "random") || !janet_cstrcmp(advice, "willneed")) {
+        return;
+    }
+#else
+    int flag;
+    if (!janet_cstrcmp(advice, "normal")) {
+        flag = POSIX_MADV_NORMAL;
+    } else if (!janet_cstrcmp(advice, "sequential")) {
+        flag = POSIX_MADV_SEQUENTIAL;
+    } else if (!janet_cstrcmp(advice, "random")) {
+        flag = POSIX_MADV_RANDOM;
+    } else if (!janet_cstrcmp(advice, "willneed")) {
+        flag = POSIX_MADV_WILLNEED;
+    } else {
+        janet_panicf("expected one of :normal, :sequential, :random, :willneed, got :%S", advice);
+    }
+    /* Advice is only a hint, so ignore failures */
+    if (NULL != m->base) posix_madvise(m->base, m->maplen, flag);
+    return;
+#endif
+    janet_panicf("expected one of :normal, :sequential, :random, :willneed, got :%S", advice);
+}
+
+static Janet cfun_io_mmap(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 4);
+    const char *path = janet_getcstring(argv, 0);
+    int64_t offset = 0;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        offset = janet_getinteger64(argv, 1);
+        if (offset < 0) janet_panic("expected non-negative offset");
+    }
+    int64_t length = -1;
+    if (argc > 2 && !janet_checktype(argv[2], JANET_NIL)) {
+        length = janet_getinteger64(argv, 2);
+        if (length < 0) janet_panic("expected non-negative length");
+    }
+    const uint8_t *advice = NULL;
+    if (argc > 3 && !janet_checktype(argv[3], JANET_NIL)) {
+        advice = janet_getkeyword(argv, 3);
+    }
+    JanetMmap *m = janet_abstract(&janet_mmap_type, sizeof(JanetMmap));
+    m->data = (const uint8_t *) "";
+    m->len = 0;
+    m->base = NULL;
+    m->maplen = 0;
+#ifdef JANET_WINDOWS
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) janet_panicf("could not open file %s: %s", path, strerror(errno));
+    _fseeki64(f, 0, SEEK_END);
+    int64_t fsize = _ftelli64(f);
+#else
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) janet_panicf("could not open file %s: %s", path, strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        janet_panicf("could not stat file %s: %s", path, strerror(errno));
+    }
+    int64_t fsize = (int64_t) st.st_size;
+#endif
+    if (offset > fsize) offset = fsize;
+    if (length < 0 || length > fsize - offset) length = fsize - offset;
+    if (length > INT32_MAX) {
+#ifdef JANET_WINDOWS
+        fclose(f);
+#else
+        close(fd);
+#endif
+        janet_panicf("cannot map %v bytes at once, map the file in pieces with offset and length",
+                     janet_wrap_number((double) length));
+    }
+    if (length > 0) {
+#ifdef JANET_WINDOWS
+        uint8_t *bytes = janet_malloc((size_t) length);
+        if (NULL == bytes) {
+            JANET_OUT_OF_MEMORY;
+        }
+        _fseeki64(f, offset, SEEK_SET);
+        size_t nread = fread(bytes, 1, (size_t) length, f);
+        fclose(f);
+        if (nread != (size_t) length) {
+            janet_free(bytes);
+            janet_panicf("could not read file %s", path);
+        }
+        m->base = bytes;
+        m->maplen = (size_t) length;
+        m->data = bytes;
+#else
+        /* mmap offsets must be page aligned */
+        int64_t page = (int64_t) sysconf(_SC_PAGESIZE);
+        int64_t skip = offset % page;
+        size_t maplen = (size_t)(length + skip);
+        void *base = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, (off_t)(offset - skip));
+        close(fd);
+        if (base == MAP_FAILED) janet_panicf("could not map file %s: %s", path, strerror(errno));
+        m->base = base;
+        m->maplen = maplen;
+        m->data = (const uint8_t *) base + skip;
+#endif
+        m->len = (int32_t) length;
+    } else {
+#ifdef JANET_WINDOWS
+        fclose(f);
+#else
+        close(fd);
+#endif
+    }
+    if (NULL != advice) io_mmap_advise(m, advice);
+    return janet_wrap_abstract(m);
+}
+
+static Janet cfun_io_mmap_close(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetMmap *m = janet_getabstract(argv, 0, &janet_mmap_type);
+    io_mmap_release(m);
+    return janet_wrap_nil();
+}
+
+static Janet cfun_io_mmap_advise(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 2);
+    JanetMmap *m = janet_getabstract(argv, 0, &janet_mmap_type);
+    io_mmap_advise(m, janet_getkeyword(argv, 1));
+    return argv[0];
+}
+
+static Janet cfun_io_mmap_length(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetMmap *m = janet_getabstract(argv, 0, &janet_mmap_type);
+    return janet_wrap_integer(m->len);
+}
+
 static const JanetReg io_cfuns[] = {
     {
         "print", cfun_io_print,
@@ -794,6 +1027,23 @@ static const JanetReg io_cfuns[] = {
              "for the relative number of bytes to seek in the file. `n` may be a real "
              "number to handle large files of more than 4GB. Returns the file handle.")
     },
+    {
+        "file/mmap", cfun_io_mmap,
+        JDOC("(file/mmap path &opt offset length advice)\n\n"
+             "Map a file into memory read only and return it as a core/mmap. The mapping "
+             "can be passed to any function that takes a string or buffer, such as "
+             "string/find, peg/match, buffer/slice or unmarshal, and those read the "
+             "mapped pages directly without copying the file. `offset` and `length` "
+             "select part of the file, by default all of it from `offset`. A mapping is "
+             "at most 2GB, so map larger files in pieces. `advice` hints how the "
+             "mapping will be read:\n\n"
+             "* :normal - no special treatment\n\n"
+             "* :sequential - read ahead aggressively\n\n"
+             "* :random - do not read ahead\n\n"
+             "* :willneed - start loading the mapping now\n\n"
+             "The mapping has the methods :advise, :length and :close. It is unmapped "
+             "when closed or garbage collected. On Windows the file is read into memory instead.")
+    },
 #ifndef JANET_NO_PROCESSES
     {
         "file/popen", cfun_io_popen,
@@ -841,6 +1091,7 @@ FILE *janet_unwrapfile(Janet j, int *flags) {
 void janet_lib_io(JanetTable *env) {
     janet_core_cfuns(env, NULL, io_cfuns);
     janet_register_abstract_type(&janet_file_type);
+    janet_register_abstract_type(&janet_mmap_type);
     int default_flags = JANET_FILE_NOT_CLOSEABLE | JANET_FILE_SERIALIZABLE;
     /* stdout */
     janet_core_def(env, "stdout",
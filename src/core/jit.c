@@ -0,0 +1,509 @@
+/*
+* Copyright (c) 2020 Calvin Rose
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "util.h"
+#include "vector.h"
+#endif
+
+#ifdef JANET_JIT
+
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+ * Baseline JIT for x86-64 (System V)
+ *
+ * Each instruction of a hot funcdef gets a small stub of machine code that
+ * works directly on the Janet stack, which is passed in rdi (the current
+ * function is in rdx). Stubs follow
+ * each other in bytecode order, so every instruction boundary is also an
+ * entry point. Only instructions that cannot allocate, call, or signal are
+ * translated. Everything else, as well as a type guard that fails, leaves
+ * native code by returning the index of the instruction. The interpreter
+ * then resumes at that instruction and runs it itself, so native code never
+ * needs to know about garbage collection, errors, or the debugger.
+ *
+ * Janet values in slots are used as raw doubles. A value that is a NaN is
+ * not a plain number (or is a NaN number), so guards simply check for
+ * unordered comparisons and bail out to the interpreter.
+ */
+
+/* Emitted code jumps to `target` and returns an instruction index. */
+typedef int32_t (*JanetJitFn)(Janet *stack, const uint8_t *target, JanetFunction *func);
+
+typedef struct {
+    int32_t at; /* Offset of the rel32 to patch */
+    int32_t index; /* Target instruction */
+} JitPatch;
+
+typedef struct {
+    JanetBuffer buf;
+    JanetFuncDef *def;
+    int32_t index; /* Instruction being emitted */
+    JitPatch *jumps; /* Jumps to other instructions */
+    JitPatch *exits; /* Guards that exit to the interpreter */
+} JitState;
+
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_XMM0 0
+#define JIT_XMM1 1
+
+static void jit_bytes(JitState *st, const char *bytes, int32_t n) {
+    janet_buffer_push_bytes(&st->buf, (const uint8_t *) bytes, n);
+}
+
+static void jit_u8(JitState *st, uint8_t x) {
+    janet_buffer_push_u8(&st->buf, x);
+}
+
+static void jit_u32(JitState *st, uint32_t x) {
+    janet_buffer_push_u32(&st->buf, x);
+}
+
+/* Leave native code at instruction index */
+static void jit_exit(JitState *st, int32_t index) {
+    jit_u8(st, 0xB8); /* mov eax, imm32 */
+    jit_u32(st, (uint32_t) index);
+    jit_u8(st, 0xC3); /* ret */
+}
+
+/* Emit rel32 placeholders */
+static void jit_rel32(JitState *st, JitPatch **list, int32_t index) {
+    JitPatch p;
+    p.at = st->buf.count;
+    p.index = index;
+    janet_v_push(*list, p);
+    jit_u32(st, 0);
+}
+
+static void jit_jmp(JitState *st, int32_t index) {
+    jit_u8(st, 0xE9); /* jmp rel32 */
+    jit_rel32(st, &st->jumps, index);
+}
+
+static void jit_jcc(JitState *st, uint8_t cc, int32_t index) {
+    jit_u8(st, 0x0F); /* jcc rel32 */
+    jit_u8(st, 0x80 | cc);
+    jit_rel32(st, &st->jumps, index);
+}
+
+/* Condition codes */
+#define JIT_CC_B 0x2
+#define JIT_CC_AE 0x3
+#define JIT_CC_E 0x4
+#define JIT_CC_NE 0x5
+#define JIT_CC_BE 0x6
+#define JIT_CC_A 0x7
+#define JIT_CC_P 0xA
+
+/* ModRM for [rdi + disp32] */
+static void jit_slot(JitState *st, int reg, int32_t slot) {
+    jit_u8(st, 0x87 | (reg << 3));
+    jit_u32(st, (uint32_t)(slot * 8));
+}
+
+/* movsd xmm, [rdi + 8 * slot] */
+static void jit_load_xmm(JitState *st, int xmm, int32_t slot) {
+    jit_bytes(st, "\xF2\x0F\x10", 3);
+    jit_slot(st, xmm, slot);
+}
+
+/* movsd [rdi + 8 * slot], xmm */
+static void jit_store_xmm(JitState *st, int xmm, int32_t slot) {
+    jit_bytes(st, "\xF2\x0F\x11", 3);
+    jit_slot(st, xmm, slot);
+}
+
+/* mov reg, [rdi + 8 * slot] */
+static void jit_load(JitState *st, int reg, int32_t slot) {
+    jit_bytes(st, "\x48\x8B", 2);
+    jit_slot(st, reg, slot);
+}
+
+/* mov [rdi + 8 * slot], reg */
+static void jit_store(JitState *st, int reg, int32_t slot) {
+    jit_bytes(st, "\x48\x89", 2);
+    jit_slot(st, reg, slot);
+}
+
+/* mov reg, imm64 */
+static void jit_imm64(JitState *st, int reg, uint64_t x) {
+    jit_u8(st, 0x48);
+    jit_u8(st, 0xB8 | reg);
+    janet_buffer_push_u64(&st->buf, x);
+}
+
+/* stack[slot] = x */
+static void jit_store_value(JitState *st, int32_t slot, Janet x) {
+    jit_imm64(st, JIT_RAX, janet_u64(x));
+    jit_store(st, JIT_RAX, slot);
+}
+
+/* Load a slot as a number, exiting if it is a NaN */
+static void jit_load_number(JitState *st, int xmm, int32_t slot) {
+    jit_load_xmm(st, xmm, slot);
+    jit_bytes(st, "\x66\x0F\x2E", 3); /* ucomisd xmm, xmm */
+    jit_u8(st, 0xC0 | (xmm << 3) | xmm);
+    jit_u8(st, 0x0F); /* jp exit */
+    jit_u8(st, 0x80 | JIT_CC_P);
+    jit_rel32(st, &st->exits, st->index);
+}
+
+/* xmm1 = (double) x */
+static void jit_load_immediate(JitState *st, int32_t x) {
+    jit_imm64(st, JIT_RAX, janet_u64(janet_wrap_number((double) x)));
+    jit_bytes(st, "\x66\x48\x0F\x6E\xC8", 5); /* movq xmm1, rax */
+}
+
+/* xmm0 = xmm0 op xmm1, where op is the second opcode byte of the sse2 instruction */
+static void jit_arith(JitState *st, uint8_t op) {
+    jit_bytes(st, "\xF2\x0F", 2);
+    jit_u8(st, op);
+    jit_u8(st, 0xC1);
+}
+
+/* stack[slot] = janet_wrap_boolean(xmm0 cc xmm1) */
+static void jit_compare(JitState *st, uint8_t cc, int32_t slot) {
+    jit_bytes(st, "\x66\x0F\x2E\xC1", 4); /* ucomisd xmm0, xmm1 */
+    jit_u8(st, 0x0F); /* setcc al */
+    jit_u8(st, 0x90 | cc);
+    jit_u8(st, 0xC0);
+    jit_bytes(st, "\x0F\xB6\xC0", 3); /* movzx eax, al */
+    jit_imm64(st, JIT_RCX, janet_u64(janet_wrap_false()));
+    jit_bytes(st, "\x48\x09\xC8", 3); /* or rax, rcx */
+    jit_store(st, JIT_RAX, slot);
+}
+
+/* Load the tag of a slot into ecx and its bits into rax */
+static void jit_load_tag(JitState *st, int32_t slot) {
+    jit_load(st, JIT_RAX, slot);
+    jit_bytes(st, "\x48\x89\xC1", 3); /* mov rcx, rax */
+    jit_bytes(st, "\x48\xC1\xE9\x2F", 4); /* shr rcx, 47 */
+}
+
+/* cmp ecx, lowtag */
+static void jit_cmp_tag(JitState *st, JanetType type) {
+    jit_bytes(st, "\x81\xF9", 2);
+    jit_u32(st, (uint32_t) janet_nanbox_lowtag(type));
+}
+
+/* Jump to index if rax/ecx (see jit_load_tag) hold a truthy value, or
+ * to index if not truthy when truthy is 0. Falls through otherwise. */
+static void jit_branch_truthy(JitState *st, int32_t index, int truthy) {
+    int32_t next = st->index + 1;
+    jit_cmp_tag(st, JANET_NIL);
+    jit_jcc(st, JIT_CC_E, truthy ? next : index);
+    jit_cmp_tag(st, JANET_BOOLEAN);
+    jit_jcc(st, JIT_CC_NE, truthy ? index : next);
+    jit_bytes(st, "\xA8\x01", 2); /* test al, 1 */
+    jit_jcc(st, truthy ? JIT_CC_NE : JIT_CC_E, index);
+}
+
+#define SSE_ADD 0x58
+#define SSE_MUL 0x59
+#define SSE_SUB 0x5C
+#define SSE_DIV 0x5E
+
+/* Emit the stub for one instruction. Returns 0 if the instruction
+ * only exits to the interpreter. */
+static int jit_instruction(JitState *st, uint32_t instr) {
+    int32_t i = st->index;
+    int32_t a = (instr >> 8) & 0xFF;
+    int32_t b = (instr >> 16) & 0xFF;
+    int32_t c = instr >> 24;
+    int32_t d = instr >> 8;
+    int32_t e = instr >> 16;
+    int32_t cs = ((int32_t) instr) >> 24;
+    int32_t ds = ((int32_t) instr) >> 8;
+    int32_t es = ((int32_t) instr) >> 16;
+    uint8_t op = 0, cc = 0;
+    switch (instr & 0xFF) {
+        default:
+            jit_exit(st, i);
+            return 0;
+        case JOP_NOOP:
+            break;
+        case JOP_LOAD_NIL:
+            jit_store_value(st, d, janet_wrap_nil());
+            break;
+        case JOP_LOAD_TRUE:
+            jit_store_value(st, d, janet_wrap_true());
+            break;
+        case JOP_LOAD_FALSE:
+            jit_store_value(st, d, janet_wrap_false());
+            break;
+        case JOP_LOAD_SELF:
+            jit_imm64(st, JIT_RAX, janet_nanbox_tag(JANET_FUNCTION));
+            jit_bytes(st, "\x48\x09\xD0", 3); /* or rax, rdx */
+            jit_store(st, JIT_RAX, d);
+            break;
+        case JOP_LOAD_INTEGER:
+            jit_store_value(st, a, janet_wrap_integer(es));
+            break;
+        case JOP_LOAD_CONSTANT:
+            if (e >= st->def->constants_length) {
+                jit_exit(st, i);
+                return 0;
+            }
+            jit_store_value(st, a, st->def->constants[e]);
+            break;
+        case JOP_MOVE_NEAR:
+            jit_load(st, JIT_RAX, e);
+            jit_store(st, JIT_RAX, a);
+            break;
+        case JOP_MOVE_FAR:
+            jit_load(st, JIT_RAX, a);
+            jit_store(st, JIT_RAX, e);
+            break;
+        case JOP_JUMP:
+            jit_jmp(st, i + ds);
+            break;
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+            jit_load_tag(st, a);
+            jit_branch_truthy(st, i + es, (instr & 0xFF) == JOP_JUMP_IF);
+            break;
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+            jit_load_tag(st, a);
+            jit_cmp_tag(st, JANET_NIL);
+            jit_jcc(st, (instr & 0xFF) == JOP_JUMP_IF_NIL ? JIT_CC_E : JIT_CC_NE, i + es);
+            break;
+
+        /* Arithmetic */
+        case JOP_ADD:
+            op = SSE_ADD;
+            goto binop;
+        case JOP_SUBTRACT:
+            op = SSE_SUB;
+            goto binop;
+        case JOP_MULTIPLY:
+            op = SSE_MUL;
+            goto binop;
+        case JOP_DIVIDE:
+            op = SSE_DIV;
+        binop:
+            jit_load_number(st, JIT_XMM0, b);
+            jit_load_number(st, JIT_XMM1, c);
+            jit_arith(st, op);
+            jit_store_xmm(st, JIT_XMM0, a);
+            break;
+        /* Operands already proven to be numbers */
+        case JOP_ADD_NUMBER:
+            op = SSE_ADD;
+            goto numop;
+        case JOP_SUBTRACT_NUMBER:
+            op = SSE_SUB;
+            goto numop;
+        case JOP_MULTIPLY_NUMBER:
+            op = SSE_MUL;
+            goto numop;
+        case JOP_DIVIDE_NUMBER:
+            op = SSE_DIV;
+        numop:
+            jit_load_xmm(st, JIT_XMM0, b);
+            jit_load_xmm(st, JIT_XMM1, c);
+            jit_arith(st, op);
+            jit_store_xmm(st, JIT_XMM0, a);
+            break;
+        /* The jump after addimj is a separate stub */
+        case JOP_ADD_IMMEDIATE:
+        case JOP_ADD_IMMEDIATE_JUMP:
+            op = SSE_ADD;
+            goto binop_imm;
+        case JOP_MULTIPLY_IMMEDIATE:
+            op = SSE_MUL;
+            goto binop_imm;
+        case JOP_DIVIDE_IMMEDIATE:
+            op = SSE_DIV;
+        binop_imm:
+            jit_load_number(st, JIT_XMM0, b);
+            jit_load_immediate(st, cs);
+            jit_arith(st, op);
+            jit_store_xmm(st, JIT_XMM0, a);
+            break;
+
+        /* Comparisons. The fused compare and branch superinstructions
+         * are emitted as plain comparisons, the branch after them is a
+         * separate stub. */
+        case JOP_LESS_THAN:
+        case JOP_LESS_THAN_JUMP:
+            cc = JIT_CC_B;
+            goto compop;
+        case JOP_LESS_THAN_EQUAL:
+        case JOP_LESS_THAN_EQUAL_JUMP:
+            cc = JIT_CC_BE;
+            goto compop;
+        case JOP_GREATER_THAN:
+        case JOP_GREATER_THAN_JUMP:
+            cc = JIT_CC_A;
+            goto compop;
+        case JOP_GREATER_THAN_EQUAL:
+        case JOP_GREATER_THAN_EQUAL_JUMP:
+            cc = JIT_CC_AE;
+            goto compop;
+        case JOP_EQUALS:
+            cc = JIT_CC_E;
+            goto compop;
+        case JOP_NOT_EQUALS:
+            cc = JIT_CC_NE;
+        compop:
+            jit_load_number(st, JIT_XMM0, b);
+            jit_load_number(st, JIT_XMM1, c);
+            jit_compare(st, cc, a);
+            break;
+        case JOP_LESS_THAN_IMMEDIATE:
+        case JOP_LESS_THAN_IMMEDIATE_JUMP:
+            cc = JIT_CC_B;
+            goto compop_imm;
+        case JOP_GREATER_THAN_IMMEDIATE:
+        case JOP_GREATER_THAN_IMMEDIATE_JUMP:
+            cc = JIT_CC_A;
+            goto compop_imm;
+        case JOP_EQUALS_IMMEDIATE:
+            cc = JIT_CC_E;
+            goto compop_imm;
+        case JOP_NOT_EQUALS_IMMEDIATE:
+            cc = JIT_CC_NE;
+        compop_imm:
+            jit_load_number(st, JIT_XMM0, b);
+            jit_load_immediate(st, cs);
+            jit_compare(st, cc, a);
+            break;
+    }
+    return 1;
+}
+
+static void jit_patch(JitState *st, JitPatch p, int32_t target) {
+    uint32_t rel = (uint32_t)(target - (p.at + 4));
+    st->buf.data[p.at] = rel & 0xFF;
+    st->buf.data[p.at + 1] = (rel >> 8) & 0xFF;
+    st->buf.data[p.at + 2] = (rel >> 16) & 0xFF;
+    st->buf.data[p.at + 3] = (rel >> 24) & 0xFF;
+}
+
+/* Translate a funcdef to native code. Leaves def->jit as NULL if
+ * the function cannot or should not be translated. */
+void janet_jit_compile(JanetFuncDef *def) {
+    if (NULL != def->jit || NULL == def->bytecode || def->bytecode_length == 0) return;
+    int32_t len = def->bytecode_length;
+
+    /* Breakpoints must be seen by the interpreter */
+    for (int32_t i = 0; i < len; i++) {
+        if (def->bytecode[i] & 0x80) return;
+    }
+
+    JitState st;
+    st.def = def;
+    st.jumps = NULL;
+    st.exits = NULL;
+    janet_buffer_init(&st.buf, 32 * len);
+    int32_t *labels = janet_malloc(sizeof(int32_t) * 2 * ((size_t) len + 1));
+    if (NULL == labels) {
+        JANET_OUT_OF_MEMORY;
+    }
+    int32_t *exit_labels = labels + len + 1;
+    int32_t translated = 0;
+
+    jit_bytes(&st, "\xFF\xE6", 2); /* jmp rsi */
+    for (int32_t i = 0; i < len; i++) {
+        st.index = i;
+        labels[i] = st.buf.count;
+        exit_labels[i] = -1;
+        if (jit_instruction(&st, def->bytecode[i])) {
+            translated++;
+        } else {
+            labels[i] = -labels[i] - 1;
+        }
+    }
+    labels[len] = st.buf.count;
+    jit_bytes(&st, "\x0F\x0B", 2); /* ud2, verified bytecode never gets here */
+
+    /* Shared exit stubs for guards */
+    for (int32_t i = 0; i < janet_v_count(st.exits); i++) {
+        JitPatch p = st.exits[i];
+        if (exit_labels[p.index] < 0) {
+            exit_labels[p.index] = st.buf.count;
+            jit_exit(&st, p.index);
+        }
+        jit_patch(&st, p, exit_labels[p.index]);
+    }
+    for (int32_t i = 0; i < janet_v_count(st.jumps); i++) {
+        JitPatch p = st.jumps[i];
+        int32_t target = labels[p.index];
+        jit_patch(&st, p, target < 0 ? -target - 1 : target);
+    }
+
+    /* Nothing to gain if no instruction leaves the interpreter */
+    if (translated > 0) {
+        size_t size = (size_t) st.buf.count;
+        void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED) {
+            memcpy(mem, st.buf.data, size);
+            if (mprotect(mem, size, PROT_READ | PROT_EXEC)) {
+                munmap(mem, size);
+            } else {
+                JanetJit *jit = janet_malloc(sizeof(JanetJit) + sizeof(int32_t) * (size_t) len);
+                if (NULL == jit) {
+                    JANET_OUT_OF_MEMORY;
+                }
+                jit->code = mem;
+                jit->size = size;
+                for (int32_t i = 0; i < len; i++) {
+                    jit->entry[i] = labels[i] < 0 ? -1 : labels[i];
+                }
+                def->jit = jit;
+            }
+        }
+    }
+
+    janet_free(labels);
+    janet_v_free(st.jumps);
+    janet_v_free(st.exits);
+    janet_buffer_deinit(&st.buf);
+}
+
+/* Drop native code, for example when bytecode changes. */
+void janet_jit_free(JanetFuncDef *def) {
+    JanetJit *jit = def->jit;
+    def->hotness = 0;
+    if (NULL == jit) return;
+    munmap(jit->code, jit->size);
+    janet_free(jit);
+    def->jit = NULL;
+}
+
+/* Run native code starting at instruction index at, which must have
+ * an entry. Returns the index of the instruction the interpreter
+ * should continue with. */
+int32_t janet_jit_run(JanetJit *jit, Janet *stack, JanetFunction *func, int32_t at) {
+    JanetJitFn fn;
+    void *code = jit->code;
+    memcpy(&fn, &code, sizeof(fn));
+    return fn(stack, jit->code + jit->entry[at], func);
+}
+
+#endif
@@ -0,0 +1,572 @@
+/*
+* Copyright (c) 2021 Calvin Rose & contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "util.h"
+#endif
+
+#include <string.h>
+#include <math.h>
+
+/* Conditional compilation */
+#ifdef JANET_JSON
+
+/* JSON encoding and decoding. Both directions work in a single pass over
+ * the input. The decoder builds values straight from the source bytes, and
+ * strings without escapes are copied once into their final Janet string.
+ * The encoder writes directly into a buffer.
+ *
+ * The inner loops over string contents look at 8 bytes at a time, and only
+ * drop to a byte at a time loop in words that contain a byte needing
+ * attention (quotes, backslashes, control characters, and non ASCII bytes
+ * when encoding). */
+
+#define JSON_ONES 0x0101010101010101ULL
+#define JSON_HIGHS 0x8080808080808080ULL
+
+static uint64_t json_load8(const uint8_t *p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/* Non zero if any byte of w is '"', '\\' or below 0x20 */
+static uint64_t json_special8(uint64_t w) {
+    uint64_t q = w ^ (JSON_ONES * '"');
+    uint64_t s = w ^ (JSON_ONES * '\\');
+    return (((w - JSON_ONES * 0x20) & ~w) |
+            ((q - JSON_ONES) & ~q) |
+            ((s - JSON_ONES) & ~s)) & JSON_HIGHS;
+}
+
+/*
+ * Decoding
+ */
+
+typedef struct {
+    const uint8_t *start;
+    const uint8_t *p;
+    const uint8_t *end;
+    int keywords;
+    int nils;
+    JanetBuffer *scratch;
+} JsonDecoder;
+
+static void json_error(JsonDecoder *d, const char *msg) {
+    janet_panicf("json: %s at byte %d", msg, (int32_t)(d->p - d->start));
+}
+
+static void json_skip_ws(JsonDecoder *d) {
+    const uint8_t *p = d->p;
+    while (p < d->end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    d->p = p;
+}
+
+static int json_hex4(JsonDecoder *d, const uint8_t *p) {
+    int code = 0;
+    if (d->end - p < 4) json_error(d, "bad unicode escape");
+    for (int i = 0; i < 4; i++) {
+        uint8_t c = p[i];
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else {
+            json_error(d, "bad unicode escape");
+            digit = 0;
+        }
+        code = (code << 4) | digit;
+    }
+    return code;
+}
+
+static void json_push_utf8(JanetBuffer *b, uint32_t code) {
+    uint8_t bytes[4];
+    int32_t n;
+    if (code < 0x80) {
+        bytes[0] = (uint8_t) code;
+        n = 1;
+    } else if (code < 0x800) {
+        bytes[0] = (uint8_t)(0xC0 | (code >> 6));
+        bytes[1] = (uint8_t)(0x80 | (code & 0x3F));
+        n = 2;
+    } else if (code < 0x10000) {
+        bytes[0] = (uint8_t)(0xE0 | (code >> 12));
+        bytes[1] = (uint8_t)(0x80 | ((code >> 6) & 0x3F));
+        bytes[2] = (uint8_t)(0x80 | (code & 0x3F));
+        n = 3;
+    } else {
+        bytes[0] = (uint8_t)(0xF0 | (code >> 18));
+        bytes[1] = (uint8_t)(0x80 | ((code >> 12) & 0x3F));
+        bytes[2] = (uint8_t)(0x80 | ((code >> 6) & 0x3F));
+        bytes[3] = (uint8_t)(0x80 | (code & 0x3F));
+        n = 4;
+    }
+    janet_buffer_push_bytes(b, bytes, n);
+}
+
+/* Decode a string. d->p is just past the opening quote. */
+static Janet json_decode_string(JsonDecoder *d, int as_keyword) {
+    const uint8_t *p = d->p;
+    const uint8_t *end = d->end;
+    const uint8_t *run = p;
+    JanetBuffer *b = NULL;
+    for (;;) {
+        while (end - p >= 8 && !json_special8(json_load8(p))) p += 8;
+        while (p < end && *p != '"' && *p != '\\' && *p >= 0x20) p++;
+        if (p >= end) {
+            d->p = p;
+            json_error(d, "unterminated string");
+        }
+        if (*p == '"') break;
+        if (*p < 0x20) {
+            d->p = p;
+            json_error(d, "control character in string");
+        }
+        /* Escape sequence */
+        if (NULL == b) {
+            b = d->scratch;
+            b->count = 0;
+        }
+        janet_buffer_push_bytes(b, run, (int32_t)(p - run));
+        if (end - p < 2) {
+            d->p = p;
+            json_error(d, "unterminated string");
+        }
+        uint8_t c = p[1];
+        p += 2;
+        switch (c) {
+            case '"':
+            case '\\':
+            case '/':
+                janet_buffer_push_u8(b, c);
+                break;
+            case 'b':
+                janet_buffer_push_u8(b, '\b');
+                break;
+            case 'f':
+                janet_buffer_push_u8(b, '\f');
+                break;
+            case 'n':
+                janet_buffer_push_u8(b, '\n');
+                break;
+            case 'r':
+                janet_buffer_push_u8(b, '\r');
+                break;
+            case 't':
+                janet_buffer_push_u8(b, '\t');
+                break;
+            case 'u': {
+                d->p = p;
+                uint32_t code = (uint32_t) json_hex4(d, p);
+                p += 4;
+                if (code >= 0xD800 && code <= 0xDFFF) {
+                    /* Surrogates only encode characters in pairs, and can't be UTF-8 on their own */
+                    uint32_t low = 0;
+                    if (code <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                        d->p = p + 2;
+                        low = (uint32_t) json_hex4(d, p + 2);
+                    }
+                    if (low < 0xDC00 || low > 0xDFFF) {
+                        d->p = p - 6;
+                        json_error(d, "unpaired surrogate");
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+                json_push_utf8(b, code);
+                break;
+            }
+            default:
+                d->p = p - 2;
+                json_error(d, "bad escape");
+        }
+        run = p;
+    }
+    d->p = p + 1;
+    const uint8_t *bytes = run;
+    int32_t len = (int32_t)(p - run);
+    if (NULL != b) {
+        janet_buffer_push_bytes(b, run, len);
+        bytes = b->data;
+        len = b->count;
+    }
+    return as_keyword
+           ? janet_keywordv(bytes, len)
+           : janet_stringv(bytes, len);
+}
+
+static Janet json_decode_number(JsonDecoder *d) {
+    const uint8_t *start = d->p;
+    const uint8_t *p = start;
+    const uint8_t *end = d->end;
+    int negative = 0;
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    const uint8_t *digits = p;
+    if (p < end && *p == '0') {
+        p++;
+    } else {
+        while (p < end && *p >= '0' && *p <= '9') p++;
+    }
+    if (p == digits) json_error(d, "bad number");
+    int is_integer = 1;
+    if (p < end && *p == '.') {
+        is_integer = 0;
+        const uint8_t *frac = ++p;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+        if (p == frac) {
+            d->p = p;
+            json_error(d, "bad number");
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        is_integer = 0;
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        const uint8_t *exp = p;
+        while (p < end && *p >= '0' && *p <= '9') p++;
+        if (p == exp) {
+            d->p = p;
+            json_error(d, "bad number");
+        }
+    }
+    d->p = p;
+    /* Integers of up to 15 digits are exact as doubles */
+    if (is_integer && p - digits <= 15) {
+        int64_t x = 0;
+        for (const uint8_t *c = digits; c < p; c++) x = x * 10 + (*c - '0');
+        return janet_wrap_number(negative ? -(double) x : (double) x);
+    }
+    double x;
+    if (janet_scan_number(start, (int32_t)(p - start), &x)) {
+        d->p = start;
+        json_error(d, "bad number");
+    }
+    return janet_wrap_number(x);
+}
+
+static void json_expect(JsonDecoder *d, const char *word, int32_t len) {
+    if (d->end - d->p < len || memcmp(d->p, word, len)) json_error(d, "unexpected character");
+    d->p += len;
+}
+
+static Janet json_decode_value(JsonDecoder *d, int depth) {
+    if (--depth == 0) json_error(d, "nested too deeply");
+    json_skip_ws(d);
+    if (d->p >= d->end) json_error(d, "unexpected end of input");
+    switch (*d->p) {
+        case '{': {
+            JanetTable *t = janet_table(0);
+            d->p++;
+            json_skip_ws(d);
+            if (d->p < d->end && *d->p == '}') {
+                d->p++;
+                return janet_wrap_table(t);
+            }
+            for (;;) {
+                json_skip_ws(d);
+                if (d->p >= d->end || *d->p != '"') json_error(d, "expected string key");
+                d->p++;
+                Janet key = json_decode_string(d, d->keywords);
+                json_skip_ws(d);
+                if (d->p >= d->end || *d->p != ':') json_error(d, "expected ':'");
+                d->p++;
+                Janet value = json_decode_value(d, depth);
+                janet_table_put(t, key, value);
+                json_skip_ws(d);
+                if (d->p < d->end && *d->p == ',') {
+                    d->p++;
+                } else if (d->p < d->end && *d->p == '}') {
+                    d->p++;
+                    break;
+                } else {
+                    json_error(d, "expected ',' or '}'");
+                }
+            }
+            return janet_wrap_table(t);
+        }
+        case '[': {
+            JanetArray *a = janet_array(0);
+            d->p++;
+            json_skip_ws(d);
+            if (d->p < d->end && *d->p == ']') {
+                d->p++;
+                return janet_wrap_array(a);
+            }
+            for (;;) {
+                janet_array_push(a, json_decode_value(d, depth));
+                json_skip_ws(d);
+                if (d->p < d->end && *d->p == ',') {
+                    d->p++;
+                } else if (d->p < d->end && *d->p == ']') {
+                    d->p++;
+                    break;
+                } else {
+                    json_error(d, "expected ',' or ']'");
+                }
+            }
+            return janet_wrap_array(a);
+        }
+        case '"':
+            d->p++;
+            return json_decode_string(d, 0);
+        case 't':
+            json_expect(d, "true", 4);
+            return janet_wrap_true();
+        case 'f':
+            json_expect(d, "false", 5);
+            return janet_wrap_false();
+        case 'n':
+            json_expect(d, "null", 4);
+            return d->nils ? janet_wrap_nil() : janet_ckeywordv("null");
+        default:
+            if (*d->p != '-' && (*d->p < '0' || *d->p > '9')) json_error(d, "unexpected character");
+            return json_decode_number(d);
+    }
+}
+
+static Janet cfun_json_decode(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 3);
+    JanetByteView bytes = janet_getbytes(argv, 0);
+    JsonDecoder d;
+    d.start = bytes.bytes;
+    d.p = bytes.bytes;
+    d.end = bytes.bytes + bytes.len;
+    d.keywords = janet_optboolean(argv, argc, 1, 0);
+    d.nils = janet_optboolean(argv, argc, 2, 0);
+    d.scratch = janet_buffer(0);
+    Janet ret = json_decode_value(&d, JANET_RECURSION_GUARD);
+    json_skip_ws(&d);
+    if (d.p != d.end) json_error(&d, "unexpected character after value");
+    return ret;
+}
+
+/*
+ * Encoding
+ */
+
+/* Length of the UTF-8 sequence at p, or 0 if it is not valid */
+static int32_t json_utf8_len(const uint8_t *p, const uint8_t *end) {
+    uint8_t c = p[0];
+    int32_t n;
+    uint32_t code;
+    if (c < 0xC2) return 0;
+    if (c < 0xE0) {
+        n = 2;
+        code = c & 0x1F;
+    } else if (c < 0xF0) {
+        n = 3;
+        code = c & 0x0F;
+    } else if (c < 0xF5) {
+        n = 4;
+        code = c & 0x07;
+    } else {
+        return 0;
+    }
+    if (end - p < n) return 0;
+    for (int32_t i = 1; i < n; i++) {
+        if ((p[i] & 0xC0) != 0x80) return 0;
+        code = (code << 6) | (p[i] & 0x3F);
+    }
+    /* Reject overlong forms, surrogates and values past U+10FFFF */
+    if ((n == 3 && code < 0x800) || (n == 4 && code < 0x10000)) return 0;
+    if ((code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF) return 0;
+    return n;
+}
+
+static void json_encode_string(JanetBuffer *b, const uint8_t *str, int32_t len) {
+    static const char hex[] = "0123456789abcdef";
+    const uint8_t *p = str;
+    const uint8_t *end = str + len;
+    const uint8_t *run = str;
+    janet_buffer_extra(b, len + 2);
+    janet_buffer_push_u8(b, '"');
+    for (;;) {
+        while (end - p >= 8) {
+            uint64_t w = json_load8(p);
+            if (json_special8(w) | (w & JSON_HIGHS)) break;
+            p += 8;
+        }
+        while (p < end && *p != '"' && *p != '\\' && *p >= 0x20 && *p < 0x80) p++;
+        if (p >= end) break;
+        uint8_t c = *p;
+        if (c >= 0x80) {
+            int32_t n = json_utf8_len(p, end);
+            if (!n) janet_panicf("json: invalid utf-8 in string at byte %d", (int32_t)(p - str));
+            p += n;
+            continue;
+        }
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            p++;
+            continue;
+        }
+        janet_buffer_push_bytes(b, run, (int32_t)(p - run));
+        switch (c) {
+            case '"':
+                janet_buffer_push_bytes(b, (const uint8_t *) "\\\"", 2);
+                break;
+            case '\\':
+                janet_buffer_push_bytes(b, (const uint8_t *) "\\\\", 2);
+                break;
+            case '\n':
+                janet_buffer_push_bytes(b, (const uint8_t *) "\\n", 2);
+                break;
+            case '\r':
+                janet_buffer_push_bytes(b, (const uint8_t *) "\\r", 2);
+                break;
+            case '\t':
+                janet_buffer_push_bytes(b, (const uint8_t *) "\\t", 2);
+                break;
+            default: {
+                uint8_t esc[6] = {'\\', 'u', '0', '0', (uint8_t) hex[c >> 4], (uint8_t) hex[c & 0xF]};
+                janet_buffer_push_bytes(b, esc, 6);
+                break;
+            }
+        }
+        p++;
+        run = p;
+    }
+    janet_buffer_push_bytes(b, run, (int32_t)(end - run));
+    janet_buffer_push_u8(b, '"');
+}
+
+static void json_encode_bytes(JanetBuffer *b, Janet x) {
+    JanetByteView view;
+    janet_bytes_view(x, &view.bytes, &view.len);
+    if (janet_checktype(x, JANET_BUFFER) && janet_unwrap_buffer(x) == b)
+        janet_panic("json: cannot encode a buffer into itself");
+    json_encode_string(b, view.bytes, view.len);
+}
+
+static void json_encode_value(JanetBuffer *b, Janet x, int depth) {
+    if (--depth == 0) janet_panic("json: value nested too deeply");
+    switch (janet_type(x)) {
+        default:
+            janet_panicf("json: cannot encode %t %v", x, x);
+        case JANET_NIL:
+            janet_buffer_push_bytes(b, (const uint8_t *) "null", 4);
+            break;
+        case JANET_BOOLEAN:
+            if (janet_unwrap_boolean(x)) {
+                janet_buffer_push_bytes(b, (const uint8_t *) "true", 4);
+            } else {
+                janet_buffer_push_bytes(b, (const uint8_t *) "false", 5);
+            }
+            break;
+        case JANET_NUMBER: {
+            double d = janet_unwrap_number(x);
+            if (isnan(d) || isinf(d)) janet_panicf("json: cannot encode %v", x);
+            janet_buffer_extra(b, 32);
+            b->count += janet_double_to_shortest((char *) b->data + b->count, d);
+            break;
+        }
+        case JANET_KEYWORD:
+            /* :null is what json/decode returns for null by default */
+            if (!janet_cstrcmp(janet_unwrap_keyword(x), "null")) {
+                janet_buffer_push_bytes(b, (const uint8_t *) "null", 4);
+                break;
+            }
+        /* fallthrough */
+        case JANET_STRING:
+        case JANET_SYMBOL:
+        case JANET_BUFFER:
+            json_encode_bytes(b, x);
+            break;
+        case JANET_ARRAY:
+        case JANET_TUPLE: {
+            const Janet *items;
+            int32_t len;
+            janet_indexed_view(x, &items, &len);
+            janet_buffer_push_u8(b, '[');
+            for (int32_t i = 0; i < len; i++) {
+                if (i) janet_buffer_push_u8(b, ',');
+                json_encode_value(b, items[i], depth);
+            }
+            janet_buffer_push_u8(b, ']');
+            break;
+        }
+        case JANET_TABLE:
+        case JANET_STRUCT: {
+            const JanetKV *kvs;
+            int32_t count, cap;
+            janet_dictionary_view(x, &kvs, &count, &cap);
+            janet_buffer_push_u8(b, '{');
+            int first = 1;
+            for (int32_t i = 0; i < cap; i++) {
+                const JanetKV *kv = kvs + i;
+                if (janet_checktype(kv->key, JANET_NIL)) continue;
+                if (!janet_checktypes(kv->key, JANET_TFLAG_BYTES))
+                    janet_panicf("json: object key must be a byte sequence, got %v", kv->key);
+                if (!first) janet_buffer_push_u8(b, ',');
+                first = 0;
+                json_encode_bytes(b, kv->key);
+                janet_buffer_push_u8(b, ':');
+                json_encode_value(b, kv->value, depth);
+            }
+            janet_buffer_push_u8(b, '}');
+            break;
+        }
+    }
+}
+
+static Janet cfun_json_encode(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    JanetBuffer *b = janet_optbuffer(argv, argc, 1, 10);
+    json_encode_value(b, argv[0], JANET_RECURSION_GUARD);
+    return janet_wrap_buffer(b);
+}
+
+static const JanetReg json_cfuns[] = {
+    {
+        "json/encode", cfun_json_encode,
+        JDOC("(json/encode x &opt buf)\n\n"
+             "Encode x as JSON into the buffer buf, or a new buffer, and return the buffer. "
+             "nil, booleans, numbers, byte sequences, indexed types and dictionaries are "
+             "encoded as null, booleans, numbers, strings, arrays and objects. The keyword "
+             ":null is also encoded as null, except as a key. Dictionary keys must be byte "
+             "sequences. Strings must be valid UTF-8.")
+    },
+    {
+        "json/decode", cfun_json_decode,
+        JDOC("(json/decode text &opt keywords nils)\n\n"
+             "Decode the single JSON value in text. Objects become tables and arrays "
+             "become arrays. If keywords is truthy, object keys are keywords instead of "
+             "strings. JSON null is decoded as :null, or as nil if nils is truthy. Escaped "
+             "UTF-16 surrogates must come in pairs.")
+    },
+    {NULL, NULL, NULL}
+};
+
+/* Module entry point */
+void janet_lib_json(JanetTable *env) {
+    janet_core_cfuns(env, NULL, json_cfuns);
+}
+
+#undef JSON_ONES
+#undef JSON_HIGHS
+
+#endif
@@ -30,13 +30,22 @@
 #include "util.h"
 #endif
 
+#include <stdio.h>
+#ifndef JANET_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 typedef struct {
     JanetBuffer *buf;
-    JanetTable seen;
+    JanetTable *seen;
     JanetTable *rreg;
     JanetFuncEnv **seen_envs;
     JanetFuncDef **seen_defs;
     int32_t nextid;
+    int32_t base;
 } MarshalState;
 
 /* Lead bytes in marshaling protocol */
@@ -63,9 +72,44 @@ enum {
     LB_FUNCENV_REF, /* 219 */
     LB_FUNCDEF_REF, /* 220 */
     LB_UNSAFE_CFUNCTION, /* 221 */
-    LB_UNSAFE_POINTER /* 222 */
+    LB_UNSAFE_POINTER, /* 222 */
+    LB_MAPPED_STRING /* 223 */
 } LeadBytes;
 
+/* Mappable images lay strings out so that a string header fits right
+ * before the string data, and bytecode is 4 byte aligned. Offsets are
+ * relative to the start of the image. */
+#define JANET_IMAGE_STRING_RESERVE 24
+#define JANET_FUNCDEF_FLAG_ALIGNED (1 << 27)
+
+/* Lazy images marshal some defs on their own, behind a header with just
+ * what is needed to create closures and call them. */
+#define JANET_FUNCDEF_FLAG_LAZYBODY (1 << 29)
+#define JANET_LAZY_DEF_MAXDEPTH 32
+
+typedef struct {
+    const uint8_t *bytes;
+    size_t len;
+    Janet owner;
+    JanetTable *reg;
+    int flags;
+} JanetLazyDef;
+
+static size_t image_align(size_t offset, size_t reserve, size_t align) {
+    offset += reserve;
+    return (offset + align - 1) & ~(align - 1);
+}
+
+/* The header a borrowed string carries in the image. It is never put on
+ * the gc list and always appears reachable, so marking it is a no-op and
+ * the page is not written to by the collector. */
+static void image_string_head(JanetStringHead *head, const uint8_t *str, int32_t len) {
+    memset(head, 0, sizeof(JanetStringHead));
+    head->gc.flags = JANET_MEMORY_STRING | JANET_MEM_REACHABLE | JANET_MEM_DISABLED;
+    head->length = len;
+    head->hash = janet_string_calchash(str, len);
+}
+
 /* Helper to look inside an entry in an environment */
 static Janet entry_getval(Janet env_entry) {
     if (janet_checktype(env_entry, JANET_TABLE)) {
@@ -224,6 +268,95 @@ static void janet_marshal_u32s(MarshalState *st, const uint32_t *u32s, int32_t n
     }
 }
 
+/* A def marshalled on its own loses the identity of everything it refers
+ * to, so only defs that refer to immutable values or registry values can
+ * be made lazy. */
+static int marshal_lazy_safe_value(MarshalState *st, Janet x, int depth);
+static int marshal_lazy_safe_def(MarshalState *st, JanetFuncDef *def, int depth) {
+    if (depth > JANET_LAZY_DEF_MAXDEPTH) return 0;
+    for (int32_t i = 0; i < def->constants_length; i++)
+        if (!marshal_lazy_safe_value(st, def->constants[i], depth + 1)) return 0;
+    for (int32_t i = 0; i < def->defs_length; i++)
+        if (!marshal_lazy_safe_def(st, def->defs[i], depth + 1)) return 0;
+    return 1;
+}
+
+static int marshal_lazy_safe_value(MarshalState *st, Janet x, int depth) {
+    if (depth > JANET_LAZY_DEF_MAXDEPTH) return 0;
+    switch (janet_type(x)) {
+        case JANET_NIL:
+        case JANET_BOOLEAN:
+        case JANET_NUMBER:
+        case JANET_STRING:
+        case JANET_SYMBOL:
+        case JANET_KEYWORD:
+            return 1;
+        case JANET_TUPLE: {
+            const Janet *tup = janet_unwrap_tuple(x);
+            for (int32_t i = 0; i < janet_tuple_length(tup); i++)
+                if (!marshal_lazy_safe_value(st, tup[i], depth + 1)) return 0;
+            return 1;
+        }
+        case JANET_STRUCT: {
+            const JanetKV *kvs = janet_unwrap_struct(x);
+            for (int32_t i = 0; i < janet_struct_capacity(kvs); i++) {
+                if (janet_checktype(kvs[i].key, JANET_NIL)) continue;
+                if (!marshal_lazy_safe_value(st, kvs[i].key, depth + 1)) return 0;
+                if (!marshal_lazy_safe_value(st, kvs[i].value, depth + 1)) return 0;
+            }
+            return 1;
+        }
+        default:
+            return st->rreg && janet_checktype(janet_table_get(st->rreg, x), JANET_SYMBOL);
+    }
+}
+
+/* Marshal a def on its own, so that it can be decoded on first use */
+static void marshal_lazy_def(MarshalState *st, JanetFuncDef *def, int flags) {
+    int32_t dflags = def->flags & ~JANET_FUNCDEF_FLAG_MAPPED;
+    if (flags & JANET_MARSHAL_STRIP) dflags &= ~JANET_FUNCDEF_FLAG_HASSOURCEMAP;
+    pushint(st, dflags | JANET_FUNCDEF_FLAG_LAZYBODY);
+    pushint(st, def->slotcount);
+    pushint(st, def->arity);
+    pushint(st, def->min_arity);
+    pushint(st, def->max_arity);
+    pushint(st, def->environments_length);
+    for (int32_t i = 0; i < def->environments_length; i++)
+        pushint(st, def->environments[i]);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASNAME)
+        marshal_one(st, janet_wrap_string(def->name), flags);
+
+    /* Reserve room for the body length, then align the body */
+    int32_t lenat = st->buf->count;
+    uint32_t zero = 0;
+    pushbytes(st, (const uint8_t *) &zero, 4);
+    size_t offset = (size_t)(st->buf->count - st->base);
+    size_t aligned = image_align(offset, 0, 8);
+    while (offset++ < aligned) pushbyte(st, 0);
+
+    MarshalState sub;
+    JanetTable seen;
+    janet_table_init(&seen, 0);
+    sub.buf = st->buf;
+    sub.seen = &seen;
+    sub.rreg = st->rreg;
+    sub.seen_envs = NULL;
+    sub.seen_defs = NULL;
+    sub.nextid = 0;
+    sub.base = st->buf->count;
+    marshal_one_def(&sub, def, flags & ~JANET_MARSHAL_LAZY);
+    janet_v_free(sub.seen_envs);
+    janet_v_free(sub.seen_defs);
+    janet_table_deinit(&seen);
+
+    uint32_t len = (uint32_t)(st->buf->count - sub.base);
+    uint8_t *at = st->buf->data + lenat;
+    at[0] = len & 0xFF;
+    at[1] = (len >> 8) & 0xFF;
+    at[2] = (len >> 16) & 0xFF;
+    at[3] = (len >> 24) & 0xFF;
+}
+
 /* Marshal a function def */
 static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
     MARSH_STACKCHECK;
@@ -234,9 +367,18 @@ static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
             return;
         }
     }
+    if (def->flags & JANET_FUNCDEF_FLAG_LAZY)
+        janet_def_materialize(def);
     /* Add to lookup */
     janet_v_push(st->seen_defs, def);
-    pushint(st, def->flags);
+    if ((flags & JANET_MARSHAL_LAZY) && marshal_lazy_safe_def(st, def, 0)) {
+        marshal_lazy_def(st, def, flags);
+        return;
+    }
+    int32_t dflags = def->flags & ~JANET_FUNCDEF_FLAG_MAPPED;
+    if (flags & JANET_MARSHAL_MAPPABLE) dflags |= JANET_FUNCDEF_FLAG_ALIGNED;
+    if (flags & JANET_MARSHAL_STRIP) dflags &= ~JANET_FUNCDEF_FLAG_HASSOURCEMAP;
+    pushint(st, dflags);
     pushint(st, def->slotcount);
     pushint(st, def->arity);
     pushint(st, def->min_arity);
@@ -257,6 +399,11 @@ static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
         marshal_one(st, def->constants[i], flags);
 
     /* marshal the bytecode */
+    if (flags & JANET_MARSHAL_MAPPABLE) {
+        size_t offset = (size_t)(st->buf->count - st->base);
+        size_t aligned = image_align(offset, 0, 4);
+        while (offset++ < aligned) pushbyte(st, 0);
+    }
     janet_marshal_u32s(st, def->bytecode, def->bytecode_length);
 
     /* marshal the environments if needed */
@@ -268,7 +415,7 @@ static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
         marshal_one_def(st, def->defs[i], flags);
 
     /* marshal source maps if needed */
-    if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCEMAP) {
+    if (dflags & JANET_FUNCDEF_FLAG_HASSOURCEMAP) {
         int32_t current = 0;
         for (int32_t i = 0; i < def->bytecode_length; i++) {
             JanetSourceMapping map = def->sourcemap[i];
@@ -359,13 +506,13 @@ void janet_marshal_janet(JanetMarshalContext *ctx, Janet x) {
 
 void janet_marshal_abstract(JanetMarshalContext *ctx, void *abstract) {
     MarshalState *st = (MarshalState *)(ctx->m_state);
-    janet_table_put(&st->seen,
+    janet_table_put(st->seen,
                     janet_wrap_abstract(abstract),
                     janet_wrap_integer(st->nextid++));
 }
 
 #define MARK_SEEN() \
-    janet_table_put(&st->seen, x, janet_wrap_integer(st->nextid++))
+    janet_table_put(st->seen, x, janet_wrap_integer(st->nextid++))
 
 static void marshal_one_abstract(MarshalState *st, Janet x, int flags) {
     void *abstract = janet_unwrap_abstract(x);
@@ -408,7 +555,7 @@ static void marshal_one(MarshalState *st, Janet x, int flags) {
 
     /* Check reference and registry value */
     {
-        Janet check = janet_table_get(&st->seen, x);
+        Janet check = janet_table_get(st->seen, x);
         if (janet_checkint(check)) {
             pushbyte(st, LB_REFERENCE);
             pushint(st, janet_unwrap_integer(check));
@@ -463,6 +610,25 @@ static void marshal_one(MarshalState *st, Janet x, int flags) {
             int32_t length = janet_string_length(str);
             /* Record reference */
             MARK_SEEN();
+            if (type == JANET_STRING && (flags & JANET_MARSHAL_MAPPABLE)) {
+                pushbyte(st, LB_MAPPED_STRING);
+                pushint(st, length);
+                size_t offset = (size_t)(st->buf->count - st->base);
+                size_t aligned = image_align(offset, JANET_IMAGE_STRING_RESERVE, 8);
+                if (sizeof(JanetStringHead) <= JANET_IMAGE_STRING_RESERVE) {
+                    /* Prefill the header for this platform so loading the
+                     * image in place usually does not need to touch it. */
+                    JanetStringHead head;
+                    image_string_head(&head, str, length);
+                    while (offset++ < aligned - sizeof(JanetStringHead)) pushbyte(st, 0);
+                    pushbytes(st, (const uint8_t *) &head, (int32_t) sizeof(JanetStringHead));
+                } else {
+                    while (offset++ < aligned) pushbyte(st, 0);
+                }
+                pushbytes(st, str, length);
+                pushbyte(st, 0);
+                return;
+            }
             uint8_t lb = (type == JANET_STRING) ? LB_STRING :
                          (type == JANET_SYMBOL) ? LB_SYMBOL :
                          LB_KEYWORD;
@@ -580,22 +746,91 @@ static void marshal_one(MarshalState *st, Janet x, int flags) {
 #undef MARK_SEEN
 }
 
+/* Estimate the size of a marshalled value from a bounded number of nodes,
+ * so the output of small values can be allocated up front. */
+static int32_t marshal_estimate(Janet x, int32_t *budget) {
+    if (--*budget < 0) return 0;
+    int32_t size = 0;
+    switch (janet_type(x)) {
+        default:
+            return 16;
+        case JANET_NIL:
+        case JANET_BOOLEAN:
+            return 1;
+        case JANET_NUMBER: {
+            double xval = janet_unwrap_number(x);
+            if (!janet_checkintrange(xval)) return 9;
+            int32_t i = (int32_t) xval;
+            return (i >= 0 && i < 128) ? 1 : (i <= 8191 && i >= -8192) ? 2 : 5;
+        }
+        case JANET_STRING:
+        case JANET_SYMBOL:
+        case JANET_KEYWORD:
+            return 6 + janet_string_length(janet_unwrap_string(x));
+        case JANET_BUFFER:
+            return 6 + janet_unwrap_buffer(x)->count;
+        case JANET_ARRAY: {
+            JanetArray *a = janet_unwrap_array(x);
+            size = 6;
+            for (int32_t i = 0; i < a->count && *budget > 0; i++)
+                size += marshal_estimate(a->data[i], budget);
+            return size;
+        }
+        case JANET_TUPLE: {
+            const Janet *tup = janet_unwrap_tuple(x);
+            size = 8;
+            for (int32_t i = 0; i < janet_tuple_length(tup) && *budget > 0; i++)
+                size += marshal_estimate(tup[i], budget);
+            return size;
+        }
+        case JANET_TABLE:
+        case JANET_STRUCT: {
+            const JanetKV *kvs = NULL;
+            int32_t len = 0, cap = 0;
+            janet_dictionary_view(x, &kvs, &len, &cap);
+            size = 6;
+            for (int32_t i = 0; i < cap && *budget > 0; i++) {
+                if (janet_checktype(kvs[i].key, JANET_NIL)) continue;
+                size += marshal_estimate(kvs[i].key, budget);
+                size += marshal_estimate(kvs[i].value, budget);
+            }
+            return size;
+        }
+    }
+}
+
+#define JANET_MARSHAL_ESTIMATE_NODES 64
+#define JANET_MARSHAL_ESTIMATE_MAX 0x10000
+
+static void marshal_with_state(MarshalState *st, Janet x, int flags) {
+    int32_t budget = JANET_MARSHAL_ESTIMATE_NODES;
+    int32_t estimate = marshal_estimate(x, &budget);
+    if (estimate > JANET_MARSHAL_ESTIMATE_MAX) estimate = JANET_MARSHAL_ESTIMATE_MAX;
+    if ((int64_t) st->buf->count + estimate <= INT32_MAX) {
+        janet_buffer_ensure(st->buf, st->buf->count + estimate, 1);
+    }
+    st->nextid = 0;
+    st->base = st->buf->count;
+    st->seen_defs = NULL;
+    st->seen_envs = NULL;
+    marshal_one(st, x, flags);
+    janet_v_free(st->seen_envs);
+    janet_v_free(st->seen_defs);
+}
+
 void janet_marshal(
     JanetBuffer *buf,
     Janet x,
     JanetTable *rreg,
     int flags) {
     MarshalState st;
+    JanetTable seen;
+    janet_table_init(&seen, 0);
     st.buf = buf;
-    st.nextid = 0;
-    st.seen_defs = NULL;
-    st.seen_envs = NULL;
+    st.seen = &seen;
     st.rreg = rreg;
-    janet_table_init(&st.seen, 0);
-    marshal_one(&st, x, flags);
-    janet_table_deinit(&st.seen);
-    janet_v_free(st.seen_envs);
-    janet_v_free(st.seen_defs);
+    marshal_with_state(&st, x, flags);
+    janet_table_deinit(&seen);
 }
 
 typedef struct {
@@ -795,6 +1030,8 @@ static const uint8_t *unmarshal_one_def(
         def->constants = NULL;
         def->bytecode = NULL;
         def->sourcemap = NULL;
+        def->jit = NULL;
+        def->hotness = 0;
         janet_v_push(st->lookup_defs, def);
 
         /* Set default lengths to zero */
@@ -810,6 +1047,56 @@ static const uint8_t *unmarshal_one_def(
         def->min_arity = readnat(st, &data);
         def->max_arity = readnat(st, &data);
 
+        /* Lazy defs only keep their encoded body until they are first used */
+        if (def->flags & JANET_FUNCDEF_FLAG_LAZYBODY) {
+            def->flags &= ~JANET_FUNCDEF_FLAG_LAZYBODY;
+            /* Closures can be made without loading the def */
+            int32_t environments_length = readnat(st, &data);
+            if (environments_length) {
+                def->environments = janet_malloc(sizeof(int32_t) * (size_t) environments_length);
+                if (!def->environments) {
+                    JANET_OUT_OF_MEMORY;
+                }
+                def->environments_length = environments_length;
+                for (int32_t i = 0; i < environments_length; i++) {
+                    def->environments[i] = readint(st, &data);
+                }
+            }
+            if (def->flags & JANET_FUNCDEF_FLAG_HASNAME) {
+                Janet x;
+                data = unmarshal_one(st, data, &x, flags + 1);
+                janet_asserttype(x, JANET_STRING);
+                def->name = janet_unwrap_string(x);
+            }
+            MARSH_EOS(st, data + 3);
+            size_t len = (size_t) data[0] |
+                         ((size_t) data[1] << 8) |
+                         ((size_t) data[2] << 16) |
+                         ((size_t) data[3] << 24);
+            data = st->start + image_align((size_t)(data + 4 - st->start), 0, 8);
+            if (len == 0 || len > (size_t)(st->end - data))
+                janet_panic("invalid lazy funcdef");
+            JanetLazyDef *lazy = janet_malloc(sizeof(JanetLazyDef));
+            if (NULL == lazy) {
+                JANET_OUT_OF_MEMORY;
+            }
+            if (flags & JANET_MARSHAL_BORROW) {
+                lazy->bytes = data;
+                lazy->owner = janet_wrap_nil();
+            } else {
+                JanetString copy = janet_string(data, (int32_t) len);
+                lazy->bytes = copy;
+                lazy->owner = janet_wrap_string(copy);
+            }
+            lazy->len = len;
+            lazy->reg = st->reg;
+            lazy->flags = flags & (JANET_MARSHAL_UNSAFE | JANET_MARSHAL_BORROW | JANET_MARSHAL_TRUSTED);
+            def->lazy = lazy;
+            def->flags |= JANET_FUNCDEF_FLAG_LAZY;
+            *out = def;
+            return data + len;
+        }
+
         /* Read some lengths */
         constants_length = readnat(st, &data);
         bytecode_length = readnat(st, &data);
@@ -845,13 +1132,28 @@ static const uint8_t *unmarshal_one_def(
         }
         def->constants_length = constants_length;
 
-        /* Unmarshal bytecode */
-        def->bytecode = janet_malloc(sizeof(uint32_t) * bytecode_length);
-        if (!def->bytecode) {
-            JANET_OUT_OF_MEMORY;
+        /* Unmarshal bytecode, using it in place if possible */
+        if (def->flags & JANET_FUNCDEF_FLAG_ALIGNED) {
+            def->flags &= ~JANET_FUNCDEF_FLAG_ALIGNED;
+            data = st->start + image_align((size_t)(data - st->start), 0, 4);
+#ifdef JANET_LITTLE_ENDIAN
+            if ((flags & JANET_MARSHAL_BORROW) && !((uintptr_t) data & 3)) {
+                MARSH_EOS(st, data + 4 * (size_t) bytecode_length - 1);
+                def->bytecode = (uint32_t *) data;
+                def->flags |= JANET_FUNCDEF_FLAG_MAPPED;
+                def->bytecode_length = bytecode_length;
+                data += 4 * (size_t) bytecode_length;
+            }
+#endif
+        }
+        if (!(def->flags & JANET_FUNCDEF_FLAG_MAPPED)) {
+            def->bytecode = janet_malloc(sizeof(uint32_t) * bytecode_length);
+            if (!def->bytecode) {
+                JANET_OUT_OF_MEMORY;
+            }
+            data = janet_unmarshal_u32s(st, data, def->bytecode, bytecode_length);
+            def->bytecode_length = bytecode_length;
         }
-        data = janet_unmarshal_u32s(st, data, def->bytecode, bytecode_length);
-        def->bytecode_length = bytecode_length;
 
         /* Unmarshal environments */
         if (def->flags & JANET_FUNCDEF_FLAG_HASENVS) {
@@ -907,9 +1209,10 @@ static const uint8_t *unmarshal_one_def(
             data = janet_unmarshal_u32s(st, data, def->closure_bitset, n);
         }
 
-        /* Validate */
-        if (janet_verify(def))
+        /* Validate, unless the image was built with this binary */
+        if (!(flags & JANET_MARSHAL_TRUSTED) && janet_verify(def))
             janet_panic("funcdef has invalid bytecode");
+        janet_bytecode_specialize(def);
 
         /* Set def */
         *out = def;
@@ -935,10 +1238,15 @@ static const uint8_t *unmarshal_one_fiber(
     fiber->data = NULL;
     fiber->child = NULL;
     fiber->env = NULL;
+    for (int i = 0; i < JANET_FIBER_LOCALS; i++) {
+        fiber->locals[i] = janet_wrap_nil();
+    }
 #ifdef JANET_EV
     fiber->waiting = NULL;
     fiber->sched_id = 0;
     fiber->supervisor_channel = NULL;
+    fiber->timeout = NULL;
+    fiber->deadline = NULL;
 #endif
 
     /* Push fiber to seen stack */
@@ -990,6 +1298,8 @@ static const uint8_t *unmarshal_one_fiber(
         janet_asserttype(funcv, JANET_FUNCTION);
         func = janet_unwrap_function(funcv);
         def = func->def;
+        if (def->flags & JANET_FUNCDEF_FLAG_LAZY)
+            janet_def_materialize(def);
 
         /* Check env */
         if (frameflags & JANET_STACKFRAME_HASENV) {
@@ -1066,7 +1376,7 @@ static const uint8_t *unmarshal_one_fiber(
 
 void janet_unmarshal_ensure(JanetMarshalContext *ctx, size_t size) {
     UnmarshalState *st = (UnmarshalState *)(ctx->u_state);
-    MARSH_EOS(st, ctx->data + size);
+    if (size > (size_t)(st->end - ctx->data)) janet_panic("unexpected end of source");
 }
 
 int32_t janet_unmarshal_int(JanetMarshalContext *ctx) {
@@ -1221,6 +1531,28 @@ static const uint8_t *unmarshal_one(
             janet_v_push(st->lookup, *out);
             return data + len;
         }
+        case LB_MAPPED_STRING: {
+            data++;
+            int32_t len = readnat(st, &data);
+            const uint8_t *bytes = st->start +
+                                   image_align((size_t)(data - st->start), JANET_IMAGE_STRING_RESERVE, 8);
+            MARSH_EOS(st, bytes + len);
+            if (bytes[len] != 0) janet_panic("invalid mapped string");
+            if ((flags & JANET_MARSHAL_BORROW) &&
+                    sizeof(JanetStringHead) <= JANET_IMAGE_STRING_RESERVE &&
+                    !((uintptr_t) bytes & 7)) {
+                JanetStringHead head;
+                JanetStringHead *inplace = (JanetStringHead *)(bytes - sizeof(JanetStringHead));
+                image_string_head(&head, bytes, len);
+                if (memcmp(inplace, &head, sizeof(JanetStringHead)))
+                    memcpy(inplace, &head, sizeof(JanetStringHead));
+                *out = janet_wrap_string(inplace->data);
+            } else {
+                *out = janet_wrap_string(janet_string(bytes, len));
+            }
+            janet_v_push(st->lookup, *out);
+            return bytes + len + 1;
+        }
         case LB_FIBER: {
             JanetFiber *fiber;
             data = unmarshal_one_fiber(st, data + 1, &fiber, flags);
@@ -1302,8 +1634,8 @@ static const uint8_t *unmarshal_one(
                     janet_panicf("invalid reference %d", len);
                 *out = st->lookup[len];
             } else {
-                /* Table */
-                JanetTable *t = janet_table(len);
+                /* Table, with room for len entries without a rehash */
+                JanetTable *t = janet_table(len > INT32_MAX / 2 ? len : 2 * len);
                 *out = janet_wrap_table(t);
                 janet_v_push(st->lookup, *out);
                 if (lead == LB_TABLE_PROTO) {
@@ -1389,8 +1721,248 @@ Janet janet_unmarshal(
     return out;
 }
 
+/* Decode the body of a lazy def in place, on first use */
+void janet_def_materialize(JanetFuncDef *def) {
+    JanetLazyDef *lazy = def->lazy;
+    UnmarshalState st;
+    st.start = lazy->bytes;
+    st.end = lazy->bytes + lazy->len;
+    st.lookup_defs = NULL;
+    st.lookup_envs = NULL;
+    st.lookup = NULL;
+    st.reg = lazy->reg;
+    JanetFuncDef *body;
+    unmarshal_one_def(&st, lazy->bytes, &body, lazy->flags);
+    janet_v_free(st.lookup_defs);
+    janet_v_free(st.lookup_envs);
+    janet_v_free(st.lookup);
+    if (body->environments_length != def->environments_length ||
+            (def->environments_length &&
+             memcmp(def->environments, body->environments, sizeof(int32_t) * (size_t) def->environments_length)))
+        janet_panic("invalid lazy funcdef");
+
+    /* Move the body into the def, leaving nothing for the body to free */
+    janet_free(def->environments);
+    def->environments = body->environments;
+    def->constants = body->constants;
+    def->defs = body->defs;
+    def->bytecode = body->bytecode;
+    def->closure_bitset = body->closure_bitset;
+    def->sourcemap = body->sourcemap;
+    def->source = body->source;
+    def->name = body->name;
+    def->flags = body->flags;
+    def->slotcount = body->slotcount;
+    def->constants_length = body->constants_length;
+    def->bytecode_length = body->bytecode_length;
+    def->defs_length = body->defs_length;
+    body->environments = NULL;
+    body->constants = NULL;
+    body->defs = NULL;
+    body->bytecode = NULL;
+    body->closure_bitset = NULL;
+    body->sourcemap = NULL;
+    body->flags &= ~JANET_FUNCDEF_FLAG_MAPPED;
+    body->environments_length = 0;
+    body->constants_length = 0;
+    body->bytecode_length = 0;
+    body->defs_length = 0;
+    janet_free(lazy);
+    janet_gc_barrier(def);
+}
+
+void janet_def_lazy_mark(JanetFuncDef *def) {
+    JanetLazyDef *lazy = def->lazy;
+    janet_mark(lazy->owner);
+    if (NULL != lazy->reg) janet_mark(janet_wrap_table(lazy->reg));
+}
+
+/* Unmarshal an image straight from a file. The file is mapped copy on write
+ * and unmarshalled with JANET_MARSHAL_BORROW, so strings and bytecode in
+ * mappable images are used in place. The mapping is never released, as the
+ * loaded values may point into it. */
+Janet janet_unmarshal_file(const char *path, JanetTable *reg) {
+    uint8_t *bytes;
+    size_t len;
+#ifdef JANET_WINDOWS
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) janet_panicf("could not open image %s", path);
+    fseek(f, 0, SEEK_END);
+    long flen = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (flen <= 0) {
+        fclose(f);
+        janet_panicf("could not read image %s", path);
+    }
+    len = (size_t) flen;
+    bytes = janet_malloc(len);
+    if (NULL == bytes) {
+        JANET_OUT_OF_MEMORY;
+    }
+    if (fread(bytes, 1, len, f) != len) {
+        fclose(f);
+        janet_free(bytes);
+        janet_panicf("could not read image %s", path);
+    }
+    fclose(f);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) janet_panicf("could not open image %s", path);
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size <= 0) {
+        close(fd);
+        janet_panicf("could not read image %s", path);
+    }
+    len = (size_t) st.st_size;
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) janet_panicf("could not map image %s", path);
+    bytes = map;
+#endif
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    Janet out = janet_wrap_nil();
+    if (!signal) {
+        out = janet_unmarshal(bytes, len, JANET_MARSHAL_BORROW, reg, NULL);
+    }
+    janet_restore(&tstate);
+    if (signal) {
+#ifdef JANET_WINDOWS
+        janet_free(bytes);
+#else
+        munmap(bytes, len);
+#endif
+        janet_panicv(tstate.payload);
+    }
+    return out;
+}
+
+/*
+ * Marshalers keep the state used for marshalling between calls, so that
+ * marshalling many small values does not rebuild the table of seen values
+ * or grow a new output buffer each time.
+ */
+
+struct JanetMarshaler {
+    JanetTable *seen;
+    JanetTable *rreg;
+    JanetTable *reg;
+    JanetBuffer *scratch;
+    int flags;
+};
+
+/* Drop the table of seen values if it got very big */
+#define JANET_MARSHALER_MAX_SEEN 4096
+
+static int marshaler_gcmark(void *p, size_t size) {
+    (void) size;
+    JanetMarshaler *m = (JanetMarshaler *) p;
+    janet_mark(janet_wrap_table(m->seen));
+    janet_mark(janet_wrap_buffer(m->scratch));
+    if (m->rreg) janet_mark(janet_wrap_table(m->rreg));
+    if (m->reg) janet_mark(janet_wrap_table(m->reg));
+    return 0;
+}
+
+static int marshaler_getter(void *p, Janet key, Janet *out);
+static Janet marshaler_next(void *p, Janet key);
+
+const JanetAbstractType janet_marshaler_type = {
+    "core/marshaler",
+    NULL,
+    marshaler_gcmark,
+    marshaler_getter,
+    NULL, /* put */
+    NULL, /* marshal */
+    NULL, /* unmarshal */
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    marshaler_next,
+    JANET_ATEND_NEXT
+};
+
+JanetMarshaler *janet_marshaler(JanetTable *rreg, JanetTable *reg, int flags) {
+    JanetMarshaler *m = janet_abstract(&janet_marshaler_type, sizeof(JanetMarshaler));
+    m->rreg = rreg;
+    m->reg = reg;
+    m->flags = flags;
+    m->seen = janet_table(0);
+    m->scratch = janet_buffer(0);
+    return m;
+}
+
+void janet_marshaler_marshal(JanetMarshaler *m, JanetBuffer *buf, Janet x) {
+    MarshalState st;
+    /* A previous call may have panicked */
+    if (m->seen->count) janet_table_clear(m->seen);
+    st.buf = buf;
+    st.seen = m->seen;
+    st.rreg = m->rreg;
+    marshal_with_state(&st, x, m->flags);
+    if (m->seen->capacity > JANET_MARSHALER_MAX_SEEN) {
+        m->seen = janet_table(0);
+    } else {
+        janet_table_clear(m->seen);
+    }
+}
+
+Janet janet_marshaler_unmarshal(JanetMarshaler *m, const uint8_t *bytes, size_t len, const uint8_t **next) {
+    return janet_unmarshal(bytes, len, m->flags, m->reg, next);
+}
+
+static Janet cfun_marshaler_marshal(int32_t argc, Janet *argv) {
+    janet_arity(argc, 2, 3);
+    JanetMarshaler *m = janet_getabstract(argv, 0, &janet_marshaler_type);
+    if (argc > 2) {
+        JanetBuffer *buffer = janet_getbuffer(argv, 2);
+        janet_marshaler_marshal(m, buffer, argv[1]);
+        return janet_wrap_buffer(buffer);
+    }
+    /* Marshal into the scratch buffer, and then copy out at the exact size */
+    m->scratch->count = 0;
+    janet_marshaler_marshal(m, m->scratch, argv[1]);
+    JanetBuffer *buffer = janet_buffer(m->scratch->count);
+    safe_memcpy(buffer->data, m->scratch->data, m->scratch->count);
+    buffer->count = m->scratch->count;
+    return janet_wrap_buffer(buffer);
+}
+
+static Janet cfun_marshaler_unmarshal(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 2);
+    JanetMarshaler *m = janet_getabstract(argv, 0, &janet_marshaler_type);
+    JanetByteView view = janet_getbytes(argv, 1);
+    return janet_marshaler_unmarshal(m, view.bytes, (size_t) view.len, NULL);
+}
+
+static const JanetMethod marshaler_methods[] = {
+    {"marshal", cfun_marshaler_marshal},
+    {"unmarshal", cfun_marshaler_unmarshal},
+    {NULL, NULL}
+};
+
+static int marshaler_getter(void *p, Janet key, Janet *out) {
+    (void) p;
+    if (!janet_checktype(key, JANET_KEYWORD)) return 0;
+    return janet_getmethod(janet_unwrap_keyword(key), marshaler_methods, out);
+}
+
+static Janet marshaler_next(void *p, Janet key) {
+    (void) p;
+    return janet_nextmethod(marshaler_methods, key);
+}
+
 /* C functions */
 
+static Janet cfun_marshaler(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 2);
+    JanetTable *rreg = NULL;
+    JanetTable *reg = NULL;
+    if (argc > 0 && !janet_checktype(argv[0], JANET_NIL)) rreg = janet_gettable(argv, 0);
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) reg = janet_gettable(argv, 1);
+    return janet_wrap_abstract(janet_marshaler(rreg, reg, 0));
+}
+
 static Janet cfun_env_lookup(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
     JanetTable *env = janet_gettable(argv, 0);
@@ -1398,18 +1970,33 @@ static Janet cfun_env_lookup(int32_t argc, Janet *argv) {
 }
 
 static Janet cfun_marshal(int32_t argc, Janet *argv) {
-    janet_arity(argc, 1, 3);
+    janet_arity(argc, 1, 4);
     JanetBuffer *buffer;
     JanetTable *rreg = NULL;
-    if (argc > 1) {
+    int flags = 0;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
         rreg = janet_gettable(argv, 1);
     }
-    if (argc > 2) {
-        buffer = janet_getbuffer(argv, 2);
-    } else {
-        buffer = janet_buffer(10);
+    buffer = janet_optbuffer(argv, argc, 2, 10);
+    if (argc > 3) {
+        JanetKeyword kw = janet_getkeyword(argv, 3);
+        for (int32_t i = 0; i < janet_string_length(kw); i++) {
+            switch (kw[i]) {
+                default:
+                    janet_panicf("unknown marshal flag %c in %v", kw[i], argv[3]);
+                case 'm':
+                    flags |= JANET_MARSHAL_MAPPABLE;
+                    break;
+                case 'l':
+                    flags |= JANET_MARSHAL_LAZY;
+                    break;
+                case 's':
+                    flags |= JANET_MARSHAL_STRIP;
+                    break;
+            }
+        }
     }
-    janet_marshal(buffer, argv[0], rreg, 0);
+    janet_marshal(buffer, argv[0], rreg, flags);
     return janet_wrap_buffer(buffer);
 }
 
@@ -1423,16 +2010,38 @@ static Janet cfun_unmarshal(int32_t argc, Janet *argv) {
     return janet_unmarshal(view.bytes, (size_t) view.len, 0, reg, NULL);
 }
 
+static Janet cfun_unmarshal_file(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    const char *path = janet_getcstring(argv, 0);
+    JanetTable *reg = NULL;
+    if (argc > 1) {
+        reg = janet_gettable(argv, 1);
+    }
+    return janet_unmarshal_file(path, reg);
+}
+
 static const JanetReg marsh_cfuns[] = {
     {
         "marshal", cfun_marshal,
-        JDOC("(marshal x &opt reverse-lookup buffer)\n\n"
+        JDOC("(marshal x &opt reverse-lookup buffer flags)\n\n"
              "Marshal a value into a buffer and return the buffer. The buffer "
              "can then later be unmarshalled to reconstruct the initial value. "
              "Optionally, one can pass in a reverse lookup table to not marshal "
              "aliased values that are found in the table. Then a forward "
              "lookup table can be used to recover the original value when "
-             "unmarshalling.")
+             "unmarshalling. flags is a keyword of characters that change the output:\n\n"
+             "* :m - mappable. Lay out strings and bytecode so that `unmarshal-file` can "
+             "use them in place, at the cost of a larger output.\n"
+             "* :l - lazy. Functions that only refer to immutable or registry values "
+             "are decoded when they are first called rather than when unmarshalled.\n"
+             "* :s - stripped. Leave out the source maps of functions.")
+    },
+    {
+        "unmarshal-file", cfun_unmarshal_file,
+        JDOC("(unmarshal-file path &opt lookup)\n\n"
+             "Unmarshal a value from the file at path, like `unmarshal`. The file is "
+             "mapped into memory and never unmapped, and strings and bytecode of images "
+             "marshalled as mappable are used in place rather than copied.")
     },
     {
         "unmarshal", cfun_unmarshal,
@@ -1441,6 +2050,15 @@ static const JanetReg marsh_cfuns[] = {
              "can be provided to allow for aliases to be resolved. Returns the value "
              "unmarshalled from the buffer.")
     },
+    {
+        "marshaler", cfun_marshaler,
+        JDOC("(marshaler &opt reverse-lookup lookup)\n\n"
+             "Create a marshaler, which marshals many values faster than repeated calls to "
+             "`marshal` by keeping its internal state between calls. Use "
+             "`(:marshal marshaler x &opt buffer)` to marshal a value, and "
+             "`(:unmarshal marshaler bytes)` to unmarshal one. The optional lookup tables are "
+             "used as they are by `marshal` and `unmarshal`.")
+    },
     {
         "env-lookup", cfun_env_lookup,
         JDOC("(env-lookup env)\n\n"
@@ -30,6 +30,7 @@
 
 #include <math.h>
 #ifdef JANET_WINDOWS
+#include <io.h>
 #include <winsock2.h>
 #include <windows.h>
 #include <ws2tcpip.h>
@@ -48,6 +49,22 @@
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef JANET_LINUX
+#include <pthread.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+/* Not declared with the strict feature test macros we use */
+extern long syscall(long number, ...);
+#endif
+/* glibc only exposes SO_REUSEPORT with _DEFAULT_SOURCE */
+#if defined(__linux__) && !defined(SO_REUSEPORT)
+#include <asm/socket.h>
+#endif
+#ifdef JANET_EV_URING
+#include <linux/io_uring.h>
+#endif
 #endif
 
 const JanetAbstractType janet_address_type = {
@@ -145,7 +162,7 @@ JanetAsyncStatus net_machine_accept(JanetListenerState *s, JanetAsyncEvent event
             Janet streamv = janet_wrap_abstract(state->astream);
             if (state->function) {
                 /* Schedule worker */
-                JanetFiber *fiber = janet_fiber(state->function, 64, 1, &streamv);
+                JanetFiber *fiber = janet_fiber(state->function, JANET_STACK_INITIAL, 1, &streamv);
                 fiber->supervisor_channel = s->fiber->supervisor_channel;
                 janet_schedule(fiber, janet_wrap_nil());
                 /* Now listen again for next connection */
@@ -203,6 +220,25 @@ typedef struct {
     JanetFunction *function;
 } NetStateAccept;
 
+/* Pass a new connection to the handler, or resume the accepting fiber with it */
+static JanetAsyncStatus net_accepted(NetStateAccept *state, JSock connfd) {
+    JanetListenerState *s = (JanetListenerState *) state;
+    janet_net_socknoblock(connfd);
+    /* Connections inherit edge triggering from the server */
+    uint32_t flags = JANET_STREAM_READABLE | JANET_STREAM_WRITABLE;
+    flags |= s->stream->flags & JANET_STREAM_EDGE;
+    JanetStream *stream = make_stream(connfd, flags);
+    Janet streamv = janet_wrap_abstract(stream);
+    if (state->function) {
+        JanetFiber *fiber = janet_fiber(state->function, JANET_STACK_INITIAL, 1, &streamv);
+        fiber->supervisor_channel = s->fiber->supervisor_channel;
+        janet_schedule(fiber, janet_wrap_nil());
+        return JANET_ASYNC_STATUS_NOT_DONE;
+    }
+    janet_schedule(s->fiber, streamv);
+    return JANET_ASYNC_STATUS_DONE;
+}
+
 JanetAsyncStatus net_machine_accept(JanetListenerState *s, JanetAsyncEvent event) {
     NetStateAccept *state = (NetStateAccept *)s;
     switch (event) {
@@ -215,18 +251,24 @@ JanetAsyncStatus net_machine_accept(JanetListenerState *s, JanetAsyncEvent event
         case JANET_ASYNC_EVENT_CLOSE:
             janet_schedule(s->fiber, janet_wrap_nil());
             return JANET_ASYNC_STATUS_DONE;
+#ifdef JANET_EV_URING
+        case JANET_ASYNC_EVENT_COMPLETE:
+            /* Called when accept finished. Failed accepts are retried, as with readiness. */
+            if (s->bytes >= 0 && net_accepted(state, s->bytes) == JANET_ASYNC_STATUS_DONE) {
+                return JANET_ASYNC_STATUS_DONE;
+            }
+
+        /* fallthrough */
+        case JANET_ASYNC_EVENT_USER:
+            janet_uring_submit(s, IORING_OP_ACCEPT, 0, NULL, 0, 0);
+            break;
+#endif
         case JANET_ASYNC_EVENT_READ: {
-            JSock connfd = accept(s->stream->handle, NULL, NULL);
-            if (JSOCKVALID(connfd)) {
-                janet_net_socknoblock(connfd);
-                JanetStream *stream = make_stream(connfd, JANET_STREAM_READABLE | JANET_STREAM_WRITABLE);
-                Janet streamv = janet_wrap_abstract(stream);
-                if (state->function) {
-                    JanetFiber *fiber = janet_fiber(state->function, 64, 1, &streamv);
-                    fiber->supervisor_channel = s->fiber->supervisor_channel;
-                    janet_schedule(fiber, janet_wrap_nil());
-                } else {
-                    janet_schedule(s->fiber, streamv);
+            /* Accept until the backlog is empty so edge triggered servers don't stall */
+            for (;;) {
+                JSock connfd = accept(s->stream->handle, NULL, NULL);
+                if (!JSOCKVALID(connfd)) break;
+                if (net_accepted(state, connfd) == JANET_ASYNC_STATUS_DONE) {
                     return JANET_ASYNC_STATUS_DONE;
                 }
             }
@@ -237,8 +279,14 @@ JanetAsyncStatus net_machine_accept(JanetListenerState *s, JanetAsyncEvent event
 }
 
 JANET_NO_RETURN static void janet_sched_accept(JanetStream *stream, JanetFunction *fun) {
+#ifdef JANET_EV_URING
+    NetStateAccept *state = (NetStateAccept *) janet_uring_listen(stream, net_machine_accept, JANET_ASYNC_LISTEN_READ, sizeof(NetStateAccept), NULL);
+    state->function = fun;
+    net_machine_accept((JanetListenerState *) state, JANET_ASYNC_EVENT_USER);
+#else
     NetStateAccept *state = (NetStateAccept *) janet_listen(stream, net_machine_accept, JANET_ASYNC_LISTEN_READ, sizeof(NetStateAccept), NULL);
     state->function = fun;
+#endif
     janet_await();
 }
 
@@ -308,105 +356,126 @@ static struct addrinfo *janet_get_addrinfo(Janet *argv, int32_t offset, int sock
 }
 
 /*
- * C Funs
+ * Name resolution
+ *
+ * getaddrinfo can block for as long as a name server takes to answer, so
+ * inside the event loop lookups of host names run on the thread pool.
+ * Numeric addresses and unix paths are still resolved in place. Answers are
+ * kept in a small per-thread cache. getaddrinfo does not report record TTLs,
+ * so entries simply expire after a configurable number of seconds.
  */
 
-static Janet cfun_net_sockaddr(int32_t argc, Janet *argv) {
-    janet_arity(argc, 2, 4);
-    int socktype = janet_get_sockettype(argv, argc, 2);
-    int is_unix = 0;
-    int make_arr = (argc >= 3 && janet_truthy(argv[3]));
-    struct addrinfo *ai = janet_get_addrinfo(argv, 0, socktype, 0, &is_unix);
-#ifndef JANET_WINDOWS
-    /* no unix domain socket support on windows yet */
-    if (is_unix) {
-        void *abst = janet_abstract(&janet_address_type, sizeof(struct sockaddr_un));
-        memcpy(abst, ai, sizeof(struct sockaddr_un));
-        Janet ret = janet_wrap_abstract(abst);
-        return make_arr ? janet_wrap_array(janet_array_n(&ret, 1)) : ret;
-    }
-#endif
-    if (make_arr) {
-        /* Select all */
-        JanetArray *arr = janet_array(10);
-        struct addrinfo *iter = ai;
-        while (NULL != iter) {
-            void *abst = janet_abstract(&janet_address_type, iter->ai_addrlen);
-            memcpy(abst, iter->ai_addr, iter->ai_addrlen);
-            janet_array_push(arr, janet_wrap_abstract(abst));
-            iter = iter->ai_next;
-        }
-        freeaddrinfo(ai);
-        return janet_wrap_array(arr);
-    } else {
-        /* Select first */
-        if (NULL == ai) {
-            janet_panic("no data for given address");
-        }
-        void *abst = janet_abstract(&janet_address_type, ai->ai_addrlen);
-        memcpy(abst, ai->ai_addr, ai->ai_addrlen);
-        freeaddrinfo(ai);
-        return janet_wrap_abstract(abst);
+#define JANET_DNS_CACHE_MAX 256
+
+static JANET_THREAD_LOCAL JanetTable *janet_vm_dns_cache = NULL;
+static JANET_THREAD_LOCAL double janet_vm_dns_ttl = 30.0;
+
+typedef enum {
+    JANET_RESOLVE_ADDRESS,
+    JANET_RESOLVE_ADDRESSES,
+    JANET_RESOLVE_CONNECT
+} JanetResolveMode;
+
+typedef struct {
+    char *host;
+    char *port;
+    int socktype;
+    int status;
+    JanetResolveMode mode;
+    uint32_t sched_id;
+    struct addrinfo *ai;
+} NetResolve;
+
+static double net_now(void) {
+    struct timespec now;
+    janet_gettime(&now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+static JanetString net_dns_key(const char *host, const char *port, int socktype) {
+    JanetBuffer buf;
+    janet_buffer_init(&buf, 32);
+    janet_buffer_push_cstring(&buf, host);
+    janet_buffer_push_u8(&buf, 0);
+    if (NULL != port) janet_buffer_push_cstring(&buf, port);
+    janet_buffer_push_u8(&buf, 0);
+    janet_buffer_push_u8(&buf, (uint8_t)(socktype == SOCK_STREAM ? 's' : 'd'));
+    JanetString key = janet_string(buf.data, buf.count);
+    janet_buffer_deinit(&buf);
+    return key;
+}
+
+static JanetArray *net_dns_cache_get(JanetString key) {
+    if (NULL == janet_vm_dns_cache) return NULL;
+    Janet entry = janet_table_get(janet_vm_dns_cache, janet_wrap_string(key));
+    if (!janet_checktype(entry, JANET_TUPLE)) return NULL;
+    const Janet *pair = janet_unwrap_tuple(entry);
+    if (janet_unwrap_number(pair[0]) < net_now()) {
+        janet_table_remove(janet_vm_dns_cache, janet_wrap_string(key));
+        return NULL;
     }
+    return janet_unwrap_array(pair[1]);
 }
 
-static Janet cfun_net_connect(int32_t argc, Janet *argv) {
-    janet_arity(argc, 2, 3);
+static void net_dns_cache_put(JanetString key, JanetArray *addrs) {
+    if (janet_vm_dns_ttl <= 0) return;
+    if (NULL == janet_vm_dns_cache) {
+        janet_vm_dns_cache = janet_table(0);
+        janet_gcroot(janet_wrap_table(janet_vm_dns_cache));
+    } else if (janet_vm_dns_cache->count >= JANET_DNS_CACHE_MAX) {
+        janet_table_clear(janet_vm_dns_cache);
+    }
+    Janet pair[2];
+    pair[0] = janet_wrap_number(net_now() + janet_vm_dns_ttl);
+    pair[1] = janet_wrap_array(addrs);
+    janet_table_put(janet_vm_dns_cache, janet_wrap_string(key), janet_wrap_tuple(janet_tuple_n(pair, 2)));
+}
 
-    int socktype = janet_get_sockettype(argv, argc, 2);
-    int is_unix = 0;
-    struct addrinfo *ai = janet_get_addrinfo(argv, 0, socktype, 0, &is_unix);
+/* Copy every result of getaddrinfo into an address abstract */
+static JanetArray *net_addrinfo_array(struct addrinfo *ai) {
+    JanetArray *arr = janet_array(4);
+    for (struct addrinfo *iter = ai; NULL != iter; iter = iter->ai_next) {
+        void *abst = janet_abstract(&janet_address_type, iter->ai_addrlen);
+        memcpy(abst, iter->ai_addr, iter->ai_addrlen);
+        janet_array_push(arr, janet_wrap_abstract(abst));
+    }
+    return arr;
+}
 
-    /* Create socket */
+/* Open a connected socket to the first address a socket can be created for.
+ * Returns 0 and the stream in *out, or 1 and an error message in *out. */
+static int net_connect_addrs(JanetArray *addrs, int socktype, Janet *out) {
     JSock sock = JSOCKDEFAULT;
-    void *addr = NULL;
+    const struct sockaddr *addr = NULL;
     socklen_t addrlen = 0;
-#ifndef JANET_WINDOWS
-    if (is_unix) {
-        sock = socket(AF_UNIX, socktype | JSOCKFLAGS, 0);
-        if (!JSOCKVALID(sock)) {
-            janet_panicf("could not create socket: %V", janet_ev_lasterr());
-        }
-        addr = (void *) ai;
-        addrlen = sizeof(struct sockaddr_un);
-    } else
-#endif
-    {
-        struct addrinfo *rp = NULL;
-        for (rp = ai; rp != NULL; rp = rp->ai_next) {
+    for (int32_t i = 0; i < addrs->count; i++) {
+        const struct sockaddr *sa = janet_unwrap_abstract(addrs->data[i]);
 #ifdef JANET_WINDOWS
-            sock = WSASocketW(rp->ai_family, rp->ai_socktype | JSOCKFLAGS, rp->ai_protocol, NULL, 0, WSA_FLAG_OVERLAPPED);
+        sock = WSASocketW(sa->sa_family, socktype | JSOCKFLAGS, 0, NULL, 0, WSA_FLAG_OVERLAPPED);
 #else
-            sock = socket(rp->ai_family, rp->ai_socktype | JSOCKFLAGS, rp->ai_protocol);
+        sock = socket(sa->sa_family, socktype | JSOCKFLAGS, 0);
 #endif
-            if (JSOCKVALID(sock)) {
-                addr = rp->ai_addr;
-                addrlen = (socklen_t) rp->ai_addrlen;
-                break;
-            }
-        }
-        if (NULL == addr) {
-            freeaddrinfo(ai);
-            janet_panicf("could not create socket: %V", janet_ev_lasterr());
+        if (JSOCKVALID(sock)) {
+            addr = sa;
+            addrlen = (socklen_t) janet_abstract_size(sa);
+            break;
         }
     }
+    if (NULL == addr) {
+        *out = janet_wrap_string(janet_formatc("could not create socket: %V", janet_ev_lasterr()));
+        return 1;
+    }
 
     /* Connect to socket */
 #ifdef JANET_WINDOWS
     int status = WSAConnect(sock, addr, addrlen, NULL, NULL, NULL, NULL);
-    freeaddrinfo(ai);
 #else
     int status = connect(sock, addr, addrlen);
-    if (is_unix) {
-        janet_free(ai);
-    } else {
-        freeaddrinfo(ai);
-    }
 #endif
-
     if (status == -1) {
+        *out = janet_wrap_string(janet_formatc("could not connect to socket: %V", janet_ev_lasterr()));
         JSOCKCLOSE(sock);
-        janet_panicf("could not connect to socket: %V", janet_ev_lasterr());
+        return 1;
     }
 
     /* Set up the socket for non-blocking IO after connect - TODO - non-blocking connect? */
@@ -414,7 +483,178 @@ static Janet cfun_net_connect(int32_t argc, Janet *argv) {
 
     /* Wrap socket in abstract type JanetStream */
     JanetStream *stream = make_stream(sock, JANET_STREAM_READABLE | JANET_STREAM_WRITABLE);
-    return janet_wrap_abstract(stream);
+    *out = janet_wrap_abstract(stream);
+    return 0;
+}
+
+/* Turn resolved addresses into the result of net/address or net/connect.
+ * Returns 0 and the result in *out, or 1 and an error message in *out. */
+static int net_resolve_finish(JanetResolveMode mode, JanetArray *addrs, int socktype, Janet *out) {
+    if (mode == JANET_RESOLVE_ADDRESSES) {
+        *out = janet_wrap_array(janet_array_n(addrs->data, addrs->count));
+        return 0;
+    }
+    if (addrs->count == 0) {
+        *out = janet_cstringv("no data for given address");
+        return 1;
+    }
+    if (mode == JANET_RESOLVE_ADDRESS) {
+        *out = addrs->data[0];
+        return 0;
+    }
+    return net_connect_addrs(addrs, socktype, out);
+}
+
+static JanetEVGenericMessage net_resolve_subr(JanetEVGenericMessage msg) {
+    NetResolve *r = (NetResolve *) msg.argp;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = r->socktype;
+    r->status = getaddrinfo(r->host, r->port, &hints, &r->ai);
+    return msg;
+}
+
+static void net_resolve_callback(JanetEVGenericMessage msg) {
+    NetResolve *r = (NetResolve *) msg.argp;
+    JanetFiber *fiber = msg.fiber;
+    JanetArray *addrs = NULL;
+    if (r->status == 0) {
+        addrs = net_addrinfo_array(r->ai);
+        net_dns_cache_put(net_dns_key(r->host, r->port, r->socktype), addrs);
+        freeaddrinfo(r->ai);
+    }
+    /* Do not resume a fiber that was canceled or timed out in the meantime */
+    if (fiber->sched_id == r->sched_id) {
+        Janet result;
+        if (NULL == addrs) {
+            janet_cancel(fiber, janet_wrap_string(janet_formatc("could not get address info: %s",
+                         gai_strerror(r->status))));
+        } else if (net_resolve_finish(r->mode, addrs, r->socktype, &result)) {
+            janet_cancel(fiber, result);
+        } else {
+            janet_schedule(fiber, result);
+        }
+    }
+    janet_gcunroot(janet_wrap_fiber(fiber));
+    janet_free(r->host);
+    janet_free(r->port);
+    janet_free(r);
+}
+
+static char *net_strdup(const char *s) {
+    if (NULL == s) return NULL;
+    size_t len = strlen(s) + 1;
+    char *copy = janet_malloc(len);
+    if (NULL == copy) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memcpy(copy, s, len);
+    return copy;
+}
+
+/* Resolve the host and port at argv[offset] for net/address and net/connect. Finishes
+ * right away when the address is numeric, a unix path, or cached, and otherwise
+ * suspends the current fiber until the thread pool has looked it up. */
+static Janet net_resolve(Janet *argv, int32_t offset, int socktype, JanetResolveMode mode) {
+    JanetArray *addrs = NULL;
+    Janet result;
+    int is_unix = 0;
+    struct addrinfo *ai = NULL;
+    JanetString key = NULL;
+    int async = NULL != janet_root_fiber();
+    if (!janet_keyeq(argv[offset], "unix")) {
+        const char *host = janet_getcstring(argv, offset);
+        const char *port;
+        if (janet_checkint(argv[offset + 1])) {
+            port = (const char *)janet_to_string(argv[offset + 1]);
+        } else {
+            port = janet_optcstring(argv, offset + 2, offset + 1, NULL);
+        }
+        key = net_dns_key(host, port, socktype);
+        addrs = net_dns_cache_get(key);
+        if (NULL == addrs) {
+            struct addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = socktype;
+            hints.ai_flags = AI_NUMERICHOST;
+            if (!async || getaddrinfo(host, port, &hints, &ai)) {
+                ai = NULL;
+            }
+        }
+        if (NULL == addrs && NULL == ai && async) {
+            NetResolve *r = janet_malloc(sizeof(NetResolve));
+            if (NULL == r) {
+                JANET_OUT_OF_MEMORY;
+            }
+            r->host = net_strdup(host);
+            r->port = net_strdup(port);
+            r->socktype = socktype;
+            r->status = 0;
+            r->mode = mode;
+            r->ai = NULL;
+            JanetEVGenericMessage msg;
+            msg.tag = 0;
+            msg.argi = 0;
+            msg.argp = r;
+            msg.fiber = janet_root_fiber();
+            r->sched_id = msg.fiber->sched_id;
+            janet_ev_threaded_call(net_resolve_subr, msg, net_resolve_callback);
+            janet_gcroot(janet_wrap_fiber(msg.fiber));
+            janet_await();
+        }
+    }
+    if (NULL == addrs) {
+        if (NULL == ai) ai = janet_get_addrinfo(argv, offset, socktype, 0, &is_unix);
+#ifndef JANET_WINDOWS
+        if (is_unix) {
+            void *abst = janet_abstract(&janet_address_type, sizeof(struct sockaddr_un));
+            memcpy(abst, ai, sizeof(struct sockaddr_un));
+            janet_free(ai);
+            addrs = janet_array(1);
+            janet_array_push(addrs, janet_wrap_abstract(abst));
+        } else
+#endif
+        {
+            addrs = net_addrinfo_array(ai);
+            freeaddrinfo(ai);
+            if (!async) net_dns_cache_put(key, addrs);
+        }
+    }
+    if (net_resolve_finish(mode, addrs, socktype, &result)) {
+        janet_panicv(result);
+    }
+    return result;
+}
+
+/*
+ * C Funs
+ */
+
+static Janet cfun_net_sockaddr(int32_t argc, Janet *argv) {
+    janet_arity(argc, 2, 4);
+    int socktype = janet_get_sockettype(argv, argc, 2);
+    int make_arr = (argc >= 4 && janet_truthy(argv[3]));
+    return net_resolve(argv, 0, socktype, make_arr ? JANET_RESOLVE_ADDRESSES : JANET_RESOLVE_ADDRESS);
+}
+
+static Janet cfun_net_connect(int32_t argc, Janet *argv) {
+    janet_arity(argc, 2, 3);
+    int socktype = janet_get_sockettype(argv, argc, 2);
+    return net_resolve(argv, 0, socktype, JANET_RESOLVE_CONNECT);
+}
+
+static Janet cfun_net_dns_cache(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    double old = janet_vm_dns_ttl;
+    if (argc > 0) {
+        double ttl = janet_getnumber(argv, 0);
+        if (ttl < 0 || isnan(ttl)) janet_panicf("expected non-negative ttl, got %v", argv[0]);
+        janet_vm_dns_ttl = ttl;
+    }
+    if (NULL != janet_vm_dns_cache) janet_table_clear(janet_vm_dns_cache);
+    return janet_wrap_number(old);
 }
 
 static const char *serverify_socket(JSock sfd) {
@@ -473,6 +713,71 @@ static Janet cfun_net_shutdown(int32_t argc, Janet *argv) {
     return argv[0];
 }
 
+typedef struct {
+    const char *name;
+    int level;
+    int option;
+    int is_bool;
+} JanetSockOption;
+
+static const JanetSockOption janet_socket_options[] = {
+    {"ip-multicast-ttl", IPPROTO_IP, IP_MULTICAST_TTL, 0},
+    {"so-broadcast", SOL_SOCKET, SO_BROADCAST, 1},
+    {"so-keepalive", SOL_SOCKET, SO_KEEPALIVE, 1},
+    {"so-rcvbuf", SOL_SOCKET, SO_RCVBUF, 0},
+    {"so-reuseaddr", SOL_SOCKET, SO_REUSEADDR, 1},
+    {"so-sndbuf", SOL_SOCKET, SO_SNDBUF, 0},
+#ifdef TCP_KEEPCNT
+    {"tcp-keepcnt", IPPROTO_TCP, TCP_KEEPCNT, 0},
+#endif
+#ifdef TCP_KEEPIDLE
+    {"tcp-keepidle", IPPROTO_TCP, TCP_KEEPIDLE, 0},
+#endif
+#ifdef TCP_KEEPINTVL
+    {"tcp-keepintvl", IPPROTO_TCP, TCP_KEEPINTVL, 0},
+#endif
+    {"tcp-nodelay", IPPROTO_TCP, TCP_NODELAY, 1},
+    {NULL, 0, 0, 0}
+};
+
+static Janet cfun_net_setsockopt(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 3);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_SOCKET);
+    JanetKeyword name = janet_getkeyword(argv, 1);
+    const JanetSockOption *opt = janet_socket_options;
+    while (NULL != opt->name && janet_cstrcmp(name, opt->name)) opt++;
+    if (NULL == opt->name) {
+        janet_panicf("unknown socket option %v", argv[1]);
+    }
+    int val = opt->is_bool ? janet_truthy(argv[2]) : janet_getinteger(argv, 2);
+    if (setsockopt((JSock) stream->handle, opt->level, opt->option, (char *) &val, sizeof(int))) {
+        janet_panicf("could not set socket option %v: %V", argv[1], janet_ev_lasterr());
+    }
+    return argv[0];
+}
+
+/* A pooled connection can be handed out again only if nothing is waiting on it,
+ * the peer has not closed it, and there is no stale data left to read. */
+static Janet cfun_net_idle(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    if (stream->flags & (JANET_STREAM_CLOSED | JANET_STREAM_CLOSE_PENDING)) return janet_wrap_false();
+    if (!(stream->flags & JANET_STREAM_SOCKET)) janet_panic("expected socket stream");
+    if (NULL != stream->state) return janet_wrap_false();
+    char c;
+#ifdef JANET_WINDOWS
+    int status = recv((JSock) stream->handle, &c, 1, MSG_PEEK);
+    return janet_wrap_boolean(status == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+    ssize_t status;
+    do {
+        status = recv(stream->handle, &c, 1, MSG_PEEK);
+    } while (status == -1 && errno == EINTR);
+    return janet_wrap_boolean(status == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+#endif
+}
+
 static Janet cfun_net_listen(int32_t argc, Janet *argv) {
     janet_arity(argc, 2, 3);
 
@@ -568,7 +873,7 @@ static Janet cfun_stream_read(int32_t argc, Janet *argv) {
     janet_arity(argc, 2, 4);
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
     janet_stream_flags(stream, JANET_STREAM_READABLE | JANET_STREAM_SOCKET);
-    JanetBuffer *buffer = janet_optbuffer(argv, argc, 2, 10);
+    JanetBuffer *buffer = janet_optbuffer_pooled(argv, argc, 2, argv[1]);
     double to = janet_optnumber(argv, argc, 3, INFINITY);
     if (janet_keyeq(argv[1], "all")) {
         if (to != INFINITY) janet_addtimeout(to);
@@ -586,7 +891,7 @@ static Janet cfun_stream_chunk(int32_t argc, Janet *argv) {
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
     janet_stream_flags(stream, JANET_STREAM_READABLE | JANET_STREAM_SOCKET);
     int32_t n = janet_getnat(argv, 1);
-    JanetBuffer *buffer = janet_optbuffer(argv, argc, 2, 10);
+    JanetBuffer *buffer = janet_optbuffer_pooled(argv, argc, 2, argv[1]);
     double to = janet_optnumber(argv, argc, 3, INFINITY);
     if (to != INFINITY) janet_addtimeout(to);
     janet_ev_recvchunk(stream, buffer, n, MSG_NOSIGNAL);
@@ -610,7 +915,15 @@ static Janet cfun_stream_write(int32_t argc, Janet *argv) {
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
     janet_stream_flags(stream, JANET_STREAM_WRITABLE | JANET_STREAM_SOCKET);
     double to = janet_optnumber(argv, argc, 2, INFINITY);
-    if (janet_checktype(argv[1], JANET_BUFFER)) {
+    JanetTuple parts = janet_ev_getparts(argv, 1);
+    if (NULL == parts) janet_getbytes(argv, 1);
+    if (janet_stream_coalesce(stream, parts ? janet_wrap_tuple(parts) : argv[1], to)) {
+        return janet_wrap_nil();
+    }
+    if (NULL != parts) {
+        if (to != INFINITY) janet_addtimeout(to);
+        janet_ev_send_parts(stream, parts, MSG_NOSIGNAL);
+    } else if (janet_checktype(argv[1], JANET_BUFFER)) {
         if (to != INFINITY) janet_addtimeout(to);
         janet_ev_send_buffer(stream, janet_getbuffer(argv, 1), MSG_NOSIGNAL);
     } else {
@@ -638,6 +951,272 @@ static Janet cfun_stream_send_to(int32_t argc, Janet *argv) {
     janet_await();
 }
 
+#ifndef JANET_WINDOWS
+
+/* State machines for batches of datagrams. On Linux a whole batch is moved with one
+ * recvmmsg or sendmmsg call, elsewhere with a loop over recvfrom or sendto. Either way
+ * the fiber is only resumed once per batch. */
+
+#define JANET_NET_BATCH_MAX 64
+
+#if defined(JANET_LINUX) && defined(__NR_recvmmsg) && defined(__NR_sendmmsg)
+#define JANET_NET_MMSG
+/* Same layout as struct mmsghdr, which needs _GNU_SOURCE */
+struct janet_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#endif
+
+typedef struct {
+    JanetListenerState head;
+    JanetArray *buffers;
+    int32_t nbytes;
+} NetStateRecvBatch;
+
+JanetAsyncStatus net_machine_recv_batch(JanetListenerState *s, JanetAsyncEvent event) {
+    NetStateRecvBatch *state = (NetStateRecvBatch *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_array(state->buffers));
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_schedule(s->fiber, janet_wrap_nil());
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_READ: {
+            JanetBuffer *buffers[JANET_NET_BATCH_MAX];
+            struct sockaddr_storage addrs[JANET_NET_BATCH_MAX];
+            socklen_t addrlens[JANET_NET_BATCH_MAX];
+            int32_t lens[JANET_NET_BATCH_MAX];
+            int32_t count = state->buffers->count;
+            if (count > JANET_NET_BATCH_MAX) count = JANET_NET_BATCH_MAX;
+            /* The array may have changed while we waited */
+            for (int32_t i = 0; i < count; i++) {
+                Janet x = state->buffers->data[i];
+                if (!janet_checktype(x, JANET_BUFFER)) {
+                    janet_cancel(s->fiber, janet_wrap_string(janet_formatc("expected buffer, got %v", x)));
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                buffers[i] = janet_unwrap_buffer(x);
+                janet_buffer_extra(buffers[i], state->nbytes);
+            }
+            int32_t nrecv = 0;
+#ifdef JANET_NET_MMSG
+            struct janet_mmsghdr msgs[JANET_NET_BATCH_MAX];
+            struct iovec iovs[JANET_NET_BATCH_MAX];
+            memset(msgs, 0, count * sizeof(struct janet_mmsghdr));
+            for (int32_t i = 0; i < count; i++) {
+                iovs[i].iov_base = buffers[i]->data + buffers[i]->count;
+                iovs[i].iov_len = (size_t) state->nbytes;
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_hdr.msg_name = &addrs[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+            }
+            long status;
+            do {
+                status = syscall(__NR_recvmmsg, s->stream->handle, msgs, (unsigned int) count, MSG_NOSIGNAL, NULL);
+            } while (status == -1 && errno == EINTR);
+            if (status == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return JANET_ASYNC_STATUS_NOT_DONE;
+                janet_cancel(s->fiber, janet_ev_lasterr());
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            nrecv = (int32_t) status;
+            for (int32_t i = 0; i < nrecv; i++) {
+                lens[i] = (int32_t) msgs[i].msg_len;
+                addrlens[i] = msgs[i].msg_hdr.msg_namelen;
+            }
+#else
+            for (; nrecv < count; nrecv++) {
+                ssize_t nread;
+                addrlens[nrecv] = sizeof(struct sockaddr_storage);
+                do {
+                    nread = recvfrom(s->stream->handle, buffers[nrecv]->data + buffers[nrecv]->count,
+                                     (size_t) state->nbytes, MSG_NOSIGNAL,
+                                     (struct sockaddr *) &addrs[nrecv], &addrlens[nrecv]);
+                } while (nread == -1 && errno == EINTR);
+                if (nread == -1) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    if (nrecv > 0) break;
+                    janet_cancel(s->fiber, janet_ev_lasterr());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                lens[nrecv] = (int32_t) nread;
+            }
+            if (nrecv == 0) return JANET_ASYNC_STATUS_NOT_DONE;
+#endif
+            JanetArray *from = janet_array(nrecv);
+            for (int32_t i = 0; i < nrecv; i++) {
+                /* A datagram longer than nbytes is truncated */
+                buffers[i]->count += lens[i] < state->nbytes ? lens[i] : state->nbytes;
+                void *abst = janet_abstract(&janet_address_type, addrlens[i]);
+                memcpy(abst, &addrs[i], addrlens[i]);
+                janet_array_push(from, janet_wrap_abstract(abst));
+            }
+            janet_schedule(s->fiber, janet_wrap_array(from));
+            return JANET_ASYNC_STATUS_DONE;
+        }
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+static Janet cfun_stream_recv_batch(int32_t argc, Janet *argv) {
+    janet_arity(argc, 3, 4);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_UDPSERVER | JANET_STREAM_SOCKET);
+    int32_t n = janet_getnat(argv, 1);
+    JanetArray *buffers = janet_getarray(argv, 2);
+    double to = janet_optnumber(argv, argc, 3, INFINITY);
+    if (buffers->count == 0) janet_panic("expected at least one buffer");
+    for (int32_t i = 0; i < buffers->count && i < JANET_NET_BATCH_MAX; i++) {
+        if (!janet_checktype(buffers->data[i], JANET_BUFFER)) {
+            janet_panicf("expected buffer, got %v", buffers->data[i]);
+        }
+    }
+    if (to != INFINITY) janet_addtimeout(to);
+    NetStateRecvBatch *state = (NetStateRecvBatch *) janet_listen(stream, net_machine_recv_batch,
+                               JANET_ASYNC_LISTEN_READ, sizeof(NetStateRecvBatch), NULL);
+    state->buffers = buffers;
+    state->nbytes = n;
+    janet_await();
+}
+
+typedef struct {
+    JanetListenerState head;
+    const Janet *dests;
+    const Janet *datas;
+    int32_t next;
+} NetStateSendBatch;
+
+/* Get the destination of a datagram in a batch */
+static void *net_batch_dest(NetStateSendBatch *state, int32_t i) {
+    int32_t n = janet_tuple_length(state->dests) == 1 ? 0 : i;
+    return janet_unwrap_abstract(state->dests[n]);
+}
+
+JanetAsyncStatus net_machine_send_batch(JanetListenerState *s, JanetAsyncEvent event) {
+    NetStateSendBatch *state = (NetStateSendBatch *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_tuple(state->dests));
+            janet_mark(janet_wrap_tuple(state->datas));
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_cancel(s->fiber, janet_cstringv("stream closed"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_ERR:
+            janet_cancel(s->fiber, janet_cstringv("stream err"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_WRITE: {
+            int32_t count = janet_tuple_length(state->datas);
+            /* Keep sending until done or the socket would block */
+            while (state->next < count) {
+                int32_t start = state->next;
+                int32_t batch = count - start;
+                if (batch > JANET_NET_BATCH_MAX) batch = JANET_NET_BATCH_MAX;
+                int32_t nsent = 0;
+#ifdef JANET_NET_MMSG
+                struct janet_mmsghdr msgs[JANET_NET_BATCH_MAX];
+                struct iovec iovs[JANET_NET_BATCH_MAX];
+                memset(msgs, 0, batch * sizeof(struct janet_mmsghdr));
+                for (int32_t i = 0; i < batch; i++) {
+                    const uint8_t *bytes;
+                    int32_t len;
+                    janet_bytes_view(state->datas[start + i], &bytes, &len);
+                    void *dest = net_batch_dest(state, start + i);
+                    iovs[i].iov_base = (void *) bytes;
+                    iovs[i].iov_len = (size_t) len;
+                    msgs[i].msg_hdr.msg_iov = &iovs[i];
+                    msgs[i].msg_hdr.msg_iovlen = 1;
+                    msgs[i].msg_hdr.msg_name = dest;
+                    msgs[i].msg_hdr.msg_namelen = (socklen_t) janet_abstract_size(dest);
+                }
+                long status;
+                do {
+                    status = syscall(__NR_sendmmsg, s->stream->handle, msgs, (unsigned int) batch, MSG_NOSIGNAL);
+                } while (status == -1 && errno == EINTR);
+                if (status == -1) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) return JANET_ASYNC_STATUS_NOT_DONE;
+                    janet_cancel(s->fiber, janet_ev_lasterr());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                nsent = (int32_t) status;
+#else
+                for (; nsent < batch; nsent++) {
+                    const uint8_t *bytes;
+                    int32_t len;
+                    janet_bytes_view(state->datas[start + nsent], &bytes, &len);
+                    void *dest = net_batch_dest(state, start + nsent);
+                    ssize_t nwrote;
+                    do {
+                        nwrote = sendto(s->stream->handle, bytes, (size_t) len, MSG_NOSIGNAL,
+                                        (struct sockaddr *) dest, janet_abstract_size(dest));
+                    } while (nwrote == -1 && errno == EINTR);
+                    if (nwrote == -1) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            state->next += nsent;
+                            return JANET_ASYNC_STATUS_NOT_DONE;
+                        }
+                        janet_cancel(s->fiber, janet_ev_lasterr());
+                        return JANET_ASYNC_STATUS_DONE;
+                    }
+                }
+#endif
+                state->next += nsent;
+            }
+            janet_schedule(s->fiber, janet_wrap_nil());
+            return JANET_ASYNC_STATUS_DONE;
+        }
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+static Janet cfun_stream_send_batch(int32_t argc, Janet *argv) {
+    janet_arity(argc, 3, 4);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_UDPSERVER | JANET_STREAM_SOCKET);
+    JanetView datas = janet_getindexed(argv, 2);
+    double to = janet_optnumber(argv, argc, 3, INFINITY);
+    const Janet *dests;
+    if (janet_checkabstract(argv[1], &janet_address_type)) {
+        dests = janet_tuple_n(argv + 1, 1);
+    } else {
+        JanetView view = janet_getindexed(argv, 1);
+        if (view.len != datas.len) {
+            janet_panicf("expected %d destinations, got %d", datas.len, view.len);
+        }
+        for (int32_t i = 0; i < view.len; i++) {
+            if (!janet_checkabstract(view.items[i], &janet_address_type)) {
+                janet_panicf("expected socket address, got %v", view.items[i]);
+            }
+        }
+        dests = janet_tuple_n(view.items, view.len);
+    }
+    for (int32_t i = 0; i < datas.len; i++) {
+        const uint8_t *bytes;
+        int32_t len;
+        if (!janet_bytes_view(datas.items[i], &bytes, &len)) {
+            janet_panicf("expected bytes, got %v", datas.items[i]);
+        }
+    }
+    if (datas.len == 0) return janet_wrap_nil();
+    if (to != INFINITY) janet_addtimeout(to);
+    NetStateSendBatch *state = (NetStateSendBatch *) janet_listen(stream, net_machine_send_batch,
+                               JANET_ASYNC_LISTEN_WRITE, sizeof(NetStateSendBatch), NULL);
+    /* Snapshot the datagrams, later changes to the array do not affect the batch */
+    state->datas = janet_tuple_n(datas.items, datas.len);
+    state->dests = dests;
+    state->next = 0;
+    janet_await();
+}
+
+#endif
+
 static Janet cfun_stream_flush(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
@@ -650,17 +1229,326 @@ static Janet cfun_stream_flush(int32_t argc, Janet *argv) {
     return argv[0];
 }
 
+/* State machine for net/sendfile. Where the platform allows it, file contents go
+ * from the page cache straight into the socket without a copy through user space. */
+
+#define JANET_NET_SENDFILE_CHUNK 0x40000000
+
+typedef struct {
+    JanetListenerState head;
+    JanetFile *file;
+    int64_t offset;
+    int64_t left;
+    int64_t sent;
+#ifdef JANET_WINDOWS
+    OVERLAPPED overlapped;
+#endif
+} NetStateSendfile;
+
+#ifdef JANET_LINUX
+/* sendfile and splice take no MSG_NOSIGNAL flag, so hold SIGPIPE back while they run
+ * and discard one that they raise. A closed peer is then reported as EPIPE only. */
+static void net_sigpipe_hold(sigset_t *old, int *pending) {
+    sigset_t set, pend;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, old);
+    sigpending(&pend);
+    *pending = sigismember(&pend, SIGPIPE);
+}
+
+static void net_sigpipe_release(const sigset_t *old, int pending, ssize_t result) {
+    if (result == -1 && errno == EPIPE && !pending) {
+        int save = errno;
+        sigset_t set;
+        struct timespec zero = {0, 0};
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        while (sigtimedwait(&set, NULL, &zero) == -1 && errno == EINTR);
+        errno = save;
+    }
+    pthread_sigmask(SIG_SETMASK, old, NULL);
+}
+#endif
+
+#ifndef JANET_WINDOWS
+/* Send up to len bytes of a file starting at offset. Returns the number of bytes sent,
+ * 0 at end of file, or -1 with errno set. */
+static ssize_t net_sendfile_impl(JSock sock, int fd, int64_t offset, size_t len) {
+    ssize_t nsent;
+#if defined(JANET_LINUX)
+    off_t off = (off_t) offset;
+    sigset_t old;
+    int pending;
+    net_sigpipe_hold(&old, &pending);
+    do {
+        nsent = sendfile(sock, fd, &off, len);
+    } while (nsent == -1 && errno == EINTR);
+    net_sigpipe_release(&old, pending, nsent);
+#elif defined(JANET_APPLE) || defined(__FreeBSD__) || defined(__DragonFly__)
+    /* The BSDs report a partial send through sbytes, even on EAGAIN */
+    off_t sbytes;
+    int status;
+    do {
+#ifdef JANET_APPLE
+        sbytes = (off_t) len;
+        status = sendfile(fd, sock, (off_t) offset, &sbytes, NULL, 0);
+#else
+        sbytes = 0;
+        status = sendfile(fd, sock, (off_t) offset, len, NULL, &sbytes, 0);
+#endif
+    } while (status == -1 && errno == EINTR && sbytes == 0);
+    nsent = (status == -1 && sbytes == 0) ? -1 : (ssize_t) sbytes;
+#else
+    /* No sendfile, so copy through a small buffer */
+    char buf[4096];
+    ssize_t nread;
+    do {
+        nread = pread(fd, buf, len > sizeof(buf) ? sizeof(buf) : len, (off_t) offset);
+    } while (nread == -1 && errno == EINTR);
+    if (nread <= 0) return nread;
+    do {
+        nsent = send(sock, buf, (size_t) nread, MSG_NOSIGNAL);
+    } while (nsent == -1 && errno == EINTR);
+#endif
+    return nsent;
+}
+#endif
+
+JanetAsyncStatus net_machine_sendfile(JanetListenerState *s, JanetAsyncEvent event) {
+    NetStateSendfile *state = (NetStateSendfile *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_INIT:
+            /* Keep the file from being read, moved or closed under us */
+            state->file = (JanetFile *) s->event;
+            state->file->flags |= JANET_FILE_BUSY;
+            break;
+        case JANET_ASYNC_EVENT_DEINIT:
+            state->file->flags &= ~JANET_FILE_BUSY;
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_abstract(state->file));
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_cancel(s->fiber, janet_cstringv("stream closed"));
+            return JANET_ASYNC_STATUS_DONE;
+#ifdef JANET_WINDOWS
+        case JANET_ASYNC_EVENT_COMPLETE:
+            state->sent += s->bytes;
+            state->offset += s->bytes;
+            state->left -= s->bytes;
+            if (s->bytes == 0 || state->left <= 0) {
+                janet_schedule(s->fiber, janet_wrap_number((double) state->sent));
+                return JANET_ASYNC_STATUS_DONE;
+            }
+        /* fallthrough - send the next piece */
+        case JANET_ASYNC_EVENT_USER: {
+            HANDLE fh = (HANDLE) _get_osfhandle(_fileno(state->file->file));
+            DWORD nbytes = (DWORD)(state->left > JANET_NET_SENDFILE_CHUNK ? JANET_NET_SENDFILE_CHUNK : state->left);
+            memset(&state->overlapped, 0, sizeof(OVERLAPPED));
+            state->overlapped.Offset = (DWORD)(state->offset & 0xFFFFFFFF);
+            state->overlapped.OffsetHigh = (DWORD)(state->offset >> 32);
+            s->tag = &state->overlapped;
+            if (!TransmitFile((SOCKET) s->stream->handle, fh, nbytes, 0, &state->overlapped, NULL, 0)) {
+                int code = WSAGetLastError();
+                if (code != WSA_IO_PENDING && code != ERROR_IO_PENDING) {
+                    janet_cancel(s->fiber, janet_ev_lasterr());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+            }
+        }
+        break;
+#else
+        case JANET_ASYNC_EVENT_ERR:
+            janet_cancel(s->fiber, janet_cstringv("stream err"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_HUP:
+            janet_cancel(s->fiber, janet_cstringv("stream hup"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_WRITE: {
+            int fd = fileno(state->file->file);
+            /* Keep sending until done or the socket would block */
+            while (state->left > 0) {
+                size_t nbytes = (size_t)(state->left > JANET_NET_SENDFILE_CHUNK ? JANET_NET_SENDFILE_CHUNK : state->left);
+                ssize_t nsent = net_sendfile_impl((JSock) s->stream->handle, fd, state->offset, nbytes);
+                if (nsent == -1) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    janet_cancel(s->fiber, janet_ev_lasterr());
+                    return JANET_ASYNC_STATUS_DONE;
+                }
+                /* The file was truncated - send what there was */
+                if (nsent == 0) state->left = 0;
+                state->sent += nsent;
+                state->offset += nsent;
+                state->left -= nsent;
+            }
+            if (state->left <= 0) {
+                janet_schedule(s->fiber, janet_wrap_number((double) state->sent));
+                return JANET_ASYNC_STATUS_DONE;
+            }
+        }
+        break;
+#endif
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+static Janet cfun_stream_sendfile(int32_t argc, Janet *argv) {
+    janet_arity(argc, 2, 5);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_WRITABLE | JANET_STREAM_SOCKET);
+    JanetFile *file = janet_getabstract(argv, 1, &janet_file_type);
+    if (file->flags & JANET_FILE_CLOSED) janet_panic("file is closed");
+    if (file->flags & JANET_FILE_BUSY) janet_panic("file is busy");
+    if (!(file->flags & (JANET_FILE_READ | JANET_FILE_UPDATE))) janet_panic("file is not readable");
+    int64_t offset = janet_optinteger64(argv, argc, 2, 0);
+    if (offset < 0) janet_panic("expected non-negative offset");
+    double to = janet_optnumber(argv, argc, 4, INFINITY);
+    /* Pending writes must reach the file before the kernel reads it */
+    if (file->flags & (JANET_FILE_WRITE | JANET_FILE_APPEND | JANET_FILE_UPDATE)) {
+        fflush(file->file);
+    }
+#ifdef JANET_WINDOWS
+    struct _stat64 st;
+    if (_fstat64(_fileno(file->file), &st)) janet_panicv(janet_ev_lasterr());
+#else
+    struct stat st;
+    if (fstat(fileno(file->file), &st)) janet_panicv(janet_ev_lasterr());
+#endif
+    int64_t length = (int64_t) st.st_size > offset ? (int64_t) st.st_size - offset : 0;
+    if (argc > 3 && !janet_checktype(argv[3], JANET_NIL)) {
+        int64_t limit = janet_getinteger64(argv, 3);
+        if (limit < 0) janet_panic("expected non-negative length");
+        if (limit < length) length = limit;
+    }
+    if (length == 0) return janet_wrap_integer(0);
+    if (to != INFINITY) janet_addtimeout(to);
+    NetStateSendfile *state = (NetStateSendfile *) janet_listen(stream, net_machine_sendfile,
+                              JANET_ASYNC_LISTEN_WRITE, sizeof(NetStateSendfile), file);
+    state->offset = offset;
+    state->left = length;
+    state->sent = 0;
+#ifdef JANET_WINDOWS
+    net_machine_sendfile((JanetListenerState *) state, JANET_ASYNC_EVENT_USER);
+#endif
+    janet_await();
+}
+
+#ifdef JANET_LINUX
+
+/* State machine for net/splice. One of the two streams is a pipe, which is assumed
+ * to be ready, so only the other stream is waited on. */
+
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#endif
+#ifndef SPLICE_F_NONBLOCK
+#define SPLICE_F_NONBLOCK 2
+#endif
+
+typedef struct {
+    JanetListenerState head;
+    JanetStream *other;
+    int into_pipe;
+    size_t nbytes;
+} NetStateSplice;
+
+JanetAsyncStatus net_machine_splice(JanetListenerState *s, JanetAsyncEvent event) {
+    NetStateSplice *state = (NetStateSplice *) s;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_abstract(state->other));
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_cancel(s->fiber, janet_cstringv("stream closed"));
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_ERR:
+            if (state->into_pipe) {
+                janet_schedule(s->fiber, janet_wrap_nil());
+            } else {
+                janet_cancel(s->fiber, janet_cstringv("stream err"));
+            }
+            return JANET_ASYNC_STATUS_DONE;
+        case JANET_ASYNC_EVENT_HUP:
+            if (!state->into_pipe) {
+                janet_cancel(s->fiber, janet_cstringv("stream hup"));
+                return JANET_ASYNC_STATUS_DONE;
+            }
+        /* fallthrough - read to end of stream */
+        case JANET_ASYNC_EVENT_READ:
+        case JANET_ASYNC_EVENT_WRITE: {
+            if ((event == JANET_ASYNC_EVENT_WRITE) == state->into_pipe) break;
+            JanetHandle in = state->into_pipe ? s->stream->handle : state->other->handle;
+            JanetHandle out = state->into_pipe ? state->other->handle : s->stream->handle;
+            long nmoved;
+            sigset_t old;
+            int pending;
+            net_sigpipe_hold(&old, &pending);
+            do {
+                nmoved = syscall(__NR_splice, in, NULL, out, NULL, state->nbytes,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            } while (nmoved == -1 && errno == EINTR);
+            net_sigpipe_release(&old, pending, (ssize_t) nmoved);
+            if (nmoved == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                janet_cancel(s->fiber, janet_ev_lasterr());
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            janet_schedule(s->fiber, nmoved ? janet_wrap_number((double) nmoved) : janet_wrap_nil());
+            return JANET_ASYNC_STATUS_DONE;
+        }
+    }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+static int net_is_pipe(JanetStream *stream) {
+    struct stat st;
+    if (fstat(stream->handle, &st)) janet_panicv(janet_ev_lasterr());
+    return S_ISFIFO(st.st_mode);
+}
+
+static Janet cfun_stream_splice(int32_t argc, Janet *argv) {
+    janet_arity(argc, 2, 4);
+    JanetStream *src = janet_getabstract(argv, 0, &janet_stream_type);
+    JanetStream *dest = janet_getabstract(argv, 1, &janet_stream_type);
+    janet_stream_flags(src, JANET_STREAM_READABLE);
+    janet_stream_flags(dest, JANET_STREAM_WRITABLE);
+    int32_t nbytes = janet_optnat(argv, argc, 2, 0x10000);
+    double to = janet_optnumber(argv, argc, 3, INFINITY);
+    if (nbytes == 0) return janet_wrap_integer(0);
+    int into_pipe = net_is_pipe(dest);
+    if (!into_pipe && !net_is_pipe(src)) janet_panic("expected src or dest to be a pipe");
+    if (to != INFINITY) janet_addtimeout(to);
+    NetStateSplice *state = (NetStateSplice *) janet_listen(into_pipe ? src : dest, net_machine_splice,
+                            into_pipe ? JANET_ASYNC_LISTEN_READ : JANET_ASYNC_LISTEN_WRITE,
+                            sizeof(NetStateSplice), NULL);
+    state->other = into_pipe ? dest : src;
+    state->into_pipe = into_pipe;
+    state->nbytes = (size_t) nbytes;
+    janet_await();
+}
+
+#endif
+
 static const JanetMethod net_stream_methods[] = {
     {"chunk", cfun_stream_chunk},
     {"close", janet_cfun_stream_close},
     {"read", cfun_stream_read},
     {"write", cfun_stream_write},
     {"flush", cfun_stream_flush},
+    {"sendfile", cfun_stream_sendfile},
     {"accept", cfun_stream_accept},
     {"accept-loop", cfun_stream_accept_loop},
     {"send-to", cfun_stream_send_to},
     {"recv-from", cfun_stream_recv_from},
-    {"recv-from", cfun_stream_recv_from},
+#ifndef JANET_WINDOWS
+    {"recv-batch", cfun_stream_recv_batch},
+    {"send-batch", cfun_stream_send_batch},
+#endif
     {"evread", janet_cfun_stream_read},
     {"evchunk", janet_cfun_stream_chunk},
     {"evwrite", janet_cfun_stream_write},
@@ -680,7 +1568,17 @@ static const JanetReg net_cfuns[] = {
              "a handle that can be used to send datagrams over network without establishing a connection. "
              "On Posix platforms, you can use :unix for host to connect to a unix domain socket, where the name is "
              "given in the port argument. On Linux, abstract "
-             "unix domain sockets are specified with a leading '@' character in port.")
+             "unix domain sockets are specified with a leading '@' character in port. Pass a truthy "
+             "fourth argument to get an array of all matching addresses instead of just the first. "
+             "Inside the event loop, host names are looked up on a background thread so other fibers keep "
+             "running, and answers are cached for a while. See net/dns-cache.")
+    },
+    {
+        "net/dns-cache", cfun_net_dns_cache,
+        JDOC("(net/dns-cache &opt ttl)\n\n"
+             "Clear the cache of host names looked up by net/address and net/connect. If `ttl` is "
+             "given, also set how many seconds new answers stay in the cache (default 30). A ttl "
+             "of 0 disables caching. The cache is per thread. Returns the previous ttl.")
     },
     {
         "net/listen", cfun_net_listen,
@@ -724,6 +1622,8 @@ static const JanetReg net_cfuns[] = {
         JDOC("(net/write stream data &opt timeout)\n\n"
              "Write data to a stream, suspending the current fiber until the write "
              "completes. Takes an optional timeout in seconds, after which will return nil. "
+             "`data` can also be an array or tuple of byte sequences, which are sent together with a "
+             "single vectored write. See ev/coalesce for batching many small writes. "
              "Returns nil, or raises an error if the write failed.")
     },
     {
@@ -739,18 +1639,62 @@ static const JanetReg net_cfuns[] = {
              "Receives data from a server stream and puts it into a buffer. Returns the socket-address the "
              "packet came from. Takes an optional timeout in seconds, after which will return nil.")
     },
+#ifndef JANET_WINDOWS
+    {
+        "net/recv-batch", cfun_stream_recv_batch,
+        JDOC("(net/recv-batch stream nbytes buffers &opt timeout)\n\n"
+             "Receives a batch of datagrams from a server stream, one into each buffer of the array "
+             "`buffers` (at most 64 at a time). Each datagram is appended to its buffer, and truncated to "
+             "`nbytes`. Waits until at least one datagram is available, then takes as many as are "
+             "ready with a single recvmmsg call on Linux. Returns an array of the socket-addresses the "
+             "datagrams came from, one per buffer that was filled. Takes an optional timeout in seconds, "
+             "after which will return nil.")
+    },
+    {
+        "net/send-batch", cfun_stream_send_batch,
+        JDOC("(net/send-batch stream dest datas &opt timeout)\n\n"
+             "Sends each byte sequence in `datas` as a datagram from a server stream. `dest` is either "
+             "one socket-address for all datagrams, or an array or tuple with an address for each one. "
+             "The datagrams go out in batches with sendmmsg on Linux. Suspends the current fiber until "
+             "all are sent. Takes an optional timeout in seconds, after which will return nil. "
+             "Returns nil.")
+    },
+#endif
     {
         "net/flush", cfun_stream_flush,
         JDOC("(net/flush stream)\n\n"
              "Make sure that a stream is not buffering any data. This temporarily disables Nagle's algorithm. "
              "Use this to make sure data is sent without delay. Returns stream.")
     },
+    {
+        "net/sendfile", cfun_stream_sendfile,
+        JDOC("(net/sendfile stream file &opt offset length timeout)\n\n"
+             "Send the contents of a regular file to a socket stream, starting at `offset` (default 0) and "
+             "sending at most `length` bytes (default to the end of the file). The data is copied by the "
+             "kernel with sendfile(2) on Linux, macOS and FreeBSD, and TransmitFile on Windows, without passing "
+             "through a Janet buffer. The file position is not changed, and the file is busy until the send "
+             "completes. Suspends the current fiber until the send completes. Takes an optional timeout in "
+             "seconds, after which will return nil. Returns the number of bytes sent.")
+    },
+#ifdef JANET_LINUX
+    {
+        "net/splice", cfun_stream_splice,
+        JDOC("(net/splice src dest &opt nbytes timeout)\n\n"
+             "Move up to `nbytes` (default 65536) from stream `src` to stream `dest` with splice(2), "
+             "without copying the data into user space. One of the two streams must be a pipe, such as "
+             "one from os/pipe. When `dest` is the pipe, waits for `src` to be readable, otherwise waits for "
+             "`dest` to be writable. Takes an optional timeout in seconds, after which will return nil. "
+             "Returns the number of bytes moved, or nil at end of stream. Only available on Linux. "
+             "See net/forward for copying between two sockets.")
+    },
+#endif
     {
         "net/connect", cfun_net_connect,
         JDOC("(net/connect host port &opt type)\n\n"
              "Open a connection to communicate with a server. Returns a duplex stream "
              "that can be used to communicate with the server. Type is an optional keyword "
-             "to specify a connection type, either :stream or :datagram. The default is :stream. ")
+             "to specify a connection type, either :stream or :datagram. The default is :stream. "
+             "Host names are resolved as with net/address, without blocking the event loop.")
     },
     {
         "net/shutdown", cfun_net_shutdown,
@@ -762,6 +1706,21 @@ static const JanetReg net_cfuns[] = {
              "* `:w` disable writing data to the socket.\n\n"
              "Returns the original socket.")
     },
+    {
+        "net/setsockopt", cfun_net_setsockopt,
+        JDOC("(net/setsockopt stream option value)\n\n"
+             "Set an option on a socket stream. Boolean options are `:so-broadcast`, `:so-keepalive`, "
+             "`:so-reuseaddr` and `:tcp-nodelay`. Integer options are `:so-rcvbuf`, `:so-sndbuf` and "
+             "`:ip-multicast-ttl`, and where the platform has them `:tcp-keepidle`, `:tcp-keepintvl` "
+             "and `:tcp-keepcnt`, which tune keepalive probes. Returns stream.")
+    },
+    {
+        "net/idle?", cfun_net_idle,
+        JDOC("(net/idle? stream)\n\n"
+             "Check without blocking whether a connected socket stream can be reused for a new "
+             "request: it is open, no fiber is reading or writing it, the peer has not closed it, "
+             "and no data is waiting to be read.")
+    },
     {NULL, NULL, NULL}
 };
 
@@ -770,6 +1729,8 @@ void janet_lib_net(JanetTable *env) {
 }
 
 void janet_net_init(void) {
+    janet_vm_dns_cache = NULL;
+    janet_vm_dns_ttl = 30.0;
 #ifdef JANET_WINDOWS
     WSADATA wsaData;
     janet_assert(!WSAStartup(MAKEWORD(2, 2), &wsaData), "could not start winsock");
@@ -65,6 +65,15 @@ extern char **environ;
 #ifdef JANET_THREADS
 #include <pthread.h>
 #endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+/* Processes are waited on by the event loop with a pidfd on linux, or an
+ * EVFILT_PROC filter with kqueue. Otherwise a thread waits on each process. */
+#if defined(JANET_EV) && defined(__linux__) && defined(SYS_pidfd_open)
+#define JANET_PROC_PIDFD
 #endif
 
 /* For macos */
@@ -386,6 +395,17 @@ static JanetEVGenericMessage janet_proc_wait_subr(JanetEVGenericMessage args) {
 
 #else /* windows check */
 
+/* Use POSIX shell semantics for interpreting signals */
+static int janet_proc_status(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    } else if (WIFSTOPPED(status)) {
+        return WSTOPSIG(status) + 128;
+    } else {
+        return WTERMSIG(status) + 128;
+    }
+}
+
 /* Function that is called in separate thread to wait on a pid */
 static JanetEVGenericMessage janet_proc_wait_subr(JanetEVGenericMessage args) {
     JanetProc *proc = (JanetProc *) args.argp;
@@ -394,39 +414,111 @@ static JanetEVGenericMessage janet_proc_wait_subr(JanetEVGenericMessage args) {
     do {
         result = waitpid(proc->pid, &status, 0);
     } while (result == -1 && errno == EINTR);
-    /* Use POSIX shell semantics for interpreting signals */
-    if (WIFEXITED(status)) {
-        status = WEXITSTATUS(status);
-    } else if (WIFSTOPPED(status)) {
-        status = WSTOPSIG(status) + 128;
-    } else {
-        status = WTERMSIG(status) + 128;
-    }
-    args.argi = status;
+    args.argi = janet_proc_status(status);
     return args;
 }
 
 #endif /* End windows check */
 
+/* Record the exit code and resume the waiting fiber */
+static void janet_proc_wait_done(JanetEVGenericMessage args) {
+    int status = args.argi;
+    JanetProc *proc = (JanetProc *) args.argp;
+    proc->return_code = (int32_t) status;
+    proc->flags |= JANET_PROC_WAITED;
+    proc->flags &= ~JANET_PROC_WAITING;
+    if ((status != 0) && (proc->flags & JANET_PROC_ERROR_NONZERO)) {
+        JanetString s = janet_formatc("command failed with non-zero exit code %d", status);
+        janet_cancel(args.fiber, janet_wrap_string(s));
+    } else {
+        janet_schedule(args.fiber, janet_wrap_integer(status));
+    }
+}
+
 /* Callback that is called in main thread when subroutine completes. */
 static void janet_proc_wait_cb(JanetEVGenericMessage args) {
-    int status = args.argi;
     JanetProc *proc = (JanetProc *) args.argp;
     if (NULL != proc) {
-        proc->return_code = (int32_t) status;
-        proc->flags |= JANET_PROC_WAITED;
-        proc->flags &= ~JANET_PROC_WAITING;
         janet_gcunroot(janet_wrap_abstract(proc));
         janet_gcunroot(janet_wrap_fiber(args.fiber));
-        if ((status != 0) && (proc->flags & JANET_PROC_ERROR_NONZERO)) {
-            JanetString s = janet_formatc("command failed with non-zero exit code %d", status);
-            janet_cancel(args.fiber, janet_wrap_string(s));
-        } else {
-            janet_schedule(args.fiber, janet_wrap_integer(status));
+        janet_proc_wait_done(args);
+    }
+}
+
+#if defined(JANET_PROC_PIDFD) || defined(JANET_EV_KQUEUE)
+
+/* Listener on a stream that becomes readable when the process exits. The stream
+ * is private to the listener, and is closed as soon as the process is reaped. */
+typedef struct {
+    JanetListenerState head;
+    JanetProc *proc;
+} ProcWaitState;
+
+static JanetAsyncStatus janet_proc_wait_machine(JanetListenerState *s, JanetAsyncEvent event) {
+    ProcWaitState *state = (ProcWaitState *) s;
+    JanetProc *proc = state->proc;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_abstract(proc));
+            break;
+        case JANET_ASYNC_EVENT_DEINIT:
+            /* Canceled waits can be waited on again */
+            proc->flags &= ~JANET_PROC_WAITING;
+            break;
+        case JANET_ASYNC_EVENT_READ:
+        case JANET_ASYNC_EVENT_ERR:
+        case JANET_ASYNC_EVENT_HUP: {
+            int status = 0;
+            pid_t result;
+            do {
+                result = waitpid(proc->pid, &status, WNOHANG);
+            } while (result == -1 && errno == EINTR);
+            if (result == 0) return JANET_ASYNC_STATUS_NOT_DONE;
+            /* Release the handle directly, the listener is removed once we are done */
+            s->stream->flags |= JANET_STREAM_CLOSED;
+#ifndef JANET_EV_KQUEUE
+            close(s->stream->handle);
+#endif
+            if (result == -1) {
+                proc->flags |= JANET_PROC_WAITED;
+                janet_cancel(s->fiber, janet_cstringv(strerror(errno)));
+                return JANET_ASYNC_STATUS_DONE;
+            }
+            JanetEVGenericMessage args;
+            memset(&args, 0, sizeof(args));
+            args.argp = proc;
+            args.argi = janet_proc_status(status);
+            args.fiber = s->fiber;
+            proc->flags |= JANET_PROC_WAITED;
+            janet_proc_wait_done(args);
+            return JANET_ASYNC_STATUS_DONE;
         }
     }
+    return JANET_ASYNC_STATUS_NOT_DONE;
+}
+
+/* Start waiting on the process from the event loop. Returns 0 if the platform
+ * could not provide a handle to wait on. */
+static int janet_proc_wait_listen(JanetProc *proc) {
+#ifdef JANET_EV_KQUEUE
+    JanetStream *stream = janet_stream((JanetHandle) proc->pid,
+                                       JANET_STREAM_READABLE | JANET_STREAM_PROCESS, NULL);
+#else
+    int fd = (int) syscall(SYS_pidfd_open, proc->pid, 0);
+    if (fd < 0) return 0;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    JanetStream *stream = janet_stream(fd, JANET_STREAM_READABLE, NULL);
+#endif
+    ProcWaitState *state = (ProcWaitState *) janet_listen(stream, janet_proc_wait_machine,
+                           JANET_ASYNC_LISTEN_READ, sizeof(ProcWaitState), NULL);
+    state->proc = proc;
+    return 1;
 }
 
+#endif
+
 #endif /* End ev check */
 
 static int janet_proc_gc(void *p, size_t s) {
@@ -467,8 +559,14 @@ os_proc_wait_impl(JanetProc *proc) {
         janet_panicf("cannot wait twice on a process");
     }
 #ifdef JANET_EV
-    /* Event loop implementation - threaded call */
     proc->flags |= JANET_PROC_WAITING;
+#if defined(JANET_PROC_PIDFD) || defined(JANET_EV_KQUEUE)
+    /* Event loop implementation - wait for the process to exit with a listener */
+    if (janet_proc_wait_listen(proc)) {
+        janet_await();
+    }
+#endif
+    /* Event loop implementation - threaded call */
     JanetEVGenericMessage targs;
     memset(&targs, 0, sizeof(targs));
     targs.argp = proc;
@@ -1742,6 +1840,349 @@ static Janet os_dir(int32_t argc, Janet *argv) {
     return janet_wrap_array(paths);
 }
 
+/* Walk a directory tree outside of the interpreter, so that it can also run
+ * on the thread pool. Only entries whose requested fields need more than the
+ * file type are stat-ed, and directories are found from d_type when possible. */
+
+#define JANET_WALK_MAX_FIELDS 16
+
+typedef struct {
+    char *path;
+    jmode_t mode;
+    jstat_t *st; /* NULL unless a field other than :mode was requested */
+} OsWalkEntry;
+
+typedef struct {
+    char *root;
+    int32_t maxdepth;
+    int need_stat;
+    int32_t field_count;
+    const struct OsStatGetter *fields[JANET_WALK_MAX_FIELDS];
+    OsWalkEntry *entries;
+    size_t count;
+    size_t capacity;
+    int err;
+#ifdef JANET_EV
+    uint32_t sched_id;
+#endif
+} OsWalk;
+
+static char *os_walk_join(const char *dir, const char *name) {
+    size_t dlen = strlen(dir);
+    size_t nlen = strlen(name);
+    char *path = janet_malloc(dlen + nlen + 2);
+    if (NULL == path) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memcpy(path, dir, dlen);
+    path[dlen] = '/';
+    memcpy(path + dlen + 1, name, nlen + 1);
+    return path;
+}
+
+static void os_walk_push(OsWalk *w, char *path, jmode_t mode, jstat_t *st) {
+    if (w->count == w->capacity) {
+        size_t newcap = w->capacity ? 2 * w->capacity : 64;
+        OsWalkEntry *entries = janet_realloc(w->entries, newcap * sizeof(OsWalkEntry));
+        if (NULL == entries) {
+            JANET_OUT_OF_MEMORY;
+        }
+        w->entries = entries;
+        w->capacity = newcap;
+    }
+    OsWalkEntry *e = w->entries + w->count++;
+    e->path = path;
+    e->mode = mode;
+    e->st = NULL;
+    if (w->need_stat) {
+        e->st = janet_malloc(sizeof(jstat_t));
+        if (NULL == e->st) {
+            JANET_OUT_OF_MEMORY;
+        }
+        *e->st = *st;
+    }
+}
+
+#ifndef JANET_WINDOWS
+static jmode_t os_walk_dtype_mode(unsigned char type) {
+    switch (type) {
+        default:
+            return 0;
+        case DT_REG:
+            return S_IFREG;
+        case DT_DIR:
+            return S_IFDIR;
+        case DT_LNK:
+            return S_IFLNK;
+        case DT_FIFO:
+            return S_IFIFO;
+        case DT_SOCK:
+            return S_IFSOCK;
+        case DT_CHR:
+            return S_IFCHR;
+        case DT_BLK:
+            return S_IFBLK;
+    }
+}
+#endif
+
+/* Directories still to be read are kept on a stack of paths, so only one
+ * directory is open at a time. Unreadable subdirectories are skipped. */
+static void os_walk_run(OsWalk *w) {
+    typedef struct {
+        char *path;
+        int32_t depth;
+    } OsWalkDir;
+    OsWalkDir *stack = NULL;
+    size_t top = 0, cap = 0;
+    char *root = janet_malloc(strlen(w->root) + 1);
+    if (NULL == root) {
+        JANET_OUT_OF_MEMORY;
+    }
+    strcpy(root, w->root);
+    OsWalkDir first = {root, 0};
+    int is_root = 1;
+    for (;;) {
+        OsWalkDir cur;
+        if (is_root) {
+            cur = first;
+        } else if (top > 0) {
+            cur = stack[--top];
+        } else {
+            break;
+        }
+#ifdef JANET_WINDOWS
+        WIN32_FIND_DATAA data;
+        size_t plen = strlen(cur.path);
+        char *pattern = janet_malloc(plen + 3);
+        if (NULL == pattern) {
+            JANET_OUT_OF_MEMORY;
+        }
+        memcpy(pattern, cur.path, plen);
+        memcpy(pattern + plen, "/*", 3);
+        HANDLE h = FindFirstFileExA(pattern, FindExInfoBasic, &data,
+                                    FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+        janet_free(pattern);
+        if (INVALID_HANDLE_VALUE == h) {
+            if (is_root) w->err = ENOENT;
+        } else {
+            do {
+                const char *name = data.cFileName;
+                if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+                char *path = os_walk_join(cur.path, name);
+                jstat_t st;
+                jmode_t mode = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? _S_IFDIR : _S_IFREG;
+                if (w->need_stat) {
+                    if (-1 == _stat(path, &st)) {
+                        janet_free(path);
+                        continue;
+                    }
+                    mode = st.st_mode;
+                }
+#else
+        DIR *dfd = opendir(cur.path);
+        if (NULL == dfd) {
+            if (is_root) w->err = errno;
+        } else {
+            struct dirent *dp;
+            while ((dp = readdir(dfd)) != NULL) {
+                const char *name = dp->d_name;
+                if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+                jstat_t st;
+                jmode_t mode = os_walk_dtype_mode(dp->d_type);
+                if (w->need_stat || mode == 0) {
+                    if (-1 == fstatat(dirfd(dfd), name, &st, AT_SYMLINK_NOFOLLOW)) continue;
+                    mode = st.st_mode;
+                }
+                char *path = os_walk_join(cur.path, name);
+#endif
+                os_walk_push(w, path, mode, &st);
+                int32_t depth = cur.depth + 1;
+#ifdef JANET_WINDOWS
+                int is_dir = (mode & _S_IFDIR) && !(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+#else
+                int is_dir = S_ISDIR(mode);
+#endif
+                if (is_dir && (w->maxdepth < 0 || depth < w->maxdepth)) {
+                    if (top == cap) {
+                        cap = cap ? 2 * cap : 16;
+                        OsWalkDir *newstack = janet_realloc(stack, cap * sizeof(OsWalkDir));
+                        if (NULL == newstack) {
+                            JANET_OUT_OF_MEMORY;
+                        }
+                        stack = newstack;
+                    }
+                    char *dirpath = janet_malloc(strlen(path) + 1);
+                    if (NULL == dirpath) {
+                        JANET_OUT_OF_MEMORY;
+                    }
+                    strcpy(dirpath, path);
+                    stack[top].path = dirpath;
+                    stack[top].depth = depth;
+                    top++;
+                }
+#ifdef JANET_WINDOWS
+            } while (FindNextFileA(h, &data));
+            FindClose(h);
+        }
+#else
+            }
+            closedir(dfd);
+        }
+#endif
+        janet_free(cur.path);
+        if (is_root && w->err) break;
+        is_root = 0;
+    }
+    janet_free(stack);
+}
+
+/* Convert walk results to janet values and free them */
+static Janet os_walk_result(OsWalk *w) {
+    JanetArray *result = janet_array((int32_t) w->count);
+    for (size_t i = 0; i < w->count; i++) {
+        OsWalkEntry *e = w->entries + i;
+        Janet path = janet_cstringv(e->path);
+        if (w->field_count == 0) {
+            janet_array_push(result, path);
+        } else {
+            Janet *tup = janet_tuple_begin(w->field_count + 1);
+            tup[0] = path;
+            for (int32_t j = 0; j < w->field_count; j++) {
+                if (NULL == e->st) {
+                    jstat_t st;
+                    st.st_mode = e->mode;
+                    tup[j + 1] = w->fields[j]->fn(&st);
+                } else {
+                    tup[j + 1] = w->fields[j]->fn(e->st);
+                }
+            }
+            janet_array_push(result, janet_wrap_tuple(janet_tuple_end(tup)));
+        }
+    }
+    return janet_wrap_array(result);
+}
+
+static void os_walk_free(OsWalk *w) {
+    for (size_t i = 0; i < w->count; i++) {
+        janet_free(w->entries[i].path);
+        janet_free(w->entries[i].st);
+    }
+    janet_free(w->entries);
+    janet_free(w->root);
+    janet_free(w);
+}
+
+#ifdef JANET_EV
+static JanetEVGenericMessage os_walk_subr(JanetEVGenericMessage msg) {
+    os_walk_run((OsWalk *) msg.argp);
+    return msg;
+}
+
+static void os_walk_callback(JanetEVGenericMessage msg) {
+    OsWalk *w = (OsWalk *) msg.argp;
+    JanetFiber *fiber = msg.fiber;
+    if (fiber->sched_id == w->sched_id) {
+        if (w->err) {
+            janet_cancel(fiber, janet_wrap_string(janet_formatc("cannot open directory %s: %s",
+                         w->root, strerror(w->err))));
+        } else {
+            janet_schedule(fiber, os_walk_result(w));
+        }
+    }
+    janet_gcunroot(janet_wrap_fiber(fiber));
+    os_walk_free(w);
+}
+#endif
+
+static Janet os_walk(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 3);
+    const char *root = janet_getcstring(argv, 0);
+    JanetView fields;
+    fields.items = NULL;
+    fields.len = 0;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        fields = janet_getindexed(argv, 1);
+    }
+    if (fields.len > JANET_WALK_MAX_FIELDS) {
+        janet_panicf("expected at most %d fields, got %d", JANET_WALK_MAX_FIELDS, fields.len);
+    }
+    int32_t maxdepth = -1;
+    int async = 0;
+    if (argc > 2 && !janet_checktype(argv[2], JANET_NIL)) {
+        JanetDictView opts = janet_getdictionary(argv, 2);
+        Janet depth = opts.kvs ? janet_dictionary_get(opts.kvs, opts.cap, janet_ckeywordv("depth")) : janet_wrap_nil();
+        Janet asyncv = opts.kvs ? janet_dictionary_get(opts.kvs, opts.cap, janet_ckeywordv("async")) : janet_wrap_nil();
+        if (!janet_checktype(depth, JANET_NIL)) {
+            if (!janet_checkint(depth) || janet_unwrap_integer(depth) < 1) {
+                janet_panicf("expected positive integer for :depth, got %v", depth);
+            }
+            maxdepth = janet_unwrap_integer(depth);
+        }
+        async = janet_truthy(asyncv);
+    }
+    OsWalk *w = janet_malloc(sizeof(OsWalk));
+    if (NULL == w) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memset(w, 0, sizeof(OsWalk));
+    w->maxdepth = maxdepth;
+    for (int32_t i = 0; i < fields.len; i++) {
+        const struct OsStatGetter *sg = os_stat_getters;
+        const uint8_t *key = janet_checktype(fields.items[i], JANET_KEYWORD)
+                             ? janet_unwrap_keyword(fields.items[i]) : NULL;
+        while (NULL != key && NULL != sg->name && janet_cstrcmp(key, sg->name)) sg++;
+        if (NULL == key || NULL == sg->name) {
+            janet_free(w);
+            janet_panicf("unexpected field %v", fields.items[i]);
+        }
+        if (sg->fn != os_stat_mode) w->need_stat = 1;
+        w->fields[w->field_count++] = sg;
+    }
+    size_t rootlen = strlen(root);
+    w->root = janet_malloc(rootlen + 1);
+    if (NULL == w->root) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memcpy(w->root, root, rootlen + 1);
+    /* Trailing separators would be doubled in the joined paths */
+    while (rootlen > 1 && (w->root[rootlen - 1] == '/'
+#ifdef JANET_WINDOWS
+                           || w->root[rootlen - 1] == '\\'
+#endif
+                          )) {
+        w->root[--rootlen] = '\0';
+    }
+#ifdef JANET_EV
+    if (async) {
+        JanetEVGenericMessage msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.argp = w;
+        msg.fiber = janet_root_fiber();
+        w->sched_id = msg.fiber->sched_id;
+        janet_ev_threaded_call(os_walk_subr, msg, os_walk_callback);
+        janet_gcroot(janet_wrap_fiber(msg.fiber));
+        janet_await();
+    }
+#else
+    if (async) {
+        janet_free(w->root);
+        janet_free(w);
+        janet_panic(":async requires the event loop");
+    }
+#endif
+    os_walk_run(w);
+    if (w->err) {
+        int err = w->err;
+        Janet msg = janet_wrap_string(janet_formatc("cannot open directory %s: %s", w->root, strerror(err)));
+        os_walk_free(w);
+        janet_panicv(msg);
+    }
+    Janet result = os_walk_result(w);
+    os_walk_free(w);
+    return result;
+}
+
 static Janet os_rename(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 2);
     const char *src = janet_getcstring(argv, 0);
@@ -1999,6 +2440,19 @@ static const JanetReg os_cfuns[] = {
              "Iterate over files and subdirectories in a directory. Returns an array of paths parts, "
              "with only the file name or directory name and no prefix.")
     },
+    {
+        "os/walk", os_walk,
+        JDOC("(os/walk dir &opt fields opts)\n\n"
+             "Recursively list the files and subdirectories below dir, in no particular order. "
+             "Returns an array of paths, each prefixed by dir. If fields is given, it is a tuple "
+             "or array of keys accepted by os/stat, and each entry is instead a tuple of the "
+             "path followed by those fields. Entries are only stat-ed if a field other than "
+             ":mode is requested. Symbolic links are not followed, so fields describe the "
+             "links themselves, as with os/lstat. Unreadable subdirectories are skipped. "
+             "opts is a table or struct that can contain:\n\n"
+             "* :depth - only descend this many levels, where 1 lists just the entries of dir\n\n"
+             "* :async - walk the tree on the thread pool, suspending only the current fiber")
+    },
     {
         "os/stat", os_stat,
         JDOC("(os/stat path &opt tab|key)\n\n"
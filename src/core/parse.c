@@ -140,6 +140,22 @@ DEF_PARSER_STACK(_pushstate, JanetParseState, states, statecount, statecap)
 
 #undef DEF_PARSER_STACK
 
+/* Push many bytes to the token buffer */
+static void push_bufn(JanetParser *p, const uint8_t *bytes, size_t n) {
+    size_t newcount = p->bufcount + n;
+    if (newcount > p->bufcap) {
+        size_t newcap = 2 * newcount;
+        uint8_t *next = janet_realloc(p->buf, newcap);
+        if (NULL == next) {
+            JANET_OUT_OF_MEMORY;
+        }
+        p->buf = next;
+        p->bufcap = newcap;
+    }
+    memcpy(p->buf + p->bufcount, bytes, n);
+    p->bufcount = newcount;
+}
+
 #define PFLAG_CONTAINER 0x100
 #define PFLAG_BUFFER 0x200
 #define PFLAG_PARENS 0x400
@@ -678,6 +694,64 @@ void janet_parser_consume(JanetParser *parser, uint8_t c) {
     parser->lookback = c;
 }
 
+/* Count the leading bytes of a run that the state of the parser would push
+ * to its buffer one at a time. Runs never contain newlines, so only the
+ * column changes over a run. */
+static size_t parser_run(JanetParser *parser, JanetParseState *state,
+                         const uint8_t *bytes, size_t len) {
+    size_t i = 0;
+    if (state->consumer == tokenchar) {
+        uint8_t high = 0;
+        while (i < len && is_symbol_char(bytes[i])) high |= bytes[i++];
+        if (high & 0x80) state->argn = 1; /* Use to indicate non ascii */
+    } else if (state->consumer == stringchar) {
+        while (i < len) {
+            uint8_t c = bytes[i];
+            if (c == '"' || c == '\\' || c == '\n' || c == '\r') break;
+            i++;
+        }
+    } else if (state->consumer == longstring) {
+        if (!(state->flags & PFLAG_INSTRING)) return 0;
+        while (i < len) {
+            uint8_t c = bytes[i];
+            if (c == '`' || c == '\n' || c == '\r') break;
+            i++;
+        }
+    } else if (state->consumer == comment) {
+        while (i < len && bytes[i] != '\n' && bytes[i] != '\r') i++;
+    } else if (state->consumer == root) {
+        /* Whitespace between values is skipped, not buffered */
+        while (i < len && (bytes[i] == ' ' || bytes[i] == '\t')) i++;
+        if (i) {
+            parser->column += i;
+            parser->lookback = bytes[i - 1];
+        }
+        return i;
+    }
+    if (i) {
+        push_bufn(parser, bytes, i);
+        parser->column += i;
+        parser->lookback = bytes[i - 1];
+    }
+    return i;
+}
+
+size_t janet_parser_consume_bytes(JanetParser *parser, const uint8_t *bytes, size_t len) {
+    size_t i = 0;
+    janet_parser_checkdead(parser);
+    while (i < len) {
+        JanetParseState *state = parser->states + parser->statecount - 1;
+        size_t run = parser_run(parser, state, bytes + i, len - i);
+        if (run) {
+            i += run;
+            continue;
+        }
+        janet_parser_consume(parser, bytes[i++]);
+        if (parser->error || parser->flag) break;
+    }
+    return i;
+}
+
 void janet_parser_eof(JanetParser *parser) {
     janet_parser_checkdead(parser);
     size_t oldcolumn = parser->column;
@@ -762,6 +836,26 @@ Janet janet_parser_produce_wrapped(JanetParser *parser) {
     return ret;
 }
 
+/* Parse all values in bytes and push them to out without evaluating
+ * them. Returns NULL, or the parse error. The values are moved straight
+ * out of the parser instead of being produced one at a time. */
+const char *janet_parse_data(const uint8_t *bytes, int32_t len, JanetArray *out) {
+    JanetParser parser;
+    janet_parser_init(&parser);
+    janet_parser_consume_bytes(&parser, bytes, (size_t) len);
+    if (NULL == parser.error) janet_parser_eof(&parser);
+    const char *error = parser.error;
+    if (NULL == error) {
+        int32_t count = (int32_t) parser.pending;
+        janet_array_ensure(out, out->count + count, 1);
+        for (int32_t i = 0; i < count; i++)
+            out->data[out->count + i] = janet_unwrap_tuple(parser.args[i])[0];
+        out->count += count;
+    }
+    janet_parser_deinit(&parser);
+    return error;
+}
+
 void janet_parser_init(JanetParser *parser) {
     parser->args = NULL;
     parser->states = NULL;
@@ -839,6 +933,15 @@ int janet_parser_has_more(JanetParser *parser) {
 
 /* C functions */
 
+static Janet cfun_parse_all_data(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetByteView view = janet_getbytes(argv, 0);
+    JanetArray *out = janet_array(0);
+    const char *error = janet_parse_data(view.bytes, view.len, out);
+    if (NULL != error) janet_panic(error);
+    return janet_wrap_array(out);
+}
+
 static int parsermark(void *p, size_t size) {
     size_t i;
     JanetParser *parser = (JanetParser *)p;
@@ -897,18 +1000,8 @@ static Janet cfun_parse_consume(int32_t argc, Janet *argv) {
         view.len -= offset;
         view.bytes += offset;
     }
-    int32_t i;
-    for (i = 0; i < view.len; i++) {
-        janet_parser_consume(p, view.bytes[i]);
-        switch (janet_parser_status(p)) {
-            case JANET_PARSE_ROOT:
-            case JANET_PARSE_PENDING:
-                break;
-            default:
-                return janet_wrap_integer(i + 1);
-        }
-    }
-    return janet_wrap_integer(i);
+    size_t consumed = janet_parser_consume_bytes(p, view.bytes, (size_t) view.len);
+    return janet_wrap_integer((int32_t) consumed);
 }
 
 static Janet cfun_parse_eof(int32_t argc, Janet *argv) {
@@ -1226,6 +1319,14 @@ static Janet parsernext(void *p, Janet key) {
 }
 
 static const JanetReg parse_cfuns[] = {
+    {
+        "parse-all-data", cfun_parse_all_data,
+        JDOC("(parse-all-data bytes)\n\n"
+             "Parse all values in a byte sequence and return them in an array, without "
+             "compiling or evaluating them. This is the fastest way to load data that is "
+             "written as Janet literals, such as the output of `(string/format \"%j\" x)`. "
+             "Raises an error if the bytes are not valid Janet source.")
+    },
     {
         "parser/new", cfun_parse_parser,
         JDOC("(parser/new)\n\n"
@@ -51,6 +51,7 @@ typedef struct {
     int32_t depth;
     int32_t linemaplen;
     int32_t has_backref;
+    int32_t hit_end;
     enum {
         PEG_MODE_NORMAL,
         PEG_MODE_ACCUMULATE
@@ -161,6 +162,98 @@ static int64_t peg_convert_u64_s64(uint64_t from, int width) {
     return ((int64_t)(from << shift)) >> shift;
 }
 
+/* Rules compiled with first byte guards have this bit set in their opcode
+ * word. Guards are indices of RULE_SET rules, or PEG_NO_GUARD. Bytecode
+ * from older versions has no guards and is still accepted. */
+#define PEG_GUARDED 0x100
+#define PEG_NO_GUARD UINT32_MAX
+
+/* Check if n more bytes of text are available. Running out of text is
+ * recorded, as the result of a match could change with more input. */
+#define peg_avail(s, text, n) (((text) + (n) <= (s)->text_end) || ((s)->hit_end = 1, 0))
+
+/* Check if text can start a match for a rule with the given guard */
+static int peg_guard(PegState *s, uint32_t guard, const uint8_t *text) {
+    if (guard == PEG_NO_GUARD) return 1;
+    if (!peg_avail(s, text, 1)) return 0;
+    const uint32_t *set = s->bytecode + guard;
+    return (set[1 + (text[0] >> 5)] >> (text[0] & 0x1F)) & 1;
+}
+
+/* Repetitions of single byte classes need no backtracking or captures,
+ * so scan for them directly. Returns the end of the repetition, or NULL
+ * if rule is not a byte class. */
+static const uint8_t *peg_scan_class(PegState *s,
+                                     const uint32_t *rule,
+                                     const uint8_t *text,
+                                     const uint8_t *limit) {
+    switch (rule[0]) {
+        default:
+            return NULL;
+        case RULE_SET:
+            while (text < limit && ((rule[1 + (text[0] >> 5)] >> (text[0] & 0x1F)) & 1))
+                text++;
+            return text;
+        case RULE_RANGE: {
+            uint8_t lo = rule[1] & 0xFF;
+            uint8_t hi = (rule[1] >> 16) & 0xFF;
+            while (text < limit && text[0] >= lo && text[0] <= hi)
+                text++;
+            return text;
+        }
+        case RULE_IFNOT: {
+            /* (any (if-not "c" 1)) and friends */
+            const uint32_t *rule_c = s->bytecode + rule[1];
+            const uint32_t *rule_n = s->bytecode + rule[2];
+            if (rule_n[0] != RULE_NCHAR || rule_n[1] != 1) return NULL;
+            if (rule_c[0] == RULE_LITERAL && rule_c[1] == 1) {
+                const uint8_t *found = memchr(text, ((const uint8_t *)(rule_c + 2))[0], limit - text);
+                return found ? found : limit;
+            }
+            if (rule_c[0] == RULE_SET) {
+                while (text < limit && !((rule_c[1 + (text[0] >> 5)] >> (text[0] & 0x1F)) & 1))
+                    text++;
+                return text;
+            }
+            return NULL;
+        }
+    }
+}
+
+/* Compute the capture of a replace or matchtime rule from the captures
+ * made since cs */
+static Janet peg_replace_value(PegState *s, const uint32_t *rule, CapState cs) {
+    Janet cap = janet_wrap_nil();
+    Janet constant = s->constants[rule[2]];
+    switch (janet_type(constant)) {
+        default:
+            cap = constant;
+            break;
+        case JANET_STRUCT:
+            if (s->captures->count) {
+                cap = janet_struct_get(janet_unwrap_struct(constant),
+                                       s->captures->data[s->captures->count - 1]);
+            }
+            break;
+        case JANET_TABLE:
+            if (s->captures->count) {
+                cap = janet_table_get(janet_unwrap_table(constant),
+                                      s->captures->data[s->captures->count - 1]);
+            }
+            break;
+        case JANET_CFUNCTION:
+            cap = janet_unwrap_cfunction(constant)(s->captures->count - cs.cap,
+                                                   s->captures->data + cs.cap);
+            break;
+        case JANET_FUNCTION:
+            cap = janet_call(janet_unwrap_function(constant),
+                             s->captures->count - cs.cap,
+                             s->captures->data + cs.cap);
+            break;
+    }
+    return cap;
+}
+
 /* Prevent stack overflow */
 #define down1(s) do { \
     if (0 == --((s)->depth)) janet_panic("peg/match recursed too deeply"); \
@@ -186,24 +279,24 @@ tail:
 
         case RULE_LITERAL: {
             uint32_t len = rule[1];
-            if (text + len > s->text_end) return NULL;
+            if (!peg_avail(s, text, len)) return NULL;
             return memcmp(text, rule + 2, len) ? NULL : text + len;
         }
 
         case RULE_NCHAR: {
             uint32_t n = rule[1];
-            return (text + n > s->text_end) ? NULL : text + n;
+            return peg_avail(s, text, n) ? text + n : NULL;
         }
 
         case RULE_NOTNCHAR: {
             uint32_t n = rule[1];
-            return (text + n > s->text_end) ? text : NULL;
+            return peg_avail(s, text, n) ? NULL : text;
         }
 
         case RULE_RANGE: {
             uint8_t lo = rule[1] & 0xFF;
             uint8_t hi = (rule[1] >> 16) & 0xFF;
-            return (text < s->text_end &&
+            return (peg_avail(s, text, 1) &&
                     text[0] >= lo &&
                     text[0] <= hi)
                    ? text + 1
@@ -211,16 +304,15 @@ tail:
         }
 
         case RULE_SET: {
+            if (!peg_avail(s, text, 1)) return NULL;
             uint32_t word = rule[1 + (text[0] >> 5)];
             uint32_t mask = (uint32_t)1 << (text[0] & 0x1F);
-            return (text < s->text_end && (word & mask))
-                   ? text + 1
-                   : NULL;
+            return (word & mask) ? text + 1 : NULL;
         }
 
         case RULE_LOOK: {
             text += ((int32_t *)rule)[1];
-            if (text < s->text_start || text > s->text_end) return NULL;
+            if (text < s->text_start || !peg_avail(s, text, 0)) return NULL;
             down1(s);
             const uint8_t *result = peg_rule(s, s->bytecode + rule[2], text);
             up1(s);
@@ -231,10 +323,12 @@ tail:
         case RULE_CHOICE: {
             uint32_t len = rule[1];
             const uint32_t *args = rule + 2;
+            const uint32_t *guards = (rule[0] & PEG_GUARDED) ? args + len : NULL;
             if (len == 0) return NULL;
             down1(s);
             CapState cs = cap_save(s);
             for (uint32_t i = 0; i < len - 1; i++) {
+                if (guards && !peg_guard(s, guards[i], text)) continue;
                 const uint8_t *result = peg_rule(s, s->bytecode + args[i], text);
                 if (result) {
                     up1(s);
@@ -243,6 +337,7 @@ tail:
                 cap_load(s, cs);
             }
             up1(s);
+            if (guards && !peg_guard(s, guards[len - 1], text)) return NULL;
             rule = s->bytecode + args[len - 1];
             goto tail;
         }
@@ -283,24 +378,40 @@ tail:
         case RULE_THRU:
         case RULE_TO: {
             const uint32_t *rule_a = s->bytecode + rule[1];
-            const uint8_t *next_text;
+            int is_to = (rule[0] & 0x1F) == RULE_TO;
+            uint32_t guard = PEG_NO_GUARD;
+            uint32_t guard_byte = PEG_NO_GUARD;
+            if (rule[0] & PEG_GUARDED) {
+                guard = rule[2];
+                guard_byte = rule[3];
+            }
+            const uint8_t *next_text = NULL;
             CapState cs = cap_save(s);
             down1(s);
             while (text <= s->text_end) {
+                /* Skip ahead to the next position where rule_a can match */
+                if (guard_byte != PEG_NO_GUARD) {
+                    text = memchr(text, (int) guard_byte, s->text_end - text);
+                    if (NULL == text) break;
+                } else if (guard != PEG_NO_GUARD) {
+                    while (text < s->text_end && !peg_guard(s, guard, text)) text++;
+                    if (text == s->text_end) break;
+                }
                 CapState cs2 = cap_save(s);
                 next_text = peg_rule(s, rule_a, text);
                 if (next_text) {
-                    if (rule[0] == RULE_TO) cap_load(s, cs2);
+                    if (is_to) cap_load(s, cs2);
                     break;
                 }
                 text++;
             }
             up1(s);
-            if (text > s->text_end) {
+            if (NULL == next_text) {
+                s->hit_end = 1;
                 cap_load(s, cs);
                 return NULL;
             }
-            return rule[0] == RULE_TO ? text : next_text;
+            return is_to ? text : next_text;
         }
 
         case RULE_BETWEEN: {
@@ -309,6 +420,13 @@ tail:
             const uint32_t *rule_a = s->bytecode + rule[3];
             uint32_t captured = 0;
             const uint8_t *next_text;
+            const uint8_t *limit = s->text_end;
+            if ((size_t) hi < (size_t)(limit - text)) limit = text + hi;
+            next_text = peg_scan_class(s, rule_a, text, limit);
+            if (NULL != next_text) {
+                if (next_text == s->text_end) s->hit_end = 1;
+                return ((size_t)(next_text - text) < lo) ? NULL : next_text;
+            }
             CapState cs = cap_save(s);
             down1(s);
             while (captured < hi) {
@@ -387,6 +505,16 @@ tail:
             return result;
         }
 
+        case RULE_SPAN: {
+            down1(s);
+            const uint8_t *result = peg_rule(s, s->bytecode + rule[1], text);
+            up1(s);
+            if (!result) return NULL;
+            pushcap(s, janet_wrap_number((double)(text - s->text_start)), rule[2]);
+            pushcap(s, janet_wrap_number((double)(result - s->text_start)), rule[2]);
+            return result;
+        }
+
         case RULE_ACCUMULATE: {
             uint32_t tag = rule[2];
             int oldmode = s->mode;
@@ -451,34 +579,7 @@ tail:
             s->mode = oldmode;
             if (!result) return NULL;
 
-            Janet cap = janet_wrap_nil();
-            Janet constant = s->constants[rule[2]];
-            switch (janet_type(constant)) {
-                default:
-                    cap = constant;
-                    break;
-                case JANET_STRUCT:
-                    if (s->captures->count) {
-                        cap = janet_struct_get(janet_unwrap_struct(constant),
-                                               s->captures->data[s->captures->count - 1]);
-                    }
-                    break;
-                case JANET_TABLE:
-                    if (s->captures->count) {
-                        cap = janet_table_get(janet_unwrap_table(constant),
-                                              s->captures->data[s->captures->count - 1]);
-                    }
-                    break;
-                case JANET_CFUNCTION:
-                    cap = janet_unwrap_cfunction(constant)(s->captures->count - cs.cap,
-                                                           s->captures->data + cs.cap);
-                    break;
-                case JANET_FUNCTION:
-                    cap = janet_call(janet_unwrap_function(constant),
-                                     s->captures->count - cs.cap,
-                                     s->captures->data + cs.cap);
-                    break;
-            }
+            Janet cap = peg_replace_value(s, rule, cs);
             cap_load_keept(s, cs);
             if (rule[0] == RULE_MATCHTIME && !janet_truthy(cap)) return NULL;
             pushcap(s, cap, tag);
@@ -515,7 +616,7 @@ tail:
                         return NULL;
                     const uint8_t *bytes = janet_unwrap_string(capture);
                     int32_t len = janet_string_length(bytes);
-                    if (text + len > s->text_end)
+                    if (!peg_avail(s, text, len))
                         return NULL;
                     return memcmp(text, bytes, len) ? NULL : text + len;
                 }
@@ -560,7 +661,7 @@ tail:
             uint32_t signedness = rule[1] & 0x10;
             uint32_t endianess = rule[1] & 0x20;
             int width = (int)(rule[1] & 0xF);
-            if (text + width > s->text_end) return NULL;
+            if (!peg_avail(s, text, width)) return NULL;
             uint64_t accum = 0;
             if (endianess) {
                 /* BE */
@@ -830,13 +931,18 @@ static void spec_look(Builder *b, int32_t argc, const Janet *argv) {
     emit_2(r, RULE_LOOK, (uint32_t) offset, subrule);
 }
 
-/* Rule of the form [len, rules...] */
+/* Rule of the form [len, rules...], followed by a guard for each rule
+ * if guarded. Guards are filled in by peg_optimize. */
 static void spec_variadic(Builder *b, int32_t argc, const Janet *argv, uint32_t op) {
     uint32_t rule = janet_v_count(b->bytecode);
     janet_v_push(b->bytecode, op);
     janet_v_push(b->bytecode, argc);
     for (int32_t i = 0; i < argc; i++)
         janet_v_push(b->bytecode, 0);
+    if (op & PEG_GUARDED) {
+        for (int32_t i = 0; i < argc; i++)
+            janet_v_push(b->bytecode, PEG_NO_GUARD);
+    }
     for (int32_t i = 0; i < argc; i++) {
         uint32_t rulei = peg_compile1(b, argv[i]);
         b->bytecode[rule + 2 + i] = rulei;
@@ -844,7 +950,7 @@ static void spec_variadic(Builder *b, int32_t argc, const Janet *argv, uint32_t
 }
 
 static void spec_choice(Builder *b, int32_t argc, const Janet *argv) {
-    spec_variadic(b, argc, argv, RULE_CHOICE);
+    spec_variadic(b, argc, argv, RULE_CHOICE | PEG_GUARDED);
 }
 static void spec_sequence(Builder *b, int32_t argc, const Janet *argv) {
     spec_variadic(b, argc, argv, RULE_SEQUENCE);
@@ -943,11 +1049,19 @@ static void spec_error(Builder *b, int32_t argc, const Janet *argv) {
         spec_onerule(b, argc, argv, RULE_ERROR);
     }
 }
+
+/* Rule of the form [rule, guard, guard_byte]. Guards are filled in by peg_optimize. */
+static void spec_scan(Builder *b, int32_t argc, const Janet *argv, uint32_t op) {
+    peg_fixarity(b, argc, 1);
+    Reserve r = reserve(b, 4);
+    uint32_t rule = peg_compile1(b, argv[0]);
+    emit_3(r, op | PEG_GUARDED, rule, PEG_NO_GUARD, PEG_NO_GUARD);
+}
 static void spec_to(Builder *b, int32_t argc, const Janet *argv) {
-    spec_onerule(b, argc, argv, RULE_TO);
+    spec_scan(b, argc, argv, RULE_TO);
 }
 static void spec_thru(Builder *b, int32_t argc, const Janet *argv) {
-    spec_onerule(b, argc, argv, RULE_THRU);
+    spec_scan(b, argc, argv, RULE_THRU);
 }
 static void spec_drop(Builder *b, int32_t argc, const Janet *argv) {
     spec_onerule(b, argc, argv, RULE_DROP);
@@ -974,6 +1088,9 @@ static void spec_group(Builder *b, int32_t argc, const Janet *argv) {
 static void spec_unref(Builder *b, int32_t argc, const Janet *argv) {
     spec_cap1(b, argc, argv, RULE_UNREF);
 }
+static void spec_span(Builder *b, int32_t argc, const Janet *argv) {
+    spec_cap1(b, argc, argv, RULE_SPAN);
+}
 
 static void spec_reference(Builder *b, int32_t argc, const Janet *argv) {
     peg_arity(b, argc, 1, 2);
@@ -1127,6 +1244,7 @@ static const SpecialPair peg_specials[] = {
     {"sequence", spec_sequence},
     {"set", spec_set},
     {"some", spec_some},
+    {"span", spec_span},
     {"thru", spec_thru},
     {"to", spec_to},
     {"uint", spec_uint_le},
@@ -1266,6 +1384,1489 @@ static uint32_t peg_compile1(Builder *b, Janet peg) {
     return rule;
 }
 
+/*
+ * Optimization
+ */
+
+/* What is known about the first byte of text at which a rule is tried.
+ * The set contains the first byte of every non-empty match, and every
+ * byte at which the rule can have side effects. A rule that is not
+ * nullable and has no side effects at any byte cannot match at a position
+ * whose next byte is not in its set, so it can be skipped there.
+ *
+ * Side effects are calls to functions and errors, which are always
+ * visible, and captures, which are visible when a failing rule leaves them
+ * on the capture stack. */
+typedef struct {
+    uint32_t set[8];
+    uint32_t flags;
+} PegFirst;
+
+#define PEG_FIRST_NULLABLE 0x01 /* Can match without consuming a byte from the set */
+#define PEG_FIRST_CALLS 0x02    /* Can call functions or raise errors */
+#define PEG_FIRST_CALLS_ANY 0x04 /* ... at any byte */
+#define PEG_FIRST_CAPS 0x08     /* Can push captures */
+#define PEG_FIRST_CAPS_ANY 0x10 /* ... at any byte */
+#define PEG_FIRST_EFFECTS (PEG_FIRST_CALLS | PEG_FIRST_CAPS)
+#define PEG_FIRST_ANY (PEG_FIRST_CALLS_ANY | PEG_FIRST_CAPS_ANY)
+#define PEG_FIRST_ALL 0x1F
+
+typedef struct {
+    const uint32_t *bytecode;
+    const Janet *constants;
+    int32_t *index; /* Rule number of each bytecode word, or -1 */
+    uint32_t *starts; /* Bytecode index of each rule */
+    PegFirst *first;
+    int32_t count;
+} PegOptimizer;
+
+/* Size of a rule in words. Only used on bytecode made by the builder. */
+static uint32_t peg_rule_size(const uint32_t *rule) {
+    switch (rule[0] & 0x1F) {
+        default:
+        case RULE_NCHAR:
+        case RULE_NOTNCHAR:
+        case RULE_RANGE:
+        case RULE_POSITION:
+        case RULE_LINE:
+        case RULE_COLUMN:
+        case RULE_BACKMATCH:
+        case RULE_ERROR:
+        case RULE_DROP:
+        case RULE_NOT:
+            return 2;
+        case RULE_LITERAL:
+            return 2 + ((rule[1] + 3) >> 2);
+        case RULE_SET:
+            return 9;
+        case RULE_LOOK:
+        case RULE_IF:
+        case RULE_IFNOT:
+        case RULE_LENPREFIX:
+        case RULE_ARGUMENT:
+        case RULE_GETTAG:
+        case RULE_CONSTANT:
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_CAPTURE:
+        case RULE_UNREF:
+        case RULE_SPAN:
+        case RULE_READINT:
+            return 3;
+        case RULE_BETWEEN:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+            return 4;
+        case RULE_TO:
+        case RULE_THRU:
+            return (rule[0] & PEG_GUARDED) ? 4 : 2;
+        case RULE_CHOICE:
+        case RULE_SEQUENCE:
+            return 2 + ((rule[0] & PEG_GUARDED) ? 2 * rule[1] : rule[1]);
+    }
+}
+
+static const PegFirst *first_of(PegOptimizer *o, uint32_t rule) {
+    return o->first + o->index[rule];
+}
+
+static void first_union(PegFirst *dest, const PegFirst *src) {
+    for (int i = 0; i < 8; i++)
+        dest->set[i] |= src->set[i];
+}
+
+static void first_fill(PegFirst *f) {
+    for (int i = 0; i < 8; i++)
+        f->set[i] = UINT32_MAX;
+}
+
+/* For rules that have effects after a sub rule matches. The effects can
+ * happen at any byte if the sub rule is nullable. */
+static void first_effect(PegFirst *out, const PegFirst *sub, uint32_t effects) {
+    *out = *sub;
+    out->flags |= effects;
+    if (sub->flags & PEG_FIRST_NULLABLE) out->flags |= effects << 1;
+}
+
+/* Compute first byte information for one rule from that of its sub rules */
+static void peg_first_rule(PegOptimizer *o, const uint32_t *rule, PegFirst *out) {
+    memset(out, 0, sizeof(PegFirst));
+    switch (rule[0] & 0x1F) {
+        default:
+            first_fill(out);
+            out->flags = PEG_FIRST_ALL;
+            break;
+        case RULE_LITERAL:
+            if (rule[1] == 0) {
+                out->flags = PEG_FIRST_NULLABLE;
+            } else {
+                bitmap_set(out->set, ((const uint8_t *)(rule + 2))[0]);
+            }
+            break;
+        case RULE_NCHAR:
+            if (rule[1] == 0) {
+                out->flags = PEG_FIRST_NULLABLE;
+            } else {
+                first_fill(out);
+            }
+            break;
+        case RULE_READINT:
+            first_fill(out);
+            out->flags = PEG_FIRST_CAPS;
+            if ((rule[1] & 0xF) == 0) out->flags |= PEG_FIRST_NULLABLE | PEG_FIRST_CAPS_ANY;
+            break;
+        case RULE_RANGE: {
+            uint32_t lo = rule[1] & 0xFF;
+            uint32_t hi = (rule[1] >> 16) & 0xFF;
+            for (uint32_t c = lo; c <= hi; c++)
+                bitmap_set(out->set, (uint8_t) c);
+            break;
+        }
+        case RULE_SET:
+            memcpy(out->set, rule + 1, sizeof(out->set));
+            break;
+        case RULE_NOTNCHAR:
+            out->flags = PEG_FIRST_NULLABLE;
+            break;
+        case RULE_POSITION:
+        case RULE_LINE:
+        case RULE_COLUMN:
+        case RULE_ARGUMENT:
+        case RULE_CONSTANT:
+        case RULE_GETTAG:
+            out->flags = PEG_FIRST_NULLABLE | PEG_FIRST_CAPS | PEG_FIRST_CAPS_ANY;
+            break;
+        case RULE_BACKMATCH:
+            first_fill(out);
+            out->flags = PEG_FIRST_NULLABLE;
+            break;
+        case RULE_LOOK: {
+            const PegFirst *a = first_of(o, rule[2]);
+            out->flags = PEG_FIRST_NULLABLE | (a->flags & PEG_FIRST_EFFECTS);
+            if (rule[1] == 0) {
+                first_union(out, a);
+                out->flags |= a->flags & PEG_FIRST_ANY;
+            } else {
+                out->flags |= (a->flags & PEG_FIRST_EFFECTS) << 1;
+            }
+            break;
+        }
+        case RULE_CHOICE:
+            for (uint32_t i = 0; i < rule[1]; i++) {
+                const PegFirst *a = first_of(o, rule[2 + i]);
+                first_union(out, a);
+                out->flags |= a->flags;
+            }
+            break;
+        case RULE_SEQUENCE: {
+            /* Only rules tried before the first non-nullable rule
+             * can see the first byte. */
+            int reached = 1;
+            out->flags = PEG_FIRST_NULLABLE;
+            for (uint32_t i = 0; i < rule[1]; i++) {
+                const PegFirst *a = first_of(o, rule[2 + i]);
+                out->flags |= a->flags & PEG_FIRST_EFFECTS;
+                if (reached) {
+                    first_union(out, a);
+                    out->flags |= a->flags & PEG_FIRST_ANY;
+                    if (!(a->flags & PEG_FIRST_NULLABLE)) {
+                        out->flags &= ~PEG_FIRST_NULLABLE;
+                        reached = 0;
+                    }
+                }
+            }
+            break;
+        }
+        case RULE_IF:
+        case RULE_IFNOT: {
+            const PegFirst *a = first_of(o, rule[1]);
+            const PegFirst *b = first_of(o, rule[2]);
+            first_union(out, a);
+            first_union(out, b);
+            out->flags = (a->flags | b->flags) & (PEG_FIRST_EFFECTS | PEG_FIRST_ANY);
+            if ((rule[0] & 0x1F) == RULE_IF) {
+                out->flags |= a->flags & b->flags & PEG_FIRST_NULLABLE;
+            } else {
+                out->flags |= b->flags & PEG_FIRST_NULLABLE;
+            }
+            break;
+        }
+        case RULE_NOT: {
+            const PegFirst *a = first_of(o, rule[1]);
+            first_union(out, a);
+            out->flags = PEG_FIRST_NULLABLE | (a->flags & (PEG_FIRST_EFFECTS | PEG_FIRST_ANY));
+            break;
+        }
+        case RULE_BETWEEN: {
+            /* Each repetition must consume input, so with lo > 0 the
+             * first byte is always from the sub rule's set. */
+            const PegFirst *a = first_of(o, rule[3]);
+            first_union(out, a);
+            out->flags = a->flags & (PEG_FIRST_EFFECTS | PEG_FIRST_ANY);
+            if (rule[1] == 0) out->flags |= PEG_FIRST_NULLABLE;
+            break;
+        }
+        case RULE_TO:
+        case RULE_THRU: {
+            /* The sub rule is tried at later positions */
+            const PegFirst *a = first_of(o, rule[1]);
+            first_fill(out);
+            out->flags = PEG_FIRST_NULLABLE | (a->flags & PEG_FIRST_EFFECTS);
+            out->flags |= (a->flags & PEG_FIRST_EFFECTS) << 1;
+            break;
+        }
+        case RULE_LENPREFIX: {
+            const PegFirst *a = first_of(o, rule[1]);
+            const PegFirst *b = first_of(o, rule[2]);
+            first_fill(out);
+            out->flags = PEG_FIRST_NULLABLE | (a->flags & (PEG_FIRST_EFFECTS | PEG_FIRST_ANY));
+            out->flags |= (b->flags & PEG_FIRST_EFFECTS) | ((b->flags & PEG_FIRST_EFFECTS) << 1);
+            break;
+        }
+        case RULE_CAPTURE:
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_SPAN:
+            first_effect(out, first_of(o, rule[1]), PEG_FIRST_CAPS);
+            break;
+        case RULE_DROP:
+        case RULE_UNREF:
+            *out = *first_of(o, rule[1]);
+            break;
+        case RULE_REPLACE:
+        case RULE_MATCHTIME: {
+            Janet constant = o->constants[rule[2]];
+            uint32_t effects = PEG_FIRST_CAPS;
+            if (janet_checktype(constant, JANET_FUNCTION) ||
+                    janet_checktype(constant, JANET_CFUNCTION))
+                effects |= PEG_FIRST_CALLS;
+            first_effect(out, first_of(o, rule[1]), effects);
+            break;
+        }
+        case RULE_ERROR:
+            first_effect(out, first_of(o, rule[1]), PEG_FIRST_CALLS);
+            break;
+    }
+}
+
+/* Iterate first byte information for all rules to a fixed point. Rules
+ * reference each other recursively, so start from nothing and grow. */
+static void peg_first_solve(PegOptimizer *o) {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int32_t r = o->count - 1; r >= 0; r--) {
+            PegFirst next;
+            PegFirst *cur = o->first + r;
+            peg_first_rule(o, o->bytecode + o->starts[r], &next);
+            first_union(&next, cur);
+            next.flags |= cur->flags;
+            if (memcmp(&next, cur, sizeof(PegFirst))) {
+                *cur = next;
+                changed = 1;
+            }
+        }
+    }
+}
+
+/* Check if all sub rules tried at the same position as a rule are grounded */
+static int peg_left_grounded(PegOptimizer *o, const uint32_t *rule, const uint8_t *grounded) {
+#define LEFT(sub) do { if (!grounded[o->index[(sub)]]) return 0; } while (0)
+    switch (rule[0] & 0x1F) {
+        default:
+            break;
+        case RULE_CHOICE:
+            for (uint32_t i = 0; i < rule[1]; i++)
+                LEFT(rule[2 + i]);
+            break;
+        case RULE_SEQUENCE:
+            for (uint32_t i = 0; i < rule[1]; i++) {
+                LEFT(rule[2 + i]);
+                if (!(first_of(o, rule[2 + i])->flags & PEG_FIRST_NULLABLE)) break;
+            }
+            break;
+        case RULE_IF:
+        case RULE_IFNOT:
+        case RULE_LENPREFIX:
+            LEFT(rule[1]);
+            LEFT(rule[2]);
+            break;
+        case RULE_LOOK:
+            LEFT(rule[2]);
+            break;
+        case RULE_BETWEEN:
+            LEFT(rule[3]);
+            break;
+        case RULE_TO:
+        case RULE_THRU:
+        case RULE_ERROR:
+        case RULE_DROP:
+        case RULE_NOT:
+        case RULE_CAPTURE:
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_UNREF:
+        case RULE_SPAN:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+            LEFT(rule[1]);
+            break;
+    }
+#undef LEFT
+    return 1;
+}
+
+/* Left recursive rules never match, they recurse until the depth limit.
+ * Mark them as having effects at any byte so that they are never skipped
+ * and still raise the same error. */
+static void peg_mark_left_recursion(PegOptimizer *o) {
+    uint8_t *grounded = janet_calloc(o->count ? o->count : 1, 1);
+    if (NULL == grounded) {
+        JANET_OUT_OF_MEMORY;
+    }
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int32_t r = o->count - 1; r >= 0; r--) {
+            if (!grounded[r] && peg_left_grounded(o, o->bytecode + o->starts[r], grounded)) {
+                grounded[r] = 1;
+                changed = 1;
+            }
+        }
+    }
+    for (int32_t r = 0; r < o->count; r++)
+        if (!grounded[r]) o->first[r].flags |= PEG_FIRST_ANY;
+    janet_free(grounded);
+}
+
+/* Get a guard for a rule, or PEG_NO_GUARD if it cannot be skipped. Flags
+ * are the effects that would make skipping the rule visible. */
+static uint32_t peg_emit_guard(Builder *b, const PegFirst *f, uint32_t rule, uint32_t flags) {
+    if (f->flags & (PEG_FIRST_NULLABLE | flags)) return PEG_NO_GUARD;
+    if (b->bytecode[rule] == RULE_SET) return rule;
+    uint32_t guard = janet_v_count(b->bytecode);
+    janet_v_push(b->bytecode, RULE_SET);
+    for (int i = 0; i < 8; i++)
+        janet_v_push(b->bytecode, f->set[i]);
+    return guard;
+}
+
+/* Fill in the guards of choices and scans. This never changes
+ * what a peg matches or captures, only skips work that would fail. */
+static void peg_optimize(Builder *b) {
+    PegOptimizer o;
+    uint32_t blen = janet_v_count(b->bytecode);
+    o.bytecode = b->bytecode;
+    o.constants = b->constants;
+    o.index = janet_malloc(sizeof(int32_t) * (blen ? blen : 1));
+    o.starts = janet_malloc(sizeof(uint32_t) * (blen ? blen : 1));
+    if (NULL == o.index || NULL == o.starts) {
+        JANET_OUT_OF_MEMORY;
+    }
+    o.count = 0;
+    for (uint32_t i = 0; i < blen; i++) o.index[i] = -1;
+    for (uint32_t i = 0; i < blen; i += peg_rule_size(b->bytecode + i)) {
+        o.index[i] = o.count;
+        o.starts[o.count++] = i;
+    }
+    o.first = janet_calloc(o.count ? o.count : 1, sizeof(PegFirst));
+    if (NULL == o.first) {
+        JANET_OUT_OF_MEMORY;
+    }
+    peg_first_solve(&o);
+    peg_mark_left_recursion(&o);
+    peg_first_solve(&o);
+
+    /* Emitting guards can move the bytecode, so index it directly */
+    for (int32_t r = 0; r < o.count; r++) {
+        uint32_t rule = o.starts[r];
+        uint32_t op = b->bytecode[rule];
+        if (op == (RULE_CHOICE | PEG_GUARDED)) {
+            uint32_t len = b->bytecode[rule + 1];
+            for (uint32_t i = 0; i < len; i++) {
+                /* Captures left by failing alternatives are dropped,
+                 * except for the last one. */
+                uint32_t alt = b->bytecode[rule + 2 + i];
+                uint32_t flags = (i == len - 1) ? PEG_FIRST_ANY : PEG_FIRST_CALLS_ANY;
+                uint32_t guard = peg_emit_guard(b, o.first + o.index[alt], alt, flags);
+                b->bytecode[rule + 2 + len + i] = guard;
+            }
+        } else if (op == (RULE_TO | PEG_GUARDED) || op == (RULE_THRU | PEG_GUARDED)) {
+            uint32_t sub = b->bytecode[rule + 1];
+            const PegFirst *f = o.first + o.index[sub];
+            int count = 0;
+            uint32_t byte = 0;
+            for (uint32_t c = 0; c < 256; c++) {
+                if ((f->set[c >> 5] >> (c & 0x1F)) & 1) {
+                    count++;
+                    byte = c;
+                }
+            }
+            if (count == 256) continue;
+            if (count == 1 && !(f->flags & (PEG_FIRST_NULLABLE | PEG_FIRST_ANY))) {
+                b->bytecode[rule + 3] = byte;
+            } else {
+                uint32_t guard = peg_emit_guard(b, f, sub, PEG_FIRST_ANY);
+                b->bytecode[rule + 2] = guard;
+            }
+        }
+    }
+
+    janet_free(o.index);
+    janet_free(o.starts);
+    janet_free(o.first);
+}
+
+/*
+ * Threaded code
+ *
+ * A compiled peg can also be translated to a flat program that runs in a
+ * single loop. Sequences, choices, repetitions and the common capturing
+ * rules become straight line code with explicit jumps, so they need no
+ * recursion. Rules that are used in several places, which includes every
+ * recursive rule, are called as subroutines. Anything else is handed to
+ * peg_rule. Programs give the same results as the interpreter, including
+ * the captures left behind by failing rules.
+ */
+
+typedef enum {
+    PT_LITERAL,         /* Match rule, else jump */
+    PT_NCHAR,
+    PT_NOTNCHAR,
+    PT_RANGE,
+    PT_SET,
+    PT_SCAN,            /* rule is a repetition of a byte class */
+    PT_RULE,            /* Interpret rule, else jump */
+    PT_GUARD,           /* Jump if text can't start a match for guard arg */
+    PT_OFFSET,          /* Move text by arg, else jump */
+    PT_JUMP,
+    PT_SAVE,            /* Push a frame with the text and capture state */
+    PT_SAVE_TEXT,       /* Push a frame with the text */
+    PT_RESTORE,         /* Restore the text and captures of the top frame */
+    PT_RESTORE_TEXT,
+    PT_RESTORE_POP,
+    PT_RESTORE_TEXT_POP,
+    PT_DROP,            /* Restore the captures of the top frame and pop it */
+    PT_POP,
+    PT_POP_JUMP,
+    PT_DISPATCH,        /* Jump to the first alternative that can match */
+    PT_REP_START,       /* Start up to arg repetitions */
+    PT_REP_NEXT,        /* Count a repetition and repeat */
+    PT_REP_AGAIN,       /* The same for patterns without captures */
+    PT_REP_EXIT,        /* Pop, and fail if less than arg repetitions */
+    PT_SCAN_NEXT,       /* Find the next position for to and thru */
+    PT_SCAN_RETRY,
+    PT_SCAN_EXHAUST,
+    PT_CAPTURE,         /* Pop and capture the text since the frame. Like the
+                         * other capturing instructions it skips the next
+                         * instruction, which handles failure of the pattern. */
+    PT_SPAN,            /* Pop and capture the offsets of the frame and text */
+    PT_MODE,            /* Push a frame and set the capture mode to arg */
+    PT_MODE_FAIL,
+    PT_GROUP,
+    PT_ACCUMULATE,
+    PT_REPLACE,
+    PT_CALL,            /* Call subroutine at jump, failing to arg */
+    PT_RETURN,
+    PT_RETURN_FAIL,
+    PT_MATCH,
+    PT_FAIL
+} PegThreadedOp;
+
+typedef struct PegInstr PegInstr;
+struct PegInstr {
+    const void *handler; /* Address of the code for op when threaded */
+    uint32_t op;
+    uint32_t arg;
+    const PegInstr *jump;
+    const uint32_t *rule;
+};
+
+typedef struct {
+    int32_t count;
+    int32_t *tables; /* Jump tables indexed by byte, and 256 at the end of text */
+    PegInstr code[];
+} PegProgram;
+
+/* Backtracking state, subroutine return addresses and saved modes */
+typedef struct {
+    const uint8_t *text;
+    const PegInstr *call;
+    CapState cs;
+    uint32_t count;
+} PegFrame;
+
+#define PEG_FRAMES_LOCAL 32
+
+/* Jump tables map each byte, and then the end of text, to an instruction.
+ * The last entry holds flags. */
+#define PT_TABLE_SIZE 258
+#define PT_END_HIT 0x1
+#define PT_SAVE_CAPTURES 0x2
+
+/* Dispatch like the vm, with computed gotos where available. Instructions
+ * then hold the address of their code. */
+#if defined(__GNUC__) && !defined(__EMSCRIPTEN__)
+#define PT_START() pt_next();
+#define PT_END()
+#define PT_OP(op) label_##op :
+#define pt_next() goto *ip->handler
+#define PT_LABEL(op) &&label_##op
+#else
+#define PT_START() for (;;) { switch (ip->op) {
+#define PT_END() }}
+#define PT_OP(op) case op :
+#define pt_next() continue
+#endif
+
+/* Run a program. With no state, a new program is prepared instead. */
+static const uint8_t *peg_run(PegState *s, PegProgram *p, const uint8_t *text) {
+    PegFrame local[PEG_FRAMES_LOCAL];
+    PegFrame *stack = local;
+    PegFrame *stack_end = local + PEG_FRAMES_LOCAL;
+    PegFrame *sp = stack - 1; /* Top frame */
+    const PegInstr *ip = p->code;
+
+#ifdef PT_LABEL
+    static const void *const op_lookup[] = {
+        PT_LABEL(PT_LITERAL),
+        PT_LABEL(PT_NCHAR),
+        PT_LABEL(PT_NOTNCHAR),
+        PT_LABEL(PT_RANGE),
+        PT_LABEL(PT_SET),
+        PT_LABEL(PT_SCAN),
+        PT_LABEL(PT_RULE),
+        PT_LABEL(PT_GUARD),
+        PT_LABEL(PT_OFFSET),
+        PT_LABEL(PT_JUMP),
+        PT_LABEL(PT_SAVE),
+        PT_LABEL(PT_SAVE_TEXT),
+        PT_LABEL(PT_RESTORE),
+        PT_LABEL(PT_RESTORE_TEXT),
+        PT_LABEL(PT_RESTORE_POP),
+        PT_LABEL(PT_RESTORE_TEXT_POP),
+        PT_LABEL(PT_DROP),
+        PT_LABEL(PT_POP),
+        PT_LABEL(PT_POP_JUMP),
+        PT_LABEL(PT_DISPATCH),
+        PT_LABEL(PT_REP_START),
+        PT_LABEL(PT_REP_NEXT),
+        PT_LABEL(PT_REP_AGAIN),
+        PT_LABEL(PT_REP_EXIT),
+        PT_LABEL(PT_SCAN_NEXT),
+        PT_LABEL(PT_SCAN_RETRY),
+        PT_LABEL(PT_SCAN_EXHAUST),
+        PT_LABEL(PT_CAPTURE),
+        PT_LABEL(PT_SPAN),
+        PT_LABEL(PT_MODE),
+        PT_LABEL(PT_MODE_FAIL),
+        PT_LABEL(PT_GROUP),
+        PT_LABEL(PT_ACCUMULATE),
+        PT_LABEL(PT_REPLACE),
+        PT_LABEL(PT_CALL),
+        PT_LABEL(PT_RETURN),
+        PT_LABEL(PT_RETURN_FAIL),
+        PT_LABEL(PT_MATCH),
+        PT_LABEL(PT_FAIL)
+    };
+    if (NULL == s) {
+        for (int32_t i = 0; i < p->count; i++)
+            p->code[i].handler = op_lookup[p->code[i].op];
+        return NULL;
+    }
+#else
+    if (NULL == s) return NULL;
+#endif
+
+#define pt_push() do { \
+    if (++sp == stack_end) { \
+        size_t n = stack_end - stack; \
+        PegFrame *newstack = janet_smalloc(sizeof(PegFrame) * n * 2); \
+        memcpy(newstack, stack, sizeof(PegFrame) * n); \
+        if (stack != local) janet_sfree(stack); \
+        stack = newstack; \
+        stack_end = newstack + n * 2; \
+        sp = newstack + n; \
+    } \
+} while (0)
+#define pt_save() do { \
+    pt_push(); \
+    sp->text = text; \
+    sp->cs = cap_save(s); \
+    sp->count = 0; \
+} while (0)
+#define pt_fail() do { ip = ip->jump; pt_next(); } while (0)
+#define pt_skip(n) do { ip += (n); pt_next(); } while (0)
+
+    PT_START()
+
+    PT_OP(PT_LITERAL) {
+        uint32_t len = ip->rule[1];
+        if (!peg_avail(s, text, len) || memcmp(text, ip->rule + 2, len)) pt_fail();
+        text += len;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_NCHAR) {
+        if (!peg_avail(s, text, ip->arg)) pt_fail();
+        text += ip->arg;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_NOTNCHAR) {
+        if (peg_avail(s, text, ip->arg)) pt_fail();
+        pt_skip(1);
+    }
+
+    PT_OP(PT_RANGE) {
+        uint8_t lo = ip->arg & 0xFF;
+        uint8_t hi = (ip->arg >> 16) & 0xFF;
+        if (!peg_avail(s, text, 1) || text[0] < lo || text[0] > hi) pt_fail();
+        text++;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_SET) {
+        if (!peg_avail(s, text, 1) ||
+                !((ip->rule[1 + (text[0] >> 5)] >> (text[0] & 0x1F)) & 1)) pt_fail();
+        text++;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_SCAN) {
+        const uint32_t *rule = ip->rule;
+        const uint8_t *limit = s->text_end;
+        if ((size_t) rule[2] < (size_t)(limit - text)) limit = text + rule[2];
+        const uint8_t *next_text = peg_scan_class(s, s->bytecode + rule[3], text, limit);
+        if (next_text == s->text_end) s->hit_end = 1;
+        if ((size_t)(next_text - text) < rule[1]) pt_fail();
+        text = next_text;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_RULE) {
+        const uint8_t *result = peg_rule(s, ip->rule, text);
+        if (!result) pt_fail();
+        text = result;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_GUARD) {
+        if (!peg_guard(s, ip->arg, text)) pt_fail();
+        pt_skip(1);
+    }
+
+    PT_OP(PT_OFFSET) {
+        text += (int32_t) ip->arg;
+        if (text < s->text_start || !peg_avail(s, text, 0)) pt_fail();
+        pt_skip(1);
+    }
+
+    PT_OP(PT_JUMP) {
+        ip = ip->jump;
+        pt_next();
+    }
+
+    PT_OP(PT_SAVE) {
+        pt_save();
+        pt_skip(1);
+    }
+
+    PT_OP(PT_SAVE_TEXT) {
+        pt_push();
+        sp->text = text;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_RESTORE) {
+        text = sp->text;
+        cap_load(s, sp->cs);
+        pt_skip(1);
+    }
+
+    PT_OP(PT_RESTORE_TEXT) {
+        text = sp->text;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_RESTORE_POP) {
+        text = sp->text;
+        cap_load(s, sp->cs);
+        sp--;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_RESTORE_TEXT_POP) {
+        text = sp->text;
+        sp--;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_DROP) {
+        cap_load(s, sp->cs);
+        sp--;
+        pt_skip(2);
+    }
+
+    PT_OP(PT_POP) {
+        sp--;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_POP_JUMP) {
+        sp--;
+        ip = ip->jump;
+        pt_next();
+    }
+
+    PT_OP(PT_DISPATCH) {
+        /* Entries are complemented when no frame is needed */
+        const int32_t *table = p->tables + ip->arg;
+        int32_t entry;
+        if (text < s->text_end) {
+            entry = table[text[0]];
+        } else {
+            if (table[257] & PT_END_HIT) s->hit_end = 1;
+            entry = table[256];
+        }
+        if (entry < 0) {
+            ip = p->code + ~entry;
+        } else {
+            pt_push();
+            sp->text = text;
+            if (table[257] & PT_SAVE_CAPTURES) sp->cs = cap_save(s);
+            ip = p->code + entry;
+        }
+        pt_next();
+    }
+
+    PT_OP(PT_REP_START) {
+        /* One frame for the whole repetition, and one for the current
+         * repetition */
+        pt_save();
+        if (ip->arg == 0) pt_fail();
+        pt_push();
+        sp->text = text;
+        sp->cs = sp[-1].cs;
+        sp->count = 0;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_REP_NEXT) {
+        /* No progress falls through to restore and pop the frame of the
+         * current repetition. */
+        if (text == sp->text) pt_skip(1);
+        if (++sp[-1].count >= ip->arg) {
+            sp--;
+            pt_skip(2);
+        }
+        sp->text = text;
+        sp->cs = cap_save(s);
+        ip = ip->jump;
+        pt_next();
+    }
+
+    PT_OP(PT_REP_AGAIN) {
+        /* Captures can't change, so the saved state stays valid */
+        if (text == sp->text) pt_skip(1);
+        if (++sp[-1].count >= ip->arg) {
+            sp--;
+            pt_skip(2);
+        }
+        sp->text = text;
+        ip = ip->jump;
+        pt_next();
+    }
+
+    PT_OP(PT_REP_EXIT) {
+        if (sp->count < ip->arg) {
+            cap_load(s, sp->cs);
+            sp--;
+            pt_fail();
+        }
+        sp--;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_SCAN_NEXT) {
+        /* The top frame holds the next position to try */
+        const uint32_t *rule = ip->rule;
+        const uint8_t *next_text = sp->text;
+        if (next_text > s->text_end) pt_fail();
+        if (rule[0] & PEG_GUARDED) {
+            if (rule[3] != PEG_NO_GUARD) {
+                next_text = memchr(next_text, (int) rule[3], s->text_end - next_text);
+                if (NULL == next_text) pt_fail();
+            } else if (rule[2] != PEG_NO_GUARD) {
+                while (next_text < s->text_end && !peg_guard(s, rule[2], next_text))
+                    next_text++;
+                if (next_text == s->text_end) pt_fail();
+            }
+        }
+        sp->text = next_text;
+        text = next_text;
+        pt_save();
+        pt_skip(1);
+    }
+
+    PT_OP(PT_SCAN_RETRY) {
+        sp--;
+        sp->text++;
+        ip = ip->jump;
+        pt_next();
+    }
+
+    PT_OP(PT_SCAN_EXHAUST) {
+        s->hit_end = 1;
+        cap_load(s, sp->cs);
+        sp--;
+        pt_fail();
+    }
+
+    PT_OP(PT_CAPTURE) {
+        const uint8_t *start = sp->text;
+        sp--;
+        /* Specialized pushcap - avoid intermediate string creation */
+        if (!s->has_backref && s->mode == PEG_MODE_ACCUMULATE) {
+            janet_buffer_push_bytes(s->scratch, start, (int32_t)(text - start));
+        } else {
+            pushcap(s, janet_stringv(start, (int32_t)(text - start)), ip->arg);
+        }
+        pt_skip(2);
+    }
+
+    PT_OP(PT_SPAN) {
+        const uint8_t *start = sp->text;
+        sp--;
+        pushcap(s, janet_wrap_number((double)(start - s->text_start)), ip->arg);
+        pushcap(s, janet_wrap_number((double)(text - s->text_start)), ip->arg);
+        pt_skip(2);
+    }
+
+    PT_OP(PT_MODE) {
+        pt_save();
+        sp->count = s->mode;
+        s->mode = ip->arg;
+        pt_skip(1);
+    }
+
+    PT_OP(PT_MODE_FAIL) {
+        s->mode = sp->count;
+        sp--;
+        pt_fail();
+    }
+
+    PT_OP(PT_GROUP) {
+        CapState cs = sp->cs;
+        s->mode = sp->count;
+        sp--;
+        int32_t num_sub_captures = s->captures->count - cs.cap;
+        JanetArray *sub_captures = janet_array(num_sub_captures);
+        safe_memcpy(sub_captures->data,
+                    s->captures->data + cs.cap,
+                    sizeof(Janet) * num_sub_captures);
+        sub_captures->count = num_sub_captures;
+        cap_load_keept(s, cs);
+        pushcap(s, janet_wrap_array(sub_captures), ip->arg);
+        pt_skip(2);
+    }
+
+    PT_OP(PT_ACCUMULATE) {
+        CapState cs = sp->cs;
+        uint32_t oldmode = sp->count;
+        s->mode = oldmode;
+        sp--;
+        if (ip->arg || oldmode != PEG_MODE_ACCUMULATE) {
+            Janet cap = janet_stringv(s->scratch->data + cs.scratch,
+                                      s->scratch->count - cs.scratch);
+            cap_load_keept(s, cs);
+            pushcap(s, cap, ip->arg);
+        }
+        pt_skip(2);
+    }
+
+    PT_OP(PT_REPLACE) {
+        CapState cs = sp->cs;
+        s->mode = sp->count;
+        sp--;
+        Janet cap = peg_replace_value(s, ip->rule, cs);
+        cap_load_keept(s, cs);
+        if (ip->rule[0] == RULE_MATCHTIME && !janet_truthy(cap)) pt_fail();
+        pushcap(s, cap, ip->rule[3]);
+        pt_skip(2);
+    }
+
+    PT_OP(PT_CALL) {
+        down1(s);
+        pt_push();
+        sp->call = ip;
+        ip = ip->jump;
+        pt_next();
+    }
+
+    PT_OP(PT_RETURN) {
+        up1(s);
+        ip = sp->call + 1;
+        sp--;
+        pt_next();
+    }
+
+    PT_OP(PT_RETURN_FAIL) {
+        up1(s);
+        ip = p->code + sp->call->arg;
+        sp--;
+        pt_next();
+    }
+
+    PT_OP(PT_MATCH) {
+        if (stack != local) janet_sfree(stack);
+        return text;
+    }
+
+    PT_OP(PT_FAIL) {
+        if (stack != local) janet_sfree(stack);
+        return NULL;
+    }
+
+    PT_END()
+
+#undef pt_push
+#undef pt_save
+#undef pt_fail
+#undef pt_skip
+}
+
+#undef PT_START
+#undef PT_END
+#undef PT_OP
+#undef pt_next
+#undef PT_LABEL
+
+/* Translation of bytecode into a program */
+typedef struct {
+    const uint32_t *bytecode;
+    PegInstr *code;
+    int32_t *jumps; /* Label of the jump of each instruction */
+    int32_t *labels;
+    uint8_t *refs; /* References to the rule at each bytecode word, and flags */
+    int32_t *procs; /* Label of each rule called as a subroutine, or -1 */
+    uint32_t *pending; /* Subroutines to emit */
+    int32_t *tables; /* Labels of jump tables */
+} PegThreader;
+
+static int32_t pt_label(PegThreader *t) {
+    janet_v_push(t->labels, -1);
+    return janet_v_count(t->labels) - 1;
+}
+
+static void pt_bind(PegThreader *t, int32_t label) {
+    t->labels[label] = janet_v_count(t->code);
+}
+
+static void pt_emit(PegThreader *t, uint32_t op, uint32_t arg, int32_t jump, const uint32_t *rule) {
+    PegInstr ins;
+    ins.handler = NULL;
+    ins.op = op;
+    ins.arg = arg;
+    ins.jump = NULL;
+    ins.rule = rule;
+    janet_v_push(t->code, ins);
+    janet_v_push(t->jumps, jump);
+}
+
+/* Rules without sub rules, which can't be part of a cycle */
+static int pt_leaf(const uint32_t *rule) {
+    switch (rule[0] & 0x1F) {
+        default:
+            return 0;
+        case RULE_LITERAL:
+        case RULE_NCHAR:
+        case RULE_NOTNCHAR:
+        case RULE_RANGE:
+        case RULE_SET:
+        case RULE_POSITION:
+        case RULE_LINE:
+        case RULE_COLUMN:
+        case RULE_ARGUMENT:
+        case RULE_CONSTANT:
+        case RULE_GETTAG:
+        case RULE_BACKMATCH:
+        case RULE_READINT:
+            return 1;
+    }
+}
+
+/* Check if rule can be scanned by peg_scan_class */
+static int pt_class(const uint32_t *bytecode, const uint32_t *rule) {
+    if (rule[0] == RULE_SET || rule[0] == RULE_RANGE) return 1;
+    if (rule[0] != RULE_IFNOT) return 0;
+    const uint32_t *rule_c = bytecode + rule[1];
+    const uint32_t *rule_n = bytecode + rule[2];
+    if (rule_n[0] != RULE_NCHAR || rule_n[1] != 1) return 0;
+    return (rule_c[0] == RULE_LITERAL && rule_c[1] == 1) || rule_c[0] == RULE_SET;
+}
+
+/* Flags kept with the reference counts of rules */
+#define PT_SEEN 0x80
+#define PT_CAPTURES 0x40 /* Can change captures */
+#define pt_refs(t, r) ((t)->refs[(r)] & 0x3F)
+#define pt_pure(t, r) (!((t)->refs[(r)] & PT_CAPTURES))
+
+/* Get the sub rules of a rule */
+static const uint32_t *pt_subs(const uint32_t *rule, uint32_t *subs, uint32_t *nsubs) {
+    *nsubs = 1;
+    switch (rule[0] & 0x1F) {
+        default:
+            *nsubs = 0;
+            return subs;
+        case RULE_CHOICE:
+        case RULE_SEQUENCE:
+            *nsubs = rule[1];
+            return rule + 2;
+        case RULE_IF:
+        case RULE_IFNOT:
+        case RULE_LENPREFIX:
+            *nsubs = 2;
+            return rule + 1;
+        case RULE_LOOK:
+            subs[0] = rule[2];
+            return subs;
+        case RULE_BETWEEN:
+            subs[0] = rule[3];
+            return subs;
+        case RULE_NOT:
+        case RULE_THRU:
+        case RULE_TO:
+        case RULE_CAPTURE:
+        case RULE_ACCUMULATE:
+        case RULE_DROP:
+        case RULE_GROUP:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+        case RULE_ERROR:
+        case RULE_UNREF:
+        case RULE_SPAN:
+            subs[0] = rule[1];
+            return subs;
+    }
+}
+
+/* Rules that can change captures or tags by themselves */
+static int pt_captures(const uint32_t *rule) {
+    switch (rule[0] & 0x1F) {
+        default:
+            return 1;
+        case RULE_LITERAL:
+        case RULE_NCHAR:
+        case RULE_NOTNCHAR:
+        case RULE_RANGE:
+        case RULE_SET:
+        case RULE_LOOK:
+        case RULE_CHOICE:
+        case RULE_SEQUENCE:
+        case RULE_IF:
+        case RULE_IFNOT:
+        case RULE_NOT:
+        case RULE_THRU:
+        case RULE_TO:
+        case RULE_BETWEEN:
+        case RULE_BACKMATCH:
+        case RULE_DROP:
+            return 0;
+    }
+}
+
+/* Count the references to each rule reachable from the main rule, and
+ * find the rules that can change captures */
+static void pt_analyze(PegThreader *t) {
+    uint32_t *stack = NULL;
+    uint32_t *seen = NULL;
+    uint32_t subs[2];
+    uint32_t nsubs;
+    t->refs[0] |= PT_SEEN;
+    janet_v_push(stack, 0);
+    while (janet_v_count(stack)) {
+        uint32_t r = stack[janet_v_count(stack) - 1];
+        janet_v_pop(stack);
+        janet_v_push(seen, r);
+        const uint32_t *sub = pt_subs(t->bytecode + r, subs, &nsubs);
+        for (uint32_t i = 0; i < nsubs; i++) {
+            if (!(t->refs[sub[i]] & PT_SEEN)) {
+                t->refs[sub[i]] |= PT_SEEN;
+                janet_v_push(stack, sub[i]);
+            }
+            if (pt_refs(t, sub[i]) < 2) t->refs[sub[i]]++;
+        }
+    }
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int32_t j = 0; j < janet_v_count(seen); j++) {
+            uint32_t r = seen[j];
+            if (t->refs[r] & PT_CAPTURES) continue;
+            int captures = pt_captures(t->bytecode + r);
+            const uint32_t *sub = pt_subs(t->bytecode + r, subs, &nsubs);
+            for (uint32_t i = 0; i < nsubs && !captures; i++)
+                captures = !pt_pure(t, sub[i]);
+            if (captures) {
+                t->refs[r] |= PT_CAPTURES;
+                changed = 1;
+            }
+        }
+    }
+    janet_v_free(stack);
+    janet_v_free(seen);
+}
+
+static void pt_rule(PegThreader *t, uint32_t r, int32_t fail, int inline_self);
+
+/* Check if a rule fails without changing the text or captures, so
+ * that nothing needs to be restored after it */
+static int pt_clean(PegThreader *t, uint32_t r) {
+    const uint32_t *rule = t->bytecode + r;
+    switch (rule[0] & 0x1F) {
+        default:
+            return 0;
+        case RULE_LITERAL:
+        case RULE_NCHAR:
+        case RULE_NOTNCHAR:
+        case RULE_RANGE:
+        case RULE_SET:
+            return 1;
+        case RULE_BETWEEN:
+            return pt_class(t->bytecode, t->bytecode + rule[3]);
+    }
+}
+
+/* Check if the guard of a rule would test no more than the rule itself */
+static int pt_self_guarded(PegThreader *t, uint32_t r) {
+    const uint32_t *rule = t->bytecode + r;
+    switch (rule[0] & 0x1F) {
+        default:
+            return 0;
+        case RULE_LITERAL:
+            return rule[1] == 1;
+        case RULE_NCHAR:
+            return rule[1] > 0;
+        case RULE_RANGE:
+        case RULE_SET:
+            return 1;
+    }
+}
+
+/* Alternatives are entered after their guard, which is only checked again
+ * after an earlier alternative failed. Guards of several alternatives are
+ * combined into a jump table. A frame to restore from is only needed if an
+ * alternative other than the last one is not clean. */
+static void pt_choice(PegThreader *t, const uint32_t *rule, int32_t fail) {
+    uint32_t len = rule[1];
+    const uint32_t *args = rule + 2;
+    const uint32_t *guards = (rule[0] & PEG_GUARDED) ? args + len : NULL;
+    if (len == 0) {
+        pt_emit(t, PT_JUMP, 0, fail, NULL);
+        return;
+    }
+    int framed = 0;
+    int pure = 1;
+    uint32_t nguards = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (i < len - 1 && !pt_clean(t, args[i])) framed = 1;
+        if (i < len - 1 && !pt_pure(t, args[i])) pure = 0;
+        if (guards && guards[i] != PEG_NO_GUARD) nguards++;
+    }
+    int32_t done = pt_label(t);
+    int32_t last = pt_label(t);
+    int32_t last_in = pt_label(t);
+    int32_t first = janet_v_count(t->labels);
+    for (uint32_t i = 0; i + 1 < len; i++) pt_label(t);
+
+    if (nguards > 1) {
+        /* Entries are complemented if they need no frame */
+        uint32_t offset = janet_v_count(t->tables);
+        int end_hit = 0;
+        for (int c = 0; c <= 256; c++) {
+            int32_t entry = fail;
+            uint32_t i;
+            for (i = 0; i < len; i++) {
+                const uint32_t *set = t->bytecode + guards[i];
+                if (guards[i] == PEG_NO_GUARD ||
+                        (c < 256 && ((set[1 + (c >> 5)] >> (c & 0x1F)) & 1))) {
+                    entry = (i == len - 1) ? last_in : first + (int32_t) i;
+                    break;
+                }
+            }
+            if (c == 256) end_hit = i > 0;
+            janet_v_push(t->tables, (framed && i < len - 1) ? entry : ~entry);
+        }
+        /* At the end of text, guards checked before the first unguarded
+         * alternative set hit_end. */
+        janet_v_push(t->tables, (end_hit ? PT_END_HIT : 0) | (pure ? 0 : PT_SAVE_CAPTURES));
+        pt_emit(t, PT_DISPATCH, offset, -1, NULL);
+    } else if (framed) {
+        pt_emit(t, pure ? PT_SAVE_TEXT : PT_SAVE, 0, -1, NULL);
+    }
+
+    for (uint32_t i = 0; i + 1 < len; i++) {
+        int32_t next = pt_label(t);
+        int32_t guard_next = (i == len - 2) ? last : pt_label(t);
+        if (guards && guards[i] != PEG_NO_GUARD && !pt_self_guarded(t, args[i]))
+            pt_emit(t, PT_GUARD, guards[i], guard_next, NULL);
+        pt_bind(t, first + i);
+        pt_rule(t, args[i], next, 0);
+        pt_emit(t, framed ? PT_POP_JUMP : PT_JUMP, 0, done, NULL);
+        pt_bind(t, next);
+        if (framed) pt_emit(t, pure ? PT_RESTORE_TEXT : PT_RESTORE, 0, -1, NULL);
+        if (i != len - 2) pt_bind(t, guard_next);
+    }
+    pt_bind(t, last);
+    if (framed) pt_emit(t, PT_POP, 0, -1, NULL);
+    if (guards && guards[len - 1] != PEG_NO_GUARD && !pt_self_guarded(t, args[len - 1]))
+        pt_emit(t, PT_GUARD, guards[len - 1], fail, NULL);
+    pt_bind(t, last_in);
+    pt_rule(t, args[len - 1], fail, 0);
+    pt_bind(t, done);
+}
+
+static void pt_rule(PegThreader *t, uint32_t r, int32_t fail, int inline_self) {
+    const uint32_t *rule = t->bytecode + r;
+
+    /* Shared rules are only emitted once */
+    if (!inline_self && !pt_leaf(rule) && (pt_refs(t, r) > 1 || (r == 0 && pt_refs(t, r)))) {
+        if (t->procs[r] < 0) {
+            t->procs[r] = pt_label(t);
+            janet_v_push(t->pending, r);
+        }
+        pt_emit(t, PT_CALL, (uint32_t) fail, t->procs[r], NULL);
+        return;
+    }
+
+    switch (rule[0] & 0x1F) {
+        default:
+            pt_emit(t, PT_RULE, 0, fail, rule);
+            break;
+
+        case RULE_LITERAL:
+            pt_emit(t, PT_LITERAL, 0, fail, rule);
+            break;
+
+        case RULE_NCHAR:
+            pt_emit(t, PT_NCHAR, rule[1], fail, rule);
+            break;
+
+        case RULE_NOTNCHAR:
+            pt_emit(t, PT_NOTNCHAR, rule[1], fail, rule);
+            break;
+
+        case RULE_RANGE:
+            pt_emit(t, PT_RANGE, rule[1], fail, rule);
+            break;
+
+        case RULE_SET:
+            pt_emit(t, PT_SET, 0, fail, rule);
+            break;
+
+        case RULE_LOOK: {
+            int32_t pop = pt_label(t);
+            int32_t done = pt_label(t);
+            pt_emit(t, PT_SAVE_TEXT, 0, -1, NULL);
+            pt_emit(t, PT_OFFSET, rule[1], pop, NULL);
+            pt_rule(t, rule[2], pop, 0);
+            pt_emit(t, PT_RESTORE_TEXT_POP, 0, -1, NULL);
+            pt_emit(t, PT_JUMP, 0, done, NULL);
+            pt_bind(t, pop);
+            pt_emit(t, PT_POP_JUMP, 0, fail, NULL);
+            pt_bind(t, done);
+            break;
+        }
+
+        case RULE_CHOICE:
+            pt_choice(t, rule, fail);
+            break;
+
+        case RULE_SEQUENCE:
+            for (uint32_t i = 0; i < rule[1]; i++)
+                pt_rule(t, rule[2 + i], fail, 0);
+            break;
+
+        case RULE_IF: {
+            int32_t pop = pt_label(t);
+            int32_t done = pt_label(t);
+            pt_emit(t, PT_SAVE_TEXT, 0, -1, NULL);
+            pt_rule(t, rule[1], pop, 0);
+            pt_emit(t, PT_RESTORE_TEXT_POP, 0, -1, NULL);
+            pt_rule(t, rule[2], fail, 0);
+            pt_emit(t, PT_JUMP, 0, done, NULL);
+            pt_bind(t, pop);
+            pt_emit(t, PT_POP_JUMP, 0, fail, NULL);
+            pt_bind(t, done);
+            break;
+        }
+
+        case RULE_IFNOT:
+        case RULE_NOT: {
+            int32_t next = pt_label(t);
+            pt_emit(t, PT_SAVE_TEXT, 0, -1, NULL);
+            pt_rule(t, rule[1], next, 0);
+            pt_emit(t, PT_POP_JUMP, 0, fail, NULL);
+            pt_bind(t, next);
+            pt_emit(t, PT_RESTORE_TEXT_POP, 0, -1, NULL);
+            if ((rule[0] & 0x1F) == RULE_IFNOT) pt_rule(t, rule[2], fail, 0);
+            break;
+        }
+
+        case RULE_THRU:
+        case RULE_TO: {
+            int32_t loop = pt_label(t);
+            int32_t retry = pt_label(t);
+            int32_t exhaust = pt_label(t);
+            int32_t done = pt_label(t);
+            pt_emit(t, PT_SAVE, 0, -1, NULL);
+            pt_bind(t, loop);
+            pt_emit(t, PT_SCAN_NEXT, 0, exhaust, rule);
+            pt_rule(t, rule[1], retry, 0);
+            pt_emit(t, ((rule[0] & 0x1F) == RULE_TO) ? PT_RESTORE_POP : PT_POP, 0, -1, NULL);
+            pt_emit(t, PT_POP_JUMP, 0, done, NULL);
+            pt_bind(t, retry);
+            pt_emit(t, PT_SCAN_RETRY, 0, loop, NULL);
+            pt_bind(t, exhaust);
+            pt_emit(t, PT_SCAN_EXHAUST, 0, fail, NULL);
+            pt_bind(t, done);
+            break;
+        }
+
+        case RULE_BETWEEN: {
+            if (pt_class(t->bytecode, t->bytecode + rule[3])) {
+                pt_emit(t, PT_SCAN, 0, fail, rule);
+                break;
+            }
+            int32_t body = pt_label(t);
+            int32_t stop = pt_label(t);
+            int32_t leave = pt_label(t);
+            pt_emit(t, PT_REP_START, rule[2], leave, NULL);
+            pt_bind(t, body);
+            pt_rule(t, rule[3], stop, 0);
+            /* Skips the next instruction when done */
+            pt_emit(t, pt_pure(t, rule[3]) ? PT_REP_AGAIN : PT_REP_NEXT, rule[2], body, NULL);
+            pt_bind(t, stop);
+            pt_emit(t, PT_RESTORE_POP, 0, -1, NULL);
+            pt_bind(t, leave);
+            pt_emit(t, PT_REP_EXIT, rule[1], fail, NULL);
+            break;
+        }
+
+        case RULE_CAPTURE:
+        case RULE_SPAN:
+        case RULE_DROP: {
+            uint32_t op = rule[0] & 0x1F;
+            int32_t pop = pt_label(t);
+            pt_emit(t, op == RULE_DROP ? PT_SAVE : PT_SAVE_TEXT, 0, -1, NULL);
+            pt_rule(t, rule[1], pop, 0);
+            if (op == RULE_CAPTURE) {
+                pt_emit(t, PT_CAPTURE, rule[2], -1, NULL);
+            } else if (op == RULE_SPAN) {
+                pt_emit(t, PT_SPAN, rule[2], -1, NULL);
+            } else {
+                pt_emit(t, PT_DROP, 0, -1, NULL);
+            }
+            pt_bind(t, pop);
+            pt_emit(t, PT_POP_JUMP, 0, fail, NULL);
+            break;
+        }
+
+        case RULE_GROUP:
+        case RULE_ACCUMULATE:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME: {
+            uint32_t op = rule[0] & 0x1F;
+            int32_t pop = pt_label(t);
+            pt_emit(t, PT_MODE,
+                    op == RULE_ACCUMULATE ? PEG_MODE_ACCUMULATE : PEG_MODE_NORMAL,
+                    -1, NULL);
+            pt_rule(t, rule[1], pop, 0);
+            if (op == RULE_GROUP) {
+                pt_emit(t, PT_GROUP, rule[2], -1, NULL);
+            } else if (op == RULE_ACCUMULATE) {
+                pt_emit(t, PT_ACCUMULATE, rule[2], -1, NULL);
+            } else {
+                pt_emit(t, PT_REPLACE, 0, fail, rule);
+            }
+            pt_bind(t, pop);
+            pt_emit(t, PT_MODE_FAIL, 0, fail, NULL);
+            break;
+        }
+    }
+}
+
+/* Translate the bytecode of a peg to threaded code */
+static PegProgram *peg_thread(const JanetPeg *peg) {
+    PegThreader t;
+    size_t len = peg->bytecode_len;
+    t.bytecode = peg->bytecode;
+    t.code = NULL;
+    t.jumps = NULL;
+    t.labels = NULL;
+    t.pending = NULL;
+    t.tables = NULL;
+    t.refs = janet_calloc(len ? len : 1, 1);
+    t.procs = janet_malloc(sizeof(int32_t) * (len ? len : 1));
+    if (NULL == t.refs || NULL == t.procs) {
+        JANET_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < len; i++) t.procs[i] = -1;
+    pt_analyze(&t);
+
+    int32_t fail = pt_label(&t);
+    pt_rule(&t, 0, fail, 0);
+    pt_emit(&t, PT_MATCH, 0, -1, NULL);
+    pt_bind(&t, fail);
+    pt_emit(&t, PT_FAIL, 0, -1, NULL);
+    while (janet_v_count(t.pending)) {
+        uint32_t r = t.pending[janet_v_count(t.pending) - 1];
+        janet_v_pop(t.pending);
+        int32_t rfail = pt_label(&t);
+        pt_bind(&t, t.procs[r]);
+        pt_rule(&t, r, rfail, 1);
+        pt_emit(&t, PT_RETURN, 0, -1, NULL);
+        pt_bind(&t, rfail);
+        pt_emit(&t, PT_RETURN_FAIL, 0, -1, NULL);
+    }
+
+    /* Resolve labels */
+    int32_t count = janet_v_count(t.code);
+    int32_t ntables = janet_v_count(t.tables);
+    size_t tables_start = sizeof(PegProgram) + sizeof(PegInstr) * (size_t) count;
+    PegProgram *p = janet_malloc(tables_start + sizeof(int32_t) * (size_t) ntables);
+    if (NULL == p) {
+        JANET_OUT_OF_MEMORY;
+    }
+    p->count = count;
+    p->tables = (int32_t *)((char *) p + tables_start);
+    for (int32_t i = 0; i < ntables; i++) {
+        int32_t label = t.tables[i];
+        if (i % PT_TABLE_SIZE == PT_TABLE_SIZE - 1) {
+            p->tables[i] = label;
+        } else {
+            p->tables[i] = label < 0 ? ~t.labels[~label] : t.labels[label];
+        }
+    }
+    for (int32_t i = 0; i < count; i++) {
+        PegInstr ins = t.code[i];
+        if (t.jumps[i] >= 0) ins.jump = p->code + t.labels[t.jumps[i]];
+        if (ins.op == PT_CALL) ins.arg = (uint32_t) t.labels[ins.arg];
+        p->code[i] = ins;
+    }
+    peg_run(NULL, p, NULL);
+
+    janet_v_free(t.code);
+    janet_v_free(t.jumps);
+    janet_v_free(t.labels);
+    janet_v_free(t.pending);
+    janet_v_free(t.tables);
+    janet_free(t.refs);
+    janet_free(t.procs);
+    return p;
+}
+
 /*
  * Post-Compilation
  */
@@ -1279,6 +2880,13 @@ static int peg_mark(void *p, size_t size) {
     return 0;
 }
 
+static int peg_gc(void *p, size_t size) {
+    (void) size;
+    JanetPeg *peg = (JanetPeg *)p;
+    janet_free(peg->threaded);
+    return 0;
+}
+
 static void peg_marshal(void *p, JanetMarshalContext *ctx) {
     JanetPeg *peg = (JanetPeg *)p;
     janet_marshal_size(ctx, peg->bytecode_len);
@@ -1319,6 +2927,7 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
     peg->constants = NULL;
     peg->bytecode_len = bytecode_len;
     peg->num_constants = num_constants;
+    peg->threaded = NULL;
 
     for (size_t i = 0; i < peg->bytecode_len; i++)
         bytecode[i] = (uint32_t) janet_unmarshal_int(ctx);
@@ -1385,6 +2994,17 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
                     op_flags[rule[2 + j]] |= 0x1;
                 }
                 i += 2 + len;
+                if ((instr & 0x1F) == RULE_CHOICE && (instr & PEG_GUARDED)) {
+                    /* [guards...] */
+                    if (i > blen || len > blen - i) goto bad;
+                    for (uint32_t j = 0; j < len; j++) {
+                        uint32_t guard = rule[2 + len + j];
+                        if (guard == PEG_NO_GUARD) continue;
+                        if (guard >= blen) goto bad;
+                        op_flags[guard] |= 0x05;
+                    }
+                    i += len;
+                }
             }
             break;
             case RULE_IF:
@@ -1421,6 +3041,7 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
             case RULE_GROUP:
             case RULE_CAPTURE:
             case RULE_UNREF:
+            case RULE_SPAN:
                 /* [rule, tag] */
                 if (rule[1] >= blen) goto bad;
                 op_flags[rule[1]] |= 0x01;
@@ -1434,11 +3055,24 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
                 op_flags[rule[1]] |= 0x01;
                 i += 4;
                 break;
+            case RULE_TO:
+            case RULE_THRU:
+                if (instr & PEG_GUARDED) {
+                    /* [rule, guard, guard_byte] */
+                    if (rule[1] >= blen) goto bad;
+                    op_flags[rule[1]] |= 0x01;
+                    if (rule[2] != PEG_NO_GUARD) {
+                        if (rule[2] >= blen) goto bad;
+                        op_flags[rule[2]] |= 0x05;
+                    }
+                    if (rule[3] != PEG_NO_GUARD && rule[3] > 0xFF) goto bad;
+                    i += 4;
+                    break;
+                }
+            /* fallthrough */
             case RULE_ERROR:
             case RULE_DROP:
             case RULE_NOT:
-            case RULE_TO:
-            case RULE_THRU:
                 /* [rule] */
                 if (rule[1] >= blen) goto bad;
                 op_flags[rule[1]] |= 0x01;
@@ -1458,9 +3092,11 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
     if (i != blen) goto bad;
 
     /* Make sure all referenced instructions are actually
-     * in instruction positions. */
-    for (i = 0; i < blen; i++)
-        if (op_flags[i] == 0x01) goto bad;
+     * in instruction positions, and that guards are sets. */
+    for (i = 0; i < blen; i++) {
+        if ((op_flags[i] & 0x03) == 0x01) goto bad;
+        if ((op_flags[i] & 0x04) && (bytecode[i] & 0x1F) != RULE_SET) goto bad;
+    }
 
     /* Good return */
     peg->bytecode = bytecode;
@@ -1479,7 +3115,7 @@ static Janet peg_next(void *p, Janet key);
 
 const JanetAbstractType janet_peg_type = {
     "core/peg",
-    NULL,
+    peg_gc,
     peg_mark,
     cfun_peg_getter,
     NULL, /* put */
@@ -1508,6 +3144,7 @@ static JanetPeg *make_peg(Builder *b) {
     safe_memcpy(peg->constants, b->constants, constants_size);
     peg->bytecode_len = janet_v_count(b->bytecode);
     peg->has_backref = b->has_backref;
+    peg->threaded = NULL;
     return peg;
 }
 
@@ -1530,6 +3167,7 @@ static JanetPeg *compile_peg(Janet x) {
     builder.depth = JANET_RECURSION_GUARD;
     builder.has_backref = 0;
     peg_compile1(&builder, x);
+    peg_optimize(&builder);
     JanetPeg *peg = make_peg(&builder);
     builder_cleanup(&builder);
     return peg;
@@ -1540,8 +3178,15 @@ static JanetPeg *compile_peg(Janet x) {
  */
 
 static Janet cfun_peg_compile(int32_t argc, Janet *argv) {
-    janet_fixarity(argc, 1);
+    janet_arity(argc, 1, 2);
+    int threaded = 0;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        if (!janet_keyeq(argv[1], "threaded"))
+            janet_panicf("expected :threaded, got %v", argv[1]);
+        threaded = 1;
+    }
     JanetPeg *peg = compile_peg(argv[0]);
+    if (threaded) peg->threaded = peg_thread(peg);
     return janet_wrap_abstract(peg);
 }
 
@@ -1550,50 +3195,67 @@ typedef struct {
     JanetPeg *peg;
     PegState s;
     JanetByteView bytes;
-    JanetByteView repl;
     int32_t start;
+    /* Stand ins for the tag storage of pegs without backrefs, which
+     * only ever have zero tagged captures. */
+    JanetArray no_tagged_captures;
+    JanetBuffer no_tags;
 } PegCall;
 
-/* Initialize state for peg cfunctions */
-static PegCall peg_cfun_init(int32_t argc, Janet *argv, int get_replace) {
-    PegCall ret;
-    int32_t min = get_replace ? 3 : 2;
-    janet_arity(argc, get_replace, -1);
+/* Initialize state for peg cfunctions. The text comes after skip other
+ * arguments, and is followed by the start index and extra arguments.
+ * Captures go to into, or to a new array if into is NULL. */
+static void peg_cfun_init(PegCall *ret, int32_t argc, Janet *argv, int32_t skip, JanetArray *into) {
+    int32_t min = skip + 2;
+    janet_arity(argc, min, -1);
     if (janet_checktype(argv[0], JANET_ABSTRACT) &&
             janet_abstract_type(janet_unwrap_abstract(argv[0])) == &janet_peg_type) {
-        ret.peg = janet_unwrap_abstract(argv[0]);
+        ret->peg = janet_unwrap_abstract(argv[0]);
     } else {
-        ret.peg = compile_peg(argv[0]);
+        ret->peg = compile_peg(argv[0]);
     }
-    if (get_replace) {
-        ret.repl = janet_getbytes(argv, 1);
-        ret.bytes = janet_getbytes(argv, 2);
+    ret->bytes = janet_getbytes(argv, skip + 1);
+    if (argc > min) {
+        ret->start = janet_gethalfrange(argv, min, ret->bytes.len, "offset");
+        ret->s.extrac = argc - min - 1;
+        ret->s.extrav = janet_tuple_n(argv + min + 1, argc - min - 1);
     } else {
-        ret.bytes = janet_getbytes(argv, 1);
+        ret->start = 0;
+        ret->s.extrac = 0;
+        ret->s.extrav = NULL;
     }
-    if (argc > min) {
-        ret.start = janet_gethalfrange(argv, min, ret.bytes.len, "offset");
-        ret.s.extrac = argc - min - 1;
-        ret.s.extrav = janet_tuple_n(argv + min + 1, argc - min - 1);
+    ret->s.mode = PEG_MODE_NORMAL;
+    ret->s.text_start = ret->bytes.bytes;
+    ret->s.text_end = ret->bytes.bytes + ret->bytes.len;
+    ret->s.depth = JANET_RECURSION_GUARD;
+    if (NULL != into) {
+        into->count = 0;
+        ret->s.captures = into;
     } else {
-        ret.start = 0;
-        ret.s.extrac = 0;
-        ret.s.extrav = NULL;
-    }
-    ret.s.mode = PEG_MODE_NORMAL;
-    ret.s.text_start = ret.bytes.bytes;
-    ret.s.text_end = ret.bytes.bytes + ret.bytes.len;
-    ret.s.depth = JANET_RECURSION_GUARD;
-    ret.s.captures = janet_array(0);
-    ret.s.tagged_captures = janet_array(0);
-    ret.s.scratch = janet_buffer(10);
-    ret.s.tags = janet_buffer(10);
-    ret.s.constants = ret.peg->constants;
-    ret.s.bytecode = ret.peg->bytecode;
-    ret.s.linemap = NULL;
-    ret.s.linemaplen = -1;
-    ret.s.has_backref = ret.peg->has_backref;
-    return ret;
+        ret->s.captures = janet_array(0);
+    }
+    ret->s.scratch = janet_buffer(10);
+    if (ret->peg->has_backref) {
+        ret->s.tagged_captures = janet_array(0);
+        ret->s.tags = janet_buffer(10);
+    } else {
+        memset(&ret->no_tagged_captures, 0, sizeof(JanetArray));
+        memset(&ret->no_tags, 0, sizeof(JanetBuffer));
+        ret->s.tagged_captures = &ret->no_tagged_captures;
+        ret->s.tags = &ret->no_tags;
+    }
+    ret->s.constants = ret->peg->constants;
+    ret->s.bytecode = ret->peg->bytecode;
+    ret->s.linemap = NULL;
+    ret->s.linemaplen = -1;
+    ret->s.has_backref = ret->peg->has_backref;
+    ret->s.hit_end = 0;
+}
+
+/* Match a peg at text, with threaded code if the peg has any */
+static const uint8_t *peg_match_at(PegState *s, const JanetPeg *peg, const uint8_t *text) {
+    if (NULL != peg->threaded) return peg_run(s, peg->threaded, text);
+    return peg_rule(s, s->bytecode, text);
 }
 
 static void peg_call_reset(PegCall *c) {
@@ -1603,46 +3265,64 @@ static void peg_call_reset(PegCall *c) {
 }
 
 static Janet cfun_peg_match(int32_t argc, Janet *argv) {
-    PegCall c = peg_cfun_init(argc, argv, 0);
-    const uint8_t *result = peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + c.start);
+    PegCall c;
+    peg_cfun_init(&c, argc, argv, 0, NULL);
+    const uint8_t *result = peg_match_at(&c.s, c.peg, c.bytes.bytes + c.start);
     return result ? janet_wrap_array(c.s.captures) : janet_wrap_nil();
 }
 
+static Janet cfun_peg_match_into(int32_t argc, Janet *argv) {
+    janet_arity(argc, 3, -1);
+    JanetArray *into = janet_getarray(argv, 1);
+    PegCall c;
+    peg_cfun_init(&c, argc, argv, 1, into);
+    const uint8_t *result = peg_match_at(&c.s, c.peg, c.bytes.bytes + c.start);
+    if (NULL == result) {
+        into->count = 0;
+        return janet_wrap_nil();
+    }
+    return janet_wrap_array(into);
+}
+
 static Janet cfun_peg_find(int32_t argc, Janet *argv) {
-    PegCall c = peg_cfun_init(argc, argv, 0);
+    PegCall c;
+    peg_cfun_init(&c, argc, argv, 0, NULL);
     for (int32_t i = c.start; i < c.bytes.len; i++) {
         peg_call_reset(&c);
-        if (peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + i))
+        if (peg_match_at(&c.s, c.peg, c.bytes.bytes + i))
             return janet_wrap_integer(i);
     }
     return janet_wrap_nil();
 }
 
 static Janet cfun_peg_find_all(int32_t argc, Janet *argv) {
-    PegCall c = peg_cfun_init(argc, argv, 0);
+    PegCall c;
+    peg_cfun_init(&c, argc, argv, 0, NULL);
     JanetArray *ret = janet_array(0);
     for (int32_t i = c.start; i < c.bytes.len; i++) {
         peg_call_reset(&c);
-        if (peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + i))
+        if (peg_match_at(&c.s, c.peg, c.bytes.bytes + i))
             janet_array_push(ret, janet_wrap_integer(i));
     }
     return janet_wrap_array(ret);
 }
 
 static Janet cfun_peg_replace_generic(int32_t argc, Janet *argv, int only_one) {
-    PegCall c = peg_cfun_init(argc, argv, 1);
+    PegCall c;
+    peg_cfun_init(&c, argc, argv, 1, NULL);
+    JanetByteView repl = janet_getbytes(argv, 1);
     JanetBuffer *ret = janet_buffer(0);
     int32_t trail = 0;
     for (int32_t i = c.start; i < c.bytes.len;) {
         peg_call_reset(&c);
-        const uint8_t *result = peg_rule(&c.s, c.s.bytecode, c.bytes.bytes + i);
+        const uint8_t *result = peg_match_at(&c.s, c.peg, c.bytes.bytes + i);
         if (NULL != result) {
             if (trail < i) {
                 janet_buffer_push_bytes(ret, c.bytes.bytes + trail, (i - trail));
                 trail = i;
             }
             int32_t nexti = (int32_t)(result - c.bytes.bytes);
-            janet_buffer_push_bytes(ret, c.repl.bytes, c.repl.len);
+            janet_buffer_push_bytes(ret, repl.bytes, repl.len);
             trail = nexti;
             if (nexti == i) nexti++;
             i = nexti;
@@ -1667,6 +3347,7 @@ static Janet cfun_peg_replace(int32_t argc, Janet *argv) {
 
 static JanetMethod peg_methods[] = {
     {"match", cfun_peg_match},
+    {"match-into", cfun_peg_match_into},
     {"find", cfun_peg_find},
     {"find-all", cfun_peg_find_all},
     {"replace", cfun_peg_replace},
@@ -1686,13 +3367,182 @@ static Janet peg_next(void *p, Janet key) {
     return janet_nextmethod(peg_methods, key);
 }
 
+/*
+ * Streaming matcher
+ */
+
+typedef struct {
+    JanetPeg *peg;
+    JanetBuffer *buffer;
+    Janet args;
+    int running;
+    enum {
+        PEG_MATCHER_OPEN,
+        PEG_MATCHER_FAILED,
+        PEG_MATCHER_FINISHED
+    } status;
+} PegMatcher;
+
+static int peg_matcher_mark(void *p, size_t size) {
+    (void) size;
+    PegMatcher *m = (PegMatcher *)p;
+    janet_mark(janet_wrap_abstract(m->peg));
+    janet_mark(janet_wrap_buffer(m->buffer));
+    janet_mark(m->args);
+    return 0;
+}
+
+static int peg_matcher_getter(JanetAbstract a, Janet key, Janet *out);
+static Janet peg_matcher_next(void *p, Janet key);
+
+const JanetAbstractType janet_peg_matcher_type = {
+    "core/peg-matcher",
+    NULL,
+    peg_matcher_mark,
+    peg_matcher_getter,
+    NULL, /* put */
+    NULL, /* marshal */
+    NULL, /* unmarshal */
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    peg_matcher_next,
+    JANET_ATEND_NEXT
+};
+
+/* Match the peg repeatedly from the start of the buffered input, pushing
+ * captures to out, and drop the input that was matched. Unless final, stop
+ * at the first match that could change with more input. Returns 0 if the
+ * peg does not match, or matches without consuming input. */
+static int peg_matcher_run(PegMatcher *m, JanetArray *out, int final) {
+    JanetBuffer *buffer = m->buffer;
+    const Janet *args = janet_unwrap_tuple(m->args);
+    PegState s;
+    s.extrac = janet_tuple_length(args);
+    s.extrav = args;
+    s.captures = janet_array(0);
+    s.tagged_captures = janet_array(0);
+    s.scratch = janet_buffer(10);
+    s.tags = janet_buffer(10);
+    s.constants = m->peg->constants;
+    s.bytecode = m->peg->bytecode;
+    s.has_backref = m->peg->has_backref;
+    int32_t start = 0;
+    int ok = 1;
+    while (start < buffer->count) {
+        s.mode = PEG_MODE_NORMAL;
+        s.text_start = buffer->data + start;
+        s.text_end = buffer->data + buffer->count;
+        s.depth = JANET_RECURSION_GUARD;
+        s.linemap = NULL;
+        s.linemaplen = -1;
+        s.hit_end = 0;
+        s.captures->count = 0;
+        s.tagged_captures->count = 0;
+        s.scratch->count = 0;
+        s.tags->count = 0;
+        const uint8_t *result = peg_match_at(&s, m->peg, s.text_start);
+        if (s.hit_end && !final) break;
+        if (NULL == result || result == s.text_start) {
+            ok = 0;
+            break;
+        }
+        for (int32_t i = 0; i < s.captures->count; i++)
+            janet_array_push(out, s.captures->data[i]);
+        start = (int32_t)(result - buffer->data);
+    }
+    memmove(buffer->data, buffer->data + start, buffer->count - start);
+    buffer->count -= start;
+    return ok;
+}
+
+static Janet peg_matcher_step(PegMatcher *m, int final) {
+    if (m->running) janet_panic("cannot use a peg matcher while it is matching");
+    if (m->status == PEG_MATCHER_FAILED) return janet_wrap_nil();
+    JanetArray *out = janet_array(0);
+    volatile int ok = 0;
+    JanetTryState tstate;
+    m->running = 1;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        ok = peg_matcher_run(m, out, final);
+    }
+    janet_restore(&tstate);
+    m->running = 0;
+    if (signal) {
+        m->status = PEG_MATCHER_FAILED;
+        janet_panicv(tstate.payload);
+    }
+    if (!ok) {
+        m->status = PEG_MATCHER_FAILED;
+        return janet_wrap_nil();
+    }
+    if (final) m->status = PEG_MATCHER_FINISHED;
+    return janet_wrap_array(out);
+}
+
+static Janet cfun_peg_matcher(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, -1);
+    JanetPeg *peg;
+    if (janet_checktype(argv[0], JANET_ABSTRACT) &&
+            janet_abstract_type(janet_unwrap_abstract(argv[0])) == &janet_peg_type) {
+        peg = janet_unwrap_abstract(argv[0]);
+    } else {
+        peg = compile_peg(argv[0]);
+    }
+    PegMatcher *m = janet_abstract(&janet_peg_matcher_type, sizeof(PegMatcher));
+    m->peg = peg;
+    m->buffer = janet_buffer(0);
+    m->args = janet_wrap_tuple(janet_tuple_n(argv + 1, argc - 1));
+    m->running = 0;
+    m->status = PEG_MATCHER_OPEN;
+    return janet_wrap_abstract(m);
+}
+
+static Janet cfun_peg_matcher_feed(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 2);
+    PegMatcher *m = janet_getabstract(argv, 0, &janet_peg_matcher_type);
+    JanetByteView bytes = janet_getbytes(argv, 1);
+    if (m->status == PEG_MATCHER_FINISHED) janet_panic("peg matcher is finished");
+    if (m->running) janet_panic("cannot use a peg matcher while it is matching");
+    if (m->status == PEG_MATCHER_OPEN) janet_buffer_push_bytes(m->buffer, bytes.bytes, bytes.len);
+    return peg_matcher_step(m, 0);
+}
+
+static Janet cfun_peg_matcher_finish(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    PegMatcher *m = janet_getabstract(argv, 0, &janet_peg_matcher_type);
+    if (m->status == PEG_MATCHER_FINISHED) janet_panic("peg matcher is finished");
+    return peg_matcher_step(m, 1);
+}
+
+static JanetMethod peg_matcher_methods[] = {
+    {"feed", cfun_peg_matcher_feed},
+    {"finish", cfun_peg_matcher_finish},
+    {NULL, NULL}
+};
+
+static int peg_matcher_getter(JanetAbstract a, Janet key, Janet *out) {
+    (void) a;
+    if (!janet_checktype(key, JANET_KEYWORD))
+        return 0;
+    return janet_getmethod(janet_unwrap_keyword(key), peg_matcher_methods, out);
+}
+
+static Janet peg_matcher_next(void *p, Janet key) {
+    (void) p;
+    return janet_nextmethod(peg_matcher_methods, key);
+}
+
 static const JanetReg peg_cfuns[] = {
     {
         "peg/compile", cfun_peg_compile,
-        JDOC("(peg/compile peg)\n\n"
+        JDOC("(peg/compile peg &opt mode)\n\n"
              "Compiles a peg source data structure into a <core/peg>. This will speed up matching "
              "if the same peg will be used multiple times. Will also use `(dyn :peg-grammar)` to suppliment "
-             "the grammar of the peg for otherwise undefined peg keywords.")
+             "the grammar of the peg for otherwise undefined peg keywords. If mode is :threaded, the peg "
+             "is also translated to threaded code, which takes longer to build but runs grammars "
+             "without recursing for each sub rule. Threaded code is not kept when a peg is marshalled.")
     },
     {
         "peg/match", cfun_peg_match,
@@ -1700,6 +3550,13 @@ static const JanetReg peg_cfuns[] = {
              "Match a Parsing Expression Grammar to a byte string and return an array of captured values. "
              "Returns nil if text does not match the language defined by peg. The syntax of PEGs is documented on the Janet website.")
     },
+    {
+        "peg/match-into", cfun_peg_match_into,
+        JDOC("(peg/match-into peg into text &opt start & args)\n\n"
+             "Like peg/match, but clears the array into and pushes the captures to it instead of a new array. "
+             "Returns into, or nil and an empty into if text does not match. Combined with span captures, "
+             "this lets a tokenizer match many times without allocating.")
+    },
     {
         "peg/find", cfun_peg_find,
         JDOC("(peg/find peg text &opt start & args)\n\n"
@@ -1721,6 +3578,29 @@ static const JanetReg peg_cfuns[] = {
         JDOC("(peg/replace-all peg repl text &opt start & args)\n\n"
              "Replace all matches of peg in text with repl, returning a new buffer. The peg does not need to make captures to do replacement.")
     },
+    {
+        "peg/matcher", cfun_peg_matcher,
+        JDOC("(peg/matcher peg & args)\n\n"
+             "Create a <core/peg-matcher> that matches peg repeatedly against a stream of bytes fed to it in chunks, "
+             "such as the results of file/read or net/read. Only input that has not been matched yet is kept in memory. "
+             "Use (:feed matcher bytes) to add input, which returns an array of the captures of every match that can "
+             "no longer change with more input. Use (:finish matcher) at the end of the stream to match the remaining input. "
+             "Both return nil if the peg fails to match, or matches without consuming input, after which the matcher always "
+             "returns nil. Positions and lines in captures are relative to the start of each match, and functions "
+             "in the peg may be called more than once on the same input. Extra args are passed to the peg as with peg/match.")
+    },
+    {
+        "peg/feed", cfun_peg_matcher_feed,
+        JDOC("(peg/feed matcher bytes)\n\n"
+             "Add bytes to the input of a peg matcher. Returns an array of the captures of all complete matches, "
+             "or nil if the peg failed to match.")
+    },
+    {
+        "peg/finish", cfun_peg_matcher_finish,
+        JDOC("(peg/finish matcher)\n\n"
+             "End the input of a peg matcher and match the rest of it. Returns an array of the captures of the remaining "
+             "matches, or nil if the remaining input does not match.")
+    },
     {NULL, NULL, NULL}
 };
 
@@ -1728,6 +3608,7 @@ static const JanetReg peg_cfuns[] = {
 void janet_lib_peg(JanetTable *env) {
     janet_core_cfuns(env, NULL, peg_cfuns);
     janet_register_abstract_type(&janet_peg_type);
+    janet_register_abstract_type(&janet_peg_matcher_type);
 }
 
 #endif /* ifdef JANET_PEG */
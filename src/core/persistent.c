@@ -0,0 +1,908 @@
+/*
+* Copyright (c) 2021 Calvin Rose & contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "util.h"
+#endif
+
+/* Conditional compilation */
+#ifdef JANET_PERSISTENT
+
+/* Persistent maps and vectors. Both are trees of immutable nodes with a
+ * branching factor of 32, so an update copies only the O(log32 n) nodes on
+ * the path to the changed entry and shares everything else with the old
+ * version.
+ *
+ * Maps are hash array mapped tries. Each node has a bitmap of the 5 bit hash
+ * fragments that have an entry stored inline, and one of the fragments that
+ * lead to a child node. Entries come first in the items, followed by the
+ * children. Keys whose 32 bit hashes are equal end up in collision nodes
+ * below the last level, which are plain lists of entries.
+ *
+ * Vectors are the same layout as Clojure's - a trie of full 32 element
+ * leaves, plus a tail of up to 32 elements that is not in the trie yet so
+ * pushing to the end is cheap. */
+
+#define JANET_PBITS 5
+#define JANET_PWIDTH (1 << JANET_PBITS)
+#define JANET_PMASK (JANET_PWIDTH - 1)
+#define JANET_PMAP_COLLISION 32
+
+/* Nodes are abstract values so they are collected once no version of a
+ * map or vector uses them. Children are stored as wrapped abstracts. */
+typedef struct {
+    uint32_t datamap;
+    uint32_t nodemap;
+    Janet items[];
+} JanetPnode;
+
+typedef struct {
+    int32_t count;
+    JanetPnode *root;
+} JanetPmap;
+
+typedef struct {
+    int32_t count;
+    int32_t shift;
+    JanetPnode *root;
+    JanetPnode *tail;
+} JanetPvec;
+
+#define pnode_len(node) ((int32_t)((janet_abstract_size(node) - sizeof(JanetPnode)) / sizeof(Janet)))
+#define pnode_child(node, i) ((JanetPnode *) janet_unwrap_abstract((node)->items[(i)]))
+
+static int pnode_gcmark(void *p, size_t size) {
+    JanetPnode *node = (JanetPnode *) p;
+    int32_t len = (int32_t)((size - sizeof(JanetPnode)) / sizeof(Janet));
+    for (int32_t i = 0; i < len; i++) {
+        janet_mark(node->items[i]);
+    }
+    return 0;
+}
+
+static const JanetAbstractType janet_pnode_type = {
+    "core/pnode",
+    NULL,
+    pnode_gcmark,
+    JANET_ATEND_GCMARK
+};
+
+static JanetPnode *pnode_new(int32_t len) {
+    JanetPnode *node = janet_abstract(&janet_pnode_type, sizeof(JanetPnode) + (size_t) len * sizeof(Janet));
+    node->datamap = 0;
+    node->nodemap = 0;
+    return node;
+}
+
+/* Copy a node, leaving room for len items */
+static JanetPnode *pnode_copy(JanetPnode *node, int32_t len) {
+    JanetPnode *ret = pnode_new(len);
+    int32_t oldlen = pnode_len(node);
+    ret->datamap = node->datamap;
+    ret->nodemap = node->nodemap;
+    safe_memcpy(ret->items, node->items, (size_t)(len < oldlen ? len : oldlen) * sizeof(Janet));
+    return ret;
+}
+
+static int pmap_popcount(uint32_t x) {
+#ifdef __GNUC__
+    return __builtin_popcount(x);
+#else
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F;
+    return (int)((x * 0x01010101) >> 24);
+#endif
+}
+
+#define pmap_bit(hash, shift) ((uint32_t) 1 << (((uint32_t)(hash) >> (shift)) & JANET_PMASK))
+#define pmap_index(map, bit) pmap_popcount((map) & ((bit) - 1))
+
+/*
+ * Maps
+ */
+
+static Janet *pmap_find(JanetPnode *node, Janet key, int32_t hash) {
+    int shift = 0;
+    while (NULL != node) {
+        if (shift >= JANET_PMAP_COLLISION) {
+            int32_t len = pnode_len(node);
+            for (int32_t i = 0; i < len; i += 2) {
+                if (janet_equals(node->items[i], key)) return node->items + i + 1;
+            }
+            return NULL;
+        }
+        uint32_t bit = pmap_bit(hash, shift);
+        if (node->datamap & bit) {
+            int32_t i = 2 * pmap_index(node->datamap, bit);
+            return janet_equals(node->items[i], key) ? node->items + i + 1 : NULL;
+        }
+        if (!(node->nodemap & bit)) return NULL;
+        node = pnode_child(node, 2 * pmap_popcount(node->datamap) + pmap_index(node->nodemap, bit));
+        shift += JANET_PBITS;
+    }
+    return NULL;
+}
+
+/* Make a node holding two entries with different keys */
+static JanetPnode *pmap_pair(Janet k1, Janet v1, int32_t h1, Janet k2, Janet v2, int32_t h2, int shift) {
+    JanetPnode *node;
+    if (shift >= JANET_PMAP_COLLISION) {
+        node = pnode_new(4);
+        node->items[0] = k1;
+        node->items[1] = v1;
+        node->items[2] = k2;
+        node->items[3] = v2;
+        return node;
+    }
+    uint32_t b1 = pmap_bit(h1, shift);
+    uint32_t b2 = pmap_bit(h2, shift);
+    if (b1 == b2) {
+        node = pnode_new(1);
+        node->nodemap = b1;
+        node->items[0] = janet_wrap_abstract(pmap_pair(k1, v1, h1, k2, v2, h2, shift + JANET_PBITS));
+        return node;
+    }
+    node = pnode_new(4);
+    node->datamap = b1 | b2;
+    int first = b1 < b2 ? 0 : 2;
+    node->items[first] = k1;
+    node->items[first + 1] = v1;
+    node->items[2 - first] = k2;
+    node->items[3 - first] = v2;
+    return node;
+}
+
+/* Return a copy of node with key set to value. */
+static JanetPnode *pmap_assoc(JanetPnode *node, Janet key, int32_t hash, Janet value, int shift, int *added) {
+    if (shift >= JANET_PMAP_COLLISION) {
+        int32_t len = pnode_len(node);
+        for (int32_t i = 0; i < len; i += 2) {
+            if (janet_equals(node->items[i], key)) {
+                JanetPnode *ret = pnode_copy(node, len);
+                ret->items[i + 1] = value;
+                return ret;
+            }
+        }
+        JanetPnode *ret = pnode_copy(node, len + 2);
+        ret->items[len] = key;
+        ret->items[len + 1] = value;
+        *added = 1;
+        return ret;
+    }
+    int32_t len = pnode_len(node);
+    uint32_t bit = pmap_bit(hash, shift);
+    int32_t ndata = 2 * pmap_popcount(node->datamap);
+    if (node->datamap & bit) {
+        int32_t i = 2 * pmap_index(node->datamap, bit);
+        Janet oldkey = node->items[i];
+        if (janet_equals(oldkey, key)) {
+            JanetPnode *ret = pnode_copy(node, len);
+            ret->items[i + 1] = value;
+            return ret;
+        }
+        /* Move the old entry and the new one down into a child */
+        JanetPnode *child = pmap_pair(oldkey, node->items[i + 1], janet_hash(oldkey),
+                                      key, value, hash, shift + JANET_PBITS);
+        int32_t j = ndata - 2 + pmap_index(node->nodemap, bit);
+        JanetPnode *ret = pnode_new(len - 1);
+        ret->datamap = node->datamap ^ bit;
+        ret->nodemap = node->nodemap | bit;
+        safe_memcpy(ret->items, node->items, (size_t) i * sizeof(Janet));
+        safe_memcpy(ret->items + i, node->items + i + 2, (size_t)(j - i) * sizeof(Janet));
+        ret->items[j] = janet_wrap_abstract(child);
+        safe_memcpy(ret->items + j + 1, node->items + j + 2, (size_t)(len - j - 2) * sizeof(Janet));
+        *added = 1;
+        return ret;
+    }
+    if (node->nodemap & bit) {
+        int32_t j = ndata + pmap_index(node->nodemap, bit);
+        JanetPnode *child = pmap_assoc(pnode_child(node, j), key, hash, value, shift + JANET_PBITS, added);
+        JanetPnode *ret = pnode_copy(node, len);
+        ret->items[j] = janet_wrap_abstract(child);
+        return ret;
+    }
+    /* Insert a new entry */
+    int32_t i = 2 * pmap_index(node->datamap, bit);
+    JanetPnode *ret = pnode_new(len + 2);
+    ret->datamap = node->datamap | bit;
+    ret->nodemap = node->nodemap;
+    safe_memcpy(ret->items, node->items, (size_t) i * sizeof(Janet));
+    ret->items[i] = key;
+    ret->items[i + 1] = value;
+    safe_memcpy(ret->items + i + 2, node->items + i, (size_t)(len - i) * sizeof(Janet));
+    *added = 1;
+    return ret;
+}
+
+/* A node with a single entry and no children can be pulled up into its parent */
+static int pmap_single(JanetPnode *node, int shift) {
+    if (shift >= JANET_PMAP_COLLISION) return pnode_len(node) == 2;
+    return node->nodemap == 0 && pmap_popcount(node->datamap) == 1;
+}
+
+/* Return a copy of node without key, NULL if the result is empty, or node
+ * itself if key is not in it. */
+static JanetPnode *pmap_dissoc(JanetPnode *node, Janet key, int32_t hash, int shift) {
+    int32_t len = pnode_len(node);
+    if (shift >= JANET_PMAP_COLLISION) {
+        for (int32_t i = 0; i < len; i += 2) {
+            if (janet_equals(node->items[i], key)) {
+                if (len == 2) return NULL;
+                JanetPnode *ret = pnode_copy(node, len - 2);
+                safe_memcpy(ret->items + i, node->items + i + 2, (size_t)(len - i - 2) * sizeof(Janet));
+                return ret;
+            }
+        }
+        return node;
+    }
+    uint32_t bit = pmap_bit(hash, shift);
+    int32_t ndata = 2 * pmap_popcount(node->datamap);
+    if (node->datamap & bit) {
+        int32_t i = 2 * pmap_index(node->datamap, bit);
+        if (!janet_equals(node->items[i], key)) return node;
+        if (len == 2) return NULL;
+        JanetPnode *ret = pnode_copy(node, len - 2);
+        ret->datamap ^= bit;
+        safe_memcpy(ret->items + i, node->items + i + 2, (size_t)(len - i - 2) * sizeof(Janet));
+        return ret;
+    }
+    if (node->nodemap & bit) {
+        int32_t j = ndata + pmap_index(node->nodemap, bit);
+        JanetPnode *child = pnode_child(node, j);
+        JanetPnode *newchild = pmap_dissoc(child, key, hash, shift + JANET_PBITS);
+        if (newchild == child) return node;
+        if (NULL == newchild) {
+            if (len == 1) return NULL;
+            JanetPnode *ret = pnode_copy(node, len - 1);
+            ret->nodemap ^= bit;
+            safe_memcpy(ret->items + j, node->items + j + 1, (size_t)(len - j - 1) * sizeof(Janet));
+            return ret;
+        }
+        if (pmap_single(newchild, shift + JANET_PBITS)) {
+            /* Inline the last entry of the child */
+            int32_t i = 2 * pmap_index(node->datamap, bit);
+            JanetPnode *ret = pnode_new(len + 1);
+            ret->datamap = node->datamap | bit;
+            ret->nodemap = node->nodemap ^ bit;
+            safe_memcpy(ret->items, node->items, (size_t) i * sizeof(Janet));
+            ret->items[i] = newchild->items[0];
+            ret->items[i + 1] = newchild->items[1];
+            safe_memcpy(ret->items + i + 2, node->items + i, (size_t)(j - i) * sizeof(Janet));
+            safe_memcpy(ret->items + j + 2, node->items + j + 1, (size_t)(len - j - 1) * sizeof(Janet));
+            return ret;
+        }
+        JanetPnode *ret = pnode_copy(node, len);
+        ret->items[j] = janet_wrap_abstract(newchild);
+        return ret;
+    }
+    return node;
+}
+
+/* First key in a subtree */
+static Janet *pmap_first(JanetPnode *node, int shift) {
+    while (shift < JANET_PMAP_COLLISION && !node->datamap) {
+        node = pnode_child(node, 0);
+        shift += JANET_PBITS;
+    }
+    return node->items;
+}
+
+/* Key after key in a subtree, or NULL if key is the last one. */
+static Janet *pmap_after(JanetPnode *node, Janet key, int32_t hash, int shift) {
+    int32_t len = pnode_len(node);
+    if (shift >= JANET_PMAP_COLLISION) {
+        for (int32_t i = 0; i < len - 2; i += 2) {
+            if (janet_equals(node->items[i], key)) return node->items + i + 2;
+        }
+        return NULL;
+    }
+    uint32_t bit = pmap_bit(hash, shift);
+    int32_t ndata = 2 * pmap_popcount(node->datamap);
+    int32_t j;
+    if (node->datamap & bit) {
+        int32_t i = 2 * pmap_index(node->datamap, bit);
+        if (i + 2 < ndata) return node->items + i + 2;
+        j = ndata - 1;
+    } else {
+        j = ndata + pmap_index(node->nodemap, bit);
+        Janet *next = pmap_after(pnode_child(node, j), key, hash, shift + JANET_PBITS);
+        if (NULL != next) return next;
+    }
+    if (j + 1 < len) return pmap_first(pnode_child(node, j + 1), shift + JANET_PBITS);
+    return NULL;
+}
+
+/* Order independent hash of a subtree */
+static uint32_t pmap_hash_node(JanetPnode *node, int shift) {
+    uint32_t hash = 0;
+    int32_t len = pnode_len(node);
+    int32_t ndata = shift >= JANET_PMAP_COLLISION ? len : 2 * pmap_popcount(node->datamap);
+    for (int32_t i = 0; i < ndata; i += 2) {
+        uint32_t kh = (uint32_t) janet_hash(node->items[i]);
+        uint32_t vh = (uint32_t) janet_hash(node->items[i + 1]);
+        hash += kh ^ (vh + 0x9e3779b9 + (kh << 6) + (kh >> 2));
+    }
+    for (int32_t i = ndata; i < len; i++) {
+        hash += pmap_hash_node(pnode_child(node, i), shift + JANET_PBITS);
+    }
+    return hash;
+}
+
+/* Check that every entry in a subtree has an equal entry in other */
+static int pmap_subset(JanetPnode *node, int shift, JanetPnode *other) {
+    int32_t len = pnode_len(node);
+    int32_t ndata = shift >= JANET_PMAP_COLLISION ? len : 2 * pmap_popcount(node->datamap);
+    for (int32_t i = 0; i < ndata; i += 2) {
+        Janet *v = pmap_find(other, node->items[i], janet_hash(node->items[i]));
+        if (NULL == v || !janet_equals(*v, node->items[i + 1])) return 0;
+    }
+    for (int32_t i = ndata; i < len; i++) {
+        if (!pmap_subset(pnode_child(node, i), shift + JANET_PBITS, other)) return 0;
+    }
+    return 1;
+}
+
+static void pmap_put(JanetPmap *m, Janet key, Janet value) {
+    int32_t hash = janet_hash(key);
+    if (NULL == m->root) {
+        m->root = pnode_new(2);
+        m->root->datamap = pmap_bit(hash, 0);
+        m->root->items[0] = key;
+        m->root->items[1] = value;
+        m->count = 1;
+        return;
+    }
+    int added = 0;
+    m->root = pmap_assoc(m->root, key, hash, value, 0, &added);
+    m->count += added;
+}
+
+static int pmap_gcmark(void *p, size_t size) {
+    (void) size;
+    JanetPmap *m = (JanetPmap *) p;
+    if (NULL != m->root) janet_mark(janet_wrap_abstract(m->root));
+    return 0;
+}
+
+static Janet cfun_pmap_length(int32_t argc, Janet *argv);
+
+static const JanetMethod pmap_methods[] = {
+    {"length", cfun_pmap_length},
+    {NULL, NULL}
+};
+
+static int pmap_get(void *p, Janet key, Janet *out) {
+    JanetPmap *m = (JanetPmap *) p;
+    Janet *v = pmap_find(m->root, key, janet_hash(key));
+    if (NULL != v) {
+        *out = *v;
+        return 1;
+    }
+    if (!janet_checktype(key, JANET_KEYWORD)) return 0;
+    return janet_getmethod(janet_unwrap_keyword(key), pmap_methods, out);
+}
+
+static Janet pmap_next(void *p, Janet key) {
+    JanetPmap *m = (JanetPmap *) p;
+    if (NULL == m->root) return janet_wrap_nil();
+    if (janet_checktype(key, JANET_NIL)) return *pmap_first(m->root, 0);
+    int32_t hash = janet_hash(key);
+    if (NULL == pmap_find(m->root, key, hash)) return janet_wrap_nil();
+    Janet *next = pmap_after(m->root, key, hash, 0);
+    return NULL == next ? janet_wrap_nil() : *next;
+}
+
+static int32_t pmap_hash(void *p, size_t size) {
+    (void) size;
+    JanetPmap *m = (JanetPmap *) p;
+    uint32_t hash = (uint32_t) m->count;
+    if (NULL != m->root) hash += pmap_hash_node(m->root, 0);
+    return (int32_t) hash;
+}
+
+static int pmap_compare(void *lhs, void *rhs) {
+    JanetPmap *a = (JanetPmap *) lhs;
+    JanetPmap *b = (JanetPmap *) rhs;
+    if (a->count != b->count) return a->count < b->count ? -1 : 1;
+    if (a->root == b->root) return 0;
+    if (pmap_subset(a->root, 0, b->root)) return 0;
+    int32_t ha = pmap_hash(lhs, 0);
+    int32_t hb = pmap_hash(rhs, 0);
+    if (ha != hb) return ha < hb ? -1 : 1;
+    return lhs < rhs ? -1 : 1;
+}
+
+static void pmap_tostring_node(JanetPnode *node, int shift, JanetBuffer *buffer, int *first) {
+    int32_t len = pnode_len(node);
+    int32_t ndata = shift >= JANET_PMAP_COLLISION ? len : 2 * pmap_popcount(node->datamap);
+    for (int32_t i = 0; i < ndata; i += 2) {
+        if (!*first) janet_buffer_push_u8(buffer, ' ');
+        *first = 0;
+        janet_description_b(buffer, node->items[i]);
+        janet_buffer_push_u8(buffer, ' ');
+        janet_description_b(buffer, node->items[i + 1]);
+    }
+    for (int32_t i = ndata; i < len; i++) {
+        pmap_tostring_node(pnode_child(node, i), shift + JANET_PBITS, buffer, first);
+    }
+}
+
+static void pmap_tostring(void *p, JanetBuffer *buffer) {
+    JanetPmap *m = (JanetPmap *) p;
+    int first = 1;
+    janet_buffer_push_u8(buffer, '{');
+    if (NULL != m->root) pmap_tostring_node(m->root, 0, buffer, &first);
+    janet_buffer_push_u8(buffer, '}');
+}
+
+static void pmap_marshal_node(JanetPnode *node, int shift, JanetMarshalContext *ctx) {
+    int32_t len = pnode_len(node);
+    int32_t ndata = shift >= JANET_PMAP_COLLISION ? len : 2 * pmap_popcount(node->datamap);
+    for (int32_t i = 0; i < ndata; i++) {
+        janet_marshal_janet(ctx, node->items[i]);
+    }
+    for (int32_t i = ndata; i < len; i++) {
+        pmap_marshal_node(pnode_child(node, i), shift + JANET_PBITS, ctx);
+    }
+}
+
+static void pmap_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetPmap *m = (JanetPmap *) p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_int(ctx, m->count);
+    if (NULL != m->root) pmap_marshal_node(m->root, 0, ctx);
+}
+
+static void *pmap_unmarshal(JanetMarshalContext *ctx) {
+    JanetPmap *m = janet_unmarshal_abstract(ctx, sizeof(JanetPmap));
+    m->count = 0;
+    m->root = NULL;
+    int32_t count = janet_unmarshal_int(ctx);
+    if (count < 0) janet_panic("invalid pmap count");
+    for (int32_t i = 0; i < count; i++) {
+        Janet key = janet_unmarshal_janet(ctx);
+        Janet value = janet_unmarshal_janet(ctx);
+        if (janet_checktype(key, JANET_NIL)) janet_panic("invalid pmap key");
+        pmap_put(m, key, value);
+    }
+    return m;
+}
+
+const JanetAbstractType janet_pmap_type = {
+    "core/pmap",
+    NULL,
+    pmap_gcmark,
+    pmap_get,
+    NULL,
+    pmap_marshal,
+    pmap_unmarshal,
+    pmap_tostring,
+    pmap_compare,
+    pmap_hash,
+    pmap_next,
+    JANET_ATEND_NEXT
+};
+
+static Janet pmap_wrap(JanetPmap m) {
+    JanetPmap *ret = janet_abstract(&janet_pmap_type, sizeof(JanetPmap));
+    *ret = m;
+    return janet_wrap_abstract(ret);
+}
+
+/*
+ * Vectors
+ */
+
+static int32_t pvec_tailoff(const JanetPvec *v) {
+    return v->count < JANET_PWIDTH ? 0 : ((v->count - 1) >> JANET_PBITS) << JANET_PBITS;
+}
+
+/* The leaf that holds index i */
+static JanetPnode *pvec_leaf(const JanetPvec *v, int32_t i) {
+    if (i >= pvec_tailoff(v)) return v->tail;
+    JanetPnode *node = v->root;
+    for (int32_t level = v->shift; level > 0; level -= JANET_PBITS) {
+        node = pnode_child(node, (i >> level) & JANET_PMASK);
+    }
+    return node;
+}
+
+static JanetPnode *pvec_path(int32_t level, JanetPnode *node) {
+    if (level == 0) return node;
+    JanetPnode *ret = pnode_new(1);
+    ret->items[0] = janet_wrap_abstract(pvec_path(level - JANET_PBITS, node));
+    return ret;
+}
+
+static JanetPnode *pvec_push_tail(const JanetPvec *v, int32_t level, JanetPnode *parent, JanetPnode *tail) {
+    int32_t sub = ((v->count - 1) >> level) & JANET_PMASK;
+    int32_t len = pnode_len(parent);
+    JanetPnode *ret = pnode_copy(parent, sub < len ? len : sub + 1);
+    JanetPnode *insert;
+    if (level == JANET_PBITS) {
+        insert = tail;
+    } else if (sub < len) {
+        insert = pvec_push_tail(v, level - JANET_PBITS, pnode_child(parent, sub), tail);
+    } else {
+        insert = pvec_path(level - JANET_PBITS, tail);
+    }
+    ret->items[sub] = janet_wrap_abstract(insert);
+    return ret;
+}
+
+static JanetPvec pvec_push(JanetPvec v, Janet x) {
+    int32_t taillen = v.count - pvec_tailoff(&v);
+    if (taillen < JANET_PWIDTH) {
+        JanetPnode *tail = pnode_copy(v.tail, taillen + 1);
+        tail->items[taillen] = x;
+        v.tail = tail;
+        v.count++;
+        return v;
+    }
+    /* Tail is full, move it into the trie */
+    if ((v.count >> JANET_PBITS) > (1 << v.shift)) {
+        JanetPnode *root = pnode_new(2);
+        root->items[0] = janet_wrap_abstract(v.root);
+        root->items[1] = janet_wrap_abstract(pvec_path(v.shift, v.tail));
+        v.root = root;
+        v.shift += JANET_PBITS;
+    } else {
+        v.root = pvec_push_tail(&v, v.shift, v.root, v.tail);
+    }
+    v.tail = pnode_new(1);
+    v.tail->items[0] = x;
+    v.count++;
+    return v;
+}
+
+static JanetPnode *pvec_assoc(int32_t level, JanetPnode *node, int32_t i, Janet x) {
+    JanetPnode *ret = pnode_copy(node, pnode_len(node));
+    if (level == 0) {
+        ret->items[i & JANET_PMASK] = x;
+    } else {
+        int32_t sub = (i >> level) & JANET_PMASK;
+        ret->items[sub] = janet_wrap_abstract(pvec_assoc(level - JANET_PBITS, pnode_child(node, sub), i, x));
+    }
+    return ret;
+}
+
+static JanetPvec pvec_put(JanetPvec v, int32_t i, Janet x) {
+    if (i == v.count) return pvec_push(v, x);
+    int32_t tailoff = pvec_tailoff(&v);
+    if (i >= tailoff) {
+        v.tail = pnode_copy(v.tail, pnode_len(v.tail));
+        v.tail->items[i - tailoff] = x;
+    } else {
+        v.root = pvec_assoc(v.shift, v.root, i, x);
+    }
+    return v;
+}
+
+/* Remove the last leaf from the trie, or return NULL if that empties node */
+static JanetPnode *pvec_pop_tail(const JanetPvec *v, int32_t level, JanetPnode *node) {
+    int32_t sub = ((v->count - 2) >> level) & JANET_PMASK;
+    if (level > JANET_PBITS) {
+        JanetPnode *child = pvec_pop_tail(v, level - JANET_PBITS, pnode_child(node, sub));
+        if (NULL == child && sub == 0) return NULL;
+        JanetPnode *ret = pnode_copy(node, NULL == child ? sub : sub + 1);
+        if (NULL != child) ret->items[sub] = janet_wrap_abstract(child);
+        return ret;
+    }
+    if (sub == 0) return NULL;
+    return pnode_copy(node, sub);
+}
+
+static JanetPvec pvec_pop(JanetPvec v) {
+    int32_t taillen = v.count - pvec_tailoff(&v);
+    if (taillen > 1) {
+        v.tail = pnode_copy(v.tail, taillen - 1);
+        v.count--;
+        return v;
+    }
+    if (v.count == 1) {
+        v.tail = pnode_new(0);
+        v.count = 0;
+        return v;
+    }
+    JanetPnode *tail = pvec_leaf(&v, v.count - 2);
+    JanetPnode *root = pvec_pop_tail(&v, v.shift, v.root);
+    if (NULL == root) root = pnode_new(0);
+    if (v.shift > JANET_PBITS && pnode_len(root) == 1) {
+        root = pnode_child(root, 0);
+        v.shift -= JANET_PBITS;
+    }
+    v.root = root;
+    v.tail = tail;
+    v.count--;
+    return v;
+}
+
+static JanetPvec pvec_empty(void) {
+    JanetPvec v;
+    v.count = 0;
+    v.shift = JANET_PBITS;
+    v.root = pnode_new(0);
+    v.tail = pnode_new(0);
+    return v;
+}
+
+static Janet pvec_ref(const JanetPvec *v, int32_t i) {
+    return pvec_leaf(v, i)->items[i & JANET_PMASK];
+}
+
+static int pvec_gcmark(void *p, size_t size) {
+    (void) size;
+    JanetPvec *v = (JanetPvec *) p;
+    janet_mark(janet_wrap_abstract(v->root));
+    janet_mark(janet_wrap_abstract(v->tail));
+    return 0;
+}
+
+static Janet cfun_pvec_length(int32_t argc, Janet *argv);
+
+static const JanetMethod pvec_methods[] = {
+    {"length", cfun_pvec_length},
+    {NULL, NULL}
+};
+
+static int pvec_get(void *p, Janet key, Janet *out) {
+    JanetPvec *v = (JanetPvec *) p;
+    if (janet_checkint(key)) {
+        int32_t i = janet_unwrap_integer(key);
+        if (i < 0 || i >= v->count) return 0;
+        *out = pvec_ref(v, i);
+        return 1;
+    }
+    if (!janet_checktype(key, JANET_KEYWORD)) return 0;
+    return janet_getmethod(janet_unwrap_keyword(key), pvec_methods, out);
+}
+
+static Janet pvec_next(void *p, Janet key) {
+    JanetPvec *v = (JanetPvec *) p;
+    int32_t i;
+    if (janet_checktype(key, JANET_NIL)) {
+        i = 0;
+    } else if (janet_checkint(key)) {
+        i = janet_unwrap_integer(key) + 1;
+    } else {
+        janet_panicf("expected integer key, got %v", key);
+    }
+    if (i < 0 || i >= v->count) return janet_wrap_nil();
+    return janet_wrap_integer(i);
+}
+
+static int32_t pvec_hash(void *p, size_t size) {
+    (void) size;
+    JanetPvec *v = (JanetPvec *) p;
+    uint32_t hash = 0;
+    for (int32_t i = 0; i < v->count; i++) {
+        uint32_t elem = (uint32_t) janet_hash(pvec_ref(v, i));
+        hash ^= elem + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+    return (int32_t) hash;
+}
+
+static int pvec_compare(void *lhs, void *rhs) {
+    JanetPvec *a = (JanetPvec *) lhs;
+    JanetPvec *b = (JanetPvec *) rhs;
+    int32_t len = a->count < b->count ? a->count : b->count;
+    for (int32_t i = 0; i < len; i++) {
+        int c = janet_compare(pvec_ref(a, i), pvec_ref(b, i));
+        if (c) return c;
+    }
+    if (a->count == b->count) return 0;
+    return a->count < b->count ? -1 : 1;
+}
+
+static void pvec_tostring(void *p, JanetBuffer *buffer) {
+    JanetPvec *v = (JanetPvec *) p;
+    janet_buffer_push_u8(buffer, '[');
+    for (int32_t i = 0; i < v->count; i++) {
+        if (i) janet_buffer_push_u8(buffer, ' ');
+        janet_description_b(buffer, pvec_ref(v, i));
+    }
+    janet_buffer_push_u8(buffer, ']');
+}
+
+static void pvec_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetPvec *v = (JanetPvec *) p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_int(ctx, v->count);
+    for (int32_t i = 0; i < v->count; i++) {
+        janet_marshal_janet(ctx, pvec_ref(v, i));
+    }
+}
+
+static void *pvec_unmarshal(JanetMarshalContext *ctx) {
+    JanetPvec *v = janet_unmarshal_abstract(ctx, sizeof(JanetPvec));
+    *v = pvec_empty();
+    int32_t count = janet_unmarshal_int(ctx);
+    if (count < 0) janet_panic("invalid pvec count");
+    for (int32_t i = 0; i < count; i++) {
+        *v = pvec_push(*v, janet_unmarshal_janet(ctx));
+    }
+    return v;
+}
+
+const JanetAbstractType janet_pvec_type = {
+    "core/pvec",
+    NULL,
+    pvec_gcmark,
+    pvec_get,
+    NULL,
+    pvec_marshal,
+    pvec_unmarshal,
+    pvec_tostring,
+    pvec_compare,
+    pvec_hash,
+    pvec_next,
+    JANET_ATEND_NEXT
+};
+
+static Janet pvec_wrap(JanetPvec v) {
+    JanetPvec *ret = janet_abstract(&janet_pvec_type, sizeof(JanetPvec));
+    *ret = v;
+    return janet_wrap_abstract(ret);
+}
+
+/*
+ * C Functions
+ */
+
+static Janet cfun_pmap_new(int32_t argc, Janet *argv) {
+    if (argc & 1) janet_panic("expected even number of arguments");
+    JanetPmap m = {0, NULL};
+    for (int32_t i = 0; i < argc; i += 2) {
+        if (janet_checktype(argv[i], JANET_NIL)) janet_panic("pmap keys cannot be nil");
+        pmap_put(&m, argv[i], argv[i + 1]);
+    }
+    return pmap_wrap(m);
+}
+
+static Janet cfun_pmap_length(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetPmap *m = janet_getabstract(argv, 0, &janet_pmap_type);
+    return janet_wrap_integer(m->count);
+}
+
+static Janet cfun_pmap_put(int32_t argc, Janet *argv) {
+    janet_arity(argc, 3, -1);
+    if (!(argc & 1)) janet_panic("expected an even number of keys and values");
+    JanetPmap m = *(JanetPmap *) janet_getabstract(argv, 0, &janet_pmap_type);
+    for (int32_t i = 1; i < argc; i += 2) {
+        if (janet_checktype(argv[i], JANET_NIL)) janet_panic("pmap keys cannot be nil");
+        pmap_put(&m, argv[i], argv[i + 1]);
+    }
+    return pmap_wrap(m);
+}
+
+static Janet cfun_pmap_remove(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, -1);
+    JanetPmap *old = janet_getabstract(argv, 0, &janet_pmap_type);
+    JanetPmap m = *old;
+    for (int32_t i = 1; i < argc && NULL != m.root; i++) {
+        JanetPnode *root = pmap_dissoc(m.root, argv[i], janet_hash(argv[i]), 0);
+        if (root != m.root) m.count--;
+        m.root = root;
+    }
+    if (m.root == old->root) return argv[0];
+    return pmap_wrap(m);
+}
+
+static Janet cfun_pvec_new(int32_t argc, Janet *argv) {
+    JanetPvec v = pvec_empty();
+    for (int32_t i = 0; i < argc; i++) {
+        v = pvec_push(v, argv[i]);
+    }
+    return pvec_wrap(v);
+}
+
+static Janet cfun_pvec_length(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetPvec *v = janet_getabstract(argv, 0, &janet_pvec_type);
+    return janet_wrap_integer(v->count);
+}
+
+static Janet cfun_pvec_push(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, -1);
+    JanetPvec v = *(JanetPvec *) janet_getabstract(argv, 0, &janet_pvec_type);
+    for (int32_t i = 1; i < argc; i++) {
+        v = pvec_push(v, argv[i]);
+    }
+    return pvec_wrap(v);
+}
+
+static Janet cfun_pvec_pop(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetPvec v = *(JanetPvec *) janet_getabstract(argv, 0, &janet_pvec_type);
+    if (v.count == 0) return argv[0];
+    return pvec_wrap(pvec_pop(v));
+}
+
+static Janet cfun_pvec_put(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 3);
+    JanetPvec v = *(JanetPvec *) janet_getabstract(argv, 0, &janet_pvec_type);
+    int32_t i = janet_getinteger(argv, 1);
+    if (i < 0 || i > v.count) janet_panicf("index %d out of range [0,%d]", i, v.count);
+    return pvec_wrap(pvec_put(v, i, argv[2]));
+}
+
+static const JanetReg persistent_cfuns[] = {
+    {
+        "pmap", cfun_pmap_new,
+        JDOC("(pmap & kvs)\n\n"
+             "Create a persistent map from a sequence of keys and values. Persistent maps "
+             "are immutable like structs, but updating one with pmap/put or pmap/remove "
+             "only copies O(log n) of it and shares the rest with the original. "
+             "Use get to look up keys and next, pairs or eachp to iterate.")
+    },
+    {
+        "pmap/put", cfun_pmap_put,
+        JDOC("(pmap/put m k v & kvs)\n\n"
+             "Returns a new persistent map with the keys of m set to new values. "
+             "Does not modify m.")
+    },
+    {
+        "pmap/remove", cfun_pmap_remove,
+        JDOC("(pmap/remove m & ks)\n\n"
+             "Returns a new persistent map without the keys ks. Does not modify m. Returns m "
+             "if none of the keys are in it.")
+    },
+    {
+        "pvec", cfun_pvec_new,
+        JDOC("(pvec & xs)\n\n"
+             "Create a persistent vector from the arguments. Persistent vectors are "
+             "immutable like tuples, but pvec/push, pvec/pop and pvec/put only copy "
+             "O(log n) of the vector and share the rest with the original. "
+             "Use get to look up indices and next or each to iterate.")
+    },
+    {
+        "pvec/push", cfun_pvec_push,
+        JDOC("(pvec/push v & xs)\n\n"
+             "Returns a new persistent vector with xs added to the end of v. Does not modify v.")
+    },
+    {
+        "pvec/pop", cfun_pvec_pop,
+        JDOC("(pvec/pop v)\n\n"
+             "Returns a new persistent vector without the last element of v. Does not modify v. "
+             "Returns v if it is empty.")
+    },
+    {
+        "pvec/put", cfun_pvec_put,
+        JDOC("(pvec/put v i x)\n\n"
+             "Returns a new persistent vector with the element at index i set to x. If i is "
+             "the length of v, x is added to the end. Does not modify v.")
+    },
+    {NULL, NULL, NULL}
+};
+
+/* Module entry point */
+void janet_lib_persistent(JanetTable *env) {
+    janet_core_cfuns(env, NULL, persistent_cfuns);
+    janet_register_abstract_type(&janet_pmap_type);
+    janet_register_abstract_type(&janet_pvec_type);
+}
+
+#endif
@@ -37,22 +37,301 @@
 /* Temporary buffer size */
 #define BUFSIZE 64
 
+/* Write the digits of u, returning the number of bytes written */
+static int uint64_to_digits(char *out, uint64_t u) {
+    char tmp[20];
+    int n = 0, len = 0;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    while (n) out[len++] = tmp[--n];
+    return len;
+}
+
 static void number_to_string_b(JanetBuffer *buffer, double x) {
     janet_buffer_ensure(buffer, buffer->count + BUFSIZE, 2);
-    const char *fmt = (x == floor(x) &&
-                       x <= JANET_INTMAX_DOUBLE &&
-                       x >= JANET_INTMIN_DOUBLE) ? "%.0f" : "%g";
+    char *out = (char *) buffer->data + buffer->count;
     int count;
     if (x == 0.0) {
         /* Prevent printing of '-0' */
         count = 1;
-        buffer->data[buffer->count] = '0';
+        out[0] = '0';
+    } else if (x == floor(x) &&
+               x <= JANET_INTMAX_DOUBLE &&
+               x >= JANET_INTMIN_DOUBLE) {
+        /* Integers print exactly, so skip snprintf */
+        count = 0;
+        if (x < 0) out[count++] = '-';
+        count += uint64_to_digits(out + count, (uint64_t)(x < 0 ? -x : x));
     } else {
-        count = snprintf((char *) buffer->data + buffer->count, BUFSIZE, fmt, x);
+        count = snprintf(out, BUFSIZE, "%g", x);
     }
     buffer->count += count;
 }
 
+/* Shortest round trip printing of doubles with Grisu2, from "Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers" by Florian
+ * Loitsch, adapted from the implementation in rapidjson. The digits always
+ * read back as the same double, and are the shortest such digits for all
+ * but a tiny fraction of inputs. */
+
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DP_EXPONENT_MASK 0x7FF0000000000000ULL
+#define DP_HIDDEN_BIT 0x0010000000000000ULL
+
+/* Normalized powers of ten from 10^-348 to 10^340 in steps of 8 */
+static const uint64_t cached_powers_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+    0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+    0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+    0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+    0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+    0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+    0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+    0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+    0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+    0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+    0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+    0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+    0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+    0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+    0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint64_t pow10_u64[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+static DiyFp diyfp_mul(DiyFp x, DiyFp y) {
+    const uint64_t M32 = 0xFFFFFFFFu;
+    uint64_t a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+    tmp += 1U << 31; /* Round */
+    DiyFp r;
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static DiyFp diyfp_normalize(DiyFp x) {
+    while (!(x.f & 0xFFC0000000000000ULL)) {
+        x.f <<= 10;
+        x.e -= 10;
+    }
+    while (!(x.f & 0x8000000000000000ULL)) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/* Get the normalized boundaries of the rounding interval around v */
+static void diyfp_boundaries(DiyFp v, DiyFp *minus, DiyFp *plus) {
+    DiyFp pl, mi;
+    pl.f = (v.f << 1) + 1;
+    pl.e = v.e - 1;
+    while (!(pl.f & (DP_HIDDEN_BIT << 1))) {
+        pl.f <<= 1;
+        pl.e--;
+    }
+    pl.f <<= 10;
+    pl.e -= 10;
+    if (v.f == DP_HIDDEN_BIT) {
+        mi.f = (v.f << 2) - 1;
+        mi.e = v.e - 2;
+    } else {
+        mi.f = (v.f << 1) - 1;
+        mi.e = v.e - 1;
+    }
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *minus = mi;
+    *plus = pl;
+}
+
+/* Get a cached power of ten c such that e + c.e + 64 is in [-60, -32] */
+static DiyFp cached_power(int e, int *K) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int) dk;
+    if (dk - k > 0.0) k++;
+    int index = (k >> 3) + 1;
+    *K = -(-348 + (index << 3));
+    DiyFp r;
+    r.f = cached_powers_f[index];
+    r.e = cached_powers_e[index];
+    return r;
+}
+
+static void grisu_round(char *digits, int len, uint64_t delta, uint64_t rest,
+                        uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+            (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        digits[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int grisu_digit_gen(DiyFp W, DiyFp Mp, uint64_t delta, char *digits, int *K) {
+    const int shift = -Mp.e;
+    const uint64_t one = 1ULL << shift;
+    const uint64_t wp_w = Mp.f - W.f;
+    uint32_t p1 = (uint32_t)(Mp.f >> shift);
+    uint64_t p2 = Mp.f & (one - 1);
+    int kappa = 1;
+    int len = 0;
+    while (kappa < 10 && p1 >= pow10_u64[kappa]) kappa++;
+    while (kappa > 0) {
+        uint32_t p = (uint32_t) pow10_u64[kappa - 1];
+        uint32_t d = p1 / p;
+        p1 %= p;
+        if (d || len) digits[len++] = (char)('0' + d);
+        kappa--;
+        uint64_t rest = ((uint64_t) p1 << shift) + p2;
+        if (rest <= delta) {
+            *K += kappa;
+            grisu_round(digits, len, delta, rest, pow10_u64[kappa] << shift, wp_w);
+            return len;
+        }
+    }
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> shift);
+        if (d || len) digits[len++] = (char)('0' + d);
+        p2 &= one - 1;
+        kappa--;
+        if (p2 < delta) {
+            *K += kappa;
+            grisu_round(digits, len, delta, p2, one, -kappa < 20 ? wp_w * pow10_u64[-kappa] : 0);
+            return len;
+        }
+    }
+}
+
+/* Get the decimal digits of a positive, finite x such that x is
+ * digits * 10^K. Returns the number of digits. */
+static int grisu2(double x, char *digits, int *K) {
+    union {
+        double d;
+        uint64_t u;
+    } bits;
+    bits.d = x;
+    int biased_e = (int)((bits.u & DP_EXPONENT_MASK) >> 52);
+    DiyFp v, w_m, w_p;
+    v.f = bits.u & DP_SIGNIFICAND_MASK;
+    if (biased_e) {
+        v.f += DP_HIDDEN_BIT;
+        v.e = biased_e - 1075;
+    } else {
+        v.e = -1074;
+    }
+    diyfp_boundaries(v, &w_m, &w_p);
+    DiyFp c_mk = cached_power(w_p.e, K);
+    DiyFp W = diyfp_mul(diyfp_normalize(v), c_mk);
+    DiyFp Wp = diyfp_mul(w_p, c_mk);
+    DiyFp Wm = diyfp_mul(w_m, c_mk);
+    Wm.f++;
+    Wp.f--;
+    int len = grisu_digit_gen(W, Wp, Wp.f - Wm.f, digits, K);
+    while (len > 1 && digits[len - 1] == '0') {
+        len--;
+        (*K)++;
+    }
+    return len;
+}
+
+/* Print the shortest representation of x that reads back exactly, laid
+ * out like printf's "%.17g". Writes at most 32 bytes to out, and returns
+ * the number of bytes written. */
+int janet_double_to_shortest(char *out, double x) {
+    char digits[24];
+    int n = 0, K = 0;
+    if (x == 0.0) {
+        if (signbit(x)) out[n++] = '-';
+        out[n++] = '0';
+        return n;
+    }
+    if (isnan(x) || isinf(x)) {
+        return snprintf(out, 32, "%.17g", x);
+    }
+    if (x < 0) {
+        out[n++] = '-';
+        x = -x;
+    }
+    int len = grisu2(x, digits, &K);
+    int point = len + K;
+    int exp10 = point - 1;
+    if (exp10 < -4 || exp10 >= 17) {
+        out[n++] = digits[0];
+        if (len > 1) {
+            out[n++] = '.';
+            memcpy(out + n, digits + 1, len - 1);
+            n += len - 1;
+        }
+        out[n++] = 'e';
+        out[n++] = exp10 < 0 ? '-' : '+';
+        if (exp10 < 0) exp10 = -exp10;
+        if (exp10 >= 100) {
+            out[n++] = (char)('0' + exp10 / 100);
+            exp10 %= 100;
+        }
+        out[n++] = (char)('0' + exp10 / 10);
+        out[n++] = (char)('0' + exp10 % 10);
+    } else if (point >= len) {
+        memcpy(out + n, digits, len);
+        n += len;
+        while (point-- > len) out[n++] = '0';
+    } else if (point > 0) {
+        memcpy(out + n, digits, point);
+        n += point;
+        out[n++] = '.';
+        memcpy(out + n, digits + point, len - point);
+        n += len - point;
+    } else {
+        out[n++] = '0';
+        out[n++] = '.';
+        while (point++ < 0) out[n++] = '0';
+        memcpy(out + n, digits, len);
+        n += len;
+    }
+    return n;
+}
+
+#undef DP_SIGNIFICAND_MASK
+#undef DP_EXPONENT_MASK
+#undef DP_HIDDEN_BIT
+
 /* expects non positive x */
 static int count_dig10(int32_t x) {
     int result = 1;
@@ -369,8 +648,8 @@ static int print_jdn_one(struct pretty *S, Janet x, int depth) {
             break;
         case JANET_NUMBER:
             janet_buffer_ensure(S->buffer, S->buffer->count + BUFSIZE, 2);
-            int count = snprintf((char *) S->buffer->data + S->buffer->count, BUFSIZE, "%.17g", janet_unwrap_number(x));
-            S->buffer->count += count;
+            S->buffer->count += janet_double_to_shortest((char *) S->buffer->data + S->buffer->count,
+                                                         janet_unwrap_number(x));
             break;
         case JANET_SYMBOL:
         case JANET_KEYWORD:
@@ -479,14 +758,14 @@ static const char *janet_pretty_colors[] = {
 
 /* Helper for pretty printing */
 static void janet_pretty_one(struct pretty *S, Janet x, int is_dict_value) {
-    /* Add to seen */
+    /* Add to seen. Only containers can form cycles. */
     switch (janet_type(x)) {
-        case JANET_NIL:
-        case JANET_NUMBER:
-        case JANET_SYMBOL:
-        case JANET_BOOLEAN:
+        default:
             break;
-        default: {
+        case JANET_ARRAY:
+        case JANET_TUPLE:
+        case JANET_TABLE:
+        case JANET_STRUCT: {
             Janet seenid = janet_table_get(&S->seen, x);
             if (janet_checktype(seenid, JANET_NUMBER)) {
                 if (S->flags & JANET_PRETTY_COLOR) {
@@ -654,7 +933,16 @@ static void janet_pretty_one(struct pretty *S, Janet x, int is_dict_value) {
         }
     }
     /* Remove from seen */
-    janet_table_remove(&S->seen, x);
+    switch (janet_type(x)) {
+        default:
+            break;
+        case JANET_ARRAY:
+        case JANET_TUPLE:
+        case JANET_TABLE:
+        case JANET_STRUCT:
+            janet_table_remove(&S->seen, x);
+            break;
+    }
     return;
 }
 
@@ -671,7 +959,7 @@ static JanetBuffer *janet_pretty_(JanetBuffer *buffer, int depth, int flags, Jan
     S.keysort_capacity = 0;
     S.keysort_buffer = NULL;
     S.keysort_start = 0;
-    janet_table_init(&S.seen, 10);
+    janet_table_init(&S.seen, 0);
     janet_pretty_one(&S, x, 0);
     janet_table_deinit(&S.seen);
     return S.buffer;
@@ -696,7 +984,7 @@ static JanetBuffer *janet_jdn_(JanetBuffer *buffer, int depth, Janet x, int32_t
     S.keysort_capacity = 0;
     S.keysort_buffer = NULL;
     S.keysort_start = 0;
-    janet_table_init(&S.seen, 10);
+    janet_table_init(&S.seen, 0);
     int res = print_jdn_one(&S, x, depth);
     janet_table_deinit(&S.seen);
     if (res) {
@@ -921,6 +1209,109 @@ JanetBuffer *janet_formatb(JanetBuffer *buffer, const char *format, ...) {
     return buffer;
 }
 
+/* Format one value for string/format and buffer/format */
+static void janet_format_one(
+    JanetBuffer *b,
+    const char *form,
+    char conv,
+    int precision,
+    const Janet *argv,
+    int32_t arg,
+    int32_t startlen) {
+    char item[MAX_ITEM];
+    int nb = 0; /* number of bytes in added item */
+    switch (conv) {
+        case 'c': {
+            nb = snprintf(item, MAX_ITEM, form, (int)
+                          janet_getinteger(argv, arg));
+            break;
+        }
+        case 'd':
+        case 'i':
+        case 'o':
+        case 'x':
+        case 'X': {
+            int32_t n = janet_getinteger(argv, arg);
+            nb = snprintf(item, MAX_ITEM, form, n);
+            break;
+        }
+        case 'a':
+        case 'A':
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'g':
+        case 'G': {
+            double d = janet_getnumber(argv, arg);
+            nb = snprintf(item, MAX_ITEM, form, d);
+            break;
+        }
+        case 's': {
+            const uint8_t *s = janet_getstring(argv, arg);
+            int32_t l = janet_string_length(s);
+            if (form[2] == '\0')
+                janet_buffer_push_bytes(b, s, l);
+            else {
+                if (l != (int32_t) strlen((const char *) s))
+                    janet_panic("string contains zeros");
+                if (!strchr(form, '.') && l >= 100) {
+                    janet_panic("no precision and string is too long to be formatted");
+                } else {
+                    nb = snprintf(item, MAX_ITEM, form, s);
+                }
+            }
+            break;
+        }
+        case 'V': {
+            janet_to_string_b(b, argv[arg]);
+            break;
+        }
+        case 'v': {
+            janet_description_b(b, argv[arg]);
+            break;
+        }
+        case 't':
+            janet_buffer_push_cstring(b, typestr(argv[arg]));
+            break;
+        case 'M':
+        case 'm':
+        case 'N':
+        case 'n':
+        case 'Q':
+        case 'q':
+        case 'P':
+        case 'p': { /* janet pretty , precision = depth */
+            int depth = precision;
+            if (depth < 1) depth = JANET_RECURSION_GUARD;
+            int has_color = (conv == 'P') || (conv == 'Q') || (conv == 'M') || (conv == 'N');
+            int has_oneline = (conv == 'Q') || (conv == 'q') || (conv == 'N') || (conv == 'n');
+            int has_notrunc = (conv == 'M') || (conv == 'm') || (conv == 'N') || (conv == 'n');
+            int flags = 0;
+            flags |= has_color ? JANET_PRETTY_COLOR : 0;
+            flags |= has_oneline ? JANET_PRETTY_ONELINE : 0;
+            flags |= has_notrunc ? JANET_PRETTY_NOTRUNC : 0;
+            janet_pretty_(b, depth, flags, argv[arg], startlen);
+            break;
+        }
+        case 'j': {
+            int depth = precision;
+            if (depth < 1)
+                depth = JANET_RECURSION_GUARD;
+            janet_jdn_(b, depth, argv[arg], startlen);
+            break;
+        }
+        default: {
+            /* also treat cases 'nLlh' */
+            janet_panicf("invalid conversion '%s' to 'format'",
+                         form);
+        }
+    }
+    if (nb >= MAX_ITEM)
+        janet_panicf("format buffer overflow", form);
+    if (nb > 0)
+        janet_buffer_push_bytes(b, (uint8_t *) item, nb);
+}
+
 /* Shared implementation between string/format and
  * buffer/format */
 void janet_buffer_format(
@@ -933,112 +1324,166 @@ void janet_buffer_format(
     const char *strfrmt_end = strfrmt + sfl;
     int32_t arg = argstart;
     int32_t startlen = b->count;
+    janet_buffer_extra(b, (int32_t) sfl);
     while (strfrmt < strfrmt_end) {
-        if (*strfrmt != '%')
-            janet_buffer_push_u8(b, (uint8_t) * strfrmt++);
-        else if (*++strfrmt == '%')
+        if (*strfrmt != '%') {
+            /* Copy literal text up to the next conversion at once */
+            const char *next = memchr(strfrmt, '%', strfrmt_end - strfrmt);
+            if (NULL == next) next = strfrmt_end;
+            janet_buffer_push_bytes(b, (const uint8_t *) strfrmt, (int32_t)(next - strfrmt));
+            strfrmt = next;
+        } else if (*++strfrmt == '%')
             janet_buffer_push_u8(b, (uint8_t) * strfrmt++); /* %% */
         else { /* format item */
-            char form[MAX_FORMAT], item[MAX_ITEM];
+            char form[MAX_FORMAT];
             char width[3], precision[3];
-            int nb = 0; /* number of bytes in added item */
             if (++arg >= argc)
                 janet_panic("not enough values for format");
             strfrmt = scanformat(strfrmt, form, width, precision);
-            switch (*strfrmt++) {
-                case 'c': {
-                    nb = snprintf(item, MAX_ITEM, form, (int)
-                                  janet_getinteger(argv, arg));
-                    break;
-                }
-                case 'd':
-                case 'i':
-                case 'o':
-                case 'x':
-                case 'X': {
-                    int32_t n = janet_getinteger(argv, arg);
-                    nb = snprintf(item, MAX_ITEM, form, n);
-                    break;
-                }
-                case 'a':
-                case 'A':
-                case 'e':
-                case 'E':
-                case 'f':
-                case 'g':
-                case 'G': {
-                    double d = janet_getnumber(argv, arg);
-                    nb = snprintf(item, MAX_ITEM, form, d);
-                    break;
-                }
-                case 's': {
-                    const uint8_t *s = janet_getstring(argv, arg);
-                    int32_t l = janet_string_length(s);
-                    if (form[2] == '\0')
-                        janet_buffer_push_bytes(b, s, l);
-                    else {
-                        if (l != (int32_t) strlen((const char *) s))
-                            janet_panic("string contains zeros");
-                        if (!strchr(form, '.') && l >= 100) {
-                            janet_panic("no precision and string is too long to be formatted");
-                        } else {
-                            nb = snprintf(item, MAX_ITEM, form, s);
-                        }
-                    }
-                    break;
-                }
-                case 'V': {
-                    janet_to_string_b(b, argv[arg]);
-                    break;
-                }
-                case 'v': {
-                    janet_description_b(b, argv[arg]);
-                    break;
-                }
-                case 't':
-                    janet_buffer_push_cstring(b, typestr(argv[arg]));
-                    break;
-                case 'M':
-                case 'm':
-                case 'N':
-                case 'n':
-                case 'Q':
-                case 'q':
-                case 'P':
-                case 'p': { /* janet pretty , precision = depth */
-                    int depth = atoi(precision);
-                    if (depth < 1) depth = JANET_RECURSION_GUARD;
-                    char d = strfrmt[-1];
-                    int has_color = (d == 'P') || (d == 'Q') || (d == 'M') || (d == 'N');
-                    int has_oneline = (d == 'Q') || (d == 'q') || (d == 'N') || (d == 'n');
-                    int has_notrunc = (d == 'M') || (d == 'm') || (d == 'N') || (d == 'n');
-                    int flags = 0;
-                    flags |= has_color ? JANET_PRETTY_COLOR : 0;
-                    flags |= has_oneline ? JANET_PRETTY_ONELINE : 0;
-                    flags |= has_notrunc ? JANET_PRETTY_NOTRUNC : 0;
-                    janet_pretty_(b, depth, flags, argv[arg], startlen);
-                    break;
-                }
-                case 'j': {
-                    int depth = atoi(precision);
-                    if (depth < 1)
-                        depth = JANET_RECURSION_GUARD;
-                    janet_jdn_(b, depth, argv[arg], startlen);
-                    break;
-                }
-                default: {
-                    /* also treat cases 'nLlh' */
-                    janet_panicf("invalid conversion '%s' to 'format'",
-                                 form);
-                }
+            char conv = *strfrmt++;
+            janet_format_one(b, form, conv, atoi(precision), argv, arg, startlen);
+        }
+    }
+}
+
+/* Compiled format strings for string/formatter. The format is parsed once
+ * into a list of literal runs, each followed by a conversion, so repeated
+ * formatting skips scanning and validating the format. */
+
+#define FORMAT_CONVERSIONS "cdioxXaAeEfgGsVvtMmNnQqPpj"
+
+typedef struct {
+    int32_t literal_start; /* Literal text before the conversion */
+    int32_t literal_len;
+    int precision;
+    char conv; /* 0 for the literal text at the end of the format */
+    char form[MAX_FORMAT];
+} JanetFormatItem;
+
+typedef struct {
+    int32_t count;
+    int32_t literal_total;
+    JanetFormatItem items[];
+    /* Literal bytes follow the items */
+} JanetFormatter;
+
+static uint8_t *formatter_literals(JanetFormatter *f) {
+    return (uint8_t *)(f->items + f->count);
+}
+
+static Janet formatter_call(void *p, int32_t argc, Janet *argv) {
+    JanetBuffer *buffer = janet_buffer(0);
+    janet_buffer_format_compiled(buffer, p, -1, argc, argv);
+    return janet_stringv(buffer->data, buffer->count);
+}
+
+const JanetAbstractType janet_formatter_type = {
+    "core/string-formatter",
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    NULL, /* next */
+    formatter_call,
+    JANET_ATEND_CALL
+};
+
+/* Parse a format into f, or only count items and literal bytes if f is NULL */
+static void formatter_parse(const char *c, const char *end, JanetFormatter *f,
+                            int32_t *count, int32_t *literal_total) {
+    uint8_t *literals = f ? formatter_literals(f) : NULL;
+    int32_t nitems = 0, nlit = 0, start = 0;
+    for (;;) {
+        while (c < end) {
+            if (*c != '%') {
+                if (literals) literals[nlit] = (uint8_t) *c;
+                nlit++;
+                c++;
+            } else if (c[1] == '%') {
+                if (literals) literals[nlit] = '%';
+                nlit++;
+                c += 2;
+            } else {
+                break;
             }
-            if (nb >= MAX_ITEM)
-                janet_panicf("format buffer overflow", form);
-            if (nb > 0)
-                janet_buffer_push_bytes(b, (uint8_t *) item, nb);
         }
+        JanetFormatItem *item = f ? f->items + nitems : NULL;
+        nitems++;
+        if (item) {
+            item->literal_start = start;
+            item->literal_len = nlit - start;
+            item->conv = 0;
+        }
+        if (c >= end) break;
+        char form[MAX_FORMAT];
+        char width[3], precision[3];
+        c = scanformat(c + 1, form, width, precision);
+        char conv = *c++;
+        if (conv == '\0' || NULL == strchr(FORMAT_CONVERSIONS, conv))
+            janet_panicf("invalid conversion '%s' to 'format'", form);
+        if (item) {
+            item->conv = conv;
+            item->precision = atoi(precision);
+            memcpy(item->form, form, MAX_FORMAT);
+        }
+        start = nlit;
     }
+    *count = nitems;
+    *literal_total = nlit;
+}
+
+Janet janet_formatter(const uint8_t *format) {
+    const char *start = (const char *) format;
+    const char *end = start + strlen(start);
+    int32_t count, literal_total;
+    formatter_parse(start, end, NULL, &count, &literal_total);
+    size_t size = sizeof(JanetFormatter) + sizeof(JanetFormatItem) * (size_t) count + (size_t) literal_total;
+    JanetFormatter *f = janet_abstract(&janet_formatter_type, size);
+    f->count = count;
+    f->literal_total = literal_total;
+    formatter_parse(start, end, f, &count, &literal_total);
+    return janet_wrap_abstract(f);
 }
 
+void janet_buffer_format_compiled(
+    JanetBuffer *b,
+    void *formatter,
+    int32_t argstart,
+    int32_t argc,
+    Janet *argv) {
+    JanetFormatter *f = formatter;
+    const uint8_t *literals = formatter_literals(f);
+    int32_t arg = argstart;
+    int32_t startlen = b->count;
+    /* Guess some room for each converted value */
+    janet_buffer_extra(b, f->literal_total + 16 * (f->count - 1));
+    for (int32_t i = 0; i < f->count; i++) {
+        const JanetFormatItem *item = f->items + i;
+        if (item->literal_len)
+            janet_buffer_push_bytes(b, literals + item->literal_start, item->literal_len);
+        if (!item->conv) break;
+        if (++arg >= argc)
+            janet_panic("not enough values for format");
+        janet_format_one(b, item->form, item->conv, item->precision, argv, arg, startlen);
+    }
+}
+
+/* Format with the format string or string/formatter at argv[n] */
+void janet_buffer_format_arg(JanetBuffer *b, int32_t n, int32_t argc, Janet *argv) {
+    void *formatter = janet_checkabstract(argv[n], &janet_formatter_type);
+    if (NULL != formatter) {
+        janet_buffer_format_compiled(b, formatter, n, argc, argv);
+    } else {
+        janet_buffer_format(b, (const char *) janet_getstring(argv, n), n, argc, argv);
+    }
+}
+
+#undef FORMAT_CONVERSIONS
+
 #undef HEX
 #undef BUFSIZE
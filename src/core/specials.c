@@ -249,7 +249,7 @@ static JanetTable *handleattr(JanetCompiler *c, int32_t argn, const Janet *argv)
                 janet_table_put(tab, attr, janet_wrap_true());
                 break;
             case JANET_STRING:
-                janet_table_put(tab, janet_ckeywordv("doc"), attr);
+                if (!c->release) janet_table_put(tab, janet_ckeywordv("doc"), attr);
                 break;
             case JANET_STRUCT:
                 janet_table_merge_struct(tab, janet_unwrap_struct(attr));
@@ -301,8 +301,9 @@ static int varleaf(
         JanetArray *ref = janet_array(1);
         janet_array_push(ref, janet_wrap_nil());
         janet_table_put(entry, janet_ckeywordv("ref"), janet_wrap_array(ref));
-        janet_table_put(entry, janet_ckeywordv("source-map"),
-                        janet_wrap_tuple(janetc_make_sourcemap(c)));
+        if (!c->release)
+            janet_table_put(entry, janet_ckeywordv("source-map"),
+                            janet_wrap_tuple(janetc_make_sourcemap(c)));
         janet_table_put(c->env, janet_wrap_symbol(sym), janet_wrap_table(entry));
         refslot = janetc_cslot(janet_wrap_array(ref));
         janetc_emit_ssu(c, JOP_PUT_INDEX, refslot, s, 0, 0);
@@ -329,8 +330,9 @@ static int defleaf(
     JanetTable *tab) {
     if (c->scope->flags & JANET_SCOPE_TOP) {
         JanetTable *entry = janet_table_clone(tab);
-        janet_table_put(entry, janet_ckeywordv("source-map"),
-                        janet_wrap_tuple(janetc_make_sourcemap(c)));
+        if (!c->release)
+            janet_table_put(entry, janet_ckeywordv("source-map"),
+                            janet_wrap_tuple(janetc_make_sourcemap(c)));
         JanetSlot valsym = janetc_cslot(janet_ckeywordv("value"));
         JanetSlot tabslot = janetc_cslot(janet_wrap_table(entry));
 
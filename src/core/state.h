@@ -24,6 +24,7 @@
 #define JANET_STATE_H_defined
 
 #include <stdint.h>
+#include <signal.h>
 
 /* The VM state. Rather than a struct that is passed
  * around, the vm state is global for simplicity. If
@@ -61,11 +62,49 @@ extern JANET_THREAD_LOCAL JanetTable *janet_vm_registry;
  * We need this to look up the constructors when unmarshalling. */
 extern JANET_THREAD_LOCAL JanetTable *janet_vm_abstract_registry;
 
+/* Per-thread pool of released buffers, see buffer/pool */
+extern JANET_THREAD_LOCAL JanetArray *janet_vm_buffer_pool;
+
+/* Keys registered for fiber-local slots, mapped to their slot index */
+extern JANET_THREAD_LOCAL JanetTable *janet_vm_fiber_locals;
+
+#ifdef JANET_INT_TYPES
+/* Shared boxes for small int/s64 and int/u64 values, see janet_wrap_s64 */
+extern JANET_THREAD_LOCAL JanetArray *janet_vm_int_cache;
+#endif
+
+/* Inline caches in the vm remember lookups that went through table
+ * prototypes. Tables they depend on are flagged, and changing a flagged
+ * table invalidates all caches by bumping the epoch. */
+#define JANET_TABLE_FLAG_CACHED 0x20000
+extern JANET_THREAD_LOCAL uint32_t janet_vm_table_epoch;
+#define janet_table_touch(t) do { \
+    if ((t)->gc.flags & JANET_TABLE_FLAG_CACHED) janet_vm_table_epoch++; \
+} while (0)
+
+/* Sampling profiler, see profile/start. The tick is set from a signal
+ * handler, so it is shared by all threads. */
+extern volatile sig_atomic_t janet_vm_profile_tick;
+extern JANET_THREAD_LOCAL JanetTable *janet_vm_profile;
+void janet_profile_sample(JanetFiber *fiber);
+void janet_profile_deinit(void);
+
+/* Call instrumentation, see debug/instrument */
+#ifdef JANET_INSTRUMENT
+extern JANET_THREAD_LOCAL int janet_vm_instrument;
+extern JANET_THREAD_LOCAL size_t janet_vm_instrument_bytes;
+void janet_instrument_enter(JanetFiber *fiber, JanetFunction *func);
+void janet_instrument_exit(JanetFiber *fiber);
+void janet_instrument_suspend(JanetFiber *fiber);
+void janet_instrument_mark(void);
+void janet_instrument_deinit(void);
+#endif
+
 /* Immutable value cache */
 extern JANET_THREAD_LOCAL const uint8_t **janet_vm_cache;
+extern JANET_THREAD_LOCAL uint32_t *janet_vm_cache_hashes;
 extern JANET_THREAD_LOCAL uint32_t janet_vm_cache_capacity;
 extern JANET_THREAD_LOCAL uint32_t janet_vm_cache_count;
-extern JANET_THREAD_LOCAL uint32_t janet_vm_cache_deleted;
 
 /* Garbage collection */
 extern JANET_THREAD_LOCAL void *janet_vm_blocks;
@@ -73,6 +112,35 @@ extern JANET_THREAD_LOCAL size_t janet_vm_gc_interval;
 extern JANET_THREAD_LOCAL size_t janet_vm_next_collection;
 extern JANET_THREAD_LOCAL size_t janet_vm_block_count;
 extern JANET_THREAD_LOCAL int janet_vm_gc_suspend;
+extern JANET_THREAD_LOCAL void *janet_vm_old_blocks;
+extern JANET_THREAD_LOCAL size_t janet_vm_old_block_count;
+extern JANET_THREAD_LOCAL size_t janet_vm_gc_old_limit;
+extern JANET_THREAD_LOCAL size_t janet_vm_gc_minor_count;
+extern JANET_THREAD_LOCAL size_t janet_vm_gc_major_count;
+extern JANET_THREAD_LOCAL JanetGCObject **janet_vm_gc_remembered;
+extern JANET_THREAD_LOCAL size_t janet_vm_gc_remembered_count;
+extern JANET_THREAD_LOCAL size_t janet_vm_gc_remembered_capacity;
+extern JANET_THREAD_LOCAL JanetGCObject **janet_vm_gc_watched;
+extern JANET_THREAD_LOCAL size_t janet_vm_gc_watched_count;
+extern JANET_THREAD_LOCAL size_t janet_vm_gc_watched_capacity;
+extern JANET_THREAD_LOCAL size_t janet_vm_gc_type_counts[];
+extern JANET_THREAD_LOCAL size_t janet_vm_gc_freed;
+extern JANET_THREAD_LOCAL double janet_vm_gc_pause_total;
+extern JANET_THREAD_LOCAL double janet_vm_gc_pause_max;
+extern JANET_THREAD_LOCAL double janet_vm_gc_pause_last;
+#ifdef JANET_EV
+extern JANET_THREAD_LOCAL JanetFunction *janet_vm_gc_hook;
+extern JANET_THREAD_LOCAL JanetFiber *janet_vm_gc_hook_fiber;
+#endif
+extern JANET_THREAD_LOCAL int janet_vm_gc_incremental;
+extern JANET_THREAD_LOCAL uint32_t janet_vm_gc_step_budget;
+extern JANET_THREAD_LOCAL size_t janet_vm_gc_next_step;
+extern JANET_THREAD_LOCAL void *janet_vm_gc_sweep_blocks;
+extern JANET_THREAD_LOCAL uint32_t janet_vm_heap_sample_rate;
+#ifndef JANET_NO_SLAB_ALLOCATOR
+extern JANET_THREAD_LOCAL void *janet_vm_slab_chunks;
+extern JANET_THREAD_LOCAL void *janet_vm_slab_free[];
+#endif
 
 /* GC roots */
 extern JANET_THREAD_LOCAL Janet *janet_vm_roots;
@@ -91,16 +91,31 @@ const uint8_t *janet_cstring(const char *str) {
 
 /* Knuth Morris Pratt Algorithm */
 
+/* Patterns up to this length keep their lookup table in the state */
+#define KMP_SMALL 16
+
 struct kmp_state {
     int32_t i;
     int32_t j;
     int32_t textlen;
     int32_t patlen;
-    int32_t *lookup;
+    const int32_t *lookup;
+    int32_t *owned; /* Lookup table to free in kmp_deinit */
     const uint8_t *text;
     const uint8_t *pat;
+    int32_t small[KMP_SMALL];
 };
 
+static void kmp_table(const uint8_t *pat, int32_t patlen, int32_t *lookup) {
+    int32_t i, j;
+    lookup[0] = 0;
+    for (i = 1, j = 0; i < patlen; i++) {
+        while (j && pat[j] != pat[i]) j = lookup[j - 1];
+        if (pat[j] == pat[i]) j++;
+        lookup[i] = j;
+    }
+}
+
 static void kmp_init(
     struct kmp_state *s,
     const uint8_t *text, int32_t textlen,
@@ -108,10 +123,16 @@ static void kmp_init(
     if (patlen == 0) {
         janet_panic("expected non-empty pattern");
     }
-    int32_t *lookup = janet_calloc(patlen, sizeof(int32_t));
-    if (!lookup) {
-        JANET_OUT_OF_MEMORY;
+    int32_t *lookup = s->small;
+    s->owned = NULL;
+    if (patlen > KMP_SMALL) {
+        lookup = janet_calloc(patlen, sizeof(int32_t));
+        if (!lookup) {
+            JANET_OUT_OF_MEMORY;
+        }
+        s->owned = lookup;
     }
+    kmp_table(pat, patlen, lookup);
     s->lookup = lookup;
     s->i = 0;
     s->j = 0;
@@ -119,19 +140,10 @@ static void kmp_init(
     s->pat = pat;
     s->textlen = textlen;
     s->patlen = patlen;
-    /* Init state machine */
-    {
-        int32_t i, j;
-        for (i = 1, j = 0; i < patlen; i++) {
-            while (j && pat[j] != pat[i]) j = lookup[j - 1];
-            if (pat[j] == pat[i]) j++;
-            lookup[i] = j;
-        }
-    }
 }
 
 static void kmp_deinit(struct kmp_state *state) {
-    janet_free(state->lookup);
+    janet_free(state->owned);
 }
 
 static void kmp_seti(struct kmp_state *state, int32_t i) {
@@ -146,8 +158,14 @@ static int32_t kmp_next(struct kmp_state *state) {
     int32_t patlen = state->patlen;
     const uint8_t *text = state->text;
     const uint8_t *pat = state->pat;
-    int32_t *lookup = state->lookup;
+    const int32_t *lookup = state->lookup;
     while (i < textlen) {
+        /* Outside of a partial match, skip to the next first byte */
+        if (j == 0) {
+            const uint8_t *hit = memchr(text + i, pat[0], (size_t)(textlen - i));
+            if (NULL == hit) break;
+            i = (int32_t)(hit - text);
+        }
         if (text[i] == pat[j]) {
             if (j == patlen - 1) {
                 state->i = i + 1;
@@ -168,6 +186,41 @@ static int32_t kmp_next(struct kmp_state *state) {
     return -1;
 }
 
+/* A pattern with a precomputed lookup table, for repeated searches */
+typedef struct {
+    int32_t patlen;
+    int32_t lookup[];
+    /* Pattern bytes follow the lookup table */
+} JanetSearcher;
+
+static const uint8_t *searcher_pattern(const JanetSearcher *searcher) {
+    return (const uint8_t *)(searcher->lookup + searcher->patlen);
+}
+
+static const JanetAbstractType janet_searcher_type = {
+    "core/string-searcher",
+    JANET_ATEND_NAME
+};
+
+/* Init a search for a pattern given as bytes or a searcher */
+static void kmp_init_pattern(struct kmp_state *s, Janet *argv, int32_t n,
+                             const uint8_t *text, int32_t textlen) {
+    JanetSearcher *searcher = janet_checkabstract(argv[n], &janet_searcher_type);
+    if (NULL == searcher) {
+        JanetByteView pat = janet_getbytes(argv, n);
+        kmp_init(s, text, textlen, pat.bytes, pat.len);
+        return;
+    }
+    s->lookup = searcher->lookup;
+    s->owned = NULL;
+    s->i = 0;
+    s->j = 0;
+    s->text = text;
+    s->pat = searcher_pattern(searcher);
+    s->textlen = textlen;
+    s->patlen = searcher->patlen;
+}
+
 /* CFuns */
 
 static Janet cfun_string_slice(int32_t argc, Janet *argv) {
@@ -268,14 +321,13 @@ static Janet cfun_string_reverse(int32_t argc, Janet *argv) {
 
 static void findsetup(int32_t argc, Janet *argv, struct kmp_state *s, int32_t extra) {
     janet_arity(argc, 2, 3 + extra);
-    JanetByteView pat = janet_getbytes(argv, 0);
     JanetByteView text = janet_getbytes(argv, 1);
     int32_t start = 0;
     if (argc >= 3) {
         start = janet_getinteger(argv, 2);
         if (start < 0) janet_panic("expected non-negative start index");
     }
-    kmp_init(s, text.bytes, text.len, pat.bytes, pat.len);
+    kmp_init_pattern(s, argv, 0, text.bytes, text.len);
     s->i = start;
 }
 
@@ -330,7 +382,6 @@ struct replace_state {
 
 static void replacesetup(int32_t argc, Janet *argv, struct replace_state *s) {
     janet_arity(argc, 3, 4);
-    JanetByteView pat = janet_getbytes(argv, 0);
     JanetByteView subst = janet_getbytes(argv, 1);
     JanetByteView text = janet_getbytes(argv, 2);
     int32_t start = 0;
@@ -338,7 +389,7 @@ static void replacesetup(int32_t argc, Janet *argv, struct replace_state *s) {
         start = janet_getinteger(argv, 3);
         if (start < 0) janet_panic("expected non-negative start index");
     }
-    kmp_init(&s->kmp, text.bytes, text.len, pat.bytes, pat.len);
+    kmp_init_pattern(&s->kmp, argv, 0, text.bytes, text.len);
     s->kmp.i = start;
     s->subst = subst.bytes;
     s->substlen = subst.len;
@@ -406,6 +457,18 @@ static Janet cfun_string_split(int32_t argc, Janet *argv) {
     return janet_wrap_array(array);
 }
 
+static Janet cfun_string_searcher(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetByteView pat = janet_getbytes(argv, 0);
+    if (pat.len == 0) janet_panic("expected non-empty pattern");
+    size_t size = sizeof(JanetSearcher) + sizeof(int32_t) * (size_t) pat.len + (size_t) pat.len;
+    JanetSearcher *searcher = janet_abstract(&janet_searcher_type, size);
+    searcher->patlen = pat.len;
+    kmp_table(pat.bytes, pat.len, searcher->lookup);
+    safe_memcpy(searcher->lookup + pat.len, pat.bytes, pat.len);
+    return janet_wrap_abstract(searcher);
+}
+
 static Janet cfun_string_checkset(int32_t argc, Janet *argv) {
     uint32_t bitset[8] = {0, 0, 0, 0, 0, 0, 0, 0};
     janet_fixarity(argc, 2);
@@ -471,11 +534,15 @@ static Janet cfun_string_join(int32_t argc, Janet *argv) {
 static Janet cfun_string_format(int32_t argc, Janet *argv) {
     janet_arity(argc, 1, -1);
     JanetBuffer *buffer = janet_buffer(0);
-    const char *strfrmt = (const char *) janet_getstring(argv, 0);
-    janet_buffer_format(buffer, strfrmt, 0, argc, argv);
+    janet_buffer_format_arg(buffer, 0, argc, argv);
     return janet_stringv(buffer->data, buffer->count);
 }
 
+static Janet cfun_string_formatter(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    return janet_formatter(janet_getstring(argv, 0));
+}
+
 static int trim_help_checkset(JanetByteView set, uint8_t x) {
     for (int32_t j = 0; j < set.len; j++)
         if (set.bytes[j] == x)
@@ -634,6 +701,14 @@ static const JanetReg string_cfuns[] = {
              "for delim at the index start (if provided), and return up to a maximum "
              "of limit results (if provided).")
     },
+    {
+        "string/searcher", cfun_string_searcher,
+        JDOC("(string/searcher patt)\n\n"
+             "Prepare the pattern patt for repeated searches. The returned searcher can be "
+             "used in place of the pattern in string/find, string/find-all, string/replace, "
+             "string/replace-all and string/split, and skips the setup of the pattern on "
+             "each call.")
+    },
     {
         "string/check-set", cfun_string_checkset,
         JDOC("(string/check-set set str)\n\n"
@@ -651,7 +726,15 @@ static const JanetReg string_cfuns[] = {
         "string/format", cfun_string_format,
         JDOC("(string/format format & values)\n\n"
              "Similar to snprintf, but specialized for operating with Janet values. Returns "
-             "a new string.")
+             "a new string. The format may also be a formatter from string/formatter.")
+    },
+    {
+        "string/formatter", cfun_string_formatter,
+        JDOC("(string/formatter format)\n\n"
+             "Parse a format string once for repeated formatting. The returned formatter "
+             "can be called like a function with the values to format, returning a new "
+             "string, and can be used in place of the format in string/format, "
+             "buffer/format and the printf family of functions.")
     },
     {
         "string/trim", cfun_string_trim,
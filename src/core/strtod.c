@@ -245,6 +245,83 @@ static double convert(
            : bignat_extract(mant, exponent2);
 }
 
+/* Powers of ten that are exact as doubles */
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Fast path for plain decimal numbers like 12, -0.25 or 6.02e23 (Clinger's
+ * algorithm). When the significant digits fit in 53 bits and the power of
+ * ten is exact as a double, a single multiply or divide gives the correctly
+ * rounded result. Returns 0 and leaves *out alone for anything else, which
+ * then goes through the exact path below. */
+static int scan_decimal_fast(const uint8_t *str, const uint8_t *end, double *out) {
+    int neg = 0;
+    uint64_t mant = 0;
+    int ndigits = 0;
+    int seenadigit = 0;
+    int32_t ex = 0;
+    if (str < end && (*str == '-' || *str == '+')) {
+        neg = *str == '-';
+        str++;
+    }
+    while (str < end && *str >= '0' && *str <= '9') {
+        if (mant || *str != '0') {
+            if (++ndigits > 19) return 0;
+            mant = mant * 10 + (*str - '0');
+        }
+        seenadigit = 1;
+        str++;
+    }
+    if (str < end && *str == '.') {
+        str++;
+        while (str < end && *str >= '0' && *str <= '9') {
+            if (mant || *str != '0') {
+                if (++ndigits > 19) return 0;
+                mant = mant * 10 + (*str - '0');
+            }
+            seenadigit = 1;
+            ex--;
+            str++;
+        }
+    }
+    if (!seenadigit) return 0;
+    if (str < end && (*str == 'e' || *str == 'E')) {
+        int eneg = 0;
+        int32_t ee = 0;
+        str++;
+        if (str < end && (*str == '-' || *str == '+')) {
+            eneg = *str == '-';
+            str++;
+        }
+        if (str >= end) return 0;
+        while (str < end && *str >= '0' && *str <= '9') {
+            if (ee > 9999) return 0;
+            ee = ee * 10 + (*str - '0');
+            str++;
+        }
+        ex += eneg ? -ee : ee;
+    }
+    if (str != end) return 0;
+    if (mant > (1ULL << 53)) return 0;
+    double x = (double) mant;
+    if (mant == 0) {
+        /* Zero whatever the exponent */
+    } else if (ex < 0) {
+        if (ex < -22) return 0;
+        x /= exact_pow10[-ex];
+    } else if (ex > 22) {
+        /* Move extra powers of ten into the mantissa if it stays exact */
+        if (ex > 22 + 15 || x * exact_pow10[ex - 22] > 9007199254740992.0) return 0;
+        x = (x * exact_pow10[ex - 22]) * 1e22;
+    } else {
+        x *= exact_pow10[ex];
+    }
+    *out = neg ? -x : x;
+    return 1;
+}
+
 /* Scan a real (double) from a string. If the string cannot be converted into
  * and integer, set *err to 1 and return 0. */
 int janet_scan_number(
@@ -259,6 +336,7 @@ int janet_scan_number(
     int foundexp = 0;
     int neg = 0;
     struct BigNat mant;
+    if (len < 40 && scan_decimal_fast(str, end, out)) return 0;
     bignat_zero(&mant);
 
     /* Prevent some kinds of overflow bugs relating to the exponent
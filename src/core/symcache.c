@@ -23,7 +23,14 @@
 /* The symbol cache is an open hashtable with all active symbols in the program
  * stored in it. As the primary use of symbols is table lookups and equality
  * checks, all symbols are interned so that there is a single copy of it in the
- * whole program. Equality is then just a pointer check. */
+ * whole program. Equality is then just a pointer check.
+ *
+ * The table uses Robin Hood hashing. Each symbol sits at most as far from its
+ * home slot as any symbol it passed while being inserted, so lookups can stop
+ * as soon as they see a symbol closer to its home than the probe. Deletion
+ * shifts the following symbols back instead of leaving tombstones, which keeps
+ * probes short when many keywords are interned and collected. The hash of each
+ * slot is kept in a separate array so probing does not touch the strings. */
 
 #ifndef JANET_AMALG
 #include "features.h"
@@ -38,154 +45,178 @@
 
 /* Cache state */
 JANET_THREAD_LOCAL const uint8_t **janet_vm_cache = NULL;
+JANET_THREAD_LOCAL uint32_t *janet_vm_cache_hashes = NULL;
 JANET_THREAD_LOCAL uint32_t janet_vm_cache_capacity = 0;
 JANET_THREAD_LOCAL uint32_t janet_vm_cache_count = 0;
-JANET_THREAD_LOCAL uint32_t janet_vm_cache_deleted = 0;
 
-/* Initialize the cache (allocate cache memory) */
-void janet_symcache_init() {
-    janet_vm_cache_capacity = 1024;
-    janet_vm_cache = janet_calloc(1, (size_t) janet_vm_cache_capacity * sizeof(const uint8_t *));
+/* Allocate the slots and hashes of a cache with a power of 2 capacity */
+static void janet_cache_alloc(uint32_t capacity) {
+    size_t size = (size_t) capacity * (sizeof(const uint8_t *) + sizeof(uint32_t));
+    janet_vm_cache = janet_calloc(1, size);
     if (NULL == janet_vm_cache) {
         JANET_OUT_OF_MEMORY;
     }
+    janet_vm_cache_hashes = (uint32_t *)(janet_vm_cache + capacity);
+    janet_vm_cache_capacity = capacity;
+}
+
+/* Initialize the cache (allocate cache memory) */
+void janet_symcache_init() {
+    janet_cache_alloc(1024);
     janet_vm_cache_count = 0;
-    janet_vm_cache_deleted = 0;
 }
 
 /* Deinitialize the cache (free the cache memory) */
 void janet_symcache_deinit() {
     janet_free((void *)janet_vm_cache);
     janet_vm_cache = NULL;
+    janet_vm_cache_hashes = NULL;
     janet_vm_cache_capacity = 0;
     janet_vm_cache_count = 0;
-    janet_vm_cache_deleted = 0;
 }
 
-/* Mark an entry in the table as deleted. */
-static const uint8_t JANET_SYMCACHE_DELETED[1] = {0};
+/* Distance of the symbol in slot i from its home slot */
+static uint32_t janet_cache_distance(uint32_t i) {
+    return (i - janet_vm_cache_hashes[i]) & (janet_vm_cache_capacity - 1);
+}
 
-/* Find an item in the cache and return its location.
- * If the item is not found, return the location
- * where one would put it. */
-static const uint8_t **janet_symcache_findmem(
+/* Find the slot of a symbol in the cache, or return -1. */
+static int64_t janet_symcache_findmem(
     const uint8_t *str,
     int32_t len,
-    int32_t hash,
-    int *success) {
-    uint32_t bounds[4];
-    uint32_t i, j, index;
-    const uint8_t **firstEmpty = NULL;
-
-    /* We will search two ranges - index to the end,
-     * and 0 to the index. */
-    index = (uint32_t)hash & (janet_vm_cache_capacity - 1);
-    bounds[0] = index;
-    bounds[1] = janet_vm_cache_capacity;
-    bounds[2] = 0;
-    bounds[3] = index;
-    for (j = 0; j < 4; j += 2)
-        for (i = bounds[j]; i < bounds[j + 1]; ++i) {
-            const uint8_t *test = janet_vm_cache[i];
-            /* Check empty spots */
-            if (NULL == test) {
-                if (NULL == firstEmpty)
-                    firstEmpty = janet_vm_cache + i;
-                goto notfound;
-            }
-            /* Check for marked deleted */
-            if (JANET_SYMCACHE_DELETED == test) {
-                if (firstEmpty == NULL)
-                    firstEmpty = janet_vm_cache + i;
-                continue;
-            }
-            if (janet_string_equalconst(test, str, len, hash)) {
-                /* Replace first deleted */
-                *success = 1;
-                if (firstEmpty != NULL) {
-                    *firstEmpty = test;
-                    janet_vm_cache[i] = JANET_SYMCACHE_DELETED;
-                    return firstEmpty;
-                }
-                return janet_vm_cache + i;
-            }
-        }
-notfound:
-    *success = 0;
-    return firstEmpty;
+    int32_t hash) {
+    uint32_t mask = janet_vm_cache_capacity - 1;
+    uint32_t i = (uint32_t) hash & mask;
+    for (uint32_t dist = 0;; dist++, i = (i + 1) & mask) {
+        const uint8_t *test = janet_vm_cache[i];
+        if (NULL == test || janet_cache_distance(i) < dist) return -1;
+        if (janet_vm_cache_hashes[i] == (uint32_t) hash &&
+                janet_string_equalconst(test, str, len, hash))
+            return i;
+    }
 }
 
-#define janet_symcache_find(str, success) \
-    janet_symcache_findmem((str), janet_string_length(str), janet_string_hash(str), (success))
+/* Insert a symbol that is not in the cache, without resizing */
+static void janet_cache_insert(const uint8_t *x, uint32_t hash) {
+    uint32_t mask = janet_vm_cache_capacity - 1;
+    uint32_t i = hash & mask;
+    for (uint32_t dist = 0;; dist++, i = (i + 1) & mask) {
+        if (NULL == janet_vm_cache[i]) {
+            janet_vm_cache[i] = x;
+            janet_vm_cache_hashes[i] = hash;
+            return;
+        }
+        /* Take the place of symbols closer to their home slot */
+        uint32_t other = janet_cache_distance(i);
+        if (other < dist) {
+            const uint8_t *tmp = janet_vm_cache[i];
+            uint32_t tmphash = janet_vm_cache_hashes[i];
+            janet_vm_cache[i] = x;
+            janet_vm_cache_hashes[i] = hash;
+            x = tmp;
+            hash = tmphash;
+            dist = other;
+        }
+    }
+}
 
 /* Resize the cache. */
 static void janet_cache_resize(uint32_t newCapacity) {
-    uint32_t i, oldCapacity;
     const uint8_t **oldCache = janet_vm_cache;
-    const uint8_t **newCache = janet_calloc(1, (size_t) newCapacity * sizeof(const uint8_t *));
-    if (newCache == NULL) {
-        JANET_OUT_OF_MEMORY;
-    }
-    oldCapacity = janet_vm_cache_capacity;
-    janet_vm_cache = newCache;
-    janet_vm_cache_capacity = newCapacity;
-    janet_vm_cache_deleted = 0;
+    uint32_t *oldHashes = janet_vm_cache_hashes;
+    uint32_t oldCapacity = janet_vm_cache_capacity;
+    janet_cache_alloc(newCapacity);
     /* Add all of the old cache entries back */
-    for (i = 0; i < oldCapacity; ++i) {
-        int status;
-        const uint8_t **bucket;
-        const uint8_t *x = oldCache[i];
-        if (x != NULL && x != JANET_SYMCACHE_DELETED) {
-            bucket = janet_symcache_find(x, &status);
-            if (status || bucket == NULL) {
-                /* there was a problem with the algorithm. */
-                break;
-            }
-            *bucket = x;
-        }
+    for (uint32_t i = 0; i < oldCapacity; ++i) {
+        if (oldCache[i] != NULL) janet_cache_insert(oldCache[i], oldHashes[i]);
     }
     /* Free the old cache */
     janet_free((void *)oldCache);
 }
 
-/* Add an item to the cache */
-static void janet_symcache_put(const uint8_t *x, const uint8_t **bucket) {
-    if ((janet_vm_cache_count + janet_vm_cache_deleted) * 2 > janet_vm_cache_capacity) {
-        int status;
-        janet_cache_resize(janet_tablen((2 * janet_vm_cache_count + 1)));
-        bucket = janet_symcache_find(x, &status);
+/* Add an item to the cache. Robin Hood tables stay fast up to a high load. */
+static void janet_symcache_put(const uint8_t *x, int32_t hash) {
+    if ((uint64_t)(janet_vm_cache_count + 1) * 8 > (uint64_t) janet_vm_cache_capacity * 7) {
+        janet_cache_resize(janet_vm_cache_capacity * 2);
     }
-    /* Add x to the cache */
     janet_vm_cache_count++;
-    *bucket = x;
+    janet_cache_insert(x, (uint32_t) hash);
+}
+
+/* Remove the symbol in slot i, and shift back the symbols after it
+ * that are not in their home slot. */
+static void janet_cache_remove(uint32_t i) {
+    uint32_t mask = janet_vm_cache_capacity - 1;
+    uint32_t next = (i + 1) & mask;
+    while (NULL != janet_vm_cache[next] && janet_cache_distance(next) > 0) {
+        janet_vm_cache[i] = janet_vm_cache[next];
+        janet_vm_cache_hashes[i] = janet_vm_cache_hashes[next];
+        i = next;
+        next = (next + 1) & mask;
+    }
+    janet_vm_cache[i] = NULL;
+    janet_vm_cache_count--;
 }
 
 /* Remove a symbol from the symcache */
 void janet_symbol_deinit(const uint8_t *sym) {
-    int status = 0;
-    const uint8_t **bucket = janet_symcache_find(sym, &status);
-    if (status) {
-        janet_vm_cache_count--;
-        janet_vm_cache_deleted++;
-        *bucket = JANET_SYMCACHE_DELETED;
+    uint32_t mask = janet_vm_cache_capacity - 1;
+    uint32_t hash = (uint32_t) janet_string_hash(sym);
+    uint32_t i = hash & mask;
+    for (uint32_t dist = 0;; dist++, i = (i + 1) & mask) {
+        const uint8_t *test = janet_vm_cache[i];
+        if (NULL == test || janet_cache_distance(i) < dist) return;
+        if (test == sym) {
+            janet_cache_remove(i);
+            return;
+        }
+    }
+}
+
+/* Remove symbols that were not marked by the garbage collector. Used when
+ * unreachable symbols are swept some time after marking. */
+void janet_symcache_prune(void) {
+    uint32_t i = 0;
+    while (i < janet_vm_cache_capacity) {
+        const uint8_t *sym = janet_vm_cache[i];
+        if (NULL != sym && !janet_gc_reachable(janet_string_head(sym))) {
+            /* Check the symbol shifted into this slot next */
+            janet_cache_remove(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+/* Get statistics about the cache */
+void janet_symcache_stats(JanetSymcacheStats *stats) {
+    uint64_t total = 0;
+    stats->count = janet_vm_cache_count;
+    stats->capacity = janet_vm_cache_capacity;
+    stats->max_probe = 0;
+    for (uint32_t i = 0; i < janet_vm_cache_capacity; i++) {
+        if (NULL == janet_vm_cache[i]) continue;
+        uint32_t probe = janet_cache_distance(i) + 1;
+        total += probe;
+        if (probe > stats->max_probe) stats->max_probe = probe;
     }
+    stats->mean_probe = janet_vm_cache_count ? (double) total / janet_vm_cache_count : 0.0;
 }
 
 /* Create a symbol from a byte string */
 const uint8_t *janet_symbol(const uint8_t *str, int32_t len) {
     int32_t hash = janet_string_calchash(str, len);
     uint8_t *newstr;
-    int success = 0;
-    const uint8_t **bucket = janet_symcache_findmem(str, len, hash, &success);
-    if (success)
-        return *bucket;
+    int64_t found = janet_symcache_findmem(str, len, hash);
+    if (found >= 0)
+        return janet_vm_cache[found];
     JanetStringHead *head = janet_gcalloc(JANET_MEMORY_SYMBOL, sizeof(JanetStringHead) + (size_t) len + 1);
     head->hash = hash;
     head->length = len;
     newstr = (uint8_t *)(head->data);
     safe_memcpy(newstr, str, len);
     newstr[len] = 0;
-    janet_symcache_put((const uint8_t *)newstr, bucket);
+    janet_symcache_put((const uint8_t *)newstr, hash);
     return newstr;
 }
 
@@ -219,27 +250,25 @@ static void inc_gensym(void) {
  * symbol will be of the format _XXXXXX, where X is a base64 digit, and
  * prefix is the argument passed. No prefix for speed. */
 const uint8_t *janet_symbol_gen(void) {
-    const uint8_t **bucket = NULL;
     uint8_t *sym;
     int32_t hash = 0;
-    int status;
+    int64_t found;
     /* Leave spaces for 6 base 64 digits and two dashes. That means 64^6 possible suffixes, which
      * is enough for resolving collisions. */
     do {
         hash = janet_string_calchash(
                    gensym_counter,
                    sizeof(gensym_counter) - 1);
-        bucket = janet_symcache_findmem(
-                     gensym_counter,
-                     sizeof(gensym_counter) - 1,
-                     hash,
-                     &status);
-    } while (status && (inc_gensym(), 1));
+        found = janet_symcache_findmem(
+                    gensym_counter,
+                    sizeof(gensym_counter) - 1,
+                    hash);
+    } while (found >= 0 && (inc_gensym(), 1));
     JanetStringHead *head = janet_gcalloc(JANET_MEMORY_SYMBOL, sizeof(JanetStringHead) + sizeof(gensym_counter));
     head->length = sizeof(gensym_counter) - 1;
     head->hash = hash;
     sym = (uint8_t *)(head->data);
     memcpy(sym, gensym_counter, sizeof(gensym_counter));
-    janet_symcache_put((const uint8_t *)sym, bucket);
+    janet_symcache_put((const uint8_t *)sym, hash);
     return (const uint8_t *)sym;
 }
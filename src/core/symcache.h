@@ -32,5 +32,15 @@
 void janet_symcache_init(void);
 void janet_symcache_deinit(void);
 void janet_symbol_deinit(const uint8_t *sym);
+void janet_symcache_prune(void);
+
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t max_probe; /* Slots looked at to find a symbol */
+    double mean_probe;
+} JanetSymcacheStats;
+
+void janet_symcache_stats(JanetSymcacheStats *stats);
 
 #endif
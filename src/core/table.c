@@ -24,38 +24,93 @@
 #include "features.h"
 #include <janet.h>
 #include "gc.h"
+#include "state.h"
 #include "util.h"
 #include <math.h>
 #endif
 
 #define JANET_TABLE_FLAG_STACK 0x10000
 
-static void *janet_memalloc_empty_local(int32_t count) {
-    int32_t i;
-    void *mem = janet_smalloc((size_t) count * sizeof(JanetKV));
-    JanetKV *mmem = (JanetKV *)mem;
-    for (i = 0; i < count; i++) {
-        JanetKV *kv = mmem + i;
-        kv->key = janet_wrap_nil();
-        kv->value = janet_wrap_nil();
+/* Besides the key value pairs, each table keeps one control byte per slot
+ * after its data. A full slot stores 7 bits of the key hash, so lookups can
+ * check 8 slots at a time with word sized bit tricks and only compare keys
+ * whose hash fragment matches. The first bytes are mirrored after the last
+ * slot so a group can always be read without wrapping around. */
+#define JANET_TABLE_GROUP 8
+#define JANET_CTRL_EMPTY 0x80
+#define JANET_CTRL_DELETED 0xFE
+#define JANET_GROUP_LSB UINT64_C(0x0101010101010101)
+#define JANET_GROUP_MSB UINT64_C(0x8080808080808080)
+#define janet_table_ctrl(t) ((uint8_t *)((t)->data + (t)->capacity))
+#define janet_table_h2(hash) ((uint8_t)(((uint32_t)(hash) * UINT32_C(0x9E3779B1)) >> 25))
+
+#ifdef __GNUC__
+#define janet_group_first(m) (__builtin_ctzll(m) >> 3)
+#else
+static int janet_group_first(uint64_t m) {
+    int ret = 0;
+    while (!(m & 0x80)) {
+        ret++;
+        m >>= 8;
     }
-    return mem;
+    return ret;
 }
+#endif
 
-static JanetTable *janet_table_init_impl(JanetTable *table, int32_t capacity, int stackalloc) {
+/* Read 8 control bytes, with the first slot in the lowest byte */
+static uint64_t janet_table_group(const uint8_t *ctrl) {
+    uint64_t g;
+    memcpy(&g, ctrl, sizeof(g));
+#ifdef JANET_BIG_ENDIAN
+    g = ((g & UINT64_C(0x00000000FFFFFFFF)) << 32) | ((g >> 32) & UINT64_C(0x00000000FFFFFFFF));
+    g = ((g & UINT64_C(0x0000FFFF0000FFFF)) << 16) | ((g >> 16) & UINT64_C(0x0000FFFF0000FFFF));
+    g = ((g & UINT64_C(0x00FF00FF00FF00FF)) << 8) | ((g >> 8) & UINT64_C(0x00FF00FF00FF00FF));
+#endif
+    return g;
+}
+
+/* High bit set in each byte equal to h2. May have false positives,
+ * which are weeded out by comparing keys. */
+static uint64_t janet_group_match(uint64_t g, uint8_t h2) {
+    uint64_t x = g ^ (JANET_GROUP_LSB * h2);
+    return (x - JANET_GROUP_LSB) & ~x & JANET_GROUP_MSB;
+}
+
+#define janet_group_free(g) ((g) & JANET_GROUP_MSB)
+#define janet_group_empty(g) ((g) & ~((g) << 6) & JANET_GROUP_MSB)
+#define janet_group_full(g) (~(g) & JANET_GROUP_MSB)
+
+/* Set the control byte of a slot and its mirrors */
+static void janet_table_setctrl(JanetTable *t, int32_t i, uint8_t c) {
+    uint8_t *ctrl = janet_table_ctrl(t);
+    ctrl[i] = c;
+    for (int32_t j = i + t->capacity; j < t->capacity + JANET_TABLE_GROUP; j += t->capacity)
+        ctrl[j] = c;
+}
+
+/* Allocate the slots and control bytes of a table */
+static JanetKV *janet_table_alloc(int32_t capacity, int islocal) {
+    size_t size = (size_t) capacity * (sizeof(JanetKV) + 1) + JANET_TABLE_GROUP;
     JanetKV *data;
+    if (islocal) {
+        data = janet_smalloc(size);
+    } else {
+        data = janet_malloc(size);
+        if (NULL == data) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm_next_collection += size;
+    }
+    janet_memempty(data, capacity);
+    memset(data + capacity, JANET_CTRL_EMPTY, (size_t) capacity + JANET_TABLE_GROUP);
+    return data;
+}
+
+static JanetTable *janet_table_init_impl(JanetTable *table, int32_t capacity, int stackalloc) {
     capacity = janet_tablen(capacity);
     if (stackalloc) table->gc.flags = JANET_TABLE_FLAG_STACK;
     if (capacity) {
-        if (stackalloc) {
-            data = janet_memalloc_empty_local(capacity);
-        } else {
-            data = (JanetKV *) janet_memalloc_empty(capacity);
-            if (NULL == data) {
-                JANET_OUT_OF_MEMORY;
-            }
-        }
-        table->data = data;
+        table->data = janet_table_alloc(capacity, stackalloc);
         table->capacity = capacity;
     } else {
         table->data = NULL;
@@ -74,6 +129,7 @@ JanetTable *janet_table_init(JanetTable *table, int32_t capacity) {
 
 /* Deinitialize a table */
 void janet_table_deinit(JanetTable *table) {
+    janet_table_touch(table);
     janet_sfree(table->data);
 }
 
@@ -85,33 +141,65 @@ JanetTable *janet_table(int32_t capacity) {
 
 /* Find the bucket that contains the given key. Will also return
  * bucket where key should go if not in the table. */
+static JanetKV *janet_table_findhash(JanetTable *t, Janet key, int32_t hash) {
+    int32_t cap = t->capacity;
+    if (0 == cap) return NULL;
+    uint8_t h2 = janet_table_h2(hash);
+    const uint8_t *ctrl = janet_table_ctrl(t);
+    uint32_t mask = (uint32_t) cap - 1;
+    uint32_t i = janet_maphash(cap, hash);
+    JanetKV *first_bucket = NULL;
+    for (int32_t probed = 0; probed < cap; probed += JANET_TABLE_GROUP) {
+        uint64_t g = janet_table_group(ctrl + i);
+        for (uint64_t m = janet_group_match(g, h2); m; m &= m - 1) {
+            JanetKV *kv = t->data + ((i + janet_group_first(m)) & mask);
+            if (janet_equals(kv->key, key)) return kv;
+        }
+        if (janet_group_free(g)) {
+            if (NULL == first_bucket)
+                first_bucket = t->data + ((i + janet_group_first(janet_group_free(g))) & mask);
+            if (janet_group_empty(g)) return first_bucket;
+        }
+        i = (i + JANET_TABLE_GROUP) & mask;
+    }
+    return first_bucket;
+}
+
 JanetKV *janet_table_find(JanetTable *t, Janet key) {
-    return (JanetKV *) janet_dict_find(t->data, t->capacity, key);
+    return janet_table_findhash(t, key, janet_hash(key));
+}
+
+/* Get the bucket after kv (or the first bucket if kv is NULL)
+ * that has a key, or NULL if there is none. */
+JanetKV *janet_table_next(JanetTable *t, const JanetKV *kv) {
+    const uint8_t *ctrl = janet_table_ctrl(t);
+    int32_t i = (NULL == kv) ? 0 : (int32_t)(kv - t->data) + 1;
+    for (; i < t->capacity; i += JANET_TABLE_GROUP) {
+        uint64_t full = janet_group_full(janet_table_group(ctrl + i));
+        if (full) {
+            i += janet_group_first(full);
+            return i < t->capacity ? t->data + i : NULL;
+        }
+    }
+    return NULL;
 }
 
 /* Resize the dictionary table. */
 static void janet_table_rehash(JanetTable *t, int32_t size) {
     JanetKV *olddata = t->data;
-    JanetKV *newdata;
     int islocal = t->gc.flags & JANET_TABLE_FLAG_STACK;
-    if (islocal) {
-        newdata = (JanetKV *) janet_memalloc_empty_local(size);
-    } else {
-        newdata = (JanetKV *) janet_memalloc_empty(size);
-        if (NULL == newdata) {
-            JANET_OUT_OF_MEMORY;
-        }
-    }
     int32_t i, oldcapacity;
     oldcapacity = t->capacity;
-    t->data = newdata;
+    t->data = janet_table_alloc(size, islocal);
     t->capacity = size;
     t->deleted = 0;
     for (i = 0; i < oldcapacity; i++) {
         JanetKV *kv = olddata + i;
         if (!janet_checktype(kv->key, JANET_NIL)) {
-            JanetKV *newkv = janet_table_find(t, kv->key);
+            int32_t hash = janet_hash(kv->key);
+            JanetKV *newkv = janet_table_findhash(t, kv->key, hash);
             *newkv = *kv;
+            janet_table_setctrl(t, (int32_t)(newkv - t->data), janet_table_h2(hash));
         }
     }
     if (islocal) {
@@ -121,6 +209,17 @@ static void janet_table_rehash(JanetTable *t, int32_t size) {
     }
 }
 
+/* Make sure a table can hold count entries without growing */
+void janet_table_reserve(JanetTable *t, int32_t count) {
+    if (count <= 0 || 2 * (count + t->deleted) <= t->capacity) return;
+    int32_t size = janet_tablen(2 * count + 2);
+    if (size <= 0) janet_panic("table capacity overflow");
+    if (size > t->capacity || t->deleted) {
+        janet_table_touch(t);
+        janet_table_rehash(t, size);
+    }
+}
+
 /* Get a value out of the table */
 Janet janet_table_get(JanetTable *t, Janet key) {
     JanetKV *bucket = janet_table_find(t, key);
@@ -174,8 +273,10 @@ Janet janet_table_remove(JanetTable *t, Janet key) {
     JanetKV *bucket = janet_table_find(t, key);
     if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL)) {
         Janet ret = bucket->value;
+        janet_table_touch(t);
         t->count--;
         t->deleted++;
+        janet_table_setctrl(t, (int32_t)(bucket - t->data), JANET_CTRL_DELETED);
         bucket->key = janet_wrap_nil();
         bucket->value = janet_wrap_false();
         return ret;
@@ -188,19 +289,23 @@ Janet janet_table_remove(JanetTable *t, Janet key) {
 void janet_table_put(JanetTable *t, Janet key, Janet value) {
     if (janet_checktype(key, JANET_NIL)) return;
     if (janet_checktype(key, JANET_NUMBER) && isnan(janet_unwrap_number(key))) return;
+    janet_gc_barrier(t);
     if (janet_checktype(value, JANET_NIL)) {
         janet_table_remove(t, key);
     } else {
-        JanetKV *bucket = janet_table_find(t, key);
+        janet_table_touch(t);
+        int32_t hash = janet_hash(key);
+        JanetKV *bucket = janet_table_findhash(t, key, hash);
         if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL)) {
             bucket->value = value;
         } else {
             if (NULL == bucket || 2 * (t->count + t->deleted + 1) > t->capacity) {
                 janet_table_rehash(t, janet_tablen(2 * t->count + 2));
+                bucket = janet_table_findhash(t, key, hash);
             }
-            bucket = janet_table_find(t, key);
             if (janet_checktype(bucket->value, JANET_BOOLEAN))
                 --t->deleted;
+            janet_table_setctrl(t, (int32_t)(bucket - t->data), janet_table_h2(hash));
             bucket->key = key;
             bucket->value = value;
             ++t->count;
@@ -212,7 +317,9 @@ void janet_table_put(JanetTable *t, Janet key, Janet value) {
 void janet_table_clear(JanetTable *t) {
     int32_t capacity = t->capacity;
     JanetKV *data = t->data;
+    janet_table_touch(t);
     janet_memempty(data, capacity);
+    if (capacity) memset(data + capacity, JANET_CTRL_EMPTY, (size_t) capacity + JANET_TABLE_GROUP);
     t->count = 0;
     t->deleted = 0;
 }
@@ -237,11 +344,16 @@ JanetTable *janet_table_clone(JanetTable *table) {
     newTable->capacity = table->capacity;
     newTable->deleted = table->deleted;
     newTable->proto = table->proto;
-    newTable->data = janet_malloc(newTable->capacity * sizeof(JanetKV));
-    if (NULL == newTable->data) {
-        JANET_OUT_OF_MEMORY;
+    if (table->capacity) {
+        size_t size = (size_t) table->capacity * (sizeof(JanetKV) + 1) + JANET_TABLE_GROUP;
+        newTable->data = janet_malloc(size);
+        if (NULL == newTable->data) {
+            JANET_OUT_OF_MEMORY;
+        }
+        memcpy(newTable->data, table->data, size);
+    } else {
+        newTable->data = NULL;
     }
-    memcpy(newTable->data, table->data, (size_t) table->capacity * sizeof(JanetKV));
     return newTable;
 }
 
@@ -271,7 +383,18 @@ void janet_table_merge_struct(JanetTable *table, const JanetKV *other) {
 static Janet cfun_table_new(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
     int32_t cap = janet_getinteger(argv, 0);
-    return janet_wrap_table(janet_table(cap));
+    JanetTable *t = janet_table(0);
+    janet_table_reserve(t, cap);
+    return janet_wrap_table(t);
+}
+
+static Janet cfun_table_reserve(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 2);
+    JanetTable *t = janet_gettable(argv, 0);
+    int32_t count = janet_getinteger(argv, 1);
+    if (count < 0) janet_panic("expected non-negative count");
+    janet_table_reserve(t, count);
+    return argv[0];
 }
 
 static Janet cfun_table_getproto(int32_t argc, Janet *argv) {
@@ -289,6 +412,8 @@ static Janet cfun_table_setproto(int32_t argc, Janet *argv) {
     if (!janet_checktype(argv[1], JANET_NIL)) {
         proto = janet_gettable(argv, 1);
     }
+    janet_gc_barrier(table);
+    janet_table_touch(table);
     table->proto = proto;
     return argv[0];
 }
@@ -320,6 +445,13 @@ static const JanetReg table_cfuns[] = {
              "entries going to go in a table on creation, extra memory allocation "
              "can be avoided. Returns the new table.")
     },
+    {
+        "table/reserve", cfun_table_reserve,
+        JDOC("(table/reserve tab count)\n\n"
+             "Make sure the memory backing a table is large enough to hold count "
+             "entries without growing. Does nothing if the table is already big enough. "
+             "Returns the original table tab.")
+    },
     {
         "table/to-struct", cfun_table_tostruct,
         JDOC("(table/to-struct tab)\n\n"
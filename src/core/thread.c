@@ -26,6 +26,7 @@
 #include "gc.h"
 #include "util.h"
 #include "state.h"
+#include "vector.h"
 #endif
 
 #ifdef JANET_THREADS
@@ -39,31 +40,74 @@
 #include <pthread.h>
 #endif
 
-/* typedefed in janet.h */
+/* Atomic operations on 32 bit integers shared between threads */
+#ifdef _MSC_VER
+#define janet_atomic_load(p) ((uint32_t) InterlockedCompareExchange((volatile LONG *)(p), 0, 0))
+#define janet_atomic_store(p, v) InterlockedExchange((volatile LONG *)(p), (LONG)(v))
+#define janet_atomic_add(p, v) InterlockedExchangeAdd((volatile LONG *)(p), (LONG)(v))
+#define janet_atomic_cas(p, e, d) \
+    (InterlockedCompareExchange((volatile LONG *)(p), (LONG)(d), (LONG)(e)) == (LONG)(e))
+#define janet_atomic_fence() MemoryBarrier()
+#else
+#define janet_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define janet_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define janet_atomic_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define janet_atomic_cas(p, e, d) \
+    __atomic_compare_exchange_n((p), &(e), (d), 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+#define janet_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/* A slot in a mailbox. The sequence number says if the slot is free to write
+ * (seq == position) or holds a message to read (seq == position + 1). */
+typedef struct {
+    uint32_t seq;
+    JanetBuffer message;
+} JanetMailboxSlot;
+
+/* typedefed in janet.h. Messages are stored in a bounded lock-free queue
+ * with many senders and one receiver, the thread that owns the mailbox. */
 struct JanetMailbox {
 
-    /* Synchronization */
+    /* Synchronization, only used for reference counting and to
+     * park threads when the mailbox is empty or full. */
 #ifdef JANET_WINDOWS
     CRITICAL_SECTION lock;
     CONDITION_VARIABLE cond;
+    CONDITION_VARIABLE sendcond;
 #else
     pthread_mutex_t lock;
     pthread_cond_t cond;
+    pthread_cond_t sendcond;
 #endif
 
     /* Memory management - reference counting */
     int refCount;
-    int closed;
+    uint32_t closed;
+
+    /* Number of threads parked on cond and sendcond */
+    uint32_t receiverWaiting;
+    uint32_t sendersWaiting;
+
+    /* Capacity is a power of 2 */
+    uint32_t messageMask;
+
+#ifdef JANET_EV
+    /* Set by the receiver when fibers in its event loop wait for a message.
+     * The first sender to clear it posts a wakeup to loopHandle. */
+    uint32_t loopArmed;
+    JanetHandle loopHandle;
+#endif
 
-    /* Store messages */
-    uint16_t messageCapacity;
-    uint16_t messageCount;
-    uint16_t messageFirst;
-    uint16_t messageNext;
+    /* Keep the ends of the queue on separate cache lines */
+    char pad0[64];
+    uint32_t messageNext; /* Claimed by senders */
+    char pad1[64];
+    uint32_t messageFirst; /* Only used by the receiver */
+    char pad2[64];
 
     /* Buffers to store messages. These buffers are manually allocated, so
      * are not owned by any thread's GC. */
-    JanetBuffer messages[];
+    JanetMailboxSlot messages[];
 };
 
 #define JANET_THREAD_HEAVYWEIGHT 0x1
@@ -71,15 +115,49 @@ struct JanetMailbox {
 #define JANET_THREAD_CFUNCTIONS 0x4
 static const char janet_thread_flags[] = "hac";
 
-typedef struct {
+typedef struct JanetMailboxPair JanetMailboxPair;
+struct JanetMailboxPair {
     JanetMailbox *original;
     JanetMailbox *newbox;
     uint64_t flags;
-} JanetMailboxPair;
+    JanetMailboxPair *next; /* Queued for a spare thread */
+};
 
 static JANET_THREAD_LOCAL JanetMailbox *janet_vm_mailbox = NULL;
 static JANET_THREAD_LOCAL JanetThread *janet_vm_thread_current = NULL;
 static JANET_THREAD_LOCAL JanetTable *janet_vm_thread_decode = NULL;
+#ifdef JANET_EV
+static JANET_THREAD_LOCAL JanetAbstract janet_vm_thread_channel = NULL;
+#endif
+
+/* Messages are marshalled into and unmarshalled from this buffer, which is
+ * swapped with the buffer in a mailbox slot. */
+static JANET_THREAD_LOCAL JanetBuffer janet_vm_thread_scratch;
+
+/* Shared values are reference counted blocks of memory outside of any
+ * thread's heap. Each thread wraps a block in a core/shared abstract. */
+typedef enum {
+    JANET_SHARED_STRING,
+    JANET_SHARED_BUFFER,
+    JANET_SHARED_IMAGE
+} JanetSharedKind;
+
+typedef struct {
+    uint32_t refCount;
+    JanetSharedKind kind;
+    int32_t length;
+    uint8_t data[];
+} JanetSharedBlock;
+
+typedef struct {
+    JanetSharedBlock *block;
+    Janet cached;
+} JanetShared;
+
+/* References taken while marshalling a message, so they can be
+ * dropped again if the message is never sent. */
+static JANET_THREAD_LOCAL int janet_vm_thread_sending = 0;
+static JANET_THREAD_LOCAL JanetSharedBlock **janet_vm_thread_shares = NULL;
 
 static JanetTable *janet_thread_get_decode(void) {
     if (janet_vm_thread_decode == NULL) {
@@ -93,25 +171,34 @@ static JanetTable *janet_thread_get_decode(void) {
 }
 
 static JanetMailbox *janet_mailbox_create(int refCount, uint16_t capacity) {
-    JanetMailbox *mailbox = janet_malloc(sizeof(JanetMailbox) + sizeof(JanetBuffer) * (size_t) capacity);
+    uint32_t size = 1;
+    while (size < capacity) size <<= 1;
+    JanetMailbox *mailbox = janet_malloc(sizeof(JanetMailbox) + sizeof(JanetMailboxSlot) * (size_t) size);
     if (NULL == mailbox) {
         JANET_OUT_OF_MEMORY;
     }
 #ifdef JANET_WINDOWS
     InitializeCriticalSection(&mailbox->lock);
     InitializeConditionVariable(&mailbox->cond);
+    InitializeConditionVariable(&mailbox->sendcond);
 #else
     pthread_mutex_init(&mailbox->lock, NULL);
     pthread_cond_init(&mailbox->cond, NULL);
+    pthread_cond_init(&mailbox->sendcond, NULL);
 #endif
     mailbox->refCount = refCount;
     mailbox->closed = 0;
-    mailbox->messageCount = 0;
-    mailbox->messageCapacity = capacity;
+    mailbox->receiverWaiting = 0;
+    mailbox->sendersWaiting = 0;
+    mailbox->messageMask = size - 1;
+#ifdef JANET_EV
+    mailbox->loopArmed = 0;
+#endif
     mailbox->messageFirst = 0;
     mailbox->messageNext = 0;
-    for (uint16_t i = 0; i < capacity; i++) {
-        janet_buffer_init(mailbox->messages + i, 0);
+    for (uint32_t i = 0; i < size; i++) {
+        mailbox->messages[i].seq = i;
+        janet_buffer_init(&mailbox->messages[i].message, 0);
     }
     return mailbox;
 }
@@ -122,9 +209,10 @@ static void janet_mailbox_destroy(JanetMailbox *mailbox) {
 #else
     pthread_mutex_destroy(&mailbox->lock);
     pthread_cond_destroy(&mailbox->cond);
+    pthread_cond_destroy(&mailbox->sendcond);
 #endif
-    for (uint16_t i = 0; i < mailbox->messageCapacity; i++) {
-        janet_buffer_deinit(mailbox->messages + i);
+    for (uint32_t i = 0; i <= mailbox->messageMask; i++) {
+        janet_buffer_deinit(&mailbox->messages[i].message);
     }
     janet_free(mailbox);
 }
@@ -184,15 +272,16 @@ static int thread_mark(void *p, size_t size) {
     return 0;
 }
 
-static JanetMailboxPair *make_mailbox_pair(JanetMailbox *original, uint64_t flags) {
+static JanetMailboxPair *make_mailbox_pair(JanetMailbox *original, uint64_t flags, uint16_t capacity) {
     JanetMailboxPair *pair = janet_malloc(sizeof(JanetMailboxPair));
     if (NULL == pair) {
         JANET_OUT_OF_MEMORY;
     }
     pair->original = original;
     janet_mailbox_ref(original, 1);
-    pair->newbox = janet_mailbox_create(1, 16);
+    pair->newbox = janet_mailbox_create(1, capacity);
     pair->flags = flags;
+    pair->next = NULL;
     return pair;
 }
 
@@ -252,114 +341,243 @@ static void janet_waiter_init(JanetWaiter *waiter, double sec) {
 #endif
 }
 
-static int janet_waiter_wait(JanetWaiter *wait, JanetMailbox *mailbox) {
+static int janet_waiter_wait(JanetWaiter *wait, JanetMailbox *mailbox, int sender) {
     if (wait->nowait) return 1;
 #ifdef JANET_WINDOWS
+    CONDITION_VARIABLE *cond = sender ? &mailbox->sendcond : &mailbox->cond;
     if (wait->timedwait) {
         if (wait->ticksLeft == 0) return 1;
         DWORD startTime = GetTickCount();
-        int status = !SleepConditionVariableCS(&mailbox->cond, &mailbox->lock, wait->ticksLeft);
+        int status = !SleepConditionVariableCS(cond, &mailbox->lock, wait->ticksLeft);
         DWORD dTick = GetTickCount() - startTime;
         /* Be careful about underflow */
-        wait->ticksLeft = dTick > wait->ticksLeft ? 0 : dTick;
+        wait->ticksLeft = dTick > wait->ticksLeft ? 0 : wait->ticksLeft - dTick;
         return status;
     } else {
-        SleepConditionVariableCS(&mailbox->cond, &mailbox->lock, INFINITE);
+        SleepConditionVariableCS(cond, &mailbox->lock, INFINITE);
         return 0;
     }
 #else
+    pthread_cond_t *cond = sender ? &mailbox->sendcond : &mailbox->cond;
     if (wait->timedwait) {
-        return pthread_cond_timedwait(&mailbox->cond, &mailbox->lock, &wait->ts);
+        return pthread_cond_timedwait(cond, &mailbox->lock, &wait->ts);
     } else {
-        pthread_cond_wait(&mailbox->cond, &mailbox->lock);
+        pthread_cond_wait(cond, &mailbox->lock);
         return 0;
     }
 #endif
 }
 
-static void janet_mailbox_wakeup(JanetMailbox *mailbox) {
+static void janet_mailbox_wakeup(JanetMailbox *mailbox, int sender) {
+    janet_mailbox_lock(mailbox);
 #ifdef JANET_WINDOWS
-    WakeConditionVariable(&mailbox->cond);
+    if (sender) {
+        WakeAllConditionVariable(&mailbox->sendcond);
+    } else {
+        WakeConditionVariable(&mailbox->cond);
+    }
 #else
-    pthread_cond_signal(&mailbox->cond);
+    if (sender) {
+        pthread_cond_broadcast(&mailbox->sendcond);
+    } else {
+        pthread_cond_signal(&mailbox->cond);
+    }
 #endif
+    janet_mailbox_unlock(mailbox);
+}
+
+static void janet_shared_block_deref(JanetSharedBlock *block) {
+    if (janet_atomic_add(&block->refCount, -1) == 1) {
+        janet_free(block);
+    }
+}
+
+static void janet_shares_release(void) {
+    janet_vm_thread_sending = 0;
+    for (int32_t i = 0; i < janet_v_count(janet_vm_thread_shares); i++) {
+        janet_shared_block_deref(janet_vm_thread_shares[i]);
+    }
+    janet_v_free(janet_vm_thread_shares);
+    janet_vm_thread_shares = NULL;
 }
 
 static int mailbox_at_capacity(JanetMailbox *mailbox) {
-    return mailbox->messageCount >= mailbox->messageCapacity;
+    uint32_t pos = janet_atomic_load(&mailbox->messageNext);
+    uint32_t seq = janet_atomic_load(&mailbox->messages[pos & mailbox->messageMask].seq);
+    return (int32_t)(seq - pos) < 0;
+}
+
+static int mailbox_has_message(JanetMailbox *mailbox) {
+    uint32_t pos = mailbox->messageFirst;
+    return janet_atomic_load(&mailbox->messages[pos & mailbox->messageMask].seq) == pos + 1;
+}
+
+static void janet_buffer_swap(JanetBuffer *a, JanetBuffer *b) {
+    JanetBuffer tmp = *a;
+    *a = *b;
+    *b = tmp;
 }
 
 /* Returns 1 if could not send (encode error or timeout), 2 for mailbox closed, and
  * 0 otherwise. Will not panic.  */
-int janet_thread_send(JanetThread *thread, Janet msg, double timeout) {
+#ifdef JANET_EV
 
-    /* Ensure mailbox is not closed. */
-    JanetMailbox *mailbox = thread->mailbox;
-    if (NULL == mailbox) return 2;
+static void janet_mailbox_pump(void);
+static void janet_mailbox_event(JanetEVGenericMessage msg);
+
+/* Wake up the event loop of the receiving thread. The lock keeps the
+ * receiver from closing its loop while we post to it. */
+static void janet_mailbox_post(JanetMailbox *mailbox) {
+    uint32_t armed = 1;
     janet_mailbox_lock(mailbox);
-    if (mailbox->closed) {
-        janet_mailbox_ref_with_lock(mailbox, -1);
-        thread->mailbox = NULL;
-        return 2;
+    if (janet_atomic_cas(&mailbox->loopArmed, armed, 0)) {
+        JanetEVGenericMessage msg;
+        memset(&msg, 0, sizeof(msg));
+        janet_ev_post(mailbox->loopHandle, janet_mailbox_event, msg);
     }
+    janet_mailbox_unlock(mailbox);
+}
 
-    /* Back pressure */
-    if (mailbox_at_capacity(mailbox)) {
-        JanetWaiter wait;
-        janet_waiter_init(&wait, timeout);
+/* Called in the receiving thread when a fiber starts waiting on the
+ * mailbox channel. */
+static void janet_mailbox_arm(void) {
+    JanetMailbox *mailbox = janet_vm_mailbox;
+    if (janet_atomic_load(&mailbox->loopArmed)) return;
+    janet_mailbox_lock(mailbox);
+    mailbox->loopHandle = janet_ev_loop_handle();
+    janet_atomic_store(&mailbox->loopArmed, 1);
+    janet_mailbox_unlock(mailbox);
+    /* A message may have been sent before we armed */
+    janet_atomic_fence();
+    if (mailbox_has_message(mailbox)) {
+        janet_mailbox_pump();
+    }
+}
 
-        if (wait.nowait) {
-            janet_mailbox_unlock(mailbox);
-            return 1;
+/* Move messages from the mailbox to fibers waiting on the mailbox channel.
+ * Messages are only taken for live readers so senders still see back pressure. */
+static void janet_mailbox_pump(void) {
+    JanetMailbox *mailbox = janet_vm_mailbox;
+    uint32_t armed = 1;
+    janet_atomic_cas(&mailbox->loopArmed, armed, 0);
+    JanetAbstract channel = janet_vm_thread_channel;
+    if (NULL == channel) return;
+    int32_t readers = janet_ev_channel_readers(channel);
+    while (readers > 0 && mailbox_has_message(mailbox)) {
+        Janet item;
+        if (janet_thread_receive(&item, 0) == 0) {
+            janet_ev_channel_feed(channel, item);
+            readers--;
         }
+    }
+    if (readers > 0) janet_mailbox_arm();
+}
 
-        /* Retry loop, as there can be multiple writers */
-        while (mailbox_at_capacity(mailbox)) {
-            if (janet_waiter_wait(&wait, mailbox)) {
-                janet_mailbox_unlock(mailbox);
-                janet_mailbox_wakeup(mailbox);
-                return 1;
-            }
-        }
+/* Wakeups are not counted by the event loop, so undo the decrement that
+ * follows this callback. */
+static void janet_mailbox_event(JanetEVGenericMessage msg) {
+    (void) msg;
+    janet_ev_inc_refcount();
+    janet_mailbox_pump();
+}
+
+static JanetAbstract janet_thread_channel(void) {
+    if (NULL == janet_vm_thread_channel) {
+        janet_vm_thread_channel = janet_ev_external_channel(janet_mailbox_arm);
+    }
+    return janet_vm_thread_channel;
+}
+
+#endif
+
+int janet_thread_send(JanetThread *thread, Janet msg, double timeout) {
+
+    /* Ensure mailbox is not closed. */
+    JanetMailbox *mailbox = thread->mailbox;
+    if (NULL == mailbox) return 2;
+    if (janet_atomic_load(&mailbox->closed)) {
+        janet_mailbox_ref(mailbox, -1);
+        thread->mailbox = NULL;
+        return 2;
     }
 
     /* Hack to capture all panics from marshalling. This works because
-     * we know janet_marshal won't mess with other essential global state. */
+     * we know janet_marshal won't mess with other essential global state.
+     * Marshal before claiming a slot so a bad message never takes one. */
     jmp_buf buf;
     jmp_buf *old_buf = janet_vm_jmp_buf;
     janet_vm_jmp_buf = &buf;
-    int32_t oldmcount = mailbox->messageCount;
-
-    int ret = 0;
     if (setjmp(buf)) {
-        ret = 1;
-        mailbox->messageCount = oldmcount;
-    } else {
-        JanetBuffer *msgbuf = mailbox->messages + mailbox->messageNext;
-        msgbuf->count = 0;
-
-        /* Start panic zone */
-        janet_marshal(msgbuf, msg, thread->encode, JANET_MARSHAL_UNSAFE);
-        /* End panic zone */
+        janet_vm_jmp_buf = old_buf;
+        janet_shares_release();
+        return 1;
+    }
+    janet_vm_thread_scratch.count = 0;
+    janet_vm_thread_sending = 1;
+    /* Start panic zone */
+    janet_marshal(&janet_vm_thread_scratch, msg, thread->encode, JANET_MARSHAL_UNSAFE);
+    /* End panic zone */
+    janet_vm_thread_sending = 0;
+    janet_vm_jmp_buf = old_buf;
 
-        mailbox->messageNext = (mailbox->messageNext + 1) % mailbox->messageCapacity;
-        mailbox->messageCount++;
+    /* Claim a slot. Retry loop, as there can be multiple writers */
+    JanetWaiter wait;
+    int waiter_ready = 0;
+    JanetMailboxSlot *slot;
+    uint32_t pos;
+    for (;;) {
+        pos = janet_atomic_load(&mailbox->messageNext);
+        slot = mailbox->messages + (pos & mailbox->messageMask);
+        int32_t diff = (int32_t)(janet_atomic_load(&slot->seq) - pos);
+        if (diff == 0) {
+            if (janet_atomic_cas(&mailbox->messageNext, pos, pos + 1)) break;
+        } else if (diff < 0) {
+            /* Back pressure */
+            if (!waiter_ready) {
+                janet_waiter_init(&wait, timeout);
+                waiter_ready = 1;
+            }
+            if (wait.nowait) {
+                janet_shares_release();
+                return 1;
+            }
+            janet_mailbox_lock(mailbox);
+            janet_atomic_add(&mailbox->sendersWaiting, 1);
+            int timedout = mailbox_at_capacity(mailbox) && janet_waiter_wait(&wait, mailbox, 1);
+            janet_atomic_add(&mailbox->sendersWaiting, -1);
+            janet_mailbox_unlock(mailbox);
+            if (timedout) {
+                janet_shares_release();
+                return 1;
+            }
+        }
     }
 
-    /* Cleanup */
-    janet_vm_jmp_buf = old_buf;
-    janet_mailbox_unlock(mailbox);
+    /* The receiver now owns any shared references in the message */
+    janet_v_free(janet_vm_thread_shares);
+    janet_vm_thread_shares = NULL;
+
+    /* Publish the message */
+    janet_buffer_swap(&slot->message, &janet_vm_thread_scratch);
+    janet_atomic_store(&slot->seq, pos + 1);
 
     /* Potentially wake up a blocked thread */
-    janet_mailbox_wakeup(mailbox);
+    janet_atomic_fence();
+    if (janet_atomic_load(&mailbox->receiverWaiting)) {
+        janet_mailbox_wakeup(mailbox, 0);
+    }
+#ifdef JANET_EV
+    if (janet_atomic_load(&mailbox->loopArmed)) {
+        janet_mailbox_post(mailbox);
+    }
+#endif
 
-    return ret;
+    return 0;
 }
 
 /* Returns 0 on successful message. Returns 1 if timedout */
 int janet_thread_receive(Janet *msg_out, double timeout) {
     JanetMailbox *mailbox = janet_vm_mailbox;
-    janet_mailbox_lock(mailbox);
 
     /* For timeouts */
     JanetWaiter wait;
@@ -368,7 +586,20 @@ int janet_thread_receive(Janet *msg_out, double timeout) {
     for (;;) {
 
         /* Check for messages waiting for us */
-        if (mailbox->messageCount > 0) {
+        if (mailbox_has_message(mailbox)) {
+
+            /* Take the message and free the slot */
+            uint32_t pos = mailbox->messageFirst;
+            JanetMailboxSlot *slot = mailbox->messages + (pos & mailbox->messageMask);
+            janet_buffer_swap(&slot->message, &janet_vm_thread_scratch);
+            janet_atomic_store(&slot->seq, pos + mailbox->messageMask + 1);
+            mailbox->messageFirst = pos + 1;
+
+            /* Potentially wake up pending threads */
+            janet_atomic_fence();
+            if (janet_atomic_load(&mailbox->sendersWaiting)) {
+                janet_mailbox_wakeup(mailbox, 1);
+            }
 
             /* Hack to capture all panics from marshalling. This works because
              * we know janet_marshal won't mess with other essential global state. */
@@ -382,39 +613,33 @@ int janet_thread_receive(Janet *msg_out, double timeout) {
                  * Do not ignore bad messages as before. */
                 janet_vm_jmp_buf = old_buf;
                 *msg_out = *janet_vm_return_reg;
-                janet_mailbox_unlock(mailbox);
                 return 2;
             } else {
-                JanetBuffer *msgbuf = mailbox->messages + mailbox->messageFirst;
-                mailbox->messageCount--;
-                mailbox->messageFirst = (mailbox->messageFirst + 1) % mailbox->messageCapacity;
-
                 /* Read from beginning of channel */
                 const uint8_t *nextItem = NULL;
                 Janet item = janet_unmarshal(
-                                 msgbuf->data, msgbuf->count,
+                                 janet_vm_thread_scratch.data, janet_vm_thread_scratch.count,
                                  JANET_MARSHAL_UNSAFE, janet_thread_get_decode(), &nextItem);
                 *msg_out = item;
 
                 /* Cleanup */
                 janet_vm_jmp_buf = old_buf;
-                janet_mailbox_unlock(mailbox);
-
-                /* Potentially wake up pending threads */
-                janet_mailbox_wakeup(mailbox);
-
                 return 0;
             }
         }
 
         if (wait.nowait) {
-            janet_mailbox_unlock(mailbox);
             return 1;
         }
 
         /* Wait for next message */
-        if (janet_waiter_wait(&wait, mailbox)) {
-            janet_mailbox_unlock(mailbox);
+        janet_mailbox_lock(mailbox);
+        janet_atomic_store(&mailbox->receiverWaiting, 1);
+        janet_atomic_fence();
+        int timedout = !mailbox_has_message(mailbox) && janet_waiter_wait(&wait, mailbox, 0);
+        janet_atomic_store(&mailbox->receiverWaiting, 0);
+        janet_mailbox_unlock(mailbox);
+        if (timedout) {
             return 1;
         }
     }
@@ -450,17 +675,116 @@ JanetThread *janet_getthread(const Janet *argv, int32_t n) {
     return (JanetThread *) janet_getabstract(argv, n, &janet_thread_type);
 }
 
-/* Runs in new thread */
-static int thread_worker(JanetMailboxPair *pair) {
-    JanetFiber *fiber = NULL;
-    Janet out;
+/*
+ * Shared values
+ */
 
-    /* Use the mailbox we were given */
-    janet_vm_mailbox = pair->newbox;
-    janet_mailbox_ref(pair->newbox, 1);
+static int shared_gc(void *p, size_t size) {
+    (void) size;
+    JanetShared *shared = (JanetShared *)p;
+    janet_shared_block_deref(shared->block);
+    return 0;
+}
 
-    /* Init VM */
-    janet_init();
+static int shared_mark(void *p, size_t size) {
+    (void) size;
+    JanetShared *shared = (JanetShared *)p;
+    janet_mark(shared->cached);
+    return 0;
+}
+
+/* Only the pointer crosses threads, so this only works with the unsafe
+ * flag, as used for thread messages. Each marshalled copy holds a
+ * reference that is adopted by whoever unmarshals it. */
+static void shared_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetShared *shared = (JanetShared *)p;
+    if (!(ctx->flags & JANET_MARSHAL_UNSAFE)) {
+        janet_panic("cannot marshal shared value without unsafe flag");
+    }
+    janet_marshal_abstract(ctx, p);
+    janet_atomic_add(&shared->block->refCount, 1);
+    if (janet_vm_thread_sending) {
+        janet_v_push(janet_vm_thread_shares, shared->block);
+    }
+    janet_marshal_bytes(ctx, (const uint8_t *) &shared->block, sizeof(JanetSharedBlock *));
+}
+
+static void *shared_unmarshal(JanetMarshalContext *ctx) {
+    if (!(ctx->flags & JANET_MARSHAL_UNSAFE)) {
+        janet_panic("cannot unmarshal shared value without unsafe flag");
+    }
+    JanetSharedBlock *block;
+    janet_unmarshal_bytes(ctx, (uint8_t *) &block, sizeof(JanetSharedBlock *));
+    JanetShared *shared = janet_unmarshal_abstract(ctx, sizeof(JanetShared));
+    shared->block = block;
+    shared->cached = janet_wrap_nil();
+    return shared;
+}
+
+static int shared_compare(void *lhs, void *rhs) {
+    JanetSharedBlock *a = ((JanetShared *)lhs)->block;
+    JanetSharedBlock *b = ((JanetShared *)rhs)->block;
+    return a > b ? 1 : (a < b ? -1 : 0);
+}
+
+static int32_t shared_hash(void *p, size_t size) {
+    (void) size;
+    JanetShared *shared = (JanetShared *)p;
+    return (int32_t)(((uintptr_t) shared->block) >> 4);
+}
+
+static int janet_shared_getter(void *p, Janet key, Janet *out);
+
+const JanetAbstractType janet_shared_type = {
+    "core/shared",
+    shared_gc,
+    shared_mark,
+    janet_shared_getter,
+    NULL, /* put */
+    shared_marshal,
+    shared_unmarshal,
+    NULL, /* tostring */
+    shared_compare,
+    shared_hash,
+    JANET_ATEND_HASH
+};
+
+/* Strings and buffers are shared as raw bytes, so they can be read
+ * in place by any function that takes a byte sequence. */
+int janet_shared_bytes(void *abstract, const uint8_t **data, int32_t *len) {
+    JanetSharedBlock *block = ((JanetShared *)abstract)->block;
+    if (block->kind == JANET_SHARED_IMAGE) return 0;
+    *data = block->data;
+    *len = block->length;
+    return 1;
+}
+
+static Janet janet_unshare(JanetShared *shared) {
+    JanetSharedBlock *block = shared->block;
+    switch (block->kind) {
+        default:
+        case JANET_SHARED_STRING:
+            if (janet_checktype(shared->cached, JANET_NIL)) {
+                shared->cached = janet_stringv(block->data, block->length);
+            }
+            return shared->cached;
+        case JANET_SHARED_BUFFER: {
+            JanetBuffer *buffer = janet_buffer(block->length);
+            janet_buffer_push_bytes(buffer, block->data, block->length);
+            return janet_wrap_buffer(buffer);
+        }
+        case JANET_SHARED_IMAGE:
+            if (janet_checktype(shared->cached, JANET_NIL)) {
+                shared->cached = janet_unmarshal(block->data, block->length, 0, NULL, NULL);
+            }
+            return shared->cached;
+    }
+}
+
+/* Run the thread function in a new thread, once the VM is initialized */
+static int thread_run(JanetMailboxPair *pair) {
+    JanetFiber *fiber = NULL;
+    Janet out;
 
     /* Get dictionaries for default encode/decode */
     JanetTable *encode;
@@ -512,7 +836,7 @@ static int thread_worker(JanetMailboxPair *pair) {
 
     /* Call function */
     Janet argv[1] = { parentv };
-    fiber = janet_fiber(func, 64, 1, argv);
+    fiber = janet_fiber(func, JANET_STACK_INITIAL, 1, argv);
     if (pair->flags & JANET_THREAD_HEAVYWEIGHT) {
         fiber->env = janet_table(0);
         fiber->env->proto = janet_core_env(NULL);
@@ -540,6 +864,112 @@ error:
     return 1;
 }
 
+/* Runs in new thread */
+static int thread_worker(JanetMailboxPair *pair) {
+
+    /* Use the mailbox we were given */
+    janet_vm_mailbox = pair->newbox;
+    janet_mailbox_ref(pair->newbox, 1);
+
+    /* Init VM */
+    janet_init();
+
+    return thread_run(pair);
+}
+
+/*
+ * Spare heavyweight threads. Booting a VM and loading the core environment is
+ * most of the cost of starting a heavyweight thread, so thread/set-spares keeps
+ * some threads booted ahead of time. thread/new with the :h flag hands its
+ * mailbox pair to an idle spare instead of starting a thread, and another
+ * spare starts booting in the background. The bytecode and strings of the core
+ * environment are borrowed from the static core image by every thread, so
+ * spares only hold their own tables and bindings.
+ */
+
+#ifdef JANET_WINDOWS
+static SRWLOCK janet_spare_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE janet_spare_cond = CONDITION_VARIABLE_INIT;
+#else
+static pthread_mutex_t janet_spare_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t janet_spare_cond = PTHREAD_COND_INITIALIZER;
+#endif
+static int32_t janet_spare_target = 0; /* Number of spares to keep */
+static int32_t janet_spare_count = 0; /* Spares booting or idle */
+static int32_t janet_spare_idle = 0; /* Booted spares not yet given a job */
+static int32_t janet_spare_exits = 0; /* Idle spares asked to exit */
+static JanetMailboxPair *janet_spare_jobs = NULL;
+
+static void janet_spare_acquire(void) {
+#ifdef JANET_WINDOWS
+    AcquireSRWLockExclusive(&janet_spare_lock);
+#else
+    pthread_mutex_lock(&janet_spare_lock);
+#endif
+}
+
+static void janet_spare_release(void) {
+#ifdef JANET_WINDOWS
+    ReleaseSRWLockExclusive(&janet_spare_lock);
+#else
+    pthread_mutex_unlock(&janet_spare_lock);
+#endif
+}
+
+/* Assumes you have the spare lock */
+static void janet_spare_wait(void) {
+#ifdef JANET_WINDOWS
+    SleepConditionVariableSRW(&janet_spare_cond, &janet_spare_lock, INFINITE, 0);
+#else
+    pthread_cond_wait(&janet_spare_cond, &janet_spare_lock);
+#endif
+}
+
+static void janet_spare_wakeup(void) {
+#ifdef JANET_WINDOWS
+    WakeAllConditionVariable(&janet_spare_cond);
+#else
+    pthread_cond_broadcast(&janet_spare_cond);
+#endif
+}
+
+/* Runs in a spare thread */
+static int thread_spare(void) {
+    janet_init();
+    janet_core_env(NULL);
+
+    /* Wait for a job, unless there are more spares than needed */
+    janet_spare_acquire();
+    if (janet_spare_count > janet_spare_target) {
+        janet_spare_count--;
+        janet_spare_release();
+        janet_deinit();
+        return 0;
+    }
+    janet_spare_idle++;
+    while (NULL == janet_spare_jobs && 0 == janet_spare_exits) {
+        janet_spare_wait();
+    }
+    JanetMailboxPair *pair = janet_spare_jobs;
+    if (NULL != pair) {
+        janet_spare_jobs = pair->next;
+    } else {
+        janet_spare_exits--;
+    }
+    janet_spare_release();
+    if (NULL == pair) {
+        janet_deinit();
+        return 0;
+    }
+
+    /* Use the mailbox we were given instead of the one made by janet_init */
+    janet_mailbox_ref(janet_vm_mailbox, -1);
+    janet_vm_mailbox = pair->newbox;
+    janet_mailbox_ref(pair->newbox, 1);
+
+    return thread_run(pair);
+}
+
 #ifdef JANET_WINDOWS
 
 static DWORD WINAPI janet_create_thread_wrapper(LPVOID param) {
@@ -555,6 +985,19 @@ static int janet_thread_start_child(JanetMailboxPair *pair) {
     return ret;
 }
 
+static DWORD WINAPI janet_spare_thread_wrapper(LPVOID param) {
+    (void) param;
+    thread_spare();
+    return 0;
+}
+
+static int janet_thread_start_spare(void) {
+    HANDLE handle = CreateThread(NULL, 0, janet_spare_thread_wrapper, NULL, 0, NULL);
+    int ret = NULL == handle;
+    if (!ret) CloseHandle(handle);
+    return ret;
+}
+
 #else
 
 static void *janet_pthread_wrapper(void *param) {
@@ -573,8 +1016,56 @@ static int janet_thread_start_child(JanetMailboxPair *pair) {
     }
 }
 
+static void *janet_spare_pthread_wrapper(void *param) {
+    (void) param;
+    thread_spare();
+    return NULL;
+}
+
+static int janet_thread_start_spare(void) {
+    pthread_t handle;
+    int error = pthread_create(&handle, NULL, janet_spare_pthread_wrapper, NULL);
+    if (error) {
+        return 1;
+    } else {
+        pthread_detach(handle);
+        return 0;
+    }
+}
+
 #endif
 
+/* Start n spares that were already counted in janet_spare_count */
+static void janet_spares_start(int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        if (janet_thread_start_spare()) {
+            janet_spare_acquire();
+            janet_spare_count -= n - i;
+            janet_spare_release();
+            break;
+        }
+    }
+}
+
+/* Give pair to an idle spare, and top up the spares. Returns 0
+ * if there was no idle spare. */
+static int janet_spares_take(JanetMailboxPair *pair) {
+    janet_spare_acquire();
+    int found = janet_spare_idle > 0;
+    if (found) {
+        janet_spare_idle--;
+        janet_spare_count--;
+        pair->next = janet_spare_jobs;
+        janet_spare_jobs = pair;
+        janet_spare_wakeup();
+    }
+    int32_t missing = janet_spare_target - janet_spare_count;
+    if (missing > 0) janet_spare_count += missing;
+    janet_spare_release();
+    if (missing > 0) janet_spares_start(missing);
+    return found;
+}
+
 /*
  * Setup/Teardown
  */
@@ -583,14 +1074,23 @@ void janet_threads_init(void) {
     if (NULL == janet_vm_mailbox) {
         janet_vm_mailbox = janet_mailbox_create(1, 10);
     }
+    janet_buffer_init(&janet_vm_thread_scratch, 0);
     janet_vm_thread_decode = NULL;
     janet_vm_thread_current = NULL;
+#ifdef JANET_EV
+    janet_vm_thread_channel = NULL;
+#endif
 }
 
 void janet_threads_deinit(void) {
     janet_mailbox_lock(janet_vm_mailbox);
-    janet_vm_mailbox->closed = 1;
+    janet_atomic_store(&janet_vm_mailbox->closed, 1);
+#ifdef JANET_EV
+    janet_atomic_store(&janet_vm_mailbox->loopArmed, 0);
+    janet_vm_thread_channel = NULL;
+#endif
     janet_mailbox_ref_with_lock(janet_vm_mailbox, -1);
+    janet_buffer_deinit(&janet_vm_thread_scratch);
     janet_vm_mailbox = NULL;
     janet_vm_thread_current = NULL;
     janet_vm_thread_decode = NULL;
@@ -630,9 +1130,10 @@ static Janet cfun_thread_new(int32_t argc, Janet *argv) {
         encode = NULL;
     }
 
-    JanetMailboxPair *pair = make_mailbox_pair(janet_vm_mailbox, flags);
+    JanetMailboxPair *pair = make_mailbox_pair(janet_vm_mailbox, flags, (uint16_t) cap);
     JanetThread *thread = janet_make_thread(pair->newbox, encode);
-    if (janet_thread_start_child(pair)) {
+    int spare = (flags & JANET_THREAD_HEAVYWEIGHT) && janet_spares_take(pair);
+    if (!spare && janet_thread_start_child(pair)) {
         destroy_mailbox_pair(pair);
         janet_panic("could not start thread");
     }
@@ -657,6 +1158,28 @@ static Janet cfun_thread_new(int32_t argc, Janet *argv) {
     return janet_wrap_abstract(thread);
 }
 
+static Janet cfun_thread_set_spares(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    int32_t n = janet_getnat(argv, 0);
+    janet_spare_acquire();
+    int32_t old = janet_spare_target;
+    janet_spare_target = n;
+    int32_t missing = n - janet_spare_count;
+    if (missing > 0) {
+        janet_spare_count += missing;
+    } else {
+        /* Spares still booting exit on their own once booted */
+        int32_t extra = janet_spare_idle < -missing ? janet_spare_idle : -missing;
+        janet_spare_idle -= extra;
+        janet_spare_count -= extra;
+        janet_spare_exits += extra;
+        janet_spare_wakeup();
+    }
+    janet_spare_release();
+    if (missing > 0) janet_spares_start(missing);
+    return janet_wrap_integer(old);
+}
+
 static Janet cfun_thread_send(int32_t argc, Janet *argv) {
     janet_arity(argc, 2, 3);
     JanetThread *thread = janet_getthread(argv, 0);
@@ -676,6 +1199,17 @@ static Janet cfun_thread_receive(int32_t argc, Janet *argv) {
     janet_arity(argc, 0, 1);
     double wait = janet_optnumber(argv, argc, 0, 1.0);
     Janet out;
+#ifdef JANET_EV
+    /* Wait in the event loop instead of blocking the thread */
+    JanetAbstract channel = janet_thread_channel();
+    if (janet_ev_channel_take(channel, &out)) return out;
+    if (!mailbox_has_message(janet_vm_mailbox) && wait > 0) {
+        if (wait < INFINITY) janet_addtimeout(wait);
+        janet_ev_channel_wait(channel);
+        janet_await();
+    }
+    wait = 0;
+#endif
     int status = janet_thread_receive(&out, wait);
     switch (status) {
         default:
@@ -688,6 +1222,14 @@ static Janet cfun_thread_receive(int32_t argc, Janet *argv) {
     return out;
 }
 
+#ifdef JANET_EV
+static Janet cfun_thread_mailbox(int32_t argc, Janet *argv) {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    return janet_wrap_abstract(janet_thread_channel());
+}
+#endif
+
 static Janet cfun_thread_close(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
     JanetThread *thread = janet_getthread(argv, 0);
@@ -707,6 +1249,76 @@ static Janet cfun_thread_exit(int32_t argc, Janet *argv) {
     return janet_wrap_nil();
 }
 
+static Janet cfun_thread_share(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    Janet x = argv[0];
+    if (janet_checkabstract(x, &janet_shared_type)) return x;
+    JanetSharedKind kind;
+    JanetBuffer *image = NULL;
+    const uint8_t *bytes;
+    int32_t len;
+    if (janet_checktype(x, JANET_STRING)) {
+        kind = JANET_SHARED_STRING;
+        bytes = janet_unwrap_string(x);
+        len = janet_string_length(bytes);
+    } else if (janet_checktype(x, JANET_BUFFER)) {
+        kind = JANET_SHARED_BUFFER;
+        bytes = janet_unwrap_buffer(x)->data;
+        len = janet_unwrap_buffer(x)->count;
+    } else {
+        kind = JANET_SHARED_IMAGE;
+        image = janet_buffer(0);
+        janet_marshal(image, x, NULL, 0);
+        bytes = image->data;
+        len = image->count;
+    }
+    JanetSharedBlock *block = janet_malloc(sizeof(JanetSharedBlock) + len);
+    if (NULL == block) {
+        JANET_OUT_OF_MEMORY;
+    }
+    block->refCount = 1;
+    block->kind = kind;
+    block->length = len;
+    if (len) memcpy(block->data, bytes, len);
+    JanetShared *shared = janet_abstract(&janet_shared_type, sizeof(JanetShared));
+    shared->block = block;
+    shared->cached = kind == JANET_SHARED_STRING ? x : janet_wrap_nil();
+    return janet_wrap_abstract(shared);
+}
+
+static Janet cfun_thread_unshare(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetShared *shared = janet_getabstract(argv, 0, &janet_shared_type);
+    return janet_unshare(shared);
+}
+
+static Janet cfun_shared_length(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetShared *shared = janet_getabstract(argv, 0, &janet_shared_type);
+    if (shared->block->kind == JANET_SHARED_IMAGE) {
+        return janet_lengthv(janet_unshare(shared));
+    }
+    return janet_wrap_integer(shared->block->length);
+}
+
+static const JanetMethod janet_shared_methods[] = {
+    {"length", cfun_shared_length},
+    {NULL, NULL}
+};
+
+static int janet_shared_getter(void *p, Janet key, Janet *out) {
+    JanetShared *shared = (JanetShared *)p;
+    if (janet_checktype(key, JANET_KEYWORD)) {
+        return janet_getmethod(janet_unwrap_keyword(key), janet_shared_methods, out);
+    }
+    if (shared->block->kind == JANET_SHARED_IMAGE) return 0;
+    if (!janet_checkint(key)) return 0;
+    int32_t index = janet_unwrap_integer(key);
+    if (index < 0 || index >= shared->block->length) return 0;
+    *out = janet_wrap_integer(shared->block->data[index]);
+    return 1;
+}
+
 static const JanetMethod janet_thread_methods[] = {
     {"send", cfun_thread_send},
     {"close", cfun_thread_close},
@@ -735,13 +1347,22 @@ static const JanetReg threadlib_cfuns[] = {
         JDOC("(thread/new func &opt capacity flags)\n\n"
              "Start a new thread that will start immediately. "
              "If capacity is provided, that is how many messages can be stored in the thread's mailbox before blocking senders. "
-             "The capacity must be between 1 and 65535 inclusive, and defaults to 10. "
+             "The capacity must be between 1 and 65535 inclusive, is rounded up to a power of 2, and defaults to 10. "
              "Can optionally provide flags to the new thread - supported flags are:\n\n"
              "* :h - Start a heavyweight thread. This loads the core environment by default, so may use more memory initially. Messages may compress better, though.\n\n"
              "* :a - Allow sending over registered abstract types to the new thread\n\n"
              "* :c - Send over cfunction information to the new thread.\n\n"
              "Returns a handle to the new thread.")
     },
+    {
+        "thread/set-spares", cfun_thread_set_spares,
+        JDOC("(thread/set-spares n)\n\n"
+             "Keep n heavyweight threads booted ahead of time, with the core environment loaded. "
+             "`thread/new` with the :h flag runs on an idle spare instead of booting a new thread, "
+             "and a replacement spare boots in the background, so starting heavyweight threads "
+             "costs about as much as starting lightweight ones. Defaults to 0. Returns the "
+             "previous number of spares.")
+    },
     {
         "thread/send", cfun_thread_send,
         JDOC("(thread/send thread msgi &opt timeout)\n\n"
@@ -755,8 +1376,19 @@ static const JanetReg threadlib_cfuns[] = {
              "Get a message sent to this thread. If timeout (in seconds) is provided, an error "
              "will be thrown after the timeout has elapsed but "
              "no messages are received. The default timeout is 1 second, and math/inf cam be passed to "
-             "turn off the timeout.")
+             "turn off the timeout. With the event loop, only the current fiber waits for a message, not "
+             "the whole thread.")
     },
+#ifdef JANET_EV
+    {
+        "thread/mailbox", cfun_thread_mailbox,
+        JDOC("(thread/mailbox)\n\n"
+             "Get a channel that receives the messages sent to the current thread, so they can "
+             "be waited on with ev/take or ev/select alongside other channels. Messages are "
+             "only moved into the channel for fibers waiting on it, which keeps back pressure "
+             "on senders.")
+    },
+#endif
     {
         "thread/close", cfun_thread_close,
         JDOC("(thread/close thread)\n\n"
@@ -769,6 +1401,22 @@ static const JanetReg threadlib_cfuns[] = {
              "Exit from the current thread. If no more threads are running, ends the process, but otherwise does "
              "not end the current process.")
     },
+    {
+        "thread/share", cfun_thread_share,
+        JDOC("(thread/share x)\n\n"
+             "Make an immutable copy of x outside of the garbage collected heap that can be "
+             "sent to other threads without being copied again. Strings and buffers are shared "
+             "as raw bytes and can be passed directly to functions that take byte sequences. "
+             "Other values must be marshallable without a registry, and are unmarshalled "
+             "lazily by thread/unshare. Returns a core/shared value.")
+    },
+    {
+        "thread/unshare", cfun_thread_unshare,
+        JDOC("(thread/unshare shared)\n\n"
+             "Get the value wrapped by a core/shared value as a normal value. Shared buffers "
+             "return a fresh, mutable copy each time. Other values are created once per "
+             "handle and then reused.")
+    },
     {NULL, NULL, NULL}
 };
 
@@ -776,6 +1424,7 @@ static const JanetReg threadlib_cfuns[] = {
 void janet_lib_thread(JanetTable *env) {
     janet_core_cfuns(env, NULL, threadlib_cfuns);
     janet_register_abstract_type(&janet_thread_type);
+    janet_register_abstract_type(&janet_shared_type);
 }
 
 #endif
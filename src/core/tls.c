@@ -0,0 +1,396 @@
+/*
+* Copyright (c) 2021 Calvin Rose and contributors.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "util.h"
+#endif
+
+#ifdef JANET_TLS
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+/* TLS is done with OpenSSL over a pair of memory BIOs, so the engine never
+ * touches a socket itself. Ciphertext is moved to and from the network by
+ * boot.janet with the ordinary ev/read and ev/write state machines, which
+ * keeps TLS working with every event loop backend. */
+
+#define JANET_TLS_SESSION_CACHE 64
+
+typedef struct {
+    char *key;
+    SSL_SESSION *session;
+} JanetTLSSession;
+
+typedef struct {
+    SSL_CTX *ctx;
+    int server;
+    int next_session;
+    JanetTLSSession sessions[JANET_TLS_SESSION_CACHE];
+} JanetTLSContext;
+
+typedef struct {
+    SSL *ssl;
+    BIO *rbio;
+    BIO *wbio;
+    JanetTLSContext *context;
+    char *key;
+} JanetTLS;
+
+static int janet_tls_context_gc(void *p, size_t s) {
+    (void) s;
+    JanetTLSContext *context = (JanetTLSContext *) p;
+    for (int i = 0; i < JANET_TLS_SESSION_CACHE; i++) {
+        janet_free(context->sessions[i].key);
+        if (NULL != context->sessions[i].session) SSL_SESSION_free(context->sessions[i].session);
+    }
+    SSL_CTX_free(context->ctx);
+    return 0;
+}
+
+static int janet_tls_gc(void *p, size_t s) {
+    (void) s;
+    JanetTLS *tls = (JanetTLS *) p;
+    if (NULL != tls->ssl) SSL_free(tls->ssl);
+    janet_free(tls->key);
+    return 0;
+}
+
+static int janet_tls_mark(void *p, size_t s) {
+    (void) s;
+    JanetTLS *tls = (JanetTLS *) p;
+    janet_mark(janet_wrap_abstract(tls->context));
+    return 0;
+}
+
+const JanetAbstractType janet_tls_context_type = {
+    "core/tls-context",
+    janet_tls_context_gc,
+    JANET_ATEND_GC
+};
+
+const JanetAbstractType janet_tls_type = {
+    "core/tls",
+    janet_tls_gc,
+    janet_tls_mark,
+    JANET_ATEND_GCMARK
+};
+
+JANET_NO_RETURN static void janet_tls_panic(const char *what) {
+    char msg[256];
+    unsigned long err = ERR_get_error();
+    ERR_clear_error();
+    if (err) {
+        ERR_error_string_n(err, msg, sizeof(msg));
+        janet_panicf("%s: %s", what, msg);
+    }
+    janet_panic(what);
+}
+
+/* Client sessions are kept per context and host name, so that a new
+ * connection to the same host can resume instead of doing a full handshake. */
+static int janet_tls_new_session(SSL *ssl, SSL_SESSION *session) {
+    JanetTLS *tls = (JanetTLS *) SSL_get_app_data(ssl);
+    if (NULL == tls || NULL == tls->key) return 0;
+    JanetTLSContext *context = tls->context;
+    JanetTLSSession *slot = NULL;
+    for (int i = 0; i < JANET_TLS_SESSION_CACHE; i++) {
+        if (NULL != context->sessions[i].key && !strcmp(context->sessions[i].key, tls->key)) {
+            slot = context->sessions + i;
+            break;
+        }
+    }
+    if (NULL == slot) {
+        slot = context->sessions + context->next_session;
+        context->next_session = (context->next_session + 1) % JANET_TLS_SESSION_CACHE;
+        janet_free(slot->key);
+        slot->key = NULL;
+    }
+    if (NULL != slot->session) SSL_SESSION_free(slot->session);
+    if (NULL == slot->key) {
+        size_t len = strlen(tls->key) + 1;
+        slot->key = janet_malloc(len);
+        if (NULL == slot->key) {
+            JANET_OUT_OF_MEMORY;
+        }
+        memcpy(slot->key, tls->key, len);
+    }
+    slot->session = session;
+    return 1;
+}
+
+static Janet janet_tls_opt(JanetDictView opts, const char *name) {
+    if (NULL == opts.kvs) return janet_wrap_nil();
+    return janet_dictionary_get(opts.kvs, opts.cap, janet_ckeywordv(name));
+}
+
+static const char *janet_tls_optfile(JanetDictView opts, const char *name) {
+    Janet x = janet_tls_opt(opts, name);
+    if (janet_checktype(x, JANET_NIL)) return NULL;
+    if (!janet_checktype(x, JANET_STRING)) janet_panicf("expected string for :%s, got %v", name, x);
+    return (const char *) janet_unwrap_string(x);
+}
+
+static Janet cfun_tls_context(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    JanetDictView opts = {NULL, 0, 0};
+    if (argc > 0) opts = janet_getdictionary(argv, 0);
+    int server = janet_truthy(janet_tls_opt(opts, "server"));
+    Janet verifyv = janet_tls_opt(opts, "verify");
+    int verify = janet_checktype(verifyv, JANET_NIL) ? !server : janet_truthy(verifyv);
+    const char *cert = janet_tls_optfile(opts, "cert");
+    const char *key = janet_tls_optfile(opts, "key");
+    const char *ca = janet_tls_optfile(opts, "ca");
+    if (server && (NULL == cert || NULL == key)) janet_panic("server context needs :cert and :key");
+
+    SSL_CTX *ctx = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+    if (NULL == ctx) janet_tls_panic("could not create tls context");
+    JanetTLSContext *context = janet_abstract(&janet_tls_context_type, sizeof(JanetTLSContext));
+    memset(context, 0, sizeof(JanetTLSContext));
+    context->ctx = ctx;
+    context->server = server;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    if (NULL != cert && 1 != SSL_CTX_use_certificate_chain_file(ctx, cert))
+        janet_tls_panic("could not load certificate");
+    if (NULL != key && 1 != SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM))
+        janet_tls_panic("could not load private key");
+    if (NULL != key && 1 != SSL_CTX_check_private_key(ctx))
+        janet_tls_panic("private key does not match certificate");
+    if (NULL != ca) {
+        if (1 != SSL_CTX_load_verify_locations(ctx, ca, NULL)) janet_tls_panic("could not load ca file");
+    } else if (verify) {
+        SSL_CTX_set_default_verify_paths(ctx);
+    }
+    SSL_CTX_set_verify(ctx, verify ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, NULL);
+    if (server) {
+        SSL_CTX_set_session_id_context(ctx, (const unsigned char *) "janet", 5);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, janet_tls_new_session);
+    }
+    return janet_wrap_abstract(context);
+}
+
+static Janet cfun_tls_engine(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    JanetTLSContext *context = janet_getabstract(argv, 0, &janet_tls_context_type);
+    const char *host = janet_optcstring(argv, argc, 1, NULL);
+    JanetTLS *tls = janet_abstract(&janet_tls_type, sizeof(JanetTLS));
+    memset(tls, 0, sizeof(JanetTLS));
+    tls->context = context;
+    tls->ssl = SSL_new(context->ctx);
+    if (NULL == tls->ssl) janet_tls_panic("could not create tls connection");
+    tls->rbio = BIO_new(BIO_s_mem());
+    tls->wbio = BIO_new(BIO_s_mem());
+    if (NULL == tls->rbio || NULL == tls->wbio) {
+        BIO_free(tls->rbio);
+        BIO_free(tls->wbio);
+        janet_tls_panic("could not create tls connection");
+    }
+    /* An empty input BIO means "try again", not end of stream */
+    BIO_set_mem_eof_return(tls->rbio, -1);
+    SSL_set_bio(tls->ssl, tls->rbio, tls->wbio);
+    SSL_set_app_data(tls->ssl, tls);
+    if (context->server) {
+        SSL_set_accept_state(tls->ssl);
+        return janet_wrap_abstract(tls);
+    }
+    SSL_set_connect_state(tls->ssl);
+    if (NULL != host) {
+        SSL_set_tlsext_host_name(tls->ssl, host);
+        if (SSL_CTX_get_verify_mode(context->ctx) & SSL_VERIFY_PEER) SSL_set1_host(tls->ssl, host);
+        size_t len = strlen(host) + 1;
+        tls->key = janet_malloc(len);
+        if (NULL == tls->key) {
+            JANET_OUT_OF_MEMORY;
+        }
+        memcpy(tls->key, host, len);
+        for (int i = 0; i < JANET_TLS_SESSION_CACHE; i++) {
+            if (NULL != context->sessions[i].key && !strcmp(context->sessions[i].key, host)) {
+                SSL_set_session(tls->ssl, context->sessions[i].session);
+                break;
+            }
+        }
+    }
+    return janet_wrap_abstract(tls);
+}
+
+static Janet cfun_tls_handshake(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetTLS *tls = janet_getabstract(argv, 0, &janet_tls_type);
+    int ret = SSL_do_handshake(tls->ssl);
+    if (ret == 1) return janet_wrap_true();
+    if (SSL_get_error(tls->ssl, ret) == SSL_ERROR_WANT_READ) return janet_ckeywordv("want-read");
+    long result = SSL_get_verify_result(tls->ssl);
+    if (result != X509_V_OK) {
+        ERR_clear_error();
+        janet_panicf("tls handshake failed: %s", X509_verify_cert_error_string(result));
+    }
+    janet_tls_panic("tls handshake failed");
+}
+
+static Janet cfun_tls_feed(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 2);
+    JanetTLS *tls = janet_getabstract(argv, 0, &janet_tls_type);
+    JanetByteView bytes = janet_getbytes(argv, 1);
+    if (bytes.len > 0 && BIO_write(tls->rbio, bytes.bytes, bytes.len) != bytes.len) {
+        janet_tls_panic("could not buffer tls input");
+    }
+    return argv[0];
+}
+
+static Janet cfun_tls_take(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 2);
+    JanetTLS *tls = janet_getabstract(argv, 0, &janet_tls_type);
+    JanetBuffer *buffer = janet_getbuffer(argv, 1);
+    size_t pending = BIO_ctrl_pending(tls->wbio);
+    if (pending == 0) return janet_wrap_nil();
+    if (pending > INT32_MAX) pending = INT32_MAX;
+    janet_buffer_extra(buffer, (int32_t) pending);
+    int n = BIO_read(tls->wbio, buffer->data + buffer->count, (int) pending);
+    if (n > 0) buffer->count += n;
+    return argv[1];
+}
+
+static Janet cfun_tls_decrypt(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 3);
+    JanetTLS *tls = janet_getabstract(argv, 0, &janet_tls_type);
+    JanetBuffer *buffer = janet_getbuffer(argv, 1);
+    int32_t n = janet_getnat(argv, 2);
+    if (n == 0) return janet_wrap_integer(0);
+    janet_buffer_extra(buffer, n);
+    int ret = SSL_read(tls->ssl, buffer->data + buffer->count, n);
+    if (ret > 0) {
+        buffer->count += ret;
+        return janet_wrap_integer(ret);
+    }
+    switch (SSL_get_error(tls->ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            return janet_ckeywordv("want-read");
+        case SSL_ERROR_ZERO_RETURN:
+            return janet_wrap_nil();
+        default:
+            janet_tls_panic("tls read failed");
+    }
+}
+
+static Janet cfun_tls_encrypt(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 2);
+    JanetTLS *tls = janet_getabstract(argv, 0, &janet_tls_type);
+    JanetByteView bytes = janet_getbytes(argv, 1);
+    /* Output goes to a memory BIO, so SSL_write takes everything at once */
+    if (bytes.len > 0 && SSL_write(tls->ssl, bytes.bytes, bytes.len) != bytes.len) {
+        janet_tls_panic("tls write failed");
+    }
+    return argv[0];
+}
+
+static Janet cfun_tls_shutdown(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetTLS *tls = janet_getabstract(argv, 0, &janet_tls_type);
+    if (SSL_is_init_finished(tls->ssl)) SSL_shutdown(tls->ssl);
+    ERR_clear_error();
+    return argv[0];
+}
+
+static Janet cfun_tls_resumed(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetTLS *tls = janet_getabstract(argv, 0, &janet_tls_type);
+    return janet_wrap_boolean(SSL_session_reused(tls->ssl));
+}
+
+static const JanetReg tls_cfuns[] = {
+    {
+        "tls/context", cfun_tls_context,
+        JDOC("(tls/context &opt options)\n\n"
+             "Create a TLS context, which holds certificates and settings shared by many connections. "
+             "`options` is a table or struct with the keys:\n\n"
+             "* `:server` - make a server context. Defaults to false.\n"
+             "* `:cert` - path of a PEM certificate chain file. Required for servers.\n"
+             "* `:key` - path of a PEM private key file. Required for servers.\n"
+             "* `:ca` - path of a PEM file of trusted certificates. Defaults to the system store.\n"
+             "* `:verify` - check the peer's certificate. Defaults to true for clients "
+             "and false for servers.\n\n"
+             "Client contexts cache sessions per host name, so that later connections to the "
+             "same host can resume without a full handshake. Returns the new context.")
+    },
+    {
+        "tls/engine", cfun_tls_engine,
+        JDOC("(tls/engine context &opt host)\n\n"
+             "Create the TLS state for one connection. A client engine sends `host` for SNI, "
+             "checks that the certificate matches it when verifying, and resumes a cached "
+             "session for it when there is one. The engine does no IO - see tls/wrap for "
+             "running it over a stream. Returns the engine.")
+    },
+    {
+        "tls/handshake", cfun_tls_handshake,
+        JDOC("(tls/handshake engine)\n\n"
+             "Advance the handshake with the input given to tls/feed so far. Returns true when "
+             "the handshake is complete, or :want-read when more input is needed. Output for the "
+             "peer can be collected with tls/take after each call. Raises an error if the "
+             "handshake fails.")
+    },
+    {
+        "tls/feed", cfun_tls_feed,
+        JDOC("(tls/feed engine bytes)\n\n"
+             "Give bytes received from the peer to the engine. Returns engine.")
+    },
+    {
+        "tls/take", cfun_tls_take,
+        JDOC("(tls/take engine buffer)\n\n"
+             "Append all pending output for the peer to `buffer`. Returns buffer, or nil if "
+             "there is no pending output.")
+    },
+    {
+        "tls/decrypt", cfun_tls_decrypt,
+        JDOC("(tls/decrypt engine buffer n)\n\n"
+             "Append up to `n` bytes of decrypted data to `buffer`. Returns the number of bytes "
+             "added, :want-read if more input is needed first, or nil if the peer has closed "
+             "the TLS session.")
+    },
+    {
+        "tls/encrypt", cfun_tls_encrypt,
+        JDOC("(tls/encrypt engine bytes)\n\n"
+             "Encrypt bytes for the peer. The result is collected with tls/take. Returns engine.")
+    },
+    {
+        "tls/shutdown", cfun_tls_shutdown,
+        JDOC("(tls/shutdown engine)\n\n"
+             "Queue a close notification for the peer, collected with tls/take. Returns engine.")
+    },
+    {
+        "tls/resumed?", cfun_tls_resumed,
+        JDOC("(tls/resumed? engine)\n\n"
+             "Check if the handshake resumed an earlier session.")
+    },
+    {NULL, NULL, NULL}
+};
+
+void janet_lib_tls(JanetTable *env) {
+    janet_core_cfuns(env, NULL, tls_cfuns);
+}
+
+#endif
@@ -0,0 +1,968 @@
+/*
+* Copyright (c) 2021 Calvin Rose & contributors
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "util.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* Conditional compilation */
+#ifdef JANET_TYPED_ARRAY
+
+/* Typed arrays are views of unboxed numbers over a shared byte buffer. A
+ * view has an element type, a length, and a stride in elements, so several
+ * views with different types or offsets can look at the same memory, and
+ * slicing a view never copies.
+ *
+ * The numeric kernels below are plain C loops over the raw elements with a
+ * separate path for contiguous views, which is the shape compilers turn into
+ * vector instructions. Integer arithmetic is done on unsigned types so that
+ * overflow wraps instead of being undefined. */
+
+static const char *const ta_type_names[] = {
+    "u8", "s8", "u16", "s16", "u32", "s32", "u64", "s64", "f32", "f64"
+};
+
+static const size_t ta_type_sizes[] = {
+    sizeof(uint8_t), sizeof(int8_t), sizeof(uint16_t), sizeof(int16_t),
+    sizeof(uint32_t), sizeof(int32_t), sizeof(uint64_t), sizeof(int64_t),
+    sizeof(float), sizeof(double)
+};
+
+#define TA_COUNT_TYPES (JANET_TARRAY_TYPE_F64 + 1)
+
+/* X(NAME, name, T, UT, SIGNED) for each integer type. UT is the unsigned
+ * type the arithmetic is done in, at least as wide as int so that the
+ * operands are not promoted back to a signed type. */
+#define TA_INT_TYPES(X) \
+    X(U8, u8, uint8_t, uint32_t, 0) \
+    X(S8, s8, int8_t, uint32_t, 1) \
+    X(U16, u16, uint16_t, uint32_t, 0) \
+    X(S16, s16, int16_t, uint32_t, 1) \
+    X(U32, u32, uint32_t, uint32_t, 0) \
+    X(S32, s32, int32_t, uint32_t, 1) \
+    X(U64, u64, uint64_t, uint64_t, 0) \
+    X(S64, s64, int64_t, uint64_t, 1)
+
+#define TA_FLOAT_TYPES(X) \
+    X(F32, f32, float, float, 1) \
+    X(F64, f64, double, double, 1)
+
+static JanetTArrayType ta_get_type(const Janet *argv, int32_t n) {
+    const uint8_t *name = janet_getkeyword(argv, n);
+    for (int i = 0; i < TA_COUNT_TYPES; i++) {
+        if (!janet_cstrcmp(name, ta_type_names[i])) return (JanetTArrayType) i;
+    }
+    janet_panicf("invalid typed array type %v", argv[n]);
+}
+
+/* Buffers */
+
+static int ta_buffer_gc(void *p, size_t size) {
+    (void) size;
+    JanetTArrayBuffer *buf = (JanetTArrayBuffer *) p;
+    janet_free(buf->data);
+    return 0;
+}
+
+static void ta_buffer_init(JanetTArrayBuffer *buf, size_t size) {
+    buf->data = NULL;
+    buf->size = 0;
+    if (size > 0) {
+        buf->data = janet_calloc(size, 1);
+        if (NULL == buf->data) {
+            JANET_OUT_OF_MEMORY;
+        }
+        buf->size = size;
+    }
+}
+
+static void ta_buffer_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetTArrayBuffer *buf = (JanetTArrayBuffer *) p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_size(ctx, buf->size);
+    janet_marshal_bytes(ctx, buf->data, buf->size);
+}
+
+static void *ta_buffer_unmarshal(JanetMarshalContext *ctx) {
+    JanetTArrayBuffer *buf = janet_unmarshal_abstract(ctx, sizeof(JanetTArrayBuffer));
+    buf->data = NULL;
+    buf->size = 0;
+    size_t size = janet_unmarshal_size(ctx);
+    janet_unmarshal_ensure(ctx, size);
+    ta_buffer_init(buf, size);
+    janet_unmarshal_bytes(ctx, buf->data, size);
+    return buf;
+}
+
+const JanetAbstractType janet_ta_buffer_type = {
+    "core/ta/buffer",
+    ta_buffer_gc,
+    NULL,
+    NULL,
+    NULL,
+    ta_buffer_marshal,
+    ta_buffer_unmarshal,
+    JANET_ATEND_UNMARSHAL
+};
+
+JanetTArrayBuffer *janet_tarray_buffer(size_t size) {
+    JanetTArrayBuffer *buf = janet_abstract(&janet_ta_buffer_type, sizeof(JanetTArrayBuffer));
+    ta_buffer_init(buf, size);
+    return buf;
+}
+
+/* Views */
+
+static size_t ta_view_offset(JanetTArrayView *view) {
+    if (NULL == view->buffer || NULL == view->buffer->data) return 0;
+    return (size_t)(view->as.u8 - view->buffer->data) / ta_type_sizes[view->type];
+}
+
+/* Number of bytes a view of size elements needs, starting offset
+ * elements into its buffer. Returns 0 if that does not fit in a size_t. */
+static int ta_view_bytes(JanetTArrayType type, size_t size, size_t stride, size_t offset,
+                         size_t *bytes) {
+    size_t esize = ta_type_sizes[type];
+    size_t max = SIZE_MAX / esize;
+    if (size == 0) {
+        if (offset > max) return 0;
+        *bytes = offset * esize;
+        return 1;
+    }
+    if (offset > max - 1) return 0;
+    if ((size - 1) > (max - 1 - offset) / stride) return 0;
+    *bytes = (offset + (size - 1) * stride + 1) * esize;
+    return 1;
+}
+
+static int ta_view_gcmark(void *p, size_t size) {
+    (void) size;
+    JanetTArrayView *view = (JanetTArrayView *) p;
+    if (NULL != view->buffer) janet_mark(janet_wrap_abstract(view->buffer));
+    return 0;
+}
+
+static void ta_view_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetTArrayView *view = (JanetTArrayView *) p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_int(ctx, (int32_t) view->type);
+    janet_marshal_size(ctx, view->size);
+    janet_marshal_size(ctx, view->stride);
+    janet_marshal_size(ctx, ta_view_offset(view));
+    janet_marshal_janet(ctx, janet_wrap_abstract(view->buffer));
+}
+
+static void *ta_view_unmarshal(JanetMarshalContext *ctx) {
+    JanetTArrayView *view = janet_unmarshal_abstract(ctx, sizeof(JanetTArrayView));
+    view->buffer = NULL;
+    view->as.pointer = NULL;
+    view->size = 0;
+    view->stride = 1;
+    view->type = JANET_TARRAY_TYPE_U8;
+    int32_t type = janet_unmarshal_int(ctx);
+    if (type < 0 || type >= TA_COUNT_TYPES) janet_panic("invalid typed array type");
+    size_t size = janet_unmarshal_size(ctx);
+    size_t stride = janet_unmarshal_size(ctx);
+    size_t offset = janet_unmarshal_size(ctx);
+    if (stride < 1) janet_panic("invalid typed array stride");
+    Janet buffer = janet_unmarshal_janet(ctx);
+    JanetTArrayBuffer *buf = janet_checkabstract(buffer, &janet_ta_buffer_type);
+    if (NULL == buf) janet_panic("expected typed array buffer");
+    size_t bytes;
+    if (!ta_view_bytes((JanetTArrayType) type, size, stride, offset, &bytes) || bytes > buf->size)
+        janet_panic("typed array out of bounds");
+    view->buffer = buf;
+    view->type = (JanetTArrayType) type;
+    view->size = size;
+    view->stride = stride;
+    view->as.u8 = NULL == buf->data ? NULL : buf->data + offset * ta_type_sizes[type];
+    return view;
+}
+
+/* Read or write a number given as a Janet number or, for the 64 bit types,
+ * a boxed s64 or u64. Integer types get the two's complement bits of the
+ * value, so negative numbers wrap around for unsigned types. */
+static uint64_t ta_unwrap_bits(Janet x) {
+    if (janet_checktype(x, JANET_NUMBER)) {
+        double d = janet_unwrap_number(x);
+        if (d == floor(d) && d >= -9223372036854775808.0 && d < 18446744073709551616.0) {
+            return d < 0 ? (uint64_t)(int64_t) d : (uint64_t) d;
+        }
+    }
+#ifdef JANET_INT_TYPES
+    if (janet_is_int(x) != JANET_INT_NONE) {
+        return *(uint64_t *) janet_unwrap_abstract(x);
+    }
+#endif
+    janet_panicf("expected integer, got %v", x);
+}
+
+static double ta_unwrap_double(Janet x) {
+    if (janet_checktype(x, JANET_NUMBER)) return janet_unwrap_number(x);
+#ifdef JANET_INT_TYPES
+    switch (janet_is_int(x)) {
+        default:
+            break;
+        case JANET_INT_S64:
+            return (double) janet_unwrap_s64(x);
+        case JANET_INT_U64:
+            return (double) janet_unwrap_u64(x);
+    }
+#endif
+    janet_panicf("expected number, got %v", x);
+}
+
+static Janet ta_wrap_u64(uint64_t x) {
+#ifdef JANET_INT_TYPES
+    return janet_wrap_u64(x);
+#else
+    return janet_wrap_number((double) x);
+#endif
+}
+
+static Janet ta_wrap_s64(int64_t x) {
+#ifdef JANET_INT_TYPES
+    return janet_wrap_s64(x);
+#else
+    return janet_wrap_number((double) x);
+#endif
+}
+
+static Janet ta_getindex(JanetTArrayView *view, size_t i) {
+    i *= view->stride;
+    switch (view->type) {
+        case JANET_TARRAY_TYPE_U8:
+            return janet_wrap_number(view->as.u8[i]);
+        case JANET_TARRAY_TYPE_S8:
+            return janet_wrap_number(view->as.s8[i]);
+        case JANET_TARRAY_TYPE_U16:
+            return janet_wrap_number(view->as.u16[i]);
+        case JANET_TARRAY_TYPE_S16:
+            return janet_wrap_number(view->as.s16[i]);
+        case JANET_TARRAY_TYPE_U32:
+            return janet_wrap_number(view->as.u32[i]);
+        case JANET_TARRAY_TYPE_S32:
+            return janet_wrap_number(view->as.s32[i]);
+        case JANET_TARRAY_TYPE_U64:
+            return ta_wrap_u64(view->as.u64[i]);
+        case JANET_TARRAY_TYPE_S64:
+            return ta_wrap_s64(view->as.s64[i]);
+        case JANET_TARRAY_TYPE_F32:
+            return janet_wrap_number(view->as.f32[i]);
+        case JANET_TARRAY_TYPE_F64:
+            return janet_wrap_number(view->as.f64[i]);
+    }
+    return janet_wrap_nil();
+}
+
+static double ta_getdouble(JanetTArrayView *view, size_t i) {
+    i *= view->stride;
+    switch (view->type) {
+#define X(NAME, name, T, UT, SIGNED) case JANET_TARRAY_TYPE_##NAME: return (double) view->as.name[i];
+            TA_INT_TYPES(X)
+            TA_FLOAT_TYPES(X)
+#undef X
+    }
+    return 0.0;
+}
+
+static void ta_setindex(JanetTArrayView *view, size_t i, Janet value) {
+    i *= view->stride;
+    switch (view->type) {
+#define X(NAME, name, T, UT, SIGNED) case JANET_TARRAY_TYPE_##NAME: view->as.name[i] = (T) ta_unwrap_bits(value); break;
+            TA_INT_TYPES(X)
+#undef X
+#define X(NAME, name, T, UT, SIGNED) case JANET_TARRAY_TYPE_##NAME: view->as.name[i] = (T) ta_unwrap_double(value); break;
+            TA_FLOAT_TYPES(X)
+#undef X
+    }
+}
+
+static Janet cfun_typed_array_length(int32_t argc, Janet *argv);
+
+static const JanetMethod tarray_view_methods[] = {
+    {"length", cfun_typed_array_length},
+    {NULL, NULL}
+};
+
+static int ta_view_get(void *p, Janet key, Janet *out) {
+    JanetTArrayView *view = (JanetTArrayView *) p;
+    if (janet_checktype(key, JANET_KEYWORD)) {
+        return janet_getmethod(janet_unwrap_keyword(key), tarray_view_methods, out);
+    }
+    if (!janet_checksize(key)) return 0;
+    size_t i = (size_t) janet_unwrap_number(key);
+    if (i >= view->size) return 0;
+    *out = ta_getindex(view, i);
+    return 1;
+}
+
+static void ta_view_put(void *p, Janet key, Janet value) {
+    JanetTArrayView *view = (JanetTArrayView *) p;
+    if (!janet_checksize(key)) janet_panicf("expected non-negative integer key, got %v", key);
+    size_t i = (size_t) janet_unwrap_number(key);
+    if (i >= view->size) janet_panicf("index %v out of range [0,%d)", key, (int32_t) view->size);
+    ta_setindex(view, i, value);
+}
+
+static Janet ta_view_next(void *p, Janet key) {
+    JanetTArrayView *view = (JanetTArrayView *) p;
+    if (janet_checktype(key, JANET_NIL)) {
+        return view->size > 0 ? janet_wrap_number(0) : janet_wrap_nil();
+    }
+    if (!janet_checksize(key)) return janet_wrap_nil();
+    size_t i = (size_t) janet_unwrap_number(key) + 1;
+    return i < view->size ? janet_wrap_number((double) i) : janet_wrap_nil();
+}
+
+static void ta_view_tostring(void *p, JanetBuffer *buffer) {
+    JanetTArrayView *view = (JanetTArrayView *) p;
+    janet_formatb(buffer, "%s[%d]", ta_type_names[view->type], (int32_t) view->size);
+}
+
+const JanetAbstractType janet_ta_view_type = {
+    "core/ta/view",
+    NULL,
+    ta_view_gcmark,
+    ta_view_get,
+    ta_view_put,
+    ta_view_marshal,
+    ta_view_unmarshal,
+    ta_view_tostring,
+    NULL,
+    NULL,
+    ta_view_next,
+    JANET_ATEND_NEXT
+};
+
+JanetTArrayView *janet_tarray_view(JanetTArrayType type, size_t size, size_t stride,
+                                   size_t offset, JanetTArrayBuffer *buffer) {
+    if (stride < 1) janet_panic("stride must be positive");
+    size_t bytes;
+    if (!ta_view_bytes(type, size, stride, offset, &bytes)) janet_panic("typed array too large");
+    if (NULL == buffer) {
+        buffer = janet_tarray_buffer(bytes);
+    } else if (bytes > buffer->size) {
+        janet_panicf("typed array needs %.0f bytes but buffer has %.0f",
+                     (double) bytes, (double) buffer->size);
+    }
+    JanetTArrayView *view = janet_abstract(&janet_ta_view_type, sizeof(JanetTArrayView));
+    view->buffer = buffer;
+    view->type = type;
+    view->size = size;
+    view->stride = stride;
+    view->as.u8 = NULL == buffer->data ? NULL : buffer->data + offset * ta_type_sizes[type];
+    return view;
+}
+
+JanetTArrayBuffer *janet_gettarray_buffer(const Janet *argv, int32_t n) {
+    return janet_getabstract(argv, n, &janet_ta_buffer_type);
+}
+
+int janet_is_tarray_view(Janet x, JanetTArrayType type) {
+    JanetTArrayView *view = janet_checkabstract(x, &janet_ta_view_type);
+    return NULL != view && (type == JANET_TARRAY_TYPE_ANY || view->type == type);
+}
+
+JanetTArrayView *janet_gettarray_any(const Janet *argv, int32_t n) {
+    return janet_getabstract(argv, n, &janet_ta_view_type);
+}
+
+JanetTArrayView *janet_gettarray_view(const Janet *argv, int32_t n, JanetTArrayType type) {
+    JanetTArrayView *view = janet_gettarray_any(argv, n);
+    if (type != JANET_TARRAY_TYPE_ANY && view->type != type) {
+        janet_panicf("bad slot #%d, expected typed array of type %s, got %s",
+                     n, ta_type_names[type], ta_type_names[view->type]);
+    }
+    return view;
+}
+
+/* Kernels */
+
+static double ta_sum(JanetTArrayView *view) {
+    size_t n = view->size, s = view->stride;
+    switch (view->type) {
+        /* Narrow integers cannot overflow a 64 bit accumulator at any
+         * length a view can have, and integer sums vectorize exactly. */
+#define X(NAME, name, T, ACC) case JANET_TARRAY_TYPE_##NAME: { \
+            const T *p = view->as.name; \
+            ACC acc = 0; \
+            if (s == 1) { \
+                for (size_t i = 0; i < n; i++) acc += p[i]; \
+            } else { \
+                for (size_t i = 0; i < n; i++) acc += p[i * s]; \
+            } \
+            return (double) acc; \
+        }
+            X(U8, u8, uint8_t, uint64_t)
+            X(S8, s8, int8_t, int64_t)
+            X(U16, u16, uint16_t, uint64_t)
+            X(S16, s16, int16_t, int64_t)
+            X(U32, u32, uint32_t, uint64_t)
+            X(S32, s32, int32_t, int64_t)
+#undef X
+            /* Floating point addition is not associative, so the compiler
+             * will not split a single accumulator. Use four. */
+#define X(NAME, name, T, UT, SIGNED) case JANET_TARRAY_TYPE_##NAME: { \
+            const T *p = view->as.name; \
+            double a0 = 0, a1 = 0, a2 = 0, a3 = 0; \
+            size_t i = 0; \
+            if (s == 1) { \
+                for (; i + 4 <= n; i += 4) { \
+                    a0 += (double) p[i]; \
+                    a1 += (double) p[i + 1]; \
+                    a2 += (double) p[i + 2]; \
+                    a3 += (double) p[i + 3]; \
+                } \
+                for (; i < n; i++) a0 += (double) p[i]; \
+            } else { \
+                for (; i < n; i++) a0 += (double) p[i * s]; \
+            } \
+            return (a0 + a1) + (a2 + a3); \
+        }
+            X(U64, u64, uint64_t, uint64_t, 0)
+            X(S64, s64, int64_t, uint64_t, 1)
+            TA_FLOAT_TYPES(X)
+#undef X
+    }
+    return 0.0;
+}
+
+static double ta_dot(JanetTArrayView *a, JanetTArrayView *b) {
+    size_t n = a->size;
+    if (a->type == b->type && a->stride == 1 && b->stride == 1) {
+        switch (a->type) {
+            default:
+                break;
+#define X(NAME, name, T, UT, SIGNED) case JANET_TARRAY_TYPE_##NAME: { \
+                const T *x = a->as.name; \
+                const T *y = b->as.name; \
+                double a0 = 0, a1 = 0, a2 = 0, a3 = 0; \
+                size_t i = 0; \
+                for (; i + 4 <= n; i += 4) { \
+                    a0 += (double) x[i] * (double) y[i]; \
+                    a1 += (double) x[i + 1] * (double) y[i + 1]; \
+                    a2 += (double) x[i + 2] * (double) y[i + 2]; \
+                    a3 += (double) x[i + 3] * (double) y[i + 3]; \
+                } \
+                for (; i < n; i++) a0 += (double) x[i] * (double) y[i]; \
+                return (a0 + a1) + (a2 + a3); \
+            }
+                TA_FLOAT_TYPES(X)
+#undef X
+        }
+    }
+    double acc = 0;
+    for (size_t i = 0; i < n; i++) {
+        acc += ta_getdouble(a, i) * ta_getdouble(b, i);
+    }
+    return acc;
+}
+
+/* Minimum or maximum of a non-empty view. NaNs are skipped, so the result
+ * is only NaN if every element is. */
+static Janet ta_extreme(JanetTArrayView *view, int max) {
+    size_t n = view->size, s = view->stride;
+    switch (view->type) {
+#define X(NAME, name, T, UT, SIGNED) case JANET_TARRAY_TYPE_##NAME: { \
+            const T *p = view->as.name; \
+            T m = p[0]; \
+            if (max) { \
+                for (size_t i = 1; i < n; i++) m = p[i * s] > m ? p[i * s] : m; \
+            } else { \
+                for (size_t i = 1; i < n; i++) m = p[i * s] < m ? p[i * s] : m; \
+            } \
+            return janet_wrap_number((double) m); \
+        }
+            X(U8, u8, uint8_t, 0, 0)
+            X(S8, s8, int8_t, 0, 0)
+            X(U16, u16, uint16_t, 0, 0)
+            X(S16, s16, int16_t, 0, 0)
+            X(U32, u32, uint32_t, 0, 0)
+            X(S32, s32, int32_t, 0, 0)
+#undef X
+        case JANET_TARRAY_TYPE_U64: {
+            const uint64_t *p = view->as.u64;
+            uint64_t m = p[0];
+            for (size_t i = 1; i < n; i++) {
+                uint64_t x = p[i * s];
+                m = (max ? x > m : x < m) ? x : m;
+            }
+            return ta_wrap_u64(m);
+        }
+        case JANET_TARRAY_TYPE_S64: {
+            const int64_t *p = view->as.s64;
+            int64_t m = p[0];
+            for (size_t i = 1; i < n; i++) {
+                int64_t x = p[i * s];
+                m = (max ? x > m : x < m) ? x : m;
+            }
+            return ta_wrap_s64(m);
+        }
+#define X(NAME, name, T, UT, SIGNED) case JANET_TARRAY_TYPE_##NAME: { \
+            const T *p = view->as.name; \
+            T m = p[0]; \
+            for (size_t i = 1; i < n; i++) { \
+                T x = p[i * s]; \
+                if (m != m || (max ? x > m : x < m)) m = x; \
+            } \
+            return janet_wrap_number((double) m); \
+        }
+            TA_FLOAT_TYPES(X)
+#undef X
+    }
+    return janet_wrap_nil();
+}
+
+typedef enum {
+    TA_OP_ADD,
+    TA_OP_SUB,
+    TA_OP_MUL,
+    TA_OP_DIV
+} TArrayOp;
+
+/* Apply dst[i] = dst[i] op src[i]. A scalar operand is passed as a one
+ * element array with a stride of 0. */
+#define TA_APPLY(T, EXPR) do { \
+        if (ds == 1 && ss == 1) { \
+            for (size_t i = 0; i < n; i++) dst[i] = (T)(EXPR(dst[i], src[i])); \
+        } else if (ds == 1 && ss == 0) { \
+            const T y = src[0]; \
+            for (size_t i = 0; i < n; i++) dst[i] = (T)(EXPR(dst[i], y)); \
+        } else { \
+            for (size_t i = 0; i < n; i++) dst[i * ds] = (T)(EXPR(dst[i * ds], src[i * ss])); \
+        } \
+    } while (0)
+
+#define TA_ADD(x, y) ((x) + (y))
+#define TA_SUB(x, y) ((x) - (y))
+#define TA_MUL(x, y) ((x) * (y))
+#define TA_DIV(x, y) ((x) / (y))
+
+/* Integer operators in terms of UT. Division of the most negative signed
+ * value by -1 is the one quotient that overflows, so negate instead. */
+#define X(NAME, name, T, UT, SIGNED) \
+    static inline T ta_##name##_add(T x, T y) { return (T)((UT) x + (UT) y); } \
+    static inline T ta_##name##_sub(T x, T y) { return (T)((UT) x - (UT) y); } \
+    static inline T ta_##name##_mul(T x, T y) { return (T)((UT) x * (UT) y); } \
+    static inline T ta_##name##_div(T x, T y) { \
+        if (SIGNED && y == (T) -1) return (T)((UT) 0 - (UT) x); \
+        return (T)(x / y); \
+    }
+TA_INT_TYPES(X)
+#undef X
+
+static void ta_binop(JanetTArrayView *view, const void *operand, size_t ss, TArrayOp op) {
+    size_t n = view->size, ds = view->stride;
+    switch (view->type) {
+#define X(NAME, name, T, UT, SIGNED) case JANET_TARRAY_TYPE_##NAME: { \
+            T *dst = view->as.name; \
+            const T *src = (const T *) operand; \
+            for (size_t i = 0; op == TA_OP_DIV && i < (ss ? n : 1); i++) { \
+                if (src[i * ss] == 0) janet_panic("division by zero"); \
+            } \
+            switch (op) { \
+                case TA_OP_ADD: \
+                    TA_APPLY(T, ta_##name##_add); \
+                    break; \
+                case TA_OP_SUB: \
+                    TA_APPLY(T, ta_##name##_sub); \
+                    break; \
+                case TA_OP_MUL: \
+                    TA_APPLY(T, ta_##name##_mul); \
+                    break; \
+                case TA_OP_DIV: \
+                    TA_APPLY(T, ta_##name##_div); \
+                    break; \
+            } \
+            break; \
+        }
+            TA_INT_TYPES(X)
+#undef X
+#define X(NAME, name, T, UT, SIGNED) case JANET_TARRAY_TYPE_##NAME: { \
+            T *dst = view->as.name; \
+            const T *src = (const T *) operand; \
+            switch (op) { \
+                case TA_OP_ADD: \
+                    TA_APPLY(T, TA_ADD); \
+                    break; \
+                case TA_OP_SUB: \
+                    TA_APPLY(T, TA_SUB); \
+                    break; \
+                case TA_OP_MUL: \
+                    TA_APPLY(T, TA_MUL); \
+                    break; \
+                case TA_OP_DIV: \
+                    TA_APPLY(T, TA_DIV); \
+                    break; \
+            } \
+            break; \
+        }
+            TA_FLOAT_TYPES(X)
+#undef X
+    }
+}
+
+static int ta_view_contiguous(JanetTArrayView *view) {
+    return view->stride == 1 || view->size < 2;
+}
+
+/* Comparators for sorting. NaNs sort after every other float. */
+#define X(NAME, name, T, UT, SIGNED) \
+    static int ta_compare_##name(const void *a, const void *b) { \
+        T x = *(const T *) a; \
+        T y = *(const T *) b; \
+        return (x > y) - (x < y); \
+    }
+TA_INT_TYPES(X)
+#undef X
+#define X(NAME, name, T, UT, SIGNED) \
+    static int ta_compare_##name(const void *a, const void *b) { \
+        T x = *(const T *) a; \
+        T y = *(const T *) b; \
+        if (x != x) return (y != y) ? 0 : 1; \
+        if (y != y) return -1; \
+        return (x > y) - (x < y); \
+    }
+TA_FLOAT_TYPES(X)
+#undef X
+
+static int (*const ta_comparators[])(const void *, const void *) = {
+    ta_compare_u8, ta_compare_s8, ta_compare_u16, ta_compare_s16,
+    ta_compare_u32, ta_compare_s32, ta_compare_u64, ta_compare_s64,
+    ta_compare_f32, ta_compare_f64
+};
+
+static void ta_sort(JanetTArrayView *view) {
+    size_t n = view->size;
+    if (n < 2) return;
+    size_t esize = ta_type_sizes[view->type];
+    if (ta_view_contiguous(view)) {
+        qsort(view->as.pointer, n, esize, ta_comparators[view->type]);
+        return;
+    }
+    /* Gather strided elements, sort them, and scatter them back */
+    size_t step = view->stride * esize;
+    uint8_t *tmp = janet_malloc(n * esize);
+    if (NULL == tmp) {
+        JANET_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < n; i++) memcpy(tmp + i * esize, view->as.u8 + i * step, esize);
+    qsort(tmp, n, esize, ta_comparators[view->type]);
+    for (size_t i = 0; i < n; i++) memcpy(view->as.u8 + i * step, tmp + i * esize, esize);
+    janet_free(tmp);
+}
+
+/* C Functions */
+
+static Janet cfun_typed_array_new(int32_t argc, Janet *argv) {
+    janet_arity(argc, 2, 5);
+    JanetTArrayType type = ta_get_type(argv, 0);
+    size_t size = (size_t) janet_getnat(argv, 1);
+    size_t stride = (size_t) janet_optnat(argv, argc, 2, 1);
+    size_t offset = (size_t) janet_optnat(argv, argc, 3, 0);
+    JanetTArrayBuffer *buffer = NULL;
+    if (argc > 4 && !janet_checktype(argv[4], JANET_NIL)) {
+        JanetTArrayView *view = janet_checkabstract(argv[4], &janet_ta_view_type);
+        if (NULL != view) {
+            /* Offset from the start of the other view */
+            size_t base = ta_view_offset(view) * ta_type_sizes[view->type];
+            if (base % ta_type_sizes[type]) janet_panic("typed array offset is not aligned");
+            offset += base / ta_type_sizes[type];
+            buffer = view->buffer;
+        } else {
+            buffer = janet_gettarray_buffer(argv, 4);
+        }
+    }
+    return janet_wrap_abstract(janet_tarray_view(type, size, stride, offset, buffer));
+}
+
+static Janet cfun_typed_array_buffer(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetTArrayView *view = janet_checkabstract(argv[0], &janet_ta_view_type);
+    if (NULL != view) return janet_wrap_abstract(view->buffer);
+    size_t size = janet_getsize(argv, 0);
+    return janet_wrap_abstract(janet_tarray_buffer(size));
+}
+
+static Janet cfun_typed_array_length(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetTArrayView *view = janet_checkabstract(argv[0], &janet_ta_view_type);
+    if (NULL != view) return janet_wrap_number((double) view->size);
+    JanetTArrayBuffer *buf = janet_checkabstract(argv[0], &janet_ta_buffer_type);
+    if (NULL != buf) return janet_wrap_number((double) buf->size);
+    janet_panicf("expected typed array or typed array buffer, got %v", argv[0]);
+}
+
+static Janet cfun_typed_array_properties(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetTArrayView *view = janet_checkabstract(argv[0], &janet_ta_view_type);
+    if (NULL == view) {
+        JanetTArrayBuffer *buf = janet_gettarray_buffer(argv, 0);
+        JanetKV *st = janet_struct_begin(1);
+        janet_struct_put(st, janet_ckeywordv("size"), janet_wrap_number((double) buf->size));
+        return janet_wrap_struct(janet_struct_end(st));
+    }
+    size_t esize = ta_type_sizes[view->type];
+    JanetKV *st = janet_struct_begin(6);
+    janet_struct_put(st, janet_ckeywordv("size"), janet_wrap_number((double) view->size));
+    janet_struct_put(st, janet_ckeywordv("byte-offset"),
+                     janet_wrap_number((double)(ta_view_offset(view) * esize)));
+    janet_struct_put(st, janet_ckeywordv("stride"), janet_wrap_number((double) view->stride));
+    janet_struct_put(st, janet_ckeywordv("type"), janet_ckeywordv(ta_type_names[view->type]));
+    janet_struct_put(st, janet_ckeywordv("type-size"), janet_wrap_number((double) esize));
+    janet_struct_put(st, janet_ckeywordv("buffer"), janet_wrap_abstract(view->buffer));
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
+static Janet cfun_typed_array_slice(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 3);
+    JanetTArrayView *src = janet_gettarray_any(argv, 0);
+    size_t start = (size_t) janet_optnat(argv, argc, 1, 0);
+    size_t end = src->size;
+    if (argc > 2 && !janet_checktype(argv[2], JANET_NIL)) end = (size_t) janet_getnat(argv, 2);
+    if (end > src->size) end = src->size;
+    if (start > end) start = end;
+    JanetTArrayView *view = janet_abstract(&janet_ta_view_type, sizeof(JanetTArrayView));
+    *view = *src;
+    view->size = end - start;
+    if (view->size > 0) view->as.u8 = src->as.u8 + start * src->stride * ta_type_sizes[src->type];
+    return janet_wrap_abstract(view);
+}
+
+static Janet cfun_typed_array_copy_bytes(int32_t argc, Janet *argv) {
+    janet_arity(argc, 4, 5);
+    JanetTArrayView *src = janet_gettarray_any(argv, 0);
+    size_t sindex = (size_t) janet_getnat(argv, 1);
+    JanetTArrayView *dst = janet_gettarray_any(argv, 2);
+    size_t dindex = (size_t) janet_getnat(argv, 3);
+    size_t count = (size_t) janet_optnat(argv, argc, 4, 1);
+    size_t esize = ta_type_sizes[src->type];
+    if (ta_type_sizes[dst->type] != esize) janet_panic("typed arrays must have the same element size");
+    if (sindex + count > src->size || dindex + count > dst->size) janet_panic("typed array out of bounds");
+    if (src->stride == 1 && dst->stride == 1) {
+        memmove(dst->as.u8 + dindex * esize, src->as.u8 + sindex * esize, count * esize);
+    } else {
+        size_t sstep = src->stride * esize;
+        size_t dstep = dst->stride * esize;
+        for (size_t i = 0; i < count; i++) {
+            memmove(dst->as.u8 + (dindex + i) * dstep, src->as.u8 + (sindex + i) * sstep, esize);
+        }
+    }
+    return janet_wrap_nil();
+}
+
+static Janet cfun_typed_array_sum(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    return janet_wrap_number(ta_sum(janet_gettarray_any(argv, 0)));
+}
+
+static Janet cfun_typed_array_min(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetTArrayView *view = janet_gettarray_any(argv, 0);
+    return view->size ? ta_extreme(view, 0) : janet_wrap_nil();
+}
+
+static Janet cfun_typed_array_max(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    JanetTArrayView *view = janet_gettarray_any(argv, 0);
+    return view->size ? ta_extreme(view, 1) : janet_wrap_nil();
+}
+
+static Janet cfun_typed_array_dot(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 2);
+    JanetTArrayView *a = janet_gettarray_any(argv, 0);
+    JanetTArrayView *b = janet_gettarray_any(argv, 1);
+    if (a->size != b->size) janet_panic("typed arrays must have the same length");
+    return janet_wrap_number(ta_dot(a, b));
+}
+
+static Janet cfun_typed_array_sort(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    ta_sort(janet_gettarray_any(argv, 0));
+    return argv[0];
+}
+
+static Janet ta_binop_cfun(int32_t argc, Janet *argv, TArrayOp op) {
+    janet_fixarity(argc, 2);
+    JanetTArrayView *view = janet_gettarray_any(argv, 0);
+    JanetTArrayView *other = janet_checkabstract(argv[1], &janet_ta_view_type);
+    if (NULL != other) {
+        if (other->type != view->type) {
+            janet_panicf("expected typed array of type %s, got %s",
+                         ta_type_names[view->type], ta_type_names[other->type]);
+        }
+        if (other->size != view->size) janet_panic("typed arrays must have the same length");
+        ta_binop(view, other->as.pointer, other->stride, op);
+        return argv[0];
+    }
+    /* Scalar operand, converted to the element type once */
+    union {
+        uint8_t u8;
+        int8_t s8;
+        uint16_t u16;
+        int16_t s16;
+        uint32_t u32;
+        int32_t s32;
+        uint64_t u64;
+        int64_t s64;
+        float f32;
+        double f64;
+    } scalar;
+    JanetTArrayView tmp;
+    tmp.as.pointer = &scalar;
+    tmp.type = view->type;
+    tmp.stride = 1;
+    tmp.size = 1;
+    tmp.buffer = NULL;
+    ta_setindex(&tmp, 0, argv[1]);
+    ta_binop(view, &scalar, 0, op);
+    return argv[0];
+}
+
+static Janet cfun_typed_array_add(int32_t argc, Janet *argv) {
+    return ta_binop_cfun(argc, argv, TA_OP_ADD);
+}
+
+static Janet cfun_typed_array_sub(int32_t argc, Janet *argv) {
+    return ta_binop_cfun(argc, argv, TA_OP_SUB);
+}
+
+static Janet cfun_typed_array_mul(int32_t argc, Janet *argv) {
+    return ta_binop_cfun(argc, argv, TA_OP_MUL);
+}
+
+static Janet cfun_typed_array_div(int32_t argc, Janet *argv) {
+    return ta_binop_cfun(argc, argv, TA_OP_DIV);
+}
+
+static const JanetReg ta_cfuns[] = {
+    {
+        "tarray/new", cfun_typed_array_new,
+        JDOC("(tarray/new type size &opt stride offset tarray|buffer)\n\n"
+             "Create a new typed array of the given type and size. Type is one of "
+             ":u8, :s8, :u16, :s16, :u32, :s32, :u64, :s64, :f32 or :f64. The array is a "
+             "view over a typed array buffer, starting offset elements into it and stepping "
+             "stride elements between entries. If a buffer or another typed array is "
+             "given, the new array shares its memory, otherwise a new zeroed buffer is made.")
+    },
+    {
+        "tarray/buffer", cfun_typed_array_buffer,
+        JDOC("(tarray/buffer array|size)\n\n"
+             "Return the buffer of a typed array, or create a new zeroed typed array "
+             "buffer of size bytes.")
+    },
+    {
+        "tarray/length", cfun_typed_array_length,
+        JDOC("(tarray/length array|buffer)\n\n"
+             "Return the number of elements in a typed array, or the number of bytes in "
+             "a typed array buffer.")
+    },
+    {
+        "tarray/properties", cfun_typed_array_properties,
+        JDOC("(tarray/properties array|buffer)\n\n"
+             "Return a struct describing a typed array or typed array buffer. Arrays have "
+             "the keys :size, :byte-offset, :stride, :type, :type-size and :buffer. "
+             "Buffers only have :size.")
+    },
+    {
+        "tarray/slice", cfun_typed_array_slice,
+        JDOC("(tarray/slice array &opt start end)\n\n"
+             "Return a typed array of the elements of array from start (default 0) up to "
+             "end (default the length). The slice shares memory with array, so "
+             "nothing is copied and writes to one are seen by the other.")
+    },
+    {
+        "tarray/copy-bytes", cfun_typed_array_copy_bytes,
+        JDOC("(tarray/copy-bytes src sindex dst dindex &opt count)\n\n"
+             "Copy count elements (default 1) of src starting at index sindex to dst "
+             "starting at index dindex. The arrays must have the same element size and "
+             "may overlap.")
+    },
+    {
+        "tarray/sum", cfun_typed_array_sum,
+        JDOC("(tarray/sum array)\n\n"
+             "Return the sum of the elements of a typed array as a number.")
+    },
+    {
+        "tarray/min", cfun_typed_array_min,
+        JDOC("(tarray/min array)\n\n"
+             "Return the smallest element of a typed array, or nil if it is empty. "
+             "NaNs are ignored unless every element is NaN.")
+    },
+    {
+        "tarray/max", cfun_typed_array_max,
+        JDOC("(tarray/max array)\n\n"
+             "Return the largest element of a typed array, or nil if it is empty. "
+             "NaNs are ignored unless every element is NaN.")
+    },
+    {
+        "tarray/dot", cfun_typed_array_dot,
+        JDOC("(tarray/dot a b)\n\n"
+             "Return the dot product of two typed arrays of the same length as a number.")
+    },
+    {
+        "tarray/sort", cfun_typed_array_sort,
+        JDOC("(tarray/sort array)\n\n"
+             "Sort the elements of a typed array in place in ascending order. NaNs sort "
+             "last. Returns array.")
+    },
+    {
+        "tarray/add", cfun_typed_array_add,
+        JDOC("(tarray/add array x)\n\n"
+             "Add x to every element of array in place. x is a number or a typed array of "
+             "the same type and length, which is added elementwise. Integer arithmetic "
+             "wraps around on overflow. Returns array.")
+    },
+    {
+        "tarray/sub", cfun_typed_array_sub,
+        JDOC("(tarray/sub array x)\n\n"
+             "Subtract x from every element of array in place. See tarray/add. Returns array.")
+    },
+    {
+        "tarray/mul", cfun_typed_array_mul,
+        JDOC("(tarray/mul array x)\n\n"
+             "Multiply every element of array by x in place. See tarray/add. Returns array.")
+    },
+    {
+        "tarray/div", cfun_typed_array_div,
+        JDOC("(tarray/div array x)\n\n"
+             "Divide every element of array by x in place. See tarray/add. Integer division "
+             "truncates, and raises an error on division by zero. Returns array.")
+    },
+    {NULL, NULL, NULL}
+};
+
+/* Module entry point */
+void janet_lib_typed_array(JanetTable *env) {
+    janet_core_cfuns(env, NULL, ta_cfuns);
+    janet_register_abstract_type(&janet_ta_buffer_type);
+    janet_register_abstract_type(&janet_ta_view_type);
+}
+
+#endif
@@ -102,7 +102,78 @@ const char *const janet_status_names[16] = {
     "alive"
 };
 
-#ifndef JANET_PRF
+#ifdef JANET_FAST_HASH
+
+/*
+  Hash in the style of wyhash - mix 16 bytes at a time by folding
+  a 64x64->128 bit multiply. With JANET_PRF the seed is the random hash key,
+  otherwise it is zero.
+*/
+
+#define JANET_HASH_P0 UINT64_C(0xa0761d6478bd642f)
+#define JANET_HASH_P1 UINT64_C(0xe7037ed1a0b428db)
+#define JANET_HASH_P2 UINT64_C(0x8ebc6af09c88c6e3)
+
+static uint64_t janet_hash_mum(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t) a, lb = (uint32_t) b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif
+}
+
+static uint64_t janet_hash_read8(const uint8_t *p) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static uint64_t janet_hash_read4(const uint8_t *p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static uint32_t janet_fasthash(const uint8_t *in, size_t len, uint64_t seed) {
+    uint64_t a, b;
+    seed ^= JANET_HASH_P0;
+    if (len <= 16) {
+        if (len >= 4) {
+            /* Overlapping reads cover 4 to 16 bytes */
+            size_t off = (len >> 3) << 2;
+            a = (janet_hash_read4(in) << 32) | janet_hash_read4(in + off);
+            b = (janet_hash_read4(in + len - 4) << 32) | janet_hash_read4(in + len - 4 - off);
+        } else if (len > 0) {
+            a = ((uint64_t) in[0] << 16) | ((uint64_t) in[len >> 1] << 8) | in[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        while (i > 16) {
+            seed = janet_hash_mum(janet_hash_read8(in) ^ JANET_HASH_P1, janet_hash_read8(in + 8) ^ seed);
+            in += 16;
+            i -= 16;
+        }
+        a = janet_hash_read8(in + i - 16);
+        b = janet_hash_read8(in + i - 8);
+    }
+    uint64_t h = janet_hash_mum(JANET_HASH_P1 ^ len, janet_hash_mum(a ^ JANET_HASH_P1, b ^ seed ^ JANET_HASH_P2));
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+#endif
+
+#if !defined(JANET_PRF) && !defined(JANET_FAST_HASH)
 
 int32_t janet_string_calchash(const uint8_t *str, int32_t len) {
     const uint8_t *end = str + len;
@@ -112,8 +183,16 @@ int32_t janet_string_calchash(const uint8_t *str, int32_t len) {
     return (int32_t) hash;
 }
 
+#elif !defined(JANET_PRF)
+
+int32_t janet_string_calchash(const uint8_t *str, int32_t len) {
+    return (int32_t) janet_fasthash(str, (size_t) len, 0);
+}
+
 #else
 
+#ifndef JANET_FAST_HASH
+
 /*
   Public domain siphash implementation sourced from:
 
@@ -208,6 +287,8 @@ static uint32_t halfsiphash(const uint8_t *in, const size_t inlen, const uint8_t
 }
 /* end of siphash */
 
+#endif
+
 static uint8_t hash_key[JANET_HASH_KEY_SIZE] = {0};
 
 void janet_init_hash_key(uint8_t new_key[JANET_HASH_KEY_SIZE]) {
@@ -218,7 +299,11 @@ void janet_init_hash_key(uint8_t new_key[JANET_HASH_KEY_SIZE]) {
 
 int32_t janet_string_calchash(const uint8_t *str, int32_t len) {
     uint32_t hash;
+#ifdef JANET_FAST_HASH
+    hash = janet_fasthash(str, (size_t) len, janet_hash_read8(hash_key) ^ janet_hash_read8(hash_key + 8));
+#else
     hash = halfsiphash(str, len, hash_key);
+#endif
     return (int32_t)hash;
 }
 
@@ -545,6 +630,12 @@ int janet_bytes_view(Janet str, const uint8_t **data, int32_t *len) {
         *data = janet_unwrap_buffer(str)->data;
         *len = janet_unwrap_buffer(str)->count;
         return 1;
+    } else if (janet_checkabstract(str, &janet_mmap_type)) {
+        return janet_mmap_bytes(janet_unwrap_abstract(str), data, len);
+#ifdef JANET_THREADS
+    } else if (janet_checkabstract(str, &janet_shared_type)) {
+        return janet_shared_bytes(janet_unwrap_abstract(str), data, len);
+#endif
     }
     return 0;
 }
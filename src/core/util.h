@@ -74,6 +74,26 @@ void janet_memempty(JanetKV *mem, int32_t count);
 void *janet_memalloc_empty(int32_t count);
 JanetTable *janet_get_core_table(const char *name);
 void janet_def_addflags(JanetFuncDef *def);
+void janet_def_materialize(JanetFuncDef *def);
+void janet_def_lazy_mark(JanetFuncDef *def);
+void janet_bytecode_specialize(JanetFuncDef *def);
+void janet_bytecode_optimize(JanetFuncDef *def);
+
+/* Baseline JIT */
+#ifdef JANET_JIT
+#ifndef JANET_JIT_THRESHOLD
+#define JANET_JIT_THRESHOLD 1000
+#endif
+typedef struct {
+    uint8_t *code;
+    size_t size;
+    int32_t entry[]; /* Offset of each instruction in code, or -1 if it is not translated */
+} JanetJit;
+void janet_jit_compile(JanetFuncDef *def);
+void janet_jit_free(JanetFuncDef *def);
+int32_t janet_jit_run(JanetJit *jit, Janet *stack, JanetFunction *func, int32_t at);
+#endif
+
 const void *janet_strbinsearch(
     const void *tab,
     size_t tabcount,
@@ -85,6 +105,16 @@ void janet_buffer_format(
     int32_t argstart,
     int32_t argc,
     Janet *argv);
+extern const JanetAbstractType janet_formatter_type;
+Janet janet_formatter(const uint8_t *format);
+void janet_buffer_format_compiled(
+    JanetBuffer *b,
+    void *formatter,
+    int32_t argstart,
+    int32_t argc,
+    Janet *argv);
+void janet_buffer_format_arg(JanetBuffer *b, int32_t n, int32_t argc, Janet *argv);
+int janet_double_to_shortest(char *out, double x);
 Janet janet_next_impl(Janet ds, Janet key, int is_interpreter);
 
 /* Inside the janet core, defining globals is different
@@ -111,6 +141,8 @@ int janet_gettime(struct timespec *spec);
 
 /* Initialize builtin libraries */
 void janet_lib_io(JanetTable *env);
+extern const JanetAbstractType janet_mmap_type;
+int janet_mmap_bytes(void *abstract, const uint8_t **data, int32_t *len);
 void janet_lib_math(JanetTable *env);
 void janet_lib_array(JanetTable *env);
 void janet_lib_tuple(JanetTable *env);
@@ -135,8 +167,19 @@ void janet_lib_typed_array(JanetTable *env);
 #ifdef JANET_INT_TYPES
 void janet_lib_inttypes(JanetTable *env);
 #endif
+#ifdef JANET_PERSISTENT
+void janet_lib_persistent(JanetTable *env);
+#endif
+#ifdef JANET_JSON
+void janet_lib_json(JanetTable *env);
+#endif
 #ifdef JANET_THREADS
 void janet_lib_thread(JanetTable *env);
+extern const JanetAbstractType janet_shared_type;
+int janet_shared_bytes(void *abstract, const uint8_t **data, int32_t *len);
+#endif
+#ifdef JANET_TLS
+void janet_lib_tls(JanetTable *env);
 #endif
 #ifdef JANET_NET
 void janet_lib_net(JanetTable *env);
@@ -146,6 +189,19 @@ extern const JanetAbstractType janet_address_type;
 void janet_lib_ev(JanetTable *env);
 void janet_ev_mark(void);
 int janet_make_pipe(JanetHandle handles[2], int mode);
+JanetAbstract janet_ev_external_channel(void (*on_wait)(void));
+void janet_ev_channel_feed(JanetAbstract channel, Janet x);
+int janet_ev_channel_take(JanetAbstract channel, Janet *out);
+void janet_ev_channel_wait(JanetAbstract channel);
+int32_t janet_ev_channel_readers(JanetAbstract channel);
+JanetTuple janet_ev_getparts(const Janet *argv, int32_t n);
+int janet_stream_coalesce(JanetStream *stream, Janet data, double to);
+#ifdef JANET_EV_URING
+struct iovec;
+JanetListenerState *janet_uring_listen(JanetStream *stream, JanetListener behavior, int mask, size_t size, void *user);
+void janet_uring_submit(JanetListenerState *state, int opcode, int32_t size, const struct iovec *iov, int niov, int flags);
+#endif
 #endif
+JanetBuffer *janet_optbuffer_pooled(const Janet *argv, int32_t argc, int32_t n, Janet size);
 
 #endif
@@ -66,9 +66,9 @@ static void push_traversal_node(void *lhs, void *rhs, int32_t index2) {
  * 2 - no next node found
  * 3 - early stop - lhs > rhs
  */
-static int traversal_next(Janet *x, Janet *y) {
+static int traversal_next(Janet *x, Janet *y, size_t floor) {
     JanetTraversalNode *t = janet_vm_traversal;
-    while (t && t > janet_vm_traversal_base) {
+    while (t && t > janet_vm_traversal_base + floor) {
         JanetGCObject *self = t->self;
         JanetTupleHead *tself = (JanetTupleHead *)self;
         JanetStructHead *sself = (JanetStructHead *)self;
@@ -124,19 +124,21 @@ Janet janet_next_impl(Janet ds, Janet key, int is_interpreter) {
     switch (t) {
         default:
             janet_panicf("expected iterable type, got %v", ds);
-        case JANET_TABLE:
-        case JANET_STRUCT: {
-            const JanetKV *start;
-            int32_t cap;
-            if (t == JANET_TABLE) {
-                JanetTable *tab = janet_unwrap_table(ds);
-                cap = tab->capacity;
-                start = tab->data;
-            } else {
-                JanetStruct st = janet_unwrap_struct(ds);
-                cap = janet_struct_capacity(st);
-                start = st;
+        case JANET_TABLE: {
+            JanetTable *tab = janet_unwrap_table(ds);
+            const JanetKV *kv = NULL;
+            if (!janet_checktype(key, JANET_NIL)) {
+                kv = janet_table_find(tab, key);
+                if (NULL == kv) break;
             }
+            kv = janet_table_next(tab, kv);
+            if (NULL != kv) return kv->key;
+            break;
+        }
+        case JANET_STRUCT: {
+            JanetStruct st = janet_unwrap_struct(ds);
+            int32_t cap = janet_struct_capacity(st);
+            const JanetKV *start = st;
             const JanetKV *end = start + cap;
             const JanetKV *kv = janet_checktype(key, JANET_NIL)
                                 ? start
@@ -238,8 +240,13 @@ static int janet_compare_abstract(JanetAbstract xx, JanetAbstract yy) {
     return xt->compare(xx, yy);
 }
 
-int janet_equals(Janet x, Janet y) {
-    janet_vm_traversal = janet_vm_traversal_base;
+/* Start a traversal above any traversal in progress, so abstract types
+ * can compare their contents from inside another comparison. */
+static size_t traversal_floor(void) {
+    return janet_vm_traversal ? (size_t)(janet_vm_traversal - janet_vm_traversal_base) : 0;
+}
+
+static int janet_equals_impl(Janet x, Janet y, size_t floor) {
     do {
         if (janet_type(x) != janet_type(y)) return 0;
         switch (janet_type(x)) {
@@ -281,10 +288,17 @@ int janet_equals(Janet x, Janet y) {
             }
             break;
         }
-    } while (!traversal_next(&x, &y));
+    } while (!traversal_next(&x, &y, floor));
     return 1;
 }
 
+int janet_equals(Janet x, Janet y) {
+    size_t floor = traversal_floor();
+    int ret = janet_equals_impl(x, y, floor);
+    janet_vm_traversal = janet_vm_traversal_base + floor;
+    return ret;
+}
+
 /* Computes a hash value for a function */
 int32_t janet_hash(Janet x) {
     int32_t hash = 0;
@@ -346,8 +360,7 @@ int32_t janet_hash(Janet x) {
 /* Compares x to y. If they are equal returns 0. If x is less, returns -1.
  * If y is less, returns 1. All types are comparable
  * and should have strict ordering, excepts NaNs. */
-int janet_compare(Janet x, Janet y) {
-    janet_vm_traversal = janet_vm_traversal_base;
+static int janet_compare_impl(Janet x, Janet y, size_t floor) {
     int status;
     do {
         JanetType tx = janet_type(x);
@@ -410,10 +423,17 @@ int janet_compare(Janet x, Janet y) {
                 break;
             }
         }
-    } while (!(status = traversal_next(&x, &y)));
+    } while (!(status = traversal_next(&x, &y, floor)));
     return status - 2;
 }
 
+int janet_compare(Janet x, Janet y) {
+    size_t floor = traversal_floor();
+    int ret = janet_compare_impl(x, y, floor);
+    janet_vm_traversal = janet_vm_traversal_base + floor;
+    return ret;
+}
+
 static int32_t getter_checkint(Janet key, int32_t max) {
     if (!janet_checkint(key)) goto bad;
     int32_t ret = janet_unwrap_integer(key);
@@ -672,6 +692,7 @@ void janet_putindex(Janet ds, int32_t index, Janet value) {
                          JANET_TFLAG_ARRAY | JANET_TFLAG_BUFFER | JANET_TFLAG_TABLE, ds);
         case JANET_ARRAY: {
             JanetArray *array = janet_unwrap_array(ds);
+            janet_gc_barrier(array);
             if (index >= array->count) {
                 janet_array_ensure(array, index + 1, 2);
                 array->count = index + 1;
@@ -715,6 +736,7 @@ void janet_put(Janet ds, Janet key, Janet value) {
         case JANET_ARRAY: {
             JanetArray *array = janet_unwrap_array(ds);
             int32_t index = getter_checkint(key, INT32_MAX - 1);
+            janet_gc_barrier(array);
             if (index >= array->count) {
                 janet_array_setcount(array, index + 1);
             }
@@ -42,6 +42,55 @@ JANET_THREAD_LOCAL JanetFiber *janet_vm_fiber = NULL;
 JANET_THREAD_LOCAL JanetFiber *janet_vm_root_fiber = NULL;
 JANET_THREAD_LOCAL Janet *janet_vm_return_reg = NULL;
 JANET_THREAD_LOCAL jmp_buf *janet_vm_jmp_buf = NULL;
+JANET_THREAD_LOCAL uint32_t janet_vm_table_epoch = 0;
+
+/* Inline caches for lookups that go through table prototypes, keyed on the
+ * instruction doing the lookup and the prototype of the table. */
+#define JANET_VM_INLINE_CACHE_SIZE 256
+typedef struct {
+    const uint32_t *pc;
+    JanetTable *proto;
+    const void *key;
+    Janet value;
+    uint32_t epoch;
+} JanetInlineCache;
+static JANET_THREAD_LOCAL JanetInlineCache janet_vm_inline_cache[JANET_VM_INLINE_CACHE_SIZE];
+
+/* Same as janet_table_get, but remember where keys that are not in the
+ * table itself were found in its prototypes. */
+static Janet vm_table_get_cached(const uint32_t *pc, JanetTable *t, Janet key) {
+    JanetKV *bucket = janet_table_find(t, key);
+    if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL))
+        return bucket->value;
+    if (NULL == t->proto)
+        return janet_wrap_nil();
+    /* Only interned keys can be compared by address */
+    if (!janet_checktypes(key, JANET_TFLAG_SYMBOL | JANET_TFLAG_KEYWORD))
+        return janet_table_get(t, key);
+    JanetInlineCache *ic = janet_vm_inline_cache +
+                           (((uintptr_t) pc >> 2) & (JANET_VM_INLINE_CACHE_SIZE - 1));
+    if (ic->pc == pc && ic->proto == t->proto &&
+            ic->epoch == janet_vm_table_epoch && ic->key == janet_unwrap_pointer(key))
+        return ic->value;
+    /* Flag every prototype looked at, so changing one invalidates the cache */
+    Janet value = janet_wrap_nil();
+    int i;
+    JanetTable *proto;
+    for (i = JANET_MAX_PROTO_DEPTH, proto = t->proto; proto && i; proto = proto->proto, --i) {
+        proto->gc.flags |= JANET_TABLE_FLAG_CACHED;
+        bucket = janet_table_find(proto, key);
+        if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL)) {
+            value = bucket->value;
+            break;
+        }
+    }
+    ic->pc = pc;
+    ic->proto = t->proto;
+    ic->key = janet_unwrap_pointer(key);
+    ic->value = value;
+    ic->epoch = janet_vm_table_epoch;
+    return value;
+}
 
 /* Virtual registers
  *
@@ -102,11 +151,59 @@ JANET_THREAD_LOCAL jmp_buf *janet_vm_jmp_buf = NULL;
 
 /* Next instruction variations */
 #define maybe_collect() do {\
-    if (janet_vm_next_collection >= janet_vm_gc_interval) janet_collect(); } while (0)
+    if (janet_vm_next_collection >= janet_vm_gc_interval || \
+            janet_vm_next_collection >= janet_vm_gc_next_step) janet_collect_auto(); } while (0)
 #define vm_checkgc_next() maybe_collect(); vm_next()
 #define vm_pcnext() pc++; vm_next()
 #define vm_checkgc_pcnext() maybe_collect(); vm_pcnext()
 
+/* Report calls and returns, see debug/instrument */
+#ifdef JANET_INSTRUMENT
+#define vm_instrument_enter() do { \
+    if (janet_vm_instrument) janet_instrument_enter(fiber, func); \
+} while (0)
+#define vm_instrument_exit() do { \
+    if (janet_vm_instrument) janet_instrument_exit(fiber); \
+} while (0)
+#else
+#define vm_instrument_enter() do {} while (0)
+#define vm_instrument_exit() do {} while (0)
+#endif
+
+/* Take a profiler sample, see profile/start */
+#define vm_maybe_sample() do { \
+    if (janet_vm_profile_tick) { \
+        vm_commit(); \
+        janet_profile_sample(fiber); \
+    } \
+} while (0)
+
+/* Run native code for the current function if it has any. vm_jit_enter
+ * also counts towards compiling the function, and is used on function
+ * entry and backwards jumps. vm_jit_resume is used after calls return. */
+#ifdef JANET_JIT
+#define vm_jit_run(def) do { \
+    JanetJit *_jit = (def)->jit; \
+    int32_t _at = (int32_t)(pc - (def)->bytecode); \
+    if (_jit->entry[_at] >= 0) pc = (def)->bytecode + janet_jit_run(_jit, stack, func, _at); \
+} while (0)
+#define vm_jit_enter() do { \
+    JanetFuncDef *_def = func->def; \
+    if (NULL != _def->jit) { \
+        vm_jit_run(_def); \
+    } else if (_def->hotness < JANET_JIT_THRESHOLD && ++_def->hotness == JANET_JIT_THRESHOLD) { \
+        janet_jit_compile(_def); \
+    } \
+} while (0)
+#define vm_jit_resume() do { \
+    JanetFuncDef *_def = func->def; \
+    if (NULL != _def->jit) vm_jit_run(_def); \
+} while (0)
+#else
+#define vm_jit_enter() do {} while (0)
+#define vm_jit_resume() do {} while (0)
+#endif
+
 /* Handle certain errors in main vm loop */
 #define vm_throw(e) do { vm_commit(); janet_panic(e); } while (0)
 #define vm_assert(cond, e) do {if (!(cond)) vm_throw((e)); } while (0)
@@ -170,6 +267,15 @@ JANET_THREAD_LOCAL jmp_buf *janet_vm_jmp_buf = NULL;
         }\
     }
 #define vm_binop(op) _vm_binop(op, janet_wrap_number)
+/* Only emitted when both operands are known to be numbers, see
+ * janet_bytecode_specialize. */
+#define vm_numop(op)\
+    {\
+        double x1 = janet_unwrap_number(stack[B]);\
+        double x2 = janet_unwrap_number(stack[C]);\
+        stack[A] = janet_wrap_number(x1 op x2);\
+        vm_pcnext();\
+    }
 #define _vm_bitop(op, type1)\
     {\
         Janet op1 = stack[B];\
@@ -202,6 +308,46 @@ JANET_THREAD_LOCAL jmp_buf *janet_vm_jmp_buf = NULL;
             vm_checkgc_pcnext();\
         }\
     }
+/* Superinstructions that in the common case also run the jump after them.
+ * The compiler only emits them in front of a jump, but the jump is still
+ * checked, so breakpoints set on it are not skipped. */
+#define vm_branch(cond) \
+    {\
+        int _cond = (cond);\
+        uint32_t _next = pc[1];\
+        stack[A] = janet_wrap_boolean(_cond);\
+        if ((_next & 0xFFFF) == ((*pc & 0xFF00) | JOP_JUMP_IF_NOT)) {\
+            pc += _cond ? 2 : 1 + ((int32_t) _next >> 16);\
+        } else if ((_next & 0xFFFF) == ((*pc & 0xFF00) | JOP_JUMP_IF)) {\
+            pc += _cond ? 1 + ((int32_t) _next >> 16) : 2;\
+        } else {\
+            pc++;\
+        }\
+        vm_next();\
+    }
+#define vm_compop_jump(op) \
+    {\
+        Janet op1 = stack[B];\
+        Janet op2 = stack[C];\
+        if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {\
+            vm_branch(janet_unwrap_number(op1) op janet_unwrap_number(op2));\
+        } else {\
+            vm_commit();\
+            stack[A] = janet_wrap_boolean(janet_compare(op1, op2) op 0);\
+            vm_checkgc_pcnext();\
+        }\
+    }
+#define vm_compop_imm_jump(op) \
+    {\
+        Janet op1 = stack[B];\
+        if (janet_checktype(op1, JANET_NUMBER)) {\
+            vm_branch(janet_unwrap_number(op1) op (double) CS);\
+        } else {\
+            vm_commit();\
+            stack[A] = janet_wrap_boolean(janet_compare(op1, janet_wrap_integer(CS)) op 0);\
+            vm_checkgc_pcnext();\
+        }\
+    }
 #define vm_compop_imm(op) \
     {\
         Janet op1 = stack[B];\
@@ -281,10 +427,13 @@ static Janet method_to_fun(Janet method, Janet obj) {
 }
 
 /* Get a callable from a keyword method name and ensure that it is valid. */
-static Janet resolve_method(Janet name, JanetFiber *fiber) {
+static Janet resolve_method(Janet name, JanetFiber *fiber, const uint32_t *pc) {
     int32_t argc = fiber->stacktop - fiber->stackstart;
     if (argc < 1) janet_panicf("method call (%v) takes at least 1 argument, got 0", name);
-    Janet callee = method_to_fun(name, fiber->data[fiber->stackstart]);
+    Janet self = fiber->data[fiber->stackstart];
+    Janet callee = janet_checktype(self, JANET_TABLE)
+                   ? vm_table_get_cached(pc, janet_unwrap_table(self), name)
+                   : method_to_fun(name, self);
     if (janet_checktype(callee, JANET_NIL))
         janet_panicf("unknown method %v invoked on %v", name, fiber->data[fiber->stackstart]);
     return callee;
@@ -399,17 +548,17 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         &&label_JOP_NOT_EQUALS,
         &&label_JOP_NOT_EQUALS_IMMEDIATE,
         &&label_JOP_CANCEL,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
+        &&label_JOP_LESS_THAN_JUMP,
+        &&label_JOP_LESS_THAN_IMMEDIATE_JUMP,
+        &&label_JOP_LESS_THAN_EQUAL_JUMP,
+        &&label_JOP_GREATER_THAN_JUMP,
+        &&label_JOP_GREATER_THAN_IMMEDIATE_JUMP,
+        &&label_JOP_GREATER_THAN_EQUAL_JUMP,
+        &&label_JOP_ADD_IMMEDIATE_JUMP,
+        &&label_JOP_ADD_NUMBER,
+        &&label_JOP_SUBTRACT_NUMBER,
+        &&label_JOP_MULTIPLY_NUMBER,
+        &&label_JOP_DIVIDE_NUMBER,
         &&label_unknown_op,
         &&label_unknown_op,
         &&label_unknown_op,
@@ -644,26 +793,57 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_RETURN) {
         Janet retval = stack[D];
         int entrance_frame = janet_stack_frame(stack)->flags & JANET_STACKFRAME_ENTRANCE;
+        vm_instrument_exit();
         janet_fiber_popframe(fiber);
         if (entrance_frame) vm_return_no_restore(JANET_SIGNAL_OK, retval);
         vm_restore();
         stack[A] = retval;
-        vm_checkgc_pcnext();
+        pc++;
+        vm_maybe_sample();
+        vm_jit_resume();
+        vm_checkgc_next();
     }
 
     VM_OP(JOP_RETURN_NIL) {
         Janet retval = janet_wrap_nil();
         int entrance_frame = janet_stack_frame(stack)->flags & JANET_STACKFRAME_ENTRANCE;
+        vm_instrument_exit();
         janet_fiber_popframe(fiber);
         if (entrance_frame) vm_return_no_restore(JANET_SIGNAL_OK, retval);
         vm_restore();
         stack[A] = retval;
-        vm_checkgc_pcnext();
+        pc++;
+        vm_maybe_sample();
+        vm_jit_resume();
+        vm_checkgc_next();
     }
 
     VM_OP(JOP_ADD_IMMEDIATE)
     vm_binop_immediate(+);
 
+    VM_OP(JOP_ADD_IMMEDIATE_JUMP) {
+        Janet op1 = stack[B];
+        if (janet_checktype(op1, JANET_NUMBER)) {
+            uint32_t next = pc[1];
+            stack[A] = janet_wrap_number(janet_unwrap_number(op1) + CS);
+            if ((next & 0xFF) == JOP_JUMP) {
+                int32_t offset = (int32_t) next >> 8;
+                pc += 1 + offset;
+                if (offset < 0) {
+                    vm_maybe_sample();
+                    vm_jit_enter();
+                }
+            } else {
+                pc++;
+            }
+            vm_next();
+        }
+        vm_commit();
+        Janet _argv[2] = { op1, janet_wrap_number(CS) };
+        stack[A] = janet_mcall("+", 2, _argv);
+        vm_checkgc_pcnext();
+    }
+
     VM_OP(JOP_ADD)
     vm_binop(+);
 
@@ -682,6 +862,18 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_DIVIDE)
     vm_binop( /);
 
+    VM_OP(JOP_ADD_NUMBER)
+    vm_numop(+);
+
+    VM_OP(JOP_SUBTRACT_NUMBER)
+    vm_numop(-);
+
+    VM_OP(JOP_MULTIPLY_NUMBER)
+    vm_numop(*);
+
+    VM_OP(JOP_DIVIDE_NUMBER)
+    vm_numop( /);
+
     VM_OP(JOP_MODULO) {
         Janet op1 = stack[B];
         Janet op2 = stack[C];
@@ -755,9 +947,15 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     stack[E] = stack[A];
     vm_pcnext();
 
-    VM_OP(JOP_JUMP)
-    pc += DS;
-    vm_next();
+    VM_OP(JOP_JUMP) {
+        int32_t offset = DS;
+        pc += offset;
+        if (offset < 0) {
+            vm_maybe_sample();
+            vm_jit_enter();
+        }
+        vm_next();
+    }
 
     VM_OP(JOP_JUMP_IF)
     if (janet_truthy(stack[A])) {
@@ -809,6 +1007,24 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_GREATER_THAN_IMMEDIATE)
     vm_compop_imm( >);
 
+    VM_OP(JOP_LESS_THAN_JUMP)
+    vm_compop_jump( <);
+
+    VM_OP(JOP_LESS_THAN_EQUAL_JUMP)
+    vm_compop_jump( <=);
+
+    VM_OP(JOP_LESS_THAN_IMMEDIATE_JUMP)
+    vm_compop_imm_jump( <);
+
+    VM_OP(JOP_GREATER_THAN_JUMP)
+    vm_compop_jump( >);
+
+    VM_OP(JOP_GREATER_THAN_EQUAL_JUMP)
+    vm_compop_jump( >=);
+
+    VM_OP(JOP_GREATER_THAN_IMMEDIATE_JUMP)
+    vm_compop_imm_jump( >);
+
     VM_OP(JOP_EQUALS)
     stack[A] = janet_wrap_boolean(janet_equals(stack[B], stack[C]));
     vm_pcnext();
@@ -892,8 +1108,10 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         vm_assert(env->length > vindex, "invalid upvalue index");
         vm_assert(janet_env_valid(env), "invalid upvalue environment");
         if (env->offset > 0) {
+            janet_gc_barrier(env->as.fiber);
             env->as.fiber->data[env->offset + vindex] = stack[A];
         } else {
+            janet_gc_barrier(env);
             env->as.values[vindex] = stack[A];
         }
         vm_pcnext();
@@ -905,6 +1123,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         int32_t elen;
         int32_t defindex = (int32_t)E;
         vm_assert(defindex < func->def->defs_length, "invalid funcdef");
+        vm_commit();
         fd = func->def->defs[defindex];
         elen = fd->environments_length;
         fn = janet_gcalloc(JANET_MEMORY_FUNCTION, sizeof(JanetFunction) + ((size_t) elen * sizeof(JanetFuncEnv *)));
@@ -967,7 +1186,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         }
         if (janet_checktype(callee, JANET_KEYWORD)) {
             vm_commit();
-            callee = resolve_method(callee, fiber);
+            callee = resolve_method(callee, fiber, pc);
         }
         if (janet_checktype(callee, JANET_FUNCTION)) {
             func = janet_unwrap_function(callee);
@@ -980,8 +1199,11 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
                 janet_panicf("%v called with %d argument%s, expected %d",
                              callee, n, n == 1 ? "" : "s", func->def->arity);
             }
+            vm_instrument_enter();
             stack = fiber->data + fiber->frame;
             pc = func->def->bytecode;
+            vm_maybe_sample();
+            vm_jit_enter();
             vm_checkgc_next();
         } else if (janet_checktype(callee, JANET_CFUNCTION)) {
             vm_commit();
@@ -991,7 +1213,10 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             janet_fiber_popframe(fiber);
             stack = fiber->data + fiber->frame;
             stack[A] = ret;
-            vm_checkgc_pcnext();
+            pc++;
+            vm_maybe_sample();
+            vm_jit_resume();
+            vm_checkgc_next();
         } else {
             vm_commit();
             stack[A] = call_nonfn(fiber, callee);
@@ -1006,21 +1231,25 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         }
         if (janet_checktype(callee, JANET_KEYWORD)) {
             vm_commit();
-            callee = resolve_method(callee, fiber);
+            callee = resolve_method(callee, fiber, pc);
         }
         if (janet_checktype(callee, JANET_FUNCTION)) {
             func = janet_unwrap_function(callee);
             if (func->gc.flags & JANET_FUNCFLAG_TRACE) {
                 vm_do_trace(func, fiber->stacktop - fiber->stackstart, fiber->data + fiber->stackstart);
             }
+            vm_instrument_exit();
             if (janet_fiber_funcframe_tail(fiber, func)) {
                 janet_stack_frame(fiber->data + fiber->frame)->pc = pc;
                 int32_t n = fiber->stacktop - fiber->stackstart;
                 janet_panicf("%v called with %d argument%s, expected %d",
                              callee, n, n == 1 ? "" : "s", func->def->arity);
             }
+            vm_instrument_enter();
             stack = fiber->data + fiber->frame;
             pc = func->def->bytecode;
+            vm_maybe_sample();
+            vm_jit_enter();
             vm_checkgc_next();
         } else {
             Janet retreg;
@@ -1034,6 +1263,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             } else {
                 retreg = call_nonfn(fiber, callee);
             }
+            vm_instrument_exit();
             janet_fiber_popframe(fiber);
             if (entrance_frame) {
                 vm_return_no_restore(JANET_SIGNAL_OK, retreg);
@@ -1119,12 +1349,20 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
 
     VM_OP(JOP_IN)
     vm_commit();
-    stack[A] = janet_in(stack[B], stack[C]);
+    if (janet_checktype(stack[B], JANET_TABLE)) {
+        stack[A] = vm_table_get_cached(pc, janet_unwrap_table(stack[B]), stack[C]);
+    } else {
+        stack[A] = janet_in(stack[B], stack[C]);
+    }
     vm_pcnext();
 
     VM_OP(JOP_GET)
     vm_commit();
-    stack[A] = janet_get(stack[B], stack[C]);
+    if (janet_checktype(stack[B], JANET_TABLE)) {
+        stack[A] = vm_table_get_cached(pc, janet_unwrap_table(stack[B]), stack[C]);
+    } else {
+        stack[A] = janet_get(stack[B], stack[C]);
+    }
     vm_pcnext();
 
     VM_OP(JOP_GET_INDEX)
@@ -1138,6 +1376,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     vm_pcnext();
 
     VM_OP(JOP_MAKE_ARRAY) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
         stack[D] = janet_wrap_array(janet_array_n(mem, count));
@@ -1148,6 +1387,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_MAKE_TUPLE)
     /* fallthrough */
     VM_OP(JOP_MAKE_BRACKET_TUPLE) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
         const Janet *tup = janet_tuple_n(mem, count);
@@ -1159,12 +1399,11 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     }
 
     VM_OP(JOP_MAKE_TABLE) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
-        if (count & 1) {
-            vm_commit();
+        if (count & 1)
             janet_panicf("expected even number of arguments to table constructor, got %d", count);
-        }
         JanetTable *table = janet_table(count / 2);
         for (int32_t i = 0; i < count; i += 2)
             janet_table_put(table, mem[i], mem[i + 1]);
@@ -1174,12 +1413,11 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     }
 
     VM_OP(JOP_MAKE_STRUCT) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
-        if (count & 1) {
-            vm_commit();
+        if (count & 1)
             janet_panicf("expected even number of arguments to struct constructor, got %d", count);
-        }
         JanetKV *st = janet_struct_begin(count / 2);
         for (int32_t i = 0; i < count; i += 2)
             janet_struct_put(st, mem[i], mem[i + 1]);
@@ -1189,6 +1427,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     }
 
     VM_OP(JOP_MAKE_STRING) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
         JanetBuffer buffer;
@@ -1202,6 +1441,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     }
 
     VM_OP(JOP_MAKE_BUFFER) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
         JanetBuffer *buffer = janet_buffer(10 * count);
@@ -1237,6 +1477,12 @@ JanetSignal janet_step(JanetFiber *fiber, Janet in, Janet *out) {
      * but for branching instructions it is also the target of the branch. */
     uint32_t *nexta = NULL, *nextb = NULL, olda = 0, oldb = 0;
 
+#ifdef JANET_JIT
+    /* Native code would run past the temporary breakpoints */
+    JanetFunction *func = janet_stack_frame(fiber->data + fiber->frame)->func;
+    if (NULL != func) janet_jit_free(func->def);
+#endif
+
     /* Set temporary breakpoints */
     switch (*pc & 0x7F) {
         default:
@@ -1302,6 +1548,9 @@ Janet janet_call(JanetFunction *fun, int32_t argc, const Janet *argv) {
         janet_panicf("arity mismatch in %v, expected at most %d, got %d", funv, max, argc);
     }
     janet_fiber_frame(janet_vm_fiber)->flags |= JANET_STACKFRAME_ENTRANCE;
+#ifdef JANET_INSTRUMENT
+    if (janet_vm_instrument) janet_instrument_enter(janet_vm_fiber, fun);
+#endif
 
     /* Set up */
     int32_t oldn = janet_vm_stackn++;
@@ -1364,6 +1613,9 @@ static JanetSignal janet_continue_no_check(JanetFiber *fiber, Janet in, Janet *o
 
     JanetFiberStatus old_status = janet_fiber_status(fiber);
 
+    /* The fiber's stack will be written to while it runs */
+    janet_gc_barrier(fiber);
+
 #ifdef JANET_EV
     janet_fiber_did_resume(fiber);
 #endif
@@ -1428,8 +1680,15 @@ static JanetSignal janet_continue_no_check(JanetFiber *fiber, Janet in, Janet *o
         if (janet_vm_root_fiber == NULL) janet_vm_root_fiber = fiber;
         janet_vm_fiber = fiber;
         janet_fiber_set_status(fiber, JANET_STATUS_ALIVE);
+#ifdef JANET_INSTRUMENT
+        if (janet_vm_instrument && old_status == JANET_STATUS_NEW && janet_fiber_frame(fiber)->func)
+            janet_instrument_enter(fiber, janet_fiber_frame(fiber)->func);
+#endif
         sig = run_vm(fiber, in);
     }
+#ifdef JANET_INSTRUMENT
+    if (janet_vm_instrument) janet_instrument_suspend(fiber);
+#endif
 
     /* Restore */
     if (janet_vm_root_fiber == fiber) janet_vm_root_fiber = NULL;
@@ -1473,7 +1732,7 @@ JanetSignal janet_pcall(
     if (f && *f) {
         fiber = janet_fiber_reset(*f, fun, argc, argv);
     } else {
-        fiber = janet_fiber(fun, 64, argc, argv);
+        fiber = janet_fiber(fun, JANET_STACK_INITIAL, argc, argv);
     }
     if (f) *f = fiber;
     if (!fiber) {
@@ -1483,6 +1742,97 @@ JanetSignal janet_pcall(
     return janet_continue(fiber, janet_wrap_nil(), out);
 }
 
+/* Call contexts keep a function and a fiber to run it on, so C code that
+ * calls the same function many times does not make a fiber per call. Both
+ * are rooted until janet_call_finish. */
+void janet_call_prepare(JanetCallContext *ctx, JanetFunction *fun) {
+    ctx->fun = fun;
+    ctx->fiber = janet_fiber(fun, JANET_STACK_INITIAL, fun->def->min_arity, NULL);
+    janet_gcroot(janet_wrap_function(fun));
+    janet_gcroot(janet_wrap_fiber(ctx->fiber));
+}
+
+void janet_call_finish(JanetCallContext *ctx) {
+    janet_gcunroot(janet_wrap_function(ctx->fun));
+    janet_gcunroot(janet_wrap_fiber(ctx->fiber));
+    ctx->fun = NULL;
+    ctx->fiber = NULL;
+}
+
+/* Run the context function once per argument list on the context fiber, in a
+ * single janet_try. Argument lists are the indexed values in args, or argc
+ * and argv when args is NULL. */
+static JanetSignal janet_call_run(JanetCallContext *ctx, int32_t count, const Janet *args,
+                                  int32_t argc, const Janet *argv, JanetArray *results, Janet *out) {
+    JanetFiber *fiber = ctx->fiber;
+    if (janet_fiber_status(fiber) == JANET_STATUS_ALIVE) {
+        *out = janet_cstringv("call context is already running");
+        return JANET_SIGNAL_ERROR;
+    }
+    if (janet_vm_stackn >= JANET_RECURSION_GUARD) {
+        *out = janet_cstringv("C stack recursed too deeply");
+        return JANET_SIGNAL_ERROR;
+    }
+    volatile int32_t i = 0;
+    JanetTryState tstate;
+    JanetSignal sig = janet_try(&tstate);
+    if (!sig) {
+        if (janet_vm_root_fiber == NULL) janet_vm_root_fiber = fiber;
+        janet_vm_fiber = fiber;
+        for (; i < count; i++) {
+            if (NULL != args && !janet_indexed_view(args[i], &argv, &argc))
+                janet_panicf("expected tuple or array of arguments, got %v", args[i]);
+            int bad_arity;
+            if (i == 0) {
+                /* Reset the whole fiber once. It stays alive, and so remembered by
+                 * the GC, for the whole batch, so later calls only reset the stack. */
+                bad_arity = NULL == janet_fiber_reset(fiber, ctx->fun, argc, argv);
+                janet_fiber_set_status(fiber, JANET_STATUS_ALIVE);
+            } else {
+                fiber->frame = 0;
+                fiber->stackstart = JANET_FRAME_SIZE;
+                fiber->stacktop = JANET_FRAME_SIZE;
+                fiber->flags |= JANET_FIBER_RESUME_NO_USEVAL | JANET_FIBER_RESUME_NO_SKIP;
+                janet_fiber_pushn(fiber, argv, argc);
+                bad_arity = janet_fiber_funcframe(fiber, ctx->fun);
+                if (!bad_arity) janet_fiber_frame(fiber)->flags |= JANET_STACKFRAME_ENTRANCE;
+            }
+            if (bad_arity)
+                janet_panicf("arity mismatch in %v, got %d arguments", janet_wrap_function(ctx->fun), argc);
+#ifdef JANET_INSTRUMENT
+            if (janet_vm_instrument) janet_instrument_enter(fiber, ctx->fun);
+#endif
+            sig = run_vm(fiber, janet_wrap_nil());
+            if (sig != JANET_SIGNAL_OK) break;
+            if (NULL != results) janet_array_push(results, tstate.payload);
+        }
+    }
+#ifdef JANET_INSTRUMENT
+    if (janet_vm_instrument) janet_instrument_suspend(fiber);
+#endif
+    if (janet_vm_root_fiber == fiber) janet_vm_root_fiber = NULL;
+    janet_fiber_set_status(fiber, sig);
+    janet_restore(&tstate);
+    fiber->last_value = tstate.payload;
+    *out = tstate.payload;
+    return sig;
+}
+
+/* Call the context function once, like janet_pcall but reusing the
+ * context fiber. */
+JanetSignal janet_call_invoke(JanetCallContext *ctx, int32_t argc, const Janet *argv, Janet *out) {
+    return janet_call_run(ctx, 1, NULL, argc, argv, NULL, out);
+}
+
+/* Call the context function on each of count argument tuples or arrays,
+ * entering the VM once for the whole batch. Results are pushed to results.
+ * Stops at the first call that does not return, and returns its signal
+ * with its payload in out. The index of that call is the number of results
+ * pushed. */
+JanetSignal janet_call_batch(JanetCallContext *ctx, int32_t count, const Janet *args, JanetArray *results, Janet *out) {
+    return janet_call_run(ctx, count, args, 0, NULL, results, out);
+}
+
 Janet janet_mcall(const char *name, int32_t argc, Janet *argv) {
     /* At least 1 argument */
     if (argc < 1) janet_panicf("method :%s expected at least 1 argument");
@@ -1502,7 +1852,40 @@ int janet_init(void) {
     janet_vm_next_collection = 0;
     janet_vm_gc_interval = 0x400000;
     janet_vm_block_count = 0;
+    janet_vm_old_blocks = NULL;
+    janet_vm_old_block_count = 0;
+    janet_vm_gc_old_limit = 0;
+    janet_vm_gc_minor_count = 0;
+    janet_vm_gc_major_count = 0;
+    janet_vm_gc_remembered = NULL;
+    janet_vm_gc_remembered_count = 0;
+    janet_vm_gc_remembered_capacity = 0;
+    janet_vm_gc_watched = NULL;
+    janet_vm_gc_watched_count = 0;
+    janet_vm_gc_watched_capacity = 0;
+    for (int i = 0; i < JANET_MEMORY_TYPE_COUNT; i++) {
+        janet_vm_gc_type_counts[i] = 0;
+    }
+    janet_vm_gc_freed = 0;
+    janet_vm_gc_pause_total = 0.0;
+    janet_vm_gc_pause_max = 0.0;
+    janet_vm_gc_pause_last = 0.0;
+#ifdef JANET_EV
+    janet_vm_gc_hook = NULL;
+    janet_vm_gc_hook_fiber = NULL;
+#endif
+    janet_vm_gc_incremental = 0;
+    janet_vm_gc_step_budget = 1000;
+    janet_vm_gc_next_step = SIZE_MAX;
+    janet_vm_gc_sweep_blocks = NULL;
+#ifndef JANET_NO_SLAB_ALLOCATOR
+    janet_vm_slab_chunks = NULL;
+    for (int i = 0; i < JANET_SLAB_CLASS_COUNT; i++) {
+        janet_vm_slab_free[i] = NULL;
+    }
+#endif
     janet_symcache_init();
+    janet_stack_pool_init();
     /* Initialize gc roots */
     janet_vm_roots = NULL;
     janet_vm_root_count = 0;
@@ -1524,6 +1907,14 @@ int janet_init(void) {
     janet_vm_core_env = NULL;
     /* Dynamic bindings */
     janet_vm_top_dyns = NULL;
+    /* Buffer pool */
+    janet_vm_buffer_pool = NULL;
+    /* Fiber-local keys */
+    janet_vm_fiber_locals = NULL;
+#ifdef JANET_INT_TYPES
+    /* Small integer boxes */
+    janet_vm_int_cache = NULL;
+#endif
     /* Seed RNG */
     janet_rng_seed(janet_default_rng(), 0);
     /* Fibers */
@@ -1544,7 +1935,12 @@ int janet_init(void) {
 
 /* Clear all memory associated with the VM */
 void janet_deinit(void) {
+    janet_profile_deinit();
+#ifdef JANET_INSTRUMENT
+    janet_instrument_deinit();
+#endif
     janet_clear_memory();
+    janet_stack_pool_deinit();
     janet_symcache_deinit();
     janet_free(janet_vm_roots);
     janet_vm_roots = NULL;
@@ -1554,6 +1950,11 @@ void janet_deinit(void) {
     janet_vm_abstract_registry = NULL;
     janet_vm_core_env = NULL;
     janet_vm_top_dyns = NULL;
+    janet_vm_buffer_pool = NULL;
+    janet_vm_fiber_locals = NULL;
+#ifdef JANET_INT_TYPES
+    janet_vm_int_cache = NULL;
+#endif
     janet_free(janet_vm_traversal_base);
     janet_vm_fiber = NULL;
     janet_vm_root_fiber = NULL;
@@ -177,11 +177,27 @@ extern "C" {
 #define JANET_TYPED_ARRAY
 #endif
 
+/* Enable or disable persistent maps and vectors */
+#ifndef JANET_NO_PERSISTENT
+#define JANET_PERSISTENT
+#endif
+
+/* Enable or disable the json module */
+#ifndef JANET_NO_JSON
+#define JANET_JSON
+#endif
+
 /* Enable or disable event loop */
 #if !defined(JANET_NO_EV) && !defined(__EMSCRIPTEN__)
 #define JANET_EV
 #endif
 
+/* Only one event loop backend is compiled in. IOCP and epoll take precedence
+ * over io_uring, so JANET_EV_URING is only defined when io_uring is used. */
+#if defined(JANET_EV_URING) && (defined(JANET_WINDOWS) || defined(JANET_EV_EPOLL))
+#undef JANET_EV_URING
+#endif
+
 /* Enable or disable networking */
 #if defined(JANET_EV) && !defined(JANET_NO_NET) && !defined(__EMSCRIPTEN__)
 #define JANET_NET
@@ -226,6 +242,16 @@ extern "C" {
 #define JANET_STACK_MAX 0x7fffffff
 #endif
 
+/* Number of stack slots a new fiber starts with. Stacks grow by doubling. */
+#ifndef JANET_STACK_INITIAL
+#define JANET_STACK_INITIAL 32
+#endif
+
+/* Number of fiber-local slots stored inline in each fiber */
+#ifndef JANET_FIBER_LOCALS
+#define JANET_FIBER_LOCALS 8
+#endif
+
 /* Use nanboxed values - uses 8 bytes per value instead of 12 or 16.
  * To turn of nanboxing, for debugging purposes or for certain
  * architectures (Nanboxing only tested on x86 and x64), comment out
@@ -246,6 +272,12 @@ extern "C" {
 #endif
 #endif
 
+/* Enable or disable the baseline JIT. Native code is only generated
+ * for nanboxed x86-64 linux for now. */
+#if defined(JANET_NANBOX_64) && defined(__x86_64__) && defined(__linux__) && !defined(JANET_NO_JIT)
+#define JANET_JIT
+#endif
+
 /* Runtime config constants */
 #ifdef JANET_NO_NANBOX
 #define JANET_NANBOX_BIT 0
@@ -508,10 +540,20 @@ typedef void *JanetAbstract;
 #define JANET_STREAM_CLOSED 0x1
 #define JANET_STREAM_SOCKET 0x2
 #define JANET_STREAM_IOCP 0x4
+#define JANET_STREAM_EDGE 0x8
+/* internal - used by the epoll backend to track edge triggered streams */
+#define JANET_STREAM_EDGE_REGISTERED 0x10
+#define JANET_STREAM_EDGE_READABLE 0x20
+#define JANET_STREAM_EDGE_WRITABLE 0x40
 #define JANET_STREAM_READABLE 0x200
 #define JANET_STREAM_WRITABLE 0x400
 #define JANET_STREAM_ACCEPTABLE 0x800
 #define JANET_STREAM_UDPSERVER 0x1000
+/* internal - used for write coalescing */
+#define JANET_STREAM_FLUSH_QUEUED 0x2000
+#define JANET_STREAM_CLOSE_PENDING 0x4000
+/* internal - used by the kqueue backend for streams whose handle is a process id */
+#define JANET_STREAM_PROCESS 0x8000
 
 typedef enum {
     JANET_ASYNC_EVENT_INIT,
@@ -551,6 +593,10 @@ struct JanetStream {
      * this constraint may be lifted later but allowing such would require more internal book keeping
      * for some implementations. You can read and write at the same time on the same stream, though. */
     int _mask;
+    /* internal - output held back by write coalescing (see ev/coalesce), and the
+     * size at which it is written out. A limit of 0 means writes are not coalesced. */
+    JanetBuffer *_wbuf;
+    int32_t _wlimit;
 };
 
 /* Interface for state machine based event loop */
@@ -563,6 +609,9 @@ struct JanetListenerState {
 #ifdef JANET_WINDOWS
     void *tag; /* Used to associate listeners with an overlapped structure */
     int bytes; /* Used to track how many bytes were transfered. */
+#elif defined(JANET_EV_URING)
+    void *tag; /* Used to associate listeners with an in-flight io_uring request */
+    int bytes; /* Used to pass the result of a completed request. */
 #endif
     /* internal */
     size_t _index;
@@ -844,6 +893,7 @@ struct JanetFiber {
     Janet *data; /* Dynamically resized stack memory */
     JanetFiber *child; /* Keep linked list of fibers for restarting pending fibers */
     Janet last_value; /* Last returned value from a fiber */
+    Janet locals[JANET_FIBER_LOCALS]; /* Fiber-local slots, see janet_fiber_local_key */
 #ifdef JANET_EV
     /* These fields are only relevant for fibers that are used as "root fibers" -
      * that is, fibers that are scheduled on the event loop and behave much like threads
@@ -852,6 +902,8 @@ struct JanetFiber {
     JanetListenerState *waiting;
     uint32_t sched_id; /* Increment everytime fiber is scheduled by event loop */
     void *supervisor_channel; /* Channel to push self to when complete */
+    void *timeout; /* Pending timeout for the current wait, cleared when scheduled */
+    void *deadline; /* Pending deadline checking this fiber (see ev/deadline) */
 #endif
 };
 
@@ -874,7 +926,8 @@ struct JanetStackFrame {
  * Should be constant across architectures */
 #define JANET_FRAME_SIZE 4
 
-/* A dynamic array type. */
+/* A dynamic array type. C code that stores a value directly into data (or into the
+ * data of a table) must call janet_gc_write_barrier on the array first. */
 struct JanetArray {
     JanetGCObject gc;
     int32_t count;
@@ -951,6 +1004,8 @@ struct JanetAbstractHead {
 #define JANET_FUNCDEF_FLAG_HASSOURCEMAP 0x800000
 #define JANET_FUNCDEF_FLAG_STRUCTARG 0x1000000
 #define JANET_FUNCDEF_FLAG_HASCLOBITSET 0x2000000
+#define JANET_FUNCDEF_FLAG_MAPPED 0x4000000
+#define JANET_FUNCDEF_FLAG_LAZY 0x10000000
 #define JANET_FUNCDEF_FLAG_TAG 0xFFFF
 
 /* Source mapping structure for a bytecode instruction */
@@ -982,6 +1037,13 @@ struct JanetFuncDef {
     int32_t bytecode_length;
     int32_t environments_length;
     int32_t defs_length;
+
+    /* Encoded body of a def that is not loaded yet, if JANET_FUNCDEF_FLAG_LAZY is set */
+    void *lazy;
+
+    /* Native code for hot functions, see jit.c */
+    void *jit;
+    uint32_t hotness;
 };
 
 /* A function environment */
@@ -1132,6 +1194,12 @@ typedef struct {
     Janet payload;
 } JanetTryState;
 
+/* For calling one function many times from C. See janet_call_prepare. */
+typedef struct {
+    JanetFunction *fun;
+    JanetFiber *fiber;
+} JanetCallContext;
+
 /* Thread types */
 #ifdef JANET_THREADS
 typedef struct JanetThread JanetThread;
@@ -1254,6 +1322,17 @@ enum JanetOpCode {
     JOP_NOT_EQUALS,
     JOP_NOT_EQUALS_IMMEDIATE,
     JOP_CANCEL,
+    JOP_LESS_THAN_JUMP,
+    JOP_LESS_THAN_IMMEDIATE_JUMP,
+    JOP_LESS_THAN_EQUAL_JUMP,
+    JOP_GREATER_THAN_JUMP,
+    JOP_GREATER_THAN_IMMEDIATE_JUMP,
+    JOP_GREATER_THAN_EQUAL_JUMP,
+    JOP_ADD_IMMEDIATE_JUMP,
+    JOP_ADD_NUMBER,
+    JOP_SUBTRACT_NUMBER,
+    JOP_MULTIPLY_NUMBER,
+    JOP_DIVIDE_NUMBER,
     JOP_INSTRUCTION_COUNT
 };
 
@@ -1337,9 +1416,15 @@ typedef JanetEVGenericMessage(*JanetThreadedSubroutine)(JanetEVGenericMessage ar
 /* Handler that is run in the main thread with the result of the JanetAsyncSubroutine */
 typedef void (*JanetThreadedCallback)(JanetEVGenericMessage return_value);
 
-/* API calls for quickly offloading some work in C to a new thread or thread pool. */
+/* API calls for quickly offloading some work in C to a thread pool. The pool has
+ * JANET_EV_POOL_SIZE (16 by default) workers, which can be changed at runtime with
+ * ev/set-pool-size. When every worker is busy, calls wait in a queue for one, so a
+ * subroutine that blocks for a long time holds up the calls behind it. These only
+ * panic if no worker thread can be started, in which case arguments is not freed. */
 JANET_API void janet_ev_threaded_call(JanetThreadedSubroutine fp, JanetEVGenericMessage arguments, JanetThreadedCallback cb);
 JANET_NO_RETURN JANET_API void janet_ev_threaded_await(JanetThreadedSubroutine fp, int tag, int argi, void *argp);
+JANET_API JanetHandle janet_ev_loop_handle(void);
+JANET_API void janet_ev_post(JanetHandle loop, JanetThreadedCallback cb, JanetEVGenericMessage msg);
 
 /* Callback used by janet_ev_threaded_await */
 JANET_API void janet_ev_default_threaded_callback(JanetEVGenericMessage return_value);
@@ -1356,7 +1441,9 @@ JANET_API void janet_ev_recvfrom(JanetStream *stream, JanetBuffer *buf, int32_t
 /* Write async to a stream */
 JANET_API void janet_ev_write_buffer(JanetStream *stream, JanetBuffer *buf);
 JANET_API void janet_ev_write_string(JanetStream *stream, JanetString str);
+JANET_API void janet_ev_write_parts(JanetStream *stream, JanetTuple parts);
 #ifdef JANET_NET
+JANET_API void janet_ev_send_parts(JanetStream *stream, JanetTuple parts, int flags);
 JANET_API void janet_ev_send_buffer(JanetStream *stream, JanetBuffer *buf, int flags);
 JANET_API void janet_ev_send_string(JanetStream *stream, JanetString str, int flags);
 JANET_API void janet_ev_sendto_buffer(JanetStream *stream, JanetBuffer *buf, void *dest, int flags);
@@ -1370,6 +1457,7 @@ extern JANET_API const JanetAbstractType janet_parser_type;
 JANET_API void janet_parser_init(JanetParser *parser);
 JANET_API void janet_parser_deinit(JanetParser *parser);
 JANET_API void janet_parser_consume(JanetParser *parser, uint8_t c);
+JANET_API size_t janet_parser_consume_bytes(JanetParser *parser, const uint8_t *bytes, size_t len);
 JANET_API enum JanetParserStatus janet_parser_status(JanetParser *parser);
 JANET_API Janet janet_parser_produce(JanetParser *parser);
 JANET_API Janet janet_parser_produce_wrapped(JanetParser *parser);
@@ -1377,6 +1465,7 @@ JANET_API const char *janet_parser_error(JanetParser *parser);
 JANET_API void janet_parser_flush(JanetParser *parser);
 JANET_API void janet_parser_eof(JanetParser *parser);
 JANET_API int janet_parser_has_more(JanetParser *parser);
+JANET_API const char *janet_parse_data(const uint8_t *bytes, int32_t len, JanetArray *out);
 
 /* Assembly */
 #ifdef JANET_ASSEMBLER
@@ -1449,6 +1538,8 @@ JANET_API Janet janet_array_peek(JanetArray *array);
 JANET_API JanetBuffer *janet_buffer(int32_t capacity);
 JANET_API JanetBuffer *janet_buffer_init(JanetBuffer *buffer, int32_t capacity);
 JANET_API void janet_buffer_deinit(JanetBuffer *buffer);
+JANET_API JanetBuffer *janet_buffer_pooled(int32_t capacity);
+JANET_API void janet_buffer_release(JanetBuffer *buffer);
 JANET_API void janet_buffer_ensure(JanetBuffer *buffer, int32_t capacity, int32_t growth);
 JANET_API void janet_buffer_setcount(JanetBuffer *buffer, int32_t count);
 JANET_API void janet_buffer_extra(JanetBuffer *buffer, int32_t n);
@@ -1535,8 +1626,10 @@ JANET_API JanetStruct janet_table_to_struct(JanetTable *t);
 JANET_API void janet_table_merge_table(JanetTable *table, JanetTable *other);
 JANET_API void janet_table_merge_struct(JanetTable *table, JanetStruct other);
 JANET_API JanetKV *janet_table_find(JanetTable *t, Janet key);
+JANET_API JanetKV *janet_table_next(JanetTable *t, const JanetKV *kv);
 JANET_API JanetTable *janet_table_clone(JanetTable *table);
 JANET_API void janet_table_clear(JanetTable *table);
+JANET_API void janet_table_reserve(JanetTable *t, int32_t count);
 
 /* Fiber */
 JANET_API JanetFiber *janet_fiber(JanetFunction *callee, int32_t capacity, int32_t argc, const Janet *argv);
@@ -1544,6 +1637,9 @@ JANET_API JanetFiber *janet_fiber_reset(JanetFiber *fiber, JanetFunction *callee
 JANET_API JanetFiberStatus janet_fiber_status(JanetFiber *fiber);
 JANET_API JanetFiber *janet_current_fiber(void);
 JANET_API JanetFiber *janet_root_fiber(void);
+JANET_API int32_t janet_fiber_local_key(Janet key);
+JANET_API Janet janet_fiber_local(JanetFiber *fiber, int32_t index);
+JANET_API void janet_fiber_setlocal(JanetFiber *fiber, int32_t index, Janet value);
 
 /* Treat similar types through uniform interfaces for iteration */
 JANET_API int janet_indexed_view(Janet seq, const Janet **data, int32_t *len);
@@ -1568,6 +1664,11 @@ JANET_API JanetModule janet_native(const char *name, JanetString *error);
 
 /* Marshaling */
 #define JANET_MARSHAL_UNSAFE 0x20000
+#define JANET_MARSHAL_MAPPABLE 0x40000
+#define JANET_MARSHAL_BORROW 0x80000
+#define JANET_MARSHAL_LAZY 0x100000
+#define JANET_MARSHAL_STRIP 0x200000
+#define JANET_MARSHAL_TRUSTED 0x400000
 
 JANET_API void janet_marshal(
     JanetBuffer *buf,
@@ -1580,6 +1681,11 @@ JANET_API Janet janet_unmarshal(
     int flags,
     JanetTable *reg,
     const uint8_t **next);
+JANET_API Janet janet_unmarshal_file(const char *path, JanetTable *reg);
+typedef struct JanetMarshaler JanetMarshaler;
+JANET_API JanetMarshaler *janet_marshaler(JanetTable *rreg, JanetTable *reg, int flags);
+JANET_API void janet_marshaler_marshal(JanetMarshaler *m, JanetBuffer *buf, Janet x);
+JANET_API Janet janet_marshaler_unmarshal(JanetMarshaler *m, const uint8_t *bytes, size_t len, const uint8_t **next);
 JANET_API JanetTable *janet_env_lookup(JanetTable *env);
 JANET_API void janet_env_lookup_into(JanetTable *renv, JanetTable *env, const char *prefix, int recurse);
 
@@ -1594,6 +1700,7 @@ JANET_API int janet_gcunrootall(Janet root);
 JANET_API int janet_gclock(void);
 JANET_API void janet_gcunlock(int handle);
 JANET_API void janet_gcpressure(size_t s);
+JANET_API void janet_gc_write_barrier(void *mem);
 
 /* Functions */
 JANET_API JanetFuncDef *janet_funcdef_alloc(void);
@@ -1646,6 +1753,10 @@ JANET_API JanetSignal janet_pcall(JanetFunction *fun, int32_t argn, const Janet
 JANET_API JanetSignal janet_step(JanetFiber *fiber, Janet in, Janet *out);
 JANET_API Janet janet_call(JanetFunction *fun, int32_t argc, const Janet *argv);
 JANET_API Janet janet_mcall(const char *name, int32_t argc, Janet *argv);
+JANET_API void janet_call_prepare(JanetCallContext *ctx, JanetFunction *fun);
+JANET_API JanetSignal janet_call_invoke(JanetCallContext *ctx, int32_t argc, const Janet *argv, Janet *out);
+JANET_API JanetSignal janet_call_batch(JanetCallContext *ctx, int32_t count, const Janet *args, JanetArray *results, Janet *out);
+JANET_API void janet_call_finish(JanetCallContext *ctx);
 JANET_API void janet_stacktrace(JanetFiber *fiber, Janet err);
 
 /* Scratch Memory API */
@@ -1779,6 +1890,7 @@ extern JANET_API const JanetAbstractType janet_file_type;
 #define JANET_FILE_SERIALIZABLE 128
 #define JANET_FILE_PIPED 256
 #define JANET_FILE_NONIL 512
+#define JANET_FILE_BUSY 1024
 
 JANET_API Janet janet_makefile(FILE *f, int32_t flags);
 JANET_API JanetFile *janet_makejfile(FILE *f, int32_t flags);
@@ -1815,6 +1927,7 @@ JANET_API const JanetAbstractType *janet_get_abstract_type(Janet key);
 #ifdef JANET_PEG
 
 extern JANET_API const JanetAbstractType janet_peg_type;
+extern JANET_API const JanetAbstractType janet_peg_matcher_type;
 
 /* opcodes for peg vm */
 typedef enum {
@@ -1824,7 +1937,7 @@ typedef enum {
     RULE_RANGE,        /* [lo | hi << 16 (1 word)] */
     RULE_SET,          /* [bitmap (8 words)] */
     RULE_LOOK,         /* [offset, rule] */
-    RULE_CHOICE,       /* [len, rules...] */
+    RULE_CHOICE,       /* [len, rules..., guards...] */
     RULE_SEQUENCE,     /* [len, rules...] */
     RULE_IF,           /* [rule_a, rule_b (b if a)] */
     RULE_IFNOT,        /* [rule_a, rule_b (b if not a)] */
@@ -1842,13 +1955,14 @@ typedef enum {
     RULE_ERROR,        /* [rule] */
     RULE_DROP,         /* [rule] */
     RULE_BACKMATCH,    /* [tag] */
-    RULE_TO,           /* [rule] */
-    RULE_THRU,         /* [rule] */
+    RULE_TO,           /* [rule, guard, guard_byte] */
+    RULE_THRU,         /* [rule, guard, guard_byte] */
     RULE_LENPREFIX,    /* [rule_a, rule_b (repeat rule_b rule_a times)] */
     RULE_READINT,      /* [(signedness << 4) | (endianess << 5) | bytewidth, tag] */
     RULE_LINE,         /* [tag] */
     RULE_COLUMN,       /* [tag] */
-    RULE_UNREF         /* [rule, tag] */
+    RULE_UNREF,        /* [rule, tag] */
+    RULE_SPAN          /* [rule, tag] */
 } JanetPegOpcod;
 
 typedef struct {
@@ -1857,10 +1971,56 @@ typedef struct {
     size_t bytecode_len;
     uint32_t num_constants;
     int has_backref;
+    void *threaded;
 } JanetPeg;
 
 #endif
 
+#ifdef JANET_TYPED_ARRAY
+
+typedef enum {
+    JANET_TARRAY_TYPE_U8,
+    JANET_TARRAY_TYPE_S8,
+    JANET_TARRAY_TYPE_U16,
+    JANET_TARRAY_TYPE_S16,
+    JANET_TARRAY_TYPE_U32,
+    JANET_TARRAY_TYPE_S32,
+    JANET_TARRAY_TYPE_U64,
+    JANET_TARRAY_TYPE_S64,
+    JANET_TARRAY_TYPE_F32,
+    JANET_TARRAY_TYPE_F64
+} JanetTArrayType;
+
+/* Matches any element type in janet_is_tarray_view and janet_gettarray_view */
+#define JANET_TARRAY_TYPE_ANY ((JanetTArrayType) -1)
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} JanetTArrayBuffer;
+
+typedef struct {
+    union {
+        void *pointer;
+        uint8_t *u8;
+        int8_t *s8;
+        uint16_t *u16;
+        int16_t *s16;
+        uint32_t *u32;
+        int32_t *s32;
+        uint64_t *u64;
+        int64_t *s64;
+        float *f32;
+        double *f64;
+    } as;
+    JanetTArrayBuffer *buffer;
+    size_t size;
+    size_t stride;
+    JanetTArrayType type;
+} JanetTArrayView;
+
+#endif
+
 #ifdef JANET_INT_TYPES
 
 extern JANET_API const JanetAbstractType janet_s64_type;
@@ -1882,6 +2042,20 @@ JANET_API int janet_scan_uint64(const uint8_t *str, int32_t len, uint64_t *out);
 
 #endif
 
+#ifdef JANET_TYPED_ARRAY
+
+extern JANET_API const JanetAbstractType janet_ta_buffer_type;
+extern JANET_API const JanetAbstractType janet_ta_view_type;
+
+JANET_API JanetTArrayBuffer *janet_tarray_buffer(size_t size);
+JANET_API JanetTArrayView *janet_tarray_view(JanetTArrayType type, size_t size, size_t stride, size_t offset, JanetTArrayBuffer *buffer);
+JANET_API int janet_is_tarray_view(Janet x, JanetTArrayType type);
+JANET_API JanetTArrayBuffer *janet_gettarray_buffer(const Janet *argv, int32_t n);
+JANET_API JanetTArrayView *janet_gettarray_view(const Janet *argv, int32_t n, JanetTArrayType type);
+JANET_API JanetTArrayView *janet_gettarray_any(const Janet *argv, int32_t n);
+
+#endif
+
 #ifdef JANET_THREADS
 
 extern JANET_API const JanetAbstractType janet_thread_type;
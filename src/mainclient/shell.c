@@ -141,6 +141,8 @@ static JANET_THREAD_LOCAL struct termios gbl_termios_start;
 static JANET_THREAD_LOCAL JanetByteView gbl_matches[JANET_MATCH_MAX];
 static JANET_THREAD_LOCAL int gbl_match_count = 0;
 static JANET_THREAD_LOCAL int gbl_lines_below = 0;
+static JANET_THREAD_LOCAL JanetArray *gbl_symindex = NULL;
+static JANET_THREAD_LOCAL uint64_t gbl_symindex_stamp = 0;
 
 /* Unsupported terminal list from linenoise */
 static const char *badterms[] = {
@@ -629,17 +631,77 @@ static void doc_format(JanetString doc, int32_t width) {
     }
 }
 
-static void find_matches(JanetByteView prefix) {
-    JanetTable *env = gbl_complete_env;
-    gbl_match_count = 0;
+/* Summarize the tables in an env chain, so we can tell when
+ * bindings were added or removed. */
+static uint64_t env_stamp(JanetTable *env) {
+    uint64_t stamp = 0;
     while (NULL != env) {
+        stamp = stamp * 31 + (uint64_t)(uintptr_t) env;
+        stamp = stamp * 31 + (uint64_t) env->count;
+        stamp = stamp * 31 + (uint64_t) env->deleted;
+        stamp = stamp * 31 + (uint64_t) env->capacity;
+        env = env->proto;
+    }
+    return stamp;
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    return janet_string_compare(janet_unwrap_symbol(*(const Janet *) a),
+                                janet_unwrap_symbol(*(const Janet *) b));
+}
+
+/* Keep a sorted list of all symbols in the completion env and its
+ * prototypes, so completion is a binary search instead of a scan of
+ * every binding. Rebuilt only when the env changes. */
+static void build_symindex(void) {
+    uint64_t stamp = env_stamp(gbl_complete_env);
+    if (NULL != gbl_symindex && stamp == gbl_symindex_stamp) return;
+    if (NULL == gbl_symindex) {
+        gbl_symindex = janet_array(0);
+        janet_gcroot(janet_wrap_array(gbl_symindex));
+    }
+    gbl_symindex->count = 0;
+    for (JanetTable *env = gbl_complete_env; NULL != env; env = env->proto) {
         JanetKV *kvend = env->data + env->capacity;
         for (JanetKV *kv = env->data; kv < kvend; kv++) {
             if (!janet_checktype(kv->key, JANET_SYMBOL)) continue;
-            const uint8_t *sym = janet_unwrap_symbol(kv->key);
-            check_match(prefix, sym, janet_string_length(sym));
+            janet_array_push(gbl_symindex, kv->key);
         }
-        env = env->proto;
+    }
+    Janet *syms = gbl_symindex->data;
+    int32_t n = gbl_symindex->count;
+    if (n) qsort(syms, (size_t) n, sizeof(Janet), compare_symbols);
+    /* Symbols are interned, so shadowed bindings are identical */
+    int32_t unique = 0;
+    for (int32_t i = 0; i < n; i++) {
+        if (unique && janet_unwrap_symbol(syms[unique - 1]) == janet_unwrap_symbol(syms[i])) continue;
+        syms[unique++] = syms[i];
+    }
+    gbl_symindex->count = unique;
+    gbl_symindex_stamp = stamp;
+}
+
+static void find_matches(JanetByteView prefix) {
+    gbl_match_count = 0;
+    build_symindex();
+    const Janet *syms = gbl_symindex->data;
+    int32_t lo = 0, hi = gbl_symindex->count;
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        const uint8_t *sym = janet_unwrap_symbol(syms[mid]);
+        int32_t len = janet_string_length(sym);
+        int cmp = memcmp(sym, prefix.bytes, len < prefix.len ? len : prefix.len);
+        if (cmp < 0 || (cmp == 0 && len < prefix.len)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (int32_t i = lo; i < gbl_symindex->count && gbl_match_count < JANET_MATCH_MAX; i++) {
+        const uint8_t *sym = janet_unwrap_symbol(syms[i]);
+        int32_t len = janet_string_length(sym);
+        if (len < prefix.len || memcmp(sym, prefix.bytes, prefix.len)) break;
+        check_match(prefix, sym, len);
     }
 }
 
@@ -936,6 +998,8 @@ void janet_line_deinit() {
     for (i = 0; i < gbl_history_count; i++)
         janet_free(gbl_history[i]);
     gbl_historyi = 0;
+    /* The VM that owned the symbol index is gone */
+    gbl_symindex = NULL;
 }
 
 static int checktermsupport() {